@@ -0,0 +1,895 @@
+#include "a64emu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    OP_UNDEF,
+    OP_NOP,
+    OP_BRK,
+    OP_ADR,           // imm = result
+    OP_ADDSUB_IMM,    // kind 1 = SUB
+    OP_ADDSUB_REG,    // shifted register
+    OP_ADDSUB_EXT,    // extended register
+    OP_ADC,           // kind 1 = SBC
+    OP_LOGIC_IMM,     // kind = opc, imm2 = mask
+    OP_LOGIC_REG,     // kind = opc | N << 2
+    OP_MOVW,          // kind = opc, amount = shift
+    OP_BFM,           // kind = opc, amount = immr, imm = imms
+    OP_EXTR,          // amount = lsb
+    OP_DP1,           // kind = opcode
+    OP_DP2,           // kind = opcode
+    OP_DP3,           // kind = op31 << 1 | o0
+    OP_CSEL,          // kind = op << 1 | op2
+    OP_CCMP,          // kind 1 = CCMP, amount 1 = immediate form, imm2 = nzcv
+    OP_B,             // imm = target
+    OP_BL,
+    OP_BCOND,
+    OP_CBZ,           // kind 1 = CBNZ
+    OP_TBZ,           // kind 1 = TBNZ, amount = bit
+    OP_BR,
+    OP_BLR,
+    OP_RET,
+    OP_LDST_IMM,      // kind = opc, shift = writeback (0, 1 pre, 2 post)
+    OP_LDST_REG,      // kind = opc, shift = extend option, amount = scale
+    OP_LDP,           // kind = L | opc << 1, shift = writeback
+    OP_LDR_LIT,       // kind = opc, imm = address
+};
+
+int a64_init(struct a64_emu *e, size_t cache_entries) {
+    memset(e, 0, sizeof(*e));
+    size_t n = 1;
+    if (cache_entries == 0) cache_entries = 4096;
+    while (n < cache_entries) n <<= 1;
+    e->cache = calloc(n, sizeof(*e->cache));
+    if (!e->cache) return -1;
+    e->cache_mask = n - 1;
+    return 0;
+}
+
+void a64_free(struct a64_emu *e) {
+    free(e->cache);
+    memset(e, 0, sizeof(*e));
+}
+
+void a64_flush(struct a64_emu *e) {
+    memset(e->cache, 0, (e->cache_mask + 1) * sizeof(*e->cache));
+}
+
+int a64_map(struct a64_emu *e, const void *p, size_t len, unsigned perm) {
+    if (e->nregions == A64_MAX_REGIONS || len == 0) return -1;
+    struct a64_region *r = &e->regions[e->nregions++];
+    r->lo = (uint64_t)(uintptr_t)p;
+    r->hi = r->lo + len;
+    r->perm = perm;
+    return 0;
+}
+
+int a64_unmap(struct a64_emu *e, const void *p) {
+    uint64_t lo = (uint64_t)(uintptr_t)p;
+    for (size_t i = 0; i < e->nregions; i++) {
+        if (e->regions[i].lo != lo) continue;
+        uint64_t hi = e->regions[i].hi;
+        memmove(&e->regions[i], &e->regions[i + 1], (e->nregions - i - 1) * sizeof(e->regions[0]));
+        e->nregions--;
+        // Only entries for PCs in the range can hold its instructions.
+        for (uint64_t pc = lo & ~3ull, n = 0; pc < hi && n <= e->cache_mask; pc += 4, n++) {
+            struct a64_insn *d = &e->cache[(pc >> 2) & e->cache_mask];
+            if (d->pc >= lo && d->pc < hi) memset(d, 0, sizeof(*d));
+        }
+        return 0;
+    }
+    return -1;
+}
+
+void a64_unmap_all(struct a64_emu *e) {
+    e->nregions = 0;
+    a64_flush(e);
+}
+
+int a64_host(struct a64_emu *e, uint64_t addr, a64_host_fn fn, void *ctx) {
+    if (e->nhosts == A64_MAX_HOSTS) return -1;
+    e->hosts[e->nhosts].addr = addr;
+    e->hosts[e->nhosts].fn = fn;
+    e->hosts[e->nhosts].ctx = ctx;
+    e->nhosts++;
+    return 0;
+}
+
+const char *a64_status_name(enum a64_status s) {
+    switch (s) {
+        case A64_OK: return "ok";
+        case A64_FAULT: return "fault";
+        case A64_UNDEF: return "undefined instruction";
+        case A64_BRK: return "brk";
+        case A64_LIMIT: return "step limit";
+        case A64_HOST: return "host function failed";
+    }
+    return "?";
+}
+
+static int64_t sext(uint64_t v, unsigned bits) {
+    uint64_t m = 1ull << (bits - 1);
+    v &= bits == 64 ? ~0ull : (1ull << bits) - 1;
+    return (int64_t)((v ^ m) - m);
+}
+
+static uint64_t ones(unsigned n) {
+    return n >= 64 ? ~0ull : (1ull << n) - 1;
+}
+
+// DecodeBitMasks for logical immediates (wmask only). Returns 0 for the
+// reserved encodings.
+static int bit_mask(unsigned n, unsigned imms, unsigned immr, int sf, uint64_t *out) {
+    unsigned v = (n << 6) | (~imms & 0x3f);
+    int len = -1;
+    for (int i = 6; i >= 0; i--) {
+        if (v & (1u << i)) {
+            len = i;
+            break;
+        }
+    }
+    if (len < 1 || (!sf && n)) return 0;
+    unsigned size = 1u << len;
+    unsigned levels = size - 1;
+    unsigned s = imms & levels;
+    unsigned r = immr & levels;
+    if (s == levels) return 0;
+    uint64_t elem = ones(s + 1);
+    if (r) elem = ((elem >> r) | (elem << (size - r))) & ones(size);
+    uint64_t m = 0;
+    for (unsigned i = 0; i < 64; i += size) m |= elem << i;
+    *out = sf ? m : (uint32_t)m;
+    return 1;
+}
+
+static void decode(uint64_t pc, uint32_t raw, struct a64_insn *d) {
+    memset(d, 0, sizeof(*d));
+    d->pc = pc;
+    d->raw = raw;
+    d->rd = raw & 31;
+    d->rn = (raw >> 5) & 31;
+    d->rm = (raw >> 16) & 31;
+    d->ra = (raw >> 10) & 31;
+    d->sf = raw >> 31;
+    d->op = OP_UNDEF;
+    unsigned op0 = (raw >> 25) & 15;
+
+    if ((op0 & 14) == 8) {
+        // Data processing, immediate.
+        unsigned op1 = (raw >> 23) & 7;
+        d->flags = (raw >> 29) & 1;
+        switch (op1) {
+            case 0:
+            case 1: {
+                int64_t imm = sext(((raw >> 5) & 0x7ffff) << 2 | ((raw >> 29) & 3), 21);
+                d->op = OP_ADR;
+                d->flags = 0;
+                d->imm = (raw >> 31) ? (int64_t)((pc & ~0xfffull) + ((uint64_t)imm << 12))
+                                     : (int64_t)(pc + (uint64_t)imm);
+                break;
+            }
+            case 2:
+                d->op = OP_ADDSUB_IMM;
+                d->kind = (raw >> 30) & 1;
+                d->imm = (int64_t)((raw >> 10) & 0xfff) << ((raw >> 22) & 1 ? 12 : 0);
+                break;
+            case 4: {
+                uint64_t m;
+                if (!bit_mask((raw >> 22) & 1, (raw >> 10) & 0x3f, (raw >> 16) & 0x3f, d->sf, &m)) {
+                    break;
+                }
+                d->op = OP_LOGIC_IMM;
+                d->kind = (raw >> 29) & 3;
+                d->imm2 = m;
+                break;
+            }
+            case 5: {
+                unsigned opc = (raw >> 29) & 3;
+                unsigned hw = (raw >> 21) & 3;
+                if (opc == 1 || (!d->sf && hw > 1)) break;
+                d->op = OP_MOVW;
+                d->kind = (uint8_t)opc;
+                d->amount = (uint8_t)(hw * 16);
+                d->imm = (raw >> 5) & 0xffff;
+                d->flags = 0;
+                break;
+            }
+            case 6: {
+                unsigned opc = (raw >> 29) & 3;
+                unsigned n = (raw >> 22) & 1;
+                if (opc == 3 || n != d->sf) break;
+                d->op = OP_BFM;
+                d->kind = (uint8_t)opc;
+                d->amount = (raw >> 16) & 0x3f;
+                d->imm = (raw >> 10) & 0x3f;
+                d->flags = 0;
+                if (!d->sf && (d->amount > 31 || d->imm > 31)) d->op = OP_UNDEF;
+                break;
+            }
+            case 7:
+                if (((raw >> 29) & 3) != 0 || ((raw >> 22) & 1) != d->sf || ((raw >> 21) & 1)) break;
+                d->op = OP_EXTR;
+                d->amount = (raw >> 10) & 0x3f;
+                if (!d->sf && d->amount > 31) d->op = OP_UNDEF;
+                break;
+        }
+        return;
+    }
+
+    if ((op0 & 14) == 10) {
+        // Branches, exception generation, system.
+        if ((raw & 0x7c000000) == 0x14000000) {
+            d->op = (raw >> 31) ? OP_BL : OP_B;
+            d->imm = (int64_t)(pc + (uint64_t)(sext(raw & 0x3ffffff, 26) * 4));
+        } else if ((raw & 0xff000010) == 0x54000000) {
+            d->op = OP_BCOND;
+            d->cond = raw & 15;
+            d->imm = (int64_t)(pc + (uint64_t)(sext((raw >> 5) & 0x7ffff, 19) * 4));
+        } else if ((raw & 0x7e000000) == 0x34000000) {
+            d->op = OP_CBZ;
+            d->kind = (raw >> 24) & 1;
+            d->imm = (int64_t)(pc + (uint64_t)(sext((raw >> 5) & 0x7ffff, 19) * 4));
+        } else if ((raw & 0x7e000000) == 0x36000000) {
+            d->op = OP_TBZ;
+            d->kind = (raw >> 24) & 1;
+            d->amount = (uint8_t)(((raw >> 31) << 5) | ((raw >> 19) & 31));
+            d->imm = (int64_t)(pc + (uint64_t)(sext((raw >> 5) & 0x3fff, 14) * 4));
+        } else if ((raw & 0xfffffc1f) == 0xd61f0000) {
+            d->op = OP_BR;
+        } else if ((raw & 0xfffffc1f) == 0xd63f0000) {
+            d->op = OP_BLR;
+        } else if ((raw & 0xfffffc1f) == 0xd65f0000) {
+            d->op = OP_RET;
+        } else if (raw == 0xd65f0bff || raw == 0xd65f0fff) {
+            // RETAA, RETAB: pointers are never signed here.
+            d->op = OP_RET;
+            d->rn = 30;
+        } else if ((raw & 0xfffff01f) == 0xd503201f || (raw & 0xfffff01f) == 0xd503301f) {
+            // Hints (NOP, PACIASP, AUTIASP, BTI, ...) and barriers.
+            d->op = OP_NOP;
+        } else if ((raw & 0xffe0001f) == 0xd4200000) {
+            d->op = OP_BRK;
+            d->imm = (raw >> 5) & 0xffff;
+        }
+        return;
+    }
+
+    if ((op0 & 5) == 4) {
+        // Loads and stores of general registers (V, bit 26, clear).
+        if (raw & (1u << 26)) return;
+        if ((raw & 0x3b000000) == 0x18000000) {
+            unsigned opc = raw >> 30;
+            d->op = opc == 3 ? OP_NOP : OP_LDR_LIT;
+            d->kind = (uint8_t)opc;
+            d->imm = (int64_t)(pc + (uint64_t)(sext((raw >> 5) & 0x7ffff, 19) * 4));
+            return;
+        }
+        if ((raw & 0x3a000000) == 0x28000000) {
+            unsigned opc = raw >> 30;
+            unsigned l = (raw >> 22) & 1;
+            unsigned mode = (raw >> 23) & 3;
+            if (opc == 3 || (opc == 1 && !l)) return;
+            d->op = OP_LDP;
+            d->kind = (uint8_t)(l | opc << 1);
+            d->size = opc == 2 ? 3 : 2;
+            d->imm = sext((raw >> 15) & 0x7f, 7) * (1 << d->size);
+            d->shift = mode == 1 ? 2 : mode == 3 ? 1 : 0;
+            return;
+        }
+        if ((raw & 0x3a000000) == 0x38000000) {
+            unsigned size = raw >> 30;
+            unsigned opc = (raw >> 22) & 3;
+            d->size = (uint8_t)size;
+            d->kind = (uint8_t)opc;
+            if (size == 3 && opc == 2) {
+                d->op = OP_NOP;     // PRFM
+                return;
+            }
+            if ((size == 3 && opc == 3) || (size == 2 && opc == 3)) return;
+            if (raw & (1u << 24)) {
+                d->op = OP_LDST_IMM;
+                d->imm = (int64_t)(((raw >> 10) & 0xfff) << size);
+                return;
+            }
+            if (raw & (1u << 21)) {
+                if (((raw >> 10) & 3) != 2 || !((raw >> 14) & 1)) return;
+                d->op = OP_LDST_REG;
+                d->shift = (raw >> 13) & 7;
+                d->amount = (raw >> 12) & 1 ? (uint8_t)size : 0;
+                return;
+            }
+            unsigned mode = (raw >> 10) & 3;
+            d->op = OP_LDST_IMM;
+            d->imm = sext((raw >> 12) & 0x1ff, 9);
+            d->shift = mode == 1 ? 2 : mode == 3 ? 1 : 0;
+            return;
+        }
+        return;
+    }
+
+    if ((op0 & 7) == 5) {
+        // Data processing, register.
+        d->flags = (raw >> 29) & 1;
+        d->shift = (raw >> 22) & 3;
+        d->amount = (raw >> 10) & 0x3f;
+        if ((raw & 0x1f000000) == 0x0a000000) {
+            if (!d->sf && d->amount > 31) return;
+            d->op = OP_LOGIC_REG;
+            d->kind = (uint8_t)(((raw >> 29) & 3) | ((raw >> 21) & 1) << 2);
+            d->flags = ((raw >> 29) & 3) == 3;
+        } else if ((raw & 0x1f200000) == 0x0b000000) {
+            if (d->shift == 3 || (!d->sf && d->amount > 31)) return;
+            d->op = OP_ADDSUB_REG;
+            d->kind = (raw >> 30) & 1;
+        } else if ((raw & 0x1f200000) == 0x0b200000) {
+            if (d->shift != 0 || ((raw >> 10) & 7) > 4) return;
+            d->op = OP_ADDSUB_EXT;
+            d->kind = (raw >> 30) & 1;
+            d->shift = (raw >> 13) & 7;
+            d->amount = (raw >> 10) & 7;
+        } else if ((raw & 0x1fe0fc00) == 0x1a000000) {
+            d->op = OP_ADC;
+            d->kind = (raw >> 30) & 1;
+        } else if ((raw & 0x1fe00000) == 0x1a400000) {
+            if (!d->flags || ((raw >> 10) & 1) || ((raw >> 4) & 1)) return;
+            d->op = OP_CCMP;
+            d->kind = (raw >> 30) & 1;
+            d->cond = (raw >> 12) & 15;
+            d->amount = (raw >> 11) & 1;
+            d->imm = d->rm;
+            d->imm2 = raw & 15;
+            d->flags = 0;
+        } else if ((raw & 0x1fe00000) == 0x1a800000) {
+            if (d->flags || ((raw >> 11) & 1)) return;
+            d->op = OP_CSEL;
+            d->kind = (uint8_t)(((raw >> 30) & 1) << 1 | ((raw >> 10) & 1));
+            d->cond = (raw >> 12) & 15;
+        } else if ((raw & 0x5fe00000) == 0x1ac00000) {
+            unsigned opcode = (raw >> 10) & 0x3f;
+            if (opcode != 2 && opcode != 3 && (opcode < 8 || opcode > 11)) return;
+            d->op = OP_DP2;
+            d->kind = (uint8_t)opcode;
+            d->flags = 0;
+        } else if ((raw & 0x5fe00000) == 0x5ac00000) {
+            unsigned opcode = (raw >> 10) & 0x3f;
+            if (((raw >> 16) & 31) != 0 || opcode > 5 || (opcode == 3 && !d->sf)) return;
+            d->op = OP_DP1;
+            d->kind = (uint8_t)opcode;
+            d->flags = 0;
+        } else if ((raw & 0x1f000000) == 0x1b000000) {
+            unsigned op31 = (raw >> 21) & 7;
+            unsigned o0 = (raw >> 15) & 1;
+            unsigned k = op31 << 1 | o0;
+            // MADD, MSUB, SMADDL, SMSUBL, SMULH, UMADDL, UMSUBL, UMULH.
+            if (k != 0 && k != 1 && k != 2 && k != 3 && k != 4 && k != 10 && k != 11 && k != 12) {
+                return;
+            }
+            if (k > 1 && !d->sf) return;
+            d->op = OP_DP3;
+            d->kind = (uint8_t)k;
+            d->flags = 0;
+        }
+        return;
+    }
+}
+
+static uint64_t xr(const struct a64_cpu *c, unsigned r) {
+    return r == 31 ? 0 : c->x[r];
+}
+
+static uint64_t xsp(const struct a64_cpu *c, unsigned r) {
+    return r == 31 ? c->sp : c->x[r];
+}
+
+static void wr(struct a64_cpu *c, unsigned r, uint64_t v, int sf) {
+    if (r != 31) c->x[r] = sf ? v : (uint32_t)v;
+}
+
+static void wsp(struct a64_cpu *c, unsigned r, uint64_t v, int sf) {
+    if (!sf) v = (uint32_t)v;
+    if (r == 31) c->sp = v;
+    else c->x[r] = v;
+}
+
+static uint64_t shift_val(uint64_t v, unsigned type, unsigned amt, int sf) {
+    unsigned width = sf ? 64 : 32;
+    if (!sf) v = (uint32_t)v;
+    if (amt == 0) return v;
+    switch (type) {
+        case 0: v <<= amt; break;
+        case 1: v >>= amt; break;
+        case 2: v = (uint64_t)(sext(v, width) >> amt); break;
+        default: v = (v >> amt) | (v << (width - amt)); break;
+    }
+    return sf ? v : (uint32_t)v;
+}
+
+static uint64_t extend_val(uint64_t v, unsigned option, unsigned amt) {
+    switch (option) {
+        case 0: v = (uint8_t)v; break;
+        case 1: v = (uint16_t)v; break;
+        case 2: v = (uint32_t)v; break;
+        case 4: v = (uint64_t)sext(v, 8); break;
+        case 5: v = (uint64_t)sext(v, 16); break;
+        case 6: v = (uint64_t)sext(v, 32); break;
+        default: break;
+    }
+    return v << amt;
+}
+
+static uint64_t add_carry(uint64_t x, uint64_t y, unsigned carry, int sf, uint32_t *nzcv) {
+    if (!sf) {
+        uint32_t a = (uint32_t)x;
+        uint32_t b = (uint32_t)y;
+        uint64_t wide = (uint64_t)a + b + carry;
+        uint32_t r = (uint32_t)wide;
+        if (nzcv) {
+            *nzcv = (r >> 31) << 3 | (uint32_t)(r == 0) << 2 | (uint32_t)(wide >> 32) << 1 |
+                    (((~(a ^ b) & (a ^ r)) >> 31) & 1);
+        }
+        return r;
+    }
+    uint64_t r = x + y + carry;
+    if (nzcv) {
+        unsigned c = r < x || (carry && r == x);
+        *nzcv = (uint32_t)(r >> 63) << 3 | (uint32_t)(r == 0) << 2 | c << 1 |
+                (uint32_t)(((~(x ^ y) & (x ^ r)) >> 63) & 1);
+    }
+    return r;
+}
+
+static void logic_flags(struct a64_cpu *c, uint64_t r, int sf) {
+    unsigned n = sf ? (unsigned)(r >> 63) : (unsigned)((r >> 31) & 1);
+    c->nzcv = n << 3 | (uint32_t)(r == 0) << 2;
+}
+
+static int cond_holds(unsigned cond, uint32_t nzcv) {
+    unsigned n = (nzcv >> 3) & 1;
+    unsigned z = (nzcv >> 2) & 1;
+    unsigned c = (nzcv >> 1) & 1;
+    unsigned v = nzcv & 1;
+    int r;
+    switch (cond >> 1) {
+        case 0: r = z; break;
+        case 1: r = c; break;
+        case 2: r = n; break;
+        case 3: r = v; break;
+        case 4: r = c && !z; break;
+        case 5: r = n == v; break;
+        case 6: r = n == v && !z; break;
+        default: r = 1; break;
+    }
+    if ((cond & 1) && cond != 15) r = !r;
+    return r;
+}
+
+static uint64_t mulhu(uint64_t a, uint64_t b) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t p0 = a_lo * b_lo;
+    uint64_t p1 = a_lo * b_hi;
+    uint64_t p2 = a_hi * b_lo;
+    uint64_t p3 = a_hi * b_hi;
+    uint64_t mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+    return p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+}
+
+static uint64_t mulhs(uint64_t a, uint64_t b) {
+    uint64_t h = mulhu(a, b);
+    if ((int64_t)a < 0) h -= b;
+    if ((int64_t)b < 0) h -= a;
+    return h;
+}
+
+static uint64_t dp1(unsigned kind, uint64_t v, int sf) {
+    unsigned width = sf ? 64 : 32;
+    uint64_t r = 0;
+    switch (kind) {
+        case 0:
+            for (unsigned i = 0; i < width; i++) r |= ((v >> i) & 1) << (width - 1 - i);
+            return r;
+        case 1:
+            // REV16: bytes swapped within each halfword.
+            return ((v & 0x00ff00ff00ff00ffull) << 8 | (v >> 8 & 0x00ff00ff00ff00ffull)) & ones(width);
+        case 2:
+        case 3: {
+            // REV (32-bit), REV32 (64-bit), REV (64-bit).
+            unsigned container = kind == 3 ? 64 : 32;
+            for (unsigned base = 0; base < width; base += container) {
+                for (unsigned b = 0; b < container; b += 8) {
+                    r |= ((v >> (base + b)) & 0xff) << (base + container - 8 - b);
+                }
+            }
+            return r;
+        }
+        case 4:
+        case 5: {
+            // CLZ, or CLS: leading bits equal to the sign bit, not counting it.
+            uint64_t x = v & ones(width);
+            unsigned top = width - 1;
+            if (kind == 5) {
+                unsigned sign = (unsigned)((x >> top) & 1);
+                unsigned n = 0;
+                for (int i = (int)top - 1; i >= 0 && ((x >> i) & 1) == sign; i--) n++;
+                return n;
+            }
+            unsigned n = 0;
+            for (int i = (int)top; i >= 0 && !((x >> i) & 1); i--) n++;
+            return n;
+        }
+    }
+    return 0;
+}
+
+static void *mem(struct a64_emu *e, uint64_t addr, unsigned len, unsigned perm) {
+    for (size_t i = 0; i < e->nregions; i++) {
+        const struct a64_region *r = &e->regions[i];
+        if (addr >= r->lo && addr < r->hi) {
+            if (len > r->hi - addr || (r->perm & perm) != perm) break;
+            return (void *)(uintptr_t)addr;
+        }
+    }
+    e->fault_addr = addr;
+    return NULL;
+}
+
+static int load(struct a64_emu *e, uint64_t addr, unsigned size, uint64_t *v) {
+    const uint8_t *p = mem(e, addr, 1u << size, A64_R);
+    if (!p) return -1;
+    switch (size) {
+        case 0: *v = *p; break;
+        case 1: { uint16_t t; memcpy(&t, p, 2); *v = t; break; }
+        case 2: { uint32_t t; memcpy(&t, p, 4); *v = t; break; }
+        default: memcpy(v, p, 8); break;
+    }
+    return 0;
+}
+
+static int store(struct a64_emu *e, uint64_t addr, unsigned size, uint64_t v) {
+    uint8_t *p = mem(e, addr, 1u << size, A64_W);
+    if (!p) return -1;
+    switch (size) {
+        case 0: *p = (uint8_t)v; break;
+        case 1: { uint16_t t = (uint16_t)v; memcpy(p, &t, 2); break; }
+        case 2: { uint32_t t = (uint32_t)v; memcpy(p, &t, 4); break; }
+        default: memcpy(p, &v, 8); break;
+    }
+    return 0;
+}
+
+// Single-register load or store at `addr`. opc: 0 store, 1 load, 2 load
+// sign-extended to 64 bits, 3 to 32 bits.
+static int ldst(struct a64_emu *e, const struct a64_insn *d, uint64_t addr) {
+    struct a64_cpu *c = &e->cpu;
+    if (d->kind == 0) return store(e, addr, d->size, xr(c, d->rd));
+    uint64_t v;
+    if (load(e, addr, d->size, &v) != 0) return -1;
+    if (d->kind == 1) {
+        wr(c, d->rd, v, 1);
+    } else {
+        int64_t s = sext(v, 8u << d->size);
+        wr(c, d->rd, (uint64_t)s, d->kind == 2);
+    }
+    return 0;
+}
+
+static const struct a64_host *find_host(const struct a64_emu *e, uint64_t pc) {
+    for (size_t i = 0; i < e->nhosts; i++) {
+        if (e->hosts[i].addr == pc) return &e->hosts[i];
+    }
+    return NULL;
+}
+
+enum a64_status a64_run(struct a64_emu *e, uint64_t max_steps) {
+    struct a64_cpu *c = &e->cpu;
+    uint64_t n = 0;
+    enum a64_status st = A64_LIMIT;
+    while (n < max_steps) {
+        uint64_t pc = c->pc;
+        struct a64_insn *d = &e->cache[(pc >> 2) & e->cache_mask];
+        uint32_t word;
+        if (d->pc == pc) memcpy(&word, (const void *)(uintptr_t)pc, 4);
+        if (d->pc != pc || d->raw != word) {
+            if (pc == A64_RETURN_ADDR) {
+                st = A64_OK;
+                break;
+            }
+            const struct a64_host *h = find_host(e, pc);
+            if (h) {
+                if (h->fn(e, h->ctx) != 0) {
+                    st = A64_HOST;
+                    break;
+                }
+                c->pc = c->x[30];
+                n++;
+                continue;
+            }
+            if ((pc & 3) || !mem(e, pc, 4, A64_X)) {
+                e->fault_addr = pc;
+                st = A64_FAULT;
+                break;
+            }
+            memcpy(&word, (const void *)(uintptr_t)pc, 4);
+            decode(pc, word, d);
+            e->decodes++;
+        }
+        n++;
+        uint64_t next = pc + 4;
+        int sf = d->sf;
+        switch (d->op) {
+            case OP_NOP:
+                break;
+            case OP_BRK:
+                e->fault_insn = d->raw;
+                st = A64_BRK;
+                goto out;
+            case OP_ADR:
+                wr(c, d->rd, (uint64_t)d->imm, 1);
+                break;
+            case OP_ADDSUB_IMM: {
+                uint64_t a = xsp(c, d->rn);
+                uint64_t b = (uint64_t)d->imm;
+                uint64_t r = d->kind ? add_carry(a, ~b, 1, sf, d->flags ? &c->nzcv : NULL)
+                                     : add_carry(a, b, 0, sf, d->flags ? &c->nzcv : NULL);
+                if (d->flags) wr(c, d->rd, r, sf);
+                else wsp(c, d->rd, r, sf);
+                break;
+            }
+            case OP_ADDSUB_REG:
+            case OP_ADDSUB_EXT: {
+                int ext = d->op == OP_ADDSUB_EXT;
+                uint64_t a = ext ? xsp(c, d->rn) : xr(c, d->rn);
+                uint64_t b = ext ? extend_val(xr(c, d->rm), d->shift, d->amount)
+                                 : shift_val(xr(c, d->rm), d->shift, d->amount, sf);
+                uint64_t r = d->kind ? add_carry(a, ~b, 1, sf, d->flags ? &c->nzcv : NULL)
+                                     : add_carry(a, b, 0, sf, d->flags ? &c->nzcv : NULL);
+                if (ext && !d->flags) wsp(c, d->rd, r, sf);
+                else wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_ADC: {
+                uint64_t b = xr(c, d->rm);
+                unsigned carry = (c->nzcv >> 1) & 1;
+                uint64_t r = add_carry(xr(c, d->rn), d->kind ? ~b : b, carry, sf,
+                                       d->flags ? &c->nzcv : NULL);
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_LOGIC_IMM:
+            case OP_LOGIC_REG: {
+                uint64_t a = xr(c, d->rn);
+                uint64_t b;
+                unsigned opc = d->kind & 3;
+                if (d->op == OP_LOGIC_IMM) {
+                    b = d->imm2;
+                } else {
+                    b = shift_val(xr(c, d->rm), d->shift, d->amount, sf);
+                    if (d->kind & 4) b = ~b;
+                }
+                uint64_t r = opc == 1 ? (a | b) : opc == 2 ? (a ^ b) : (a & b);
+                if (!sf) r = (uint32_t)r;
+                if (opc == 3) logic_flags(c, r, sf);
+                if (d->op == OP_LOGIC_IMM && opc != 3) wsp(c, d->rd, r, sf);
+                else wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_MOVW: {
+                uint64_t imm = (uint64_t)d->imm << d->amount;
+                uint64_t r;
+                if (d->kind == 0) r = ~imm;
+                else if (d->kind == 2) r = imm;
+                else r = (xr(c, d->rd) & ~(0xffffull << d->amount)) | imm;
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_BFM: {
+                unsigned width = sf ? 64 : 32;
+                unsigned immr = d->amount;
+                unsigned imms = (unsigned)d->imm;
+                uint64_t src = xr(c, d->rn);
+                unsigned len;
+                unsigned pos;
+                uint64_t field;
+                if (imms >= immr) {
+                    len = imms - immr + 1;
+                    field = (src >> immr) & ones(len);
+                    pos = 0;
+                } else {
+                    len = imms + 1;
+                    field = src & ones(len);
+                    pos = width - immr;
+                }
+                uint64_t r;
+                if (d->kind == 1) {
+                    uint64_t m = ones(len) << pos;
+                    r = (xr(c, d->rd) & ~m) | ((field << pos) & m);
+                } else if (d->kind == 0) {
+                    r = (uint64_t)sext(field, len) << pos;
+                } else {
+                    r = field << pos;
+                }
+                wr(c, d->rd, r & ones(width), sf);
+                break;
+            }
+            case OP_EXTR: {
+                uint64_t lo = xr(c, d->rm);
+                uint64_t hi = xr(c, d->rn);
+                unsigned lsb = d->amount;
+                uint64_t r;
+                if (sf) {
+                    r = lsb ? (lo >> lsb) | (hi << (64 - lsb)) : lo;
+                } else {
+                    uint64_t cat = (hi & 0xffffffffull) << 32 | (uint32_t)lo;
+                    r = (uint32_t)(cat >> lsb);
+                }
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_DP1:
+                wr(c, d->rd, dp1(d->kind, xr(c, d->rn), sf), sf);
+                break;
+            case OP_DP2: {
+                uint64_t a = xr(c, d->rn);
+                uint64_t b = xr(c, d->rm);
+                unsigned width = sf ? 64 : 32;
+                uint64_t r;
+                if (!sf) {
+                    a = (uint32_t)a;
+                    b = (uint32_t)b;
+                }
+                switch (d->kind) {
+                    case 2:
+                        r = b ? a / b : 0;
+                        break;
+                    case 3: {
+                        int64_t sa = sext(a, width);
+                        int64_t sb = sext(b, width);
+                        if (sb == 0) r = 0;
+                        else if (sb == -1) r = 0 - (uint64_t)sa;
+                        else r = (uint64_t)(sa / sb);
+                        break;
+                    }
+                    default:
+                        r = shift_val(a, d->kind - 8u, (unsigned)(b % width), sf);
+                        break;
+                }
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_DP3: {
+                uint64_t a = xr(c, d->rn);
+                uint64_t b = xr(c, d->rm);
+                uint64_t acc = xr(c, d->ra);
+                uint64_t r;
+                switch (d->kind) {
+                    case 0: r = acc + a * b; break;
+                    case 1: r = acc - a * b; break;
+                    case 2: r = acc + (uint64_t)(sext(a, 32) * sext(b, 32)); break;
+                    case 3: r = acc - (uint64_t)(sext(a, 32) * sext(b, 32)); break;
+                    case 4: r = mulhs(a, b); break;
+                    case 10: r = acc + (uint64_t)(uint32_t)a * (uint32_t)b; break;
+                    case 11: r = acc - (uint64_t)(uint32_t)a * (uint32_t)b; break;
+                    default: r = mulhu(a, b); break;
+                }
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_CSEL: {
+                uint64_t r;
+                if (cond_holds(d->cond, c->nzcv)) {
+                    r = xr(c, d->rn);
+                } else {
+                    r = xr(c, d->rm);
+                    if (d->kind == 1) r += 1;
+                    else if (d->kind == 2) r = ~r;
+                    else if (d->kind == 3) r = 0 - r;
+                }
+                wr(c, d->rd, r, sf);
+                break;
+            }
+            case OP_CCMP:
+                if (cond_holds(d->cond, c->nzcv)) {
+                    uint64_t b = d->amount ? (uint64_t)d->imm : xr(c, d->rm);
+                    if (d->kind) add_carry(xr(c, d->rn), ~b, 1, sf, &c->nzcv);
+                    else add_carry(xr(c, d->rn), b, 0, sf, &c->nzcv);
+                } else {
+                    c->nzcv = (uint32_t)d->imm2;
+                }
+                break;
+            case OP_B:
+                next = (uint64_t)d->imm;
+                break;
+            case OP_BL:
+                c->x[30] = pc + 4;
+                next = (uint64_t)d->imm;
+                break;
+            case OP_BCOND:
+                if (cond_holds(d->cond, c->nzcv)) next = (uint64_t)d->imm;
+                break;
+            case OP_CBZ: {
+                uint64_t v = xr(c, d->rd);
+                if (!sf) v = (uint32_t)v;
+                if ((v == 0) != d->kind) next = (uint64_t)d->imm;
+                break;
+            }
+            case OP_TBZ:
+                if (((xr(c, d->rd) >> d->amount) & 1) == d->kind) next = (uint64_t)d->imm;
+                break;
+            case OP_BR:
+            case OP_RET:
+                next = xr(c, d->rn);
+                break;
+            case OP_BLR:
+                next = xr(c, d->rn);
+                c->x[30] = pc + 4;
+                break;
+            case OP_LDST_IMM: {
+                uint64_t base = xsp(c, d->rn);
+                uint64_t addr = d->shift == 2 ? base : base + (uint64_t)d->imm;
+                if (ldst(e, d, addr) != 0) goto fault;
+                if (d->shift) wsp(c, d->rn, base + (uint64_t)d->imm, 1);
+                break;
+            }
+            case OP_LDST_REG: {
+                uint64_t addr = xsp(c, d->rn) + extend_val(xr(c, d->rm), d->shift, d->amount);
+                if (ldst(e, d, addr) != 0) goto fault;
+                break;
+            }
+            case OP_LDP: {
+                uint64_t base = xsp(c, d->rn);
+                uint64_t addr = d->shift == 2 ? base : base + (uint64_t)d->imm;
+                unsigned step = 1u << d->size;
+                if (d->kind & 1) {
+                    uint64_t a, b;
+                    if (load(e, addr, d->size, &a) != 0 || load(e, addr + step, d->size, &b) != 0) {
+                        goto fault;
+                    }
+                    if ((d->kind >> 1) == 1) {
+                        a = (uint64_t)sext(a, 32);
+                        b = (uint64_t)sext(b, 32);
+                    }
+                    wr(c, d->rd, a, 1);
+                    wr(c, d->ra, b, 1);
+                } else if (store(e, addr, d->size, xr(c, d->rd)) != 0 ||
+                           store(e, addr + step, d->size, xr(c, d->ra)) != 0) {
+                    goto fault;
+                }
+                if (d->shift) wsp(c, d->rn, base + (uint64_t)d->imm, 1);
+                break;
+            }
+            case OP_LDR_LIT: {
+                uint64_t v;
+                unsigned size = d->kind == 1 ? 3 : 2;
+                if (load(e, (uint64_t)d->imm, size, &v) != 0) goto fault;
+                if (d->kind == 2) v = (uint64_t)sext(v, 32);
+                wr(c, d->rd, v, 1);
+                break;
+            }
+            default:
+                e->fault_addr = pc;
+                e->fault_insn = d->raw;
+                st = A64_UNDEF;
+                goto out;
+        }
+        c->pc = next;
+    }
+out:
+    e->steps += n;
+    return st;
+fault:
+    e->steps += n;
+    return A64_FAULT;
+}
+
+enum a64_status a64_call(struct a64_emu *e, uint64_t fn, const uint64_t *args, size_t nargs,
+                         uint64_t sp, uint64_t max_steps, uint64_t *ret) {
+    struct a64_cpu *c = &e->cpu;
+    for (size_t i = 0; i < 8; i++) c->x[i] = i < nargs ? args[i] : 0;
+    c->x[30] = A64_RETURN_ADDR;
+    c->sp = sp;
+    c->pc = fn;
+    enum a64_status st = a64_run(e, max_steps);
+    if (ret) *ret = c->x[0];
+    return st;
+}
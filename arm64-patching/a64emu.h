@@ -0,0 +1,144 @@
+#ifndef ARM64_A64EMU_H
+#define ARM64_A64EMU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A small AArch64 interpreter for running patched code on hosts that are
+// not arm64: the integer data-processing instructions, branches, and loads
+// and stores of general registers. FP/SIMD, atomics, exclusives and system
+// registers stop the run with A64_UNDEF. PAC and BTI hints execute as NOPs,
+// so arm64e code runs with its pointers unsigned.
+//
+// Guest addresses are host addresses. The caller registers the host memory
+// the guest may touch (code, stack, data) with a64_map; any other access
+// stops the run with A64_FAULT instead of crashing the host. This lets the
+// guest run code where patcher.c put it: a prologue patched in place, and a
+// trampoline mmap'd next to it.
+//
+// Each instruction is decoded once into a direct-mapped cache indexed by
+// PC. A hit compares the cached word with memory, so code rewritten in
+// place (arm64_hotpatch) is decoded again without an explicit flush.
+
+#define A64_R 1u
+#define A64_W 2u
+#define A64_X 4u
+
+#define A64_MAX_REGIONS 16
+#define A64_MAX_HOSTS 16
+
+// a64_call returns here: a link register value no mapping can contain.
+#define A64_RETURN_ADDR 0xfffffffffffff000ull
+
+enum a64_status {
+    A64_OK,        // returned to A64_RETURN_ADDR
+    A64_FAULT,     // load, store or fetch outside the mapped regions
+    A64_UNDEF,     // instruction outside the supported subset
+    A64_BRK,       // BRK #imm
+    A64_LIMIT,     // step budget used up
+    A64_HOST,      // a host function returned nonzero
+};
+
+struct a64_cpu {
+    uint64_t x[31];
+    uint64_t sp;
+    uint64_t pc;
+    uint32_t nzcv;  // N, Z, C, V in bits 3..0
+};
+
+struct a64_emu;
+
+// Called when the guest branches to a registered address. It sees the
+// registers (arguments in x0-x7) and returns 0 to continue at x30, as if
+// the function had returned.
+typedef int (*a64_host_fn)(struct a64_emu *e, void *ctx);
+
+struct a64_region {
+    uint64_t lo;
+    uint64_t hi;
+    unsigned perm;  // A64_R | A64_W | A64_X
+};
+
+struct a64_host {
+    uint64_t addr;
+    a64_host_fn fn;
+    void *ctx;
+};
+
+// A decoded instruction. Branch and literal targets are absolute, since
+// an entry is only used at its own PC.
+struct a64_insn {
+    uint64_t pc;
+    uint32_t raw;
+    uint8_t op;
+    uint8_t rd;
+    uint8_t rn;
+    uint8_t rm;
+    uint8_t ra;     // also Rt2
+    uint8_t sf;     // 64-bit operation
+    uint8_t flags;  // sets NZCV
+    uint8_t kind;   // per-op variant
+    uint8_t shift;  // shift or extend type
+    uint8_t amount;
+    uint8_t cond;
+    uint8_t size;   // load/store: log2 bytes
+    int64_t imm;
+    uint64_t imm2;
+};
+
+struct a64_emu {
+    struct a64_cpu cpu;
+    struct a64_region regions[A64_MAX_REGIONS];
+    size_t nregions;
+    struct a64_host hosts[A64_MAX_HOSTS];
+    size_t nhosts;
+    struct a64_insn *cache;
+    size_t cache_mask;
+    uint64_t steps;          // instructions executed, all runs
+    uint64_t decodes;        // cache misses
+    uint64_t fault_addr;     // A64_FAULT: the address; A64_UNDEF: the PC
+    uint32_t fault_insn;     // A64_UNDEF: the instruction word
+};
+
+// cache_entries is rounded up to a power of two (0 = 4096). Returns 0, or
+// -1 when out of memory.
+int a64_init(struct a64_emu *e, size_t cache_entries);
+void a64_free(struct a64_emu *e);
+
+// Let the guest access [p, p + len) with `perm`. Later regions do not
+// override earlier ones: the first match decides. Returns -1 when full.
+int a64_map(struct a64_emu *e, const void *p, size_t len, unsigned perm);
+
+// Remove the region starting at p and the instructions decoded from it.
+// Call it before the host memory goes away: a cache hit reads the word at
+// PC without looking at the regions again. Returns -1 if there is no such
+// region.
+int a64_unmap(struct a64_emu *e, const void *p);
+void a64_unmap_all(struct a64_emu *e);
+
+// Branching to `addr` (outside every region) runs fn instead.
+int a64_host(struct a64_emu *e, uint64_t addr, a64_host_fn fn, void *ctx);
+
+// Drop every decoded instruction.
+void a64_flush(struct a64_emu *e);
+
+// Run from cpu.pc for at most max_steps instructions.
+enum a64_status a64_run(struct a64_emu *e, uint64_t max_steps);
+
+// Call fn(args...) with up to 8 arguments on stack pointer `sp` (16-byte
+// aligned, in a writable region), returning to A64_RETURN_ADDR. Other
+// registers keep their values, so callee-saved ones can be checked after.
+enum a64_status a64_call(struct a64_emu *e, uint64_t fn, const uint64_t *args, size_t nargs,
+                         uint64_t sp, uint64_t max_steps, uint64_t *ret);
+
+const char *a64_status_name(enum a64_status s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARM64_A64EMU_H */
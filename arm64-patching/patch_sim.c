@@ -0,0 +1,1472 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE        // MAP_ANON, clock_gettime
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "a64emu.h"
+#include "patcher.h"
+
+// Runs patcher.c against ARM64 code under a64emu, so the patching flow can
+// be tested on any host. Each scenario assembles a random function with a
+// position-independent prologue, a hook, and computes the function's result
+// with a C model of the same instructions. Then:
+//
+//   1. the function runs unpatched and must match the model;
+//   2. arm64_patch_prologue(target, hook, 4 * k) rewrites it in place;
+//   3. calling the target must now give the hook's result, which for half
+//      the scenarios wraps the original through the trampoline;
+//   4. calling the trampoline directly must give the original result.
+//
+// Every run must also return with sp and x19-x28 unchanged.
+
+#define CODE_TARGET 0x000u
+#define CODE_HELPER 0x600u
+#define CODE_HOOK 0x800u
+#define CODE_INSNS (CODE_HELPER / 4)
+#define STACK_BYTES 0x4000u
+#define FRAME 64u
+#define MAX_OPS 160
+#define MAX_STEPS 100000
+
+#define HOST_MIX 0xfff0000000001000ull
+#define HOST_TARGET 0xfff0000000002000ull
+#define HOST_HOOK 0xfff0000000003000ull
+
+#define INSN_RET 0xd65f03c0u
+#define INSN_RETAA 0xd65f0bffu
+#define INSN_BTI_C 0xd503245fu
+#define INSN_PACIASP 0xd503233fu
+#define INSN_AUTIASP 0xd50323bfu
+#define INSN_BLR_X16 0xd63f0200u
+
+// ---- random numbers ----
+
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static unsigned rng_below(uint64_t *s, unsigned n) {
+    return (unsigned)(rng_next(s) % n);
+}
+
+// Mostly small values and values near the 32/64-bit edges, where carries,
+// sign bits and overflow live.
+static uint64_t rng_value(uint64_t *s) {
+    uint64_t v = rng_next(s);
+    switch (rng_below(s, 6)) {
+        case 0: return v & 0xff;
+        case 1: return (uint64_t)(int64_t)(int8_t)v;
+        case 2: return 0x80000000ull + (v & 3) - 2;
+        case 3: return 0x8000000000000000ull + (v & 3) - 2;
+        case 4: return (uint32_t)v;
+        default: return v;
+    }
+}
+
+// ---- encoders ----
+
+static uint32_t sfbit(int sf) {
+    return sf ? 0x80000000u : 0;
+}
+
+static uint32_t enc_movw(unsigned opc, unsigned rd, unsigned imm16, unsigned hw, int sf) {
+    return sfbit(sf) | opc << 29 | 0x12800000u | hw << 21 | (imm16 & 0xffff) << 5 | rd;
+}
+
+static uint32_t enc_addsub_imm(int sf, unsigned sub, unsigned s, unsigned rd, unsigned rn,
+                               unsigned imm12, unsigned sh) {
+    return sfbit(sf) | sub << 30 | s << 29 | 0x11000000u | sh << 22 | (imm12 & 0xfff) << 10 |
+           rn << 5 | rd;
+}
+
+static uint32_t enc_addsub_reg(int sf, unsigned sub, unsigned s, unsigned rd, unsigned rn,
+                               unsigned rm, unsigned type, unsigned amt) {
+    return sfbit(sf) | sub << 30 | s << 29 | 0x0b000000u | type << 22 | rm << 16 | amt << 10 |
+           rn << 5 | rd;
+}
+
+static uint32_t enc_addsub_ext(int sf, unsigned sub, unsigned rd, unsigned rn, unsigned rm,
+                               unsigned option, unsigned amt) {
+    return sfbit(sf) | sub << 30 | 0x0b200000u | rm << 16 | option << 13 | amt << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_logic_reg(int sf, unsigned opc, unsigned n, unsigned rd, unsigned rn,
+                              unsigned rm, unsigned type, unsigned amt) {
+    return sfbit(sf) | opc << 29 | 0x0a000000u | type << 22 | n << 21 | rm << 16 | amt << 10 |
+           rn << 5 | rd;
+}
+
+static uint32_t enc_logic_imm(int sf, unsigned opc, unsigned n, unsigned immr, unsigned imms,
+                              unsigned rd, unsigned rn) {
+    return sfbit(sf) | opc << 29 | 0x12000000u | n << 22 | immr << 16 | imms << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_bfm(int sf, unsigned opc, unsigned rd, unsigned rn, unsigned immr,
+                        unsigned imms) {
+    return sfbit(sf) | opc << 29 | 0x13000000u | (sf ? 1u << 22 : 0) | immr << 16 | imms << 10 |
+           rn << 5 | rd;
+}
+
+static uint32_t enc_extr(int sf, unsigned rd, unsigned rn, unsigned rm, unsigned lsb) {
+    return sfbit(sf) | 0x13800000u | (sf ? 1u << 22 : 0) | rm << 16 | lsb << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_dp1(int sf, unsigned opcode, unsigned rd, unsigned rn) {
+    return sfbit(sf) | 0x5ac00000u | opcode << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_dp2(int sf, unsigned opcode, unsigned rd, unsigned rn, unsigned rm) {
+    return sfbit(sf) | 0x1ac00000u | rm << 16 | opcode << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_dp3(int sf, unsigned op31, unsigned o0, unsigned rd, unsigned rn, unsigned rm,
+                        unsigned ra) {
+    return sfbit(sf) | 0x1b000000u | op31 << 21 | rm << 16 | o0 << 15 | ra << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_adc(int sf, unsigned sbc, unsigned rd, unsigned rn, unsigned rm) {
+    return sfbit(sf) | sbc << 30 | 0x1a000000u | rm << 16 | rn << 5 | rd;
+}
+
+static uint32_t enc_csel(int sf, unsigned op, unsigned o2, unsigned rd, unsigned rn, unsigned rm,
+                         unsigned cond) {
+    return sfbit(sf) | op << 30 | 0x1a800000u | rm << 16 | cond << 12 | o2 << 10 | rn << 5 | rd;
+}
+
+static uint32_t enc_ccmp(int sf, int imm_form, unsigned rn, unsigned rm_or_imm, unsigned nzcv,
+                         unsigned cond) {
+    return sfbit(sf) | 0x7a400000u | rm_or_imm << 16 | cond << 12 | (imm_form ? 1u << 11 : 0) |
+           rn << 5 | nzcv;
+}
+
+static uint32_t enc_ldst_uimm(unsigned size, unsigned opc, unsigned rt, unsigned rn,
+                              unsigned off) {
+    return size << 30 | 0x39000000u | opc << 22 | (off >> size) << 10 | rn << 5 | rt;
+}
+
+// mode: 0 unscaled, 1 post-index, 3 pre-index.
+static uint32_t enc_ldst_simm(unsigned size, unsigned opc, unsigned rt, unsigned rn, int simm,
+                              unsigned mode) {
+    return size << 30 | 0x38000000u | opc << 22 | ((uint32_t)simm & 0x1ff) << 12 | mode << 10 |
+           rn << 5 | rt;
+}
+
+static uint32_t enc_ldst_reg(unsigned size, unsigned opc, unsigned rt, unsigned rn, unsigned rm,
+                             unsigned option, unsigned s) {
+    return size << 30 | 0x38200800u | opc << 22 | rm << 16 | option << 13 | s << 12 | rn << 5 | rt;
+}
+
+// mode: 1 post-index, 2 offset, 3 pre-index. opc: 0 32-bit, 1 LDPSW, 2 64-bit.
+static uint32_t enc_ldstp(unsigned opc, unsigned l, unsigned mode, unsigned rt, unsigned rt2,
+                          unsigned rn, int simm) {
+    unsigned scale = opc == 2 ? 3 : 2;
+    return opc << 30 | 0x28000000u | mode << 23 | l << 22 |
+           ((uint32_t)(simm >> scale) & 0x7f) << 15 | rt2 << 10 | rn << 5 | rt;
+}
+
+static uint32_t enc_branch(uint32_t base, size_t from, size_t to) {
+    int64_t delta = (int64_t)to - (int64_t)from;
+    return base | ((uint32_t)delta & 0x3ffffffu);
+}
+
+static uint32_t enc_bcond(size_t from, size_t to, unsigned cond) {
+    int64_t delta = (int64_t)to - (int64_t)from;
+    return 0x54000000u | ((uint32_t)delta & 0x7ffff) << 5 | cond;
+}
+
+static uint32_t enc_cb(int sf, unsigned nz, unsigned rt, size_t from, size_t to) {
+    int64_t delta = (int64_t)to - (int64_t)from;
+    return sfbit(sf) | 0x34000000u | nz << 24 | ((uint32_t)delta & 0x7ffff) << 5 | rt;
+}
+
+static uint32_t enc_tb(unsigned nz, unsigned rt, unsigned bit, size_t from, size_t to) {
+    int64_t delta = (int64_t)to - (int64_t)from;
+    return (bit >> 5) << 31 | 0x36000000u | nz << 24 | (bit & 31) << 19 |
+           ((uint32_t)delta & 0x3fff) << 5 | rt;
+}
+
+struct code {
+    uint32_t *w;
+    size_t n;
+    size_t cap;
+};
+
+static void emit(struct code *c, uint32_t insn) {
+    if (c->n < c->cap) c->w[c->n] = insn;
+    c->n++;
+}
+
+static void emit_mov64(struct code *c, unsigned rd, uint64_t v) {
+    emit(c, enc_movw(2, rd, (unsigned)(v & 0xffff), 0, 1));
+    for (unsigned hw = 1; hw < 4; hw++) emit(c, enc_movw(3, rd, (unsigned)(v >> (16 * hw)), hw, 1));
+}
+
+// ---- scenario IR ----
+
+enum {
+    K_RAW,        // raw: no effect the model can see (frame setup, hints)
+    K_ALU,        // three-register data processing, sub = A_*
+    K_IMM,        // one register and an immediate, sub = I_*
+    K_MOVW,       // sub = MOVN/MOVZ/MOVK opc
+    K_ADC,        // cmp rn2, rm2; adc/sbc rd, rn, rm
+    K_CSEL,       // cmp; csel family
+    K_STORE,
+    K_LOAD,
+    K_CALL,       // host function through x16
+    K_BL,         // local helper
+    K_SKIP,       // compare and branch over the next n ops
+    K_LOOP,       // x9 = n
+    K_ENDLOOP,    // back n ops while --x9
+};
+
+enum {
+    A_ADD, A_SUB, A_ADDS, A_SUBS, A_AND, A_ORR, A_EOR, A_ANDS, A_BIC, A_ORN, A_EON, A_BICS,
+    A_MADD, A_MSUB, A_UDIV, A_SDIV, A_LSLV, A_LSRV, A_ASRV, A_RORV, A_UMULH, A_SMULH,
+    A_SMADDL, A_UMADDL, A_SMSUBL, A_UMSUBL, A_ADDX, A_SUBX, A_EXTR, A_COUNT
+};
+
+enum {
+    I_ADD, I_SUB, I_ADDS, I_SUBS, I_AND, I_ORR, I_EOR, I_ANDS, I_LSL, I_LSR, I_ASR, I_UBFX,
+    I_SBFX, I_BFI, I_BFXIL, I_CLZ, I_CLS, I_RBIT, I_REV, I_REV16, I_REV32, I_COUNT
+};
+
+// Skip conditions.
+enum { S_CMP, S_CMPI, S_CCMP, S_CBZ, S_TBZ, S_COUNT };
+
+// Load/store addressing.
+enum { M_UIMM, M_UNSCALED, M_PRE, M_POST, M_REG, M_PAIR, M_COUNT };
+
+struct op {
+    uint8_t kind;
+    uint8_t sub;
+    uint8_t sf;
+    uint8_t rd, rn, rm, ra;
+    uint8_t rn2, rm2;       // compares
+    uint8_t sf2;
+    uint8_t type, amt;      // shift type/amount, extend option, bit number
+    uint8_t cond, cond2;
+    uint8_t nz;             // CBNZ/TBNZ, or the ccmp literal flags
+    uint8_t size, opc, mode;
+    uint32_t n;
+    int32_t off, off2;
+    uint64_t imm;
+    uint32_t raw;
+};
+
+struct scenario {
+    struct op ops[MAX_OPS];
+    size_t nops;
+    size_t prologue_insns;  // all position independent
+    size_t patch_insns;     // 1..prologue_insns
+    int frame;
+    int save_callee;        // x19, x20 saved at [sp, #16] and used
+    unsigned slot_lo;       // first frame byte the body may use
+    int wrap;               // hook calls the original through the trampoline
+    uint64_t hook_k;
+    uint64_t regs[31];      // x0-x30 at entry (x0-x7 are the arguments)
+};
+
+static const uint8_t POOL[] = {0, 1, 2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, 15, 19, 20};
+
+static unsigned pick_reg(uint64_t *s, const struct scenario *sc) {
+    unsigned n = sc->save_callee ? sizeof(POOL) : sizeof(POOL) - 2;
+    return POOL[rng_below(s, n)];
+}
+
+// ---- the model ----
+
+static uint64_t tw(uint64_t v, int sf) {
+    return sf ? v : (uint32_t)v;
+}
+
+static int64_t ts(uint64_t v, int sf) {
+    return sf ? (int64_t)v : (int64_t)(int32_t)(uint32_t)v;
+}
+
+static uint64_t m_ones(unsigned n) {
+    return n >= 64 ? ~0ull : (1ull << n) - 1;
+}
+
+static uint64_t m_shift(uint64_t v, unsigned type, unsigned amt, int sf) {
+    unsigned w = sf ? 64 : 32;
+    v = tw(v, sf);
+    amt %= w;
+    switch (type) {
+        case 0: v <<= amt; break;
+        case 1: v >>= amt; break;
+        case 2: v = (uint64_t)(ts(v, sf) >> amt); break;
+        default: v = amt ? (v >> amt) | (v << (w - amt)) : v; break;
+    }
+    return tw(v, sf);
+}
+
+static uint64_t m_extend(uint64_t v, unsigned option) {
+    static const unsigned bits[4] = {8, 16, 32, 64};
+    unsigned b = bits[option & 3];
+    uint64_t u = v & m_ones(b);
+    if (option & 4 && b < 64 && (u >> (b - 1)) & 1) u |= ~m_ones(b);
+    return u;
+}
+
+static unsigned m_clz(uint64_t v, unsigned w) {
+    unsigned n = 0;
+    while (n < w && !(v & (1ull << (w - 1 - n)))) n++;
+    return n;
+}
+
+static uint64_t m_bytes(uint64_t v, unsigned w, unsigned group) {
+    uint8_t b[8];
+    uint8_t r[8];
+    for (unsigned i = 0; i < 8; i++) b[i] = (uint8_t)(v >> (8 * i));
+    for (unsigned i = 0; i < w / 8; i++) r[i] = b[(i / group) * group + (group - 1 - i % group)];
+    uint64_t out = 0;
+    for (unsigned i = 0; i < w / 8; i++) out |= (uint64_t)r[i] << (8 * i);
+    return out;
+}
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 m_u128;
+__extension__ typedef __int128 m_i128;
+
+static uint64_t m_umulh(uint64_t a, uint64_t b) {
+    return (uint64_t)(((m_u128)a * b) >> 64);
+}
+
+static uint64_t m_smulh(uint64_t a, uint64_t b) {
+    return (uint64_t)(((m_i128)(int64_t)a * (int64_t)b) >> 64);
+}
+#endif
+
+struct cmpv {
+    int literal;
+    unsigned nzcv;
+    uint64_t a, b;
+    int sf;
+};
+
+static int m_cond(const struct cmpv *c, unsigned cond) {
+    int r;
+    if (c->literal) {
+        int n = (c->nzcv >> 3) & 1, z = (c->nzcv >> 2) & 1, cy = (c->nzcv >> 1) & 1, v = c->nzcv & 1;
+        switch (cond) {
+            case 0: r = z; break;
+            case 1: r = !z; break;
+            case 2: r = cy; break;
+            case 3: r = !cy; break;
+            case 4: r = n; break;
+            case 5: r = !n; break;
+            case 6: r = v; break;
+            case 7: r = !v; break;
+            case 8: r = cy && !z; break;
+            case 9: r = !(cy && !z); break;
+            case 10: r = n == v; break;
+            case 11: r = n != v; break;
+            case 12: r = !z && n == v; break;
+            case 13: r = z || n != v; break;
+            default: r = 1; break;
+        }
+        return r;
+    }
+    uint64_t ua = tw(c->a, c->sf), ub = tw(c->b, c->sf);
+    int64_t sa = ts(c->a, c->sf), sb = ts(c->b, c->sf);
+    int ovf;
+    if (c->sf) {
+        int64_t t;
+        ovf = __builtin_sub_overflow(sa, sb, &t);
+    } else {
+        int64_t t = sa - sb;
+        ovf = t < INT32_MIN || t > INT32_MAX;
+    }
+    int neg = (int)((tw(ua - ub, c->sf) >> (c->sf ? 63 : 31)) & 1);
+    switch (cond) {
+        case 0: r = ua == ub; break;
+        case 1: r = ua != ub; break;
+        case 2: r = ua >= ub; break;
+        case 3: r = ua < ub; break;
+        case 4: r = neg; break;
+        case 5: r = !neg; break;
+        case 6: r = ovf; break;
+        case 7: r = !ovf; break;
+        case 8: r = ua > ub; break;
+        case 9: r = ua <= ub; break;
+        case 10: r = sa >= sb; break;
+        case 11: r = sa < sb; break;
+        case 12: r = sa > sb; break;
+        case 13: r = sa <= sb; break;
+        default: r = 1; break;
+    }
+    return r;
+}
+
+static void mix_call(uint64_t *x) {
+    x[0] = x[0] * 0x9e3779b97f4a7c15ull + x[1];
+    for (unsigned i = 1; i <= 17; i++) x[i] = x[0] ^ (i * 0x0101010101010101ull);
+}
+
+static uint64_t helper_model(uint64_t x0, uint64_t x1) {
+    return (x0 ^ ((x1 >> 7) | (x1 << 57))) + 3;
+}
+
+static uint64_t logic_mask(const struct op *o) {
+    // imm: element size in bits 0-7, ones - 1 in 8-15, rotation in 16-23.
+    unsigned e = (unsigned)(o->imm & 0xff);
+    unsigned s = (unsigned)((o->imm >> 8) & 0xff);
+    unsigned r = (unsigned)((o->imm >> 16) & 0xff);
+    uint64_t elem = m_ones(s + 1);
+    if (r) elem = ((elem >> r) | (elem << (e - r))) & m_ones(e);
+    uint64_t m = 0;
+    for (unsigned i = 0; i < 64; i += e) m |= elem << i;
+    return m;
+}
+
+static uint64_t rd_(const uint64_t *x, unsigned r) {
+    return r == 31 ? 0 : x[r];
+}
+
+static void wr_(uint64_t *x, unsigned r, uint64_t v, int sf) {
+    if (r != 31) x[r] = tw(v, sf);
+}
+
+static struct cmpv skip_cmp(const struct op *o, const uint64_t *x) {
+    struct cmpv c = {0, 0, rd_(x, o->rn2), 0, o->sf2};
+    if (o->sub == S_CMPI) c.b = o->imm;
+    else c.b = rd_(x, o->rm2);
+    return c;
+}
+
+static int skip_taken(const struct op *o, const uint64_t *x) {
+    switch (o->sub) {
+        case S_CMP:
+        case S_CMPI: {
+            struct cmpv c = skip_cmp(o, x);
+            return m_cond(&c, o->cond);
+        }
+        case S_CCMP: {
+            struct cmpv c = {0, 0, rd_(x, o->rn2), rd_(x, o->rm2), o->sf2};
+            if (m_cond(&c, o->cond2)) {
+                c.a = rd_(x, o->rn);
+                c.b = o->mode ? o->imm : rd_(x, o->rm);
+                c.sf = o->sf;
+            } else {
+                c.literal = 1;
+                c.nzcv = o->nz;
+            }
+            return m_cond(&c, o->cond);
+        }
+        case S_CBZ:
+            return (tw(rd_(x, o->rn), o->sf) == 0) != o->nz;
+        default:
+            return (int)((rd_(x, o->rn) >> o->amt) & 1) == o->nz;
+    }
+}
+
+static void model_alu(const struct op *o, uint64_t *x) {
+    int sf = o->sf;
+    uint64_t a = rd_(x, o->rn);
+    uint64_t b = rd_(x, o->rm);
+    uint64_t acc = rd_(x, o->ra);
+    uint64_t sh = m_shift(b, o->type, o->amt, sf);
+    uint64_t r = 0;
+    switch (o->sub) {
+        case A_ADD: case A_ADDS: r = a + sh; break;
+        case A_SUB: case A_SUBS: r = a - sh; break;
+        case A_AND: case A_ANDS: r = a & sh; break;
+        case A_ORR: r = a | sh; break;
+        case A_EOR: r = a ^ sh; break;
+        case A_BIC: case A_BICS: r = a & ~sh; break;
+        case A_ORN: r = a | ~sh; break;
+        case A_EON: r = a ^ ~sh; break;
+        case A_MADD: r = acc + a * b; break;
+        case A_MSUB: r = acc - a * b; break;
+        case A_UDIV:
+            r = tw(b, sf) ? tw(a, sf) / tw(b, sf) : 0;
+            break;
+        case A_SDIV: {
+            int64_t sa = ts(a, sf), sb = ts(b, sf);
+            int64_t min = sf ? INT64_MIN : INT32_MIN;
+            if (sb == 0) r = 0;
+            else if (sa == min && sb == -1) r = (uint64_t)min;
+            else r = (uint64_t)(sa / sb);
+            break;
+        }
+        case A_LSLV: r = m_shift(a, 0, (unsigned)b, sf); break;
+        case A_LSRV: r = m_shift(a, 1, (unsigned)b, sf); break;
+        case A_ASRV: r = m_shift(a, 2, (unsigned)b, sf); break;
+        case A_RORV: r = m_shift(a, 3, (unsigned)b, sf); break;
+#ifdef __SIZEOF_INT128__
+        case A_UMULH: r = m_umulh(a, b); break;
+        case A_SMULH: r = m_smulh(a, b); break;
+#endif
+        case A_SMADDL: r = acc + (uint64_t)((int64_t)(int32_t)a * (int32_t)b); break;
+        case A_SMSUBL: r = acc - (uint64_t)((int64_t)(int32_t)a * (int32_t)b); break;
+        case A_UMADDL: r = acc + (a & 0xffffffff) * (b & 0xffffffff); break;
+        case A_UMSUBL: r = acc - (a & 0xffffffff) * (b & 0xffffffff); break;
+        case A_ADDX: r = a + (m_extend(b, o->type) << o->amt); break;
+        case A_SUBX: r = a - (m_extend(b, o->type) << o->amt); break;
+        case A_EXTR: {
+            unsigned w = sf ? 64 : 32;
+            r = o->amt ? (tw(b, sf) >> o->amt) | (a << (w - o->amt)) : b;
+            break;
+        }
+    }
+    wr_(x, o->rd, r, sf);
+}
+
+static void model_imm(const struct op *o, uint64_t *x) {
+    int sf = o->sf;
+    unsigned w = sf ? 64 : 32;
+    uint64_t a = rd_(x, o->rn);
+    uint64_t r = 0;
+    unsigned lsb = o->amt;
+    unsigned width = (unsigned)o->imm;
+    switch (o->sub) {
+        case I_ADD: case I_ADDS: r = a + o->imm; break;
+        case I_SUB: case I_SUBS: r = a - o->imm; break;
+        case I_AND: case I_ANDS: r = a & logic_mask(o); break;
+        case I_ORR: r = a | logic_mask(o); break;
+        case I_EOR: r = a ^ logic_mask(o); break;
+        case I_LSL: r = m_shift(a, 0, lsb, sf); break;
+        case I_LSR: r = m_shift(a, 1, lsb, sf); break;
+        case I_ASR: r = m_shift(a, 2, lsb, sf); break;
+        case I_UBFX: r = (tw(a, sf) >> lsb) & m_ones(width); break;
+        case I_SBFX: {
+            uint64_t f = (tw(a, sf) >> lsb) & m_ones(width);
+            if ((f >> (width - 1)) & 1) f |= ~m_ones(width);
+            r = f;
+            break;
+        }
+        case I_BFI: {
+            uint64_t m = m_ones(width) << lsb;
+            r = (rd_(x, o->rd) & ~m) | ((a << lsb) & m);
+            break;
+        }
+        case I_BFXIL: {
+            uint64_t m = m_ones(width);
+            r = (rd_(x, o->rd) & ~m) | ((tw(a, sf) >> lsb) & m);
+            break;
+        }
+        case I_CLZ: r = m_clz(tw(a, sf), w); break;
+        case I_CLS: r = m_clz(tw(a ^ (uint64_t)(ts(a, sf) >> 1), sf), w) - 1; break;
+        case I_RBIT:
+            for (unsigned i = 0; i < w; i++) {
+                if ((a >> i) & 1) r |= 1ull << (w - 1 - i);
+            }
+            break;
+        case I_REV: r = m_bytes(a, w, w / 8); break;
+        case I_REV16: r = m_bytes(a, w, 2); break;
+        case I_REV32: r = m_bytes(a, w, 4); break;
+    }
+    wr_(x, o->rd, r, sf);
+}
+
+static uint64_t model_run(const struct scenario *sc) {
+    uint64_t x[31];
+    uint8_t frame[FRAME];
+    memcpy(x, sc->regs, sizeof(x));
+    memset(frame, 0, sizeof(frame));
+    size_t i = 0;
+    while (i < sc->nops) {
+        const struct op *o = &sc->ops[i];
+        switch (o->kind) {
+            case K_RAW:
+                break;
+            case K_ALU:
+                model_alu(o, x);
+                break;
+            case K_IMM:
+                model_imm(o, x);
+                break;
+            case K_MOVW: {
+                uint64_t imm = o->imm << o->amt;
+                uint64_t r = o->sub == 0 ? ~imm
+                           : o->sub == 2 ? imm
+                                         : (rd_(x, o->rd) & ~(0xffffull << o->amt)) | imm;
+                wr_(x, o->rd, r, o->sf);
+                break;
+            }
+            case K_ADC: {
+                uint64_t a = tw(rd_(x, o->rn2), o->sf2), b = tw(rd_(x, o->rm2), o->sf2);
+                uint64_t carry = a >= b;
+                uint64_t r = o->sub ? rd_(x, o->rn) - rd_(x, o->rm) - (1 - carry)
+                                    : rd_(x, o->rn) + rd_(x, o->rm) + carry;
+                wr_(x, o->rd, r, o->sf);
+                break;
+            }
+            case K_CSEL: {
+                struct cmpv c = {0, 0, rd_(x, o->rn2), rd_(x, o->rm2), o->sf2};
+                uint64_t r;
+                if (m_cond(&c, o->cond)) {
+                    r = rd_(x, o->rn);
+                } else {
+                    uint64_t b = rd_(x, o->rm);
+                    r = o->sub == 0 ? b : o->sub == 1 ? b + 1 : o->sub == 2 ? ~b : 0 - b;
+                }
+                wr_(x, o->rd, r, o->sf);
+                break;
+            }
+            case K_STORE: {
+                unsigned bytes = 1u << o->size;
+                uint64_t v = rd_(x, o->rd);
+                memcpy(frame + o->off, &v, bytes);
+                if (o->mode == M_PAIR) {
+                    uint64_t v2 = rd_(x, o->ra);
+                    memcpy(frame + o->off + bytes, &v2, bytes);
+                }
+                break;
+            }
+            case K_LOAD: {
+                unsigned bytes = 1u << o->size;
+                uint64_t v = 0;
+                uint64_t v2 = 0;
+                memcpy(&v, frame + o->off, bytes);
+                if (o->mode == M_PAIR) memcpy(&v2, frame + o->off + bytes, bytes);
+                if (o->opc >= 2) {
+                    unsigned bits = 8 * bytes;
+                    if ((v >> (bits - 1)) & 1) v |= ~m_ones(bits);
+                    if ((v2 >> (bits - 1)) & 1) v2 |= ~m_ones(bits);
+                }
+                int sf = o->opc != 3;
+                if (o->mode == M_PAIR) {
+                    if (o->rd == o->ra) {
+                        // Unpredictable on hardware; never generated.
+                        break;
+                    }
+                    wr_(x, o->ra, v2, sf);
+                }
+                wr_(x, o->rd, v, sf);
+                break;
+            }
+            case K_CALL:
+                mix_call(x);
+                break;
+            case K_BL:
+                x[0] = helper_model(x[0], x[1]);
+                break;
+            case K_SKIP:
+                if (skip_taken(o, x)) i += o->n;
+                break;
+            case K_LOOP:
+                x[9] = o->n;
+                break;
+            case K_ENDLOOP:
+                x[9]--;
+                if (x[9] != 0) {
+                    i -= o->n;
+                    continue;
+                }
+                break;
+        }
+        i++;
+    }
+    return x[0];
+}
+
+// ---- assembling ----
+
+static void emit_op(struct code *c, const struct op *o, size_t target_pc) {
+    int sf = o->sf;
+    switch (o->kind) {
+        case K_RAW:
+            emit(c, o->raw);
+            break;
+        case K_ALU:
+            switch (o->sub) {
+                case A_ADD: case A_SUB: case A_ADDS: case A_SUBS: {
+                    unsigned sub = o->sub == A_SUB || o->sub == A_SUBS;
+                    unsigned s = o->sub == A_ADDS || o->sub == A_SUBS;
+                    emit(c, enc_addsub_reg(sf, sub, s, o->rd, o->rn, o->rm, o->type, o->amt));
+                    break;
+                }
+                case A_AND: case A_ORR: case A_EOR: case A_ANDS:
+                    emit(c, enc_logic_reg(sf, o->sub - A_AND, 0, o->rd, o->rn, o->rm, o->type,
+                                          o->amt));
+                    break;
+                case A_BIC: case A_ORN: case A_EON: case A_BICS:
+                    emit(c, enc_logic_reg(sf, o->sub - A_BIC, 1, o->rd, o->rn, o->rm, o->type,
+                                          o->amt));
+                    break;
+                case A_MADD: emit(c, enc_dp3(sf, 0, 0, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_MSUB: emit(c, enc_dp3(sf, 0, 1, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_UDIV: emit(c, enc_dp2(sf, 2, o->rd, o->rn, o->rm)); break;
+                case A_SDIV: emit(c, enc_dp2(sf, 3, o->rd, o->rn, o->rm)); break;
+                case A_LSLV: emit(c, enc_dp2(sf, 8, o->rd, o->rn, o->rm)); break;
+                case A_LSRV: emit(c, enc_dp2(sf, 9, o->rd, o->rn, o->rm)); break;
+                case A_ASRV: emit(c, enc_dp2(sf, 10, o->rd, o->rn, o->rm)); break;
+                case A_RORV: emit(c, enc_dp2(sf, 11, o->rd, o->rn, o->rm)); break;
+                case A_SMULH: emit(c, enc_dp3(1, 2, 0, o->rd, o->rn, o->rm, 31)); break;
+                case A_UMULH: emit(c, enc_dp3(1, 6, 0, o->rd, o->rn, o->rm, 31)); break;
+                case A_SMADDL: emit(c, enc_dp3(1, 1, 0, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_SMSUBL: emit(c, enc_dp3(1, 1, 1, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_UMADDL: emit(c, enc_dp3(1, 5, 0, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_UMSUBL: emit(c, enc_dp3(1, 5, 1, o->rd, o->rn, o->rm, o->ra)); break;
+                case A_ADDX: emit(c, enc_addsub_ext(sf, 0, o->rd, o->rn, o->rm, o->type, o->amt)); break;
+                case A_SUBX: emit(c, enc_addsub_ext(sf, 1, o->rd, o->rn, o->rm, o->type, o->amt)); break;
+                case A_EXTR: emit(c, enc_extr(sf, o->rd, o->rn, o->rm, o->amt)); break;
+            }
+            break;
+        case K_IMM: {
+            unsigned w = sf ? 64 : 32;
+            unsigned lsb = o->amt;
+            unsigned width = (unsigned)o->imm;
+            switch (o->sub) {
+                case I_ADD: case I_SUB: case I_ADDS: case I_SUBS: {
+                    unsigned sub = o->sub == I_SUB || o->sub == I_SUBS;
+                    unsigned s = o->sub == I_ADDS || o->sub == I_SUBS;
+                    unsigned sh = o->imm > 0xfff;
+                    emit(c, enc_addsub_imm(sf, sub, s, o->rd, o->rn,
+                                           (unsigned)(sh ? o->imm >> 12 : o->imm), sh));
+                    break;
+                }
+                case I_AND: case I_ORR: case I_EOR: case I_ANDS: {
+                    unsigned e = (unsigned)(o->imm & 0xff);
+                    unsigned s = (unsigned)((o->imm >> 8) & 0xff);
+                    unsigned r = (unsigned)((o->imm >> 16) & 0xff);
+                    unsigned len = 0;
+                    while ((1u << len) < e) len++;
+                    unsigned imms = e == 64 ? s : (((0x3fu << (len + 1)) & 0x3f) | s);
+                    emit(c, enc_logic_imm(sf, o->sub - I_AND, e == 64, r, imms, o->rd, o->rn));
+                    break;
+                }
+                case I_LSL: emit(c, enc_bfm(sf, 2, o->rd, o->rn, (w - lsb) % w, w - 1 - lsb)); break;
+                case I_LSR: emit(c, enc_bfm(sf, 2, o->rd, o->rn, lsb, w - 1)); break;
+                case I_ASR: emit(c, enc_bfm(sf, 0, o->rd, o->rn, lsb, w - 1)); break;
+                case I_UBFX: emit(c, enc_bfm(sf, 2, o->rd, o->rn, lsb, lsb + width - 1)); break;
+                case I_SBFX: emit(c, enc_bfm(sf, 0, o->rd, o->rn, lsb, lsb + width - 1)); break;
+                case I_BFI: emit(c, enc_bfm(sf, 1, o->rd, o->rn, (w - lsb) % w, width - 1)); break;
+                case I_BFXIL: emit(c, enc_bfm(sf, 1, o->rd, o->rn, lsb, lsb + width - 1)); break;
+                case I_CLZ: emit(c, enc_dp1(sf, 4, o->rd, o->rn)); break;
+                case I_CLS: emit(c, enc_dp1(sf, 5, o->rd, o->rn)); break;
+                case I_RBIT: emit(c, enc_dp1(sf, 0, o->rd, o->rn)); break;
+                case I_REV: emit(c, enc_dp1(sf, sf ? 3 : 2, o->rd, o->rn)); break;
+                case I_REV16: emit(c, enc_dp1(sf, 1, o->rd, o->rn)); break;
+                case I_REV32: emit(c, enc_dp1(1, 2, o->rd, o->rn)); break;
+            }
+            break;
+        }
+        case K_MOVW:
+            emit(c, enc_movw(o->sub, o->rd, (unsigned)o->imm, o->amt / 16, sf));
+            break;
+        case K_ADC:
+            emit(c, enc_addsub_reg(o->sf2, 1, 1, 31, o->rn2, o->rm2, 0, 0));
+            emit(c, enc_adc(sf, o->sub, o->rd, o->rn, o->rm));
+            break;
+        case K_CSEL:
+            emit(c, enc_addsub_reg(o->sf2, 1, 1, 31, o->rn2, o->rm2, 0, 0));
+            emit(c, enc_csel(sf, o->sub >> 1, o->sub & 1, o->rd, o->rn, o->rm, o->cond));
+            break;
+        case K_STORE:
+        case K_LOAD: {
+            unsigned opc = o->kind == K_STORE ? 0 : o->opc;
+            switch (o->mode) {
+                case M_UIMM:
+                    emit(c, enc_ldst_uimm(o->size, opc, o->rd, 31, (unsigned)o->off));
+                    break;
+                case M_UNSCALED:
+                    emit(c, enc_ldst_simm(o->size, opc, o->rd, 31, o->off, 0));
+                    break;
+                case M_PRE:
+                    // x8 = sp + off2, access at x8 + (off - off2), x8 updated.
+                    emit(c, enc_addsub_imm(1, 0, 0, 8, 31, (unsigned)o->off2, 0));
+                    emit(c, enc_ldst_simm(o->size, opc, o->rd, 8, o->off - o->off2, 3));
+                    break;
+                case M_POST:
+                    emit(c, enc_addsub_imm(1, 0, 0, 8, 31, (unsigned)o->off, 0));
+                    emit(c, enc_ldst_simm(o->size, opc, o->rd, 8, o->off2, 1));
+                    break;
+                case M_REG: {
+                    // x8 = index; option in type, scaled when amt.
+                    unsigned idx = o->amt ? (unsigned)o->off >> o->size : (unsigned)o->off;
+                    emit(c, enc_movw(2, 8, idx, 0, 1));
+                    emit(c, enc_ldst_reg(o->size, opc, o->rd, 31, 8, o->type, o->amt));
+                    break;
+                }
+                default: {
+                    unsigned popc = o->size == 3 ? 2 : o->opc >= 2 ? 1 : 0;
+                    emit(c, enc_ldstp(popc, o->kind == K_LOAD, 2, o->rd, o->ra, 31, o->off));
+                    break;
+                }
+            }
+            break;
+        }
+        case K_CALL:
+            emit_mov64(c, 16, HOST_MIX);
+            emit(c, INSN_BLR_X16);
+            break;
+        case K_BL:
+            emit(c, enc_branch(0x94000000u, target_pc + c->n, CODE_HELPER / 4));
+            break;
+        default:
+            break;
+    }
+}
+
+// Returns the number of instructions, or 0 when it does not fit.
+static size_t assemble(const struct scenario *sc, uint32_t *w, size_t cap) {
+    struct code c = {w, 0, cap};
+    size_t start[MAX_OPS + 1];      // first instruction of each op
+    size_t fix[MAX_OPS];            // skip branches to patch
+    size_t nfix = 0;
+    for (size_t i = 0; i < sc->nops; i++) {
+        const struct op *o = &sc->ops[i];
+        start[i] = c.n;
+        switch (o->kind) {
+            case K_SKIP:
+                if (o->sub == S_CMP) {
+                    emit(&c, enc_addsub_reg(o->sf2, 1, 1, 31, o->rn2, o->rm2, 0, 0));
+                } else if (o->sub == S_CMPI) {
+                    emit(&c, enc_addsub_imm(o->sf2, 1, 1, 31, o->rn2, (unsigned)o->imm, 0));
+                } else if (o->sub == S_CCMP) {
+                    emit(&c, enc_addsub_reg(o->sf2, 1, 1, 31, o->rn2, o->rm2, 0, 0));
+                    emit(&c, enc_ccmp(o->sf, o->mode, o->rn, o->mode ? (unsigned)o->imm : o->rm,
+                                      o->nz, o->cond2));
+                }
+                fix[nfix++] = i;
+                emit(&c, 0);
+                break;
+            case K_LOOP:
+                emit(&c, enc_movw(2, 9, o->n, 0, 1));
+                break;
+            case K_ENDLOOP:
+                emit(&c, enc_addsub_imm(1, 1, 1, 9, 9, 1, 0));
+                emit(&c, enc_bcond(c.n, start[i - o->n], 1));
+                break;
+            default:
+                emit_op(&c, o, CODE_TARGET / 4);
+                break;
+        }
+    }
+    start[sc->nops] = c.n;
+    if (c.n > cap) return 0;
+    for (size_t k = 0; k < nfix; k++) {
+        const struct op *o = &sc->ops[fix[k]];
+        size_t at = start[fix[k] + 1] - 1;
+        size_t to = start[fix[k] + 1 + o->n];
+        if (o->sub == S_CBZ) w[at] = enc_cb(o->sf, o->nz, o->rn, at, to);
+        else if (o->sub == S_TBZ) w[at] = enc_tb(o->nz, o->rn, o->amt, at, to);
+        else w[at] = enc_bcond(at, to, o->cond);
+    }
+    return c.n;
+}
+
+// ---- generation ----
+
+static void gen_logic_imm(uint64_t *s, struct op *o) {
+    static const unsigned sizes[] = {2, 4, 8, 16, 32, 64};
+    unsigned e = sizes[rng_below(s, o->sf ? 6 : 5)];
+    unsigned ones = rng_below(s, e - 1);
+    unsigned rot = rng_below(s, e);
+    o->imm = e | (uint64_t)ones << 8 | (uint64_t)rot << 16;
+}
+
+// One instruction, no memory, no control flow: safe in a prologue.
+static void gen_simple(uint64_t *s, const struct scenario *sc, struct op *o) {
+    memset(o, 0, sizeof(*o));
+    o->sf = rng_below(s, 4) != 0;
+    o->rd = (uint8_t)pick_reg(s, sc);
+    o->rn = (uint8_t)pick_reg(s, sc);
+    o->rm = (uint8_t)(rng_below(s, 12) ? pick_reg(s, sc) : 31);
+    o->ra = (uint8_t)(rng_below(s, 4) ? pick_reg(s, sc) : 31);
+    unsigned w = o->sf ? 64 : 32;
+    switch (rng_below(s, 3)) {
+        case 0:
+            o->kind = K_ALU;
+            o->sub = (uint8_t)rng_below(s, A_COUNT);
+#ifndef __SIZEOF_INT128__
+            if (o->sub == A_UMULH || o->sub == A_SMULH) o->sub = A_MADD;
+#endif
+            if (o->sub >= A_UMULH && o->sub <= A_UMSUBL) o->sf = 1, w = 64;
+            o->type = (uint8_t)rng_below(s, o->sub >= A_AND && o->sub <= A_BICS ? 4 : 3);
+            o->amt = (uint8_t)(rng_below(s, 3) ? rng_below(s, w) : 0);
+            if (o->sub == A_ADDX || o->sub == A_SUBX) {
+                o->type = (uint8_t)rng_below(s, o->sf ? 8 : 7);
+                o->amt = (uint8_t)rng_below(s, 5);
+                if (o->rm == 31) o->rm = 0;
+            }
+            if (o->sub == A_EXTR) o->amt = (uint8_t)rng_below(s, w);
+            break;
+        case 1:
+            o->kind = K_IMM;
+            o->sub = (uint8_t)rng_below(s, I_COUNT);
+            if (o->sub == I_REV32) o->sf = 1, w = 64;
+            switch (o->sub) {
+                case I_ADD: case I_SUB: case I_ADDS: case I_SUBS:
+                    o->imm = rng_below(s, 0x1000);
+                    if (rng_below(s, 4) == 0) o->imm <<= 12;
+                    break;
+                case I_AND: case I_ORR: case I_EOR: case I_ANDS:
+                    gen_logic_imm(s, o);
+                    break;
+                case I_LSL: case I_LSR: case I_ASR:
+                    o->amt = (uint8_t)rng_below(s, w);
+                    break;
+                case I_UBFX: case I_SBFX: case I_BFI: case I_BFXIL:
+                    o->amt = (uint8_t)rng_below(s, w);
+                    o->imm = 1 + rng_below(s, w - o->amt);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        default: {
+            static const uint8_t opcs[] = {0, 2, 3};
+            o->kind = K_MOVW;
+            o->sub = opcs[rng_below(s, 3)];
+            o->amt = (uint8_t)(16 * rng_below(s, o->sf ? 4 : 2));
+            o->imm = rng_next(s) & 0xffff;
+            break;
+        }
+    }
+}
+
+static unsigned gen_cond(uint64_t *s) {
+    return rng_below(s, 16);
+}
+
+// A plain op for the body: anything that runs straight through.
+static void gen_plain(uint64_t *s, const struct scenario *sc, struct op *o) {
+    unsigned pick = rng_below(s, 10);
+    if (pick < 5 || (pick >= 7 && !sc->frame)) {
+        gen_simple(s, sc, o);
+        return;
+    }
+    memset(o, 0, sizeof(*o));
+    o->sf = rng_below(s, 4) != 0;
+    o->sf2 = rng_below(s, 3) != 0;
+    o->rd = (uint8_t)pick_reg(s, sc);
+    o->rn = (uint8_t)pick_reg(s, sc);
+    o->rm = (uint8_t)pick_reg(s, sc);
+    o->ra = (uint8_t)pick_reg(s, sc);
+    o->rn2 = (uint8_t)pick_reg(s, sc);
+    o->rm2 = (uint8_t)pick_reg(s, sc);
+    if (pick == 5) {
+        o->kind = K_ADC;
+        o->sub = (uint8_t)rng_below(s, 2);
+        return;
+    }
+    if (pick == 6) {
+        o->kind = K_CSEL;
+        o->sub = (uint8_t)rng_below(s, 4);
+        o->cond = (uint8_t)gen_cond(s);
+        if (rng_below(s, 8) == 0) o->rm = 31;
+        return;
+    }
+    // Frame accesses. Stores write [slot_lo, FRAME), loads read it back.
+    o->kind = pick == 7 ? K_STORE : K_LOAD;
+    o->mode = (uint8_t)rng_below(s, M_COUNT);
+    o->size = (uint8_t)rng_below(s, 4);
+    if (o->kind == K_LOAD) {
+        // opc: 1 zero-extend, 2 sign-extend to 64, 3 sign-extend to 32.
+        unsigned max_opc = o->size == 3 ? 1 : o->size == 2 ? 2 : 3;
+        o->opc = (uint8_t)(1 + rng_below(s, max_opc));
+    }
+    if (o->mode == M_PAIR) {
+        o->size = (uint8_t)(rng_below(s, 2) ? 3 : 2);
+        if (o->kind == K_LOAD) o->opc = (uint8_t)(o->size == 2 && rng_below(s, 2) ? 2 : 1);
+        while (o->ra == o->rd) o->ra = (uint8_t)pick_reg(s, sc);
+    }
+    unsigned bytes = 1u << o->size;
+    unsigned span = o->mode == M_PAIR ? 2 * bytes : bytes;
+    unsigned room = FRAME - sc->slot_lo - span;
+    unsigned align = o->mode == M_UNSCALED || o->mode == M_PRE || o->mode == M_POST ? 1 : bytes;
+    o->off = (int32_t)(sc->slot_lo + rng_below(s, room / align + 1) * align);
+    if (o->mode == M_PRE) {
+        o->off2 = (int32_t)sc->slot_lo;
+    } else if (o->mode == M_POST) {
+        o->off2 = (int32_t)rng_below(s, 64) - 32;
+    } else if (o->mode == M_REG) {
+        static const uint8_t options[] = {2, 3, 6, 7};
+        o->type = options[rng_below(s, 4)];
+        o->amt = (uint8_t)rng_below(s, 2);
+        if (o->size == 0) o->amt = 0;
+    }
+}
+
+static void gen_skip(uint64_t *s, const struct scenario *sc, struct op *o, unsigned n) {
+    memset(o, 0, sizeof(*o));
+    o->kind = K_SKIP;
+    o->n = n;
+    o->sub = (uint8_t)rng_below(s, S_COUNT);
+    o->sf = rng_below(s, 3) != 0;
+    o->sf2 = rng_below(s, 3) != 0;
+    o->rn = (uint8_t)pick_reg(s, sc);
+    o->rm = (uint8_t)pick_reg(s, sc);
+    o->rn2 = (uint8_t)pick_reg(s, sc);
+    o->rm2 = (uint8_t)(rng_below(s, 4) ? pick_reg(s, sc) : o->rn2);
+    o->cond = (uint8_t)gen_cond(s);
+    o->cond2 = (uint8_t)gen_cond(s);
+    o->nz = (uint8_t)rng_below(s, o->sub == S_CCMP ? 16 : 2);
+    if (o->sub == S_CMPI) o->imm = rng_below(s, 0x1000);
+    if (o->sub == S_CCMP) {
+        o->mode = (uint8_t)rng_below(s, 2);
+        o->imm = rng_below(s, 32);
+    }
+    if (o->sub == S_TBZ) o->amt = (uint8_t)rng_below(s, 64);
+}
+
+static int add_op(struct scenario *sc, const struct op *o) {
+    if (sc->nops == MAX_OPS) return -1;
+    sc->ops[sc->nops++] = *o;
+    return 0;
+}
+
+static int add_raw(struct scenario *sc, uint32_t raw) {
+    struct op o;
+    memset(&o, 0, sizeof(o));
+    o.kind = K_RAW;
+    o.raw = raw;
+    return add_op(sc, &o);
+}
+
+// n plain ops, each maybe behind a skip over the next few.
+static int gen_run(uint64_t *s, struct scenario *sc, unsigned n) {
+    struct op o;
+    while (n > 0) {
+        if (n > 1 && rng_below(s, 4) == 0) {
+            unsigned k = 1 + rng_below(s, n - 1);
+            gen_skip(s, sc, &o, k);
+            if (add_op(sc, &o) != 0) return -1;
+            for (unsigned i = 0; i < k; i++) {
+                gen_plain(s, sc, &o);
+                if (add_op(sc, &o) != 0) return -1;
+            }
+            n -= k;
+            continue;
+        }
+        gen_plain(s, sc, &o);
+        if (add_op(sc, &o) != 0) return -1;
+        n--;
+    }
+    return 0;
+}
+
+static int gen_scenario(uint64_t *s, struct scenario *sc) {
+    struct op o;
+    memset(sc, 0, sizeof(*sc));
+    sc->frame = rng_below(s, 4) != 0;
+    sc->save_callee = sc->frame && rng_below(s, 2);
+    sc->slot_lo = sc->save_callee ? 32 : 16;
+    sc->wrap = rng_below(s, 2);
+    sc->hook_k = 1 + rng_below(s, 0xffff);
+    for (unsigned i = 0; i < 31; i++) sc->regs[i] = rng_value(s);
+
+    // Prologue: only instructions that still work when copied elsewhere.
+    int pac = rng_below(s, 3) == 0;
+    if (pac) add_raw(sc, INSN_PACIASP);
+    else if (rng_below(s, 3) == 0) add_raw(sc, INSN_BTI_C);
+    unsigned pre = rng_below(s, 3);
+    if (!sc->frame && pre == 0 && !pac) pre = 1;
+    // The registers x19/x20 are only usable after they are saved.
+    int saved = sc->save_callee;
+    sc->save_callee = 0;
+    for (unsigned i = 0; i < pre; i++) {
+        gen_simple(s, sc, &o);
+        add_op(sc, &o);
+    }
+    if (sc->frame) {
+        add_raw(sc, enc_ldstp(2, 0, 3, 29, 30, 31, -(int)FRAME));
+        add_raw(sc, enc_addsub_imm(1, 0, 0, 29, 31, 0, 0));
+        if (saved) add_raw(sc, enc_ldstp(2, 0, 2, 19, 20, 31, 16));
+    }
+    sc->save_callee = saved;
+    sc->prologue_insns = sc->nops;
+    sc->patch_insns = 1 + rng_below(s, (unsigned)sc->prologue_insns);
+
+    // Body: zero the slots, then runs of plain ops, loops and calls.
+    if (sc->frame) {
+        for (unsigned off = sc->slot_lo; off < FRAME; off += 16) {
+            add_raw(sc, enc_ldstp(2, 0, 2, 31, 31, 31, (int)off));
+        }
+    }
+    unsigned blocks = 2 + rng_below(s, 10);
+    for (unsigned b = 0; b < blocks; b++) {
+        unsigned pick = rng_below(s, 8);
+        if (pick == 0 && sc->frame) {
+            memset(&o, 0, sizeof(o));
+            o.kind = rng_below(s, 2) ? K_CALL : K_BL;
+            if (add_op(sc, &o) != 0) return -1;
+        } else if (pick == 1) {
+            size_t head = sc->nops;
+            memset(&o, 0, sizeof(o));
+            o.kind = K_LOOP;
+            o.n = 1 + rng_below(s, 6);
+            if (add_op(sc, &o) != 0) return -1;
+            if (gen_run(s, sc, 1 + rng_below(s, 5)) != 0) return -1;
+            memset(&o, 0, sizeof(o));
+            o.kind = K_ENDLOOP;
+            o.n = (uint32_t)(sc->nops - head - 1);
+            if (add_op(sc, &o) != 0) return -1;
+        } else if (gen_run(s, sc, 1 + rng_below(s, 6)) != 0) {
+            return -1;
+        }
+    }
+
+    // Fold a few registers into the result, then the epilogue.
+    for (unsigned i = 0; i < 3; i++) {
+        memset(&o, 0, sizeof(o));
+        o.kind = K_ALU;
+        o.sub = A_EOR;
+        o.sf = 1;
+        o.rd = 0;
+        o.rn = 0;
+        o.rm = (uint8_t)pick_reg(s, sc);
+        o.type = 3;
+        o.amt = (uint8_t)(7 * i + 1);
+        if (add_op(sc, &o) != 0) return -1;
+    }
+    if (sc->frame) {
+        if (saved) add_raw(sc, enc_ldstp(2, 1, 2, 19, 20, 31, 16));
+        add_raw(sc, enc_ldstp(2, 1, 1, 29, 30, 31, (int)FRAME));
+    }
+    if (pac && rng_below(s, 2)) {
+        add_raw(sc, INSN_RETAA);
+    } else {
+        if (pac) add_raw(sc, INSN_AUTIASP);
+        if (add_raw(sc, INSN_RET) != 0) return -1;
+    }
+    return 0;
+}
+
+// ---- running ----
+
+struct sim {
+    struct a64_emu emu;
+    uint8_t *code;          // PATCHER_PAGE_SIZE: target, helper, hook
+    uint8_t *data;          // STACK_BYTES: trampoline slot at 0, stack grows down from the end
+    int verbose;
+};
+
+static int host_mix(struct a64_emu *e, void *ctx) {
+    (void)ctx;
+    mix_call(e->cpu.x);
+    return 0;
+}
+
+static int host_print(struct a64_emu *e, void *ctx) {
+    printf("%s called with x=%d\n", (const char *)ctx, (int)(int32_t)e->cpu.x[0]);
+    return 0;
+}
+
+static int sim_open(struct sim *sm, int verbose) {
+    memset(sm, 0, sizeof(*sm));
+    sm->verbose = verbose;
+    if (a64_init(&sm->emu, 1024) != 0) return -1;
+    sm->code = mmap(NULL, PATCHER_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    sm->data = mmap(NULL, STACK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (sm->code == MAP_FAILED || sm->data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    a64_map(&sm->emu, sm->code, PATCHER_PAGE_SIZE, A64_R | A64_X);
+    a64_map(&sm->emu, sm->data, STACK_BYTES, A64_R | A64_W);
+    a64_host(&sm->emu, HOST_MIX, host_mix, NULL);
+    a64_host(&sm->emu, HOST_TARGET, host_print, "[target] target_function");
+    a64_host(&sm->emu, HOST_HOOK, host_print, "[hook] hook_function");
+    return 0;
+}
+
+static void sim_close(struct sim *sm) {
+    if (sm->code && sm->code != MAP_FAILED) munmap(sm->code, PATCHER_PAGE_SIZE);
+    if (sm->data && sm->data != MAP_FAILED) munmap(sm->data, STACK_BYTES);
+    a64_free(&sm->emu);
+}
+
+static uint64_t addr_of(const void *p) {
+    return (uint64_t)(uintptr_t)p;
+}
+
+static uint64_t stack_top(const struct sim *sm) {
+    return addr_of(sm->data + STACK_BYTES);
+}
+
+// Undo arm64_hotpatch's read+execute so the next scenario can be written.
+static int code_writable(struct sim *sm) {
+    if (mprotect(sm->code, PATCHER_PAGE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        return -1;
+    }
+    return 0;
+}
+
+static void write_code(struct sim *sm, size_t at, const uint32_t *w, size_t n) {
+    memcpy(sm->code + at, w, n * 4);
+}
+
+// Call fn on x0-x30 from `regs`, checking the ABI on the way out.
+static enum a64_status sim_call(struct sim *sm, uint64_t fn, const uint64_t *regs, uint64_t *ret,
+                                const char **abi) {
+    struct a64_cpu *c = &sm->emu.cpu;
+    memcpy(c->x, regs, sizeof(c->x));
+    uint64_t sp = stack_top(sm);
+    enum a64_status st = a64_call(&sm->emu, fn, regs, 8, sp, MAX_STEPS, ret);
+    *abi = NULL;
+    if (st != A64_OK) return st;
+    if (c->sp != sp) *abi = "sp not restored";
+    for (unsigned r = 19; r <= 28 && !*abi; r++) {
+        if (c->x[r] != regs[r]) *abi = "callee-saved register clobbered";
+    }
+    return st;
+}
+
+static void dump_code(const char *what, const uint8_t *p, size_t n) {
+    fprintf(stderr, "  %s:", what);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t w;
+        memcpy(&w, p + 4 * i, 4);
+        fprintf(stderr, "%s%08x", i % 8 ? " " : "\n    ", w);
+    }
+    fprintf(stderr, "\n");
+}
+
+struct totals {
+    uint64_t scenarios;
+    uint64_t failed;
+    uint64_t calls;
+};
+
+static int fail(struct sim *sm, uint64_t index, const char *stage, enum a64_status st,
+                const char *abi, uint64_t want, uint64_t got, size_t ninsns, const uint8_t *tramp,
+                size_t tramp_insns) {
+    fprintf(stderr, "patch_sim: scenario %llu: %s: ", (unsigned long long)index, stage);
+    if (st != A64_OK) {
+        fprintf(stderr, "%s at pc 0x%llx (insn 0x%08x, address 0x%llx)\n", a64_status_name(st),
+                (unsigned long long)sm->emu.cpu.pc, sm->emu.fault_insn,
+                (unsigned long long)sm->emu.fault_addr);
+    } else if (abi) {
+        fprintf(stderr, "%s\n", abi);
+    } else {
+        fprintf(stderr, "want 0x%llx, got 0x%llx\n", (unsigned long long)want,
+                (unsigned long long)got);
+    }
+    if (sm->verbose) {
+        dump_code("target", sm->code + CODE_TARGET, ninsns);
+        if (tramp) dump_code("trampoline", tramp, tramp_insns);
+    }
+    return -1;
+}
+
+static size_t assemble_hook(const struct scenario *sc, uint32_t *w, uint64_t slot) {
+    struct code c = {w, 0, 32};
+    if (sc->wrap) {
+        // orig(x0..x7) * k + x0, orig reached through the trampoline.
+        emit(&c, enc_ldstp(2, 0, 3, 29, 30, 31, -32));
+        emit(&c, enc_addsub_imm(1, 0, 0, 29, 31, 0, 0));
+        emit(&c, enc_ldst_uimm(3, 0, 0, 31, 16));
+        emit_mov64(&c, 17, slot);
+        emit(&c, enc_ldst_uimm(3, 1, 16, 17, 0));
+        emit(&c, INSN_BLR_X16);
+        emit(&c, enc_ldst_uimm(3, 1, 1, 31, 16));
+        emit(&c, enc_movw(2, 2, (unsigned)sc->hook_k, 0, 1));
+        emit(&c, enc_dp3(1, 0, 0, 0, 0, 2, 1));
+        emit(&c, enc_ldstp(2, 1, 1, 29, 30, 31, 32));
+    } else {
+        emit(&c, enc_movw(2, 9, (unsigned)sc->hook_k, 0, 1));
+        emit(&c, enc_logic_reg(1, 2, 0, 0, 0, 9, 0, 0));
+    }
+    emit(&c, INSN_RET);
+    return c.n;
+}
+
+static size_t assemble_helper(uint32_t *w) {
+    struct code c = {w, 0, 8};
+    emit(&c, enc_logic_reg(1, 2, 0, 0, 0, 1, 3, 7));
+    emit(&c, enc_addsub_imm(1, 0, 0, 0, 0, 3, 0));
+    emit(&c, INSN_RET);
+    return c.n;
+}
+
+static int run_scenario(struct sim *sm, uint64_t seed, uint64_t index, struct totals *t) {
+    static struct scenario sc;
+    uint32_t w[CODE_INSNS];
+    uint32_t hw[32];
+    uint64_t rs = seed ^ (index * 0xd1b54a32d192ed03ull);
+    size_t n;
+    do {
+        if (gen_scenario(&rs, &sc) != 0) n = 0;
+        else n = assemble(&sc, w, CODE_INSNS);
+    } while (n == 0);
+
+    uint64_t target = addr_of(sm->code + CODE_TARGET);
+    uint64_t slot = addr_of(sm->data);
+    size_t nh = assemble_hook(&sc, hw, slot);
+    uint32_t helper[8];
+    size_t nhelper = assemble_helper(helper);
+
+    if (code_writable(sm) != 0) return -1;
+    write_code(sm, CODE_TARGET, w, n);
+    write_code(sm, CODE_HELPER, helper, nhelper);
+    write_code(sm, CODE_HOOK, hw, nh);
+    t->scenarios++;
+
+    uint64_t orig = model_run(&sc);
+    uint64_t got;
+    const char *abi;
+    enum a64_status st = sim_call(sm, target, sc.regs, &got, &abi);
+    t->calls++;
+    if (st != A64_OK || abi || got != orig) {
+        return fail(sm, index, "before patch", st, abi, orig, got, n, NULL, 0);
+    }
+
+    size_t k = sc.patch_insns;
+    void *tramp = arm64_patch_prologue(sm->code + CODE_TARGET, sm->code + CODE_HOOK, 4 * k);
+    if (!tramp) {
+        fprintf(stderr, "patch_sim: scenario %llu: arm64_patch_prologue failed\n",
+                (unsigned long long)index);
+        return -1;
+    }
+    size_t tramp_bytes = 4 * k + 4;
+    memcpy(sm->data, &tramp, sizeof(tramp));
+    a64_map(&sm->emu, tramp, tramp_bytes, A64_R | A64_X);
+
+    int rc = 0;
+    uint64_t want = sc.wrap ? orig * sc.hook_k + sc.regs[0] : sc.regs[0] ^ sc.hook_k;
+    st = sim_call(sm, target, sc.regs, &got, &abi);
+    t->calls++;
+    if (st != A64_OK || abi || got != want) {
+        rc = fail(sm, index, "after patch", st, abi, want, got, n, tramp, k + 1);
+    } else {
+        st = sim_call(sm, addr_of(tramp), sc.regs, &got, &abi);
+        t->calls++;
+        if (st != A64_OK || abi || got != orig) {
+            rc = fail(sm, index, "trampoline", st, abi, orig, got, n, tramp, k + 1);
+        }
+    }
+
+    a64_unmap(&sm->emu, tramp);
+    munmap(tramp, tramp_bytes);
+    return rc;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// patch_demo's flow, with target_function and hook_function hand-assembled.
+static int run_demo(struct sim *sm) {
+    uint32_t w[32];
+    struct code c = {w, 0, 32};
+    emit(&c, enc_ldstp(2, 0, 3, 29, 30, 31, -32));      // stp x29, x30, [sp, #-32]!
+    emit(&c, enc_addsub_imm(1, 0, 0, 29, 31, 0, 0));    // mov x29, sp
+    emit(&c, enc_ldst_uimm(3, 0, 0, 31, 16));           // str x0, [sp, #16]
+    emit_mov64(&c, 16, HOST_TARGET);
+    emit(&c, INSN_BLR_X16);                             // printf
+    emit(&c, enc_ldst_uimm(3, 1, 0, 31, 16));           // ldr x0, [sp, #16]
+    emit(&c, enc_addsub_imm(0, 0, 0, 0, 0, 1, 0));      // add w0, w0, #1
+    emit(&c, enc_ldstp(2, 1, 1, 29, 30, 31, 32));       // ldp x29, x30, [sp], #32
+    emit(&c, INSN_RET);
+    size_t nt = c.n;
+
+    uint32_t hw[16];
+    struct code h = {hw, 0, 16};
+    emit(&h, enc_ldstp(2, 0, 3, 29, 30, 31, -16));
+    emit(&h, enc_addsub_imm(1, 0, 0, 29, 31, 0, 0));
+    emit_mov64(&h, 16, HOST_HOOK);
+    emit(&h, INSN_BLR_X16);
+    emit(&h, enc_movw(2, 0, 1337, 0, 0));               // mov w0, #1337
+    emit(&h, enc_ldstp(2, 1, 1, 29, 30, 31, 16));
+    emit(&h, INSN_RET);
+
+    if (code_writable(sm) != 0) return 1;
+    write_code(sm, CODE_TARGET, w, nt);
+    write_code(sm, CODE_HOOK, hw, h.n);
+
+    uint64_t target = addr_of(sm->code + CODE_TARGET);
+    uint64_t regs[31] = {41};
+    uint64_t ret;
+    const char *abi;
+
+    printf("[demo] calling target_function before patch\n");
+    if (sim_call(sm, target, regs, &ret, &abi) != A64_OK || abi) return 1;
+    printf("[demo] result=%d\n", (int)(int32_t)ret);
+
+    printf("[demo] patching prologue\n");
+    void *tramp = arm64_patch_prologue(sm->code + CODE_TARGET, sm->code + CODE_HOOK, 4);
+    if (!tramp) {
+        fprintf(stderr, "error: patch failed\n");
+        return 1;
+    }
+    a64_map(&sm->emu, tramp, 8, A64_R | A64_X);
+
+    printf("[demo] calling target_function after patch\n");
+    if (sim_call(sm, target, regs, &ret, &abi) != A64_OK || abi) return 1;
+    printf("[demo] result=%d\n", (int)(int32_t)ret);
+
+    printf("[demo] calling the original through the trampoline\n");
+    if (sim_call(sm, addr_of(tramp), regs, &ret, &abi) != A64_OK || abi) return 1;
+    printf("[demo] result=%d\n", (int)(int32_t)ret);
+
+    a64_unmap(&sm->emu, tramp);
+    munmap(tramp, 8);
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-n COUNT] [-s SEED] [-v]\n", argv0);
+    fprintf(stderr, "       %s --demo\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    uint64_t count = 10000;
+    uint64_t seed = 1;
+    int verbose = 0;
+    int demo = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--demo") == 0) {
+            demo = 1;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    struct sim sm;
+    if (sim_open(&sm, verbose) != 0) {
+        sim_close(&sm);
+        return 1;
+    }
+    if (demo) {
+        int rc = run_demo(&sm);
+        sim_close(&sm);
+        return rc;
+    }
+
+    struct totals t = {0, 0, 0};
+    double t0 = now_seconds();
+    for (uint64_t i = 0; i < count; i++) {
+        if (run_scenario(&sm, seed, i, &t) != 0) {
+            t.failed++;
+            if (t.failed >= 10) break;
+        }
+    }
+    double secs = now_seconds() - t0;
+    if (secs <= 0) secs = 1e-9;
+
+    uint64_t steps = sm.emu.steps;
+    uint64_t decodes = sm.emu.decodes;
+    printf("scenarios: %llu, failed: %llu, seed: %llu\n", (unsigned long long)t.scenarios,
+           (unsigned long long)t.failed, (unsigned long long)seed);
+    printf("calls: %llu, instructions: %llu, decoded: %llu (%.1f%% cache hits)\n",
+           (unsigned long long)t.calls, (unsigned long long)steps, (unsigned long long)decodes,
+           steps ? 100.0 * (double)(steps - decodes) / (double)steps : 0.0);
+    printf("time: %.3f s, %.0f scenarios/s, %.1f M instructions/s\n", secs,
+           (double)t.scenarios / secs, (double)steps / secs / 1e6);
+    sim_close(&sm);
+    return t.failed ? 1 : 0;
+}
@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE        // MAP_ANON
+#endif
+
 #include "patcher.h"
 
 #include <stdio.h>
@@ -23,6 +23,10 @@ int arm64_patch_b(void *src, const void *dst);
 void *arm64_make_trampoline(void *src, size_t insn_bytes);
 
 // High-level prologue patch: redirect src to hook and return trampoline.
+// insn_bytes is copied verbatim into the trampoline, so it must not contain
+// PC-relative instructions or a branch target; `macho_inspect --cfg` reports
+// a safe value per function as patch_bytes, and `macho_inspect --match OLD
+// NEW` re-finds a hooked function in a new build with the value there.
 void *arm64_patch_prologue(void *src, void *hook, size_t insn_bytes);
 
 // Hot-patch engine: make page writable, apply patch, flush cache.
@@ -1,13 +1,24 @@
-# ABOUTME: Runs the ARM64 patch demo and checks the expected output lines.
+# ABOUTME: Runs the ARM64 patch demo (patch_sim everywhere, patch_demo on macOS arm64)
+# ABOUTME: and checks the expected output lines.
 # ABOUTME: Used as a minimal regression test for the runtime patching flow.
 #!/usr/bin/env sh
 set -eu
 
+# The interpreter-backed run works on every host.
+SIM_OUTPUT=$(./arm64-patching/patch_sim --demo 2>&1)
+
+echo "$SIM_OUTPUT" | grep -q "\\[target\\] target_function called with x=41"
+echo "$SIM_OUTPUT" | grep -q "\\[hook\\] hook_function called with x=41"
+echo "$SIM_OUTPUT" | grep -q "\\[demo\\] result=1337"
+[ "$(echo "$SIM_OUTPUT" | grep -c "\\[demo\\] result=42")" -eq 2 ]
+
+./arm64-patching/patch_sim -n 2000 >/dev/null
+
 UNAME_S=$(uname -s)
 UNAME_M=$(uname -m)
 
 if [ "$UNAME_S" != "Darwin" ] || [ "$UNAME_M" != "arm64" ]; then
-    echo "skip: requires macOS arm64"
+    echo "skip: patch_demo requires macOS arm64"
     exit 0
 fi
 
@@ -3,13 +3,86 @@
 
 #include <stdint.h>
 
+// Thread state flavors as they appear in LC_THREAD / LC_UNIXTHREAD: a
+// sequence of { uint32_t flavor; uint32_t count; uint32_t state[count]; }.
+// Counts are in 32-bit words.
+
+// arm / arm64 (mach/arm/thread_status.h)
+#ifndef ARM_THREAD_STATE
+#define ARM_THREAD_STATE 1          // arm_unified_thread_state: hdr + 32/64 state
+#endif
+#ifndef ARM_EXCEPTION_STATE
+#define ARM_EXCEPTION_STATE 3
+#endif
+#ifndef ARM_DEBUG_STATE
+#define ARM_DEBUG_STATE 4
+#endif
 #ifndef ARM_THREAD_STATE64
 #define ARM_THREAD_STATE64 6
 #endif
+#ifndef ARM_EXCEPTION_STATE64
+#define ARM_EXCEPTION_STATE64 7
+#endif
+#ifndef ARM_THREAD_STATE32
+#define ARM_THREAD_STATE32 9
+#endif
+#ifndef ARM_DEBUG_STATE64
+#define ARM_DEBUG_STATE64 15
+#endif
+#ifndef ARM_NEON_STATE64
+#define ARM_NEON_STATE64 17
+#endif
 
 #ifndef ARM_THREAD_STATE64_COUNT
 #define ARM_THREAD_STATE64_COUNT 68
 #endif
+#ifndef ARM_EXCEPTION_STATE64_COUNT
+#define ARM_EXCEPTION_STATE64_COUNT 4
+#endif
+// The kernel's arm_neon_state64 is 16-byte aligned, so fpsr/fpcr are
+// followed by 8 bytes of padding: 132 words, of which 130 carry data.
+#ifndef ARM_NEON_STATE64_COUNT
+#define ARM_NEON_STATE64_COUNT 132
+#endif
+
+// x86_64 (mach/i386/thread_status.h)
+#ifndef x86_THREAD_STATE64
+#define x86_THREAD_STATE64 4
+#endif
+#ifndef x86_FLOAT_STATE64
+#define x86_FLOAT_STATE64 5
+#endif
+#ifndef x86_EXCEPTION_STATE64
+#define x86_EXCEPTION_STATE64 6
+#endif
+#ifndef x86_THREAD_STATE
+#define x86_THREAD_STATE 7          // x86_thread_state: hdr + 32/64 state
+#endif
+#ifndef x86_FLOAT_STATE
+#define x86_FLOAT_STATE 8
+#endif
+#ifndef x86_EXCEPTION_STATE
+#define x86_EXCEPTION_STATE 9
+#endif
+#ifndef x86_DEBUG_STATE64
+#define x86_DEBUG_STATE64 11
+#endif
+
+#ifndef x86_THREAD_STATE64_COUNT
+#define x86_THREAD_STATE64_COUNT 42
+#endif
+#ifndef x86_FLOAT_STATE64_COUNT
+#define x86_FLOAT_STATE64_COUNT 131
+#endif
+#ifndef x86_EXCEPTION_STATE64_COUNT
+#define x86_EXCEPTION_STATE64_COUNT 4
+#endif
+
+// Header of the unified ARM_THREAD_STATE / x86_*_STATE flavors.
+struct thread_state_hdr {
+    uint32_t flavor;
+    uint32_t count;
+};
 
 struct arm_thread_state64 {
     uint64_t x[29];
@@ -21,4 +94,51 @@ struct arm_thread_state64 {
     uint32_t pad;
 };
 
+struct arm_exception_state64 {
+    uint64_t far;
+    uint32_t esr;
+    uint32_t exception;
+};
+
+struct arm_neon_state64 {
+    uint8_t v[32][16];
+    uint32_t fpsr;
+    uint32_t fpcr;
+};
+
+struct x86_thread_state64 {
+    uint64_t rax, rbx, rcx, rdx, rdi, rsi, rbp, rsp;
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    uint64_t rip, rflags, cs, fs, gs;
+};
+
+struct x86_exception_state64 {
+    uint16_t trapno;
+    uint16_t cpu;
+    uint32_t err;
+    uint64_t faultvaddr;
+};
+
+// fxsave layout plus Mach's leading reserved words.
+struct x86_float_state64 {
+    uint32_t fpu_reserved[2];
+    uint16_t fcw;
+    uint16_t fsw;
+    uint8_t ftw;
+    uint8_t rsrv1;
+    uint16_t fop;
+    uint32_t ip;
+    uint16_t cs;
+    uint16_t rsrv2;
+    uint32_t dp;
+    uint16_t ds;
+    uint16_t rsrv3;
+    uint32_t mxcsr;
+    uint32_t mxcsrmask;
+    uint8_t stmm[8][16];
+    uint8_t xmm[16][16];
+    uint8_t rsrv4[96];
+    uint32_t reserved1;
+};
+
 #endif /* _MACH_MACHINE_THREAD_STATUS_H_ */
@@ -0,0 +1,90 @@
+#ifndef _MACHO_FIXUP_CHAINS_H_
+#define _MACHO_FIXUP_CHAINS_H_
+
+#include <stdint.h>
+
+// Chained fixups (LC_DYLD_CHAINED_FIXUPS), after dyld's
+// <mach-o/fixup-chains.h>. The payload starts with
+// dyld_chained_fixups_header; the imports table and the per-segment chain
+// starts hang off it. Pointer and import records are bitfields in Apple's
+// header; here they are documented and decoded with shifts (64-bit
+// bitfields are not ISO C).
+
+#define DYLD_CHAINED_IMPORT          1
+#define DYLD_CHAINED_IMPORT_ADDEND   2
+#define DYLD_CHAINED_IMPORT_ADDEND64 3
+
+struct dyld_chained_fixups_header {
+    uint32_t fixups_version;   // 0
+    uint32_t starts_offset;    // to dyld_chained_starts_in_image
+    uint32_t imports_offset;   // to the imports table
+    uint32_t symbols_offset;   // to the symbol name pool
+    uint32_t imports_count;
+    uint32_t imports_format;   // DYLD_CHAINED_IMPORT*
+    uint32_t symbols_format;   // 0 = uncompressed
+};
+
+// One entry per segment; 0 means the segment has no fixups. Offsets are
+// from the start of this struct.
+struct dyld_chained_starts_in_image {
+    uint32_t seg_count;
+    uint32_t seg_info_offset[1];   // [seg_count]
+};
+
+struct dyld_chained_starts_in_segment {
+    uint32_t size;                 // of this struct, page_start included
+    uint16_t page_size;            // 0x1000 or 0x4000
+    uint16_t pointer_format;       // DYLD_CHAINED_PTR_*
+    uint64_t segment_offset;       // from the mach_header to the segment
+    uint32_t max_valid_pointer;    // 32-bit formats only
+    uint16_t page_count;
+    uint16_t page_start[1];        // [page_count]: offset of the first fixup
+};
+
+#define DYLD_CHAINED_PTR_START_NONE  0xFFFF   // page has no fixups
+#define DYLD_CHAINED_PTR_START_MULTI 0x8000   // 32-bit: index of overflow starts
+#define DYLD_CHAINED_PTR_START_LAST  0x8000   // last start in an overflow list
+
+// Import records (all fields little-endian bit order, low bits first):
+//   DYLD_CHAINED_IMPORT         uint32: lib_ordinal:8 weak_import:1 name_offset:23
+//   DYLD_CHAINED_IMPORT_ADDEND  the same, then int32 addend
+//   DYLD_CHAINED_IMPORT_ADDEND64 uint64: lib_ordinal:16 weak_import:1
+//                               reserved:15 name_offset:32, then uint64 addend
+// 8- and 16-bit ordinals are sign-extended for the special values
+// (0xFF/0xFFFF = -1 main executable, 0xFE = -2 flat, 0xFD = -3 weak).
+
+enum {
+    DYLD_CHAINED_PTR_ARM64E              = 1,    // unauth target is vmaddr
+    DYLD_CHAINED_PTR_64                  = 2,    // target is vmaddr
+    DYLD_CHAINED_PTR_32                  = 3,
+    DYLD_CHAINED_PTR_32_CACHE            = 4,
+    DYLD_CHAINED_PTR_32_FIRMWARE         = 5,
+    DYLD_CHAINED_PTR_64_OFFSET           = 6,    // target is vm offset
+    DYLD_CHAINED_PTR_ARM64E_KERNEL       = 7,    // unauth target is vm offset
+    DYLD_CHAINED_PTR_64_KERNEL_CACHE     = 8,
+    DYLD_CHAINED_PTR_ARM64E_USERLAND     = 9,    // unauth target is vm offset
+    DYLD_CHAINED_PTR_ARM64E_FIRMWARE     = 10,   // unauth target is vmaddr
+    DYLD_CHAINED_PTR_X86_64_KERNEL_CACHE = 11,
+    DYLD_CHAINED_PTR_ARM64E_USERLAND24   = 12,   // USERLAND with 24-bit bind ordinals
+    DYLD_CHAINED_PTR_ARM64E_SHARED_CACHE = 13,
+    DYLD_CHAINED_PTR_ARM64E_SEGMENTED    = 14,
+};
+
+// Pointer layouts (uint64 unless noted, low bits first):
+//   arm64e rebase       target:43 high8:8 next:11 bind:1(0) auth:1(0)
+//   arm64e bind         ordinal:16 zero:16 addend:19 next:11 bind:1(1) auth:1(0)
+//   arm64e auth rebase  target:32 diversity:16 addrDiv:1 key:2 next:11 bind:1(0) auth:1(1)
+//   arm64e auth bind    ordinal:16 zero:16 diversity:16 addrDiv:1 key:2 next:11
+//                       bind:1(1) auth:1(1)
+//   arm64e bind24 / auth bind24: ordinal widened to 24 bits, zero:8
+//   64 rebase           target:36 high8:8 reserved:7 next:12 bind:1(0)
+//   64 bind             ordinal:24 addend:8 reserved:19 next:12 bind:1(1)
+//   64 kernel cache     target:30 cacheLevel:2 diversity:16 addrDiv:1 key:2
+//                       next:12 isAuth:1
+//   32 rebase (uint32)  target:26 next:5 bind:1(0)
+//   32 bind (uint32)    ordinal:20 addend:6 next:5 bind:1(1)
+// `next` counts strides to the next fixup on the page; 0 ends the chain.
+// The stride is 8 bytes for ARM64E, ARM64E_USERLAND(24) and
+// ARM64E_SHARED_CACHE, 1 byte for X86_64_KERNEL_CACHE, 4 bytes otherwise.
+
+#endif /* _MACHO_FIXUP_CHAINS_H_ */
@@ -0,0 +1,43 @@
+#ifndef _MACHO_STAB_H_
+#define _MACHO_STAB_H_
+
+// Symbolic debugging entries, after <mach-o/stab.h>. An nlist entry is a
+// stab when (n_type & N_STAB) != 0; n_type is then one of the values
+// below. ld keeps these in a linked image as the "debug map" dsymutil
+// reads: per compile unit an N_SO pair (directory, file), an N_OSO naming
+// the object file (archive members as "lib.a(member.o)"), then N_FUN /
+// N_STSYM / N_GSYM per symbol, closed by an N_SO with an empty name.
+
+#define N_GSYM   0x20   /* global symbol: name,,NO_SECT,type,0 */
+#define N_FNAME  0x22   /* procedure name (f77 kludge): name,,NO_SECT,0,0 */
+#define N_FUN    0x24   /* procedure: name,,n_sect,linenumber,address;
+                           a second N_FUN with an empty name carries the size */
+#define N_STSYM  0x26   /* static symbol: name,,n_sect,type,address */
+#define N_LCSYM  0x28   /* .lcomm symbol: name,,n_sect,type,address */
+#define N_BNSYM  0x2e   /* begin nsect sym: 0,,n_sect,0,address */
+#define N_AST    0x32   /* AST file path: name,,NO_SECT,0,0 */
+#define N_OPT    0x3c   /* emitted with gcc2_compiled and in gcc source */
+#define N_RSYM   0x40   /* register sym: name,,NO_SECT,type,register */
+#define N_SLINE  0x44   /* src line: 0,,n_sect,linenumber,address */
+#define N_ENSYM  0x4e   /* end nsect sym: 0,,n_sect,0,address */
+#define N_SSYM   0x60   /* structure elt: name,,NO_SECT,type,struct_offset */
+#define N_SO     0x64   /* source file name: name,,n_sect,0,address */
+#define N_OSO    0x66   /* object file name: name,,0,0,st_mtime */
+#define N_LSYM   0x80   /* local sym: name,,NO_SECT,type,offset */
+#define N_BINCL  0x82   /* include file beginning: name,,NO_SECT,0,sum */
+#define N_SOL    0x84   /* #included file name: name,,n_sect,0,address */
+#define N_PARAMS 0x86   /* compiler parameters: name,,NO_SECT,0,0 */
+#define N_VERSION 0x88  /* compiler version: name,,NO_SECT,0,0 */
+#define N_OLEVEL 0x8a   /* compiler -O level: name,,NO_SECT,0,0 */
+#define N_PSYM   0xa0   /* parameter: name,,NO_SECT,type,offset */
+#define N_EINCL  0xa2   /* include file end: name,,NO_SECT,0,0 */
+#define N_ENTRY  0xa4   /* alternate entry: name,,n_sect,linenumber,address */
+#define N_LBRAC  0xc0   /* left bracket: 0,,NO_SECT,nesting level,address */
+#define N_EXCL   0xc2   /* deleted include file: name,,NO_SECT,0,sum */
+#define N_RBRAC  0xe0   /* right bracket: 0,,NO_SECT,nesting level,address */
+#define N_BCOMM  0xe2   /* begin common: name,,NO_SECT,0,0 */
+#define N_ECOMM  0xe4   /* end common: name,,n_sect,0,0 */
+#define N_ECOML  0xe8   /* end common (local name): 0,,n_sect,0,address */
+#define N_LENG   0xfe   /* second stab entry with length information */
+
+#endif /* _MACHO_STAB_H_ */
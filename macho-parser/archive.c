@@ -0,0 +1,417 @@
+#include "archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/nlist.h"
+#include "../include/macho/ranlib.h"
+
+#include "macho_common.h"
+#include "macho_image.h"
+#include "parallel.h"
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_HDR 60
+
+int ar_is_archive(const uint8_t *buf, size_t size) {
+    return size >= 8 && memcmp(buf, AR_MAGIC, 8) == 0;
+}
+
+// Decimal field, space padded.
+static int ar_num(const uint8_t *p, size_t len, uint64_t *out) {
+    uint64_t v = 0;
+    size_t i = 0;
+    while (i < len && p[i] == ' ') i++;
+    if (i == len || p[i] < '0' || p[i] > '9') return -1;
+    for (; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+        if (v > (UINT64_MAX - 9) / 10) return -1;
+        v = v * 10 + (uint64_t)(p[i] - '0');
+    }
+    for (; i < len; i++) {
+        if (p[i] != ' ') return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+static int cmp_offset(const void *a, const void *b) {
+    const struct ar_member *x = a;
+    const struct ar_member *y = b;
+    return (x->header_offset > y->header_offset) - (x->header_offset < y->header_offset);
+}
+
+// Parse a ranlib table. The table is in the target's byte order, which is
+// not recorded anywhere: take the order in which its size field fits.
+static int parse_symdef(struct ar_archive *ar, const uint8_t *d, uint64_t size, int is64,
+                        char *errbuf, size_t errlen) {
+    size_t w = is64 ? 8 : 4;
+    if (size < w) goto bad;
+    int sw = 0;
+    uint64_t tab = is64 ? load64_u(d, 0) : load32_u(d, 0);
+    if (tab > size - w) {
+        sw = 1;
+        tab = is64 ? load64_u(d, 1) : load32_u(d, 1);
+        if (tab > size - w) goto bad;
+    }
+    size_t entsz = 2 * w;
+    if (tab % entsz != 0 || size - w - tab < w) goto bad;
+    const uint8_t *strsz_p = d + w + tab;
+    uint64_t strsize = is64 ? load64_u(strsz_p, sw) : load32_u(strsz_p, sw);
+    if (strsize > size - w - tab - w) goto bad;
+    const char *strtab = (const char *)strsz_p + w;
+
+    size_t n = (size_t)(tab / entsz);
+    ar->symdefs = calloc(n ? n : 1, sizeof(*ar->symdefs));
+    if (!ar->symdefs) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *e = d + w + i * entsz;
+        uint64_t strx = is64 ? load64_u(e, sw) : load32_u(e, sw);
+        uint64_t off = is64 ? load64_u(e + w, sw) : load32_u(e + w, sw);
+        if (strx >= strsize || !memchr(strtab + strx, '\0', (size_t)(strsize - strx))) continue;
+        struct ar_symdef *s = &ar->symdefs[ar->nsymdefs++];
+        s->name = strtab + strx;
+        s->header_offset = off;
+        s->member = SIZE_MAX;
+    }
+    ar->symdef_64 = is64;
+    return 0;
+
+bad:
+    snprintf(errbuf, errlen, "malformed %s table of contents", is64 ? SYMDEF_64 : SYMDEF);
+    return -1;
+}
+
+int ar_open(struct ar_archive *ar, const uint8_t *buf, size_t size,
+            char *errbuf, size_t errlen) {
+    memset(ar, 0, sizeof(*ar));
+    if (!ar_is_archive(buf, size)) {
+        snprintf(errbuf, errlen, "not an ar archive");
+        return -1;
+    }
+
+    // Upper bound on members. Names point into the archive until the walk
+    // is done, then get copied out NUL-terminated.
+    size_t cap = (size - 8) / AR_HDR + 1;
+    ar->members = calloc(cap, sizeof(*ar->members));
+    size_t *name_lens = calloc(cap, sizeof(*name_lens));
+    if (!ar->members || !name_lens) {
+        free(name_lens);
+        ar_close(ar);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    const char *gnu_names = NULL;
+    uint64_t gnu_names_len = 0;
+    const uint8_t *symdef = NULL;
+    uint64_t symdef_size = 0;
+    int symdef64 = 0;
+
+    uint64_t pos = 8;
+    while (pos + AR_HDR <= size) {
+        const uint8_t *h = buf + pos;
+        uint64_t msize;
+        if (h[58] != '`' || h[59] != '\n' || ar_num(h + 48, 10, &msize) != 0 ||
+            msize > size - pos - AR_HDR) {
+            free(name_lens);
+            ar_close(ar);
+            snprintf(errbuf, errlen, "bad ar header at offset %llu", (unsigned long long)pos);
+            return -1;
+        }
+        const uint8_t *data = h + AR_HDR;
+        const char *raw = (const char *)h;
+        size_t name_len = 16;
+
+        if (memcmp(raw, "#1/", 3) == 0) {
+            // BSD: name in front of the data, counted in the member size.
+            uint64_t l;
+            if (ar_num(h + 3, 13, &l) != 0 || l > msize) {
+                free(name_lens);
+                ar_close(ar);
+                snprintf(errbuf, errlen, "bad long name at offset %llu", (unsigned long long)pos);
+                return -1;
+            }
+            raw = (const char *)data;
+            name_len = (size_t)l;
+            data += l;
+            msize -= l;
+            const char *nul = memchr(raw, '\0', name_len);
+            if (nul) name_len = (size_t)(nul - raw);
+        } else if (raw[0] == '/' && raw[1] == '/' && raw[2] == ' ') {
+            gnu_names = (const char *)data;
+            gnu_names_len = msize;
+            name_len = 0;
+        } else if (raw[0] == '/' && raw[1] >= '0' && raw[1] <= '9') {
+            uint64_t idx;
+            size_t digits = 1;
+            while (digits < 15 && raw[1 + digits] >= '0' && raw[1 + digits] <= '9') digits++;
+            if (!gnu_names || ar_num(h + 1, digits, &idx) != 0 || idx >= gnu_names_len) {
+                free(name_lens);
+                ar_close(ar);
+                snprintf(errbuf, errlen, "bad GNU long name at offset %llu",
+                         (unsigned long long)pos);
+                return -1;
+            }
+            raw = gnu_names + idx;
+            name_len = 0;
+            while (idx + name_len < gnu_names_len && raw[name_len] != '/' &&
+                   raw[name_len] != '\n') {
+                name_len++;
+            }
+        } else {
+            while (name_len > 0 && raw[name_len - 1] == ' ') name_len--;
+            if (name_len > 1 && raw[name_len - 1] == '/') name_len--;    // GNU "name/"
+        }
+
+        int skip = name_len == 0 || (name_len == 1 && raw[0] == '/');   // GNU symbol table
+        if (!skip && ((name_len == 9 && memcmp(raw, SYMDEF, 9) == 0) ||
+                      (name_len == 16 && memcmp(raw, SYMDEF_SORTED, 16) == 0))) {
+            symdef = data;
+            symdef_size = msize;
+            symdef64 = 0;
+            ar->symdef_sorted = name_len == 16;
+            skip = 1;
+        } else if (!skip && ((name_len == 12 && memcmp(raw, SYMDEF_64, 12) == 0) ||
+                             (name_len == 19 && memcmp(raw, SYMDEF_64_SORTED, 19) == 0))) {
+            symdef = data;
+            symdef_size = msize;
+            symdef64 = 1;
+            ar->symdef_sorted = name_len == 19;
+            skip = 1;
+        }
+
+        if (!skip) {
+            struct ar_member *m = &ar->members[ar->n];
+            name_lens[ar->n++] = name_len;
+            m->name = raw;
+            m->header_offset = pos;
+            m->data = data;
+            m->size = msize;
+        }
+
+        pos = (uint64_t)(data - buf) + msize;
+        pos += pos & 1;     // members are 2-byte aligned
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < ar->n; i++) total += name_lens[i] + 1;
+    ar->names = malloc(total ? total : 1);
+    if (!ar->names) {
+        free(name_lens);
+        ar_close(ar);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    char *np = ar->names;
+    for (size_t i = 0; i < ar->n; i++) {
+        memcpy(np, ar->members[i].name, name_lens[i]);
+        np[name_lens[i]] = '\0';
+        ar->members[i].name = np;
+        np += name_lens[i] + 1;
+    }
+    free(name_lens);
+
+    for (size_t i = 0; i < ar->n; i++) {
+        struct ar_member *m = &ar->members[i];
+        if (((uintptr_t)m->data & 7) == 0 || m->size == 0) continue;
+        if (!ar->copies) ar->copies = calloc(ar->n, sizeof(*ar->copies));
+        uint8_t *c = ar->copies ? malloc((size_t)m->size) : NULL;
+        if (!c) {
+            ar_close(ar);
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+        memcpy(c, m->data, (size_t)m->size);
+        ar->copies[ar->ncopies++] = c;
+        m->data = c;
+    }
+
+    if (symdef && parse_symdef(ar, symdef, symdef_size, symdef64, errbuf, errlen) != 0) {
+        ar_close(ar);
+        return -1;
+    }
+    // Members are already in offset order; resolve each SYMDEF entry by
+    // binary search on the header offset.
+    for (size_t i = 0; i < ar->nsymdefs; i++) {
+        struct ar_member key;
+        key.header_offset = ar->symdefs[i].header_offset;
+        const struct ar_member *m = bsearch(&key, ar->members, ar->n, sizeof(*ar->members),
+                                            cmp_offset);
+        if (m) ar->symdefs[i].member = (size_t)(m - ar->members);
+    }
+    return 0;
+}
+
+void ar_close(struct ar_archive *ar) {
+    for (size_t i = 0; i < ar->ncopies; i++) free(ar->copies[i]);
+    free(ar->copies);
+    free(ar->members);
+    free(ar->symdefs);
+    free(ar->names);
+    memset(ar, 0, sizeof(*ar));
+}
+
+const struct ar_member *ar_find(const struct ar_archive *ar, const char *name) {
+    for (size_t i = 0; i < ar->n; i++) {
+        if (strcmp(ar->members[i].name, name) == 0) return &ar->members[i];
+    }
+    return NULL;
+}
+
+struct index_worker {
+    struct ar_symbol *syms;
+    size_t n;
+    size_t cap;
+    size_t nundefined;
+    size_t bad;
+    int oom;
+};
+
+struct index_ctx {
+    const struct ar_archive *ar;
+    struct ar_member_info *info;
+    struct index_worker *workers;
+};
+
+static void index_member(size_t begin, size_t end, unsigned worker, void *arg) {
+    struct index_ctx *c = arg;
+    struct index_worker *w = &c->workers[worker];
+    for (size_t i = begin; i < end; i++) {
+        const struct ar_member *m = &c->ar->members[i];
+        struct ar_member_info *info = &c->info[i];
+        struct macho_image img;
+        if (macho_image_load(&img, m->data, (size_t)m->size, NULL, 0) != 0) {
+            w->bad++;
+            continue;
+        }
+        info->ok = 1;
+        info->cputype = img.cputype;
+        info->filetype = img.filetype;
+        info->nsects = (uint32_t)img.nsects;
+        for (size_t s = 0; s < img.nsects; s++) info->nreloc += img.sects[s].nreloc;
+
+        for (uint32_t k = 0; k < img.nsyms; k++) {
+            struct macho_symbol sym;
+            if (macho_image_symbol(&img, k, &sym) != 0) continue;
+            if ((sym.type & N_STAB) || !(sym.type & N_EXT)) continue;
+            uint8_t t = sym.type & N_TYPE;
+            if (t == N_UNDF) {
+                // Common symbols are N_UNDF with a size; they are definitions.
+                if (sym.addr == 0) {
+                    info->nundefined++;
+                    continue;
+                }
+            } else if (t != N_SECT) {
+                continue;
+            }
+            info->ndefined++;
+            if (w->n == w->cap) {
+                size_t ncap = w->cap ? w->cap * 2 : 256;
+                struct ar_symbol *v = realloc(w->syms, ncap * sizeof(*v));
+                if (!v) {
+                    w->oom = 1;
+                    break;
+                }
+                w->syms = v;
+                w->cap = ncap;
+            }
+            w->syms[w->n].name = sym.name;
+            w->syms[w->n].member = i;
+            w->n++;
+        }
+        w->nundefined += info->nundefined;
+        macho_image_free(&img);
+    }
+}
+
+static int cmp_symbol(const void *a, const void *b) {
+    const struct ar_symbol *x = a;
+    const struct ar_symbol *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c) return c;
+    return (x->member > y->member) - (x->member < y->member);
+}
+
+int ar_index_build(const struct ar_archive *ar, unsigned jobs, struct ar_index *idx,
+                   char *errbuf, size_t errlen) {
+    memset(idx, 0, sizeof(*idx));
+    if (jobs == 0) jobs = par_default_threads();
+    idx->info = calloc(ar->n ? ar->n : 1, sizeof(*idx->info));
+    struct index_worker *workers = calloc(jobs, sizeof(*workers));
+    if (!idx->info || !workers) {
+        free(workers);
+        ar_index_free(idx);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    struct index_ctx ctx = { ar, idx->info, workers };
+    par_for(ar->n, 16, jobs, index_member, &ctx);
+
+    size_t total = 0;
+    int oom = 0;
+    for (unsigned w = 0; w < jobs; w++) {
+        total += workers[w].n;
+        idx->nundefined += workers[w].nundefined;
+        idx->bad_members += workers[w].bad;
+        oom |= workers[w].oom;
+    }
+    idx->syms = oom ? NULL : malloc((total ? total : 1) * sizeof(*idx->syms));
+    if (idx->syms) {
+        for (unsigned w = 0; w < jobs; w++) {
+            if (workers[w].n == 0) continue;
+            memcpy(idx->syms + idx->nsyms, workers[w].syms, workers[w].n * sizeof(*idx->syms));
+            idx->nsyms += workers[w].n;
+        }
+    }
+    for (unsigned w = 0; w < jobs; w++) free(workers[w].syms);
+    free(workers);
+    if (!idx->syms) {
+        ar_index_free(idx);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    qsort(idx->syms, idx->nsyms, sizeof(*idx->syms), cmp_symbol);
+    for (size_t i = 1; i < idx->nsyms; i++) {
+        if (strcmp(idx->syms[i].name, idx->syms[i - 1].name) == 0 &&
+            (i < 2 || strcmp(idx->syms[i - 1].name, idx->syms[i - 2].name) != 0)) {
+            idx->duplicates++;
+        }
+    }
+
+    for (size_t i = 0; i < ar->nsymdefs; i++) {
+        const struct ar_symdef *d = &ar->symdefs[i];
+        if (d->member == SIZE_MAX) {
+            idx->symdef_unresolved++;
+            continue;
+        }
+        struct ar_symbol key = { d->name, d->member };
+        if (bsearch(&key, idx->syms, idx->nsyms, sizeof(*idx->syms), cmp_symbol)) {
+            idx->symdef_matched++;
+        } else {
+            idx->symdef_mismatched++;
+        }
+    }
+    return 0;
+}
+
+void ar_index_free(struct ar_index *idx) {
+    free(idx->info);
+    free(idx->syms);
+    memset(idx, 0, sizeof(*idx));
+}
+
+const struct ar_symbol *ar_index_find(const struct ar_index *idx, const char *name) {
+    size_t lo = 0;
+    size_t hi = idx->nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->syms[mid].name, name) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < idx->nsyms && strcmp(idx->syms[lo].name, name) == 0) return &idx->syms[lo];
+    return NULL;
+}
@@ -0,0 +1,95 @@
+#ifndef MACHO_ARCHIVE_H
+#define MACHO_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Static libraries: `ar` archives of MH_OBJECT members.
+//
+// Members are located in place; nothing is copied except their names and,
+// rarely, member data that is not 8-byte aligned (Apple's ar and libtool
+// pad long names so it always is, GNU ar only aligns to 2): the Mach-O
+// walkers read load commands through struct pointers.
+// Handles BSD long names ("#1/<len>", the name stored in front of the
+// data, as Apple's ar and libtool write them), the GNU "//" name table, and
+// the ranlib table of contents (__.SYMDEF, __.SYMDEF SORTED and their _64
+// variants). For each SYMDEF entry the matching member is resolved.
+
+struct ar_member {
+    const char *name;
+    uint64_t header_offset;   // of the ar header; what SYMDEF ran_off holds
+    const uint8_t *data;
+    uint64_t size;
+};
+
+struct ar_symdef {
+    const char *name;         // points into the SYMDEF string table
+    uint64_t header_offset;
+    size_t member;            // index into members, SIZE_MAX if unresolved
+};
+
+struct ar_archive {
+    struct ar_member *members;   // excludes the SYMDEF and GNU table members
+    size_t n;
+    struct ar_symdef *symdefs;
+    size_t nsymdefs;
+    int symdef_sorted;
+    int symdef_64;
+    char *names;
+    uint8_t **copies;            // aligned copies of misaligned members
+    size_t ncopies;
+};
+
+// "!<arch>\n" at the start?
+int ar_is_archive(const uint8_t *buf, size_t size);
+
+// Returns 0 on success, -1 on malformed input.
+int ar_open(struct ar_archive *ar, const uint8_t *buf, size_t size,
+            char *errbuf, size_t errlen);
+void ar_close(struct ar_archive *ar);
+
+// Member by name, or NULL.
+const struct ar_member *ar_find(const struct ar_archive *ar, const char *name);
+
+// Symbol index over the members, built by loading every member as a
+// macho_image in parallel straight from the archive bytes. Members that are
+// not Mach-O (or are malformed) are counted, not fatal.
+
+struct ar_member_info {
+    int ok;                 // loaded as a Mach-O
+    uint32_t cputype;
+    uint32_t filetype;
+    uint32_t nsects;
+    uint32_t nreloc;        // sum over sections
+    uint32_t ndefined;      // external, defined in a section
+    uint32_t nundefined;
+};
+
+struct ar_symbol {
+    const char *name;       // points into the member's string table
+    size_t member;
+};
+
+struct ar_index {
+    struct ar_member_info *info;   // one per member
+    struct ar_symbol *syms;        // defined externals, sorted by name
+    size_t nsyms;
+    size_t nundefined;
+    size_t bad_members;
+    size_t duplicates;             // names defined by more than one member
+    // SYMDEF cross-check: entries whose member defines the name, entries
+    // pointing elsewhere, and entries whose offset names no member.
+    size_t symdef_matched;
+    size_t symdef_mismatched;
+    size_t symdef_unresolved;
+};
+
+// jobs == 0 means one worker per CPU. Returns 0, or -1 on allocation failure.
+int ar_index_build(const struct ar_archive *ar, unsigned jobs, struct ar_index *idx,
+                   char *errbuf, size_t errlen);
+void ar_index_free(struct ar_index *idx);
+
+// First definition of `name`, or NULL.
+const struct ar_symbol *ar_index_find(const struct ar_index *idx, const char *name);
+
+#endif /* MACHO_ARCHIVE_H */
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "arm64_decode.h"
+
+#include <pthread.h>
+
+// One row per value of insn[31:22].
+struct a64_row {
+    uint8_t kind;
+    uint8_t imm_lo;     // lowest bit of the immediate field
+    uint8_t imm_bits;   // width (0 = no immediate)
+    uint8_t imm_shift;  // left shift applied after extraction
+    uint8_t flags;
+};
+
+#define ROW_SIGNED 0x1  // sign-extend the field
+#define ROW_ADR    0x2  // immhi:immlo split immediate (ADR/ADRP)
+#define ROW_LOAD   0x4
+#define ROW_BCOND  0x8  // valid only when insn[4] == 0
+#define ROW_BRREG  0x10 // refine via opc = insn[24:21]
+#define ROW_VEC    0x20 // SIMD/FP register transfer (V = 1)
+#define ROW_WBACK  0x40 // always writes back rn (pair pre/post-index)
+#define ROW_IDX    0x80 // imm9 group: writeback and atomics refined via insn[21], insn[11:10]
+
+static struct a64_row g_rows[1024];
+static pthread_once_t g_rows_once = PTHREAD_ONCE_INIT;
+
+// insn[24:21] for the unconditional-branch-register group, including the
+// pointer-authentication forms (BRAA/BLRAA/RETAA share opc with BR/BLR/RET
+// up to bit 24).
+static const uint8_t g_brreg_kind[16] = {
+    A64_BR, A64_BLR, A64_RET, A64_OTHER, A64_OTHER, A64_OTHER, A64_OTHER, A64_OTHER,
+    A64_BR, A64_BLR, A64_RET, A64_OTHER, A64_OTHER, A64_OTHER, A64_OTHER, A64_OTHER,
+};
+
+static void set_rows(uint32_t mask, uint32_t value, struct a64_row row) {
+    // mask/value are given on the full word; only bits [31:22] index rows.
+    uint32_t m = mask >> 22;
+    uint32_t v = value >> 22;
+    for (uint32_t i = 0; i < 1024; i++) {
+        if ((i & m) == v) g_rows[i] = row;
+    }
+}
+
+static void build_rows(void) {
+    struct a64_row r;
+
+    r = (struct a64_row){ A64_ADR, 0, 21, 0, ROW_SIGNED | ROW_ADR };
+    set_rows(0x9F000000u, 0x10000000u, r);
+    r = (struct a64_row){ A64_ADRP, 0, 21, 12, ROW_SIGNED | ROW_ADR };
+    set_rows(0x9F000000u, 0x90000000u, r);
+
+    // ADD Xd, Xn, #imm{, LSL #12}: bit 22 (sh) is inside the index.
+    r = (struct a64_row){ A64_ADD_IMM, 10, 12, 0, 0 };
+    set_rows(0xFFC00000u, 0x91000000u, r);
+    r.imm_shift = 12;
+    set_rows(0xFFC00000u, 0x91400000u, r);
+
+    // Load/store register (unsigned immediate): size[31:30] 111 V[26] 01 opc[23:22].
+    // The scale is size, or 4 for 128-bit SIMD (V=1, opc=1x).
+    for (uint32_t size = 0; size < 4; size++) {
+        for (uint32_t v = 0; v < 2; v++) {
+            for (uint32_t opc = 0; opc < 4; opc++) {
+                uint32_t word = (size << 30) | (0x7u << 27) | (v << 26) | (0x1u << 24) | (opc << 22);
+                uint8_t scale = (uint8_t)size;
+                uint8_t flags = (opc != 0) ? ROW_LOAD : 0;
+                if (v) {
+                    if (opc >= 2) {
+                        if (size != 0) continue;   // unallocated
+                        scale = 4;
+                        flags = (opc == 3) ? ROW_LOAD : 0;
+                    } else {
+                        flags = (opc == 1) ? ROW_LOAD : 0;
+                    }
+                } else if (size == 3 && opc == 2) {
+                    flags = 0;                      // PRFM: no register written
+                }
+                if (v) flags |= ROW_VEC;
+                r = (struct a64_row){ A64_LDST_UIMM, 10, 12, scale, flags };
+                set_rows(0xFFC00000u, word, r);
+                // The same size/V/opc with insn[25:24] = 00: unscaled and
+                // pre/post-index imm9 forms, register offset, atomics.
+                r = (struct a64_row){ A64_LDST_REG, 12, 9, 0, flags | ROW_SIGNED | ROW_IDX };
+                set_rows(0xFFC00000u, word & ~(0x1u << 24), r);
+            }
+        }
+    }
+
+    // Load/store pair: opc[31:30] 101 V[26] 0 type[24:23] L[22]. Types 01
+    // (post-index) and 11 (pre-index) write back rn; imm7 is scaled by the
+    // register size.
+    for (uint32_t opc = 0; opc < 3; opc++) {
+        for (uint32_t v = 0; v < 2; v++) {
+            uint8_t scale = (uint8_t)(v ? 2 + opc : (opc == 2 ? 3 : 2));
+            for (uint32_t type = 0; type < 4; type++) {
+                for (uint32_t l = 0; l < 2; l++) {
+                    uint32_t word = (opc << 30) | (0x5u << 27) | (v << 26) | (type << 23) | (l << 22);
+                    uint8_t flags = ROW_SIGNED;
+                    if (l) flags |= ROW_LOAD;
+                    if (v) flags |= ROW_VEC;
+                    if (type & 1) flags |= ROW_WBACK;
+                    r = (struct a64_row){ A64_LDST_PAIR, 15, 7, scale, flags };
+                    set_rows(0xFFC00000u, word, r);
+                }
+            }
+        }
+    }
+
+    // LDR (literal), GPR and SIMD: opc[31:30] 011 V 00.
+    r = (struct a64_row){ A64_LDR_LIT, 5, 19, 2, ROW_SIGNED | ROW_LOAD };
+    set_rows(0x3F000000u, 0x18000000u, r);
+    r.flags |= ROW_VEC;
+    set_rows(0x3F000000u, 0x1C000000u, r);
+
+    r = (struct a64_row){ A64_B, 0, 26, 2, ROW_SIGNED };
+    set_rows(0xFC000000u, 0x14000000u, r);
+    r = (struct a64_row){ A64_BL, 0, 26, 2, ROW_SIGNED };
+    set_rows(0xFC000000u, 0x94000000u, r);
+    r = (struct a64_row){ A64_B_COND, 5, 19, 2, ROW_SIGNED | ROW_BCOND };
+    set_rows(0xFF000000u, 0x54000000u, r);
+    r = (struct a64_row){ A64_CBZ, 5, 19, 2, ROW_SIGNED };
+    set_rows(0x7E000000u, 0x34000000u, r);
+    r = (struct a64_row){ A64_TBZ, 5, 14, 2, ROW_SIGNED };
+    set_rows(0x7E000000u, 0x36000000u, r);
+
+    // Unconditional branch (register): 1101011 opc[24:21] ...
+    r = (struct a64_row){ A64_BR, 0, 0, 0, ROW_BRREG };
+    set_rows(0xFE000000u, 0xD6000000u, r);
+}
+
+static inline int64_t sign_extend(uint64_t v, unsigned bits) {
+    unsigned sh = 64u - bits;
+    return (int64_t)(v << sh) >> sh;
+}
+
+void a64_decode_init(void) {
+    pthread_once(&g_rows_once, build_rows);
+}
+
+void a64_decode(uint32_t insn, struct a64_insn *out) {
+    const struct a64_row *row = &g_rows[insn >> 22];
+
+    uint32_t bits = row->imm_bits;
+    uint64_t fmask = ((uint64_t)1 << bits) - 1;
+    uint64_t field = ((uint64_t)insn >> row->imm_lo) & fmask;
+    // ADR/ADRP: immhi = insn[23:5], immlo = insn[30:29].
+    uint64_t adr = ((((uint64_t)insn >> 5) & 0x7FFFFu) << 2) | (((uint64_t)insn >> 29) & 3u);
+    uint64_t is_adr = (uint64_t)0 - (uint64_t)((row->flags & ROW_ADR) != 0);
+    field = (adr & is_adr) | (field & ~is_adr);
+
+    uint64_t is_signed = (uint64_t)0 - (uint64_t)((row->flags & ROW_SIGNED) != 0);
+    uint64_t sext = (uint64_t)sign_extend(field, bits ? bits : 1);
+    uint64_t imm = (sext & is_signed) | (field & ~is_signed);
+    imm <<= row->imm_shift;
+
+    // B.cond requires insn[4] == 0; BR-register rows select by opc.
+    uint8_t kind = row->kind;
+    uint8_t bcond_ok = (uint8_t)(((row->flags & ROW_BCOND) == 0) | (((insn >> 4) & 1u) == 0));
+    kind = (uint8_t)(kind * bcond_ok);
+    uint8_t brreg = (uint8_t)(0u - (unsigned)((row->flags & ROW_BRREG) != 0));
+    uint8_t rk = g_brreg_kind[(insn >> 21) & 0xF];
+    kind = (uint8_t)((rk & brreg) | (kind & (uint8_t)~brreg));
+
+    out->kind = kind;
+    out->rd = (uint8_t)(insn & 31u);
+    out->rn = (uint8_t)((insn >> 5) & 31u);
+    // imm9 group: insn[21] clear with insn[10] set is pre- or post-index;
+    // insn[21] set with insn[11:10] == 00 is an atomic, which writes rt
+    // whatever its opc bits say.
+    uint32_t idx = (row->flags & ROW_IDX) != 0;
+    uint32_t b21 = (insn >> 21) & 1u;
+    uint32_t atomic = idx & b21 & (((insn >> 10) & 3u) == 0);
+    uint32_t wb_idx = idx & (b21 ^ 1u) & ((insn >> 10) & 1u);
+    out->is_load = (uint8_t)(((row->flags & ROW_LOAD) != 0) | atomic);
+    out->is_vec = (uint8_t)((row->flags & ROW_VEC) != 0);
+    out->wback = (uint8_t)(((row->flags & ROW_WBACK) != 0) | wb_idx);
+    out->rt2 = (uint8_t)((insn >> 10) & 31u);
+    out->imm = (int64_t)imm;
+}
+
+const char *a64_kind_name(uint8_t kind) {
+    switch (kind) {
+        case A64_ADRP: return "adrp";
+        case A64_ADR: return "adr";
+        case A64_ADD_IMM: return "add";
+        case A64_LDST_UIMM: return "ldst";
+        case A64_LDR_LIT: return "ldr-lit";
+        case A64_LDST_REG: return "ldst-reg";
+        case A64_LDST_PAIR: return "ldst-pair";
+        case A64_B: return "b";
+        case A64_BL: return "bl";
+        case A64_B_COND: return "b.cond";
+        case A64_CBZ: return "cbz";
+        case A64_TBZ: return "tbz";
+        case A64_BR: return "br";
+        case A64_BLR: return "blr";
+        case A64_RET: return "ret";
+        default: return "other";
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ARM64_DECODE_H
+#define ARM64_DECODE_H
+
+#include <stdint.h>
+
+// Table-driven classifier for the ARM64 instructions static analysis cares
+// about: address materialization (ADRP/ADR/ADD/LDR/STR) and control flow.
+//
+// The top ten opcode bits (insn[31:22]) select a row in a 1024-entry table
+// that already knows the class, where the immediate lives, how wide it is,
+// whether it is signed and how far to shift it. The remaining distinctions
+// (B.cond's bit 4, the BR/BLR/RET opc field) are folded in with masks, so
+// decoding a word is a couple of loads and ALU ops with no data-dependent
+// branches. Everything else decodes as A64_OTHER.
+
+enum a64_kind {
+    A64_OTHER = 0,
+    A64_ADRP,       // rd = page(pc) + imm
+    A64_ADR,        // rd = pc + imm
+    A64_ADD_IMM,    // rd = rn + imm (64-bit, no flags)
+    A64_LDST_UIMM,  // load/store [rn, #imm]  (rt = rd field)
+    A64_LDR_LIT,    // rt = [pc + imm]
+    A64_LDST_REG,   // other single-register load/store: unscaled and pre/post-index
+                    // (imm = imm9), register offset, atomics
+    A64_LDST_PAIR,  // LDP/STP/LDNP/STNP (rt = rd field, rt2)
+    A64_B,
+    A64_BL,
+    A64_B_COND,
+    A64_CBZ,        // CBZ/CBNZ
+    A64_TBZ,        // TBZ/TBNZ
+    A64_BR,
+    A64_BLR,
+    A64_RET,
+    A64_KIND_COUNT
+};
+
+struct a64_insn {
+    uint8_t kind;
+    uint8_t rd;      // rd/rt, insn[4:0]
+    uint8_t rn;      // insn[9:5]
+    uint8_t is_load; // loads write rt (and rt2); A64_LDST_* and A64_LDR_LIT
+    uint8_t is_vec;  // loads/stores of SIMD/FP registers: rt/rt2 are not X registers
+    uint8_t wback;   // pre/post-index: rn is written back
+    uint8_t rt2;     // A64_LDST_PAIR second register, insn[14:10]
+    int64_t imm;     // byte offset / addend, already scaled
+};
+
+// Build the decode table. Call once before decoding (every analysis entry
+// point does); thread-safe and cheap to repeat.
+void a64_decode_init(void);
+
+// Decode one little-endian instruction word. Pure table lookup, safe from
+// any thread once a64_decode_init has returned.
+void a64_decode(uint32_t insn, struct a64_insn *out);
+
+// Absolute target for PC-relative kinds (ADRP, ADR, LDR literal, branches).
+static inline uint64_t a64_pcrel_target(const struct a64_insn *d, uint64_t pc) {
+    uint64_t base = (d->kind == A64_ADRP) ? (pc & ~(uint64_t)0xfff) : pc;
+    return base + (uint64_t)d->imm;
+}
+
+static inline int a64_is_branch(uint8_t kind) {
+    return kind >= A64_B && kind <= A64_RET;
+}
+
+// Ends a basic block with no fallthrough.
+static inline int a64_is_terminal(uint8_t kind) {
+    return kind == A64_B || kind == A64_BR || kind == A64_RET;
+}
+
+const char *a64_kind_name(uint8_t kind);
+
+#endif /* ARM64_DECODE_H */
@@ -0,0 +1,35 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+
+#include "bench_inspect.h"
+
+static FILE *bench_sink;
+
+#undef stderr
+#define stderr bench_sink
+#define main macho_inspect_main
+#include "macho_inspect.c"
+#undef main
+#undef stderr
+
+int bench_inspect_init(void) {
+    if (!bench_sink) bench_sink = fopen("/dev/null", "w");
+    if (!bench_sink) return -1;
+    setvbuf(bench_sink, NULL, _IOFBF, 1 << 16);
+    return 0;
+}
+
+int bench_inspect(const uint8_t *data, size_t size) {
+    if (size < sizeof(uint32_t)) return 1;
+    uint32_t magic = 0;
+    memcpy(&magic, data, sizeof(magic));
+    if (is_fat_magic(magic)) {
+        struct parse_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        return parse_fat(data, size, &opts);
+    }
+    if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) return parse_thin_macho_64(data, size);
+    if (magic == MH_MAGIC || magic == MH_CIGAM) return parse_thin_macho_32(data, size);
+    return 1;
+}
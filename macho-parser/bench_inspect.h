@@ -0,0 +1,23 @@
+#ifndef MACHO_BENCH_INSPECT_H
+#define MACHO_BENCH_INSPECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// macho_inspect's own parse path, for macho_bench.
+//
+// macho_inspect.c is compiled into bench_inspect.c with its main renamed,
+// as fuzz_macho.c does, so the `inspect` stage times the code the tool
+// runs on `macho_inspect FILE`: parse_fat, parse_thin_macho_64 and
+// parse_thin_macho_32, formatting included. They print to stdout, which
+// the caller points at /dev/null while the stage runs; their stderr goes
+// to a /dev/null stream of its own.
+
+// Opens the stderr sink. Returns 0, or -1 if /dev/null cannot be opened.
+int bench_inspect_init(void);
+
+// Parse one file the way `macho_inspect FILE` does. Returns the parser's
+// exit status (0 = no error), or 1 for a buffer that is not Mach-O.
+int bench_inspect(const uint8_t *data, size_t size);
+
+#endif /* MACHO_BENCH_INSPECT_H */
@@ -0,0 +1,930 @@
+#include "bindiff.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/mach/machine.h"
+#include "../include/mach/vm_prot.h"
+#include "../include/macho/loader.h"
+#include "../include/macho/nlist.h"
+
+#include "arm64_decode.h"
+#include "digest.h"
+#include "macho_common.h"
+#include "parallel.h"
+
+static const char *const category_names[BINDIFF_NCATEGORIES] = {
+    "header", "load commands", "segments", "sections", "dylibs", "rpaths",
+    "exports", "imports", "symbols",
+};
+
+// Strings are appended to a chain of blocks so they never move.
+struct bindiff_block {
+    struct bindiff_block *next;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+static const char *side_printf(struct bindiff_side *s, const char *fmt, ...) {
+    char tmp[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n < 0) return NULL;
+    size_t len = (size_t)n < sizeof(tmp) ? (size_t)n + 1 : sizeof(tmp);
+    struct bindiff_block *b = s->strings;
+    if (!b || b->cap - b->used < len) {
+        size_t cap = len > 65536 ? len : 65536;
+        b = malloc(sizeof(*b) + cap);
+        if (!b) return NULL;
+        b->next = s->strings;
+        b->used = 0;
+        b->cap = cap;
+        s->strings = b;
+    }
+    char *out = b->data + b->used;
+    memcpy(out, tmp, len - 1);
+    out[len - 1] = '\0';
+    b->used += len;
+    return out;
+}
+
+static int add_fact(struct bindiff_facts *fv, const char *key, const char *val) {
+    if (!key || !val) return -1;
+    if (fv->n == fv->cap) {
+        size_t cap = fv->cap ? fv->cap * 2 : 64;
+        struct bindiff_fact *v = realloc(fv->v, cap * sizeof(*v));
+        if (!v) return -1;
+        fv->v = v;
+        fv->cap = cap;
+    }
+    fv->v[fv->n].key = key;
+    fv->v[fv->n++].val = val;
+    return 0;
+}
+
+static int cmp_fact(const void *a, const void *b) {
+    const struct bindiff_fact *x = a;
+    const struct bindiff_fact *y = b;
+    int c = strcmp(x->key, y->key);
+    return c ? c : strcmp(x->val, y->val);
+}
+
+static void sort_facts(struct bindiff_facts *fv) {
+    // Exports and imports arrive sorted; check before paying for qsort.
+    for (size_t i = 1; i < fv->n; i++) {
+        if (cmp_fact(&fv->v[i - 1], &fv->v[i]) > 0) {
+            qsort(fv->v, fv->n, sizeof(*fv->v), cmp_fact);
+            return;
+        }
+    }
+}
+
+static void fmt_version(char *buf, size_t len, uint32_t v) {
+    snprintf(buf, len, "%u.%u.%u", v >> 16, (v >> 8) & 0xff, v & 0xff);
+}
+
+static void prot_str(char out[4], uint32_t prot) {
+    out[0] = (prot & VM_PROT_READ) ? 'r' : '-';
+    out[1] = (prot & VM_PROT_WRITE) ? 'w' : '-';
+    out[2] = (prot & VM_PROT_EXECUTE) ? 'x' : '-';
+    out[3] = '\0';
+}
+
+static const char *lc_name(uint32_t cmd) {
+    switch (cmd) {
+    case LC_UUID: return "LC_UUID";
+    case LC_MAIN: return "LC_MAIN";
+    case LC_THREAD: return "LC_THREAD";
+    case LC_UNIXTHREAD: return "LC_UNIXTHREAD";
+    case LC_LOAD_DYLINKER: return "LC_LOAD_DYLINKER";
+    case LC_ID_DYLINKER: return "LC_ID_DYLINKER";
+    case LC_DYLD_ENVIRONMENT: return "LC_DYLD_ENVIRONMENT";
+    case LC_BUILD_VERSION: return "LC_BUILD_VERSION";
+    case LC_VERSION_MIN_MACOSX: return "LC_VERSION_MIN_MACOSX";
+    case LC_VERSION_MIN_IPHONEOS: return "LC_VERSION_MIN_IPHONEOS";
+    case LC_VERSION_MIN_TVOS: return "LC_VERSION_MIN_TVOS";
+    case LC_VERSION_MIN_WATCHOS: return "LC_VERSION_MIN_WATCHOS";
+    case LC_SOURCE_VERSION: return "LC_SOURCE_VERSION";
+    case LC_ENCRYPTION_INFO: return "LC_ENCRYPTION_INFO";
+    case LC_ENCRYPTION_INFO_64: return "LC_ENCRYPTION_INFO_64";
+    case LC_CODE_SIGNATURE: return "LC_CODE_SIGNATURE";
+    case LC_FUNCTION_STARTS: return "LC_FUNCTION_STARTS";
+    case LC_DATA_IN_CODE: return "LC_DATA_IN_CODE";
+    case LC_SEGMENT_SPLIT_INFO: return "LC_SEGMENT_SPLIT_INFO";
+    case LC_DYLIB_CODE_SIGN_DRS: return "LC_DYLIB_CODE_SIGN_DRS";
+    case LC_LINKER_OPTIMIZATION_HINT: return "LC_LINKER_OPTIMIZATION_HINT";
+    case LC_DYLD_EXPORTS_TRIE: return "LC_DYLD_EXPORTS_TRIE";
+    case LC_DYLD_CHAINED_FIXUPS: return "LC_DYLD_CHAINED_FIXUPS";
+    case LC_DYLD_INFO: return "LC_DYLD_INFO";
+    case LC_DYLD_INFO_ONLY: return "LC_DYLD_INFO_ONLY";
+    case LC_SYMTAB: return "LC_SYMTAB";
+    case LC_DYSYMTAB: return "LC_DYSYMTAB";
+    case LC_NOTE: return "LC_NOTE";
+    case LC_LINKER_OPTION: return "LC_LINKER_OPTION";
+    case LC_FILESET_ENTRY: return "LC_FILESET_ENTRY";
+    default: return NULL;
+    }
+}
+
+// Commands whose payload is an offset/size into __LINKEDIT (or a table
+// there): only their presence is compared, the contents show up as
+// exports, imports and symbols.
+static int is_linkedit_ref(uint32_t cmd) {
+    return cmd == LC_CODE_SIGNATURE || cmd == LC_FUNCTION_STARTS || cmd == LC_DATA_IN_CODE ||
+           cmd == LC_SEGMENT_SPLIT_INFO || cmd == LC_DYLIB_CODE_SIGN_DRS ||
+           cmd == LC_LINKER_OPTIMIZATION_HINT || cmd == LC_DYLD_EXPORTS_TRIE ||
+           cmd == LC_DYLD_CHAINED_FIXUPS || cmd == LC_DYLD_INFO || cmd == LC_DYLD_INFO_ONLY ||
+           cmd == LC_SYMTAB || cmd == LC_DYSYMTAB;
+}
+
+// Name of the symbol at vmaddr, or NULL. syms is sorted by address.
+static const char *symbol_at(const struct bindiff_side *s, uint64_t vmaddr) {
+    size_t lo = 0;
+    size_t hi = s->nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->syms[mid].addr < vmaddr) lo = mid + 1;
+        else hi = mid;
+    }
+    const char *local = NULL;
+    for (size_t i = lo; i < s->nsyms && s->syms[i].addr == vmaddr; i++) {
+        if (!s->syms[i].name[0]) continue;
+        if (s->syms[i].type & N_EXT) return s->syms[i].name;
+        if (!local) local = s->syms[i].name;
+    }
+    return local;
+}
+
+// A short description of a load command, or an empty string when only its
+// presence matters.
+static void describe_cmd(const struct bindiff_side *s, const struct macho_lc_ref *ref,
+                         char *val, size_t len) {
+    const struct macho_image *img = &s->img;
+    const uint8_t *p = img->buf + ref->offset;
+    int sw = img->swapped;
+    char v1[16];
+    char v2[16];
+    switch (ref->cmd) {
+    case LC_UUID:
+        if (ref->cmdsize < 24) break;
+        snprintf(val, len, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                 p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15], p[16], p[17], p[18],
+                 p[19], p[20], p[21], p[22], p[23]);
+        return;
+    case LC_BUILD_VERSION:
+        if (ref->cmdsize < 24) break;
+        fmt_version(v1, sizeof(v1), load32_u(p + 12, sw));
+        fmt_version(v2, sizeof(v2), load32_u(p + 16, sw));
+        snprintf(val, len, "platform %u minos %s sdk %s", load32_u(p + 8, sw), v1, v2);
+        return;
+    case LC_VERSION_MIN_MACOSX:
+    case LC_VERSION_MIN_IPHONEOS:
+    case LC_VERSION_MIN_TVOS:
+    case LC_VERSION_MIN_WATCHOS:
+        if (ref->cmdsize < 16) break;
+        fmt_version(v1, sizeof(v1), load32_u(p + 8, sw));
+        fmt_version(v2, sizeof(v2), load32_u(p + 12, sw));
+        snprintf(val, len, "minos %s sdk %s", v1, v2);
+        return;
+    case LC_SOURCE_VERSION: {
+        if (ref->cmdsize < 16) break;
+        uint64_t v = load64_u(p + 8, sw);
+        snprintf(val, len, "%llu.%llu.%llu.%llu.%llu", (unsigned long long)(v >> 40),
+                 (unsigned long long)((v >> 30) & 0x3ff), (unsigned long long)((v >> 20) & 0x3ff),
+                 (unsigned long long)((v >> 10) & 0x3ff), (unsigned long long)(v & 0x3ff));
+        return;
+    }
+    case LC_ENCRYPTION_INFO:
+    case LC_ENCRYPTION_INFO_64:
+        if (ref->cmdsize < 20) break;
+        snprintf(val, len, "cryptid %u size 0x%x", load32_u(p + 16, sw), load32_u(p + 12, sw));
+        return;
+    case LC_MAIN: {
+        if (ref->cmdsize < 24) break;
+        // The entry offset moves with the code; its symbol does not.
+        uint64_t off = load64_u(p + 8, sw);
+        const char *name = symbol_at(s, macho_image_base(img) + off);
+        if (name) snprintf(val, len, "entry %s", name);
+        else snprintf(val, len, "entryoff 0x%llx", (unsigned long long)off);
+        return;
+    }
+    case LC_LOAD_DYLINKER:
+    case LC_ID_DYLINKER:
+    case LC_DYLD_ENVIRONMENT: {
+        if (ref->cmdsize < 12) break;
+        uint32_t off = load32_u(p + 8, sw);
+        if (off >= ref->cmdsize) break;
+        snprintf(val, len, "%.*s", (int)(ref->cmdsize - off), (const char *)p + off);
+        return;
+    }
+    default:
+        if (is_linkedit_ref(ref->cmd)) return;
+        break;
+    }
+    uint8_t h[32];
+    digest_sha256(p, ref->cmdsize, h);
+    snprintf(val, len, "size %u sha256 %02x%02x%02x%02x%02x%02x%02x%02x", ref->cmdsize,
+             h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7]);
+}
+
+static const char *dylib_kind_name(enum macho_dylib_kind k) {
+    switch (k) {
+    case DYLIB_WEAK: return "weak";
+    case DYLIB_REEXPORT: return "reexport";
+    case DYLIB_UPWARD: return "upward";
+    case DYLIB_LAZY: return "lazy";
+    default: return "load";
+    }
+}
+
+static const char *ordinal_name(const struct bindiff_side *s, int32_t ordinal) {
+    if (ordinal >= 1 && (size_t)ordinal <= s->link.ndylibs) return s->link.dylibs[ordinal - 1].name;
+    return ordinal == BIND_SPECIAL_DYLIB_SELF ? "self" :
+           ordinal == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE ? "main executable" :
+           ordinal == BIND_SPECIAL_DYLIB_FLAT_LOOKUP ? "flat lookup" :
+           ordinal == BIND_SPECIAL_DYLIB_WEAK_LOOKUP ? "weak lookup" : "bad ordinal";
+}
+
+// Values keep the last path component of library names so they fit.
+static const char *leaf(const char *path) {
+    const char *s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+// Value of a defined symbol: visibility and section. There are few
+// distinct ones, so they are formatted once per (visibility, section).
+static const char *symbol_value(struct bindiff_side *s, const char **cache,
+                                const struct macho_symbol *sym) {
+    const struct macho_image *img = &s->img;
+    size_t vis = (sym->type & N_EXT) ? 0 : (sym->type & N_PEXT) ? 1 : 2;
+    size_t sect = sym->sect >= 1 && sym->sect <= img->nsects ? sym->sect : 0;
+    const char **slot = &cache[vis * (img->nsects + 1) + sect];
+    if (!*slot) {
+        static const char *const vis_names[] = { "external", "private", "local" };
+        const struct macho_section *sec = sect ? &img->sects[sect - 1] : NULL;
+        *slot = side_printf(s, "%s %s%s%s", vis_names[vis], sec ? sec->segname : "?",
+                            sec ? "," : "", sec ? sec->sectname : "");
+    }
+    return *slot;
+}
+
+static const char *export_value(struct bindiff_side *s, const char **cache,
+                                const struct macho_export *e) {
+    if (e->flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+        return side_printf(s, "reexport %s%s%s", leaf(ordinal_name(s, (int32_t)e->reexport_ordinal)),
+                           e->import_name ? " as " : "", e->import_name ? e->import_name : "");
+    }
+    uint64_t kind = e->flags & EXPORT_SYMBOL_FLAGS_KIND_MASK;
+    size_t weak = (e->flags & EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION) != 0;
+    size_t resolver = (e->flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) != 0;
+    const char **slot = &cache[kind * 4 + weak * 2 + resolver];
+    if (!*slot) {
+        *slot = side_printf(s, "%s%s%s",
+                            kind == EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL ? "tlv" :
+                            kind == EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE ? "absolute" : "regular",
+                            weak ? " weak" : "", resolver ? " resolver" : "");
+    }
+    return *slot;
+}
+
+static int build_facts(struct bindiff_side *s) {
+    const struct macho_image *img = &s->img;
+    struct bindiff_facts *f = s->facts;
+    char buf[96];
+
+#define FACT(cat, key, val) do { if (add_fact(&f[cat], (key), (val)) != 0) return -1; } while (0)
+    FACT(BINDIFF_HEADER, "cputype", side_printf(s, "%u/0x%x", img->cputype, img->cpusubtype));
+    FACT(BINDIFF_HEADER, "filetype", side_printf(s, "%u", img->filetype));
+    FACT(BINDIFF_HEADER, "flags", side_printf(s, "0x%x", img->flags));
+    if (s->link.install_name) FACT(BINDIFF_HEADER, "install name", s->link.install_name);
+
+    // Other load commands, numbered per type. Segments, dylibs and rpaths
+    // have their own categories.
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *ref = &img->cmds[i];
+        uint32_t cmd = ref->cmd;
+        if (cmd == LC_SEGMENT || cmd == LC_SEGMENT_64 || cmd == LC_RPATH ||
+            cmd == LC_LOAD_DYLIB || cmd == LC_LOAD_WEAK_DYLIB || cmd == LC_REEXPORT_DYLIB ||
+            cmd == LC_LOAD_UPWARD_DYLIB || cmd == LC_LAZY_LOAD_DYLIB || cmd == LC_ID_DYLIB) {
+            continue;
+        }
+        unsigned nth = 0;
+        for (size_t j = 0; j < i; j++) nth += img->cmds[j].cmd == cmd;
+        const char *name = lc_name(cmd);
+        const char *key = name ? side_printf(s, "%s#%u", name, nth) :
+                                 side_printf(s, "LC_0x%x#%u", cmd, nth);
+        buf[0] = '\0';
+        describe_cmd(s, ref, buf, sizeof(buf));
+        FACT(BINDIFF_LOAD_COMMANDS, key, side_printf(s, "%s", buf));
+    }
+
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *seg = &img->segs[i];
+        char maxp[4];
+        char initp[4];
+        prot_str(maxp, seg->maxprot);
+        prot_str(initp, seg->initprot);
+        if (strcmp(seg->name, "__LINKEDIT") == 0) {
+            // Its size follows the tables compared below.
+            FACT(BINDIFF_SEGMENTS, seg->name, side_printf(s, "%s/%s", initp, maxp));
+            continue;
+        }
+        FACT(BINDIFF_SEGMENTS, seg->name,
+             side_printf(s, "vmsize 0x%llx filesize 0x%llx %s/%s", (unsigned long long)seg->vmsize,
+                         (unsigned long long)seg->filesize, initp, maxp));
+    }
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *sec = &img->sects[i];
+        FACT(BINDIFF_SECTIONS, side_printf(s, "%s,%s", sec->segname, sec->sectname),
+             side_printf(s, "size 0x%llx align 2^%u flags 0x%x", (unsigned long long)sec->size,
+                         sec->align, sec->flags));
+    }
+    for (size_t i = 0; i < s->link.ndylibs; i++) {
+        const struct macho_dylib *d = &s->link.dylibs[i];
+        char cur[16];
+        char compat[16];
+        fmt_version(cur, sizeof(cur), d->current_version);
+        fmt_version(compat, sizeof(compat), d->compat_version);
+        FACT(BINDIFF_DYLIBS, d->name,
+             side_printf(s, "%s %s (compat %s)", dylib_kind_name(d->kind), cur, compat));
+    }
+    for (size_t i = 0; i < s->link.nrpaths; i++) FACT(BINDIFF_RPATHS, s->link.rpaths[i], "");
+
+    const char *export_cache[16] = { NULL };
+    for (size_t i = 0; i < s->exports.n; i++) {
+        const struct macho_export *e = &s->exports.v[i];
+        FACT(BINDIFF_EXPORTS, e->name, export_value(s, export_cache, e));
+    }
+    for (size_t i = 0; i < s->nimports; i++) {
+        const struct macho_import *im = &s->imports[i];
+        FACT(BINDIFF_IMPORTS, im->name,
+             side_printf(s, "%s%s%s", leaf(ordinal_name(s, im->ordinal)),
+                         im->weak_import ? " weak" : "", im->lazy ? " lazy" : ""));
+    }
+    const char **sym_cache = calloc(3 * (img->nsects + 1), sizeof(*sym_cache));
+    if (!sym_cache) return -1;
+    f[BINDIFF_SYMBOLS].v = malloc((s->nsyms ? s->nsyms : 1) * sizeof(*f[BINDIFF_SYMBOLS].v));
+    if (!f[BINDIFF_SYMBOLS].v) {
+        free(sym_cache);
+        return -1;
+    }
+    f[BINDIFF_SYMBOLS].cap = s->nsyms ? s->nsyms : 1;
+    for (size_t i = 0; i < s->nsyms; i++) {
+        const struct macho_symbol *sym = &s->syms[i];
+        if (!sym->name[0]) continue;
+        if (add_fact(&f[BINDIFF_SYMBOLS], sym->name, symbol_value(s, sym_cache, sym)) != 0) {
+            free(sym_cache);
+            return -1;
+        }
+    }
+    free(sym_cache);
+#undef FACT
+
+    for (int c = 0; c < BINDIFF_NCATEGORIES; c++) sort_facts(&f[c]);
+    return 0;
+}
+
+static int is_zerofill(uint32_t flags) {
+    uint32_t type = flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+// File bytes of a section, or NULL when it has none or they are out of
+// bounds.
+static const uint8_t *section_bytes(const struct macho_image *img,
+                                    const struct macho_section *sec) {
+    if (is_zerofill(sec->flags) || sec->size == 0) return NULL;
+    if (sec->offset > img->size || sec->size > img->size - sec->offset) return NULL;
+    return img->buf + sec->offset;
+}
+
+struct open_ctx {
+    struct bindiff_side *sides;
+    const char *paths[2];
+    int want_index;
+    uint32_t want_cputype;
+};
+
+static int open_side(struct bindiff_side *s, const char *path, int want_index,
+                     uint32_t want_cputype) {
+    char err[200];
+    uint64_t off = 0;
+    uint64_t size = 0;
+    s->path = path;
+    if (map_file(path, &s->mf, err, sizeof(err)) != 0 ||
+        macho_select_slice(s->mf.data, s->mf.size, want_index, want_cputype, &off, &size,
+                           err, sizeof(err)) != 0 ||
+        macho_image_load(&s->img, s->mf.data + off, (size_t)size, err, sizeof(err)) != 0) {
+        snprintf(s->err, sizeof(s->err), "%s: %s", path, err);
+        return -1;
+    }
+    s->loaded = 1;
+    if (macho_link_info(&s->img, &s->link, err, sizeof(err)) != 0 ||
+        macho_imports(&s->img, &s->imports, &s->nimports, err, sizeof(err)) != 0 ||
+        macho_exports(&s->img, &s->exports, err, sizeof(err)) != 0) {
+        snprintf(s->err, sizeof(s->err), "%s: %s", path, err);
+        return -1;
+    }
+    s->nsyms = macho_image_defined_symbols(&s->img, &s->syms);
+    s->sect_hash = calloc(s->img.nsects ? s->img.nsects : 1, sizeof(*s->sect_hash));
+    if (!s->sect_hash || build_facts(s) != 0) {
+        snprintf(s->err, sizeof(s->err), "%s: out of memory", path);
+        return -1;
+    }
+    for (size_t i = 0; i < s->img.nsects; i++) {
+        const uint8_t *p = section_bytes(&s->img, &s->img.sects[i]);
+        if (p) digest_sha256(p, (size_t)s->img.sects[i].size, s->sect_hash[i]);
+    }
+    return 0;
+}
+
+static void open_worker(size_t begin, size_t end, unsigned worker, void *arg) {
+    (void)worker;
+    struct open_ctx *ctx = arg;
+    for (size_t i = begin; i < end; i++) {
+        open_side(&ctx->sides[i], ctx->paths[i], ctx->want_index, ctx->want_cputype);
+    }
+}
+
+int bindiff_open(struct bindiff_side sides[2], const char *a, const char *b,
+                 int want_index, uint32_t want_cputype, unsigned jobs) {
+    memset(sides, 0, 2 * sizeof(*sides));
+    struct open_ctx ctx = { sides, { a, b }, want_index, want_cputype };
+    par_for(2, 1, jobs ? jobs : 2, open_worker, &ctx);
+    return sides[0].err[0] || sides[1].err[0] ? -1 : 0;
+}
+
+void bindiff_close(struct bindiff_side sides[2]) {
+    for (int i = 0; i < 2; i++) {
+        struct bindiff_side *s = &sides[i];
+        for (int c = 0; c < BINDIFF_NCATEGORIES; c++) free(s->facts[c].v);
+        while (s->strings) {
+            struct bindiff_block *next = s->strings->next;
+            free(s->strings);
+            s->strings = next;
+        }
+        free(s->sect_hash);
+        free(s->syms);
+        free(s->imports);
+        macho_export_list_free(&s->exports);
+        macho_link_info_free(&s->link);
+        if (s->loaded) macho_image_free(&s->img);
+        unmap_file(&s->mf);
+        memset(s, 0, sizeof(*s));
+    }
+}
+
+// Prints "  ... N more" once a category has used its quota.
+struct quota {
+    size_t top;
+    size_t shown;
+    size_t hidden;
+};
+
+static int quota_take(struct quota *q) {
+    if (q->top && q->shown >= q->top) {
+        q->hidden++;
+        return 0;
+    }
+    q->shown++;
+    return 1;
+}
+
+static void quota_flush(const struct quota *q) {
+    if (q->hidden) printf("  ... %zu more\n", q->hidden);
+}
+
+static void diff_facts(const struct bindiff_facts *a, const struct bindiff_facts *b,
+                       const char *title, size_t top, struct bindiff_stats *st) {
+    struct quota q = { top, 0, 0 };
+    int header = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a->n || j < b->n) {
+        const struct bindiff_fact *x = i < a->n ? &a->v[i] : NULL;
+        const struct bindiff_fact *y = j < b->n ? &b->v[j] : NULL;
+        int c = !x ? 1 : !y ? -1 : strcmp(x->key, y->key);
+        if (c == 0 && strcmp(x->val, y->val) == 0) {
+            i++;
+            j++;
+            continue;
+        }
+        if (!header) {
+            printf("%s:\n", title);
+            header = 1;
+        }
+        st->changes++;
+        if (c < 0) {
+            if (quota_take(&q)) printf("  - %s%s%s\n", x->key, x->val[0] ? "  " : "", x->val);
+            i++;
+        } else if (c > 0) {
+            if (quota_take(&q)) printf("  + %s%s%s\n", y->key, y->val[0] ? "  " : "", y->val);
+            j++;
+        } else {
+            if (quota_take(&q)) printf("  ~ %s  %s -> %s\n", x->key, x->val, y->val);
+            i++;
+            j++;
+        }
+    }
+    quota_flush(&q);
+}
+
+struct func {
+    uint64_t start;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t name_hash;    // sorts names on integers; ties fall back to strcmp
+    const char *name;
+    size_t match;          // index on the other side, or SIZE_MAX
+};
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+// Content hash of one function. arm64 words are hashed with their
+// PC-relative immediates cleared, and with the page offsets applied to
+// ADRP results, so relinking at other addresses does not change it.
+static uint64_t hash_code(const uint8_t *p, uint64_t len, int arm64) {
+    uint64_t h = mix(0x6a09e667f3bcc908ull, len);
+    if (!arm64) {
+        uint64_t i = 0;
+        for (; i + 8 <= len; i += 8) h = mix(h, load64_u(p + i, 0));
+        for (; i < len; i++) h = mix(h, p[i]);
+        return h;
+    }
+    uint32_t adrp_regs = 0;
+    for (uint64_t i = 0; i + 4 <= len; i += 4) {
+        uint32_t w = load32_u(p + i, 0);
+        struct a64_insn d;
+        a64_decode(w, &d);
+        uint64_t v = w;
+        switch (d.kind) {
+        case A64_ADRP:
+            adrp_regs |= 1u << d.rd;
+            v = (uint64_t)d.kind << 8 | d.rd;
+            break;
+        case A64_ADR:
+        case A64_LDR_LIT:
+            v = (uint64_t)d.kind << 8 | d.rd;
+            break;
+        case A64_B:
+        case A64_BL:
+            v = d.kind;
+            break;
+        case A64_B_COND:
+        case A64_CBZ:
+            v = w & ~(0x7ffffu << 5);
+            break;
+        case A64_TBZ:
+            v = w & ~(0x3fffu << 5);
+            break;
+        case A64_ADD_IMM:
+        case A64_LDST_UIMM:
+            if (adrp_regs & (1u << d.rn)) v = w & ~(0xfffu << 10);
+            if (d.kind == A64_ADD_IMM || d.is_load) adrp_regs &= ~(1u << d.rd);
+            break;
+        default:
+            break;
+        }
+        h = mix(h, v);
+    }
+    return h;
+}
+
+struct func_list {
+    struct func *v;
+    size_t n;
+};
+
+struct funcs_ctx {
+    struct bindiff_side *sides;
+    const size_t *pairs;           // (a section, b section) per changed code section
+    struct func_list *out;         // [2 * npairs]: side a then side b per pair
+    int oom;
+};
+
+static void funcs_worker(size_t begin, size_t end, unsigned worker, void *arg) {
+    (void)worker;
+    struct funcs_ctx *ctx = arg;
+    for (size_t k = begin; k < end; k++) {
+        const struct bindiff_side *s = &ctx->sides[k & 1];
+        const struct macho_image *img = &s->img;
+        const struct macho_section *sec = &img->sects[ctx->pairs[k]];
+        const uint8_t *bytes = section_bytes(img, sec);
+        uint64_t *starts = NULL;
+        size_t n = macho_image_functions_in(img, sec, &starts);
+        struct func *v = calloc(n ? n : 1, sizeof(*v));
+        if (!v || !starts || !bytes) {
+            if (!v || (!starts && n)) ctx->oom = 1;
+            free(v);
+            free(starts);
+            continue;
+        }
+        int arm64 = img->cputype == CPU_TYPE_ARM64;
+        uint64_t end_addr = sec->addr + sec->size;
+        for (size_t i = 0; i < n; i++) {
+            v[i].start = starts[i];
+            v[i].size = (i + 1 < n ? starts[i + 1] : end_addr) - starts[i];
+            v[i].hash = hash_code(bytes + (starts[i] - sec->addr), v[i].size, arm64);
+            v[i].name = symbol_at(s, starts[i]);
+            if (v[i].name) {
+                uint64_t h = 0xcbf29ce484222325ull;
+                for (const char *c = v[i].name; *c; c++) h = (h ^ (uint8_t)*c) * 0x100000001b3ull;
+                v[i].name_hash = h;
+            }
+            v[i].match = SIZE_MAX;
+        }
+        free(starts);
+        ctx->out[k].v = v;
+        ctx->out[k].n = n;
+    }
+}
+
+struct func_ref {
+    const struct func *f;
+    size_t idx;
+};
+
+static int cmp_ref_name(const void *a, const void *b) {
+    const struct func_ref *x = a;
+    const struct func_ref *y = b;
+    if (x->f->name_hash != y->f->name_hash) return x->f->name_hash < y->f->name_hash ? -1 : 1;
+    int c = strcmp(x->f->name, y->f->name);
+    return c ? c : (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+static int cmp_ref_hash(const void *a, const void *b) {
+    const struct func_ref *x = a;
+    const struct func_ref *y = b;
+    if (x->f->hash != y->f->hash) return x->f->hash < y->f->hash ? -1 : 1;
+    return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+// Unmatched functions of one list, with a name (by_name) or without, or
+// all unmatched ones (by_name < 0).
+static size_t collect(const struct func_list *l, int by_name, struct func_ref *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < l->n; i++) {
+        if (l->v[i].match != SIZE_MAX) continue;
+        if (by_name >= 0 && (l->v[i].name != NULL) != by_name) continue;
+        out[n].f = &l->v[i];
+        out[n++].idx = i;
+    }
+    return n;
+}
+
+// Pairs equal keys of two sorted ref arrays (the k-th with the k-th).
+static void match_sorted(struct func_list *a, struct func_list *b, struct func_ref *ra,
+                         size_t na, struct func_ref *rb, size_t nb,
+                         int (*cmp)(const void *, const void *)) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb) {
+        struct func_ref x = ra[i];
+        struct func_ref y = rb[j];
+        x.idx = y.idx = 0;   // compare keys only
+        int c = cmp(&x, &y);
+        if (c < 0) i++;
+        else if (c > 0) j++;
+        else {
+            a->v[ra[i].idx].match = rb[j].idx;
+            b->v[rb[j].idx].match = ra[i].idx;
+            i++;
+            j++;
+        }
+    }
+}
+
+static void print_func(char sign, const struct func *f, const struct func *g) {
+    char na[32];
+    const char *name = f->name;
+    if (!name) {
+        snprintf(na, sizeof(na), "sub_%llx", (unsigned long long)f->start);
+        name = na;
+    }
+    if (g) {
+        printf("  %c %s  %llu -> %llu bytes\n", sign, name, (unsigned long long)f->size,
+               (unsigned long long)g->size);
+    } else {
+        printf("  %c %s  %llu bytes\n", sign, name, (unsigned long long)f->size);
+    }
+}
+
+// Function-level diff of one changed code section. Returns the number of
+// changes reported, or -1 on allocation failure.
+static long diff_functions(struct func_list *a, struct func_list *b, const char *title,
+                           size_t top, struct bindiff_stats *st) {
+    size_t cap = (a->n > b->n ? a->n : b->n) + 1;
+    struct func_ref *ra = malloc(cap * sizeof(*ra));
+    struct func_ref *rb = malloc(cap * sizeof(*rb));
+    if (!ra || !rb) {
+        free(ra);
+        free(rb);
+        return -1;
+    }
+    // 1. Same name. 2. Same content (names differ or are absent).
+    size_t na = collect(a, 1, ra);
+    size_t nb = collect(b, 1, rb);
+    qsort(ra, na, sizeof(*ra), cmp_ref_name);
+    qsort(rb, nb, sizeof(*rb), cmp_ref_name);
+    match_sorted(a, b, ra, na, rb, nb, cmp_ref_name);
+    na = collect(a, -1, ra);
+    nb = collect(b, -1, rb);
+    qsort(ra, na, sizeof(*ra), cmp_ref_hash);
+    qsort(rb, nb, sizeof(*rb), cmp_ref_hash);
+    match_sorted(a, b, ra, na, rb, nb, cmp_ref_hash);
+    free(ra);
+    free(rb);
+
+    // 3. Unnamed leftovers between two anchors (matches that keep address
+    // order) are paired by position: the same slot, new contents.
+    size_t last_b = 0;
+    size_t jb = 0;
+    for (size_t i = 0; i <= a->n; i++) {
+        size_t next_b = b->n;
+        if (i < a->n) {
+            size_t m = a->v[i].match;
+            if (m == SIZE_MAX || m < last_b) continue;
+            next_b = m;
+        }
+        // a: unmatched since the previous anchor; b: unmatched in [jb, next_b).
+        size_t ia = i;
+        while (ia > 0 && a->v[ia - 1].match == SIZE_MAX) ia--;
+        for (size_t x = ia; x < i && jb < next_b; x++) {
+            if (a->v[x].name) continue;
+            while (jb < next_b && (b->v[jb].match != SIZE_MAX || b->v[jb].name)) jb++;
+            if (jb == next_b) break;
+            a->v[x].match = jb;
+            b->v[jb].match = x;
+            jb++;
+        }
+        jb = next_b + 1;
+        last_b = next_b;
+    }
+
+    struct quota q = { top, 0, 0 };
+    long reported = 0;
+    int header = 0;
+    for (size_t i = 0; i < a->n; i++) {
+        const struct func *f = &a->v[i];
+        const struct func *g = f->match == SIZE_MAX ? NULL : &b->v[f->match];
+        if (g && g->hash == f->hash) {
+            st->funcs_same++;
+            if (g->start != f->start) st->funcs_moved++;
+            continue;
+        }
+        if (!header) {
+            printf("%s:\n", title);
+            header = 1;
+        }
+        if (g) st->funcs_changed++;
+        else st->funcs_removed++;
+        reported++;
+        if (quota_take(&q)) print_func(g ? '~' : '-', f, g);
+    }
+    for (size_t j = 0; j < b->n; j++) {
+        if (b->v[j].match != SIZE_MAX) continue;
+        if (!header) {
+            printf("%s:\n", title);
+            header = 1;
+        }
+        st->funcs_added++;
+        reported++;
+        if (quota_take(&q)) print_func('+', &b->v[j], NULL);
+    }
+    quota_flush(&q);
+    return reported;
+}
+
+struct sect_ref {
+    const struct macho_section *s;
+    size_t idx;
+};
+
+static int cmp_sect(const void *a, const void *b) {
+    const struct macho_section *x = ((const struct sect_ref *)a)->s;
+    const struct macho_section *y = ((const struct sect_ref *)b)->s;
+    int c = strcmp(x->segname, y->segname);
+    return c ? c : strcmp(x->sectname, y->sectname);
+}
+
+static struct sect_ref *sorted_sections(const struct macho_image *img) {
+    struct sect_ref *v = malloc((img->nsects ? img->nsects : 1) * sizeof(*v));
+    if (!v) return NULL;
+    for (size_t i = 0; i < img->nsects; i++) {
+        v[i].s = &img->sects[i];
+        v[i].idx = i;
+    }
+    qsort(v, img->nsects, sizeof(*v), cmp_sect);
+    return v;
+}
+
+int bindiff_print(struct bindiff_side sides[2], size_t top, unsigned jobs,
+                  struct bindiff_stats *st) {
+    memset(st, 0, sizeof(*st));
+    printf("--- %s\n+++ %s\n", sides[0].path, sides[1].path);
+    for (int c = 0; c < BINDIFF_NCATEGORIES; c++) {
+        diff_facts(&sides[0].facts[c], &sides[1].facts[c], category_names[c], top, st);
+    }
+
+    // Sections present on both sides: equal hashes are skipped, changed
+    // code sections are queued for the function diff, changed data is
+    // counted byte by byte.
+    const struct macho_image *ia = &sides[0].img;
+    const struct macho_image *ib = &sides[1].img;
+    struct sect_ref *sa = sorted_sections(ia);
+    struct sect_ref *sb = sorted_sections(ib);
+    size_t *pairs = malloc(2 * (ia->nsects + 1) * sizeof(*pairs));
+    if (!sa || !sb || !pairs) {
+        free(sa);
+        free(sb);
+        free(pairs);
+        return -1;
+    }
+    size_t npairs = 0;
+    int header = 0;
+    struct quota q = { top, 0, 0 };
+    for (size_t i = 0, j = 0; i < ia->nsects && j < ib->nsects;) {
+        int c = cmp_sect(&sa[i], &sb[j]);
+        if (c) {
+            if (c < 0) i++;
+            else j++;
+            continue;
+        }
+        const struct macho_section *x = sa[i].s;
+        const struct macho_section *y = sb[j].s;
+        const uint8_t *px = section_bytes(ia, x);
+        const uint8_t *py = section_bytes(ib, y);
+        if (!px || !py ||
+            memcmp(sides[0].sect_hash[sa[i].idx], sides[1].sect_hash[sb[j].idx], 32) == 0) {
+            // Equal, or no contents to compare (zerofill: sizes are facts).
+            if (px && py) {
+                st->sections_same++;
+                st->bytes_skipped += x->size;
+            }
+        } else if ((x->flags & y->flags & (S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS))) {
+            pairs[2 * npairs] = sa[i].idx;
+            pairs[2 * npairs + 1] = sb[j].idx;
+            npairs++;
+        } else {
+            uint64_t n = x->size < y->size ? x->size : y->size;
+            uint64_t total = x->size > y->size ? x->size : y->size;
+            uint64_t differ = total - n;
+            for (uint64_t k = 0; k < n; k++) differ += px[k] != py[k];
+            st->sections_changed++;
+            if (!header) {
+                printf("contents:\n");
+                header = 1;
+            }
+            st->changes++;
+            if (quota_take(&q)) {
+                printf("  ~ %s,%s  %llu of %llu bytes differ\n", x->segname, x->sectname,
+                       (unsigned long long)differ, (unsigned long long)total);
+            }
+        }
+        i++;
+        j++;
+    }
+    quota_flush(&q);
+    free(sa);
+    free(sb);
+
+    struct func_list *lists = calloc(2 * npairs + 1, sizeof(*lists));
+    if (!lists) {
+        free(pairs);
+        return -1;
+    }
+    struct funcs_ctx ctx = { sides, pairs, lists, 0 };
+    a64_decode_init();
+    par_for(2 * npairs, 1, jobs, funcs_worker, &ctx);
+    int rc = ctx.oom ? -1 : 0;
+    for (size_t k = 0; k < npairs && rc == 0; k++) {
+        const struct macho_section *x = &ia->sects[pairs[2 * k]];
+        char title[64];
+        snprintf(title, sizeof(title), "functions in %s,%s", x->segname, x->sectname);
+        struct func_list *a = &lists[2 * k];
+        struct func_list *b = &lists[2 * k + 1];
+        long n = diff_functions(a, b, title, top, st);
+        if (n < 0) {
+            rc = -1;
+        } else if (n > 0) {
+            st->sections_changed++;
+            st->changes += (size_t)n;
+        } else {
+            // Only moved code: nothing real to report.
+            st->sections_same++;
+        }
+    }
+    for (size_t k = 0; k < 2 * npairs; k++) free(lists[k].v);
+    free(lists);
+    free(pairs);
+    return rc;
+}
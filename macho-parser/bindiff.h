@@ -0,0 +1,97 @@
+#ifndef MACHO_BINDIFF_H
+#define MACHO_BINDIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "corpus.h"
+#include "dyld_info.h"
+#include "macho_image.h"
+
+// Structural diff of two builds of one binary.
+//
+// Each side is reduced to named facts per category (header, load commands,
+// segments, sections, dylibs, rpaths, exports, imports, symbols). A fact's
+// value leaves out what shifts on every rebuild, such as addresses and
+// __LINKEDIT offsets. The facts are sorted by name and merged, so
+// additions, removals and changed values fall out of one pass.
+//
+// Section contents are compared by SHA-256: identical sections are skipped
+// without touching their bytes a second time. A changed code section is
+// split into functions (LC_FUNCTION_STARTS, else symbols). Functions are
+// matched by name, then by content hash, and the unnamed leftovers are
+// paired by position between matched anchors. On arm64 the content hash masks
+// PC-relative immediates (branch targets, ADRP pages and the page offsets
+// added to them), so code that only moved is not reported as changed.
+//
+// The two sides are parsed and hashed concurrently.
+
+enum bindiff_category {
+    BINDIFF_HEADER,
+    BINDIFF_LOAD_COMMANDS,
+    BINDIFF_SEGMENTS,
+    BINDIFF_SECTIONS,
+    BINDIFF_DYLIBS,
+    BINDIFF_RPATHS,
+    BINDIFF_EXPORTS,
+    BINDIFF_IMPORTS,
+    BINDIFF_SYMBOLS,
+    BINDIFF_NCATEGORIES
+};
+
+// Keys and values alias the image or the side's string blocks.
+struct bindiff_fact {
+    const char *key;
+    const char *val;
+};
+
+struct bindiff_block;
+
+struct bindiff_facts {
+    struct bindiff_fact *v;   // sorted by key, then value
+    size_t n;
+    size_t cap;
+};
+
+struct bindiff_side {
+    const char *path;
+    struct mapped_file mf;
+    struct macho_image img;
+    struct macho_link_info link;
+    struct macho_import *imports;
+    size_t nimports;
+    struct macho_export_list exports;
+    struct macho_symbol *syms;     // defined, by address
+    size_t nsyms;
+    uint8_t (*sect_hash)[32];      // per image section; zero if not file-backed
+    struct bindiff_facts facts[BINDIFF_NCATEGORIES];
+    struct bindiff_block *strings;  // formatted keys and values
+    int loaded;
+    char err[256];
+};
+
+struct bindiff_stats {
+    size_t changes;                // lines reported
+    size_t sections_same;
+    uint64_t bytes_skipped;        // in sections whose hashes matched
+    size_t sections_changed;
+    size_t funcs_same;             // matched with identical content
+    size_t funcs_moved;            // ... at a different address
+    size_t funcs_changed;
+    size_t funcs_added;
+    size_t funcs_removed;
+};
+
+// Maps, parses and hashes both files (the slice is picked as
+// macho_select_slice does), one thread per side. Returns 0, or -1 with the
+// failing side's err set; bindiff_close is needed either way.
+int bindiff_open(struct bindiff_side sides[2], const char *a, const char *b,
+                 int want_index, uint32_t want_cputype, unsigned jobs);
+void bindiff_close(struct bindiff_side sides[2]);
+
+// Prints the changes, at most `top` per category and per section (0: no
+// limit). Returns 0, or -1 on allocation failure.
+int bindiff_print(struct bindiff_side sides[2], size_t top, unsigned jobs,
+                  struct bindiff_stats *st);
+
+#endif /* MACHO_BINDIFF_H */
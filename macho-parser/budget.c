@@ -0,0 +1,337 @@
+#include "budget.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "macho_common.h"
+#include "macho_image.h"
+
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64  0xcafebabf
+#endif
+
+#ifndef FAT_CIGAM_64
+#define FAT_CIGAM_64  0xbfbafeca
+#endif
+
+static struct macho_budget g_default = {
+    MACHO_BUDGET_CMDS, MACHO_BUDGET_SECTS, MACHO_BUDGET_FAT_ARCHES,
+    MACHO_BUDGET_ALLOC, MACHO_BUDGET_WORK,
+};
+
+static void set_err(char *errbuf, size_t errlen, const char *fmt, ...) {
+    if (!errbuf || errlen == 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(errbuf, errlen, fmt, ap);
+    va_end(ap);
+}
+
+void macho_budget_defaults(struct macho_budget *b) {
+    b->max_cmds = MACHO_BUDGET_CMDS;
+    b->max_sects = MACHO_BUDGET_SECTS;
+    b->max_fat_arches = MACHO_BUDGET_FAT_ARCHES;
+    b->max_alloc = MACHO_BUDGET_ALLOC;
+    b->max_work = MACHO_BUDGET_WORK;
+}
+
+const struct macho_budget *macho_budget_default(void) {
+    return &g_default;
+}
+
+void macho_budget_set_default(const struct macho_budget *b) {
+    g_default = *b;
+}
+
+static int parse_size(const char *s, size_t n, uint64_t *out) {
+    if (n == 4 && memcmp(s, "none", 4) == 0) {
+        *out = 0;
+        return 0;
+    }
+    uint64_t v = 0;
+    size_t i = 0;
+    for (; i < n && s[i] >= '0' && s[i] <= '9'; i++) {
+        if (v > (UINT64_MAX - 9) / 10) return -1;
+        v = v * 10 + (uint64_t)(s[i] - '0');
+    }
+    if (i == 0) return -1;
+    if (i < n) {
+        unsigned shift;
+        switch (s[i]) {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: return -1;
+        }
+        if (i + 1 != n || v > (UINT64_MAX >> shift)) return -1;
+        v <<= shift;
+    }
+    *out = v;
+    return 0;
+}
+
+int macho_budget_parse(struct macho_budget *b, const char *spec, char *errbuf, size_t errlen) {
+    static const struct {
+        const char *key;
+        size_t off;
+    } keys[] = {
+        { "cmds", offsetof(struct macho_budget, max_cmds) },
+        { "sects", offsetof(struct macho_budget, max_sects) },
+        { "arches", offsetof(struct macho_budget, max_fat_arches) },
+        { "alloc", offsetof(struct macho_budget, max_alloc) },
+        { "work", offsetof(struct macho_budget, max_work) },
+    };
+    const char *p = spec;
+    while (*p) {
+        const char *item_end = strchr(p, ',');
+        if (!item_end) item_end = p + strlen(p);
+        const char *eq = memchr(p, '=', (size_t)(item_end - p));
+        if (!eq) {
+            set_err(errbuf, errlen, "budget: expected key=value in \"%.*s\"",
+                    (int)(item_end - p), p);
+            return -1;
+        }
+        size_t k = 0;
+        for (; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            if (strlen(keys[k].key) == (size_t)(eq - p) &&
+                memcmp(keys[k].key, p, (size_t)(eq - p)) == 0) break;
+        }
+        if (k == sizeof(keys) / sizeof(keys[0])) {
+            set_err(errbuf, errlen, "budget: unknown key \"%.*s\" (cmds, sects, arches, alloc, work)",
+                    (int)(eq - p), p);
+            return -1;
+        }
+        uint64_t v;
+        if (parse_size(eq + 1, (size_t)(item_end - eq - 1), &v) != 0) {
+            set_err(errbuf, errlen, "budget: bad value for %s", keys[k].key);
+            return -1;
+        }
+        memcpy((char *)b + keys[k].off, &v, sizeof(v));
+        p = *item_end ? item_end + 1 : item_end;
+    }
+    return 0;
+}
+
+static int over(uint64_t used, uint64_t limit) {
+    return limit && used > limit;
+}
+
+// Fixed part of the commands the parsers read, and where their lc_str
+// offset sits (0 for none).
+static uint32_t min_cmdsize(uint32_t cmd, uint32_t *str_field) {
+    *str_field = 0;
+    switch (cmd) {
+        case LC_SEGMENT: return sizeof(struct segment_command);
+        case LC_SEGMENT_64: return sizeof(struct segment_command_64);
+        case LC_SYMTAB: return sizeof(struct symtab_command);
+        case LC_DYSYMTAB: return sizeof(struct dysymtab_command);
+        case LC_MAIN: return sizeof(struct entry_point_command);
+        case LC_UUID: return sizeof(struct uuid_command);
+        case LC_DYLD_INFO:
+        case LC_DYLD_INFO_ONLY: return sizeof(struct dyld_info_command);
+        case LC_ENCRYPTION_INFO: return sizeof(struct encryption_info_command);
+        case LC_ENCRYPTION_INFO_64: return sizeof(struct encryption_info_command_64);
+        case LC_BUILD_VERSION: return sizeof(struct build_version_command);
+        case LC_SOURCE_VERSION: return sizeof(struct source_version_command);
+        case LC_UNIXTHREAD:
+        case LC_THREAD: return sizeof(struct thread_command);
+        case LC_CODE_SIGNATURE:
+        case LC_SEGMENT_SPLIT_INFO:
+        case LC_FUNCTION_STARTS:
+        case LC_DATA_IN_CODE:
+        case LC_DYLIB_CODE_SIGN_DRS:
+        case LC_LINKER_OPTIMIZATION_HINT:
+        case LC_DYLD_EXPORTS_TRIE:
+        case LC_DYLD_CHAINED_FIXUPS: return sizeof(struct linkedit_data_command);
+        case LC_LOAD_DYLIB:
+        case LC_LOAD_WEAK_DYLIB:
+        case LC_REEXPORT_DYLIB:
+        case LC_LOAD_UPWARD_DYLIB:
+        case LC_LAZY_LOAD_DYLIB:
+        case LC_ID_DYLIB:
+            *str_field = offsetof(struct dylib_command, dylib.name.offset);
+            return sizeof(struct dylib_command);
+        case LC_RPATH:
+            *str_field = offsetof(struct rpath_command, path.offset);
+            return sizeof(struct rpath_command);
+        case LC_LOAD_DYLINKER:
+        case LC_ID_DYLINKER:
+        case LC_DYLD_ENVIRONMENT:
+            *str_field = offsetof(struct dylinker_command, name.offset);
+            return sizeof(struct dylinker_command);
+        case LC_FILESET_ENTRY:
+            *str_field = offsetof(struct fileset_entry_command, entry_id.offset);
+            return sizeof(struct fileset_entry_command);
+        default: return sizeof(struct load_command);
+    }
+}
+
+int macho_budget_check_thin(const uint8_t *hp, size_t avail, const struct macho_budget *b,
+                            struct macho_budget_usage *u, char *errbuf, size_t errlen) {
+    if (!b) b = &g_default;
+    struct macho_budget_usage tmp;
+    if (!u) u = &tmp;
+    memset(u, 0, sizeof(*u));
+
+    if (avail < sizeof(struct mach_header)) {
+        set_err(errbuf, errlen, "file too small for mach_header");
+        return -1;
+    }
+    uint32_t magic;
+    memcpy(&magic, hp, sizeof(magic));
+    size_t hdr;
+    int sw;
+    if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        hdr = sizeof(struct mach_header_64);
+        sw = (magic == MH_CIGAM_64);
+    } else if (magic == MH_MAGIC || magic == MH_CIGAM) {
+        hdr = sizeof(struct mach_header);
+        sw = (magic == MH_CIGAM);
+    } else {
+        set_err(errbuf, errlen, "not a thin Mach-O (magic 0x%08x)", magic);
+        return -1;
+    }
+    if (avail < hdr) {
+        set_err(errbuf, errlen, "file too small for mach_header_64");
+        return -1;
+    }
+    uint32_t ncmds = load32_u(hp + offsetof(struct mach_header, ncmds), sw);
+    uint32_t sizeofcmds = load32_u(hp + offsetof(struct mach_header, sizeofcmds), sw);
+    if (sizeofcmds > avail - hdr) {
+        set_err(errbuf, errlen, "sizeofcmds extends beyond file");
+        return -1;
+    }
+    // Both checks before the walk: each command takes at least 8 bytes.
+    if (ncmds > sizeofcmds / sizeof(struct load_command)) {
+        set_err(errbuf, errlen, "ncmds %u does not fit in sizeofcmds %u", ncmds, sizeofcmds);
+        return -1;
+    }
+    if (over(ncmds, b->max_cmds)) {
+        set_err(errbuf, errlen, "budget: %u load commands (limit %llu)", ncmds,
+                (unsigned long long)b->max_cmds);
+        return -1;
+    }
+
+    uint64_t alloc = (uint64_t)ncmds * sizeof(struct macho_lc_ref);
+    uint64_t work = ncmds;
+    uint64_t nsects = 0;
+    uint32_t nsegs = 0;
+    const uint8_t *p = hp + hdr;
+    const uint8_t *end = p + sizeofcmds;
+    for (uint32_t i = 0; i < ncmds; i++) {
+        if ((size_t)(end - p) < sizeof(struct load_command)) {
+            set_err(errbuf, errlen, "truncated load command %u", i);
+            return -1;
+        }
+        uint32_t cmd = load32_u(p, sw);
+        uint32_t cmdsize = load32_u(p + 4, sw);
+        if (cmdsize < sizeof(struct load_command) || cmdsize > (size_t)(end - p)) {
+            set_err(errbuf, errlen, "invalid cmdsize %u at load command %u", cmdsize, i);
+            return -1;
+        }
+        uint32_t str_field;
+        uint32_t fixed = min_cmdsize(cmd, &str_field);
+        if (cmdsize < fixed) {
+            set_err(errbuf, errlen, "load command %u (0x%x) too small: %u < %u",
+                    i, cmd, cmdsize, fixed);
+            return -1;
+        }
+        if (str_field) {
+            uint32_t off = load32_u(p + str_field, sw);
+            if (off < fixed || off >= cmdsize) {
+                set_err(errbuf, errlen, "load command %u: string offset %u outside the command",
+                        i, off);
+                return -1;
+            }
+        }
+
+        if (cmd == LC_SEGMENT_64 || cmd == LC_SEGMENT) {
+            int seg64 = (cmd == LC_SEGMENT_64);
+            size_t secsz = seg64 ? sizeof(struct section_64) : sizeof(struct section);
+            uint32_t n = load32_u(p + (seg64 ? offsetof(struct segment_command_64, nsects)
+                                             : offsetof(struct segment_command, nsects)), sw);
+            if ((cmdsize - fixed) / secsz < n) {
+                set_err(errbuf, errlen, "segment command %u: %u sections truncated", i, n);
+                return -1;
+            }
+            nsegs++;
+            nsects += n;
+            work += n;
+            alloc += sizeof(struct segment_map) + (uint64_t)n * sizeof(struct macho_section);
+            if (over(nsects, b->max_sects)) {
+                set_err(errbuf, errlen, "budget: %llu sections (limit %llu)",
+                        (unsigned long long)nsects, (unsigned long long)b->max_sects);
+                return -1;
+            }
+        } else if (cmd == LC_UNIXTHREAD || cmd == LC_THREAD) {
+            const uint8_t *tp = p + fixed;
+            const uint8_t *tend = p + cmdsize;
+            while (tend - tp >= 8) {
+                uint32_t count = load32_u(tp + 4, sw);
+                tp += 8;
+                if (count > (size_t)(tend - tp) / sizeof(uint32_t)) {
+                    set_err(errbuf, errlen, "load command %u: thread state count %u overruns it",
+                            i, count);
+                    return -1;
+                }
+                tp += (size_t)count * sizeof(uint32_t);
+                work += 1 + count;
+                if (over(work, b->max_work)) break;
+            }
+        }
+        if (over(alloc, b->max_alloc)) {
+            set_err(errbuf, errlen, "budget: load needs %llu bytes (limit %llu)",
+                    (unsigned long long)alloc, (unsigned long long)b->max_alloc);
+            return -1;
+        }
+        if (over(work, b->max_work)) {
+            set_err(errbuf, errlen, "budget: %llu work units by load command %u (limit %llu)",
+                    (unsigned long long)work, i, (unsigned long long)b->max_work);
+            return -1;
+        }
+        p += cmdsize;
+    }
+
+    u->ncmds = ncmds;
+    u->nsegs = nsegs;
+    u->nsects = (uint32_t)nsects;
+    u->alloc = alloc;
+    u->work = work;
+    return 0;
+}
+
+int macho_budget_check_fat(const uint8_t *buf, size_t sz, const struct macho_budget *b,
+                           char *errbuf, size_t errlen) {
+    if (!b) b = &g_default;
+    if (sz < sizeof(struct fat_header)) {
+        set_err(errbuf, errlen, "file too small for fat_header");
+        return -1;
+    }
+    uint32_t magic;
+    memcpy(&magic, buf, sizeof(magic));
+    if (magic != FAT_MAGIC && magic != FAT_CIGAM &&
+        magic != FAT_MAGIC_64 && magic != FAT_CIGAM_64) {
+        set_err(errbuf, errlen, "not a FAT file (magic 0x%08x)", magic);
+        return -1;
+    }
+    int fat64 = (magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64);
+    int swapped = (magic == FAT_CIGAM || magic == FAT_CIGAM_64);
+    uint32_t nfat = load32_u(buf + 4, swapped);
+    size_t entsz = fat64 ? 32 : sizeof(struct fat_arch);     // fat_arch_64 is 32 bytes
+    if (over(nfat, b->max_fat_arches)) {
+        set_err(errbuf, errlen, "budget: %u fat slices (limit %llu)", nfat,
+                (unsigned long long)b->max_fat_arches);
+        return -1;
+    }
+    if ((uint64_t)nfat * entsz > sz - sizeof(struct fat_header)) {
+        set_err(errbuf, errlen, "truncated fat_arch table (nfat_arch=%u)", nfat);
+        return -1;
+    }
+    return 0;
+}
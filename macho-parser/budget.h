@@ -0,0 +1,71 @@
+#ifndef MACHO_BUDGET_H
+#define MACHO_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Resource limits for parsing files nobody vouches for. The header counts
+// (ncmds, nsects, nfat_arch, thread-state counts) come straight from the
+// file, and a parser that sizes allocations or loops by them lets one
+// crafted file claim gigabytes or hours of a corpus scan.
+//
+// macho_budget_check_thin walks the load command region once before
+// anything is allocated. It checks the structure the parsers rely on (every
+// command inside sizeofcmds, cmdsize at least the fixed part of the
+// commands that are read, section tables and thread states inside their
+// command, lc_str offsets inside theirs) and counts what a load will cost.
+// A file over any limit is rejected in O(sizeofcmds) time with no
+// allocation. Every field is read with load32_u, so the load commands may
+// sit at any address.
+//
+// Work units: one per load command, per section and per thread-state word.
+// A limit of 0 means unlimited.
+
+struct macho_budget {
+    uint64_t max_cmds;         // load commands per image
+    uint64_t max_sects;        // sections per image, all segments
+    uint64_t max_fat_arches;   // slices per FAT header
+    uint64_t max_alloc;        // bytes a load may allocate for its tables
+    uint64_t max_work;         // work units per image
+};
+
+#define MACHO_BUDGET_CMDS 65536
+#define MACHO_BUDGET_SECTS 65536
+#define MACHO_BUDGET_FAT_ARCHES 64
+#define MACHO_BUDGET_ALLOC (64ull << 20)
+#define MACHO_BUDGET_WORK (4ull << 20)
+
+// What an image that passed the check will need.
+struct macho_budget_usage {
+    uint32_t ncmds;
+    uint32_t nsegs;            // LC_SEGMENT and LC_SEGMENT_64
+    uint32_t nsects;
+    uint64_t alloc;            // macho_image tables: lc refs, segments, sections
+    uint64_t work;
+};
+
+void macho_budget_defaults(struct macho_budget *b);
+
+// The budget the loaders use when passed NULL. Set it before starting
+// threads; it is read without locking.
+const struct macho_budget *macho_budget_default(void);
+void macho_budget_set_default(const struct macho_budget *b);
+
+// Update b from "key=value,..." with keys cmds, sects, arches, alloc and
+// work. Values take a K, M or G suffix (powers of 1024); "none" is 0.
+// Returns 0, or -1 with a reason in errbuf.
+int macho_budget_parse(struct macho_budget *b, const char *spec, char *errbuf, size_t errlen);
+
+// Validate the thin Mach-O whose header is at hp, with `avail` bytes of
+// the file from there on. b may be NULL (the default); u may be NULL.
+// Returns 0, or -1 with a reason in errbuf.
+int macho_budget_check_thin(const uint8_t *hp, size_t avail, const struct macho_budget *b,
+                            struct macho_budget_usage *u, char *errbuf, size_t errlen);
+
+// Validate a FAT or FAT64 header of an `sz`-byte buffer: the slice count
+// against max_fat_arches and the table against the buffer. Slice bounds are
+// left to the callers, which report them per slice.
+int macho_budget_check_fat(const uint8_t *buf, size_t sz, const struct macho_budget *b,
+                           char *errbuf, size_t errlen);
+
+#endif /* MACHO_BUDGET_H */
@@ -0,0 +1,471 @@
+#include "cfg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+
+#include "arm64_decode.h"
+#include "macho_common.h"
+#include "parallel.h"
+
+// Per-function result of phase 1, with block-local successor indices.
+struct fn_local {
+    struct cfg_block *blocks;
+    uint32_t nblocks;
+    uint32_t *succ;
+    uint32_t nsucc;
+    uint64_t *calls;
+    uint32_t ncalls;
+    uint32_t patch_bytes;
+    uint32_t succ_base;     // assigned in phase 2
+    int oom;
+};
+
+struct cfg_job {
+    const uint8_t *code;
+    uint64_t code_addr;
+    uint64_t code_end;
+    const uint64_t *starts;
+    size_t nfuncs;
+    struct fn_local *local;
+};
+
+#define PATCH_MAX_BYTES 16u
+
+static int has_target(uint8_t kind) {
+    return kind == A64_B || kind == A64_BL || kind == A64_B_COND ||
+           kind == A64_CBZ || kind == A64_TBZ;
+}
+
+static int is_pc_relative(uint8_t kind) {
+    return kind == A64_ADRP || kind == A64_ADR || kind == A64_LDR_LIT ||
+           a64_is_branch(kind);
+}
+
+static void analyze_function(const struct cfg_job *job, size_t fi, struct fn_local *out) {
+    uint64_t fs = job->starts[fi];
+    uint64_t fe = (fi + 1 < job->nfuncs) ? job->starts[fi + 1] : job->code_end;
+    memset(out, 0, sizeof(*out));
+    if (fe <= fs) return;
+    size_t n = (size_t)((fe - fs) / 4);
+    if (n == 0) return;
+    // A start that is not 4-aligned leaves a partial word at the end; the
+    // target checks below must not index it.
+    fe = fs + (uint64_t)n * 4;
+
+    const uint8_t *code = job->code + (fs - job->code_addr);
+    struct a64_insn *ins = malloc(n * sizeof(*ins));
+    uint8_t *lead = calloc(n, 1);
+    uint32_t *block_of = malloc(n * sizeof(*block_of));
+    if (!ins || !lead || !block_of) {
+        out->oom = 1;
+        goto done;
+    }
+
+    // Pass 1: decode once, mark leaders and count edges.
+    lead[0] = 1;
+    uint32_t ncalls = 0;
+    for (size_t i = 0; i < n; i++) {
+        a64_decode(load32_u(code + i * 4, 0), &ins[i]);
+        uint8_t k = ins[i].kind;
+        if (!a64_is_branch(k) || k == A64_BL || k == A64_BLR) continue;
+        if (i + 1 < n) lead[i + 1] = 1;
+        if (has_target(k)) {
+            uint64_t t = a64_pcrel_target(&ins[i], fs + i * 4);
+            if (t >= fs && t < fe && ((t - fs) & 3) == 0) lead[(t - fs) / 4] = 1;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint8_t k = ins[i].kind;
+        if (k == A64_BL) ncalls++;
+        else if (k == A64_B) {
+            uint64_t t = a64_pcrel_target(&ins[i], fs + i * 4);
+            if (t < fs || t >= fe) ncalls++;
+        }
+    }
+
+    uint32_t nblocks = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lead[i]) nblocks++;
+        block_of[i] = nblocks - 1;
+    }
+
+    out->blocks = malloc(nblocks * sizeof(*out->blocks));
+    out->succ = malloc((size_t)nblocks * 2 * sizeof(*out->succ));
+    out->calls = malloc((ncalls ? ncalls : 1) * sizeof(*out->calls));
+    if (!out->blocks || !out->succ || !out->calls) {
+        out->oom = 1;
+        goto done;
+    }
+
+    // Pass 2: materialize blocks and their successors.
+    size_t i = 0;
+    while (i < n) {
+        size_t j = i + 1;
+        while (j < n && !lead[j]) j++;
+        struct cfg_block *b = &out->blocks[out->nblocks];
+        const struct a64_insn *last = &ins[j - 1];
+        uint64_t last_pc = fs + (j - 1) * 4;
+        b->start = fs + i * 4;
+        b->ninsns = (uint32_t)(j - i);
+        b->succ_start = out->nsucc;
+        b->term = last->kind;
+
+        uint8_t k = last->kind;
+        if (k == A64_B || k == A64_B_COND || k == A64_CBZ || k == A64_TBZ) {
+            uint64_t t = a64_pcrel_target(last, last_pc);
+            if (t >= fs && t < fe && ((t - fs) & 3) == 0) {
+                out->succ[out->nsucc++] = block_of[(t - fs) / 4];
+            }
+        }
+        if (!a64_is_terminal(k) && j < n) {
+            out->succ[out->nsucc++] = block_of[j];
+        }
+        b->nsucc = (uint8_t)(out->nsucc - b->succ_start);
+        out->nblocks++;
+        i = j;
+    }
+
+    for (size_t k = 0; k < n; k++) {
+        uint64_t pc = fs + k * 4;
+        if (ins[k].kind == A64_BL) {
+            out->calls[out->ncalls++] = a64_pcrel_target(&ins[k], pc);
+        } else if (ins[k].kind == A64_B) {
+            uint64_t t = a64_pcrel_target(&ins[k], pc);
+            if (t < fs || t >= fe) out->calls[out->ncalls++] = t;
+        }
+    }
+
+    // arm64_patch_prologue copies the first insn_bytes into a trampoline and
+    // branches back, so those bytes must be position-independent and must
+    // not be a branch target themselves.
+    uint32_t entry = out->blocks[0].ninsns;
+    uint32_t limit = PATCH_MAX_BYTES / 4;
+    uint32_t safe = 0;
+    while (safe < entry && safe < limit && !is_pc_relative(ins[safe].kind)) safe++;
+    out->patch_bytes = safe * 4;
+
+done:
+    free(ins);
+    free(lead);
+    free(block_of);
+}
+
+static void cfg_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct cfg_job *job = ctx;
+    for (size_t i = begin; i < end; i++) analyze_function(job, i, &job->local[i]);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+long cfg_function_at(const struct cfg_graph *g, uint64_t addr) {
+    size_t lo = 0;
+    size_t hi = g->nfuncs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g->funcs[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return -1;
+    const struct cfg_function *f = &g->funcs[lo - 1];
+    return (addr < f->end) ? (long)(lo - 1) : -1;
+}
+
+long cfg_block_at(const struct cfg_graph *g, uint64_t addr) {
+    long fi = cfg_function_at(g, addr);
+    if (fi < 0) return -1;
+    const struct cfg_function *f = &g->funcs[fi];
+    size_t lo = f->first_block;
+    size_t hi = (size_t)f->first_block + f->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (g->blocks[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == f->first_block) return -1;
+    const struct cfg_block *b = &g->blocks[lo - 1];
+    return (addr < b->start + (uint64_t)b->ninsns * 4) ? (long)(lo - 1) : -1;
+}
+
+struct link_job {
+    struct cfg_graph *g;
+    struct fn_local *local;
+};
+
+// Phase 3: copy each function's blocks/edges into its prefix-summed slot and
+// resolve call targets to function ids.
+static void link_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct link_job *lj = ctx;
+    struct cfg_graph *g = lj->g;
+    for (size_t fi = begin; fi < end; fi++) {
+        struct fn_local *l = &lj->local[fi];
+        struct cfg_function *f = &g->funcs[fi];
+        uint32_t succ_off = l->succ_base;
+        for (uint32_t b = 0; b < l->nblocks; b++) {
+            struct cfg_block *dst = &g->blocks[f->first_block + b];
+            *dst = l->blocks[b];
+            dst->succ_start += succ_off;
+        }
+        for (uint32_t s = 0; s < l->nsucc; s++) {
+            g->succ[succ_off + s] = f->first_block + l->succ[s];
+        }
+
+        uint32_t *dst = &g->callees[f->callee_start];
+        uint32_t n = 0;
+        for (uint32_t c = 0; c < l->ncalls; c++) {
+            long callee = cfg_function_at(g, l->calls[c]);
+            if (callee >= 0) dst[n++] = (uint32_t)callee;
+        }
+        qsort(dst, n, sizeof(*dst), cmp_u32);
+        uint32_t u = 0;
+        for (uint32_t c = 0; c < n; c++) {
+            if (u == 0 || dst[c] != dst[u - 1]) dst[u++] = dst[c];
+        }
+        f->ncallees = u;
+        f->ncall_sites = l->ncalls;
+        f->patch_bytes = l->patch_bytes;
+    }
+}
+
+int cfg_build(const struct macho_image *img, unsigned nthreads,
+              struct cfg_graph *out, char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    if (img->cputype != (uint32_t)CPU_TYPE_ARM64) {
+        snprintf(errbuf, errlen, "CFG recovery needs an arm64 slice");
+        return -1;
+    }
+    a64_decode_init();
+    const struct macho_section *text = macho_image_section(img, "__TEXT", "__text");
+    if (!text || text->size == 0) {
+        snprintf(errbuf, errlen, "no __TEXT,__text section");
+        return -1;
+    }
+    if ((uint64_t)text->offset + text->size > img->size) {
+        snprintf(errbuf, errlen, "__text out of bounds");
+        return -1;
+    }
+
+    uint64_t *starts = NULL;
+    size_t nfuncs = macho_image_functions_in(img, text, &starts);
+    if (nfuncs == 0) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    struct fn_local *local = calloc(nfuncs, sizeof(*local));
+    if (!local) {
+        free(starts);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    struct cfg_job job;
+    job.code = img->buf + text->offset;
+    job.code_addr = text->addr;
+    job.code_end = text->addr + (text->size & ~(uint64_t)3);
+    job.starts = starts;
+    job.nfuncs = nfuncs;
+    job.local = local;
+    par_for(nfuncs, 8, nthreads, cfg_worker, &job);
+
+    // Phase 2: prefix sums give every function its slice of the flat arrays.
+    int rc = -1;
+    size_t nblocks = 0;
+    size_t nsucc = 0;
+    size_t ncalls = 0;
+    for (size_t i = 0; i < nfuncs; i++) {
+        if (local[i].oom) goto fail_oom;
+        nblocks += local[i].nblocks;
+        nsucc += local[i].nsucc;
+        ncalls += local[i].ncalls;
+    }
+    if (nblocks > UINT32_MAX || nsucc > UINT32_MAX || ncalls > UINT32_MAX) {
+        snprintf(errbuf, errlen, "graph too large");
+        goto fail;
+    }
+
+    out->nfuncs = nfuncs;
+    out->funcs = calloc(nfuncs, sizeof(*out->funcs));
+    out->blocks = calloc(nblocks ? nblocks : 1, sizeof(*out->blocks));
+    out->succ = malloc((nsucc ? nsucc : 1) * sizeof(*out->succ));
+    out->callees = malloc((ncalls ? ncalls : 1) * sizeof(*out->callees));
+    if (!out->funcs || !out->blocks || !out->succ || !out->callees) goto fail_oom;
+    out->nblocks = nblocks;
+    out->nsucc = nsucc;
+
+    uint32_t boff = 0;
+    uint32_t soff = 0;
+    uint32_t coff = 0;
+    for (size_t i = 0; i < nfuncs; i++) {
+        struct cfg_function *f = &out->funcs[i];
+        f->start = starts[i];
+        f->end = (i + 1 < nfuncs) ? starts[i + 1] : job.code_end;
+        // A start in the last partial word of __text lies past code_end.
+        if (f->end < f->start) f->end = f->start;
+        f->first_block = boff;
+        f->nblocks = local[i].nblocks;
+        f->callee_start = coff;
+        local[i].succ_base = soff;
+        boff += local[i].nblocks;
+        soff += local[i].nsucc;
+        coff += local[i].ncalls;
+    }
+
+    struct link_job lj;
+    lj.g = out;
+    lj.local = local;
+    par_for(nfuncs, 32, nthreads, link_worker, &lj);
+
+    // Compact callee lists (dedupe left holes) and build the reverse CSR.
+    size_t cw = 0;
+    for (size_t i = 0; i < nfuncs; i++) {
+        struct cfg_function *f = &out->funcs[i];
+        memmove(&out->callees[cw], &out->callees[f->callee_start],
+                f->ncallees * sizeof(*out->callees));
+        f->callee_start = (uint32_t)cw;
+        cw += f->ncallees;
+    }
+    out->ncallees = cw;
+
+    out->callers = malloc((cw ? cw : 1) * sizeof(*out->callers));
+    if (!out->callers) goto fail_oom;
+    for (size_t i = 0; i < cw; i++) out->funcs[out->callees[i]].ncallers++;
+    uint32_t acc = 0;
+    for (size_t i = 0; i < nfuncs; i++) {
+        out->funcs[i].caller_start = acc;
+        acc += out->funcs[i].ncallers;
+        out->funcs[i].ncallers = 0;
+    }
+    for (size_t i = 0; i < nfuncs; i++) {
+        const struct cfg_function *f = &out->funcs[i];
+        for (uint32_t c = 0; c < f->ncallees; c++) {
+            struct cfg_function *callee = &out->funcs[out->callees[f->callee_start + c]];
+            out->callers[callee->caller_start + callee->ncallers++] = (uint32_t)i;
+        }
+    }
+    out->ncallers = cw;
+    rc = 0;
+    goto done;
+
+fail_oom:
+    snprintf(errbuf, errlen, "out of memory");
+fail:
+    cfg_free(out);
+done:
+    for (size_t i = 0; i < nfuncs; i++) {
+        free(local[i].blocks);
+        free(local[i].succ);
+        free(local[i].calls);
+    }
+    free(local);
+    free(starts);
+    return rc;
+}
+
+void cfg_free(struct cfg_graph *g) {
+    free(g->funcs);
+    free(g->blocks);
+    free(g->succ);
+    free(g->callees);
+    free(g->callers);
+    memset(g, 0, sizeof(*g));
+}
+
+size_t cfg_blast_radius(const struct cfg_graph *g, size_t func) {
+    if (func >= g->nfuncs) return 0;
+    uint8_t *seen = calloc(g->nfuncs, 1);
+    uint32_t *queue = malloc(g->nfuncs * sizeof(*queue));
+    if (!seen || !queue) {
+        free(seen);
+        free(queue);
+        return 0;
+    }
+    size_t qh = 0;
+    size_t qt = 0;
+    size_t count = 0;
+    seen[func] = 1;
+    queue[qt++] = (uint32_t)func;
+    while (qh < qt) {
+        const struct cfg_function *f = &g->funcs[queue[qh++]];
+        for (uint32_t c = 0; c < f->ncallers; c++) {
+            uint32_t caller = g->callers[f->caller_start + c];
+            if (seen[caller]) continue;
+            seen[caller] = 1;
+            queue[qt++] = caller;
+            count++;
+        }
+    }
+    free(seen);
+    free(queue);
+    return count;
+}
+
+uint32_t cfg_patch_window(const struct macho_image *img, const struct cfg_graph *g,
+                          uint64_t addr, uint32_t max_bytes) {
+    long bi = cfg_block_at(g, addr);
+    if (bi < 0 || (addr & 3)) return 0;
+    const struct cfg_block *b = &g->blocks[bi];
+    uint64_t block_end = b->start + (uint64_t)b->ninsns * 4;
+    const uint8_t *p = macho_image_vm_ptr(img, addr, block_end - addr);
+    if (!p) return 0;
+
+    uint32_t bytes = 0;
+    struct a64_insn d;
+    while (bytes + 4 <= max_bytes && addr + bytes < block_end) {
+        a64_decode(load32_u(p + bytes, 0), &d);
+        if (is_pc_relative(d.kind)) break;
+        bytes += 4;
+    }
+    return bytes;
+}
+
+static void print_function(const struct cfg_graph *g, size_t fi, int verbose) {
+    const struct cfg_function *f = &g->funcs[fi];
+    printf("func 0x%llx size=0x%llx blocks=%u callees=%u callers=%u call_sites=%u patch_bytes=%u\n",
+           (unsigned long long)f->start,
+           (unsigned long long)(f->end - f->start),
+           f->nblocks, f->ncallees, f->ncallers, f->ncall_sites, f->patch_bytes);
+    if (!verbose) return;
+    for (uint32_t b = 0; b < f->nblocks; b++) {
+        const struct cfg_block *blk = &g->blocks[f->first_block + b];
+        printf("     bb 0x%llx insns=%u term=%s", (unsigned long long)blk->start,
+               blk->ninsns, a64_kind_name(blk->term));
+        for (uint32_t s = 0; s < blk->nsucc; s++) {
+            printf("%s0x%llx", s ? ", " : " -> ",
+                   (unsigned long long)g->blocks[g->succ[blk->succ_start + s]].start);
+        }
+        printf("\n");
+    }
+    for (uint32_t c = 0; c < f->ncallees; c++) {
+        printf("     calls 0x%llx\n",
+               (unsigned long long)g->funcs[g->callees[f->callee_start + c]].start);
+    }
+    for (uint32_t c = 0; c < f->ncallers; c++) {
+        printf("     called-by 0x%llx\n",
+               (unsigned long long)g->funcs[g->callers[f->caller_start + c]].start);
+    }
+}
+
+void cfg_print(const struct cfg_graph *g, int only_func, uint64_t addr) {
+    printf("== CFG (__TEXT,__text) ==\n");
+    printf("functions=%zu blocks=%zu edges=%zu call_edges=%zu\n",
+           g->nfuncs, g->nblocks, g->nsucc, g->ncallees);
+    if (only_func) {
+        long fi = cfg_function_at(g, addr);
+        if (fi < 0) {
+            printf("0x%llx: not inside a known function\n", (unsigned long long)addr);
+            return;
+        }
+        print_function(g, (size_t)fi, 1);
+        printf("     blast_radius=%zu (transitive callers)\n", cfg_blast_radius(g, (size_t)fi));
+        return;
+    }
+    for (size_t i = 0; i < g->nfuncs; i++) print_function(g, i, 1);
+}
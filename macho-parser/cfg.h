@@ -0,0 +1,79 @@
+#ifndef MACHO_CFG_H
+#define MACHO_CFG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Basic-block CFG and direct call graph for arm64 __TEXT,__text.
+//
+// Function boundaries come from macho_image_functions_in (LC_FUNCTION_STARTS,
+// else the symbol table). Each function is split into basic blocks at branch
+// targets and after every branch; edges follow B/B.cond/CBZ/TBZ and
+// fallthrough. BL targets, and B targets that land on another function's
+// entry (tail calls), become call-graph edges.
+//
+// Everything is stored CSR-style in flat arrays:
+//   funcs[f].first_block .. +nblocks          -> blocks[]
+//   blocks[b].succ_start .. +nsucc            -> succ[] (global block ids)
+//   funcs[f].callee_start .. +ncallees        -> callees[] (function ids)
+//   funcs[f].caller_start .. +ncallers        -> callers[] (function ids)
+
+struct cfg_block {
+    uint64_t start;
+    uint32_t ninsns;
+    uint32_t succ_start;
+    uint8_t nsucc;
+    uint8_t term;           // a64_kind of the last instruction
+};
+
+struct cfg_function {
+    uint64_t start;
+    uint64_t end;
+    uint32_t first_block;
+    uint32_t nblocks;
+    uint32_t callee_start;
+    uint32_t ncallees;
+    uint32_t caller_start;
+    uint32_t ncallers;
+    uint32_t ncall_sites;   // BL/tail-call instructions, including external targets
+    uint32_t patch_bytes;   // safe insn_bytes for arm64_patch_prologue (0 = unsafe)
+};
+
+struct cfg_graph {
+    struct cfg_function *funcs;
+    size_t nfuncs;
+    struct cfg_block *blocks;
+    size_t nblocks;
+    uint32_t *succ;
+    size_t nsucc;
+    uint32_t *callees;
+    size_t ncallees;
+    uint32_t *callers;
+    size_t ncallers;
+};
+
+int cfg_build(const struct macho_image *img, unsigned nthreads,
+              struct cfg_graph *out, char *errbuf, size_t errlen);
+void cfg_free(struct cfg_graph *g);
+
+// Function whose [start, end) contains addr, or -1.
+long cfg_function_at(const struct cfg_graph *g, uint64_t addr);
+
+// Block containing addr, or -1.
+long cfg_block_at(const struct cfg_graph *g, uint64_t addr);
+
+// Number of distinct functions that can reach `func` through direct calls
+// (transitive callers, excluding itself): the blast radius of a hook.
+size_t cfg_blast_radius(const struct cfg_graph *g, size_t func);
+
+// Largest prefix (up to max_bytes, multiple of 4) of [addr, ...) that can be
+// overwritten and relocated into a trampoline: it stays in one basic block,
+// no branch lands strictly inside it, and it has no PC-relative instruction.
+uint32_t cfg_patch_window(const struct macho_image *img, const struct cfg_graph *g,
+                          uint64_t addr, uint32_t max_bytes);
+
+void cfg_print(const struct cfg_graph *g, int only_func, uint64_t addr);
+
+#endif /* MACHO_CFG_H */
@@ -0,0 +1,716 @@
+#include "codesign.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/kern/cs_blobs.h"
+#include "../include/macho/loader.h"
+
+#include "digest.h"
+#include "macho_common.h"
+#include "parallel.h"
+
+const char *cs_hash_type_name(uint8_t type) {
+    switch (type) {
+    case CS_HASHTYPE_SHA1:             return "sha1";
+    case CS_HASHTYPE_SHA256:           return "sha256";
+    case CS_HASHTYPE_SHA256_TRUNCATED: return "sha256-truncated";
+    case CS_HASHTYPE_SHA384:           return "sha384";
+    default:                           return "unknown";
+    }
+}
+
+static size_t hash_type_size(uint8_t type) {
+    switch (type) {
+    case CS_HASHTYPE_SHA1:             return CS_SHA1_LEN;
+    case CS_HASHTYPE_SHA256:           return CS_SHA256_LEN;
+    case CS_HASHTYPE_SHA256_TRUNCATED: return CS_SHA256_TRUNCATED_LEN;
+    case CS_HASHTYPE_SHA384:           return 48;
+    default:                           return 0;
+    }
+}
+
+static const char *slot_name(uint32_t slot) {
+    switch (slot) {
+    case CSSLOT_CODEDIRECTORY:                return "CodeDirectory";
+    case CSSLOT_INFOSLOT:                     return "Info.plist";
+    case CSSLOT_REQUIREMENTS:                 return "Requirements";
+    case CSSLOT_RESOURCEDIR:                  return "ResourceDir";
+    case CSSLOT_APPLICATION:                  return "Application";
+    case CSSLOT_ENTITLEMENTS:                 return "Entitlements";
+    case CSSLOT_DER_ENTITLEMENTS:             return "DER Entitlements";
+    case CSSLOT_LAUNCH_CONSTRAINT_SELF:       return "LaunchConstraint(self)";
+    case CSSLOT_LAUNCH_CONSTRAINT_PARENT:     return "LaunchConstraint(parent)";
+    case CSSLOT_LAUNCH_CONSTRAINT_RESPONSIBLE: return "LaunchConstraint(responsible)";
+    case CSSLOT_LIBRARY_CONSTRAINT:           return "LibraryConstraint";
+    case CSSLOT_SIGNATURESLOT:                return "CMS Signature";
+    case CSSLOT_IDENTIFICATIONSLOT:           return "Identification";
+    case CSSLOT_TICKETSLOT:                   return "Ticket";
+    default:
+        if (slot >= CSSLOT_ALTERNATE_CODEDIRECTORIES &&
+            slot < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT) {
+            return "Alternate CodeDirectory";
+        }
+        return "?";
+    }
+}
+
+// NUL-terminated string at `off` inside a blob of `len` bytes, or NULL.
+static const char *blob_string(const uint8_t *blob, uint32_t len, uint32_t off) {
+    if (off == 0 || off >= len) return NULL;
+    if (!memchr(blob + off, 0, len - off)) return NULL;
+    return (const char *)(blob + off);
+}
+
+static int parse_code_directory(const struct cs_blob_ref *b, struct cs_code_directory *cd,
+                                char *errbuf, size_t errlen) {
+    const uint8_t *p = b->data;
+    uint32_t len = b->length;
+    memset(cd, 0, sizeof(*cd));
+
+    // Fixed prefix through spare2 (version 0x20001).
+    if (len < 44) {
+        snprintf(errbuf, errlen, "CodeDirectory in slot 0x%x too short", b->slot);
+        return -1;
+    }
+    cd->blob = p;
+    cd->length = len;
+    cd->slot = b->slot;
+    cd->version = load32_be(p + 8);
+    cd->flags = load32_be(p + 12);
+    cd->hash_offset = load32_be(p + 16);
+    cd->ident_offset = load32_be(p + 20);
+    cd->n_special = load32_be(p + 24);
+    cd->n_code = load32_be(p + 28);
+    cd->code_limit = load32_be(p + 32);
+    cd->hash_size = p[36];
+    cd->hash_type = p[37];
+    cd->platform = p[38];
+    cd->page_shift = p[39];
+
+    // Every later field is only present from the version that added it.
+    if (cd->version >= CS_SUPPORTSSCATTER && len >= 48) {
+        cd->scatter_offset = load32_be(p + 44);
+    }
+    if (cd->version >= CS_SUPPORTSTEAMID && len >= 52) {
+        cd->team_offset = load32_be(p + 48);
+    }
+    if (cd->version >= CS_SUPPORTSCODELIMIT64 && len >= 64) {
+        uint64_t limit64 = load64_be(p + 56);
+        if (limit64) cd->code_limit = limit64;
+    }
+    if (cd->version >= CS_SUPPORTSEXECSEG && len >= 88) {
+        cd->exec_seg_base = load64_be(p + 64);
+        cd->exec_seg_limit = load64_be(p + 72);
+        cd->exec_seg_flags = load64_be(p + 80);
+    }
+    if (cd->version >= CS_SUPPORTSRUNTIME && len >= 96) {
+        cd->runtime = load32_be(p + 88);
+        cd->pre_encrypt_offset = load32_be(p + 92);
+    }
+    if (cd->version >= CS_SUPPORTSLINKAGE && len >= 108) {
+        cd->linkage_hash_type = p[96];
+        cd->linkage_app_type = p[97];
+        cd->linkage_app_subtype = (uint16_t)((p[98] << 8) | p[99]);
+        cd->linkage_offset = load32_be(p + 100);
+        cd->linkage_size = load32_be(p + 104);
+    }
+
+    size_t want = hash_type_size(cd->hash_type);
+    if (want == 0 || cd->hash_size != want) {
+        snprintf(errbuf, errlen, "CodeDirectory in slot 0x%x: hash type %u with size %u",
+                 b->slot, cd->hash_type, cd->hash_size);
+        return -1;
+    }
+    if (cd->page_shift != 0 && (cd->page_shift < 9 || cd->page_shift > 30)) {
+        snprintf(errbuf, errlen, "CodeDirectory in slot 0x%x: page size 2^%u",
+                 b->slot, cd->page_shift);
+        return -1;
+    }
+
+    // Special slots sit just below hashOffset, code slots from it upward.
+    uint64_t below = (uint64_t)cd->n_special * cd->hash_size;
+    uint64_t above = (uint64_t)cd->n_code * cd->hash_size;
+    if (cd->hash_offset < below || (uint64_t)cd->hash_offset + above > len) {
+        snprintf(errbuf, errlen, "CodeDirectory in slot 0x%x: hash slots out of bounds",
+                 b->slot);
+        return -1;
+    }
+
+    cd->ident = blob_string(p, len, cd->ident_offset);
+    cd->team = blob_string(p, len, cd->team_offset);
+
+    uint8_t full[DIGEST_MAX_LEN];
+    digest_cs(cd->hash_type, p, len, full);
+    memcpy(cd->cdhash, full, CS_CDHASH_LEN);
+    return 0;
+}
+
+const struct cs_blob_ref *cs_find_slot(const struct cs_signature *sig, uint32_t slot) {
+    for (uint32_t i = 0; i < sig->count; i++) {
+        if (sig->blobs[i].slot == slot) return &sig->blobs[i];
+    }
+    return NULL;
+}
+
+int cs_parse_blob(const uint8_t *data, uint32_t size, struct cs_signature *out,
+                  char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    if (size < 12) {
+        snprintf(errbuf, errlen, "code signature too small (%u bytes)", size);
+        return -1;
+    }
+    uint32_t magic = load32_be(data);
+    uint32_t length = load32_be(data + 4);
+    uint32_t count = load32_be(data + 8);
+    if (magic != CSMAGIC_EMBEDDED_SIGNATURE) {
+        snprintf(errbuf, errlen, "bad SuperBlob magic 0x%08x", magic);
+        return -1;
+    }
+    // The linker pads the LC_CODE_SIGNATURE region; the SuperBlob may be
+    // shorter than it but never longer.
+    if (length < 12 || length > size) {
+        snprintf(errbuf, errlen, "SuperBlob length %u exceeds %u", length, size);
+        return -1;
+    }
+    if (count > (length - 12) / 8) {
+        snprintf(errbuf, errlen, "SuperBlob index count %u too large", count);
+        return -1;
+    }
+
+    out->data = data;
+    out->size = length;
+    out->count = count;
+    out->blobs = calloc(count ? count : 1, sizeof(*out->blobs));
+    if (!out->blobs) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct cs_blob_ref *b = &out->blobs[i];
+        b->slot = load32_be(data + 12 + (size_t)i * 8);
+        b->offset = load32_be(data + 16 + (size_t)i * 8);
+        if (b->offset > length || length - b->offset < 8) {
+            snprintf(errbuf, errlen, "blob %u (slot 0x%x) out of bounds", i, b->slot);
+            cs_free(out);
+            return -1;
+        }
+        b->data = data + b->offset;
+        b->magic = load32_be(b->data);
+        b->length = load32_be(b->data + 4);
+        if (b->length < 8 || b->length > length - b->offset) {
+            snprintf(errbuf, errlen, "blob %u (slot 0x%x) length %u out of bounds",
+                     i, b->slot, b->length);
+            cs_free(out);
+            return -1;
+        }
+
+        if (b->slot == CSSLOT_CODEDIRECTORY ||
+            (b->slot >= CSSLOT_ALTERNATE_CODEDIRECTORIES &&
+             b->slot < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) {
+            if (b->magic != CSMAGIC_CODEDIRECTORY) {
+                snprintf(errbuf, errlen, "slot 0x%x is not a CodeDirectory", b->slot);
+                cs_free(out);
+                return -1;
+            }
+            if (out->ncds == CS_MAX_CODE_DIRECTORIES) continue;
+            if (parse_code_directory(b, &out->cds[out->ncds], errbuf, errlen) != 0) {
+                cs_free(out);
+                return -1;
+            }
+            out->ncds++;
+        } else if (b->slot == CSSLOT_REQUIREMENTS) {
+            out->requirements = b;
+        } else if (b->slot == CSSLOT_ENTITLEMENTS) {
+            out->entitlements = b;
+        } else if (b->slot == CSSLOT_DER_ENTITLEMENTS) {
+            out->der_entitlements = b;
+        } else if (b->slot == CSSLOT_SIGNATURESLOT) {
+            out->cms = b;
+        }
+    }
+
+    if (out->ncds == 0) {
+        snprintf(errbuf, errlen, "signature has no CodeDirectory");
+        cs_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+int cs_parse(const struct macho_image *img, struct cs_signature *out,
+             char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    uint32_t size = 0;
+    size_t iter = 0;
+    if (!macho_image_next_cmd(img, LC_CODE_SIGNATURE, &iter)) {
+        snprintf(errbuf, errlen, "no LC_CODE_SIGNATURE");
+        return 1;
+    }
+    const uint8_t *data = macho_image_linkedit(img, LC_CODE_SIGNATURE, &size);
+    if (!data) {
+        snprintf(errbuf, errlen, "LC_CODE_SIGNATURE out of bounds");
+        return -1;
+    }
+    return cs_parse_blob(data, size, out, errbuf, errlen);
+}
+
+void cs_free(struct cs_signature *sig) {
+    free(sig->blobs);
+    memset(sig, 0, sizeof(*sig));
+}
+
+// ---- verification ----
+
+struct page_job {
+    const uint8_t *buf;
+    uint64_t limit;
+    uint64_t page_size;
+    const uint8_t *slots;       // code slot 0
+    uint8_t hash_type;
+    uint8_t hash_size;
+    uint32_t *bad;              // per worker
+    uint32_t *first_bad;        // per worker, UINT32_MAX = none
+};
+
+static void page_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    struct page_job *job = ctx;
+    uint8_t h[DIGEST_MAX_LEN];
+    for (size_t i = begin; i < end; i++) {
+        uint64_t off = (uint64_t)i * job->page_size;
+        uint64_t n = job->limit - off;
+        if (n > job->page_size) n = job->page_size;
+        digest_cs(job->hash_type, job->buf + off, (size_t)n, h);
+        if (memcmp(h, job->slots + i * job->hash_size, job->hash_size) != 0) {
+            job->bad[worker]++;
+            if (i < job->first_bad[worker]) job->first_bad[worker] = (uint32_t)i;
+        }
+    }
+}
+
+int cs_verify(const struct macho_image *img, const struct cs_signature *sig,
+              const struct cs_code_directory *cd, unsigned nthreads,
+              struct cs_verify_result *res) {
+    memset(res, 0, sizeof(*res));
+    const uint8_t *slots = cd->blob + cd->hash_offset;
+
+    // Special slots: only the ones whose blob lives in this signature can be
+    // checked here (Info.plist and the resource directory are bundle files).
+    uint8_t h[DIGEST_MAX_LEN];
+    for (uint32_t k = 1; k <= cd->n_special; k++) {
+        const uint8_t *want = slots - (size_t)k * cd->hash_size;
+        const struct cs_blob_ref *b = cs_find_slot(sig, k);
+        if (!b) continue;
+        res->special_checked++;
+        digest_cs(cd->hash_type, b->data, b->length, h);
+        if (memcmp(h, want, cd->hash_size) != 0) res->special_bad++;
+    }
+
+    uint64_t limit = cd->code_limit;
+    uint64_t page_size = cd->page_shift ? (1ull << cd->page_shift) : (limit ? limit : 1);
+    uint64_t pages = limit ? (limit + page_size - 1) / page_size : 0;
+    res->pages = cd->n_code;
+    if (limit > img->size || pages != cd->n_code) {
+        // Slot table does not describe this file: count everything as bad.
+        res->pages_bad = cd->n_code ? cd->n_code : 1;
+        res->first_bad = 0;
+        return -1;
+    }
+
+    if (nthreads == 0) nthreads = par_default_threads();
+    uint32_t *bad = calloc(nthreads, sizeof(*bad));
+    uint32_t *first_bad = malloc(nthreads * sizeof(*first_bad));
+    if (!bad || !first_bad) {
+        free(bad);
+        free(first_bad);
+        return -1;
+    }
+    for (unsigned w = 0; w < nthreads; w++) first_bad[w] = UINT32_MAX;
+
+    struct page_job job = {
+        .buf = img->buf,
+        .limit = limit,
+        .page_size = page_size,
+        .slots = slots,
+        .hash_type = cd->hash_type,
+        .hash_size = cd->hash_size,
+        .bad = bad,
+        .first_bad = first_bad,
+    };
+    // 64 pages (256 KiB at 4K) per grab keeps the cursor cold.
+    par_for((size_t)pages, 64, nthreads, page_worker, &job);
+
+    res->first_bad = UINT32_MAX;
+    for (unsigned w = 0; w < nthreads; w++) {
+        res->pages_bad += bad[w];
+        if (first_bad[w] < res->first_bad) res->first_bad = first_bad[w];
+    }
+    if (res->pages_bad == 0) res->first_bad = 0;
+    free(bad);
+    free(first_bad);
+    return (res->pages_bad || res->special_bad) ? -1 : 0;
+}
+
+// ---- printing ----
+
+static void print_hex(const uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) printf("%02x", p[i]);
+}
+
+static void print_code_directory(const struct cs_code_directory *cd) {
+    printf("CodeDirectory slot=0x%x version=0x%x flags=0x%x hash=%s size=%u\n",
+           cd->slot, cd->version, cd->flags, cs_hash_type_name(cd->hash_type),
+           cd->hash_size);
+    printf("  ident=%s", cd->ident ? cd->ident : "(none)");
+    if (cd->team) printf(" team=%s", cd->team);
+    printf("\n");
+    printf("  cdhash=");
+    print_hex(cd->cdhash, CS_CDHASH_LEN);
+    printf("\n");
+    printf("  codeLimit=0x%llx pageSize=%llu codeSlots=%u specialSlots=%u platform=%u\n",
+           (unsigned long long)cd->code_limit,
+           cd->page_shift ? (unsigned long long)1 << cd->page_shift : 0ull,
+           cd->n_code, cd->n_special, cd->platform);
+    if (cd->scatter_offset) printf("  scatterOffset=0x%x\n", cd->scatter_offset);
+    if (cd->version >= CS_SUPPORTSEXECSEG) {
+        printf("  execSeg base=0x%llx limit=0x%llx flags=0x%llx%s\n",
+               (unsigned long long)cd->exec_seg_base,
+               (unsigned long long)cd->exec_seg_limit,
+               (unsigned long long)cd->exec_seg_flags,
+               (cd->exec_seg_flags & CS_EXECSEG_MAIN_BINARY) ? " (main binary)" : "");
+    }
+    if (cd->version >= CS_SUPPORTSRUNTIME) {
+        printf("  runtime=%u.%u.%u preEncryptOffset=0x%x\n",
+               cd->runtime >> 16, (cd->runtime >> 8) & 0xff, cd->runtime & 0xff,
+               cd->pre_encrypt_offset);
+    }
+    if (cd->version >= CS_SUPPORTSLINKAGE && cd->linkage_size) {
+        printf("  linkage hash=%s app=%u/%u offset=0x%x size=%u\n",
+               cs_hash_type_name(cd->linkage_hash_type), cd->linkage_app_type,
+               cd->linkage_app_subtype, cd->linkage_offset, cd->linkage_size);
+    }
+}
+
+void cs_print(const struct cs_signature *sig) {
+    printf("== Code signature ==\n");
+    printf("SuperBlob length=%u count=%u\n", sig->size, sig->count);
+    for (uint32_t i = 0; i < sig->count; i++) {
+        const struct cs_blob_ref *b = &sig->blobs[i];
+        printf("  [%u] slot=0x%05x %-24s magic=0x%08x offset=%u length=%u\n",
+               i, b->slot, slot_name(b->slot), b->magic, b->offset, b->length);
+    }
+    for (size_t i = 0; i < sig->ncds; i++) print_code_directory(&sig->cds[i]);
+
+    if (sig->requirements) cs_print_requirements(sig->requirements);
+    if (sig->entitlements) {
+        const struct cs_blob_ref *e = sig->entitlements;
+        printf("Entitlements (%u bytes):\n", e->length - 8);
+        fwrite(e->data + 8, 1, e->length - 8, stdout);
+        if (e->length > 8 && e->data[e->length - 1] != '\n') printf("\n");
+    }
+    if (sig->der_entitlements) {
+        printf("DER entitlements: %u bytes\n", sig->der_entitlements->length - 8);
+    }
+    if (sig->cms) {
+        printf("CMS signature: %u bytes%s\n", sig->cms->length - 8,
+               sig->cms->length <= 8 ? " (ad-hoc)" : "");
+    } else {
+        printf("CMS signature: none (ad-hoc)\n");
+    }
+}
+
+// ---- requirement language ----
+//
+// Requirements are compiled expressions in prefix form. This prints them back
+// in the `codesign -d -r-` syntax. Depth and cursor are bounded so a hostile
+// blob cannot recurse or read past its end.
+
+enum {
+    opFalse, opTrue, opIdent, opAppleAnchor, opAnchorHash, opInfoKey, opAnd,
+    opOr, opCDHash, opNot, opInfoKeyField, opCertField, opTrustedCert,
+    opTrustedCerts, opCertGeneric, opAppleGenericAnchor, opEntitlementField,
+    opCertPolicy, opNamedAnchor, opNamedCode, opPlatform, opNotarized,
+    opCertFieldDate, opLegacyDevID
+};
+
+enum {
+    matchExists, matchEqual, matchContains, matchBeginsWith, matchEndsWith,
+    matchLessThan, matchGreaterThan, matchLessEqual, matchGreaterEqual,
+    matchOn, matchBefore, matchAfter, matchOnOrBefore, matchOnOrAfter,
+    matchAbsent
+};
+
+#define REQ_OP_MASK   0x00FFFFFFu
+#define REQ_MAX_DEPTH 64
+
+struct req_cursor {
+    const uint8_t *p;
+    const uint8_t *end;
+    int bad;
+};
+
+static uint32_t req_u32(struct req_cursor *c) {
+    if (c->bad || c->end - c->p < 4) {
+        c->bad = 1;
+        return 0;
+    }
+    uint32_t v = load32_be(c->p);
+    c->p += 4;
+    return v;
+}
+
+// Length-prefixed data, padded to 4 bytes.
+static const uint8_t *req_data(struct req_cursor *c, uint32_t *len) {
+    *len = req_u32(c);
+    if (c->bad) return NULL;
+    size_t padded = ((size_t)*len + 3) & ~(size_t)3;
+    if ((size_t)(c->end - c->p) < padded) {
+        c->bad = 1;
+        return NULL;
+    }
+    const uint8_t *d = c->p;
+    c->p += padded;
+    return d;
+}
+
+static void req_print_string(struct req_cursor *c) {
+    uint32_t len = 0;
+    const uint8_t *d = req_data(c, &len);
+    if (!d) return;
+    printf("\"");
+    for (uint32_t i = 0; i < len; i++) {
+        if (d[i] == '"' || d[i] == '\\') printf("\\%c", d[i]);
+        else if (d[i] >= 0x20 && d[i] < 0x7f) printf("%c", d[i]);
+        else printf("\\x%02x", d[i]);
+    }
+    printf("\"");
+}
+
+static void req_print_hash(struct req_cursor *c) {
+    uint32_t len = 0;
+    const uint8_t *d = req_data(c, &len);
+    if (!d) return;
+    printf("H\"");
+    print_hex(d, len);
+    printf("\"");
+}
+
+// DER-encoded OID body in dotted form.
+static void req_print_oid(struct req_cursor *c) {
+    uint32_t len = 0;
+    const uint8_t *d = req_data(c, &len);
+    if (!d || len == 0) return;
+    printf("%u.%u", d[0] / 40, d[0] % 40);
+    uint64_t v = 0;
+    for (uint32_t i = 1; i < len; i++) {
+        v = (v << 7) | (d[i] & 0x7f);
+        if (!(d[i] & 0x80)) {
+            printf(".%llu", (unsigned long long)v);
+            v = 0;
+        }
+    }
+}
+
+static void req_print_slot(struct req_cursor *c) {
+    int32_t slot = (int32_t)req_u32(c);
+    if (slot == 0) printf("leaf");
+    else if (slot == -1) printf("root");
+    else printf("%d", slot);
+}
+
+static void req_print_match(struct req_cursor *c) {
+    uint32_t m = req_u32(c);
+    switch (m) {
+    case matchExists:       printf(" /* exists */"); break;
+    case matchAbsent:       printf(" absent"); break;
+    case matchEqual:        printf(" = "); req_print_string(c); break;
+    case matchContains:     printf(" ~ "); req_print_string(c); break;
+    case matchBeginsWith:   printf(" = "); req_print_string(c); printf("*"); break;
+    case matchEndsWith:     printf(" = *"); req_print_string(c); break;
+    case matchLessThan:     printf(" < "); req_print_string(c); break;
+    case matchGreaterThan:  printf(" > "); req_print_string(c); break;
+    case matchLessEqual:    printf(" <= "); req_print_string(c); break;
+    case matchGreaterEqual: printf(" >= "); req_print_string(c); break;
+    case matchOn:           printf(" = timestamp "); req_print_string(c); break;
+    case matchBefore:       printf(" < timestamp "); req_print_string(c); break;
+    case matchAfter:        printf(" > timestamp "); req_print_string(c); break;
+    case matchOnOrBefore:   printf(" <= timestamp "); req_print_string(c); break;
+    case matchOnOrAfter:    printf(" >= timestamp "); req_print_string(c); break;
+    default:
+        printf(" /* match %u */", m);
+        c->bad = 1;
+        break;
+    }
+}
+
+static void req_print_expr(struct req_cursor *c, int depth, uint32_t parent);
+
+// Operand of and/or: parenthesise mixed and/or nesting.
+static void req_print_operand(struct req_cursor *c, int depth, uint32_t parent) {
+    uint32_t next = (c->end - c->p >= 4) ? (load32_be(c->p) & REQ_OP_MASK) : 0;
+    int paren = (next == opAnd || next == opOr) && next != parent;
+    if (paren) printf("(");
+    req_print_expr(c, depth + 1, parent);
+    if (paren) printf(")");
+}
+
+static void req_print_expr(struct req_cursor *c, int depth, uint32_t parent) {
+    (void)parent;
+    if (depth > REQ_MAX_DEPTH) {
+        c->bad = 1;
+        return;
+    }
+    uint32_t op = req_u32(c) & REQ_OP_MASK;
+    if (c->bad) return;
+
+    switch (op) {
+    case opFalse:             printf("never"); break;
+    case opTrue:              printf("always"); break;
+    case opAppleAnchor:       printf("anchor apple"); break;
+    case opAppleGenericAnchor: printf("anchor apple generic"); break;
+    case opTrustedCerts:      printf("anchor trusted"); break;
+    case opNotarized:         printf("notarized"); break;
+    case opLegacyDevID:       printf("legacy"); break;
+    case opIdent:
+        printf("identifier ");
+        req_print_string(c);
+        break;
+    case opCDHash:
+        printf("cdhash ");
+        req_print_hash(c);
+        break;
+    case opAnchorHash:
+        printf("certificate ");
+        req_print_slot(c);
+        printf(" = ");
+        req_print_hash(c);
+        break;
+    case opInfoKey:
+        printf("info[");
+        req_print_string(c);
+        printf("] = ");
+        req_print_string(c);
+        break;
+    case opInfoKeyField:
+        printf("info[");
+        req_print_string(c);
+        printf("]");
+        req_print_match(c);
+        break;
+    case opEntitlementField:
+        printf("entitlement[");
+        req_print_string(c);
+        printf("]");
+        req_print_match(c);
+        break;
+    case opCertField:
+        printf("certificate ");
+        req_print_slot(c);
+        printf("[");
+        {
+            uint32_t len = 0;
+            const uint8_t *d = req_data(c, &len);
+            if (d) fwrite(d, 1, len, stdout);
+        }
+        printf("]");
+        req_print_match(c);
+        break;
+    case opCertGeneric:
+    case opCertPolicy:
+    case opCertFieldDate:
+        printf("certificate ");
+        req_print_slot(c);
+        printf(op == opCertGeneric ? "[field." : op == opCertPolicy ? "[policy." : "[timestamp.");
+        req_print_oid(c);
+        printf("]");
+        req_print_match(c);
+        break;
+    case opTrustedCert:
+        printf("certificate ");
+        req_print_slot(c);
+        printf(" trusted");
+        break;
+    case opNamedAnchor:
+        printf("anchor apple ");
+        {
+            uint32_t len = 0;
+            const uint8_t *d = req_data(c, &len);
+            if (d) fwrite(d, 1, len, stdout);
+        }
+        break;
+    case opNamedCode:
+        printf("(");
+        {
+            uint32_t len = 0;
+            const uint8_t *d = req_data(c, &len);
+            if (d) fwrite(d, 1, len, stdout);
+        }
+        printf(")");
+        break;
+    case opPlatform:
+        printf("platform = %u", req_u32(c));
+        break;
+    case opNot:
+        printf("! ");
+        req_print_operand(c, depth, opNot);
+        break;
+    case opAnd:
+    case opOr:
+        req_print_operand(c, depth, op);
+        printf(op == opAnd ? " and " : " or ");
+        req_print_operand(c, depth, op);
+        break;
+    default:
+        printf("/* unknown opcode %u */", op);
+        c->bad = 1;
+        break;
+    }
+}
+
+static const char *req_type_name(uint32_t type) {
+    switch (type) {
+    case 1:  return "host";
+    case 2:  return "guest";
+    case 3:  return "designated";
+    case 4:  return "library";
+    case 5:  return "plugin";
+    default: return "requirement";
+    }
+}
+
+void cs_print_requirements(const struct cs_blob_ref *blob) {
+    const uint8_t *p = blob->data;
+    uint32_t len = blob->length;
+    if (blob->magic != CSMAGIC_REQUIREMENTS || len < 12) {
+        printf("Requirements: unexpected magic 0x%08x\n", blob->magic);
+        return;
+    }
+    uint32_t count = load32_be(p + 8);
+    if (count > (len - 12) / 8) {
+        printf("Requirements: count %u out of bounds\n", count);
+        return;
+    }
+    printf("Requirements (%u):\n", count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t type = load32_be(p + 12 + (size_t)i * 8);
+        uint32_t off = load32_be(p + 16 + (size_t)i * 8);
+        if (off > len || len - off < 12) {
+            printf("  %s => /* out of bounds */\n", req_type_name(type));
+            continue;
+        }
+        const uint8_t *r = p + off;
+        uint32_t rmagic = load32_be(r);
+        uint32_t rlen = load32_be(r + 4);
+        uint32_t kind = load32_be(r + 8);
+        if (rmagic != CSMAGIC_REQUIREMENT || rlen < 12 || rlen > len - off || kind != 1) {
+            printf("  %s => /* unsupported requirement blob */\n", req_type_name(type));
+            continue;
+        }
+        struct req_cursor c = { r + 12, r + rlen, 0 };
+        printf("  %s => ", req_type_name(type));
+        req_print_expr(&c, 0, opAnd);
+        printf("%s\n", c.bad ? " /* malformed */" : "");
+    }
+}
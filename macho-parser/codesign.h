@@ -0,0 +1,106 @@
+#ifndef MACHO_CODESIGN_H
+#define MACHO_CODESIGN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// LC_CODE_SIGNATURE parsing and page-hash verification.
+//
+// The signature is a big-endian SuperBlob: an index of (slot, offset) pairs
+// pointing at a CodeDirectory (plus up to five alternates with other hash
+// types), a requirements vector, XML and DER entitlements and a CMS blob.
+// A CodeDirectory holds one hash per page of the slice up to codeLimit
+// ("code slots") and, at negative indices, hashes of the other blobs
+// ("special slots"). Verification recomputes both.
+
+#define CS_MAX_CODE_DIRECTORIES 6
+
+struct cs_blob_ref {
+    uint32_t slot;
+    uint32_t magic;
+    uint32_t offset;        // from the start of the SuperBlob
+    uint32_t length;
+    const uint8_t *data;    // blob header included
+};
+
+struct cs_code_directory {
+    const uint8_t *blob;
+    uint32_t length;
+    uint32_t slot;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t hash_offset;
+    uint32_t ident_offset;
+    uint32_t n_special;
+    uint32_t n_code;
+    uint64_t code_limit;
+    uint8_t hash_size;
+    uint8_t hash_type;
+    uint8_t platform;
+    uint8_t page_shift;     // 0 = one page covers everything
+    uint32_t scatter_offset;
+    uint32_t team_offset;
+    uint64_t exec_seg_base;
+    uint64_t exec_seg_limit;
+    uint64_t exec_seg_flags;
+    uint32_t runtime;
+    uint32_t pre_encrypt_offset;
+    uint8_t linkage_hash_type;
+    uint8_t linkage_app_type;
+    uint16_t linkage_app_subtype;
+    uint32_t linkage_offset;
+    uint32_t linkage_size;
+    const char *ident;      // NULL if absent or unterminated
+    const char *team;
+    uint8_t cdhash[20];
+};
+
+struct cs_signature {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t count;
+    struct cs_blob_ref *blobs;
+    struct cs_code_directory cds[CS_MAX_CODE_DIRECTORIES];
+    size_t ncds;
+    const struct cs_blob_ref *requirements;
+    const struct cs_blob_ref *entitlements;      // XML plist
+    const struct cs_blob_ref *der_entitlements;
+    const struct cs_blob_ref *cms;
+};
+
+struct cs_verify_result {
+    uint32_t pages;
+    uint32_t pages_bad;
+    uint32_t first_bad;         // valid when pages_bad > 0
+    uint32_t special_checked;
+    uint32_t special_bad;
+};
+
+// Returns 0 on success, 1 when the image has no LC_CODE_SIGNATURE, -1 on
+// malformed data.
+int cs_parse(const struct macho_image *img, struct cs_signature *out,
+             char *errbuf, size_t errlen);
+void cs_free(struct cs_signature *sig);
+
+// Parse a SuperBlob that is not attached to an image (used by the signer to
+// re-read what it produced). Same return convention as cs_parse.
+int cs_parse_blob(const uint8_t *data, uint32_t size, struct cs_signature *out,
+                  char *errbuf, size_t errlen);
+
+// Blob stored under `slot`, or NULL.
+const struct cs_blob_ref *cs_find_slot(const struct cs_signature *sig, uint32_t slot);
+
+// Recompute every code-slot hash over img->buf in parallel and every
+// in-signature special slot. Returns 0 if everything matched.
+int cs_verify(const struct macho_image *img, const struct cs_signature *sig,
+              const struct cs_code_directory *cd, unsigned nthreads,
+              struct cs_verify_result *res);
+
+const char *cs_hash_type_name(uint8_t type);
+
+void cs_print(const struct cs_signature *sig);
+void cs_print_requirements(const struct cs_blob_ref *blob);
+
+#endif /* MACHO_CODESIGN_H */
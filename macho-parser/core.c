@@ -0,0 +1,436 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "core.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../include/macho/loader.h"
+#include "../include/mach/machine.h"
+
+#include "macho_common.h"
+
+static int cmp_region(const void *a, const void *b) {
+    const struct core_region *x = a;
+    const struct core_region *y = b;
+    if (x->vmaddr != y->vmaddr) return x->vmaddr < y->vmaddr ? -1 : 1;
+    return 0;
+}
+
+static int build_regions(struct core_file *c, char *errbuf, size_t errlen) {
+    const struct macho_image *img = &c->img;
+    c->regions = calloc(img->nsegs ? img->nsegs : 1, sizeof(*c->regions));
+    if (!c->regions) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *m = &img->segs[i];
+        if (m->vmsize == 0) continue;
+        if (m->vmaddr > UINT64_MAX - m->vmsize) {
+            snprintf(errbuf, errlen, "region %zu wraps the address space", i);
+            return -1;
+        }
+        struct core_region *r = &c->regions[k++];
+        r->vmaddr = m->vmaddr;
+        r->vmsize = m->vmsize;
+        r->fileoff = m->fileoff;
+        r->filesize = m->filesize < m->vmsize ? m->filesize : m->vmsize;
+        r->prot = m->initprot;
+        r->segment = (uint32_t)i;
+        // A core cut short by a full disk still has every load command;
+        // keep what made it to the file.
+        if (r->fileoff >= img->size) {
+            if (r->filesize) c->truncated++;
+            r->filesize = 0;
+        } else if (r->filesize > img->size - r->fileoff) {
+            r->filesize = img->size - r->fileoff;
+            c->truncated++;
+        }
+        c->dumped_bytes += r->filesize;
+    }
+    c->nregions = k;
+    qsort(c->regions, k, sizeof(*c->regions), cmp_region);
+    for (size_t i = 1; i < k; i++) {
+        const struct core_region *a = &c->regions[i - 1];
+        if (c->regions[i].vmaddr < a->vmaddr + a->vmsize) {
+            snprintf(errbuf, errlen, "regions overlap at 0x%llx",
+                     (unsigned long long)c->regions[i].vmaddr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#define LD64(p, type, field) load64_u((p) + offsetof(type, field), sw)
+#define LD32(p, type, field) load32_u((p) + offsetof(type, field), sw)
+#define LD16(p, type, field) load16_u((p) + offsetof(type, field), sw)
+
+// One flavor of one LC_THREAD. `p` holds `count` words.
+static void decode_state(struct core_thread *t, uint32_t cputype, int sw, uint32_t flavor,
+                         uint32_t count, const uint8_t *p, int depth) {
+    if (cputype == (uint32_t)CPU_TYPE_ARM64) {
+        struct core_arm64_state *a = &t->u.arm64;
+        if (flavor == ARM_THREAD_STATE64 && count >= ARM_THREAD_STATE64_COUNT) {
+            for (int i = 0; i < 29; i++) a->x[i] = load64_u(p + 8 * i, sw);
+            a->fp = LD64(p, struct arm_thread_state64, fp);
+            a->lr = LD64(p, struct arm_thread_state64, lr);
+            a->sp = LD64(p, struct arm_thread_state64, sp);
+            a->pc = LD64(p, struct arm_thread_state64, pc);
+            a->cpsr = LD32(p, struct arm_thread_state64, cpsr);
+            t->pc = a->pc;
+            t->sp = a->sp;
+            t->fp = a->fp;
+            t->has_gpr = 1;
+            return;
+        }
+        // The 8 bytes of alignment padding at the end are optional.
+        if (flavor == ARM_NEON_STATE64 && count >= ARM_NEON_STATE64_COUNT - 2) {
+            memcpy(a->v, p, sizeof(a->v));
+            if (sw) {
+                for (int i = 0; i < 32; i++) {
+                    for (int j = 0; j < 8; j++) {
+                        uint8_t tmp = a->v[i][j];
+                        a->v[i][j] = a->v[i][15 - j];
+                        a->v[i][15 - j] = tmp;
+                    }
+                }
+            }
+            a->fpsr = LD32(p, struct arm_neon_state64, fpsr);
+            a->fpcr = LD32(p, struct arm_neon_state64, fpcr);
+            t->has_fpu = 1;
+            return;
+        }
+        if (flavor == ARM_EXCEPTION_STATE64 && count >= ARM_EXCEPTION_STATE64_COUNT) {
+            a->far = LD64(p, struct arm_exception_state64, far);
+            a->esr = LD32(p, struct arm_exception_state64, esr);
+            a->exception = LD32(p, struct arm_exception_state64, exception);
+            t->has_exc = 1;
+            return;
+        }
+        if (flavor == ARM_THREAD_STATE && count >= 2 && depth == 0) {
+            uint32_t inner = load32_u(p, sw);
+            uint32_t icount = load32_u(p + 4, sw);
+            if (icount <= count - 2) {
+                decode_state(t, cputype, sw, inner, icount, p + 8, 1);
+                return;
+            }
+        }
+    } else if (cputype == (uint32_t)CPU_TYPE_X86_64) {
+        struct core_x86_64_state *x = &t->u.x86_64;
+        if (flavor == x86_THREAD_STATE64 && count >= x86_THREAD_STATE64_COUNT) {
+            for (int i = 0; i < 21; i++) x->gpr[i] = load64_u(p + 8 * i, sw);
+            t->pc = LD64(p, struct x86_thread_state64, rip);
+            t->sp = LD64(p, struct x86_thread_state64, rsp);
+            t->fp = LD64(p, struct x86_thread_state64, rbp);
+            t->has_gpr = 1;
+            return;
+        }
+        if (flavor == x86_FLOAT_STATE64 && count >= x86_FLOAT_STATE64_COUNT) {
+            x->fcw = LD16(p, struct x86_float_state64, fcw);
+            x->fsw = LD16(p, struct x86_float_state64, fsw);
+            x->mxcsr = LD32(p, struct x86_float_state64, mxcsr);
+            memcpy(x->stmm, p + offsetof(struct x86_float_state64, stmm), sizeof(x->stmm));
+            memcpy(x->xmm, p + offsetof(struct x86_float_state64, xmm), sizeof(x->xmm));
+            t->has_fpu = 1;
+            return;
+        }
+        if (flavor == x86_EXCEPTION_STATE64 && count >= x86_EXCEPTION_STATE64_COUNT) {
+            x->trapno = LD16(p, struct x86_exception_state64, trapno);
+            x->cpu = LD16(p, struct x86_exception_state64, cpu);
+            x->err = LD32(p, struct x86_exception_state64, err);
+            x->faultvaddr = LD64(p, struct x86_exception_state64, faultvaddr);
+            t->has_exc = 1;
+            return;
+        }
+        if ((flavor == x86_THREAD_STATE || flavor == x86_FLOAT_STATE ||
+             flavor == x86_EXCEPTION_STATE) && count >= 2 && depth == 0) {
+            uint32_t inner = load32_u(p, sw);
+            uint32_t icount = load32_u(p + 4, sw);
+            if (icount <= count - 2) {
+                decode_state(t, cputype, sw, inner, icount, p + 8, 1);
+                return;
+            }
+        }
+    }
+    t->nother++;
+}
+
+static int load_threads(struct core_file *c, char *errbuf, size_t errlen) {
+    const struct macho_image *img = &c->img;
+    size_t n = 0;
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        if (img->cmds[i].cmd == LC_THREAD || img->cmds[i].cmd == LC_UNIXTHREAD) n++;
+    }
+    c->threads = calloc(n ? n : 1, sizeof(*c->threads));
+    if (!c->threads) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        if (lc->cmd != LC_THREAD && lc->cmd != LC_UNIXTHREAD) continue;
+        struct core_thread *t = &c->threads[c->nthreads++];
+        t->cmd_index = (uint32_t)i;
+        if (lc->cmdsize < sizeof(struct thread_command)) continue;
+        const uint8_t *p = img->buf + lc->offset + sizeof(struct thread_command);
+        const uint8_t *end = img->buf + lc->offset + lc->cmdsize;
+        while (end - p >= 8) {
+            uint32_t flavor = load32_u(p, img->swapped);
+            uint32_t count = load32_u(p + 4, img->swapped);
+            p += 8;
+            if ((uint64_t)count * 4 > (uint64_t)(end - p)) {
+                snprintf(errbuf, errlen, "thread %zu: flavor %u overruns LC_THREAD",
+                         c->nthreads - 1, flavor);
+                return -1;
+            }
+            decode_state(t, img->cputype, img->swapped, flavor, count, p, 0);
+            p += (size_t)count * 4;
+        }
+    }
+    return 0;
+}
+
+static int load(struct core_file *c, const uint8_t *buf, size_t size,
+                char *errbuf, size_t errlen) {
+    if (macho_image_load(&c->img, buf, size, errbuf, errlen) != 0) {
+        core_close(c);
+        return -1;
+    }
+    if (c->img.filetype != MH_CORE) {
+        snprintf(errbuf, errlen, "not an MH_CORE (filetype 0x%x)", c->img.filetype);
+        core_close(c);
+        return -1;
+    }
+    if (build_regions(c, errbuf, errlen) != 0 || load_threads(c, errbuf, errlen) != 0) {
+        core_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+int core_load(struct core_file *c, const uint8_t *buf, size_t size,
+              char *errbuf, size_t errlen) {
+    memset(c, 0, sizeof(*c));
+    return load(c, buf, size, errbuf, errlen);
+}
+
+int core_open(struct core_file *c, const char *path, char *errbuf, size_t errlen) {
+    memset(c, 0, sizeof(*c));
+    if (map_file(path, &c->mf, errbuf, errlen) != 0) return -1;
+    if (c->mf.size) {
+        posix_madvise((void *)c->mf.data, c->mf.size, POSIX_MADV_RANDOM);
+    }
+    return load(c, c->mf.data, c->mf.size, errbuf, errlen);
+}
+
+void core_close(struct core_file *c) {
+    macho_image_free(&c->img);
+    free(c->regions);
+    free(c->threads);
+    unmap_file(&c->mf);
+    memset(c, 0, sizeof(*c));
+}
+
+const struct core_region *core_region_for(const struct core_file *c, uint64_t vmaddr) {
+    size_t lo = 0;
+    size_t hi = c->nregions;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (c->regions[mid].vmaddr <= vmaddr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    const struct core_region *r = &c->regions[lo - 1];
+    return vmaddr - r->vmaddr < r->vmsize ? r : NULL;
+}
+
+size_t core_read(const struct core_file *c, uint64_t vmaddr, void *dst, size_t len) {
+    uint8_t *out = dst;
+    size_t done = 0;
+    const struct core_region *r = core_region_for(c, vmaddr);
+    while (done < len && r) {
+        uint64_t off = vmaddr - r->vmaddr;
+        if (off >= r->filesize) break;
+        uint64_t take = r->filesize - off;
+        if (take > len - done) take = len - done;
+        memcpy(out + done, c->img.buf + r->fileoff + off, (size_t)take);
+        done += (size_t)take;
+        vmaddr += take;
+        // Only an adjacent region can continue the range.
+        if (++r == c->regions + c->nregions || r->vmaddr != vmaddr) break;
+    }
+    return done;
+}
+
+const uint8_t *core_ptr(const struct core_file *c, uint64_t vmaddr, uint64_t len) {
+    const struct core_region *r = core_region_for(c, vmaddr);
+    if (!r) return NULL;
+    uint64_t off = vmaddr - r->vmaddr;
+    if (off > r->filesize || len > r->filesize - off) return NULL;
+    return c->img.buf + r->fileoff + off;
+}
+
+int core_read_u64(const struct core_file *c, uint64_t vmaddr, uint64_t *out) {
+    uint8_t b[8];
+    if (core_read(c, vmaddr, b, sizeof(b)) != sizeof(b)) return -1;
+    *out = load64_u(b, c->img.swapped);
+    return 0;
+}
+
+static uint64_t strip_pac(uint32_t cputype, uint64_t v) {
+    // User addresses have bit 55 clear; PAC signatures sit above the
+    // 47-bit VA there.
+    if (cputype == (uint32_t)CPU_TYPE_ARM64 && !(v & (1ULL << 55))) {
+        v &= 0x00007fffffffffffULL;
+    }
+    return v;
+}
+
+size_t core_backtrace(const struct core_file *c, const struct core_thread *t,
+                      uint64_t *pcs, size_t max) {
+    size_t n = 0;
+    if (!t->has_gpr || max == 0) return 0;
+    pcs[n++] = strip_pac(c->img.cputype, t->pc);
+    // Both ABIs keep { saved fp, return address } at fp.
+    uint64_t fp = strip_pac(c->img.cputype, t->fp);
+    while (n < max && fp && (fp & 7) == 0) {
+        uint64_t prev, ret;
+        if (core_read_u64(c, fp, &prev) != 0 || core_read_u64(c, fp + 8, &ret) != 0) break;
+        ret = strip_pac(c->img.cputype, ret);
+        if (ret == 0) break;
+        pcs[n++] = ret;
+        prev = strip_pac(c->img.cputype, prev);
+        if (prev <= fp) break;
+        fp = prev;
+    }
+    return n;
+}
+
+const char *core_flavor_name(uint32_t cputype, uint32_t flavor) {
+    if (cputype == (uint32_t)CPU_TYPE_ARM64 || cputype == (uint32_t)CPU_TYPE_ARM) {
+        switch (flavor) {
+            case ARM_THREAD_STATE: return "ARM_THREAD_STATE";
+            case ARM_EXCEPTION_STATE: return "ARM_EXCEPTION_STATE";
+            case ARM_DEBUG_STATE: return "ARM_DEBUG_STATE";
+            case ARM_THREAD_STATE64: return "ARM_THREAD_STATE64";
+            case ARM_EXCEPTION_STATE64: return "ARM_EXCEPTION_STATE64";
+            case ARM_THREAD_STATE32: return "ARM_THREAD_STATE32";
+            case ARM_DEBUG_STATE64: return "ARM_DEBUG_STATE64";
+            case ARM_NEON_STATE64: return "ARM_NEON_STATE64";
+            default: return NULL;
+        }
+    }
+    if (cputype == (uint32_t)CPU_TYPE_X86_64 || cputype == (uint32_t)CPU_TYPE_X86) {
+        switch (flavor) {
+            case x86_THREAD_STATE64: return "x86_THREAD_STATE64";
+            case x86_FLOAT_STATE64: return "x86_FLOAT_STATE64";
+            case x86_EXCEPTION_STATE64: return "x86_EXCEPTION_STATE64";
+            case x86_THREAD_STATE: return "x86_THREAD_STATE";
+            case x86_FLOAT_STATE: return "x86_FLOAT_STATE";
+            case x86_EXCEPTION_STATE: return "x86_EXCEPTION_STATE";
+            case x86_DEBUG_STATE64: return "x86_DEBUG_STATE64";
+            default: return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void print_vec(const char *prefix, int i, const uint8_t v[16]) {
+    printf("  %s%-2d 0x", prefix, i);
+    for (int j = 15; j >= 0; j--) printf("%02x", v[j]);
+}
+
+static void print_arm64(const struct core_thread *t) {
+    const struct core_arm64_state *a = &t->u.arm64;
+    if (t->has_gpr) {
+        for (int i = 0; i < 29; i++) {
+            printf("  x%-2d 0x%016llx%s", i, (unsigned long long)a->x[i], i % 4 == 3 ? "\n" : "");
+        }
+        printf("\n  fp  0x%016llx  lr  0x%016llx  sp  0x%016llx  pc  0x%016llx\n",
+               (unsigned long long)a->fp, (unsigned long long)a->lr,
+               (unsigned long long)a->sp, (unsigned long long)a->pc);
+        printf("  cpsr 0x%08x\n", a->cpsr);
+    }
+    if (t->has_fpu) {
+        for (int i = 0; i < 32; i++) {
+            print_vec("q", i, a->v[i]);
+            if (i % 2) printf("\n");
+        }
+        printf("  fpsr 0x%08x  fpcr 0x%08x\n", a->fpsr, a->fpcr);
+    }
+    if (t->has_exc) {
+        printf("  exception: far=0x%llx esr=0x%08x exception=0x%x\n",
+               (unsigned long long)a->far, a->esr, a->exception);
+    }
+}
+
+static void print_x86_64(const struct core_thread *t) {
+    static const char *const names[21] = {
+        "rax", "rbx", "rcx", "rdx", "rdi", "rsi", "rbp", "rsp", "r8", "r9", "r10",
+        "r11", "r12", "r13", "r14", "r15", "rip", "rflags", "cs", "fs", "gs",
+    };
+    const struct core_x86_64_state *x = &t->u.x86_64;
+    if (t->has_gpr) {
+        for (int i = 0; i < 21; i++) {
+            printf("  %-6s 0x%016llx%s", names[i], (unsigned long long)x->gpr[i],
+                   i % 4 == 3 || i == 20 ? "\n" : "");
+        }
+    }
+    if (t->has_fpu) {
+        for (int i = 0; i < 16; i++) {
+            print_vec("xmm", i, x->xmm[i]);
+            if (i % 2) printf("\n");
+        }
+        for (int i = 0; i < 8; i++) {
+            print_vec("st", i, x->stmm[i]);
+            if (i % 2) printf("\n");
+        }
+        printf("  fcw 0x%04x  fsw 0x%04x  mxcsr 0x%08x\n", x->fcw, x->fsw, x->mxcsr);
+    }
+    if (t->has_exc) {
+        printf("  exception: trapno=%u cpu=%u err=0x%x faultvaddr=0x%llx\n",
+               x->trapno, x->cpu, x->err, (unsigned long long)x->faultvaddr);
+    }
+}
+
+void core_print(const struct core_file *c, int list_only) {
+    uint64_t mapped = 0;
+    for (size_t i = 0; i < c->nregions; i++) mapped += c->regions[i].vmsize;
+    printf("== Core: %zu regions, %zu threads ==\n", c->nregions, c->nthreads);
+    printf("memory: %llu bytes mapped, %llu dumped", (unsigned long long)mapped,
+           (unsigned long long)c->dumped_bytes);
+    if (c->truncated) printf(", %zu regions truncated", c->truncated);
+    printf("\n");
+    if (!list_only) {
+        for (size_t i = 0; i < c->nregions; i++) {
+            const struct core_region *r = &c->regions[i];
+            printf("  0x%016llx-0x%016llx %c%c%c fileoff=0x%llx dumped=0x%llx\n",
+                   (unsigned long long)r->vmaddr, (unsigned long long)(r->vmaddr + r->vmsize),
+                   (r->prot & 1) ? 'r' : '-', (r->prot & 2) ? 'w' : '-',
+                   (r->prot & 4) ? 'x' : '-', (unsigned long long)r->fileoff,
+                   (unsigned long long)r->filesize);
+        }
+    }
+    for (size_t i = 0; i < c->nthreads; i++) {
+        const struct core_thread *t = &c->threads[i];
+        printf("thread %zu (load command %u): pc=0x%llx sp=0x%llx fp=0x%llx", i, t->cmd_index,
+               (unsigned long long)t->pc, (unsigned long long)t->sp,
+               (unsigned long long)t->fp);
+        if (t->nother) printf(" (+%u other flavors)", t->nother);
+        printf("\n");
+        if (c->img.cputype == (uint32_t)CPU_TYPE_ARM64) print_arm64(t);
+        else if (c->img.cputype == (uint32_t)CPU_TYPE_X86_64) print_x86_64(t);
+        uint64_t pcs[64];
+        size_t n = core_backtrace(c, t, pcs, sizeof(pcs) / sizeof(pcs[0]));
+        for (size_t k = 0; k < n; k++) {
+            const struct core_region *r = core_region_for(c, pcs[k]);
+            printf("  #%-2zu 0x%016llx%s\n", k, (unsigned long long)pcs[k],
+                   r ? "" : "  (unmapped)");
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef MACHO_CORE_H
+#define MACHO_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "corpus.h"
+#include "macho_image.h"
+
+// MH_CORE files: process and kernel core dumps.
+//
+// A core is one LC_SEGMENT_64 per dumped memory region (thousands of them,
+// each carrying its own fileoff) plus one LC_THREAD per thread. The regions
+// are gathered into an index sorted by vmaddr so a VM read is a binary
+// search, not a walk over load commands. Nothing is copied: reads go
+// straight to the mapped file, so a debugger walking a few stacks in a
+// multi-GB core only faults in the pages it touches.
+//
+// Every thread state flavor arm64 and x86_64 cores carry is decoded:
+// general registers, NEON / SSE registers and exception state. The
+// unified ARM_THREAD_STATE / x86_*_STATE flavors are unwrapped.
+
+struct core_region {
+    uint64_t vmaddr;
+    uint64_t vmsize;
+    uint64_t fileoff;
+    uint64_t filesize;     // may be < vmsize: the rest was not dumped
+    uint32_t prot;         // initprot
+    uint32_t segment;      // index into core_file.img.segs
+};
+
+struct core_arm64_state {
+    uint64_t x[29];
+    uint64_t fp, lr, sp, pc;
+    uint32_t cpsr;
+    uint8_t v[32][16];     // q0-q31, little-endian
+    uint32_t fpsr, fpcr;
+    uint64_t far;
+    uint32_t esr, exception;
+};
+
+struct core_x86_64_state {
+    uint64_t gpr[21];      // rax rbx rcx rdx rdi rsi rbp rsp r8-r15 rip rflags cs fs gs
+    uint8_t xmm[16][16];
+    uint8_t stmm[8][16];
+    uint16_t fcw, fsw;
+    uint32_t mxcsr;
+    uint16_t trapno, cpu;
+    uint32_t err;
+    uint64_t faultvaddr;
+};
+
+struct core_thread {
+    uint32_t cmd_index;    // load command index
+    int has_gpr;
+    int has_fpu;
+    int has_exc;
+    uint32_t nother;       // flavors recognised by neither decoder
+    uint64_t pc, sp, fp;   // convenience copies for the walker
+    union {
+        struct core_arm64_state arm64;
+        struct core_x86_64_state x86_64;
+    } u;
+};
+
+struct core_file {
+    struct mapped_file mf;     // owned when opened with core_open
+    struct macho_image img;
+    struct core_region *regions;   // sorted by vmaddr, non-overlapping
+    size_t nregions;
+    size_t truncated;              // regions whose file data runs past EOF (clipped)
+    uint64_t dumped_bytes;         // sum of filesize
+    struct core_thread *threads;
+    size_t nthreads;
+};
+
+// Parse a core already in memory. buf must outlive the core. Returns 0, or
+// -1 with a reason in errbuf (not MH_CORE, overlapping regions, ...).
+int core_load(struct core_file *c, const uint8_t *buf, size_t size,
+              char *errbuf, size_t errlen);
+
+// Map `path` read-only and parse it. Tells the kernel reads will be random
+// so it does not read ahead around every stack page touched.
+int core_open(struct core_file *c, const char *path, char *errbuf, size_t errlen);
+void core_close(struct core_file *c);
+
+// Region containing vmaddr (file-backed or not), or NULL. O(log n).
+const struct core_region *core_region_for(const struct core_file *c, uint64_t vmaddr);
+
+// Copy [vmaddr, vmaddr + len) into dst, crossing adjacent regions. Returns
+// the number of bytes copied; short when the range reaches memory that is
+// unmapped or was not dumped.
+size_t core_read(const struct core_file *c, uint64_t vmaddr, void *dst, size_t len);
+
+// Zero-copy view when the range lies in one region's dumped bytes, else NULL.
+const uint8_t *core_ptr(const struct core_file *c, uint64_t vmaddr, uint64_t len);
+
+// Pointer-sized read in the core's byte order. Returns 0 on success.
+int core_read_u64(const struct core_file *c, uint64_t vmaddr, uint64_t *out);
+
+// Frame-pointer walk from the thread's pc/fp: pcs[0] is the pc, then each
+// saved return address (arm64 PAC bits stripped from user addresses).
+// Stops at max, a null or non-increasing fp, or unreadable memory.
+size_t core_backtrace(const struct core_file *c, const struct core_thread *t,
+                      uint64_t *pcs, size_t max);
+
+// "ARM_THREAD_STATE64", "x86_FLOAT_STATE64", ... or NULL if unknown.
+const char *core_flavor_name(uint32_t cputype, uint32_t flavor);
+
+// Regions, then each thread's registers and backtrace.
+void core_print(const struct core_file *c, int list_only);
+
+#endif /* MACHO_CORE_H */
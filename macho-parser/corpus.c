@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "corpus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int map_file(const char *path, struct mapped_file *mf, char *errbuf, size_t errlen) {
+    mf->data = NULL;
+    mf->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        snprintf(errbuf, errlen, "%s: not a regular file", path);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        snprintf(errbuf, errlen, "%s: mmap: %s", path, strerror(errno));
+        return -1;
+    }
+    mf->data = p;
+    mf->size = (size_t)st.st_size;
+    return 0;
+}
+
+void unmap_file(struct mapped_file *mf) {
+    if (mf->data) munmap((void *)mf->data, mf->size);
+    mf->data = NULL;
+    mf->size = 0;
+}
+
+int write_file_atomic(const char *path, const uint8_t *data, size_t size,
+                      unsigned mode, char *errbuf, size_t errlen) {
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 8);
+    if (!tmp) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    snprintf(tmp, plen + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        snprintf(errbuf, errlen, "%s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t w = write(fd, data + done, size - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += (size_t)w;
+    }
+    int ok = done == size && fchmod(fd, (mode_t)(mode & 07777)) == 0;
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+struct pathvec {
+    char **v;
+    size_t n;
+    size_t cap;
+};
+
+static void pathvec_push(struct pathvec *pv, const char *s, size_t len) {
+    if (pv->n == pv->cap) {
+        size_t ncap = pv->cap ? pv->cap * 2 : 64;
+        char **nv = realloc(pv->v, ncap * sizeof(*nv));
+        if (!nv) return;
+        pv->v = nv;
+        pv->cap = ncap;
+    }
+    char *copy = malloc(len + 1);
+    if (!copy) return;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    pv->v[pv->n++] = copy;
+}
+
+size_t corpus_collect_paths(int argc, char **argv, char ***out) {
+    struct pathvec pv = { NULL, 0, 0 };
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-") != 0) {
+            pathvec_push(&pv, argv[i], strlen(argv[i]));
+            continue;
+        }
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        while ((len = getline(&line, &cap, stdin)) > 0) {
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+            if (len > 0) pathvec_push(&pv, line, (size_t)len);
+        }
+        free(line);
+    }
+    *out = pv.v;
+    return pv.n;
+}
+
+void corpus_free_paths(char **paths, size_t n) {
+    for (size_t i = 0; i < n; i++) free(paths[i]);
+    free(paths);
+}
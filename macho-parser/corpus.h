@@ -0,0 +1,33 @@
+#ifndef MACHO_CORPUS_H
+#define MACHO_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Helpers for tools that walk many files (a firmware root, a sample dir).
+//
+// Files are mapped read-only instead of read into malloc'd buffers: a
+// firmware scan touches thousands of binaries but usually only their load
+// commands and __LINKEDIT, so most pages are never faulted in.
+
+struct mapped_file {
+    const uint8_t *data;
+    size_t size;
+};
+
+// Returns 0 on success. Empty files map to {NULL, 0} and succeed.
+int map_file(const char *path, struct mapped_file *mf, char *errbuf, size_t errlen);
+void unmap_file(struct mapped_file *mf);
+
+// Replace `path` with `data` atomically (temp file in the same directory +
+// rename) and give it `mode`. Returns 0 on success.
+int write_file_atomic(const char *path, const uint8_t *data, size_t size,
+                      unsigned mode, char *errbuf, size_t errlen);
+
+// Collect input paths. Each argument is a path, except "-" which reads one
+// path per line from stdin (`find / -type f | tool ... -`). Returns the count
+// and stores a malloc'd array of malloc'd strings in *out.
+size_t corpus_collect_paths(int argc, char **argv, char ***out);
+void corpus_free_paths(char **paths, size_t n);
+
+#endif /* MACHO_CORPUS_H */
@@ -0,0 +1,1004 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "dedup.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../include/macho/loader.h"
+
+#include "corpus.h"
+#include "digest.h"
+#include "macho_image.h"
+#include "parallel.h"
+#include "universal.h"
+
+// Files are chunked a batch at a time so only one batch is mapped and
+// holds per-chunk hashes; the fingerprint table is merged between batches.
+#define BATCH 256
+
+// DEDUP_AVG_CHUNK is 2^12: 14 bits before the normal size, 10 after.
+#define MASK_SMALL (~0ull << (64 - 14))
+#define MASK_LARGE (~0ull << (64 - 10))
+
+// ---- chunking ----
+
+static uint64_t g_gear[256];
+static pthread_once_t g_gear_once = PTHREAD_ONCE_INIT;
+
+// The table only has to be random-looking and fixed: chunk boundaries, and
+// so what a store can share with older runs, depend on it.
+static void gear_init(void) {
+    uint64_t x = 0x6d61636864647570ull;     // "machddup"
+    for (int i = 0; i < 256; i++) {
+        x += 0x9e3779b97f4a7c15ull;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        g_gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t dedup_cut(const uint8_t *p, size_t n) {
+    if (n <= DEDUP_MIN_CHUNK) return n;
+    pthread_once(&g_gear_once, gear_init);
+    size_t max = n < DEDUP_MAX_CHUNK ? n : DEDUP_MAX_CHUNK;
+    size_t normal = max < DEDUP_AVG_CHUNK ? max : DEDUP_AVG_CHUNK;
+    uint64_t h = 0;
+    size_t i = DEDUP_MIN_CHUNK;
+    for (; i < normal; i++) {
+        h = (h << 1) + g_gear[p[i]];
+        if (!(h & MASK_SMALL)) return i + 1;
+    }
+    for (; i < max; i++) {
+        h = (h << 1) + g_gear[p[i]];
+        if (!(h & MASK_LARGE)) return i + 1;
+    }
+    return max;
+}
+
+// ---- regions ----
+
+struct rvec {
+    struct dedup_region *v;
+    size_t n;
+    size_t cap;
+};
+
+static int rvec_push(struct rvec *r, uint64_t off, uint64_t size, uint32_t cputype,
+                     const char *seg, const char *sect) {
+    if (r->n == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 16;
+        struct dedup_region *v = realloc(r->v, cap * sizeof(*v));
+        if (!v) return -1;
+        r->v = v;
+        r->cap = cap;
+    }
+    struct dedup_region *d = &r->v[r->n++];
+    memset(d, 0, sizeof(*d));
+    d->offset = off;
+    d->size = size;
+    d->cputype = cputype;
+    snprintf(d->segname, sizeof(d->segname), "%s", seg);
+    snprintf(d->sectname, sizeof(d->sectname), "%s", sect);
+    return 0;
+}
+
+static int is_zerofill(uint32_t flags) {
+    uint32_t type = flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+// [off, off + size) of a slice of ssize bytes at base, clipped to the slice.
+static int push_clipped(struct rvec *r, uint64_t base, uint64_t ssize, uint64_t off,
+                        uint64_t size, uint32_t cputype, const char *seg, const char *sect) {
+    if (size == 0 || off >= ssize) return 0;
+    if (size > ssize - off) size = ssize - off;
+    return rvec_push(r, base + off, size, cputype, seg, sect);
+}
+
+static int cmp_region(const void *a, const void *b) {
+    const struct dedup_region *x = a;
+    const struct dedup_region *y = b;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// Sort by offset and trim overlaps so each byte is covered at most once.
+static void normalize(struct rvec *r) {
+    if (r->n == 0) return;
+    qsort(r->v, r->n, sizeof(*r->v), cmp_region);
+    size_t k = 0;
+    uint64_t end = 0;
+    for (size_t i = 0; i < r->n; i++) {
+        struct dedup_region d = r->v[i];
+        uint64_t e = d.offset + d.size;
+        if (k && e <= end) continue;
+        if (k && d.offset < end) {
+            d.size = e - end;
+            d.offset = end;
+        }
+        r->v[k++] = d;
+        end = e;
+    }
+    r->n = k;
+}
+
+// Sections and segments of every slice that loads. Returns 1 if any did,
+// 0 if the file is not (usable) Mach-O, -1 on allocation failure.
+static int collect_spans(const uint8_t *buf, size_t size, struct rvec *sects,
+                         struct rvec *segs) {
+    struct fat_slice *slices = NULL;
+    size_t nslices = 0;
+    int is_fat;
+    int is64;
+    char err[128];
+    if (universal_read(buf, size, &slices, &nslices, &is_fat, &is64, err, sizeof(err)) != 0) {
+        return 0;
+    }
+    int loaded = 0;
+    for (size_t s = 0; s < nslices; s++) {
+        struct macho_image img;
+        uint64_t base = slices[s].offset;
+        uint64_t ssize = slices[s].size;
+        if (macho_image_load(&img, buf + base, (size_t)ssize, err, sizeof(err)) != 0) continue;
+        loaded = 1;
+        int ok = 1;
+        for (size_t i = 0; i < img.nsegs && ok; i++) {
+            const struct segment_map *g = &img.segs[i];
+            ok = push_clipped(segs, base, ssize, g->fileoff, g->filesize, img.cputype,
+                              g->name, "") == 0;
+        }
+        for (size_t i = 0; i < img.nsects && ok; i++) {
+            const struct macho_section *sc = &img.sects[i];
+            if (is_zerofill(sc->flags) || sc->offset == 0) continue;
+            ok = push_clipped(sects, base, ssize, sc->offset, sc->size, img.cputype,
+                              sc->segname, sc->sectname) == 0;
+        }
+        macho_image_free(&img);
+        if (!ok) {
+            free(slices);
+            return -1;
+        }
+    }
+    free(slices);
+    return loaded;
+}
+
+// Cover [0, size) with regions: sections first, then the rest of their
+// segments, then whatever no slice accounts for.
+static int build_regions(const uint8_t *buf, size_t size, struct rvec *out, int *macho) {
+    struct rvec sects = { 0 };
+    struct rvec segs = { 0 };
+    int rc = collect_spans(buf, size, &sects, &segs);
+    *macho = rc > 0;
+    if (rc < 0) goto fail;
+    normalize(&sects);
+    normalize(&segs);
+
+    uint64_t pos = 0;
+    size_t si = 0;
+    size_t gi = 0;
+    while (pos < size) {
+        while (si < sects.n && sects.v[si].offset + sects.v[si].size <= pos) si++;
+        while (gi < segs.n && segs.v[gi].offset + segs.v[gi].size <= pos) gi++;
+        uint64_t next_sect = si < sects.n ? sects.v[si].offset : size;
+        const struct dedup_region *label = NULL;
+        uint64_t end;
+        if (si < sects.n && next_sect <= pos) {
+            label = &sects.v[si];
+            end = label->offset + label->size;
+        } else if (gi < segs.n && segs.v[gi].offset <= pos) {
+            label = &segs.v[gi];
+            end = label->offset + label->size;
+            if (next_sect < end) end = next_sect;
+        } else {
+            end = gi < segs.n ? segs.v[gi].offset : size;
+            if (next_sect < end) end = next_sect;
+        }
+        if (rvec_push(out, pos, end - pos, label ? label->cputype : 0,
+                      label ? label->segname : "", label ? label->sectname : "") != 0) {
+            goto fail;
+        }
+        pos = end;
+    }
+    free(sects.v);
+    free(segs.v);
+    return 0;
+fail:
+    free(sects.v);
+    free(segs.v);
+    return -1;
+}
+
+// ---- per-file work ----
+
+struct wchunk {
+    uint8_t sha[32];
+    uint32_t size;
+    uint32_t region;
+};
+
+struct work {
+    struct mapped_file mf;
+    struct dedup_region *regions;
+    size_t nregions;
+    struct wchunk *chunks;
+    size_t nchunks;
+    int macho;
+    int error;
+};
+
+static int chunk_file(struct work *w) {
+    struct rvec regions = { 0 };
+    if (build_regions(w->mf.data, w->mf.size, &regions, &w->macho) != 0) {
+        free(regions.v);
+        return -1;
+    }
+    // Every chunk is at least DEDUP_MIN_CHUNK bytes except the last of a region.
+    size_t cap = w->mf.size / DEDUP_MIN_CHUNK + regions.n + 1;
+    w->chunks = malloc(cap * sizeof(*w->chunks));
+    if (!w->chunks) {
+        free(regions.v);
+        return -1;
+    }
+    for (size_t r = 0; r < regions.n; r++) {
+        const uint8_t *p = w->mf.data + regions.v[r].offset;
+        size_t n = (size_t)regions.v[r].size;
+        while (n) {
+            size_t len = dedup_cut(p, n);
+            struct wchunk *c = &w->chunks[w->nchunks++];
+            digest_sha256(p, len, c->sha);
+            c->size = (uint32_t)len;
+            c->region = (uint32_t)r;
+            regions.v[r].nchunks++;
+            p += len;
+            n -= len;
+        }
+    }
+    w->regions = regions.v;
+    w->nregions = regions.n;
+    return 0;
+}
+
+struct chunk_job {
+    char **paths;
+    struct work *work;
+};
+
+static void chunk_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct chunk_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        struct work *w = &job->work[i];
+        char err[256];
+        memset(w, 0, sizeof(*w));
+        if (map_file(job->paths[i], &w->mf, err, sizeof(err)) != 0 || chunk_file(w) != 0) {
+            free(w->chunks);
+            free(w->regions);
+            unmap_file(&w->mf);
+            memset(w, 0, sizeof(*w));
+            w->error = 1;
+        }
+    }
+}
+
+static void work_release(struct work *w) {
+    free(w->chunks);
+    w->chunks = NULL;
+    unmap_file(&w->mf);
+    memset(&w->mf, 0, sizeof(w->mf));
+}
+
+// ---- fingerprint table ----
+
+struct fp_table {
+    struct dedup_chunk *v;
+    size_t n;
+    size_t cap;
+    uint32_t *slots;            // id + 1, 0 when empty
+    size_t mask;
+};
+
+static size_t fp_slot(const uint8_t sha[32], size_t mask) {
+    uint64_t k;
+    memcpy(&k, sha, sizeof(k));
+    return (size_t)k & mask;
+}
+
+static int fp_rehash(struct fp_table *t, size_t nslots) {
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) return -1;
+    size_t mask = nslots - 1;
+    for (size_t id = 0; id < t->n; id++) {
+        size_t s = fp_slot(t->v[id].sha, mask);
+        while (slots[s]) s = (s + 1) & mask;
+        slots[s] = (uint32_t)id + 1;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->mask = mask;
+    return 0;
+}
+
+// Id of sha, or -1. *slot receives where it would be inserted.
+static long fp_find(const struct fp_table *t, const uint8_t sha[32], size_t *slot) {
+    size_t s = fp_slot(sha, t->mask);
+    while (t->slots[s]) {
+        uint32_t id = t->slots[s] - 1;
+        if (memcmp(t->v[id].sha, sha, 32) == 0) return id;
+        s = (s + 1) & t->mask;
+    }
+    *slot = s;
+    return -1;
+}
+
+// Adds a chunk that fp_find did not find (slot from that call). Returns its
+// id, or -1 when out of memory or ids.
+static long fp_add(struct fp_table *t, size_t slot, const uint8_t sha[32], uint64_t offset,
+                   uint32_t size) {
+    if (t->n >= UINT32_MAX - 1) return -1;
+    if (t->n == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        struct dedup_chunk *v = realloc(t->v, cap * sizeof(*v));
+        if (!v) return -1;
+        t->v = v;
+        t->cap = cap;
+    }
+    size_t id = t->n++;
+    struct dedup_chunk *c = &t->v[id];
+    memcpy(c->sha, sha, 32);
+    c->offset = offset;
+    c->size = size;
+    c->refs = 0;
+    t->slots[slot] = (uint32_t)id + 1;
+    // Keep the load factor at or below one half.
+    if (t->n * 2 > t->mask + 1 && fp_rehash(t, (t->mask + 1) * 2) != 0) return -1;
+    return (long)id;
+}
+
+static int fp_init(struct fp_table *t, size_t expect) {
+    memset(t, 0, sizeof(*t));
+    size_t nslots = 1024;
+    while (nslots < expect * 2) nslots *= 2;
+    return fp_rehash(t, nslots);
+}
+
+static void fp_free(struct fp_table *t) {
+    free(t->v);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// ---- shared helpers ----
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static size_t sort_unique(char **paths, size_t npaths) {
+    if (npaths == 0) return 0;
+    qsort(paths, npaths, sizeof(*paths), cmp_path);
+    size_t uniq = 0;
+    for (size_t i = 0; i < npaths; i++) {
+        if (uniq && strcmp(paths[uniq - 1], paths[i]) == 0) continue;
+        // Swap rather than overwrite: the caller still owns all npaths strings.
+        char *t = paths[uniq];
+        paths[uniq++] = paths[i];
+        paths[i] = t;
+    }
+    return uniq;
+}
+
+// Moves a finished file's regions into its report entry.
+static void fill_image(struct dedup_image *im, const char *path, struct work *w) {
+    memset(im, 0, sizeof(*im));
+    im->path = path;
+    im->error = w->error;
+    if (w->error) return;
+    im->size = w->mf.size;
+    im->nchunks = (uint32_t)w->nchunks;
+    im->macho = w->macho;
+    im->regions = w->regions;
+    im->nregions = w->nregions;
+    w->regions = NULL;
+}
+
+void dedup_report_free(struct dedup_report *r) {
+    for (size_t i = 0; i < r->nimages; i++) free(r->images[i].regions);
+    free(r->images);
+    memset(r, 0, sizeof(*r));
+}
+
+// ---- scan ----
+
+int dedup_scan(char **paths, size_t npaths, unsigned nthreads, struct dedup_report *out,
+               char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    npaths = sort_unique(paths, npaths);
+
+    struct fp_table tab;
+    struct dedup_image *images = calloc(npaths ? npaths : 1, sizeof(*images));
+    uint32_t **ids = calloc(npaths ? npaths : 1, sizeof(*ids));
+    struct work *work = calloc(BATCH, sizeof(*work));
+    if (!images || !ids || !work || fp_init(&tab, 0) != 0) {
+        free(images);
+        free(ids);
+        free(work);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    out->images = images;
+    out->nimages = npaths;
+
+    int rc = 0;
+    for (size_t b = 0; b < npaths && rc == 0; b += BATCH) {
+        size_t nb = npaths - b < BATCH ? npaths - b : BATCH;
+        struct chunk_job job = { paths + b, work };
+        par_for(nb, 1, nthreads, chunk_worker, &job);
+
+        // Merged in path order, so chunk ids do not depend on thread timing.
+        for (size_t i = 0; i < nb; i++) {
+            struct work *w = &work[i];
+            fill_image(&images[b + i], paths[b + i], w);
+            if (w->error) {
+                out->errors++;
+                continue;
+            }
+            out->bytes += w->mf.size;
+            out->chunks += w->nchunks;
+            ids[b + i] = malloc((w->nchunks ? w->nchunks : 1) * sizeof(**ids));
+            if (!ids[b + i]) rc = -1;
+            for (size_t k = 0; k < w->nchunks && rc == 0; k++) {
+                size_t slot;
+                long id = fp_find(&tab, w->chunks[k].sha, &slot);
+                if (id < 0) id = fp_add(&tab, slot, w->chunks[k].sha, 0, w->chunks[k].size);
+                if (id < 0) {
+                    rc = -1;
+                    break;
+                }
+                tab.v[id].refs++;
+                ids[b + i][k] = (uint32_t)id;
+            }
+        }
+        for (size_t i = 0; i < nb; i++) work_release(&work[i]);
+    }
+
+    if (rc == 0) {
+        out->unique_chunks = tab.n;
+        for (size_t id = 0; id < tab.n; id++) out->unique_bytes += tab.v[id].size;
+        for (size_t i = 0; i < npaths; i++) {
+            struct dedup_image *im = &images[i];
+            size_t k = 0;
+            for (size_t r = 0; r < im->nregions; r++) {
+                struct dedup_region *rg = &im->regions[r];
+                for (uint32_t j = 0; j < rg->nchunks; j++, k++) {
+                    const struct dedup_chunk *c = &tab.v[ids[i][k]];
+                    if (c->refs > 1) rg->shared += c->size;
+                }
+                im->shared += rg->shared;
+            }
+        }
+    } else {
+        snprintf(errbuf, errlen, "out of memory");
+        dedup_report_free(out);
+    }
+    for (size_t i = 0; i < npaths; i++) free(ids[i]);
+    free(ids);
+    free(work);
+    fp_free(&tab);
+    return rc;
+}
+
+// ---- store: catalog I/O ----
+
+static char *join(const char *dir, const char *name) {
+    size_t a = strlen(dir);
+    size_t b = strlen(name);
+    char *p = malloc(a + b + 2);
+    if (!p) return NULL;
+    memcpy(p, dir, a);
+    p[a] = '/';
+    memcpy(p + a + 1, name, b + 1);
+    return p;
+}
+
+static uint64_t align8(uint64_t x) {
+    return (x + 7) & ~(uint64_t)7;
+}
+
+static int emit(FILE *f, uint64_t *pos, const void *p, size_t len, uint64_t at) {
+    static const uint8_t zeros[8];
+    while (*pos < at) {
+        size_t n = (at - *pos) < sizeof(zeros) ? (size_t)(at - *pos) : sizeof(zeros);
+        if (fwrite(zeros, 1, n, f) != n) return 0;
+        *pos += n;
+    }
+    if (len && fwrite(p, 1, len, f) != len) return 0;
+    *pos += len;
+    return 1;
+}
+
+int dedup_store_open(const char *dir, struct dedup_store *st, char *errbuf, size_t errlen) {
+    memset(st, 0, sizeof(*st));
+    char *cpath = join(dir, "catalog");
+    char *ppath = join(dir, "pack");
+    struct mapped_file cat = { 0 };
+    struct mapped_file pack = { 0 };
+    int rc = -1;
+    if (!cpath || !ppath) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto out;
+    }
+    if (map_file(cpath, &cat, errbuf, errlen) != 0) goto out;
+    if (map_file(ppath, &pack, errbuf, errlen) != 0) {
+        unmap_file(&cat);
+        goto out;
+    }
+    st->map = cat.data;
+    st->size = cat.size;
+    st->pack = pack.data;
+    st->pack_size = pack.size;
+
+    const struct dedup_header *h = (const struct dedup_header *)cat.data;
+    if (cat.size < sizeof(*h) || memcmp(h->magic, DEDUP_MAGIC, sizeof(h->magic)) != 0) {
+        snprintf(errbuf, errlen, "%s: not a dedup catalog", cpath);
+        goto fail;
+    }
+    if (h->version != DEDUP_VERSION || h->byte_order != DEDUP_BYTE_ORDER) {
+        snprintf(errbuf, errlen, "%s: catalog version %u / byte order mismatch", cpath,
+                 h->version);
+        goto fail;
+    }
+    uint64_t sz = cat.size;
+    int ok = h->chunks_off <= sz &&
+             (uint64_t)h->nchunks * sizeof(struct dedup_chunk) <= sz - h->chunks_off &&
+             h->files_off <= sz &&
+             (uint64_t)h->nfiles * sizeof(struct dedup_file) <= sz - h->files_off &&
+             h->refs_off <= sz && h->nrefs <= (sz - h->refs_off) / 4 &&
+             h->strtab_off <= sz && h->strtab_size <= sz - h->strtab_off &&
+             h->strtab_size > 0 && cat.data[h->strtab_off + h->strtab_size - 1] == '\0' &&
+             (h->chunks_off | h->files_off | h->refs_off) % 8 == 0 &&
+             h->pack_size <= pack.size;
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt catalog", cpath);
+        goto fail;
+    }
+    // Tables are validated once so lookups and reads can index without checks.
+    const struct dedup_chunk *chunks = (const struct dedup_chunk *)(cat.data + h->chunks_off);
+    const struct dedup_file *files = (const struct dedup_file *)(cat.data + h->files_off);
+    const uint32_t *refs = (const uint32_t *)(cat.data + h->refs_off);
+    const char *strtab = (const char *)(cat.data + h->strtab_off);
+    for (uint32_t i = 0; i < h->nchunks && ok; i++) {
+        ok = chunks[i].offset <= h->pack_size &&
+             chunks[i].size <= h->pack_size - chunks[i].offset &&
+             (i == 0 || memcmp(chunks[i - 1].sha, chunks[i].sha, 32) < 0);
+    }
+    for (uint32_t i = 0; i < h->nfiles && ok; i++) {
+        ok = files[i].path < h->strtab_size && files[i].first_ref <= h->nrefs &&
+             files[i].nchunks <= h->nrefs - files[i].first_ref &&
+             (i == 0 || strcmp(strtab + files[i - 1].path, strtab + files[i].path) < 0);
+    }
+    for (uint64_t i = 0; i < h->nrefs && ok; i++) ok = refs[i] < h->nchunks;
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt chunk or file table", cpath);
+        goto fail;
+    }
+    st->h = h;
+    st->chunks = chunks;
+    st->files = files;
+    st->refs = refs;
+    st->strtab = strtab;
+    rc = 0;
+    goto out;
+fail:
+    dedup_store_close(st);
+out:
+    free(cpath);
+    free(ppath);
+    return rc;
+}
+
+void dedup_store_close(struct dedup_store *st) {
+    struct mapped_file cat = { st->map, st->size };
+    struct mapped_file pack = { st->pack, st->pack_size };
+    unmap_file(&cat);
+    unmap_file(&pack);
+    memset(st, 0, sizeof(*st));
+}
+
+const char *dedup_store_path(const struct dedup_store *st, uint32_t file) {
+    return st->strtab + st->files[file].path;
+}
+
+long dedup_store_find(const struct dedup_store *st, const char *path) {
+    size_t lo = 0;
+    size_t hi = st->h->nfiles;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(dedup_store_path(st, (uint32_t)mid), path);
+        if (c == 0) return (long)mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+int dedup_store_read(const struct dedup_store *st, uint32_t file, uint8_t **out,
+                     size_t *size, char *errbuf, size_t errlen) {
+    const struct dedup_file *f = &st->files[file];
+    const uint32_t *refs = st->refs + f->first_ref;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < f->nchunks; i++) total += st->chunks[refs[i]].size;
+    if (total != f->size || total > SIZE_MAX) {
+        snprintf(errbuf, errlen, "%s: recipe covers %llu bytes, file has %llu",
+                 dedup_store_path(st, file), (unsigned long long)total,
+                 (unsigned long long)f->size);
+        return -1;
+    }
+    uint8_t *buf = malloc(total ? (size_t)total : 1);
+    if (!buf) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    size_t pos = 0;
+    for (uint32_t i = 0; i < f->nchunks; i++) {
+        const struct dedup_chunk *c = &st->chunks[refs[i]];
+        uint8_t sha[32];
+        digest_sha256(st->pack + c->offset, c->size, sha);
+        if (memcmp(sha, c->sha, sizeof(sha)) != 0) {
+            snprintf(errbuf, errlen, "%s: chunk at pack offset 0x%llx fails its SHA-256",
+                     dedup_store_path(st, file), (unsigned long long)c->offset);
+            free(buf);
+            return -1;
+        }
+        memcpy(buf + pos, st->pack + c->offset, c->size);
+        pos += c->size;
+    }
+    *out = buf;
+    *size = pos;
+    return 0;
+}
+
+// ---- store: adding files ----
+
+struct sfile {
+    char *path;
+    uint64_t size;
+    uint32_t *ids;
+    uint32_t nchunks;
+    int dead;                   // replaced by a newer recipe
+};
+
+struct store_mem {
+    struct fp_table tab;
+    struct sfile *files;
+    size_t nfiles;
+    size_t cap;
+    size_t nold;                // files[0..nold) came from the catalog, sorted by path
+};
+
+static void store_mem_free(struct store_mem *m) {
+    for (size_t i = 0; i < m->nfiles; i++) {
+        free(m->files[i].path);
+        free(m->files[i].ids);
+    }
+    free(m->files);
+    fp_free(&m->tab);
+}
+
+static struct sfile *sfile_push(struct store_mem *m) {
+    if (m->nfiles == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 64;
+        struct sfile *v = realloc(m->files, cap * sizeof(*v));
+        if (!v) return NULL;
+        m->files = v;
+        m->cap = cap;
+    }
+    struct sfile *f = &m->files[m->nfiles++];
+    memset(f, 0, sizeof(*f));
+    return f;
+}
+
+// Copy an existing catalog into memory (chunk ids are catalog indices).
+static int store_load(struct store_mem *m, const struct dedup_store *st) {
+    const struct dedup_header *h = st->h;
+    if (fp_init(&m->tab, h->nchunks) != 0) return -1;
+    for (uint32_t i = 0; i < h->nchunks; i++) {
+        size_t slot;
+        // Sorted and distinct, so never found.
+        if (fp_find(&m->tab, st->chunks[i].sha, &slot) >= 0) return -1;
+        long id = fp_add(&m->tab, slot, st->chunks[i].sha, st->chunks[i].offset,
+                         st->chunks[i].size);
+        if (id < 0) return -1;
+        m->tab.v[id].refs = st->chunks[i].refs;
+    }
+    for (uint32_t i = 0; i < h->nfiles; i++) {
+        const struct dedup_file *df = &st->files[i];
+        struct sfile *f = sfile_push(m);
+        if (!f) return -1;
+        f->path = strdup(dedup_store_path(st, i));
+        f->ids = malloc((df->nchunks ? df->nchunks : 1) * sizeof(*f->ids));
+        if (!f->path || !f->ids) return -1;
+        memcpy(f->ids, st->refs + df->first_ref, (size_t)df->nchunks * sizeof(*f->ids));
+        f->nchunks = df->nchunks;
+        f->size = df->size;
+    }
+    m->nold = m->nfiles;
+    return 0;
+}
+
+// An older recipe for path gives up its chunk references.
+static void store_replace(struct store_mem *m, const char *path) {
+    size_t lo = 0;
+    size_t hi = m->nold;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(m->files[mid].path, path);
+        if (c == 0) {
+            struct sfile *f = &m->files[mid];
+            if (f->dead) return;
+            for (uint32_t i = 0; i < f->nchunks; i++) m->tab.v[f->ids[i]].refs--;
+            f->dead = 1;
+            return;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+}
+
+struct keyed_chunk {
+    struct dedup_chunk c;
+    uint32_t old;
+};
+
+static int cmp_keyed(const void *a, const void *b) {
+    return memcmp(((const struct keyed_chunk *)a)->c.sha, ((const struct keyed_chunk *)b)->c.sha,
+                  32);
+}
+
+static int cmp_sfile(const void *a, const void *b) {
+    return strcmp(((const struct sfile *)a)->path, ((const struct sfile *)b)->path);
+}
+
+static int store_write(const char *dir, struct store_mem *m, uint64_t pack_size,
+                       char *errbuf, size_t errlen) {
+    struct fp_table *t = &m->tab;
+    size_t nlive = 0;
+    uint64_t nrefs = 0;
+    size_t strsize = 1;
+    for (size_t i = 0; i < m->nfiles; i++) {
+        struct sfile *sf = &m->files[i];
+        if (sf->dead) {
+            free(sf->path);
+            free(sf->ids);
+            continue;
+        }
+        nrefs += sf->nchunks;
+        strsize += strlen(sf->path) + 1;
+        m->files[nlive++] = *sf;
+    }
+    m->nfiles = nlive;
+    m->nold = 0;
+    qsort(m->files, nlive, sizeof(*m->files), cmp_sfile);
+
+    struct keyed_chunk *keyed = malloc((t->n ? t->n : 1) * sizeof(*keyed));
+    uint32_t *remap = malloc((t->n ? t->n : 1) * sizeof(*remap));
+    struct dedup_chunk *chunks = malloc((t->n ? t->n : 1) * sizeof(*chunks));
+    struct dedup_file *files = malloc((nlive ? nlive : 1) * sizeof(*files));
+    uint32_t *refs = malloc((nrefs ? nrefs : 1) * sizeof(*refs));
+    char *strtab = malloc(strsize);
+    char *cpath = join(dir, "catalog");
+    char *tmp = join(dir, "catalog.tmp");
+    int rc = -1;
+    if (!keyed || !remap || !chunks || !files || !refs || !strtab || !cpath || !tmp ||
+        strsize > UINT32_MAX || nlive > UINT32_MAX) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto out;
+    }
+    for (size_t i = 0; i < t->n; i++) {
+        keyed[i].c = t->v[i];
+        keyed[i].old = (uint32_t)i;
+    }
+    qsort(keyed, t->n, sizeof(*keyed), cmp_keyed);
+    for (size_t i = 0; i < t->n; i++) {
+        chunks[i] = keyed[i].c;
+        remap[keyed[i].old] = (uint32_t)i;
+    }
+
+    size_t pos = 1;
+    uint64_t r = 0;
+    strtab[0] = '\0';
+    for (size_t i = 0; i < nlive; i++) {
+        const struct sfile *sf = &m->files[i];
+        size_t len = strlen(sf->path) + 1;
+        memcpy(strtab + pos, sf->path, len);
+        files[i].path = (uint32_t)pos;
+        files[i].nchunks = sf->nchunks;
+        files[i].first_ref = r;
+        files[i].size = sf->size;
+        pos += len;
+        for (uint32_t k = 0; k < sf->nchunks; k++) refs[r++] = remap[sf->ids[k]];
+    }
+
+    struct dedup_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DEDUP_MAGIC, sizeof(h.magic));
+    h.version = DEDUP_VERSION;
+    h.byte_order = DEDUP_BYTE_ORDER;
+    h.nchunks = (uint32_t)t->n;
+    h.nfiles = (uint32_t)nlive;
+    h.nrefs = nrefs;
+    h.pack_size = pack_size;
+    h.chunks_off = align8(sizeof(h));
+    h.files_off = align8(h.chunks_off + (uint64_t)t->n * sizeof(*chunks));
+    h.refs_off = align8(h.files_off + (uint64_t)nlive * sizeof(*files));
+    h.strtab_off = align8(h.refs_off + nrefs * sizeof(*refs));
+    h.strtab_size = strsize;
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        snprintf(errbuf, errlen, "%s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    uint64_t at = 0;
+    int ok = emit(f, &at, &h, sizeof(h), 0) &&
+             emit(f, &at, chunks, (size_t)t->n * sizeof(*chunks), h.chunks_off) &&
+             emit(f, &at, files, nlive * sizeof(*files), h.files_off) &&
+             emit(f, &at, refs, (size_t)nrefs * sizeof(*refs), h.refs_off) &&
+             emit(f, &at, strtab, strsize, h.strtab_off);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, cpath) != 0) {
+        snprintf(errbuf, errlen, "%s: %s", cpath, strerror(errno));
+        remove(tmp);
+        goto out;
+    }
+    rc = 0;
+out:
+    free(keyed);
+    free(remap);
+    free(chunks);
+    free(files);
+    free(refs);
+    free(strtab);
+    free(cpath);
+    free(tmp);
+    return rc;
+}
+
+int dedup_store_add(const char *dir, char **paths, size_t npaths, unsigned nthreads,
+                    struct dedup_report *out, char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    npaths = sort_unique(paths, npaths);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        snprintf(errbuf, errlen, "%s: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    struct store_mem m;
+    memset(&m, 0, sizeof(m));
+    char *cpath = join(dir, "catalog");
+    char *ppath = join(dir, "pack");
+    struct work *work = calloc(BATCH, sizeof(*work));
+    struct dedup_image *images = calloc(npaths ? npaths : 1, sizeof(*images));
+    FILE *pack = NULL;
+    int rc = -1;
+    if (!cpath || !ppath || !work || !images) {
+        free(images);
+        snprintf(errbuf, errlen, "out of memory");
+        goto out;
+    }
+    out->images = images;
+    out->nimages = npaths;
+
+    struct stat sb;
+    if (stat(cpath, &sb) == 0) {
+        struct dedup_store st;
+        if (dedup_store_open(dir, &st, errbuf, errlen) != 0) goto out;
+        int lrc = store_load(&m, &st);
+        dedup_store_close(&st);
+        if (lrc != 0) {
+            snprintf(errbuf, errlen, "out of memory");
+            goto out;
+        }
+    } else if (errno != ENOENT) {
+        snprintf(errbuf, errlen, "%s: %s", cpath, strerror(errno));
+        goto out;
+    } else if (fp_init(&m.tab, 0) != 0) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto out;
+    }
+
+    // Bytes past the catalog's pack_size are left over from a run that
+    // failed before its catalog was written; new chunks go after them.
+    pack = fopen(ppath, "ab");
+    off_t end = -1;
+    if (pack && fseeko(pack, 0, SEEK_END) == 0) end = ftello(pack);
+    if (end < 0) {
+        snprintf(errbuf, errlen, "%s: %s", ppath, strerror(errno));
+        goto out;
+    }
+    uint64_t pack_size = (uint64_t)end;
+
+    int failed = 0;
+    for (size_t b = 0; b < npaths && !failed; b += BATCH) {
+        size_t nb = npaths - b < BATCH ? npaths - b : BATCH;
+        struct chunk_job job = { paths + b, work };
+        par_for(nb, 1, nthreads, chunk_worker, &job);
+
+        for (size_t i = 0; i < nb && !failed; i++) {
+            struct work *w = &work[i];
+            struct dedup_image *im = &images[b + i];
+            fill_image(im, paths[b + i], w);
+            if (w->error) {
+                out->errors++;
+                continue;
+            }
+            out->bytes += w->mf.size;
+            out->chunks += w->nchunks;
+            store_replace(&m, paths[b + i]);
+            struct sfile *sf = sfile_push(&m);
+            if (!sf || !(sf->path = strdup(paths[b + i])) ||
+                !(sf->ids = malloc((w->nchunks ? w->nchunks : 1) * sizeof(*sf->ids)))) {
+                snprintf(errbuf, errlen, "out of memory");
+                failed = 1;
+                break;
+            }
+            sf->size = w->mf.size;
+            sf->nchunks = (uint32_t)w->nchunks;
+
+            const uint8_t *p = w->mf.data;
+            for (size_t k = 0; k < w->nchunks; k++) {
+                const struct wchunk *c = &w->chunks[k];
+                size_t slot;
+                long id = fp_find(&m.tab, c->sha, &slot);
+                if (id >= 0) {
+                    im->regions[c->region].shared += c->size;
+                    im->shared += c->size;
+                } else {
+                    if (fwrite(p, 1, c->size, pack) != c->size) {
+                        snprintf(errbuf, errlen, "%s: %s", ppath, strerror(errno));
+                        failed = 1;
+                        break;
+                    }
+                    id = fp_add(&m.tab, slot, c->sha, pack_size, c->size);
+                    if (id < 0) {
+                        snprintf(errbuf, errlen, "out of memory");
+                        failed = 1;
+                        break;
+                    }
+                    pack_size += c->size;
+                    out->unique_chunks++;
+                    out->unique_bytes += c->size;
+                }
+                m.tab.v[id].refs++;
+                sf->ids[k] = (uint32_t)id;
+                p += c->size;
+            }
+        }
+        for (size_t i = 0; i < nb; i++) work_release(&work[i]);
+    }
+    // Any regions still in work (after a failure) were never handed over.
+    for (size_t i = 0; i < BATCH; i++) free(work[i].regions);
+
+    // The pack must be complete before a catalog points into it.
+    int cerr = fclose(pack);
+    pack = NULL;
+    if (failed) goto out;
+    if (cerr != 0) {
+        snprintf(errbuf, errlen, "%s: %s", ppath, strerror(errno));
+        goto out;
+    }
+    rc = store_write(dir, &m, pack_size, errbuf, errlen);
+out:
+    if (pack) fclose(pack);
+    if (rc != 0) dedup_report_free(out);
+    store_mem_free(&m);
+    free(work);
+    free(cpath);
+    free(ppath);
+    return rc;
+}
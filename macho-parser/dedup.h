@@ -0,0 +1,152 @@
+#ifndef MACHO_DEDUP_H
+#define MACHO_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Content-defined chunking of whole files and a store that keeps every
+// distinct chunk once.
+//
+// A file is first cut into regions, and no chunk spans two of them: each
+// file-backed section of every slice, the rest of each segment (load
+// commands, __LINKEDIT, padding), and the bytes outside all slices (the FAT
+// header, alignment). A file that is not Mach-O is one region. Each region is
+// chunked FastCDC-style. A Gear hash (h = (h << 1) + gear[byte]) rolls over
+// the bytes and a chunk ends where the top bits of h are all zero. Before
+// DEDUP_AVG_CHUNK bytes the mask has two bits more than the average needs,
+// after it two fewer, so sizes cluster around the average. The first
+// DEDUP_MIN_CHUNK bytes of a chunk are skipped. Cuts depend only on the 64
+// bytes before them: an insertion shifts the cuts after it instead of
+// changing them, and the chunks further on still match. Chunks are
+// identified by SHA-256.
+//
+// A store is a directory:
+//   pack      chunk bytes, each distinct chunk once, appended
+//   catalog   the chunk index and one recipe per file, rewritten atomically
+//             (temporary file + rename) after the pack has been extended
+// The catalog is the in-memory layout, as for ent_index: opening it is one
+// mmap. All integers are host byte order.
+//
+//   header
+//   struct dedup_chunk chunks[nchunks]   sorted by sha
+//   struct dedup_file files[nfiles]      sorted by path
+//   u32 refs[nrefs]                      chunk indices, file by file, in order
+//   strtab                               NUL-terminated paths
+
+#define DEDUP_MAGIC "MACHODDP"
+#define DEDUP_VERSION 1
+#define DEDUP_BYTE_ORDER 0x01020304u
+
+#define DEDUP_MIN_CHUNK 1024
+#define DEDUP_AVG_CHUNK 4096
+#define DEDUP_MAX_CHUNK 32768
+
+struct dedup_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t nchunks;
+    uint32_t nfiles;
+    uint64_t nrefs;
+    uint64_t pack_size;         // pack bytes the chunk table covers
+    uint64_t chunks_off;
+    uint64_t files_off;
+    uint64_t refs_off;
+    uint64_t strtab_off;
+    uint64_t strtab_size;
+};
+
+struct dedup_chunk {
+    uint8_t sha[32];
+    uint64_t offset;            // in the pack
+    uint32_t size;
+    uint32_t refs;              // recipe entries naming it; 0 once its files were replaced
+};
+
+struct dedup_file {
+    uint32_t path;              // string offset
+    uint32_t nchunks;
+    uint64_t first_ref;         // index into refs
+    uint64_t size;
+};
+
+// Length of the first chunk of p[0..n): n itself when n is at most
+// DEDUP_MIN_CHUNK, never more than DEDUP_MAX_CHUNK.
+size_t dedup_cut(const uint8_t *p, size_t n);
+
+// A region of an input file and how many of its bytes are duplicated.
+struct dedup_region {
+    uint64_t offset;            // in the file
+    uint64_t size;
+    uint64_t shared;
+    uint32_t nchunks;
+    uint32_t cputype;           // 0 outside slices
+    char segname[17];           // "" outside slices
+    char sectname[17];          // "" for segment bytes outside its sections
+};
+
+struct dedup_image {
+    const char *path;           // the caller's string
+    uint64_t size;
+    uint64_t shared;
+    uint32_t nchunks;
+    int macho;                  // regions come from load commands
+    int error;                  // the file could not be read; nothing else is set
+    struct dedup_region *regions;
+    size_t nregions;
+};
+
+// What "shared" means depends on the pass:
+//   dedup_scan       the chunk occurs more than once in the set (in this file
+//                    or another);
+//   dedup_store_add  the chunk was in the store already, or came earlier in
+//                    this run, so no bytes were written for it.
+struct dedup_report {
+    struct dedup_image *images; // in path order
+    size_t nimages;
+    size_t errors;
+    uint64_t bytes;             // all input bytes
+    uint64_t chunks;
+    uint64_t unique_chunks;     // scan: distinct chunks; store: chunks written
+    uint64_t unique_bytes;
+};
+
+// Chunk `paths` (sorted and deduplicated in place, as for sidx_build) in
+// parallel and report the bytes each region shares with the rest of the set.
+int dedup_scan(char **paths, size_t npaths, unsigned nthreads, struct dedup_report *out,
+               char *errbuf, size_t errlen);
+void dedup_report_free(struct dedup_report *r);
+
+// Add `paths` to the store in directory `dir` (created if missing). Chunks
+// not yet in the store are appended to the pack. A path already in the store
+// gets the new recipe; chunks only the old one used stay in the pack with
+// refs 0.
+int dedup_store_add(const char *dir, char **paths, size_t npaths, unsigned nthreads,
+                    struct dedup_report *out, char *errbuf, size_t errlen);
+
+struct dedup_store {
+    const uint8_t *map;         // catalog
+    size_t size;
+    const uint8_t *pack;
+    size_t pack_size;
+    const struct dedup_header *h;
+    const struct dedup_chunk *chunks;
+    const struct dedup_file *files;
+    const uint32_t *refs;
+    const char *strtab;
+};
+
+int dedup_store_open(const char *dir, struct dedup_store *st, char *errbuf, size_t errlen);
+void dedup_store_close(struct dedup_store *st);
+
+const char *dedup_store_path(const struct dedup_store *st, uint32_t file);
+
+// File index for a path, or -1.
+long dedup_store_find(const struct dedup_store *st, const char *path);
+
+// Reassemble a file into a malloc'd buffer. Every chunk is hashed again and
+// compared with its SHA-256, so a damaged pack is an error, not wrong output.
+int dedup_store_read(const struct dedup_store *st, uint32_t file, uint8_t **out,
+                     size_t *size, char *errbuf, size_t errlen);
+
+#endif /* MACHO_DEDUP_H */
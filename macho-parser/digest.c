@@ -0,0 +1,372 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "digest.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "../include/kern/cs_blobs.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DIGEST_HAVE_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_SHA2)
+#define DIGEST_HAVE_ARMV8 1
+#include <arm_neon.h>
+#endif
+
+static inline uint32_t rol32(uint32_t x, unsigned n) { return (x << n) | (x >> (32 - n)); }
+static inline uint32_t ror32(uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+static inline uint64_t ror64(uint64_t x, unsigned n) { return (x >> n) | (x << (64 - n)); }
+
+static inline uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t be64(const uint8_t *p) {
+    return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+static inline void put_be64(uint8_t *p, uint64_t v) {
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+// --- SHA-256 ---------------------------------------------------------------
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_blocks_portable(uint32_t s[8], const uint8_t *p, size_t nblocks) {
+    uint32_t w[64];
+    while (nblocks--) {
+        for (int i = 0; i < 16; i++) w[i] = be32(p + i * 4);
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3];
+        uint32_t e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) +
+                          ((e & f) ^ (~e & g)) + K256[i] + w[i];
+            uint32_t t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+        p += 64;
+    }
+}
+
+#ifdef DIGEST_HAVE_SHANI
+// Intel SHA extensions. sha256rnds2 runs two rounds on state kept as
+// ABEF/CDGH; msg1/msg2 compute the message schedule four words at a time.
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t s[8], const uint8_t *p, size_t nblocks) {
+    const __m128i shuf = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&s[0]);
+    __m128i st1 = _mm_loadu_si128((const __m128i *)&s[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);            // CDAB
+    st1 = _mm_shuffle_epi32(st1, 0x1B);            // EFGH
+    __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);    // ABEF
+    st1 = _mm_blend_epi16(st1, tmp, 0xF0);         // CDGH
+
+    while (nblocks--) {
+        __m128i abef = st0;
+        __m128i cdgh = st1;
+        __m128i w[4];
+        // Fully unrolled, g is a constant and w[] stays in registers.
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + g * 16)), shuf);
+            }
+            __m128i msg = _mm_add_epi32(w[g & 3], _mm_loadu_si128((const __m128i *)&K256[g * 4]));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+            if (g >= 3 && g <= 14) {
+                __m128i t = _mm_alignr_epi8(w[g & 3], w[(g + 3) & 3], 4);
+                w[(g + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(w[(g + 1) & 3], t), w[g & 3]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+            if (g >= 1 && g <= 12) {
+                w[(g + 3) & 3] = _mm_sha256msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+            }
+        }
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+        p += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(st0, 0x1B);            // FEBA
+    st1 = _mm_shuffle_epi32(st1, 0xB1);            // DCHG
+    st0 = _mm_blend_epi16(tmp, st1, 0xF0);         // DCBA
+    st1 = _mm_alignr_epi8(st1, tmp, 8);            // ABEF
+    _mm_storeu_si128((__m128i *)&s[0], st0);
+    _mm_storeu_si128((__m128i *)&s[4], st1);
+}
+
+static int cpu_has_shani(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+    int sse41 = (c >> 19) & 1;
+    int ssse3 = (c >> 9) & 1;
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, a, b, c, d);
+    return sse41 && ssse3 && ((b >> 29) & 1);
+}
+#endif
+
+#ifdef DIGEST_HAVE_ARMV8
+static void sha256_blocks_armv8(uint32_t s[8], const uint8_t *p, size_t nblocks) {
+    uint32x4_t st0 = vld1q_u32(&s[0]);
+    uint32x4_t st1 = vld1q_u32(&s[4]);
+    while (nblocks--) {
+        uint32x4_t abcd = st0;
+        uint32x4_t efgh = st1;
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; i++) {
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + i * 16)));
+        }
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            uint32x4_t k = vaddq_u32(w[g & 3], vld1q_u32(&K256[g * 4]));
+            if (g < 12) w[g & 3] = vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]);
+            uint32x4_t prev = st0;
+            st0 = vsha256hq_u32(st0, st1, k);
+            st1 = vsha256h2q_u32(st1, prev, k);
+            if (g < 12) w[g & 3] = vsha256su1q_u32(w[g & 3], w[(g + 2) & 3], w[(g + 3) & 3]);
+        }
+        st0 = vaddq_u32(st0, abcd);
+        st1 = vaddq_u32(st1, efgh);
+        p += 64;
+    }
+    vst1q_u32(&s[0], st0);
+    vst1q_u32(&s[4], st1);
+}
+#endif
+
+typedef void (*sha256_blocks_fn)(uint32_t s[8], const uint8_t *p, size_t nblocks);
+
+static sha256_blocks_fn g_sha256_blocks = sha256_blocks_portable;
+static const char *g_sha256_name = "portable";
+static pthread_once_t g_sha256_once = PTHREAD_ONCE_INIT;
+
+static void sha256_pick(void) {
+#ifdef DIGEST_HAVE_ARMV8
+    g_sha256_blocks = sha256_blocks_armv8;
+    g_sha256_name = "armv8-crypto";
+#endif
+#ifdef DIGEST_HAVE_SHANI
+    if (cpu_has_shani()) {
+        g_sha256_blocks = sha256_blocks_shani;
+        g_sha256_name = "sha-ni";
+    }
+#endif
+}
+
+const char *digest_sha256_impl(void) {
+    pthread_once(&g_sha256_once, sha256_pick);
+    return g_sha256_name;
+}
+
+void sha256_init(struct sha256_ctx *c) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    pthread_once(&g_sha256_once, sha256_pick);
+    memcpy(c->state, iv, sizeof(iv));
+    c->total = 0;
+    c->buflen = 0;
+}
+
+void sha256_update(struct sha256_ctx *c, const void *data, size_t len) {
+    const uint8_t *p = data;
+    c->total += len;
+    if (c->buflen) {
+        size_t take = 64 - c->buflen;
+        if (take > len) take = len;
+        memcpy(c->buf + c->buflen, p, take);
+        c->buflen += take;
+        p += take;
+        len -= take;
+        if (c->buflen < 64) return;
+        g_sha256_blocks(c->state, c->buf, 1);
+        c->buflen = 0;
+    }
+    if (len >= 64) {
+        size_t nb = len / 64;
+        g_sha256_blocks(c->state, p, nb);
+        p += nb * 64;
+        len -= nb * 64;
+    }
+    if (len) {
+        memcpy(c->buf, p, len);
+        c->buflen = len;
+    }
+}
+
+void sha256_final(struct sha256_ctx *c, uint8_t out[32]) {
+    uint64_t bits = c->total * 8;
+    uint8_t pad[72];
+    size_t padlen = (c->buflen < 56) ? (56 - c->buflen) : (120 - c->buflen);
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    put_be64(pad + padlen, bits);
+    sha256_update(c, pad, padlen + 8);
+    for (int i = 0; i < 8; i++) put_be32(out + i * 4, c->state[i]);
+}
+
+void digest_sha256(const void *data, size_t len, uint8_t out[32]) {
+    struct sha256_ctx c;
+    sha256_init(&c);
+    sha256_update(&c, data, len);
+    sha256_final(&c, out);
+}
+
+// --- SHA-1 -----------------------------------------------------------------
+
+static void sha1_blocks(uint32_t s[5], const uint8_t *p, size_t nblocks) {
+    uint32_t w[80];
+    while (nblocks--) {
+        for (int i = 0; i < 16; i++) w[i] = be32(p + i * 4);
+        for (int i = 16; i < 80; i++) w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+            uint32_t t = rol32(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol32(b, 30); b = a; a = t;
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e;
+        p += 64;
+    }
+}
+
+void digest_sha1(const void *data, size_t len, uint8_t out[20]) {
+    uint32_t s[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    const uint8_t *p = data;
+    size_t nb = len / 64;
+    sha1_blocks(s, p, nb);
+    uint8_t tail[128];
+    size_t rem = len - nb * 64;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p + nb * 64, rem);
+    tail[rem] = 0x80;
+    size_t tlen = (rem < 56) ? 64 : 128;
+    put_be64(tail + tlen - 8, (uint64_t)len * 8);
+    sha1_blocks(s, tail, tlen / 64);
+    for (int i = 0; i < 5; i++) put_be32(out + i * 4, s[i]);
+}
+
+// --- SHA-384 (SHA-512 core) ------------------------------------------------
+
+static const uint64_t K512[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static void sha512_blocks(uint64_t s[8], const uint8_t *p, size_t nblocks) {
+    uint64_t w[80];
+    while (nblocks--) {
+        for (int i = 0; i < 16; i++) w[i] = be64(p + i * 8);
+        for (int i = 16; i < 80; i++) {
+            uint64_t s0 = ror64(w[i - 15], 1) ^ ror64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+            uint64_t s1 = ror64(w[i - 2], 19) ^ ror64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint64_t a = s[0], b = s[1], c = s[2], d = s[3];
+        uint64_t e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 80; i++) {
+            uint64_t t1 = h + (ror64(e, 14) ^ ror64(e, 18) ^ ror64(e, 41)) +
+                          ((e & f) ^ (~e & g)) + K512[i] + w[i];
+            uint64_t t2 = (ror64(a, 28) ^ ror64(a, 34) ^ ror64(a, 39)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+        p += 128;
+    }
+}
+
+void digest_sha384(const void *data, size_t len, uint8_t out[48]) {
+    uint64_t s[8] = {
+        0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+        0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+    };
+    const uint8_t *p = data;
+    size_t nb = len / 128;
+    sha512_blocks(s, p, nb);
+    uint8_t tail[256];
+    size_t rem = len - nb * 128;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p + nb * 128, rem);
+    tail[rem] = 0x80;
+    size_t tlen = (rem < 112) ? 128 : 256;
+    // 128-bit length; inputs here never exceed 2^61 bytes.
+    put_be64(tail + tlen - 8, (uint64_t)len * 8);
+    sha512_blocks(s, tail, tlen / 128);
+    for (int i = 0; i < 6; i++) put_be64(out + i * 8, s[i]);
+}
+
+size_t digest_cs(uint8_t hash_type, const void *data, size_t len,
+                 uint8_t out[DIGEST_MAX_LEN]) {
+    switch (hash_type) {
+        case CS_HASHTYPE_SHA1:
+            digest_sha1(data, len, out);
+            return 20;
+        case CS_HASHTYPE_SHA256:
+        case CS_HASHTYPE_SHA256_TRUNCATED:
+            digest_sha256(data, len, out);
+            return 32;
+        case CS_HASHTYPE_SHA384:
+            digest_sha384(data, len, out);
+            return 48;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef MACHO_DIGEST_H
+#define MACHO_DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Self-contained SHA-1 / SHA-256 / SHA-384 for code-signature work (no
+// OpenSSL/CommonCrypto dependency, so it builds the same on Arch and macOS).
+//
+// SHA-256 is the hot path for page hashing. It dispatches once to the x86
+// SHA extensions (SHA-NI, detected with CPUID at runtime) or the ARMv8
+// crypto extensions (compile-time, always present on Apple silicon), and
+// falls back to portable C.
+
+#define DIGEST_MAX_LEN 48
+
+struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t total;
+    uint8_t buf[64];
+    size_t buflen;
+};
+
+void sha256_init(struct sha256_ctx *c);
+void sha256_update(struct sha256_ctx *c, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *c, uint8_t out[32]);
+
+void digest_sha1(const void *data, size_t len, uint8_t out[20]);
+void digest_sha256(const void *data, size_t len, uint8_t out[32]);
+void digest_sha384(const void *data, size_t len, uint8_t out[48]);
+
+// Hash with a code-signature hash type (CS_HASHTYPE_*). Writes the full
+// digest and returns its length, or 0 for an unknown type.
+size_t digest_cs(uint8_t hash_type, const void *data, size_t len,
+                 uint8_t out[DIGEST_MAX_LEN]);
+
+// Name of the SHA-256 block function in use: "sha-ni", "armv8-crypto" or
+// "portable".
+const char *digest_sha256_impl(void);
+
+#endif /* MACHO_DIGEST_H */
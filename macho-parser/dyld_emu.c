@@ -0,0 +1,746 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE        // MAP_ANONYMOUS
+#endif
+
+#include "dyld_emu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/mach/machine.h"
+#include "../include/mach/vm_prot.h"
+#include "../include/macho/loader.h"
+#include "../include/macho/fixup-chains.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// The reservation starts on a 16 KB boundary (arm64 pages) so addresses
+// keep their offset within any host page up to that size.
+#define EMU_ALIGN 0x4000ull
+
+// Larger VM ranges are rejected rather than reserved.
+#define EMU_MAX_RANGE (1ull << 36)
+
+// Re-export chains deeper than this are treated as cycles.
+#define MAX_REEXPORT_DEPTH 32
+
+void dyld_emu_options_init(struct dyld_emu_options *o) {
+    memset(o, 0, sizeof(*o));
+    o->want_index = -1;
+}
+
+static uint64_t round_down(uint64_t v, uint64_t a) { return v & ~(a - 1); }
+static uint64_t round_up(uint64_t v, uint64_t a) { return (v + a - 1) & ~(a - 1); }
+
+static int host_prot(uint32_t vmprot, int no_exec) {
+    int p = PROT_NONE;
+    if (vmprot & VM_PROT_READ) p |= PROT_READ;
+    if (vmprot & VM_PROT_WRITE) p |= PROT_WRITE;
+    if ((vmprot & VM_PROT_EXECUTE) && !no_exec) p |= PROT_EXEC;
+    return p;
+}
+
+const char *dyld_emu_prot_name(int prot, char buf[4]) {
+    buf[0] = (prot & PROT_READ) ? 'r' : '-';
+    buf[1] = (prot & PROT_WRITE) ? 'w' : '-';
+    buf[2] = (prot & PROT_EXEC) ? 'x' : '-';
+    buf[3] = '\0';
+    return buf;
+}
+
+const char *dyld_emu_status_name(enum dyld_emu_bind_status s) {
+    switch (s) {
+        case DYLD_EMU_BOUND: return "bound";
+        case DYLD_EMU_CALLBACK: return "resolver";
+        case DYLD_EMU_WEAK_MISSING: return "weak-missing";
+        case DYLD_EMU_UNRESOLVED: return "unresolved";
+    }
+    return "?";
+}
+
+static struct dyld_emu_segment *find_seg(const struct dyld_emu_image *im, uint64_t vmaddr,
+                                         uint64_t len) {
+    for (size_t i = 0; i < im->nsegs; i++) {
+        struct dyld_emu_segment *s = &im->segs[i];
+        if (vmaddr >= s->vmaddr && vmaddr - s->vmaddr < s->vmsize &&
+            len <= s->vmsize - (vmaddr - s->vmaddr)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *dyld_emu_ptr(const struct dyld_emu_image *im, uint64_t vmaddr, uint64_t len) {
+    const struct dyld_emu_segment *s = find_seg(im, vmaddr, len);
+    return s && (s->prot & PROT_READ) ? s->host + (vmaddr - s->vmaddr) : NULL;
+}
+
+const struct dyld_emu_image *dyld_emu_owner(const struct dyld_emu_image *const *all,
+                                            size_t n, uint64_t addr) {
+    for (size_t i = 0; i < n; i++) {
+        if (!all[i] || !all[i]->base) continue;
+        uint64_t b = (uint64_t)(uintptr_t)all[i]->base;
+        if (addr >= b && addr - b < all[i]->reserved) return all[i];
+    }
+    return NULL;
+}
+
+// Symbol `name` as exported by `im`: its own exports (following re-export
+// entries to the library they name), then the libraries it re-exports with
+// LC_REEXPORT_DYLIB.
+static int lookup(const struct dyld_emu_image *im, const char *name, unsigned depth,
+                  uint64_t *addr, const struct dyld_emu_image **provider) {
+    if (!im || depth > MAX_REEXPORT_DEPTH) return 0;
+    const struct macho_export *e = macho_export_find(&im->exports, name);
+    if (e) {
+        if (!(e->flags & EXPORT_SYMBOL_FLAGS_REEXPORT)) {
+            if ((e->flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) == EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE) {
+                *addr = e->address;
+            } else {
+                // STUB_AND_RESOLVER: the stub, which calls the resolver
+                // on first use.
+                *addr = macho_image_base(&im->img) + e->address + im->slide;
+            }
+            *provider = im;
+            return 1;
+        }
+        uint32_t ord = e->reexport_ordinal;
+        if (ord < 1 || ord > im->link.ndylibs) return 0;
+        return lookup(im->deps[ord - 1], e->import_name ? e->import_name : name, depth + 1,
+                      addr, provider);
+    }
+    for (size_t k = 0; k < im->link.ndylibs; k++) {
+        if (im->link.dylibs[k].kind != DYLIB_REEXPORT) continue;
+        if (lookup(im->deps[k], name, depth + 1, addr, provider)) return 1;
+    }
+    return 0;
+}
+
+int dyld_emu_symbol(const struct dyld_emu_image *im, const char *name, uint64_t *addr) {
+    const struct dyld_emu_image *provider;
+    return lookup(im, name, 0, addr, &provider) ? 0 : -1;
+}
+
+struct load_ctx {
+    struct dyld_emu_image *im;
+    const struct dyld_emu_options *o;
+    uint64_t page;                  // host page size
+    uint8_t *file_pages;            // bitmap over the reservation
+    uint8_t *dirty;
+    size_t bind_cap;
+    const struct macho_chained_import *imports;
+    size_t nimports;
+    struct dyld_emu_bind *import_binds; // chained: each import resolved once, its addend added
+    uint8_t *import_done;
+    char *errbuf;
+    size_t errlen;
+};
+
+static void set_bit(uint8_t *map, uint64_t i) { map[i >> 3] |= (uint8_t)(1u << (i & 7)); }
+
+static uint64_t count_bits(const uint8_t *a, const uint8_t *b, size_t nbytes) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < nbytes; i++) {
+        uint8_t v = b ? (uint8_t)(a[i] & b[i]) : a[i];
+        while (v) {
+            v &= (uint8_t)(v - 1);
+            n++;
+        }
+    }
+    return n;
+}
+
+static void mark_dirty(struct load_ctx *c, const uint8_t *p, size_t len) {
+    uint64_t first = (uint64_t)(p - c->im->base) / c->page;
+    uint64_t last = (uint64_t)(p + len - 1 - c->im->base) / c->page;
+    for (uint64_t pg = first; pg <= last; pg++) set_bit(c->dirty, pg);
+}
+
+// Write a pointer of `width` bytes at unslid `vmaddr`.
+static int put(struct load_ctx *c, uint64_t vmaddr, uint64_t v, unsigned width) {
+    struct dyld_emu_segment *s = find_seg(c->im, vmaddr, width);
+    if (!s) {
+        snprintf(c->errbuf, c->errlen, "fixup at 0x%llx outside the mapped segments",
+                 (unsigned long long)vmaddr);
+        return -1;
+    }
+    uint8_t *p = s->host + (vmaddr - s->vmaddr);
+    if (width == 8) {
+        memcpy(p, &v, 8);
+    } else {
+        if (v >> 32) {
+            snprintf(c->errbuf, c->errlen, "32-bit pointer at 0x%llx does not fit 0x%llx",
+                     (unsigned long long)vmaddr, (unsigned long long)v);
+            return -1;
+        }
+        uint32_t w = (uint32_t)v;
+        memcpy(p, &w, 4);
+    }
+    mark_dirty(c, p, width);
+    return 0;
+}
+
+static int push_bind(struct load_ctx *c, const struct dyld_emu_bind *b) {
+    struct dyld_emu_image *im = c->im;
+    if (im->nbinds == c->bind_cap) {
+        size_t ncap = c->bind_cap ? c->bind_cap * 2 : 64;
+        struct dyld_emu_bind *n = realloc(im->binds, ncap * sizeof(*n));
+        if (!n) {
+            snprintf(c->errbuf, c->errlen, "out of memory");
+            return -1;
+        }
+        im->binds = n;
+        c->bind_cap = ncap;
+    }
+    im->binds[im->nbinds++] = *b;
+    im->stats.binds++;
+    return 0;
+}
+
+// Resolve `name` for library ordinal `ord` the way the bind stream asks:
+// the ordinal's stub image, the image itself, the main executable, or (flat
+// and weak lookups) all of them; then the caller's resolver. b->value gets
+// the symbol's address without any addend.
+static void resolve(struct load_ctx *c, const char *name, int32_t ord, int weak,
+                    struct dyld_emu_bind *b) {
+    const struct dyld_emu_image *im = c->im;
+    const struct dyld_emu_image *self = im;
+    const struct dyld_emu_image *main = im->main ? im->main : self;
+    uint64_t addr = 0;
+    const struct dyld_emu_image *provider = NULL;
+    int found = 0;
+    if (!(im->img.flags & MH_TWOLEVEL) && ord >= 1) ord = BIND_SPECIAL_DYLIB_FLAT_LOOKUP;
+    if (ord >= 1) {
+        if ((size_t)ord <= im->link.ndylibs) {
+            if (im->link.dylibs[ord - 1].kind == DYLIB_WEAK) weak = 1;
+            found = lookup(im->deps[ord - 1], name, 0, &addr, &provider);
+        }
+    } else if (ord == BIND_SPECIAL_DYLIB_SELF) {
+        found = lookup(self, name, 0, &addr, &provider);
+    } else if (ord == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE) {
+        found = lookup(main, name, 0, &addr, &provider);
+    } else {
+        found = lookup(self, name, 0, &addr, &provider) ||
+                lookup(main, name, 0, &addr, &provider);
+        for (size_t k = 0; k < im->link.ndylibs && !found; k++) {
+            found = lookup(im->deps[k], name, 0, &addr, &provider);
+        }
+        if (ord == BIND_SPECIAL_DYLIB_WEAK_LOOKUP) weak = 1;
+    }
+    b->name = name;
+    b->ordinal = ord;
+    b->provider = NULL;
+    if (found) {
+        b->status = DYLD_EMU_BOUND;
+        b->provider = provider;
+        b->value = addr;
+    } else if (c->o->resolve && c->o->resolve(c->o->resolve_ctx, name, ord, &addr) == 0) {
+        b->status = DYLD_EMU_CALLBACK;
+        b->value = addr;
+    } else if (weak) {
+        b->status = DYLD_EMU_WEAK_MISSING;
+        b->value = 0;
+    } else {
+        b->status = DYLD_EMU_UNRESOLVED;
+        b->value = c->o->unbound;
+    }
+}
+
+// Value for a resolved bind plus `addend`; missing symbols get their fixed
+// value whatever the addend.
+static uint64_t bind_value(const struct dyld_emu_bind *b, int64_t addend) {
+    if (b->status == DYLD_EMU_WEAK_MISSING || b->status == DYLD_EMU_UNRESOLVED) {
+        return b->value;
+    }
+    return b->value + (uint64_t)addend;
+}
+
+static void count_bind(struct dyld_emu_image *im, const struct dyld_emu_bind *b) {
+    if (b->status == DYLD_EMU_UNRESOLVED) im->stats.unresolved++;
+    if (b->status == DYLD_EMU_WEAK_MISSING) im->stats.weak_missing++;
+}
+
+static int on_chained(void *ctx, const struct macho_chained_fixup *f) {
+    struct load_ctx *c = ctx;
+    struct dyld_emu_image *im = c->im;
+    if (!im->chained_format) im->chained_format = f->format;
+    struct macho_chained_target t;
+    if (macho_chained_decode(f, macho_image_base(&im->img), &t) != 0) {
+        snprintf(c->errbuf, c->errlen, "chained pointer format %u is not applied", f->format);
+        return -1;
+    }
+    if (t.plain) return 0;
+    if (t.auth) im->stats.auth_stripped++;
+    if (!f->bind) {
+        uint64_t v = t.target + im->slide;
+        if (!t.auth) v |= (uint64_t)t.high8 << 56;
+        im->stats.rebases++;
+        return put(c, f->vmaddr, v, f->width);
+    }
+    if (t.import >= c->nimports) {
+        snprintf(c->errbuf, c->errlen, "chained bind at 0x%llx names import %u of %zu",
+                 (unsigned long long)f->vmaddr, t.import, c->nimports);
+        return -1;
+    }
+    struct dyld_emu_bind *ib = &c->import_binds[t.import];
+    if (!c->import_done[t.import]) {
+        const struct macho_chained_import *imp = &c->imports[t.import];
+        resolve(c, imp->name, imp->ordinal, imp->weak_import, ib);
+        ib->value = bind_value(ib, imp->addend);
+        c->import_done[t.import] = 1;
+    }
+    struct dyld_emu_bind b = *ib;
+    b.vmaddr = f->vmaddr;
+    b.value = bind_value(ib, t.addend);
+    count_bind(im, &b);
+    if (push_bind(c, &b) != 0) return -1;
+    return put(c, f->vmaddr, b.value, f->width);
+}
+
+static int on_rebase(void *ctx, uint32_t seg, uint64_t offset) {
+    struct load_ctx *c = ctx;
+    struct dyld_emu_image *im = c->im;
+    unsigned width = im->img.is64 ? 8 : 4;
+    uint64_t vmaddr = im->img.segs[seg].vmaddr + offset;
+    const struct dyld_emu_segment *s = find_seg(im, vmaddr, width);
+    if (!s) {
+        snprintf(c->errbuf, c->errlen, "rebase at 0x%llx outside the mapped segments",
+                 (unsigned long long)vmaddr);
+        return -1;
+    }
+    const uint8_t *p = s->host + (vmaddr - s->vmaddr);
+    uint64_t v = 0;
+    if (width == 8) {
+        memcpy(&v, p, 8);
+        v += im->slide;
+    } else {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        v = (uint64_t)w + im->slide;
+    }
+    im->stats.rebases++;
+    return put(c, vmaddr, v, width);
+}
+
+static int apply_bind(struct load_ctx *c, const char *name, int32_t ordinal, unsigned flags,
+                      int64_t addend, uint32_t seg, uint64_t offset) {
+    struct dyld_emu_image *im = c->im;
+    if (seg == MACHO_NO_SEGMENT) {
+        snprintf(c->errbuf, c->errlen, "threaded binds are not applied");
+        return -1;
+    }
+    struct dyld_emu_bind b;
+    resolve(c, name, ordinal, (flags & BIND_SYMBOL_FLAGS_WEAK_IMPORT) != 0, &b);
+    b.vmaddr = im->img.segs[seg].vmaddr + offset;
+    b.value = bind_value(&b, addend);
+    count_bind(im, &b);
+    if (push_bind(c, &b) != 0) return -1;
+    return put(c, b.vmaddr, b.value, im->img.is64 ? 8 : 4);
+}
+
+static int on_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                   int64_t addend, uint32_t seg, uint64_t offset) {
+    return apply_bind(ctx, name, ordinal, flags, addend, seg, offset);
+}
+
+static int on_lazy_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                        int64_t addend, uint32_t seg, uint64_t offset) {
+    struct load_ctx *c = ctx;
+    c->im->stats.lazy_binds++;
+    return apply_bind(ctx, name, ordinal, flags, addend, seg, offset);
+}
+
+static int on_weak_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                        int64_t addend, uint32_t seg, uint64_t offset) {
+    struct load_ctx *c = ctx;
+    (void)name;
+    (void)ordinal;
+    (void)addend;
+    (void)seg;
+    (void)offset;
+    if (!(flags & BIND_SYMBOL_FLAGS_NON_WEAK_DEFINITION)) c->im->stats.weak_defs++;
+    return 0;
+}
+
+static int apply_fixups(struct load_ctx *c) {
+    struct dyld_emu_image *im = c->im;
+    const struct macho_image *img = &im->img;
+    uint32_t size;
+    if (macho_image_linkedit(img, LC_DYLD_CHAINED_FIXUPS, &size)) {
+        im->fixups = "chained";
+        struct macho_chained_import *imports = NULL;
+        size_t n = 0;
+        if (macho_chained_imports(img, &imports, &n, c->errbuf, c->errlen) != 0) return -1;
+        c->imports = imports;
+        c->nimports = n;
+        c->import_binds = calloc(n ? n : 1, sizeof(*c->import_binds));
+        c->import_done = calloc(n ? n : 1, 1);
+        int rc = -1;
+        if (!c->import_binds || !c->import_done) {
+            snprintf(c->errbuf, c->errlen, "out of memory");
+        } else {
+            rc = macho_chained_walk(img, on_chained, c, c->errbuf, c->errlen) != 0 ? -1 : 0;
+        }
+        free(c->import_binds);
+        free(c->import_done);
+        free(imports);
+        c->imports = NULL;
+        return rc;
+    }
+    size_t it = 0;
+    if (!macho_image_next_cmd(img, LC_DYLD_INFO_ONLY, &it)) {
+        it = 0;
+        if (!macho_image_next_cmd(img, LC_DYLD_INFO, &it)) {
+            im->fixups = "none";
+            return 0;
+        }
+    }
+    im->fixups = "opcodes";
+    if (macho_rebase_walk(img, on_rebase, c, c->errbuf, c->errlen) != 0 ||
+        macho_bind_walk(img, MACHO_BIND, on_bind, c, c->errbuf, c->errlen) != 0 ||
+        macho_bind_walk(img, MACHO_BIND_LAZY, on_lazy_bind, c, c->errbuf, c->errlen) != 0 ||
+        macho_bind_walk(img, MACHO_BIND_WEAK, on_weak_bind, c, c->errbuf, c->errlen) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Reserve [vm_start, vm_end) + slide as one PROT_NONE range. Without a fixed
+// slide the kernel picks the place, over-allocated by EMU_ALIGN and trimmed
+// so the start is aligned. 32-bit images must land below 4 GB: the slide is
+// stored in 4-byte pointers.
+static int reserve(struct dyld_emu_image *im, const struct dyld_emu_options *o,
+                   uint64_t page, char *errbuf, size_t errlen) {
+    size_t len = (size_t)(im->vm_end - im->vm_start);
+    uint8_t *p;
+    if (o->fixed || !im->img.is64) {
+        uint64_t want = o->fixed ? im->vm_start + o->slide : im->vm_start;
+        if (!o->fixed && want < 0x10000000ull) want = 0x10000000ull;
+        if (want % page) {
+            snprintf(errbuf, errlen, "slide 0x%llx is not page-aligned",
+                     (unsigned long long)o->slide);
+            return -1;
+        }
+        void *m = mmap((void *)(uintptr_t)want, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+        if (m == MAP_FAILED) {
+            snprintf(errbuf, errlen, "reserve %zu bytes: %s", len, strerror(errno));
+            return -1;
+        }
+        if ((uint64_t)(uintptr_t)m != want ||
+            (!im->img.is64 && want + len > 0x100000000ull)) {
+            munmap(m, len);
+            snprintf(errbuf, errlen, "0x%llx is not available for the image",
+                     (unsigned long long)want);
+            return -1;
+        }
+        p = m;
+    } else {
+        size_t over = len + (size_t)EMU_ALIGN;
+        void *m = mmap(NULL, over, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            snprintf(errbuf, errlen, "reserve %zu bytes: %s", len, strerror(errno));
+            return -1;
+        }
+        uint8_t *raw = m;
+        p = (uint8_t *)(uintptr_t)round_up((uint64_t)(uintptr_t)raw, EMU_ALIGN);
+        if (p > raw) munmap(raw, (size_t)(p - raw));
+        if (raw + over > p + len) munmap(p + len, (size_t)(raw + over - (p + len)));
+    }
+    im->base = p;
+    im->reserved = len;
+    im->slide = (uint64_t)(uintptr_t)p - im->vm_start;
+    return 0;
+}
+
+static int map_segments(struct dyld_emu_image *im, struct load_ctx *c, int fd,
+                        char *errbuf, size_t errlen) {
+    uint64_t page = c->page;
+    for (size_t i = 0; i < im->nsegs; i++) {
+        struct dyld_emu_segment *s = &im->segs[i];
+        s->host = im->base + (s->vmaddr - im->vm_start);
+        uint8_t *lo = im->base + round_down((uint64_t)(s->host - im->base), page);
+        uint8_t *hi = im->base + round_up((uint64_t)(s->host - im->base) + s->vmsize, page);
+        if (mprotect(lo, (size_t)(hi - lo), PROT_READ | PROT_WRITE) != 0) {
+            snprintf(errbuf, errlen, "%s: mprotect: %s", s->name, strerror(errno));
+            return -1;
+        }
+        if (s->file_bytes == 0) continue;
+        uint64_t fo = im->slice_offset + s->fileoff;
+        if ((uint64_t)(uintptr_t)s->host % page == 0 && fo % page == 0) {
+            size_t mlen = (size_t)round_up(s->file_bytes, page);
+            void *r = mmap(s->host, mlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+                           (off_t)fo);
+            if (r == MAP_FAILED) {
+                snprintf(errbuf, errlen, "%s: mmap: %s", s->name, strerror(errno));
+                return -1;
+            }
+            uint64_t first = (uint64_t)(s->host - im->base) / page;
+            for (uint64_t pg = 0; pg < mlen / page; pg++) set_bit(c->file_pages, first + pg);
+            // The last page carries whatever follows the segment in the
+            // file; clear it only if that is not already zero.
+            uint8_t *tail = s->host + s->file_bytes;
+            size_t ntail = mlen - (size_t)s->file_bytes;
+            for (size_t k = 0; k < ntail; k++) {
+                if (tail[k]) {
+                    memset(tail, 0, ntail);
+                    mark_dirty(c, tail, ntail);
+                    break;
+                }
+            }
+        } else {
+            memcpy(s->host, im->mf.data + fo, (size_t)s->file_bytes);
+            s->copied = 1;
+        }
+    }
+    return 0;
+}
+
+static void protect_segments(struct dyld_emu_image *im, const struct dyld_emu_options *o,
+                             uint64_t page) {
+    for (size_t i = 0; i < im->nsegs; i++) {
+        struct dyld_emu_segment *s = &im->segs[i];
+        uint8_t *lo = im->base + round_down((uint64_t)(s->host - im->base), page);
+        uint8_t *hi = im->base + round_up((uint64_t)(s->host - im->base) + s->vmsize, page);
+        int prot = host_prot(s->initprot, o->no_exec);
+        if (s->flags & SG_READ_ONLY) prot &= ~PROT_WRITE;
+        if (mprotect(lo, (size_t)(hi - lo), prot) != 0 && (prot & PROT_EXEC)) {
+            // noexec mounts and hardened kernels refuse executable
+            // private file mappings; the bytes are still readable.
+            prot &= ~PROT_EXEC;
+            if (mprotect(lo, (size_t)(hi - lo), prot) == 0) im->exec_denied = 1;
+        }
+        s->prot = prot;
+    }
+}
+
+// Segments that take address space, sorted by vmaddr and checked not to
+// overlap. __PAGEZERO (no file bytes, no access) is left out, as it is only
+// a guard below the image.
+static int collect_segments(struct dyld_emu_image *im, uint64_t page, char *errbuf,
+                            size_t errlen) {
+    const struct macho_image *img = &im->img;
+    im->segs = calloc(img->nsegs ? img->nsegs : 1, sizeof(*im->segs));
+    if (!im->segs) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *m = &img->segs[i];
+        if (m->vmsize == 0 || (m->filesize == 0 && m->initprot == 0)) continue;
+        if (m->vmaddr + m->vmsize < m->vmaddr) {
+            snprintf(errbuf, errlen, "%s wraps around the address space", m->name);
+            return -1;
+        }
+        uint64_t fsize = m->filesize < m->vmsize ? m->filesize : m->vmsize;
+        if (m->fileoff > img->size || fsize > img->size - m->fileoff) {
+            snprintf(errbuf, errlen, "%s extends beyond the file", m->name);
+            return -1;
+        }
+        size_t j = im->nsegs++;
+        while (j > 0 && im->segs[j - 1].vmaddr > m->vmaddr) {
+            im->segs[j] = im->segs[j - 1];
+            j--;
+        }
+        struct dyld_emu_segment *s = &im->segs[j];
+        memset(s, 0, sizeof(*s));
+        memcpy(s->name, m->name, sizeof(s->name));
+        s->vmaddr = m->vmaddr;
+        s->vmsize = m->vmsize;
+        s->fileoff = m->fileoff;
+        s->file_bytes = fsize;
+        s->initprot = m->initprot;
+        s->flags = m->flags;
+    }
+    if (im->nsegs == 0) {
+        snprintf(errbuf, errlen, "no segments to map");
+        return -1;
+    }
+    for (size_t i = 1; i < im->nsegs; i++) {
+        if (im->segs[i - 1].vmaddr + im->segs[i - 1].vmsize > im->segs[i].vmaddr) {
+            snprintf(errbuf, errlen, "segments %s and %s overlap", im->segs[i - 1].name,
+                     im->segs[i].name);
+            return -1;
+        }
+    }
+    const struct dyld_emu_segment *last = &im->segs[im->nsegs - 1];
+    im->vm_start = round_down(im->segs[0].vmaddr, EMU_ALIGN);
+    im->vm_end = round_up(last->vmaddr + last->vmsize, page);
+    if (im->vm_end < im->vm_start || im->vm_end - im->vm_start > EMU_MAX_RANGE ||
+        (!img->is64 && im->vm_end > 0x100000000ull)) {
+        snprintf(errbuf, errlen, "VM range 0x%llx-0x%llx is too large",
+                 (unsigned long long)im->vm_start, (unsigned long long)last->vmaddr);
+        return -1;
+    }
+    return 0;
+}
+
+int dyld_emu_load(const char *path, const struct dyld_emu_options *o,
+                  struct dyld_emu_image *im, char *errbuf, size_t errlen) {
+    memset(im, 0, sizeof(*im));
+    im->fixups = "none";
+    im->path = strdup(path);
+    if (!im->path) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        dyld_emu_unload(im);
+        return -1;
+    }
+    struct load_ctx c;
+    memset(&c, 0, sizeof(c));
+    c.im = im;
+    c.o = o;
+    c.errbuf = errbuf;
+    c.errlen = errlen;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    c.page = pagesize > 0 ? (uint64_t)pagesize : 4096;
+
+    struct stat st;
+    uint64_t off = 0;
+    uint64_t size = 0;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        snprintf(errbuf, errlen, "%s: not a regular non-empty file", path);
+        goto fail;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        snprintf(errbuf, errlen, "%s: mmap: %s", path, strerror(errno));
+        goto fail;
+    }
+    im->mf.data = m;
+    im->mf.size = (size_t)st.st_size;
+    if (macho_select_slice(im->mf.data, im->mf.size, o->want_index, o->cputype, &off, &size,
+                           errbuf, errlen) != 0 ||
+        macho_image_load(&im->img, im->mf.data + off, (size_t)size, errbuf, errlen) != 0) {
+        goto fail;
+    }
+    im->slice_offset = off;
+    if (im->img.swapped) {
+        snprintf(errbuf, errlen, "byte-swapped images are not mapped");
+        goto fail;
+    }
+    if (macho_link_info(&im->img, &im->link, errbuf, errlen) != 0 ||
+        macho_exports(&im->img, &im->exports, errbuf, errlen) != 0) {
+        goto fail;
+    }
+    im->deps = calloc(im->link.ndylibs ? im->link.ndylibs : 1, sizeof(*im->deps));
+    if (!im->deps) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto fail;
+    }
+    for (size_t k = 0; k < im->link.ndylibs && k < o->ndeps && o->deps; k++) {
+        im->deps[k] = o->deps[k];
+    }
+    im->main = o->main;
+
+    if (collect_segments(im, c.page, errbuf, errlen) != 0 ||
+        reserve(im, o, c.page, errbuf, errlen) != 0) {
+        goto fail;
+    }
+    size_t npages = (size_t)(im->reserved / c.page);
+    size_t mapbytes = npages / 8 + 1;
+    c.file_pages = calloc(mapbytes, 1);
+    c.dirty = calloc(mapbytes, 1);
+    if (!c.file_pages || !c.dirty) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto fail;
+    }
+    if (map_segments(im, &c, fd, errbuf, errlen) != 0) goto fail;
+    close(fd);
+    fd = -1;
+    if (apply_fixups(&c) != 0) goto fail;
+    protect_segments(im, o, c.page);
+    im->stats.file_pages = count_bits(c.file_pages, NULL, mapbytes);
+    im->stats.dirty_pages = count_bits(c.file_pages, c.dirty, mapbytes);
+    free(c.file_pages);
+    free(c.dirty);
+    return 0;
+fail:
+    if (fd >= 0) close(fd);
+    free(c.file_pages);
+    free(c.dirty);
+    dyld_emu_unload(im);
+    return -1;
+}
+
+void dyld_emu_unload(struct dyld_emu_image *im) {
+    if (im->base) munmap(im->base, im->reserved);
+    free(im->binds);
+    free(im->segs);
+    free(im->deps);
+    macho_export_list_free(&im->exports);
+    macho_link_info_free(&im->link);
+    macho_image_free(&im->img);
+    unmap_file(&im->mf);
+    free(im->path);
+    memset(im, 0, sizeof(*im));
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+void dyld_emu_print(const struct dyld_emu_image *im, const struct dyld_emu_image *const *all,
+                    size_t nall, int list_only) {
+    char pbuf[4];
+    printf("%s: mapped at 0x%llx-0x%llx, slide 0x%llx%s\n", im->path,
+           (unsigned long long)(uintptr_t)im->base,
+           (unsigned long long)((uintptr_t)im->base + im->reserved),
+           (unsigned long long)im->slide, im->exec_denied ? " (exec denied)" : "");
+    printf("  %-16s %-18s %-18s %10s %10s  %s\n", "SEGMENT", "VMADDR", "HOST", "VMSIZE",
+           "FILE", "PROT");
+    for (size_t i = 0; i < im->nsegs; i++) {
+        const struct dyld_emu_segment *s = &im->segs[i];
+        printf("  %-16s 0x%016llx 0x%016llx %10llu %10llu  %s%s\n", s->name,
+               (unsigned long long)s->vmaddr, (unsigned long long)(uintptr_t)s->host,
+               (unsigned long long)s->vmsize, (unsigned long long)s->file_bytes,
+               dyld_emu_prot_name(s->prot, pbuf), s->copied ? " copied" : "");
+    }
+    const struct dyld_emu_stats *st = &im->stats;
+    printf("  fixups: %s", im->fixups);
+    if (im->chained_format) printf(" (pointer format %u)", im->chained_format);
+    printf(", %llu rebases, %llu binds (%llu lazy), %llu unresolved, %llu weak-missing",
+           (unsigned long long)st->rebases, (unsigned long long)st->binds,
+           (unsigned long long)st->lazy_binds, (unsigned long long)st->unresolved,
+           (unsigned long long)st->weak_missing);
+    if (st->auth_stripped) printf(", %llu auth stripped", (unsigned long long)st->auth_stripped);
+    if (st->weak_defs) printf(", %llu weak defs not coalesced", (unsigned long long)st->weak_defs);
+    printf("\n  pages: %llu mapped from the file, %llu copied by fixups\n",
+           (unsigned long long)st->file_pages, (unsigned long long)st->dirty_pages);
+
+    unsigned width = im->img.is64 ? 8 : 4;
+    for (size_t i = 0; i < im->nbinds; i++) {
+        const struct dyld_emu_bind *b = &im->binds[i];
+        if (list_only && b->status != DYLD_EMU_UNRESOLVED) continue;
+        const uint8_t *p = dyld_emu_ptr(im, b->vmaddr, width);
+        uint64_t v = 0;
+        if (p && width == 8) {
+            memcpy(&v, p, 8);
+        } else if (p) {
+            uint32_t w;
+            memcpy(&w, p, 4);
+            v = w;
+        }
+        printf("    0x%llx  %-12s %-32s 0x%llx", (unsigned long long)b->vmaddr,
+               dyld_emu_status_name(b->status), b->name, (unsigned long long)v);
+        const struct dyld_emu_image *owner = dyld_emu_owner(all, nall, v);
+        if (owner) {
+            printf("  %s+0x%llx", base_name(owner->path),
+                   (unsigned long long)(v - owner->slide - macho_image_base(&owner->img)));
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef MACHO_DYLD_EMU_H
+#define MACHO_DYLD_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "corpus.h"
+#include "dyld_info.h"
+#include "macho_image.h"
+
+// Maps a Mach-O image into this process the way dyld would, without running
+// it: segments at vmaddr + slide with their initprot, rebases slid, binds
+// pointing at the images that define the symbols. Passes that want the
+// image as the loader sees it (pointers already followed, GOT slots filled)
+// then read memory instead of decoding fixups themselves.
+//
+// Protections are applied once the fixups are written: initprot, without
+// write access for SG_READ_ONLY segments (__DATA_CONST).
+//
+// The whole VM range is reserved first (PROT_NONE, anonymous), so the slide
+// is one number. File-backed segments are mapped over it MAP_PRIVATE from
+// the file: nothing is read until touched, and only pages a fixup writes to
+// get copied. Zero-fill is the anonymous reservation itself. A segment whose
+// file offset and address are not page-aligned on this host is read into
+// the reservation instead.
+//
+// Fixups come from LC_DYLD_CHAINED_FIXUPS, else from the rebase and bind
+// opcodes of LC_DYLD_INFO(_ONLY); lazy binds are bound at load, as with
+// DYLD_BIND_AT_LAUNCH. arm64e pointers are written stripped (there is no
+// key to sign them with). Weak-definition coalescing and threaded binds are
+// not applied. Binds are resolved against stub images, dyld_emu_images
+// loaded earlier and passed by library ordinal, then against the caller's
+// resolver; anything left gets `unbound` (weak imports get 0).
+
+typedef int (*dyld_emu_resolve_fn)(void *ctx, const char *name, int32_t ordinal,
+                                   uint64_t *addr);
+
+struct dyld_emu_image;
+
+struct dyld_emu_options {
+    int want_index;                 // slice by position, -1 = by cputype
+    uint32_t cputype;               // 0 = arm64 if present, else the first slice
+    int fixed;                      // map at exactly vmaddr + slide or fail
+    uint64_t slide;
+    int no_exec;                    // never ask for PROT_EXEC
+    const struct dyld_emu_image *const *deps;   // library ordinal k is deps[k - 1]; may be NULL
+    size_t ndeps;
+    const struct dyld_emu_image *main;          // BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE (NULL = itself)
+    dyld_emu_resolve_fn resolve;    // asked when no stub image defines a symbol
+    void *resolve_ctx;
+    uint64_t unbound;               // value for non-weak binds nothing resolves
+};
+
+void dyld_emu_options_init(struct dyld_emu_options *o);
+
+struct dyld_emu_segment {
+    char name[17];
+    uint64_t vmaddr;                // unslid
+    uint64_t vmsize;
+    uint8_t *host;                  // vmaddr + slide
+    uint64_t fileoff;               // in the slice
+    uint64_t file_bytes;            // backed by the file, the rest is zero-fill
+    uint32_t initprot;              // VM_PROT_*
+    uint32_t flags;                 // SG_*
+    int prot;                       // PROT_* actually applied
+    int copied;                     // read in rather than mapped
+};
+
+enum dyld_emu_bind_status {
+    DYLD_EMU_BOUND,                 // a stub image exports it
+    DYLD_EMU_CALLBACK,              // options.resolve supplied it
+    DYLD_EMU_WEAK_MISSING,          // weak import or weak library: 0
+    DYLD_EMU_UNRESOLVED,            // options.unbound
+};
+
+struct dyld_emu_bind {
+    uint64_t vmaddr;                // of the pointer, unslid
+    const char *name;               // points into the image
+    int32_t ordinal;
+    enum dyld_emu_bind_status status;
+    const struct dyld_emu_image *provider;      // DYLD_EMU_BOUND only
+    uint64_t value;                 // what was written, addend included
+};
+
+struct dyld_emu_stats {
+    uint64_t rebases;
+    uint64_t binds;                 // == nbinds
+    uint64_t lazy_binds;            // of binds, from the lazy stream
+    uint64_t unresolved;            // non-weak binds left at `unbound`
+    uint64_t weak_missing;
+    uint64_t auth_stripped;         // arm64e pointers written unsigned
+    uint64_t weak_defs;             // weak-definition binds, not applied
+    uint64_t file_pages;            // host pages mapped from the file
+    uint64_t dirty_pages;           // of those, copied because a fixup wrote to them
+};
+
+struct dyld_emu_image {
+    char *path;
+    struct mapped_file mf;          // whole file, read-only: load commands, __LINKEDIT
+    uint64_t slice_offset;
+    struct macho_image img;         // the slice, in mf
+    struct macho_link_info link;
+    struct macho_export_list exports;
+    const struct dyld_emu_image **deps; // [link.ndylibs], copied from the options
+    const struct dyld_emu_image *main;
+
+    uint8_t *base;                  // reservation: [vm_start, vm_end) + slide
+    size_t reserved;
+    uint64_t vm_start;
+    uint64_t vm_end;
+    uint64_t slide;                 // host address - vmaddr (mod 2^64)
+    int exec_denied;                // PROT_EXEC was refused, code is mapped without it
+
+    struct dyld_emu_segment *segs;
+    size_t nsegs;
+
+    const char *fixups;             // "chained", "opcodes" or "none"
+    uint16_t chained_format;        // DYLD_CHAINED_PTR_* of the first chained fixup
+    struct dyld_emu_bind *binds;    // in fixup order
+    size_t nbinds;
+    struct dyld_emu_stats stats;
+};
+
+// Map `path`. Returns 0, or -1 with a reason in errbuf (nothing stays
+// mapped). Binds that resolve to nothing do not fail the load.
+int dyld_emu_load(const char *path, const struct dyld_emu_options *o,
+                  struct dyld_emu_image *im, char *errbuf, size_t errlen);
+void dyld_emu_unload(struct dyld_emu_image *im);
+
+// Host memory for [vmaddr, vmaddr + len) if it lies inside one mapped,
+// readable segment, else NULL.
+const uint8_t *dyld_emu_ptr(const struct dyld_emu_image *im, uint64_t vmaddr, uint64_t len);
+
+// Host address of an exported symbol, following re-exports into stub
+// images. Returns 0 when found.
+int dyld_emu_symbol(const struct dyld_emu_image *im, const char *name, uint64_t *addr);
+
+// Image among `all` whose reservation holds host address `addr`, or NULL.
+const struct dyld_emu_image *dyld_emu_owner(const struct dyld_emu_image *const *all,
+                                            size_t n, uint64_t addr);
+
+// "r-x" style rendering of PROT_* bits into buf[4].
+const char *dyld_emu_prot_name(int prot, char buf[4]);
+
+const char *dyld_emu_status_name(enum dyld_emu_bind_status s);
+
+// Segment mapping, fixup counts, then every bind with the pointer as read
+// back from memory and the image it lands in (one of `all`). With list_only
+// only the unresolved binds are listed.
+void dyld_emu_print(const struct dyld_emu_image *im, const struct dyld_emu_image *const *all,
+                    size_t nall, int list_only);
+
+#endif /* MACHO_DYLD_EMU_H */
@@ -0,0 +1,949 @@
+#include "dyld_info.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/nlist.h"
+#include "../include/macho/fixup-chains.h"
+
+#include "macho_common.h"
+
+// Length of the string at `off` inside a load command, bounded by the
+// command. Returns -1 if the offset is outside it.
+static long lc_strlen(const uint8_t *cmd, uint32_t cmdsize, uint32_t off) {
+    if (off >= cmdsize) return -1;
+    const uint8_t *s = cmd + off;
+    const uint8_t *nul = memchr(s, '\0', cmdsize - off);
+    return nul ? (long)(nul - s) : (long)(cmdsize - off);
+}
+
+static int dylib_kind(uint32_t cmd, enum macho_dylib_kind *kind) {
+    switch (cmd) {
+        case LC_LOAD_DYLIB: *kind = DYLIB_LOAD; return 1;
+        case LC_LOAD_WEAK_DYLIB: *kind = DYLIB_WEAK; return 1;
+        case LC_REEXPORT_DYLIB: *kind = DYLIB_REEXPORT; return 1;
+        case LC_LOAD_UPWARD_DYLIB: *kind = DYLIB_UPWARD; return 1;
+        case LC_LAZY_LOAD_DYLIB: *kind = DYLIB_LAZY; return 1;
+        default: return 0;
+    }
+}
+
+int macho_link_info(const struct macho_image *img, struct macho_link_info *out,
+                    char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    int sw = img->swapped;
+
+    // Two passes: size the string pool, then fill it.
+    size_t ndylibs = 0;
+    size_t nrpaths = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        const uint8_t *p = img->buf + lc->offset;
+        enum macho_dylib_kind kind;
+        long len = -1;
+        if ((dylib_kind(lc->cmd, &kind) || lc->cmd == LC_ID_DYLIB) &&
+            lc->cmdsize >= sizeof(struct dylib_command)) {
+            len = lc_strlen(p, lc->cmdsize, load32_u(p + 8, sw));
+            if (lc->cmd != LC_ID_DYLIB) ndylibs++;
+        } else if (lc->cmd == LC_RPATH && lc->cmdsize >= sizeof(struct rpath_command)) {
+            len = lc_strlen(p, lc->cmdsize, load32_u(p + 8, sw));
+            nrpaths++;
+        }
+        if (len >= 0) bytes += (size_t)len + 1;
+    }
+
+    out->dylibs = calloc(ndylibs ? ndylibs : 1, sizeof(*out->dylibs));
+    out->rpaths = calloc(nrpaths ? nrpaths : 1, sizeof(*out->rpaths));
+    out->strings = malloc(bytes ? bytes : 1);
+    if (!out->dylibs || !out->rpaths || !out->strings) {
+        macho_link_info_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    char *s = out->strings;
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        const uint8_t *p = img->buf + lc->offset;
+        enum macho_dylib_kind kind;
+        int is_dylib = dylib_kind(lc->cmd, &kind);
+        if ((is_dylib || lc->cmd == LC_ID_DYLIB) &&
+            lc->cmdsize >= sizeof(struct dylib_command)) {
+            uint32_t off = load32_u(p + 8, sw);
+            long len = lc_strlen(p, lc->cmdsize, off);
+            const char *name = "";
+            if (len >= 0) {
+                memcpy(s, p + off, (size_t)len);
+                s[len] = '\0';
+                name = s;
+                s += len + 1;
+            }
+            if (!is_dylib) {
+                out->install_name = name;
+                continue;
+            }
+            struct macho_dylib *d = &out->dylibs[out->ndylibs++];
+            d->name = name;
+            d->kind = kind;
+            d->current_version = load32_u(p + 16, sw);
+            d->compat_version = load32_u(p + 20, sw);
+        } else if (lc->cmd == LC_RPATH && lc->cmdsize >= sizeof(struct rpath_command)) {
+            uint32_t off = load32_u(p + 8, sw);
+            long len = lc_strlen(p, lc->cmdsize, off);
+            if (len < 0) continue;
+            memcpy(s, p + off, (size_t)len);
+            s[len] = '\0';
+            out->rpaths[out->nrpaths++] = s;
+            s += len + 1;
+        }
+    }
+    return 0;
+}
+
+void macho_link_info_free(struct macho_link_info *li) {
+    free(li->dylibs);
+    free(li->rpaths);
+    free(li->strings);
+    memset(li, 0, sizeof(*li));
+}
+
+struct import_vec {
+    struct macho_import *v;
+    size_t n;
+    size_t cap;
+};
+
+static int push_import(struct import_vec *iv, const char *name, int32_t ordinal, int weak,
+                       int lazy) {
+    if (iv->n == iv->cap) {
+        size_t cap = iv->cap ? iv->cap * 2 : 64;
+        struct macho_import *v = realloc(iv->v, cap * sizeof(*v));
+        if (!v) return -1;
+        iv->v = v;
+        iv->cap = cap;
+    }
+    struct macho_import *im = &iv->v[iv->n++];
+    im->name = name;
+    im->ordinal = ordinal;
+    im->weak_import = (uint8_t)(weak != 0);
+    im->lazy = (uint8_t)(lazy != 0);
+    return 0;
+}
+
+// LC_DYLD_INFO(_ONLY) opcode stream at `field` of the command (rebase +8,
+// bind +16, weak bind +24, lazy bind +32). *p is NULL when the command or
+// the stream is absent.
+static int dyld_info_stream(const struct macho_image *img, unsigned field,
+                            const uint8_t **p, const uint8_t **end,
+                            char *errbuf, size_t errlen) {
+    *p = *end = NULL;
+    size_t it = 0;
+    const struct macho_lc_ref *di = macho_image_next_cmd(img, LC_DYLD_INFO_ONLY, &it);
+    if (!di) {
+        it = 0;
+        di = macho_image_next_cmd(img, LC_DYLD_INFO, &it);
+    }
+    if (!di || di->cmdsize < sizeof(struct dyld_info_command)) return 0;
+    const uint8_t *cmd = img->buf + di->offset;
+    uint32_t off = load32_u(cmd + field, img->swapped);
+    uint32_t size = load32_u(cmd + field + 4, img->swapped);
+    if (size == 0) return 0;
+    if ((uint64_t)off + size > img->size) {
+        snprintf(errbuf, errlen, "LC_DYLD_INFO opcodes out of bounds");
+        return -1;
+    }
+    *p = img->buf + off;
+    *end = *p + size;
+    return 0;
+}
+
+// Opcodes repeating more pointers than this are rejected: no segment
+// holds that many, and a fuzzed count would otherwise spin for hours.
+#define MAX_OPCODE_REPEAT (1u << 24)
+
+// `count` pointers of `ptr` bytes starting at `off` in segment `seg`, each
+// followed by a gap of `skip`, all lie inside the segment.
+static int locations_ok(const struct macho_image *img, uint64_t seg, uint64_t off,
+                        uint64_t count, uint64_t skip, unsigned ptr) {
+    if (seg >= img->nsegs || count > MAX_OPCODE_REPEAT) return 0;
+    uint64_t vmsize = img->segs[seg].vmsize;
+    if (off > vmsize || vmsize - off < ptr || skip > vmsize) return 0;
+    uint64_t step = ptr + skip;
+    return count <= 1 || count - 1 <= (vmsize - off - ptr) / step;
+}
+
+int macho_bind_walk(const struct macho_image *img, enum macho_bind_kind kind,
+                    macho_bind_fn fn, void *ctx, char *errbuf, size_t errlen) {
+    const uint8_t *p;
+    const uint8_t *end;
+    unsigned field = kind == MACHO_BIND_LAZY ? 32 : kind == MACHO_BIND_WEAK ? 24 : 16;
+    if (dyld_info_stream(img, field, &p, &end, errbuf, errlen) != 0) return -1;
+    unsigned ptr = img->is64 ? 8 : 4;
+    int32_t ordinal = 0;
+    const char *name = NULL;
+    unsigned flags = 0;
+    int64_t addend = 0;
+    uint64_t seg = 0;
+    uint64_t off = 0;
+    int threaded = 0;
+    uint64_t u;
+    int64_t sl;
+    while (p && p < end) {
+        uint8_t b = *p++;
+        uint8_t imm = b & BIND_IMMEDIATE_MASK;
+        uint64_t count = 0;
+        uint64_t skip = 0;
+        switch (b & BIND_OPCODE_MASK) {
+            case BIND_OPCODE_DONE:
+                // Lazy streams use DONE as an entry separator.
+                if (kind != MACHO_BIND_LAZY) return 0;
+                break;
+            case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+                ordinal = imm;
+                break;
+            case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+                if (!read_uleb128(&p, end, &u) || u > 0xffff) goto bad;
+                ordinal = (int32_t)u;
+                break;
+            case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+                ordinal = imm ? (int32_t)(int8_t)(BIND_OPCODE_MASK | imm) : 0;
+                break;
+            case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM: {
+                const uint8_t *nul = memchr(p, '\0', (size_t)(end - p));
+                if (!nul) goto bad;
+                name = (const char *)p;
+                flags = imm;
+                p = nul + 1;
+                break;
+            }
+            case BIND_OPCODE_SET_TYPE_IMM:
+                break;
+            case BIND_OPCODE_SET_ADDEND_SLEB:
+                if (!read_sleb128(&p, end, &sl)) goto bad;
+                addend = sl;
+                break;
+            case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+                seg = imm;
+                if (!read_uleb128(&p, end, &off)) goto bad;
+                break;
+            case BIND_OPCODE_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &u)) goto bad;
+                off += u;
+                break;
+            case BIND_OPCODE_DO_BIND:
+                count = 1;
+                break;
+            case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &skip)) goto bad;
+                count = 1;
+                break;
+            case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+                count = 1;
+                skip = (uint64_t)imm * ptr;
+                break;
+            case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+                if (!read_uleb128(&p, end, &count) || !read_uleb128(&p, end, &skip)) goto bad;
+                break;
+            case BIND_OPCODE_THREADED:
+                if (imm == BIND_SUBOPCODE_THREADED_SET_BIND_ORDINAL_TABLE_SIZE_ULEB) {
+                    if (!read_uleb128(&p, end, &u)) goto bad;
+                } else if (imm != BIND_SUBOPCODE_THREADED_APPLY) {
+                    goto bad;
+                }
+                threaded = 1;
+                break;
+            default:
+                goto bad;
+        }
+        if (count == 0) continue;
+        if (!name) goto bad;
+        if (threaded) {
+            // Threaded binds fill the ordinal table; the locations are
+            // in the pointer chains, not in the opcodes.
+            int rc = fn(ctx, name, ordinal, flags, addend, MACHO_NO_SEGMENT, 0);
+            if (rc) return rc;
+            continue;
+        }
+        if (!locations_ok(img, seg, off, count, skip, ptr)) {
+            snprintf(errbuf, errlen, "bind outside its segment");
+            return -1;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            int rc = fn(ctx, name, ordinal, flags, addend, (uint32_t)seg, off);
+            if (rc) return rc;
+            off += ptr + skip;
+        }
+    }
+    return 0;
+bad:
+    snprintf(errbuf, errlen, "malformed %sbind opcodes",
+             kind == MACHO_BIND_LAZY ? "lazy " : kind == MACHO_BIND_WEAK ? "weak " : "");
+    return -1;
+}
+
+int macho_rebase_walk(const struct macho_image *img, macho_rebase_fn fn, void *ctx,
+                      char *errbuf, size_t errlen) {
+    const uint8_t *p;
+    const uint8_t *end;
+    if (dyld_info_stream(img, 8, &p, &end, errbuf, errlen) != 0) return -1;
+    unsigned ptr = img->is64 ? 8 : 4;
+    uint64_t seg = 0;
+    uint64_t off = 0;
+    uint64_t u;
+    while (p && p < end) {
+        uint8_t b = *p++;
+        uint8_t imm = b & REBASE_IMMEDIATE_MASK;
+        uint64_t count = 0;
+        uint64_t skip = 0;
+        switch (b & REBASE_OPCODE_MASK) {
+            case REBASE_OPCODE_DONE:
+                return 0;
+            case REBASE_OPCODE_SET_TYPE_IMM:
+                break;
+            case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+                seg = imm;
+                if (!read_uleb128(&p, end, &off)) goto bad;
+                break;
+            case REBASE_OPCODE_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &u)) goto bad;
+                off += u;
+                break;
+            case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+                off += (uint64_t)imm * ptr;
+                break;
+            case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+                count = imm;
+                break;
+            case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+                if (!read_uleb128(&p, end, &count)) goto bad;
+                break;
+            case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+                if (!read_uleb128(&p, end, &skip)) goto bad;
+                count = 1;
+                break;
+            case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+                if (!read_uleb128(&p, end, &count) || !read_uleb128(&p, end, &skip)) goto bad;
+                break;
+            default:
+                goto bad;
+        }
+        if (count == 0) continue;
+        if (!locations_ok(img, seg, off, count, skip, ptr)) {
+            snprintf(errbuf, errlen, "rebase outside its segment");
+            return -1;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            int rc = fn(ctx, (uint32_t)seg, off);
+            if (rc) return rc;
+            off += ptr + skip;
+        }
+    }
+    return 0;
+bad:
+    snprintf(errbuf, errlen, "malformed rebase opcodes");
+    return -1;
+}
+
+struct import_walk {
+    struct import_vec *iv;
+    int lazy;
+};
+
+static int import_from_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                            int64_t addend, uint32_t seg, uint64_t offset) {
+    (void)addend;
+    (void)seg;
+    (void)offset;
+    struct import_walk *w = ctx;
+    return push_import(w->iv, name, ordinal, (flags & BIND_SYMBOL_FLAGS_WEAK_IMPORT) != 0,
+                       w->lazy);
+}
+
+int macho_chained_imports(const struct macho_image *img, struct macho_chained_import **out,
+                          size_t *n, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *n = 0;
+    uint32_t size = 0;
+    const uint8_t *p = macho_image_linkedit(img, LC_DYLD_CHAINED_FIXUPS, &size);
+    if (!p) return 0;
+    if (size < sizeof(struct dyld_chained_fixups_header)) goto bad;
+    uint32_t imports_off = load32_u(p + 8, img->swapped);
+    uint32_t symbols_off = load32_u(p + 12, img->swapped);
+    uint32_t count = load32_u(p + 16, img->swapped);
+    uint32_t format = load32_u(p + 20, img->swapped);
+    uint32_t symbols_format = load32_u(p + 24, img->swapped);
+    size_t entsz = format == DYLD_CHAINED_IMPORT ? 4 :
+                   format == DYLD_CHAINED_IMPORT_ADDEND ? 8 :
+                   format == DYLD_CHAINED_IMPORT_ADDEND64 ? 16 : 0;
+    if (entsz == 0 || symbols_format != 0) {
+        snprintf(errbuf, errlen, "unsupported chained imports format %u/%u", format,
+                 symbols_format);
+        return -1;
+    }
+    if (imports_off > size || count > (size - imports_off) / entsz || symbols_off > size) {
+        goto bad;
+    }
+    if (count == 0) return 0;
+    struct macho_chained_import *v = malloc((size_t)count * sizeof(*v));
+    if (!v) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    const char *pool = (const char *)p + symbols_off;
+    size_t pool_size = size - symbols_off;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *e = p + imports_off + (size_t)i * entsz;
+        struct macho_chained_import *ci = &v[i];
+        uint64_t name_off;
+        if (format == DYLD_CHAINED_IMPORT_ADDEND64) {
+            uint64_t x = load64_u(e, img->swapped);
+            uint32_t o = (uint32_t)(x & 0xffff);
+            ci->ordinal = o > 0xfff0 ? (int32_t)(int16_t)o : (int32_t)o;
+            ci->weak_import = (uint8_t)((x >> 16) & 1);
+            ci->addend = (int64_t)load64_u(e + 8, img->swapped);
+            name_off = x >> 32;
+        } else {
+            uint32_t x = load32_u(e, img->swapped);
+            uint32_t o = x & 0xff;
+            ci->ordinal = o > 0xf0 ? (int32_t)(int8_t)o : (int32_t)o;
+            ci->weak_import = (uint8_t)((x >> 8) & 1);
+            ci->addend = format == DYLD_CHAINED_IMPORT_ADDEND ?
+                         (int32_t)load32_u(e + 4, img->swapped) : 0;
+            name_off = x >> 9;
+        }
+        if (name_off >= pool_size || !memchr(pool + name_off, '\0', pool_size - name_off)) {
+            free(v);
+            goto bad;
+        }
+        ci->name = pool + name_off;
+    }
+    *out = v;
+    *n = count;
+    return 0;
+bad:
+    snprintf(errbuf, errlen, "malformed LC_DYLD_CHAINED_FIXUPS imports");
+    return -1;
+}
+
+// Chained pointer formats: pointer width, stride of `next`, where `next`
+// sits and which bit marks a bind (-1 = rebases only).
+struct ptr_format {
+    uint16_t format;
+    uint8_t width;
+    uint8_t stride;
+    uint8_t next_shift;
+    uint8_t next_bits;
+    int8_t bind_bit;
+};
+
+static const struct ptr_format ptr_formats[] = {
+    { DYLD_CHAINED_PTR_ARM64E, 8, 8, 51, 11, 62 },
+    { DYLD_CHAINED_PTR_64, 8, 4, 51, 12, 63 },
+    { DYLD_CHAINED_PTR_32, 4, 4, 26, 5, 31 },
+    { DYLD_CHAINED_PTR_32_CACHE, 4, 4, 30, 2, -1 },
+    { DYLD_CHAINED_PTR_32_FIRMWARE, 4, 4, 26, 6, -1 },
+    { DYLD_CHAINED_PTR_64_OFFSET, 8, 4, 51, 12, 63 },
+    { DYLD_CHAINED_PTR_ARM64E_KERNEL, 8, 4, 51, 11, 62 },
+    { DYLD_CHAINED_PTR_64_KERNEL_CACHE, 8, 4, 51, 12, -1 },
+    { DYLD_CHAINED_PTR_ARM64E_USERLAND, 8, 8, 51, 11, 62 },
+    { DYLD_CHAINED_PTR_ARM64E_FIRMWARE, 8, 4, 51, 11, 62 },
+    { DYLD_CHAINED_PTR_X86_64_KERNEL_CACHE, 8, 1, 51, 12, -1 },
+    { DYLD_CHAINED_PTR_ARM64E_USERLAND24, 8, 8, 51, 11, 62 },
+    { DYLD_CHAINED_PTR_ARM64E_SHARED_CACHE, 8, 8, 52, 11, -1 },
+};
+
+static const struct ptr_format *find_format(uint16_t format) {
+    for (size_t i = 0; i < sizeof(ptr_formats) / sizeof(ptr_formats[0]); i++) {
+        if (ptr_formats[i].format == format) return &ptr_formats[i];
+    }
+    return NULL;
+}
+
+// One chain: fixups from `start` within the page at vmaddr `page`. The
+// offset only grows and must stay on the page, so the walk terminates.
+// Returns 0, -1 if the chain leaves the page or the image, or 1 when fn
+// stopped the walk (its value is in *stop).
+static int walk_chain(const struct macho_image *img, const struct ptr_format *pf,
+                      struct macho_chained_fixup *f, uint64_t page, uint32_t page_size,
+                      uint32_t start, macho_chained_fn fn, void *ctx, int *stop) {
+    uint64_t off = start;
+    uint64_t mask = (1ull << pf->next_bits) - 1;
+    for (;;) {
+        if (off + pf->width > page_size) return -1;
+        const uint8_t *p = macho_image_vm_ptr(img, page + off, pf->width);
+        if (!p) return -1;
+        f->vmaddr = page + off;
+        f->raw = pf->width == 8 ? load64_u(p, img->swapped) : load32_u(p, img->swapped);
+        f->bind = pf->bind_bit >= 0 && ((f->raw >> pf->bind_bit) & 1);
+        *stop = fn(ctx, f);
+        if (*stop) return 1;
+        f->new_page = 0;
+        uint64_t next = (f->raw >> pf->next_shift) & mask;
+        if (next == 0) return 0;
+        off += next * pf->stride;
+    }
+}
+
+int macho_chained_walk(const struct macho_image *img, macho_chained_fn fn, void *ctx,
+                       char *errbuf, size_t errlen) {
+    uint32_t size = 0;
+    const uint8_t *p = macho_image_linkedit(img, LC_DYLD_CHAINED_FIXUPS, &size);
+    if (!p) return 0;
+    int sw = img->swapped;
+    const char *why = "malformed chained fixups";
+    int rc;
+    int stop = 0;
+    if (size < sizeof(struct dyld_chained_fixups_header)) goto bad;
+    uint32_t starts = load32_u(p + 4, sw);
+    if (starts > size || size - starts < 4) goto bad;
+    uint32_t seg_count = load32_u(p + starts, sw);
+    if (seg_count > (size - starts - 4) / 4) goto bad;
+    uint64_t base = macho_image_base(img);
+    for (uint32_t s = 0; s < seg_count; s++) {
+        uint32_t info = load32_u(p + starts + 4 + (size_t)s * 4, sw);
+        if (info == 0) continue;
+        uint64_t at = (uint64_t)starts + info;
+        if (at > size || size - at < 22) goto bad;
+        const uint8_t *seg = p + at;
+        uint32_t seg_size = load32_u(seg, sw);
+        uint16_t page_size = load16_u(seg + 4, sw);
+        uint16_t format = load16_u(seg + 6, sw);
+        uint64_t seg_off = load64_u(seg + 8, sw);
+        uint16_t page_count = load16_u(seg + 20, sw);
+        // page_start[] plus the 32-bit formats' overflow starts.
+        if (seg_size < 22 || seg_size > size - at) goto bad;
+        size_t nstarts = (seg_size - 22) / 2;
+        if (page_count > nstarts || page_size == 0) goto bad;
+        const struct ptr_format *pf = find_format(format);
+        if (!pf) {
+            why = "unsupported chained pointer format";
+            goto bad;
+        }
+        struct macho_chained_fixup f;
+        memset(&f, 0, sizeof(f));
+        f.format = format;
+        f.width = pf->width;
+        f.max_valid_pointer = load32_u(seg + 16, sw);
+        for (uint32_t pg = 0; pg < page_count; pg++) {
+            uint16_t start = load16_u(seg + 22 + (size_t)pg * 2, sw);
+            if (start == DYLD_CHAINED_PTR_START_NONE) continue;
+            uint64_t page = base + seg_off + (uint64_t)pg * page_size;
+            f.new_page = 1;
+            if (pf->width == 4 && (start & DYLD_CHAINED_PTR_START_MULTI)) {
+                for (size_t k = start & ~DYLD_CHAINED_PTR_START_MULTI;; k++) {
+                    if (k >= nstarts) goto bad;
+                    uint16_t s2 = load16_u(seg + 22 + k * 2, sw);
+                    rc = walk_chain(img, pf, &f, page, page_size,
+                                    s2 & ~DYLD_CHAINED_PTR_START_LAST, fn, ctx, &stop);
+                    if (rc < 0) goto bad;
+                    if (rc > 0) return stop;
+                    if (s2 & DYLD_CHAINED_PTR_START_LAST) break;
+                }
+            } else {
+                rc = walk_chain(img, pf, &f, page, page_size, start, fn, ctx, &stop);
+                if (rc < 0) goto bad;
+                if (rc > 0) return stop;
+            }
+        }
+    }
+    return 0;
+bad:
+    snprintf(errbuf, errlen, "%s", why);
+    return -1;
+}
+
+static uint64_t bits(uint64_t v, unsigned shift, unsigned n) {
+    return (v >> shift) & ((1ull << n) - 1);
+}
+
+int macho_chained_decode(const struct macho_chained_fixup *f, uint64_t base,
+                         struct macho_chained_target *t) {
+    memset(t, 0, sizeof(*t));
+    uint64_t v = f->raw;
+    switch (f->format) {
+        case DYLD_CHAINED_PTR_64:
+        case DYLD_CHAINED_PTR_64_OFFSET:
+            if (f->bind) {
+                t->import = (uint32_t)bits(v, 0, 24);
+                t->addend = (int64_t)bits(v, 24, 8);
+            } else {
+                t->target = bits(v, 0, 36);
+                t->high8 = (uint8_t)bits(v, 36, 8);
+                if (f->format == DYLD_CHAINED_PTR_64_OFFSET) t->target += base;
+            }
+            return 0;
+        case DYLD_CHAINED_PTR_ARM64E:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+        case DYLD_CHAINED_PTR_ARM64E_USERLAND24: {
+            int wide = f->format == DYLD_CHAINED_PTR_ARM64E_USERLAND24;
+            t->auth = (uint8_t)bits(v, 63, 1);
+            if (t->auth) {
+                t->diversity = (uint16_t)bits(v, 32, 16);
+                t->addr_div = (uint8_t)bits(v, 48, 1);
+                t->key = (uint8_t)bits(v, 49, 2);
+            }
+            if (f->bind) {
+                t->import = (uint32_t)bits(v, 0, wide ? 24 : 16);
+                // Sign-extend the 19-bit addend (plain binds only).
+                if (!t->auth) t->addend = (int64_t)(bits(v, 32, 19) << 45) >> 45;
+            } else if (t->auth) {
+                // Authenticated rebases always hold an offset from the header.
+                t->target = bits(v, 0, 32) + base;
+            } else {
+                t->target = bits(v, 0, 43);
+                t->high8 = (uint8_t)bits(v, 43, 8);
+                if (f->format != DYLD_CHAINED_PTR_ARM64E) t->target += base;
+            }
+            return 0;
+        }
+        case DYLD_CHAINED_PTR_32:
+            if (f->bind) {
+                t->import = (uint32_t)bits(v, 0, 20);
+                t->addend = (int64_t)bits(v, 20, 6);
+            } else {
+                t->target = bits(v, 0, 26);
+                // Small non-pointer values are biased into the top of the range.
+                if (t->target > f->max_valid_pointer) {
+                    t->target -= (0x04000000u - f->max_valid_pointer) / 2;
+                    t->plain = 1;
+                }
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// nsyms is only trusted once the table is known to fit in the file.
+static int symtab_fits(const struct macho_image *img) {
+    uint64_t entsz = img->is64 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    return (uint64_t)img->symoff + img->nsyms * entsz <= img->size;
+}
+
+static int symtab_imports(const struct macho_image *img, struct import_vec *iv,
+                          char *errbuf, size_t errlen) {
+    int two_level = (img->flags & MH_TWOLEVEL) != 0;
+    uint32_t nsyms = symtab_fits(img) ? img->nsyms : 0;
+    for (uint32_t i = 0; i < nsyms; i++) {
+        struct macho_symbol s;
+        if (macho_image_symbol(img, i, &s) != 0) continue;
+        if ((s.type & N_STAB) || (s.type & N_TYPE) != N_UNDF || !(s.type & N_EXT)) continue;
+        if (s.addr != 0) continue;   // common symbol, defined by the linker
+        int32_t ordinal = BIND_SPECIAL_DYLIB_FLAT_LOOKUP;
+        if (two_level) {
+            uint32_t o = GET_LIBRARY_ORDINAL(s.desc);
+            ordinal = o == EXECUTABLE_ORDINAL ? BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE :
+                      o == DYNAMIC_LOOKUP_ORDINAL ? BIND_SPECIAL_DYLIB_FLAT_LOOKUP :
+                      (int32_t)o;
+        }
+        if (push_import(iv, s.name, ordinal, (s.desc & N_WEAK_REF) != 0, 0) != 0) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int cmp_import(const void *a, const void *b) {
+    const struct macho_import *x = a;
+    const struct macho_import *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c) return c;
+    return (x->ordinal > y->ordinal) - (x->ordinal < y->ordinal);
+}
+
+int macho_imports(const struct macho_image *img, struct macho_import **out, size_t *n,
+                  char *errbuf, size_t errlen) {
+    *out = NULL;
+    *n = 0;
+    struct import_vec iv = { NULL, 0, 0 };
+    int rc;
+    uint32_t size = 0;
+    const uint8_t *chained = macho_image_linkedit(img, LC_DYLD_CHAINED_FIXUPS, &size);
+    size_t it = 0;
+    const struct macho_lc_ref *di = macho_image_next_cmd(img, LC_DYLD_INFO_ONLY, &it);
+    if (!di) {
+        it = 0;
+        di = macho_image_next_cmd(img, LC_DYLD_INFO, &it);
+    }
+    if (chained) {
+        struct macho_chained_import *ci = NULL;
+        size_t nci = 0;
+        rc = macho_chained_imports(img, &ci, &nci, errbuf, errlen);
+        for (size_t i = 0; i < nci && rc == 0; i++) {
+            rc = push_import(&iv, ci[i].name, ci[i].ordinal, ci[i].weak_import, 0);
+            if (rc) snprintf(errbuf, errlen, "out of memory");
+        }
+        free(ci);
+    } else if (di && di->cmdsize >= sizeof(struct dyld_info_command)) {
+        // The walkers report their own errors; a callback can only fail
+        // to allocate.
+        snprintf(errbuf, errlen, "out of memory");
+        struct import_walk w = { &iv, 0 };
+        rc = macho_bind_walk(img, MACHO_BIND, import_from_bind, &w, errbuf, errlen);
+        w.lazy = 1;
+        if (rc == 0) rc = macho_bind_walk(img, MACHO_BIND_LAZY, import_from_bind, &w, errbuf, errlen);
+    } else {
+        rc = symtab_imports(img, &iv, errbuf, errlen);
+    }
+    if (rc != 0) {
+        free(iv.v);
+        return -1;
+    }
+
+    // One entry per (name, ordinal): a symbol bound at many locations, or
+    // both eagerly and lazily, is one import. It is weak or lazy only if
+    // every reference is.
+    if (iv.n) qsort(iv.v, iv.n, sizeof(*iv.v), cmp_import);
+    size_t k = 0;
+    for (size_t i = 0; i < iv.n; i++) {
+        if (k && cmp_import(&iv.v[k - 1], &iv.v[i]) == 0) {
+            iv.v[k - 1].weak_import &= iv.v[i].weak_import;
+            iv.v[k - 1].lazy &= iv.v[i].lazy;
+            continue;
+        }
+        iv.v[k++] = iv.v[i];
+    }
+    if (k == 0) {
+        free(iv.v);
+        iv.v = NULL;
+    }
+    *out = iv.v;
+    *n = k;
+    return 0;
+}
+
+struct trie_item {
+    uint32_t node;
+    uint32_t prefix_len;     // length of the parent's name
+    const uint8_t *edge;
+    uint32_t edge_len;
+};
+
+struct export_build {
+    struct macho_export *v;
+    size_t *name_off;        // into pool until the walk ends
+    size_t n;
+    size_t cap;
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+};
+
+static int add_trie_export(struct export_build *eb, const char *name, size_t len,
+                           const struct macho_export *e) {
+    if (eb->n == eb->cap) {
+        size_t cap = eb->cap ? eb->cap * 2 : 256;
+        struct macho_export *v = realloc(eb->v, cap * sizeof(*v));
+        if (!v) return -1;
+        eb->v = v;
+        size_t *offs = realloc(eb->name_off, cap * sizeof(*offs));
+        if (!offs) return -1;
+        eb->name_off = offs;
+        eb->cap = cap;
+    }
+    if (eb->pool_cap - eb->pool_len < len + 1) {
+        size_t cap = eb->pool_cap ? eb->pool_cap : 4096;
+        while (cap - eb->pool_len < len + 1) cap *= 2;
+        char *pool = realloc(eb->pool, cap);
+        if (!pool) return -1;
+        eb->pool = pool;
+        eb->pool_cap = cap;
+    }
+    memcpy(eb->pool + eb->pool_len, name, len);
+    eb->pool[eb->pool_len + len] = '\0';
+    eb->name_off[eb->n] = eb->pool_len;
+    eb->v[eb->n++] = *e;
+    eb->pool_len += len + 1;
+    return 0;
+}
+
+static int walk_trie(const uint8_t *trie, uint32_t size, struct export_build *eb,
+                     char *errbuf, size_t errlen) {
+    const uint8_t *end = trie + size;
+    uint8_t *visited = calloc(size / 8 + 1, 1);
+    size_t cap = 64;
+    size_t sp = 0;
+    struct trie_item *stack = malloc(cap * sizeof(*stack));
+    size_t name_cap = 256;
+    char *name = malloc(name_cap);
+    const char *why = NULL;
+    if (!visited || !stack || !name) {
+        why = "out of memory";
+        goto done;
+    }
+    stack[sp++] = (struct trie_item){ 0, 0, NULL, 0 };
+    while (sp) {
+        struct trie_item it = stack[--sp];
+        if (it.node >= size) { why = "export trie node out of bounds"; goto done; }
+        if (visited[it.node / 8] & (1u << (it.node % 8))) {
+            why = "export trie has a loop or shared node";
+            goto done;
+        }
+        visited[it.node / 8] |= (uint8_t)(1u << (it.node % 8));
+        size_t len = (size_t)it.prefix_len + it.edge_len;
+        if (len + 1 > name_cap) {
+            while (len + 1 > name_cap) name_cap *= 2;
+            char *nn = realloc(name, name_cap);
+            if (!nn) { why = "out of memory"; goto done; }
+            name = nn;
+        }
+        if (it.edge_len) memcpy(name + it.prefix_len, it.edge, it.edge_len);
+
+        const uint8_t *p = trie + it.node;
+        uint64_t term;
+        if (!read_uleb128(&p, end, &term) || term > (uint64_t)(end - p)) {
+            why = "export trie terminal out of bounds";
+            goto done;
+        }
+        if (term) {
+            const uint8_t *q = p;
+            const uint8_t *qend = p + term;
+            struct macho_export e;
+            memset(&e, 0, sizeof(e));
+            uint64_t v;
+            if (!read_uleb128(&q, qend, &e.flags)) { why = "bad export flags"; goto done; }
+            if (e.flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+                if (!read_uleb128(&q, qend, &v) || v > 0xffff) {
+                    why = "bad re-export ordinal";
+                    goto done;
+                }
+                e.reexport_ordinal = (uint32_t)v;
+                const uint8_t *nul = memchr(q, '\0', (size_t)(qend - q));
+                if (!nul) { why = "unterminated re-export name"; goto done; }
+                if (nul != q) e.import_name = (const char *)q;
+            } else {
+                if (!read_uleb128(&q, qend, &e.address)) { why = "bad export address"; goto done; }
+                if ((e.flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) &&
+                    !read_uleb128(&q, qend, &e.resolver)) {
+                    why = "bad export resolver";
+                    goto done;
+                }
+            }
+            if (add_trie_export(eb, name, len, &e) != 0) { why = "out of memory"; goto done; }
+        }
+        p += term;
+        if (p >= end) { why = "export trie truncated"; goto done; }
+        uint8_t nchildren = *p++;
+        for (uint8_t c = 0; c < nchildren; c++) {
+            const uint8_t *nul = memchr(p, '\0', (size_t)(end - p));
+            if (!nul) { why = "unterminated export trie edge"; goto done; }
+            const uint8_t *edge = p;
+            p = nul + 1;
+            uint64_t child;
+            if (!read_uleb128(&p, end, &child) || child >= size) {
+                why = "export trie child out of bounds";
+                goto done;
+            }
+            if (sp == cap) {
+                cap *= 2;
+                struct trie_item *ns = realloc(stack, cap * sizeof(*ns));
+                if (!ns) { why = "out of memory"; goto done; }
+                stack = ns;
+            }
+            stack[sp++] = (struct trie_item){ (uint32_t)child, (uint32_t)len, edge,
+                                              (uint32_t)(nul - edge) };
+        }
+    }
+done:
+    free(visited);
+    free(stack);
+    free(name);
+    if (why) {
+        snprintf(errbuf, errlen, "%s", why);
+        return -1;
+    }
+    return 0;
+}
+
+static int cmp_export(const void *a, const void *b) {
+    return strcmp(((const struct macho_export *)a)->name, ((const struct macho_export *)b)->name);
+}
+
+int macho_exports(const struct macho_image *img, struct macho_export_list *out,
+                  char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    uint32_t size = 0;
+    const uint8_t *trie = macho_image_linkedit(img, LC_DYLD_EXPORTS_TRIE, &size);
+    if (!trie) {
+        size_t it = 0;
+        const struct macho_lc_ref *di = macho_image_next_cmd(img, LC_DYLD_INFO_ONLY, &it);
+        if (!di) {
+            it = 0;
+            di = macho_image_next_cmd(img, LC_DYLD_INFO, &it);
+        }
+        if (di && di->cmdsize >= sizeof(struct dyld_info_command)) {
+            const uint8_t *p = img->buf + di->offset;
+            uint32_t off = load32_u(p + 40, img->swapped);
+            size = load32_u(p + 44, img->swapped);
+            if (size && (uint64_t)off + size <= img->size) trie = img->buf + off;
+        }
+    }
+
+    if (trie && size) {
+        struct export_build eb;
+        memset(&eb, 0, sizeof(eb));
+        if (walk_trie(trie, size, &eb, errbuf, errlen) != 0) {
+            free(eb.v);
+            free(eb.name_off);
+            free(eb.pool);
+            return -1;
+        }
+        for (size_t i = 0; i < eb.n; i++) eb.v[i].name = eb.pool + eb.name_off[i];
+        free(eb.name_off);
+        out->v = eb.v;
+        out->n = eb.n;
+        out->pool = eb.pool;
+        out->from_trie = 1;
+    } else {
+        // No trie: external symbols defined in a section. Count, then fill.
+        size_t count = 0;
+        uint32_t nsyms = symtab_fits(img) ? img->nsyms : 0;
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                out->v = calloc(count ? count : 1, sizeof(*out->v));
+                if (!out->v) {
+                    snprintf(errbuf, errlen, "out of memory");
+                    return -1;
+                }
+            }
+            uint64_t base = macho_image_base(img);
+            for (uint32_t i = 0; i < nsyms; i++) {
+                struct macho_symbol s;
+                if (macho_image_symbol(img, i, &s) != 0) continue;
+                if ((s.type & N_STAB) || (s.type & N_TYPE) != N_SECT || !(s.type & N_EXT) ||
+                    (s.type & N_PEXT)) {
+                    continue;
+                }
+                if (pass == 0) {
+                    count++;
+                    continue;
+                }
+                struct macho_export *e = &out->v[out->n++];
+                e->name = s.name;
+                e->address = s.addr - base;
+                if (s.desc & N_WEAK_DEF) e->flags |= EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION;
+            }
+        }
+    }
+    if (out->n) qsort(out->v, out->n, sizeof(*out->v), cmp_export);
+    return 0;
+}
+
+void macho_export_list_free(struct macho_export_list *l) {
+    free(l->v);
+    free(l->pool);
+    memset(l, 0, sizeof(*l));
+}
+
+const struct macho_export *macho_export_find(const struct macho_export_list *l,
+                                             const char *name) {
+    if (!l->n) return NULL;
+    struct macho_export key;
+    memset(&key, 0, sizeof(key));
+    key.name = name;
+    return bsearch(&key, l->v, l->n, sizeof(*l->v), cmp_export);
+}
@@ -0,0 +1,170 @@
+#ifndef MACHO_DYLD_INFO_H
+#define MACHO_DYLD_INFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// What dyld needs from an image to link it: the libraries it loads (in
+// ordinal order), its LC_RPATHs, the symbols it imports and the symbols it
+// exports.
+//
+// Imports come from the LC_DYLD_CHAINED_FIXUPS imports table, else from the
+// bind and lazy-bind opcode streams of LC_DYLD_INFO(_ONLY), else from the
+// undefined symbols in LC_SYMTAB (library ordinal in n_desc). Exports come
+// from the export trie (LC_DYLD_EXPORTS_TRIE or LC_DYLD_INFO's), else from
+// the external symbols defined in the symbol table.
+
+enum macho_dylib_kind {
+    DYLIB_LOAD,       // LC_LOAD_DYLIB
+    DYLIB_WEAK,       // LC_LOAD_WEAK_DYLIB: may be missing
+    DYLIB_REEXPORT,   // LC_REEXPORT_DYLIB: its exports are ours
+    DYLIB_UPWARD,     // LC_LOAD_UPWARD_DYLIB
+    DYLIB_LAZY,       // LC_LAZY_LOAD_DYLIB
+};
+
+struct macho_dylib {
+    const char *name;            // install name as written (@rpath/...)
+    enum macho_dylib_kind kind;
+    uint32_t current_version;
+    uint32_t compat_version;
+};
+
+struct macho_link_info {
+    const char *install_name;    // LC_ID_DYLIB, NULL for executables
+    struct macho_dylib *dylibs;  // library ordinal k is dylibs[k - 1]
+    size_t ndylibs;
+    const char **rpaths;
+    size_t nrpaths;
+    char *strings;               // copies of the strings above
+};
+
+// Load command strings are copied (they need not be terminated inside the
+// command). Returns 0, or -1 on allocation failure.
+int macho_link_info(const struct macho_image *img, struct macho_link_info *out,
+                    char *errbuf, size_t errlen);
+void macho_link_info_free(struct macho_link_info *li);
+
+// Library ordinals below 1 are BIND_SPECIAL_DYLIB_SELF (0),
+// _MAIN_EXECUTABLE (-1), _FLAT_LOOKUP (-2) and _WEAK_LOOKUP (-3).
+struct macho_import {
+    const char *name;            // points into the image
+    int32_t ordinal;
+    uint8_t weak_import;         // may stay unbound
+    uint8_t lazy;                // only bound lazily (opcode images)
+};
+
+// Distinct imports sorted by name, then ordinal. *out is malloc'd (NULL if
+// there are none). Returns 0, or -1 on malformed fixup information.
+int macho_imports(const struct macho_image *img, struct macho_import **out, size_t *n,
+                  char *errbuf, size_t errlen);
+
+// Opcode streams of LC_DYLD_INFO(_ONLY), walked location by location.
+// Locations are (segment index in load command order, offset in the
+// segment) and are checked to lie inside the segment. The callback returns
+// 0 to continue; anything else stops the walk and is returned as is.
+// Images without LC_DYLD_INFO (chained fixups) have empty streams.
+enum macho_bind_kind {
+    MACHO_BIND,                  // bound at launch
+    MACHO_BIND_LAZY,             // bound on first call
+    MACHO_BIND_WEAK,             // weak-definition coalescing
+};
+
+// Threaded (arm64e, pre-chained-fixups) binds only fill the ordinal table;
+// they are reported once with this segment.
+#define MACHO_NO_SEGMENT UINT32_MAX
+
+typedef int (*macho_bind_fn)(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                             int64_t addend, uint32_t seg, uint64_t offset);
+typedef int (*macho_rebase_fn)(void *ctx, uint32_t seg, uint64_t offset);
+
+// flags are BIND_SYMBOL_FLAGS_*. Returns 0, or -1 on malformed opcodes.
+int macho_bind_walk(const struct macho_image *img, enum macho_bind_kind kind,
+                    macho_bind_fn fn, void *ctx, char *errbuf, size_t errlen);
+int macho_rebase_walk(const struct macho_image *img, macho_rebase_fn fn, void *ctx,
+                      char *errbuf, size_t errlen);
+
+// LC_DYLD_CHAINED_FIXUPS imports table in table order: a chained bind's
+// ordinal field is an index into it.
+struct macho_chained_import {
+    const char *name;            // points into the image
+    int32_t ordinal;             // library ordinal, as in macho_import
+    uint8_t weak_import;
+    int64_t addend;              // from the ADDEND formats, else 0
+};
+
+// *out is malloc'd (NULL when the image has no chained fixups or no
+// imports). Returns 0, or -1 on a malformed table.
+int macho_chained_imports(const struct macho_image *img, struct macho_chained_import **out,
+                          size_t *n, char *errbuf, size_t errlen);
+
+// Chained fixups walked pointer by pointer: every page start of every
+// segment, then along the chain through each pointer's `next` field. A
+// chain may not leave its page, so every walk ends.
+struct macho_chained_fixup {
+    uint64_t vmaddr;             // of the pointer, unslid
+    uint64_t raw;                // the pointer as stored (width bytes)
+    uint32_t max_valid_pointer;  // 32-bit formats: larger targets are plain values
+    uint16_t format;             // DYLD_CHAINED_PTR_*
+    uint8_t width;               // 4 or 8
+    uint8_t bind;
+    uint8_t new_page;            // first fixup walked on its page
+};
+
+typedef int (*macho_chained_fn)(void *ctx, const struct macho_chained_fixup *f);
+
+// Returns 0 (also when the image has no LC_DYLD_CHAINED_FIXUPS), -1 on
+// malformed starts or chains or an unknown pointer format, else the
+// callback's nonzero value.
+int macho_chained_walk(const struct macho_image *img, macho_chained_fn fn, void *ctx,
+                       char *errbuf, size_t errlen);
+
+// What a chained pointer means. Rebase targets are unslid vmaddrs (formats
+// that store an offset from the mach_header get `base` added); binds name
+// an import by index.
+struct macho_chained_target {
+    uint64_t target;             // rebase
+    uint8_t high8;               // rebase: top byte to put back after sliding
+    uint8_t plain;               // 32-bit value above max_valid_pointer: not a pointer
+    uint8_t auth;                // arm64e: signed with key/diversity/addr_div
+    uint8_t key;
+    uint8_t addr_div;
+    uint16_t diversity;
+    uint32_t import;             // bind: index into macho_chained_imports
+    int64_t addend;              // bind
+};
+
+// Decode f for an image whose mach_header sits at vmaddr `base`. Returns 0,
+// or -1 for the kernel, firmware and shared cache formats, which are not
+// decoded.
+int macho_chained_decode(const struct macho_chained_fixup *f, uint64_t base,
+                         struct macho_chained_target *t);
+
+struct macho_export {
+    const char *name;
+    uint64_t flags;              // EXPORT_SYMBOL_FLAGS_*
+    uint64_t address;            // image offset; resolver stub for STUB_AND_RESOLVER
+    uint64_t resolver;           // STUB_AND_RESOLVER only
+    uint32_t reexport_ordinal;   // REEXPORT only: library ordinal
+    const char *import_name;     // REEXPORT only: name there (NULL = same name)
+};
+
+struct macho_export_list {
+    struct macho_export *v;      // sorted by name
+    size_t n;
+    char *pool;                  // names assembled from the trie
+    int from_trie;
+};
+
+// Returns 0, or -1 if the trie is malformed (out of bounds, loops, shared
+// nodes). Walks the trie iteratively; a node is visited at most once.
+int macho_exports(const struct macho_image *img, struct macho_export_list *out,
+                  char *errbuf, size_t errlen);
+void macho_export_list_free(struct macho_export_list *l);
+
+// Export named `name`, or NULL. O(log n).
+const struct macho_export *macho_export_find(const struct macho_export_list *l,
+                                             const char *name);
+
+#endif /* MACHO_DYLD_INFO_H */
@@ -0,0 +1,192 @@
+#include "dylib_insert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+
+#include "macho_common.h"
+#include "macho_image.h"
+#include "signer.h"
+#include "universal.h"
+
+long dylib_header_slack(const uint8_t *slice, size_t size, char *errbuf, size_t errlen) {
+    struct macho_image img;
+    if (macho_image_load(&img, slice, size, errbuf, errlen) != 0) return -1;
+    uint64_t start = (uint64_t)img.header_size + img.sizeofcmds;
+    uint64_t limit = macho_image_header_limit(&img);
+    macho_image_free(&img);
+    if (limit < start) return 0;
+    // Only zero bytes count: anything else belongs to someone.
+    uint64_t n = 0;
+    while (start + n < limit && slice[start + n] == 0) n++;
+    return (long)n;
+}
+
+// Does the slice already load `path` (any LC_*_DYLIB flavour)?
+static int has_dylib(const struct macho_image *img, const char *path) {
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        if (lc->cmd != LC_LOAD_DYLIB && lc->cmd != LC_LOAD_WEAK_DYLIB &&
+            lc->cmd != LC_REEXPORT_DYLIB && lc->cmd != LC_LAZY_LOAD_DYLIB &&
+            lc->cmd != LC_LOAD_UPWARD_DYLIB) {
+            continue;
+        }
+        if (lc->cmdsize < sizeof(struct dylib_command)) continue;
+        uint32_t off = load32_u(img->buf + lc->offset + 8, img->swapped);
+        if (off >= lc->cmdsize) continue;
+        size_t max = lc->cmdsize - off;
+        const char *name = (const char *)img->buf + lc->offset + off;
+        const char *nul = memchr(name, 0, max);
+        size_t len = nul ? (size_t)(nul - name) : max;
+        if (len == strlen(path) && memcmp(name, path, len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Insert into one thin slice. Returns 0 (inserted, *out malloc'd), 1
+// (already present) or -1.
+static int insert_slice(const uint8_t *in, size_t size, const struct insert_opts *opts,
+                        uint8_t **out, size_t *out_size, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *out_size = 0;
+
+    struct macho_image img;
+    if (macho_image_load(&img, in, size, errbuf, errlen) != 0) return -1;
+    if (has_dylib(&img, opts->dylib)) {
+        macho_image_free(&img);
+        return 1;
+    }
+
+    size_t ptr_align = img.is64 ? 8 : 4;
+    size_t name_len = strlen(opts->dylib) + 1;
+    size_t cmdsize = (sizeof(struct dylib_command) + name_len + ptr_align - 1) & ~(ptr_align - 1);
+    uint32_t at = img.header_size + img.sizeofcmds;
+    uint32_t ncmds = img.ncmds;
+    uint32_t sizeofcmds = img.sizeofcmds;
+    int sw = img.swapped;
+    macho_image_free(&img);
+
+    long slack = dylib_header_slack(in, size, errbuf, errlen);
+    if (slack < 0) return -1;
+    if ((size_t)slack < cmdsize) {
+        // Making room would mean sliding __TEXT content, i.e. rewriting every
+        // rebase, fixup, unwind entry and export offset: relink instead.
+        snprintf(errbuf, errlen,
+                 "need %zu bytes of header padding, have %ld (relink with "
+                 "-headerpad_max_install_names)", cmdsize, slack);
+        return -1;
+    }
+
+    uint8_t *o = malloc(size);
+    if (!o) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    memcpy(o, in, size);
+
+    uint8_t *lc = o + at;
+    memset(lc, 0, cmdsize);
+    store32_u(lc, opts->weak ? LC_LOAD_WEAK_DYLIB : LC_LOAD_DYLIB, sw);
+    store32_u(lc + 4, (uint32_t)cmdsize, sw);
+    store32_u(lc + 8, (uint32_t)sizeof(struct dylib_command), sw);    // name.offset
+    store32_u(lc + 12, 2, sw);                                         // timestamp
+    store32_u(lc + 16, opts->current_version, sw);
+    store32_u(lc + 20, opts->compat_version, sw);
+    memcpy(lc + sizeof(struct dylib_command), opts->dylib, name_len);
+
+    store32_u(o + 16, ncmds + 1, sw);
+    store32_u(o + 20, sizeofcmds + (uint32_t)cmdsize, sw);
+
+    *out = o;
+    *out_size = size;
+    return 0;
+}
+
+int dylib_insert_buffer(const uint8_t *in, size_t in_size, const struct insert_opts *opts,
+                        uint8_t **out, size_t *out_size, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *out_size = 0;
+
+    struct fat_slice *slices = NULL;
+    size_t n = 0;
+    int is_fat = 0;
+    int is64 = 0;
+    if (universal_read(in, in_size, &slices, &n, &is_fat, &is64, errbuf, errlen) != 0) {
+        return -1;
+    }
+
+    uint8_t **parts = calloc(n, sizeof(*parts));
+    if (!parts) {
+        free(slices);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    int rc = 0;
+    size_t inserted = 0;
+    struct sign_opts so = { NULL, 0, opts->jobs };
+    for (size_t i = 0; i < n && rc == 0; i++) {
+        const uint8_t *src = in + slices[i].offset;
+        size_t sz = 0;
+        int irc = insert_slice(src, (size_t)slices[i].size, opts, &parts[i], &sz,
+                               errbuf, errlen);
+        if (irc < 0) {
+            rc = -1;
+            break;
+        }
+        if (irc == 0) inserted++;
+        if (irc == 1) {
+            // Unchanged slice: keep its bytes as they are.
+            parts[i] = malloc((size_t)slices[i].size);
+            if (!parts[i]) {
+                snprintf(errbuf, errlen, "out of memory");
+                rc = -1;
+                break;
+            }
+            memcpy(parts[i], src, (size_t)slices[i].size);
+            sz = (size_t)slices[i].size;
+        } else if (!opts->no_sign) {
+            uint8_t *signed_part = NULL;
+            if (cs_sign_slice(parts[i], sz, &so, NULL, &signed_part, &sz,
+                              errbuf, errlen) != 0) {
+                rc = -1;
+                break;
+            }
+            free(parts[i]);
+            parts[i] = signed_part;
+        }
+        slices[i].size = sz;
+    }
+
+    if (rc == 0 && inserted == 0) rc = 1;
+
+    if (rc == 0 && !is_fat) {
+        *out = parts[0];
+        *out_size = (size_t)slices[0].size;
+        parts[0] = NULL;
+    } else if (rc == 0) {
+        // Signed slices change size, so offsets are recomputed; FAT64 input
+        // stays FAT64.
+        int fat64 = 0;
+        uint64_t total = universal_layout(slices, n, is64, &fat64);
+        uint8_t *o = total <= SIZE_MAX ? calloc(1, (size_t)total) : NULL;
+        if (!o) {
+            snprintf(errbuf, errlen, "out of memory");
+            rc = -1;
+        } else {
+            universal_write_header(slices, n, fat64, o);
+            for (size_t i = 0; i < n; i++) {
+                memcpy(o + slices[i].offset, parts[i], (size_t)slices[i].size);
+            }
+            *out = o;
+            *out_size = (size_t)total;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) free(parts[i]);
+    free(parts);
+    free(slices);
+    return rc;
+}
@@ -0,0 +1,34 @@
+#ifndef MACHO_DYLIB_INSERT_H
+#define MACHO_DYLIB_INSERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Static injection: add an LC_LOAD_DYLIB (or LC_LOAD_WEAK_DYLIB) to a
+// binary on disk, so dyld loads the library at every launch with normal
+// two-level binding, instead of DYLD_INSERT_LIBRARIES +
+// DYLD_FORCE_FLAT_NAMESPACE on each run (runtime-injection/injector.c).
+//
+// The command goes into the zero padding between the last load command and
+// the first section, so no file offset or address moves. ncmds/sizeofcmds
+// are updated, the slice is re-signed ad hoc (the header page hash changed),
+// and FAT slices are laid out again.
+
+struct insert_opts {
+    const char *dylib;          // install name as dyld should see it
+    int weak;                   // LC_LOAD_WEAK_DYLIB: launch even if missing
+    uint32_t current_version;
+    uint32_t compat_version;
+    int no_sign;                // leave the (now invalid) signature alone
+    unsigned jobs;
+};
+
+// Bytes of free, zero-filled header padding in a thin slice, or -1.
+long dylib_header_slack(const uint8_t *slice, size_t size, char *errbuf, size_t errlen);
+
+// Thin or FAT. Returns 0 on success (*out malloc'd), 1 if every slice
+// already loads the dylib (nothing written), -1 on error.
+int dylib_insert_buffer(const uint8_t *in, size_t in_size, const struct insert_opts *opts,
+                        uint8_t **out, size_t *out_size, char *errbuf, size_t errlen);
+
+#endif /* MACHO_DYLIB_INSERT_H */
@@ -0,0 +1,516 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ent_index.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "codesign.h"
+#include "corpus.h"
+#include "entitlements.h"
+#include "macho_image.h"
+#include "parallel.h"
+
+// ---- scanning ----
+
+struct ent_rec {
+    uint32_t binary;
+    char *key;
+    char *value;
+};
+
+struct rec_vec {
+    struct ent_rec *v;
+    size_t n;
+    size_t cap;
+    int oom;
+};
+
+struct scan_counts {
+    size_t machos;
+    size_t signed_machos;
+    size_t with_entitlements;
+    size_t errors;
+};
+
+struct scan_job {
+    char **paths;
+    struct rec_vec *recs;          // per worker
+    struct scan_counts *counts;    // per worker
+};
+
+static int looks_like_macho(const uint8_t *p, size_t n) {
+    if (n < 4) return 0;
+    uint32_t m;
+    memcpy(&m, p, sizeof(m));
+    return m == MH_MAGIC || m == MH_CIGAM || m == MH_MAGIC_64 || m == MH_CIGAM_64 ||
+           m == FAT_MAGIC || m == FAT_CIGAM || m == 0xcafebabfu || m == 0xbfbafecau;
+}
+
+static void rec_push(struct rec_vec *rv, uint32_t binary, char *key, char *value) {
+    if (rv->n == rv->cap) {
+        size_t ncap = rv->cap ? rv->cap * 2 : 256;
+        struct ent_rec *nv = realloc(rv->v, ncap * sizeof(*nv));
+        if (!nv) {
+            rv->oom = 1;
+            free(key);
+            free(value);
+            return;
+        }
+        rv->v = nv;
+        rv->cap = ncap;
+    }
+    rv->v[rv->n].binary = binary;
+    rv->v[rv->n].key = key;
+    rv->v[rv->n].value = value;
+    rv->n++;
+}
+
+static void scan_one(const char *path, uint32_t binary, struct rec_vec *out,
+                     struct scan_counts *cnt) {
+    char err[256];
+    struct mapped_file mf;
+    if (map_file(path, &mf, err, sizeof(err)) != 0) {
+        cnt->errors++;
+        return;
+    }
+    if (!looks_like_macho(mf.data, mf.size)) {
+        unmap_file(&mf);
+        return;
+    }
+
+    uint64_t off = 0;
+    uint64_t size = 0;
+    // 0xcafebabe is shared with Java class files: a FAT header that does
+    // not select is not counted as a broken Mach-O.
+    if (macho_select_slice(mf.data, mf.size, -1, 0, &off, &size, err, sizeof(err)) != 0) {
+        unmap_file(&mf);
+        return;
+    }
+    cnt->machos++;
+
+    struct macho_image img;
+    if (macho_image_load(&img, mf.data + off, (size_t)size, err, sizeof(err)) != 0) {
+        cnt->errors++;
+        unmap_file(&mf);
+        return;
+    }
+
+    struct cs_signature sig;
+    int rc = cs_parse(&img, &sig, err, sizeof(err));
+    if (rc == 0) {
+        cnt->signed_machos++;
+        struct ent_list ents = { 0 };
+        int erc = ent_from_signature(&sig, &ents, err, sizeof(err));
+        if (erc < 0) cnt->errors++;
+        if (ents.n) cnt->with_entitlements++;
+        for (size_t i = 0; i < ents.n; i++) {
+            rec_push(out, binary, ents.v[i].key, ents.v[i].value);
+        }
+        // Ownership of the strings moved into the records.
+        free(ents.v);
+        cs_free(&sig);
+    } else if (rc < 0) {
+        cnt->errors++;
+    }
+
+    macho_image_free(&img);
+    unmap_file(&mf);
+}
+
+static void scan_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    struct scan_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        scan_one(job->paths[i], (uint32_t)i, &job->recs[worker], &job->counts[worker]);
+    }
+}
+
+// ---- string table ----
+
+struct strtab {
+    char *buf;
+    size_t n;
+    size_t cap;
+    uint32_t *slots;     // offset + 1, 0 = empty
+    size_t nslots;
+    size_t count;
+    int oom;
+};
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static int strtab_grow_slots(struct strtab *t) {
+    size_t nslots = t->nslots ? t->nslots * 2 : 1024;
+    uint32_t *ns = calloc(nslots, sizeof(*ns));
+    if (!ns) return -1;
+    for (size_t i = 0; i < t->nslots; i++) {
+        uint32_t v = t->slots[i];
+        if (!v) continue;
+        size_t j = fnv1a(t->buf + v - 1) & (nslots - 1);
+        while (ns[j]) j = (j + 1) & (nslots - 1);
+        ns[j] = v;
+    }
+    free(t->slots);
+    t->slots = ns;
+    t->nslots = nslots;
+    return 0;
+}
+
+static uint32_t strtab_add(struct strtab *t, const char *s) {
+    if (t->oom) return 0;
+    if ((t->count + 1) * 2 > t->nslots && strtab_grow_slots(t) != 0) {
+        t->oom = 1;
+        return 0;
+    }
+    size_t j = fnv1a(s) & (t->nslots - 1);
+    while (t->slots[j]) {
+        if (strcmp(t->buf + t->slots[j] - 1, s) == 0) return t->slots[j] - 1;
+        j = (j + 1) & (t->nslots - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    if (t->n + len > UINT32_MAX - 1) {
+        t->oom = 1;
+        return 0;
+    }
+    if (t->n + len > t->cap) {
+        size_t ncap = t->cap ? t->cap : 4096;
+        while (ncap < t->n + len) ncap *= 2;
+        char *nb = realloc(t->buf, ncap);
+        if (!nb) {
+            t->oom = 1;
+            return 0;
+        }
+        t->buf = nb;
+        t->cap = ncap;
+    }
+    uint32_t off = (uint32_t)t->n;
+    memcpy(t->buf + t->n, s, len);
+    t->n += len;
+    t->slots[j] = off + 1;
+    t->count++;
+    return off;
+}
+
+// ---- build ----
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int cmp_rec(const void *a, const void *b) {
+    const struct ent_rec *x = a;
+    const struct ent_rec *y = b;
+    int c = strcmp(x->key, y->key);
+    if (c) return c;
+    return (x->binary > y->binary) - (x->binary < y->binary);
+}
+
+static uint64_t align8(uint64_t x) {
+    return (x + 7) & ~(uint64_t)7;
+}
+
+// Write `len` bytes at file offset `at` (>= *pos), zero-filling the gap.
+static int emit(FILE *f, uint64_t *pos, const void *p, size_t len, uint64_t at) {
+    static const uint8_t zeros[8];
+    while (*pos < at) {
+        size_t n = (at - *pos) < sizeof(zeros) ? (size_t)(at - *pos) : sizeof(zeros);
+        if (fwrite(zeros, 1, n, f) != n) return 0;
+        *pos += n;
+    }
+    if (len && fwrite(p, 1, len, f) != len) return 0;
+    *pos += len;
+    return 1;
+}
+
+static int write_index(const char *out_path, const struct eidx_header *h,
+                       const uint32_t *bins, const struct eidx_key *keys,
+                       const struct eidx_posting *posts, const char *strtab,
+                       char *errbuf, size_t errlen) {
+    size_t plen = strlen(out_path);
+    char *tmp = malloc(plen + 5);
+    if (!tmp) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    memcpy(tmp, out_path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        snprintf(errbuf, errlen, "%s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+
+    uint64_t pos = 0;
+    int ok = emit(f, &pos, h, sizeof(*h), 0) &&
+             emit(f, &pos, bins, (size_t)h->nbinaries * sizeof(*bins), h->binaries_off) &&
+             emit(f, &pos, keys, (size_t)h->nkeys * sizeof(*keys), h->keys_off) &&
+             emit(f, &pos, posts, (size_t)h->npostings * sizeof(*posts), h->postings_off) &&
+             emit(f, &pos, strtab, (size_t)h->strtab_size, h->strtab_off);
+
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, out_path) != 0) {
+        snprintf(errbuf, errlen, "%s: %s", out_path, strerror(errno));
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+int eidx_build(char **paths, size_t npaths, unsigned nthreads, const char *out_path,
+               struct eidx_build_stats *stats, char *errbuf, size_t errlen) {
+    memset(stats, 0, sizeof(*stats));
+    if (npaths > UINT32_MAX) {
+        snprintf(errbuf, errlen, "too many input files");
+        return -1;
+    }
+
+    // Stable binary ids regardless of input order or thread timing.
+    qsort(paths, npaths, sizeof(*paths), cmp_path);
+    size_t uniq = 0;
+    for (size_t i = 0; i < npaths; i++) {
+        if (uniq && strcmp(paths[uniq - 1], paths[i]) == 0) continue;
+        // Swap rather than overwrite: the caller still owns all npaths strings.
+        char *t = paths[uniq];
+        paths[uniq++] = paths[i];
+        paths[i] = t;
+    }
+    npaths = uniq;
+    stats->files = npaths;
+
+    if (nthreads == 0) nthreads = par_default_threads();
+    struct rec_vec *recs = calloc(nthreads, sizeof(*recs));
+    struct scan_counts *counts = calloc(nthreads, sizeof(*counts));
+    if (!recs || !counts) {
+        free(recs);
+        free(counts);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    struct scan_job job = { paths, recs, counts };
+    par_for(npaths, 8, nthreads, scan_worker, &job);
+
+    size_t total = 0;
+    int oom = 0;
+    for (unsigned w = 0; w < nthreads; w++) {
+        total += recs[w].n;
+        oom |= recs[w].oom;
+        stats->machos += counts[w].machos;
+        stats->signed_machos += counts[w].signed_machos;
+        stats->with_entitlements += counts[w].with_entitlements;
+        stats->errors += counts[w].errors;
+    }
+    free(counts);
+
+    struct ent_rec *all = malloc((total ? total : 1) * sizeof(*all));
+    size_t k = 0;
+    for (unsigned w = 0; w < nthreads; w++) {
+        for (size_t i = 0; i < recs[w].n; i++) {
+            if (all) {
+                all[k++] = recs[w].v[i];
+            } else {
+                free(recs[w].v[i].key);
+                free(recs[w].v[i].value);
+            }
+        }
+        free(recs[w].v);
+    }
+    free(recs);
+    if (!all || oom || total > UINT32_MAX) {
+        for (size_t i = 0; all && i < total; i++) {
+            free(all[i].key);
+            free(all[i].value);
+        }
+        free(all);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    qsort(all, total, sizeof(*all), cmp_rec);
+
+    struct strtab st = { 0 };
+    strtab_add(&st, "");
+
+    uint32_t *bins = malloc((npaths ? npaths : 1) * sizeof(*bins));
+    struct eidx_key *keys = calloc(total ? total : 1, sizeof(*keys));
+    struct eidx_posting *posts = malloc((total ? total : 1) * sizeof(*posts));
+    size_t nkeys = 0;
+    if (bins && keys && posts) {
+        for (size_t i = 0; i < npaths; i++) bins[i] = strtab_add(&st, paths[i]);
+        for (size_t i = 0; i < total; i++) {
+            if (i == 0 || strcmp(all[i].key, all[i - 1].key) != 0) {
+                keys[nkeys].name = strtab_add(&st, all[i].key);
+                keys[nkeys].first = (uint32_t)i;
+                nkeys++;
+            }
+            keys[nkeys - 1].count++;
+            posts[i].binary = all[i].binary;
+            posts[i].value = strtab_add(&st, all[i].value);
+        }
+    }
+    for (size_t i = 0; i < total; i++) {
+        free(all[i].key);
+        free(all[i].value);
+    }
+    free(all);
+
+    int rc = -1;
+    if (!bins || !keys || !posts || st.oom) {
+        snprintf(errbuf, errlen, "out of memory");
+    } else {
+        struct eidx_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, EIDX_MAGIC, sizeof(h.magic));
+        h.version = EIDX_VERSION;
+        h.byte_order = EIDX_BYTE_ORDER;
+        h.nbinaries = (uint32_t)npaths;
+        h.nkeys = (uint32_t)nkeys;
+        h.npostings = (uint32_t)total;
+        h.nsigned = (uint32_t)stats->signed_machos;
+        h.binaries_off = align8(sizeof(h));
+        h.keys_off = align8(h.binaries_off + (uint64_t)npaths * sizeof(*bins));
+        h.postings_off = align8(h.keys_off + (uint64_t)nkeys * sizeof(*keys));
+        h.strtab_off = align8(h.postings_off + (uint64_t)total * sizeof(*posts));
+        h.strtab_size = st.n;
+        rc = write_index(out_path, &h, bins, keys, posts, st.buf, errbuf, errlen);
+        stats->postings = total;
+        stats->keys = nkeys;
+    }
+
+    free(bins);
+    free(keys);
+    free(posts);
+    free(st.buf);
+    free(st.slots);
+    return rc;
+}
+
+// ---- query ----
+
+int eidx_open(const char *path, struct eidx *idx, char *errbuf, size_t errlen) {
+    memset(idx, 0, sizeof(*idx));
+    struct mapped_file mf;
+    if (map_file(path, &mf, errbuf, errlen) != 0) return -1;
+    idx->map = mf.data;
+    idx->size = mf.size;
+
+    const struct eidx_header *h = (const struct eidx_header *)mf.data;
+    if (mf.size < sizeof(*h) || memcmp(h->magic, EIDX_MAGIC, sizeof(h->magic)) != 0) {
+        snprintf(errbuf, errlen, "%s: not an entitlement index", path);
+        eidx_close(idx);
+        return -1;
+    }
+    if (h->version != EIDX_VERSION || h->byte_order != EIDX_BYTE_ORDER) {
+        snprintf(errbuf, errlen, "%s: index version %u / byte order mismatch",
+                 path, h->version);
+        eidx_close(idx);
+        return -1;
+    }
+
+    uint64_t sz = mf.size;
+    int ok = h->binaries_off <= sz && (uint64_t)h->nbinaries * 4 <= sz - h->binaries_off &&
+             h->keys_off <= sz && (uint64_t)h->nkeys * sizeof(struct eidx_key) <= sz - h->keys_off &&
+             h->postings_off <= sz &&
+             (uint64_t)h->npostings * sizeof(struct eidx_posting) <= sz - h->postings_off &&
+             h->strtab_off <= sz && h->strtab_size <= sz - h->strtab_off &&
+             h->strtab_size > 0 && mf.data[h->strtab_off + h->strtab_size - 1] == '\0' &&
+             (h->binaries_off | h->keys_off | h->postings_off) % 8 == 0;
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt index", path);
+        eidx_close(idx);
+        return -1;
+    }
+    // Posting ranges are validated once so queries can index without checks.
+    const struct eidx_key *keys = (const struct eidx_key *)(mf.data + h->keys_off);
+    const struct eidx_posting *posts = (const struct eidx_posting *)(mf.data + h->postings_off);
+    for (uint32_t i = 0; i < h->nkeys && ok; i++) {
+        ok = keys[i].first <= h->npostings && keys[i].count <= h->npostings - keys[i].first;
+    }
+    for (uint32_t i = 0; i < h->npostings && ok; i++) {
+        ok = posts[i].binary < h->nbinaries;
+    }
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt posting table", path);
+        eidx_close(idx);
+        return -1;
+    }
+
+    idx->h = h;
+    idx->binaries = (const uint32_t *)(mf.data + h->binaries_off);
+    idx->keys = keys;
+    idx->postings = posts;
+    idx->strtab = (const char *)(mf.data + h->strtab_off);
+    return 0;
+}
+
+void eidx_close(struct eidx *idx) {
+    struct mapped_file mf = { idx->map, idx->size };
+    unmap_file(&mf);
+    memset(idx, 0, sizeof(*idx));
+}
+
+const char *eidx_str(const struct eidx *idx, uint32_t off) {
+    if (off >= idx->h->strtab_size) return "";
+    return idx->strtab + off;
+}
+
+// First key >= s.
+static size_t lower_bound(const struct eidx *idx, const char *s) {
+    size_t lo = 0;
+    size_t hi = idx->h->nkeys;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(eidx_str(idx, idx->keys[mid].name), s) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+const struct eidx_key *eidx_find(const struct eidx *idx, const char *key) {
+    size_t i = lower_bound(idx, key);
+    if (i < idx->h->nkeys && strcmp(eidx_str(idx, idx->keys[i].name), key) == 0) {
+        return &idx->keys[i];
+    }
+    return NULL;
+}
+
+size_t eidx_prefix(const struct eidx *idx, const char *prefix, size_t *first) {
+    size_t plen = strlen(prefix);
+    size_t i = lower_bound(idx, prefix);
+    *first = i;
+    size_t n = 0;
+    while (i + n < idx->h->nkeys &&
+           strncmp(eidx_str(idx, idx->keys[i + n].name), prefix, plen) == 0) {
+        n++;
+    }
+    return n;
+}
+
+long eidx_find_binary(const struct eidx *idx, const char *path) {
+    size_t lo = 0;
+    size_t hi = idx->h->nbinaries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(eidx_str(idx, idx->binaries[mid]), path);
+        if (c == 0) return (long)mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
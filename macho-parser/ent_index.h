@@ -0,0 +1,90 @@
+#ifndef MACHO_ENT_INDEX_H
+#define MACHO_ENT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Inverted entitlement index: key -> (binary, value) postings.
+//
+// The on-disk file is the in-memory layout, so opening it is one mmap and
+// every query is a binary search over the key table. All integers are host
+// byte order; the header records it and eidx_open rejects a foreign file.
+//
+//   header
+//   u32 binaries[nbinaries]          path (string offset), sorted by path
+//   struct eidx_key keys[nkeys]      sorted by name
+//   struct eidx_posting [npostings]  grouped by key, sorted by binary
+//   strtab                           NUL-terminated, de-duplicated
+
+#define EIDX_MAGIC "MACHOENT"
+#define EIDX_VERSION 1
+#define EIDX_BYTE_ORDER 0x01020304u
+
+struct eidx_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t nbinaries;
+    uint32_t nkeys;
+    uint32_t npostings;
+    uint32_t nsigned;         // binaries with a code signature
+    uint64_t binaries_off;
+    uint64_t keys_off;
+    uint64_t postings_off;
+    uint64_t strtab_off;
+    uint64_t strtab_size;
+};
+
+struct eidx_key {
+    uint32_t name;            // string offset
+    uint32_t first;           // first posting
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct eidx_posting {
+    uint32_t binary;          // index into binaries[]
+    uint32_t value;           // string offset
+};
+
+struct eidx_build_stats {
+    size_t files;
+    size_t machos;
+    size_t signed_machos;
+    size_t with_entitlements;
+    size_t errors;
+    size_t postings;
+    size_t keys;
+};
+
+// Scan `paths` in parallel and write the index to out_path (atomically via
+// a temporary file). Files that are not Mach-O are counted and skipped.
+int eidx_build(char **paths, size_t npaths, unsigned nthreads, const char *out_path,
+               struct eidx_build_stats *stats, char *errbuf, size_t errlen);
+
+struct eidx {
+    const uint8_t *map;
+    size_t size;
+    const struct eidx_header *h;
+    const uint32_t *binaries;
+    const struct eidx_key *keys;
+    const struct eidx_posting *postings;
+    const char *strtab;
+};
+
+int eidx_open(const char *path, struct eidx *idx, char *errbuf, size_t errlen);
+void eidx_close(struct eidx *idx);
+
+// String at a table offset ("" if out of range).
+const char *eidx_str(const struct eidx *idx, uint32_t off);
+
+// Exact key, or NULL.
+const struct eidx_key *eidx_find(const struct eidx *idx, const char *key);
+
+// Keys starting with `prefix`: returns the count, *first is the first index.
+size_t eidx_prefix(const struct eidx *idx, const char *prefix, size_t *first);
+
+// Binary index for a path, or -1.
+long eidx_find_binary(const struct eidx *idx, const char *path);
+
+#endif /* MACHO_ENT_INDEX_H */
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "corpus.h"
+#include "ent_index.h"
+
+// entindex: build and query an entitlement index over many Mach-O files.
+//
+//   entindex build [-j N] OUT PATH... | -
+//   entindex query IDX KEY [VALUE]      KEY may end in '*' for a prefix
+//   entindex show IDX PATH              every entitlement of one binary
+//   entindex stats IDX [N]              totals and the N most common keys
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s build [-j N] <index> <path>... | -\n", prog);
+    fprintf(out, "       %s query <index> <key>[*] [value]\n", prog);
+    fprintf(out, "       %s show <index> <path>\n", prog);
+    fprintf(out, "       %s stats <index> [top N]\n", prog);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int cmd_build(int argc, char **argv) {
+    unsigned jobs = 0;
+    int i = 0;
+    if (i + 1 < argc && (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0)) {
+        jobs = (unsigned)strtoul(argv[i + 1], NULL, 0);
+        i += 2;
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "error: build needs an output file and inputs\n");
+        return 2;
+    }
+    const char *out = argv[i++];
+
+    char **paths = NULL;
+    size_t npaths = corpus_collect_paths(argc - i, argv + i, &paths);
+
+    char err[256];
+    struct eidx_build_stats st;
+    double t0 = now_ms();
+    int rc = eidx_build(paths, npaths, jobs, out, &st, err, sizeof(err));
+    double t1 = now_ms();
+    corpus_free_paths(paths, npaths);
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    printf("files=%zu macho=%zu signed=%zu with_entitlements=%zu errors=%zu\n",
+           st.files, st.machos, st.signed_machos, st.with_entitlements, st.errors);
+    printf("keys=%zu postings=%zu time=%.1fms -> %s\n", st.keys, st.postings, t1 - t0, out);
+    return 0;
+}
+
+static void print_key(const struct eidx *idx, const struct eidx_key *k, const char *value) {
+    size_t shown = 0;
+    for (uint32_t j = 0; j < k->count; j++) {
+        const struct eidx_posting *p = &idx->postings[k->first + j];
+        if (value && strcmp(eidx_str(idx, p->value), value) != 0) continue;
+        if (shown++ == 0) printf("%s\n", eidx_str(idx, k->name));
+        printf("  %s = %s\n", eidx_str(idx, idx->binaries[p->binary]),
+               eidx_str(idx, p->value));
+    }
+}
+
+static int cmd_query(const struct eidx *idx, const char *key, const char *value) {
+    size_t len = strlen(key);
+    if (len && key[len - 1] == '*') {
+        char *prefix = malloc(len);
+        if (!prefix) return 1;
+        memcpy(prefix, key, len - 1);
+        prefix[len - 1] = '\0';
+        size_t first = 0;
+        size_t n = eidx_prefix(idx, prefix, &first);
+        free(prefix);
+        for (size_t i = 0; i < n; i++) print_key(idx, &idx->keys[first + i], value);
+        return n ? 0 : 1;
+    }
+    const struct eidx_key *k = eidx_find(idx, key);
+    if (!k) {
+        fprintf(stderr, "no binary holds %s\n", key);
+        return 1;
+    }
+    print_key(idx, k, value);
+    return 0;
+}
+
+static int cmd_show(const struct eidx *idx, const char *path) {
+    long b = eidx_find_binary(idx, path);
+    if (b < 0) {
+        fprintf(stderr, "error: %s is not in the index\n", path);
+        return 1;
+    }
+    // Postings are grouped by key, so this is one pass over the table.
+    printf("%s\n", path);
+    for (uint32_t i = 0; i < idx->h->nkeys; i++) {
+        const struct eidx_key *k = &idx->keys[i];
+        for (uint32_t j = 0; j < k->count; j++) {
+            const struct eidx_posting *p = &idx->postings[k->first + j];
+            if (p->binary != (uint32_t)b) continue;
+            printf("  %s = %s\n", eidx_str(idx, k->name), eidx_str(idx, p->value));
+        }
+    }
+    return 0;
+}
+
+static const struct eidx *g_sort_idx;
+
+static int cmp_key_count(const void *a, const void *b) {
+    const struct eidx_key *x = &g_sort_idx->keys[*(const uint32_t *)a];
+    const struct eidx_key *y = &g_sort_idx->keys[*(const uint32_t *)b];
+    if (x->count != y->count) return (x->count < y->count) - (x->count > y->count);
+    return strcmp(eidx_str(g_sort_idx, x->name), eidx_str(g_sort_idx, y->name));
+}
+
+static int cmd_stats(const struct eidx *idx, size_t top) {
+    const struct eidx_header *h = idx->h;
+    printf("binaries=%u signed=%u keys=%u postings=%u strtab=%llu bytes\n",
+           h->nbinaries, h->nsigned, h->nkeys, h->npostings,
+           (unsigned long long)h->strtab_size);
+    if (h->nkeys == 0) return 0;
+
+    uint32_t *order = malloc(h->nkeys * sizeof(*order));
+    if (!order) return 1;
+    for (uint32_t i = 0; i < h->nkeys; i++) order[i] = i;
+    g_sort_idx = idx;
+    qsort(order, h->nkeys, sizeof(*order), cmp_key_count);
+    if (top > h->nkeys) top = h->nkeys;
+    for (size_t i = 0; i < top; i++) {
+        const struct eidx_key *k = &idx->keys[order[i]];
+        printf("%6u  %s\n", k->count, eidx_str(idx, k->name));
+    }
+    free(order);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0], argc < 2 ? stderr : stdout);
+        return argc < 2 ? 2 : 0;
+    }
+    const char *cmd = argv[1];
+    if (strcmp(cmd, "build") == 0) return cmd_build(argc - 2, argv + 2);
+
+    if (argc < 3) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    char err[256];
+    struct eidx idx;
+    if (eidx_open(argv[2], &idx, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
+    int rc;
+    if (strcmp(cmd, "query") == 0 && argc >= 4) {
+        rc = cmd_query(&idx, argv[3], argc >= 5 ? argv[4] : NULL);
+    } else if (strcmp(cmd, "show") == 0 && argc >= 4) {
+        rc = cmd_show(&idx, argv[3]);
+    } else if (strcmp(cmd, "stats") == 0) {
+        rc = cmd_stats(&idx, argc >= 4 ? (size_t)strtoul(argv[3], NULL, 0) : 20);
+    } else {
+        usage(argv[0], stderr);
+        rc = 2;
+    }
+    eidx_close(&idx);
+    return rc;
+}
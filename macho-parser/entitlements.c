@@ -0,0 +1,540 @@
+#include "entitlements.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENT_MAX_DEPTH 32
+
+// ---- small string builder ----
+
+struct sbuf {
+    char *p;
+    size_t n;
+    size_t cap;
+    int oom;
+};
+
+static void sb_putn(struct sbuf *sb, const char *s, size_t len) {
+    if (sb->oom) return;
+    if (sb->n + len + 1 > sb->cap) {
+        size_t ncap = sb->cap ? sb->cap : 64;
+        while (ncap < sb->n + len + 1) ncap *= 2;
+        char *np = realloc(sb->p, ncap);
+        if (!np) {
+            sb->oom = 1;
+            return;
+        }
+        sb->p = np;
+        sb->cap = ncap;
+    }
+    memcpy(sb->p + sb->n, s, len);
+    sb->n += len;
+    sb->p[sb->n] = '\0';
+}
+
+static void sb_puts(struct sbuf *sb, const char *s) {
+    sb_putn(sb, s, strlen(s));
+}
+
+// Strings inside arrays and dictionaries are quoted so separators stay
+// unambiguous; a top-level string value is stored as-is.
+static void sb_put_string(struct sbuf *sb, const char *s, size_t len, int nested) {
+    if (!nested) {
+        sb_putn(sb, s, len);
+        return;
+    }
+    sb_putn(sb, "\"", 1);
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '"' || s[i] == '\\') sb_putn(sb, "\\", 1);
+        sb_putn(sb, s + i, 1);
+    }
+    sb_putn(sb, "\"", 1);
+}
+
+// Hand the buffer over to the caller (always a valid string, or NULL on OOM).
+static char *sb_take(struct sbuf *sb) {
+    if (!sb->oom && !sb->p) sb_putn(sb, "", 0);
+    char *p = sb->oom ? NULL : sb->p;
+    if (sb->oom) free(sb->p);
+    sb->p = NULL;
+    sb->n = sb->cap = 0;
+    sb->oom = 0;
+    return p;
+}
+
+static int ent_push(struct ent_list *l, char *key, char *value) {
+    if (!key || !value) {
+        free(key);
+        free(value);
+        return -1;
+    }
+    if (l->n == l->cap) {
+        size_t ncap = l->cap ? l->cap * 2 : 16;
+        struct ent_pair *nv = realloc(l->v, ncap * sizeof(*nv));
+        if (!nv) {
+            free(key);
+            free(value);
+            return -1;
+        }
+        l->v = nv;
+        l->cap = ncap;
+    }
+    l->v[l->n].key = key;
+    l->v[l->n].value = value;
+    l->n++;
+    return 0;
+}
+
+void ent_list_free(struct ent_list *l) {
+    for (size_t i = 0; i < l->n; i++) {
+        free(l->v[i].key);
+        free(l->v[i].value);
+    }
+    free(l->v);
+    memset(l, 0, sizeof(*l));
+}
+
+// ---- XML plist ----
+//
+// Not a general XML parser: just the plist subset codesign emits (dict,
+// array, key, string, integer, real, date, data, true, false), with the five
+// predefined entities and numeric character references.
+
+struct xml_cur {
+    const char *p;
+    const char *end;
+    int bad;
+};
+
+static int xml_starts(const struct xml_cur *c, const char *s) {
+    size_t n = strlen(s);
+    return (size_t)(c->end - c->p) >= n && memcmp(c->p, s, n) == 0;
+}
+
+// Skip to just past `s`; sets bad if it never appears.
+static void xml_skip_past(struct xml_cur *c, const char *s) {
+    size_t n = strlen(s);
+    while ((size_t)(c->end - c->p) >= n) {
+        if (memcmp(c->p, s, n) == 0) {
+            c->p += n;
+            return;
+        }
+        c->p++;
+    }
+    c->p = c->end;
+    c->bad = 1;
+}
+
+// Whitespace, <?xml ...?>, <!DOCTYPE ...> and comments.
+static void xml_skip_misc(struct xml_cur *c) {
+    while (c->p < c->end && !c->bad) {
+        char ch = *c->p;
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            c->p++;
+        } else if (xml_starts(c, "<?")) {
+            xml_skip_past(c, "?>");
+        } else if (xml_starts(c, "<!--")) {
+            xml_skip_past(c, "-->");
+        } else if (xml_starts(c, "<!")) {
+            xml_skip_past(c, ">");
+        } else {
+            break;
+        }
+    }
+}
+
+// Read "<name ...>" or "<name/>" or "</name>". Attributes are skipped.
+static int xml_tag(struct xml_cur *c, char *name, size_t cap, int *closing, int *empty) {
+    xml_skip_misc(c);
+    *closing = 0;
+    *empty = 0;
+    if (c->bad || c->p >= c->end || *c->p != '<') {
+        c->bad = 1;
+        return -1;
+    }
+    c->p++;
+    if (c->p < c->end && *c->p == '/') {
+        *closing = 1;
+        c->p++;
+    }
+    size_t n = 0;
+    while (c->p < c->end && *c->p != '>' && *c->p != '/' && *c->p != ' ' &&
+           *c->p != '\t' && *c->p != '\n' && *c->p != '\r') {
+        if (n + 1 < cap) name[n++] = *c->p;
+        c->p++;
+    }
+    name[n] = '\0';
+    while (c->p < c->end && *c->p != '>') {
+        if (*c->p == '/') *empty = 1;
+        else if (*c->p != ' ' && *c->p != '\t' && *c->p != '\n' && *c->p != '\r') *empty = 0;
+        c->p++;
+    }
+    if (c->p >= c->end) {
+        c->bad = 1;
+        return -1;
+    }
+    c->p++;
+    return 0;
+}
+
+static void put_utf8(struct sbuf *sb, unsigned long cp) {
+    char b[4];
+    size_t n;
+    if (cp < 0x80) {
+        b[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        b[0] = (char)(0xC0 | (cp >> 6));
+        b[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        b[0] = (char)(0xE0 | (cp >> 12));
+        b[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        b[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        b[0] = (char)(0xF0 | ((cp >> 18) & 0x07));
+        b[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        b[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        b[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    sb_putn(sb, b, n);
+}
+
+// Character data up to the next '<', entities decoded, into `out`.
+static void xml_text(struct xml_cur *c, struct sbuf *out) {
+    while (c->p < c->end && *c->p != '<') {
+        if (*c->p != '&') {
+            const char *s = c->p;
+            while (c->p < c->end && *c->p != '<' && *c->p != '&') c->p++;
+            sb_putn(out, s, (size_t)(c->p - s));
+            continue;
+        }
+        const char *semi = memchr(c->p, ';', (size_t)(c->end - c->p));
+        if (!semi || semi - c->p > 12) {
+            c->bad = 1;
+            return;
+        }
+        const char *ent = c->p + 1;
+        size_t len = (size_t)(semi - ent);
+        if (len == 3 && memcmp(ent, "amp", 3) == 0) sb_putn(out, "&", 1);
+        else if (len == 2 && memcmp(ent, "lt", 2) == 0) sb_putn(out, "<", 1);
+        else if (len == 2 && memcmp(ent, "gt", 2) == 0) sb_putn(out, ">", 1);
+        else if (len == 4 && memcmp(ent, "quot", 4) == 0) sb_putn(out, "\"", 1);
+        else if (len == 4 && memcmp(ent, "apos", 4) == 0) sb_putn(out, "'", 1);
+        else if (len >= 2 && ent[0] == '#') {
+            char num[16];
+            memcpy(num, ent + 1, len - 1);
+            num[len - 1] = '\0';
+            unsigned long cp = (num[0] == 'x') ? strtoul(num + 1, NULL, 16)
+                                               : strtoul(num, NULL, 10);
+            put_utf8(out, cp > 0x10FFFF ? 0xFFFD : cp);
+        } else {
+            c->bad = 1;
+            return;
+        }
+        c->p = semi + 1;
+    }
+}
+
+// Text of a simple element whose open tag was just read, through its close tag.
+static void xml_element_text(struct xml_cur *c, const char *name, struct sbuf *out) {
+    xml_text(c, out);
+    char close[16];
+    int closing, empty;
+    if (xml_tag(c, close, sizeof(close), &closing, &empty) != 0 || !closing ||
+        strcmp(close, name) != 0) {
+        c->bad = 1;
+    }
+}
+
+static void xml_value(struct xml_cur *c, const char *name, int empty, int depth,
+                      struct sbuf *out);
+
+// Contents of an <array> or <dict> whose open tag was just read.
+static void xml_container(struct xml_cur *c, int is_dict, int depth, struct sbuf *out) {
+    sb_puts(out, is_dict ? "{" : "[");
+    int first = 1;
+    while (!c->bad) {
+        char name[16];
+        int closing, empty;
+        if (xml_tag(c, name, sizeof(name), &closing, &empty) != 0) return;
+        if (closing) {
+            if (strcmp(name, is_dict ? "dict" : "array") != 0) c->bad = 1;
+            break;
+        }
+        if (is_dict) {
+            if (strcmp(name, "key") != 0) {
+                c->bad = 1;
+                return;
+            }
+            struct sbuf key = { 0 };
+            xml_element_text(c, "key", &key);
+            sb_puts(out, first ? "" : " ");
+            sb_put_string(out, key.p ? key.p : "", key.n, 1);
+            free(key.p);
+            sb_puts(out, " = ");
+            if (xml_tag(c, name, sizeof(name), &closing, &empty) != 0 || closing) {
+                c->bad = 1;
+                return;
+            }
+            xml_value(c, name, empty, depth + 1, out);
+            sb_puts(out, ";");
+        } else {
+            sb_puts(out, first ? "" : ", ");
+            xml_value(c, name, empty, depth + 1, out);
+        }
+        first = 0;
+    }
+    sb_puts(out, is_dict ? "}" : "]");
+}
+
+static void xml_value(struct xml_cur *c, const char *name, int empty, int depth,
+                      struct sbuf *out) {
+    int nested = depth > 0;
+    if (depth > ENT_MAX_DEPTH) {
+        c->bad = 1;
+        return;
+    }
+    if (strcmp(name, "true") == 0 || strcmp(name, "false") == 0) {
+        sb_puts(out, name);
+        if (!empty) {
+            struct sbuf junk = { 0 };
+            xml_element_text(c, name, &junk);
+            free(junk.p);
+        }
+    } else if (strcmp(name, "array") == 0 || strcmp(name, "dict") == 0) {
+        int is_dict = name[0] == 'd';
+        if (empty) sb_puts(out, is_dict ? "{}" : "[]");
+        else xml_container(c, is_dict, depth, out);
+    } else if (strcmp(name, "string") == 0 || strcmp(name, "integer") == 0 ||
+               strcmp(name, "real") == 0 || strcmp(name, "date") == 0 ||
+               strcmp(name, "data") == 0) {
+        struct sbuf text = { 0 };
+        if (!empty) xml_element_text(c, name, &text);
+        const char *s = text.p ? text.p : "";
+        size_t n = text.n;
+        if (name[0] == 's') {
+            sb_put_string(out, s, n, nested);
+        } else {
+            // Numbers and base64 are whitespace-insensitive.
+            while (n && (*s == ' ' || *s == '\n' || *s == '\t' || *s == '\r')) { s++; n--; }
+            while (n && (s[n - 1] == ' ' || s[n - 1] == '\n' || s[n - 1] == '\t' ||
+                         s[n - 1] == '\r')) n--;
+            if (name[1] == 'a' && name[0] == 'd') sb_puts(out, "<data ");
+            sb_putn(out, s, n);
+            if (name[1] == 'a' && name[0] == 'd') sb_puts(out, ">");
+        }
+        free(text.p);
+    } else {
+        c->bad = 1;
+    }
+}
+
+int ent_parse_xml(const uint8_t *p, size_t n, struct ent_list *out,
+                  char *errbuf, size_t errlen) {
+    struct xml_cur c = { (const char *)p, (const char *)p + n, 0 };
+    char name[16];
+    int closing, empty;
+
+    if (xml_tag(&c, name, sizeof(name), &closing, &empty) != 0 || strcmp(name, "plist") != 0) {
+        snprintf(errbuf, errlen, "entitlements: expected <plist>");
+        return -1;
+    }
+    if (xml_tag(&c, name, sizeof(name), &closing, &empty) != 0 || strcmp(name, "dict") != 0) {
+        snprintf(errbuf, errlen, "entitlements: top level is not a <dict>");
+        return -1;
+    }
+    if (empty) return 0;
+
+    while (!c.bad) {
+        if (xml_tag(&c, name, sizeof(name), &closing, &empty) != 0) break;
+        if (closing) return strcmp(name, "dict") == 0 ? 0 : -1;
+        if (strcmp(name, "key") != 0) {
+            c.bad = 1;
+            break;
+        }
+        struct sbuf key = { 0 };
+        struct sbuf val = { 0 };
+        xml_element_text(&c, "key", &key);
+        if (xml_tag(&c, name, sizeof(name), &closing, &empty) != 0 || closing) {
+            free(key.p);
+            c.bad = 1;
+            break;
+        }
+        xml_value(&c, name, empty, 0, &val);
+        if (c.bad) {
+            free(key.p);
+            free(val.p);
+            break;
+        }
+        if (ent_push(out, sb_take(&key), sb_take(&val)) != 0) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+    }
+    snprintf(errbuf, errlen, "entitlements: malformed XML near offset %zu",
+             (size_t)(c.p - (const char *)p));
+    return -1;
+}
+
+// ---- DER ----
+//
+// Layout written by codesign:
+//   [APPLICATION 16] { INTEGER 1, [CONTEXT 16] { SEQUENCE { UTF8String key, value }... } }
+// with values BOOLEAN, INTEGER, UTF8String, SEQUENCE (array) or
+// [CONTEXT 16] (dictionary).
+
+#define DER_BOOLEAN     0x01
+#define DER_INTEGER     0x02
+#define DER_UTF8STRING  0x0C
+#define DER_SEQUENCE    0x30
+#define DER_APP16       0x70
+#define DER_DICT        0xB0
+
+struct der_cur {
+    const uint8_t *p;
+    const uint8_t *end;
+};
+
+// One TLV with a low-number tag. Returns 0 and advances past it.
+static int der_next(struct der_cur *d, uint8_t *tag, struct der_cur *val) {
+    if (d->end - d->p < 2) return -1;
+    *tag = d->p[0];
+    if ((*tag & 0x1F) == 0x1F) return -1;
+    size_t len = d->p[1];
+    const uint8_t *q = d->p + 2;
+    if (len & 0x80) {
+        size_t nb = len & 0x7F;
+        if (nb == 0 || nb > 8 || (size_t)(d->end - q) < nb) return -1;
+        len = 0;
+        for (size_t i = 0; i < nb; i++) {
+            if (len >> 55) return -1;
+            len = (len << 8) | q[i];
+        }
+        q += nb;
+    }
+    if ((size_t)(d->end - q) < len) return -1;
+    val->p = q;
+    val->end = q + len;
+    d->p = q + len;
+    return 0;
+}
+
+static int der_value(uint8_t tag, struct der_cur v, int depth, struct sbuf *out) {
+    int nested = depth > 0;
+    if (depth > ENT_MAX_DEPTH) return -1;
+    size_t len = (size_t)(v.end - v.p);
+
+    switch (tag) {
+    case DER_BOOLEAN:
+        if (len != 1) return -1;
+        sb_puts(out, v.p[0] ? "true" : "false");
+        return 0;
+    case DER_INTEGER: {
+        if (len == 0 || len > 8) return -1;
+        int64_t x = (v.p[0] & 0x80) ? -1 : 0;
+        for (size_t i = 0; i < len; i++) x = (int64_t)(((uint64_t)x << 8) | v.p[i]);
+        char num[24];
+        snprintf(num, sizeof(num), "%lld", (long long)x);
+        sb_puts(out, num);
+        return 0;
+    }
+    case DER_UTF8STRING:
+        sb_put_string(out, (const char *)v.p, len, nested);
+        return 0;
+    case DER_SEQUENCE: {
+        sb_puts(out, "[");
+        int first = 1;
+        while (v.p < v.end) {
+            uint8_t et;
+            struct der_cur ev;
+            if (der_next(&v, &et, &ev) != 0) return -1;
+            sb_puts(out, first ? "" : ", ");
+            if (der_value(et, ev, depth + 1, out) != 0) return -1;
+            first = 0;
+        }
+        sb_puts(out, "]");
+        return 0;
+    }
+    case DER_DICT: {
+        sb_puts(out, "{");
+        int first = 1;
+        while (v.p < v.end) {
+            uint8_t et, kt, vt;
+            struct der_cur pair, kv, vv;
+            if (der_next(&v, &et, &pair) != 0 || et != DER_SEQUENCE) return -1;
+            if (der_next(&pair, &kt, &kv) != 0 || kt != DER_UTF8STRING) return -1;
+            if (der_next(&pair, &vt, &vv) != 0) return -1;
+            sb_puts(out, first ? "" : " ");
+            sb_put_string(out, (const char *)kv.p, (size_t)(kv.end - kv.p), 1);
+            sb_puts(out, " = ");
+            if (der_value(vt, vv, depth + 1, out) != 0) return -1;
+            sb_puts(out, ";");
+            first = 0;
+        }
+        sb_puts(out, "}");
+        return 0;
+    }
+    default: {
+        char t[24];
+        snprintf(t, sizeof(t), "<der tag 0x%02x>", tag);
+        sb_puts(out, t);
+        return 0;
+    }
+    }
+}
+
+int ent_parse_der(const uint8_t *p, size_t n, struct ent_list *out,
+                  char *errbuf, size_t errlen) {
+    struct der_cur d = { p, p + n };
+    struct der_cur body, ver, dict;
+    uint8_t tag;
+
+    if (der_next(&d, &tag, &body) != 0 || tag != DER_APP16 ||
+        der_next(&body, &tag, &ver) != 0 || tag != DER_INTEGER ||
+        der_next(&body, &tag, &dict) != 0 || tag != DER_DICT) {
+        snprintf(errbuf, errlen, "DER entitlements: unexpected outer structure");
+        return -1;
+    }
+
+    while (dict.p < dict.end) {
+        uint8_t et, kt, vt;
+        struct der_cur pair, kv, vv;
+        if (der_next(&dict, &et, &pair) != 0 || et != DER_SEQUENCE ||
+            der_next(&pair, &kt, &kv) != 0 || kt != DER_UTF8STRING ||
+            der_next(&pair, &vt, &vv) != 0) {
+            snprintf(errbuf, errlen, "DER entitlements: malformed entry %zu", out->n);
+            return -1;
+        }
+        struct sbuf key = { 0 };
+        struct sbuf val = { 0 };
+        sb_putn(&key, (const char *)kv.p, (size_t)(kv.end - kv.p));
+        if (der_value(vt, vv, 0, &val) != 0) {
+            free(key.p);
+            free(val.p);
+            snprintf(errbuf, errlen, "DER entitlements: malformed value for %zu", out->n);
+            return -1;
+        }
+        if (ent_push(out, sb_take(&key), sb_take(&val)) != 0) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ent_from_signature(const struct cs_signature *sig, struct ent_list *out,
+                       char *errbuf, size_t errlen) {
+    const struct cs_blob_ref *b = sig->der_entitlements;
+    if (b && b->length > 8) {
+        return ent_parse_der(b->data + 8, b->length - 8, out, errbuf, errlen);
+    }
+    b = sig->entitlements;
+    if (b && b->length > 8) {
+        return ent_parse_xml(b->data + 8, b->length - 8, out, errbuf, errlen);
+    }
+    return 1;
+}
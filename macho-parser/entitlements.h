@@ -0,0 +1,45 @@
+#ifndef MACHO_ENTITLEMENTS_H
+#define MACHO_ENTITLEMENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codesign.h"
+
+// Entitlements as flat (key, value) pairs.
+//
+// Signatures carry entitlements twice: an XML plist (slot 5) and, since
+// iOS 15 / macOS 12, a DER encoding of the same dictionary (slot 7), which
+// is what the kernel reads. Both are reduced to the top-level keys with the
+// value rendered as one line of text, so XML and DER sources compare equal:
+//
+//   true / false / 42 / plain string
+//   ["a", "b"]              arrays
+//   {"k" = v; ...}          nested dictionaries
+
+struct ent_pair {
+    char *key;
+    char *value;
+};
+
+struct ent_list {
+    struct ent_pair *v;
+    size_t n;
+    size_t cap;
+};
+
+// Both parsers append to `out` and return 0, or -1 on malformed input
+// (pairs parsed before the error are kept).
+int ent_parse_xml(const uint8_t *p, size_t n, struct ent_list *out,
+                  char *errbuf, size_t errlen);
+int ent_parse_der(const uint8_t *p, size_t n, struct ent_list *out,
+                  char *errbuf, size_t errlen);
+
+// DER blob if present, else XML. Returns 0 on success, 1 if the signature
+// has no entitlements, -1 on malformed blobs.
+int ent_from_signature(const struct cs_signature *sig, struct ent_list *out,
+                       char *errbuf, size_t errlen);
+
+void ent_list_free(struct ent_list *l);
+
+#endif /* MACHO_ENTITLEMENTS_H */
@@ -0,0 +1,552 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "entropy.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+
+#include "macho_common.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ENTROPY_HAVE_AVX2 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define MIN_FLAG_BYTES 1024
+#define CODE_HIGH 7.0
+#define DATA_HIGH 7.5
+
+// Counters are 32-bit inside a scan; entropy_add flushes them this often.
+#define SCAN_SPAN (1u << 30)
+
+// ---- scanning ----
+
+struct scan {
+    uint32_t t[8][256];
+    uint64_t zero_blocks;       // zero bytes in all-zero 32-byte blocks
+    uint64_t cur;               // zero run in progress
+    int seen;                   // a non-zero byte has been seen
+    struct entropy_acc *a;
+};
+
+// A zero run of `len` bytes (possibly 0) ended at a non-zero byte.
+static inline void run_end(struct scan *s, uint64_t len) {
+    if (!s->seen) {
+        s->a->lead = len;
+        s->seen = 1;
+    } else if (len >= ENTROPY_ZERO_RUN_MIN) {
+        s->a->runs++;
+        s->a->run_bytes += len;
+        if (len > s->a->longest) s->a->longest = len;
+    }
+}
+
+// Zero runs of a 32-byte block from its zero mask (bit i: byte i is 0).
+// Runs shorter than the minimum never matter, so only the ends of the
+// block are looked at unless it has room for an interior run.
+static inline void block_runs(struct scan *s, uint32_t m) {
+    if (m == 0xffffffffu) {
+        s->cur += 32;
+        return;
+    }
+    if (m == 0) {
+        run_end(s, s->cur);
+        s->cur = 0;
+        return;
+    }
+    unsigned lead = (unsigned)__builtin_ctz(~m);
+    unsigned trail = (unsigned)__builtin_clz(~m);
+    run_end(s, s->cur + lead);
+    if ((unsigned)__builtin_popcount(m) - lead - trail >= ENTROPY_ZERO_RUN_MIN) {
+        unsigned i = lead + 1;
+        while (i < 32 - trail) {
+            if (!((m >> i) & 1)) {
+                i++;
+                continue;
+            }
+            unsigned j = i;
+            while ((m >> j) & 1) j++;
+            run_end(s, j - i);
+            i = j;
+        }
+    }
+    s->cur = trail;
+}
+
+static inline void count8(struct scan *s, uint64_t w) {
+    s->t[0][w & 0xff]++;
+    s->t[1][(w >> 8) & 0xff]++;
+    s->t[2][(w >> 16) & 0xff]++;
+    s->t[3][(w >> 24) & 0xff]++;
+    s->t[4][(w >> 32) & 0xff]++;
+    s->t[5][(w >> 40) & 0xff]++;
+    s->t[6][(w >> 48) & 0xff]++;
+    s->t[7][w >> 56]++;
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void count32(struct scan *s, const uint8_t *p) {
+    count8(s, load64(p));
+    count8(s, load64(p + 8));
+    count8(s, load64(p + 16));
+    count8(s, load64(p + 24));
+}
+
+// Fewer than 32 bytes, one at a time.
+static void scan_tail(struct scan *s, const uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        s->t[i & 7][p[i]]++;
+        if (p[i] == 0) {
+            s->cur++;
+        } else {
+            run_end(s, s->cur);
+            s->cur = 0;
+        }
+    }
+}
+
+// Zero-byte mask of 8 bytes: bit i set when byte i is 0. The high bit of
+// each byte of t is exact (no borrow between bytes); the multiply gathers
+// them into the top byte.
+static inline uint32_t zmask8(uint64_t w) {
+    const uint64_t lo7 = 0x7f7f7f7f7f7f7f7full;
+    uint64_t t = ~(((w & lo7) + lo7) | w | lo7);
+    return (uint32_t)(((t >> 7) * 0x0102040810204080ull) >> 56);
+}
+
+static void scan_swar(struct scan *s, const uint8_t *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint32_t m = zmask8(load64(p + i)) | zmask8(load64(p + i + 8)) << 8 |
+                     zmask8(load64(p + i + 16)) << 16 | zmask8(load64(p + i + 24)) << 24;
+        if (m == 0xffffffffu) {
+            s->zero_blocks += 32;
+            s->cur += 32;
+            continue;
+        }
+        count32(s, p + i);
+        block_runs(s, m);
+    }
+    scan_tail(s, p + i, n - i);
+}
+
+#ifdef ENTROPY_HAVE_AVX2
+__attribute__((target("avx2")))
+static void scan_avx2(struct scan *s, const uint8_t *p, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+        if (m == 0xffffffffu) {
+            s->zero_blocks += 32;
+            s->cur += 32;
+            continue;
+        }
+        count32(s, p + i);
+        block_runs(s, m);
+    }
+    scan_tail(s, p + i, n - i);
+}
+
+static int cpu_has_avx2(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+    // AVX needs OS support for the YMM state (OSXSAVE + XCR0 bits 1-2).
+    if (!((c >> 27) & 1) || !((c >> 28) & 1)) return 0;
+    unsigned xlo, xhi;
+    __asm__ volatile("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+    if ((xlo & 6) != 6) return 0;
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 5) & 1;
+}
+#endif
+
+typedef void (*scan_fn)(struct scan *s, const uint8_t *p, size_t n);
+
+static scan_fn g_scan = scan_swar;
+static const char *g_scan_name = "swar";
+static pthread_once_t g_scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_pick(void) {
+#ifdef ENTROPY_HAVE_AVX2
+    if (cpu_has_avx2()) {
+        g_scan = scan_avx2;
+        g_scan_name = "avx2";
+    }
+#endif
+}
+
+const char *entropy_impl(void) {
+    pthread_once(&g_scan_once, scan_pick);
+    return g_scan_name;
+}
+
+// acc += next, where next's bytes follow acc's. A zero run that spans the
+// seam is joined before it is counted.
+static void acc_append(struct entropy_acc *acc, const struct entropy_acc *next) {
+    if (next->bytes == 0) return;
+    for (int i = 0; i < 256; i++) acc->hist[i] += next->hist[i];
+    if (acc->bytes == 0) {
+        acc->lead = next->lead;
+        acc->trail = next->trail;
+        acc->runs = next->runs;
+        acc->run_bytes = next->run_bytes;
+        acc->longest = next->longest;
+    } else if (acc->lead == acc->bytes) {
+        // All zero so far: the run continues into next.
+        acc->lead += next->lead;
+        acc->trail = next->lead == next->bytes ? acc->lead : next->trail;
+        acc->runs = next->runs;
+        acc->run_bytes = next->run_bytes;
+        acc->longest = next->longest;
+    } else if (next->lead == next->bytes) {
+        acc->trail += next->bytes;
+    } else {
+        uint64_t seam = acc->trail + next->lead;
+        if (seam >= ENTROPY_ZERO_RUN_MIN) {
+            acc->runs++;
+            acc->run_bytes += seam;
+            if (seam > acc->longest) acc->longest = seam;
+        }
+        acc->runs += next->runs;
+        acc->run_bytes += next->run_bytes;
+        if (next->longest > acc->longest) acc->longest = next->longest;
+        acc->trail = next->trail;
+    }
+    acc->bytes += next->bytes;
+}
+
+void entropy_add(struct entropy_acc *acc, const uint8_t *p, size_t n) {
+    pthread_once(&g_scan_once, scan_pick);
+    struct entropy_acc piece;
+    struct scan s;
+    memset(&piece, 0, sizeof(piece));
+    memset(&s, 0, sizeof(s));
+    s.a = &piece;
+    for (size_t done = 0; done < n;) {
+        size_t len = n - done < SCAN_SPAN ? n - done : SCAN_SPAN;
+        g_scan(&s, p + done, len);
+        for (int b = 0; b < 256; b++) {
+            uint64_t c = 0;
+            for (int t = 0; t < 8; t++) c += s.t[t][b];
+            piece.hist[b] += c;
+        }
+        memset(s.t, 0, sizeof(s.t));
+        done += len;
+    }
+    piece.hist[0] += s.zero_blocks;
+    piece.bytes = n;
+    if (!s.seen) piece.lead = n;
+    piece.trail = s.cur;
+    acc_append(acc, &piece);
+}
+
+// log2 without libm: the exponent from the bit length, the mantissa m in
+// [1, 2) from ln m = 2 atanh((m - 1) / (m + 1)), whose series converges
+// fast for |y| < 1/3.
+static double log2_u64(uint64_t c) {
+    int e = 63 - __builtin_clzll(c);
+    double m = (double)c / (double)(1ull << e);
+    double y = (m - 1.0) / (m + 1.0);
+    double y2 = y * y;
+    double s = y * (1.0 + y2 * (1.0 / 3 + y2 * (1.0 / 5 + y2 * (1.0 / 7 + y2 * (1.0 / 9 + y2 / 11)))));
+    return e + 2.0 * s * 1.4426950408889634;
+}
+
+double entropy_bits(const uint64_t hist[256], uint64_t n) {
+    if (n == 0) return 0.0;
+    double sum = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (hist[i]) sum += (double)hist[i] * log2_u64(hist[i]);
+    }
+    double h = log2_u64(n) - sum / (double)n;
+    return h < 0.0 ? 0.0 : h;
+}
+
+static void summarize(const struct entropy_acc *a, uint64_t offset, struct entropy_summary *out) {
+    memset(out, 0, sizeof(*out));
+    out->offset = offset;
+    out->bytes = a->bytes;
+    out->zeros = a->hist[0];
+    out->entropy = (float)entropy_bits(a->hist, a->bytes);
+    for (int i = 1; i < 256; i++) {
+        if (a->hist[i] > a->hist[out->top_byte]) out->top_byte = (uint8_t)i;
+    }
+    out->zero_runs = a->runs;
+    out->zero_run_bytes = a->run_bytes;
+    out->longest_zero_run = a->longest;
+    // The ends count as runs too; an all-zero range is one run.
+    uint64_t ends[2] = { a->lead, a->lead == a->bytes ? 0 : a->trail };
+    for (int i = 0; i < 2; i++) {
+        if (ends[i] < ENTROPY_ZERO_RUN_MIN) continue;
+        out->zero_runs++;
+        out->zero_run_bytes += ends[i];
+        if (ends[i] > out->longest_zero_run) out->longest_zero_run = ends[i];
+    }
+}
+
+// ---- report ----
+
+static int is_zerofill(uint32_t flags) {
+    uint32_t type = flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+static const struct macho_section *g_sort_sects;
+
+static int cmp_sect_off(const void *a, const void *b) {
+    const struct macho_section *x = &g_sort_sects[*(const uint32_t *)a];
+    const struct macho_section *y = &g_sort_sects[*(const uint32_t *)b];
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return (*(const uint32_t *)a > *(const uint32_t *)b) - (*(const uint32_t *)a < *(const uint32_t *)b);
+}
+
+static uint64_t min_u64(uint64_t a, uint64_t b) {
+    return a < b ? a : b;
+}
+
+int entropy_analyze(const struct macho_image *img, uint32_t page_size,
+                    struct entropy_report *out, char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    if (page_size == 0) page_size = img->cputype == CPU_TYPE_ARM64 ? 0x4000 : 0x1000;
+    out->page_size = page_size;
+
+    uint64_t crypt_lo = 0;
+    uint64_t crypt_hi = 0;
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        if ((lc->cmd != LC_ENCRYPTION_INFO && lc->cmd != LC_ENCRYPTION_INFO_64) || lc->cmdsize < 20) {
+            continue;
+        }
+        const uint8_t *p = img->buf + lc->offset;
+        crypt_lo = min_u64(load32_u(p + 8, img->swapped), img->size);
+        crypt_hi = min_u64(crypt_lo + load32_u(p + 12, img->swapped), img->size);
+        out->cryptid = load32_u(p + 16, img->swapped);
+        out->has_crypt = 1;
+        break;
+    }
+
+    // File-backed sections by offset, for the cut points.
+    uint32_t *order = malloc((img->nsects ? img->nsects : 1) * sizeof(*order));
+    size_t norder = 0;
+    out->sects = calloc(img->nsects ? img->nsects : 1, sizeof(*out->sects));
+    out->segs = calloc(img->nsegs ? img->nsegs : 1, sizeof(*out->segs));
+    struct entropy_acc *sect_acc = calloc(img->nsects ? img->nsects : 1, sizeof(*sect_acc));
+    struct entropy_acc *acc = calloc(4, sizeof(*acc));   // page, segment, whole, crypt
+    size_t npages_max = 0;
+    for (size_t g = 0; g < img->nsegs; g++) {
+        const struct segment_map *sg = &img->segs[g];
+        if (sg->filesize == 0 || sg->fileoff >= img->size) continue;
+        uint64_t end = min_u64(sg->fileoff + min_u64(sg->filesize, img->size), img->size);
+        npages_max += (end - 1) / page_size - sg->fileoff / page_size + 1;
+    }
+    out->pages = malloc((npages_max ? npages_max : 1) * sizeof(*out->pages));
+    if (!order || !out->sects || !out->segs || !sect_acc || !acc || !out->pages) {
+        free(order);
+        free(sect_acc);
+        free(acc);
+        entropy_report_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    out->nsects = img->nsects;
+    out->nsegs = img->nsegs;
+    for (size_t s = 0; s < img->nsects; s++) {
+        const struct macho_section *sec = &img->sects[s];
+        out->sects[s].offset = sec->offset;
+        if (is_zerofill(sec->flags) || sec->size == 0) continue;
+        if (sec->offset > img->size || sec->size > img->size - sec->offset) continue;
+        order[norder++] = (uint32_t)s;
+    }
+    g_sort_sects = img->sects;
+    qsort(order, norder, sizeof(*order), cmp_sect_off);
+
+    struct entropy_acc *page = &acc[0];
+    struct entropy_acc *seg = &acc[1];
+    struct entropy_acc *whole = &acc[2];
+    struct entropy_acc *crypt = &acc[3];
+    for (size_t g = 0; g < img->nsegs; g++) {
+        const struct segment_map *sg = &img->segs[g];
+        out->segs[g].offset = sg->fileoff;
+        if (sg->filesize == 0 || sg->fileoff >= img->size) continue;
+        uint64_t start = sg->fileoff;
+        uint64_t end = min_u64(start + min_u64(sg->filesize, img->size), img->size);
+        memset(seg, 0, sizeof(*seg));
+        memset(page, 0, sizeof(*page));
+        uint64_t page_start = start;
+        size_t k = 0;
+        for (uint64_t pos = start; pos < end;) {
+            // Next cut: page, section or crypt boundary, whichever is first.
+            uint64_t next = min_u64(end, (pos / page_size + 1) * page_size);
+            while (k < norder && (uint64_t)img->sects[order[k]].offset + img->sects[order[k]].size <= pos) {
+                k++;
+            }
+            int in_sect = 0;
+            if (k < norder) {
+                const struct macho_section *sec = &img->sects[order[k]];
+                in_sect = sec->offset <= pos;
+                next = min_u64(next, in_sect ? sec->offset + sec->size : sec->offset);
+            }
+            int in_crypt = pos >= crypt_lo && pos < crypt_hi;
+            if (in_crypt) next = min_u64(next, crypt_hi);
+            else if (crypt_lo > pos) next = min_u64(next, crypt_lo);
+
+            struct entropy_acc piece;
+            memset(&piece, 0, sizeof(piece));
+            entropy_add(&piece, img->buf + pos, (size_t)(next - pos));
+            acc_append(page, &piece);
+            acc_append(seg, &piece);
+            acc_append(whole, &piece);
+            if (in_sect) acc_append(&sect_acc[order[k]], &piece);
+            if (in_crypt) acc_append(crypt, &piece);
+            pos = next;
+
+            if (pos % page_size == 0 || pos == end) {
+                struct entropy_page *pg = &out->pages[out->npages++];
+                pg->offset = page_start;
+                pg->bytes = (uint32_t)page->bytes;
+                pg->segment = (uint32_t)g;
+                pg->entropy = (float)entropy_bits(page->hist, page->bytes);
+                pg->zero_share = page->bytes ? (float)page->hist[0] / (float)page->bytes : 0.0f;
+                memset(page, 0, sizeof(*page));
+                page_start = pos;
+            }
+        }
+        summarize(seg, start, &out->segs[g]);
+    }
+    for (size_t i = 0; i < norder; i++) {
+        summarize(&sect_acc[order[i]], img->sects[order[i]].offset, &out->sects[order[i]]);
+    }
+    summarize(whole, 0, &out->whole);
+    summarize(crypt, crypt_lo, &out->crypt);
+
+    // Flags.
+    int encrypted = out->has_crypt && out->cryptid != 0;
+    for (size_t s = 0; s < img->nsects; s++) {
+        struct entropy_summary *es = &out->sects[s];
+        if (es->bytes < MIN_FLAG_BYTES) continue;
+        const struct macho_section *sec = &img->sects[s];
+        int code = (sec->flags & (S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)) != 0;
+        if (es->entropy < (code ? CODE_HIGH : DATA_HIGH)) continue;
+        int covered = encrypted && sec->offset >= crypt_lo && sec->offset + sec->size <= crypt_hi;
+        es->flags |= covered ? ENTROPY_ENCRYPTED : code ? ENTROPY_PACKED : ENTROPY_COMPRESSED;
+        out->flags |= es->flags;
+    }
+    for (size_t g = 0; g < img->nsegs; g++) {
+        struct entropy_summary *es = &out->segs[g];
+        if (img->segs[g].nsects || strcmp(img->segs[g].name, SEG_LINKEDIT) == 0) continue;
+        if (es->bytes < MIN_FLAG_BYTES || es->entropy < CODE_HIGH) continue;
+        es->flags |= ENTROPY_PACKED;
+        out->flags |= es->flags;
+    }
+    if (encrypted) {
+        out->crypt.flags |= ENTROPY_ENCRYPTED;
+        if (out->crypt.bytes >= MIN_FLAG_BYTES && out->crypt.entropy < CODE_HIGH) {
+            out->crypt.flags |= ENTROPY_CRYPT_PLAIN;
+        }
+        out->flags |= out->crypt.flags;
+    }
+
+    free(order);
+    free(sect_acc);
+    free(acc);
+    return 0;
+}
+
+void entropy_report_free(struct entropy_report *r) {
+    free(r->sects);
+    free(r->segs);
+    free(r->pages);
+    memset(r, 0, sizeof(*r));
+}
+
+const char *entropy_flag_names(uint32_t flags, char *buf, size_t len) {
+    static const char *const names[] = { "packed", "compressed", "encrypted", "crypt_plain" };
+    size_t n = 0;
+    buf[0] = '\0';
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!(flags & (1u << i))) continue;
+        int w = snprintf(buf + n, len - n, "%s%s", n ? "|" : "", names[i]);
+        if (w < 0 || (size_t)w >= len - n) break;
+        n += (size_t)w;
+    }
+    if (n == 0) snprintf(buf, len, "-");
+    return buf;
+}
+
+// ---- printing ----
+
+static const char GLYPHS[] = " .:-=+*#%@";
+#define HEAT_WIDTH 64
+
+static char glyph(float bits) {
+    int i = (int)(bits * 10.0f / 8.0f);
+    if (i < 0) i = 0;
+    if (i > 9) i = 9;
+    return GLYPHS[i];
+}
+
+static void print_row(const char *indent, const char *name, const struct entropy_summary *es) {
+    char fl[64];
+    printf("%s%-*s %10llx %10llx %7.2f %5.1f%% %6llu %8llu  0x%02x  %s\n", indent,
+           (int)(26 - strlen(indent)), name, (unsigned long long)es->offset,
+           (unsigned long long)es->bytes, es->entropy,
+           es->bytes ? 100.0 * (double)es->zeros / (double)es->bytes : 0.0,
+           (unsigned long long)es->zero_runs, (unsigned long long)es->longest_zero_run,
+           es->top_byte, entropy_flag_names(es->flags, fl, sizeof(fl)));
+}
+
+void entropy_print(const struct macho_image *img, const struct entropy_report *r) {
+    char fl[64];
+    printf("entropy: %zu pages of %u KB, scan=%s, zero runs counted from %d bytes\n",
+           r->npages, r->page_size / 1024, entropy_impl(), ENTROPY_ZERO_RUN_MIN);
+    printf("  %-24s %10s %10s %7s %6s %6s %8s  %4s  %s\n", "region", "offset", "size",
+           "entropy", "zeros", "runs", "longest", "top", "flags");
+    for (size_t g = 0; g < img->nsegs; g++) {
+        const struct segment_map *sg = &img->segs[g];
+        if (r->segs[g].bytes == 0) continue;
+        print_row("  ", sg->name[0] ? sg->name : "(unnamed)", &r->segs[g]);
+        for (uint32_t s = sg->first_sect; s < sg->first_sect + sg->nsects && s < img->nsects; s++) {
+            if (r->sects[s].bytes == 0) continue;
+            print_row("    ", img->sects[s].sectname, &r->sects[s]);
+        }
+    }
+    print_row("  ", "(all segments)", &r->whole);
+    if (r->has_crypt) {
+        printf("  LC_ENCRYPTION_INFO cryptid=%u: ", r->cryptid);
+        if (r->crypt.bytes == 0) {
+            printf("empty range\n");
+        } else {
+            printf("0x%llx+0x%llx entropy %.2f %s\n", (unsigned long long)r->crypt.offset,
+                   (unsigned long long)r->crypt.bytes, r->crypt.entropy,
+                   entropy_flag_names(r->crypt.flags, fl, sizeof(fl)));
+        }
+    }
+
+    printf("heat map: one glyph per %u KB page, 0 to 8 bits per byte as \"%s\"\n",
+           r->page_size / 1024, GLYPHS);
+    for (size_t i = 0; i < r->npages;) {
+        uint32_t g = r->pages[i].segment;
+        size_t j = i;
+        while (j < r->npages && r->pages[j].segment == g && j - i < HEAT_WIDTH) j++;
+        char line[HEAT_WIDTH + 1];
+        for (size_t k = i; k < j; k++) line[k - i] = glyph(r->pages[k].entropy);
+        line[j - i] = '\0';
+        printf("  %-16s %10llx  |%s|\n", img->segs[g].name, (unsigned long long)r->pages[i].offset,
+               line);
+        i = j;
+    }
+    printf("verdict: %s\n", r->flags ? entropy_flag_names(r->flags, fl, sizeof(fl)) : "plain");
+}
@@ -0,0 +1,108 @@
+#ifndef MACHO_ENTROPY_H
+#define MACHO_ENTROPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Byte statistics per section, segment and page: Shannon entropy, the byte
+// histogram behind it, and zero runs. They separate ordinary code and data
+// from content that was packed, compressed or encrypted.
+//
+// Each segment's file range is cut at page, section and LC_ENCRYPTION_INFO
+// boundaries, and every piece is scanned once. A piece's histogram and
+// zero-run summary are added to its page, section, segment and crypt range,
+// so a page and the section it overlaps share one pass over the bytes. The
+// scan compares 32 bytes at a time against zero (AVX2, picked with CPUID at
+// runtime) or 8 at a time (SWAR). All-zero blocks skip counting, and zero runs
+// come from the compare masks. Other bytes are counted into eight tables, one
+// per byte lane of a 64-bit load, so runs of equal bytes and the repeated
+// opcode byte of every 4-byte instruction do not wait on one counter.
+//
+// Flags use these thresholds (entropy in bits per byte, 8 = random):
+//   packed      a code section, or a segment without sections other than
+//               __LINKEDIT, of at least 1 KB at 7.0 or more (compiled code
+//               stays near 6);
+//   compressed  a data section of at least 1 KB at 7.5 or more;
+//   encrypted   LC_ENCRYPTION_INFO(_64) with a nonzero cryptid. If its range
+//               has less than 7.0 bits per byte, crypt_plain is set too:
+//               cryptid says encrypted, the bytes say decrypted.
+
+#define ENTROPY_ZERO_RUN_MIN 16    // shorter zero runs are not counted
+
+enum {
+    ENTROPY_PACKED = 1u << 0,
+    ENTROPY_COMPRESSED = 1u << 1,
+    ENTROPY_ENCRYPTED = 1u << 2,
+    ENTROPY_CRYPT_PLAIN = 1u << 3,
+};
+
+// Running totals for a contiguous byte range, built from consecutive pieces.
+struct entropy_acc {
+    uint64_t hist[256];
+    uint64_t bytes;
+    uint64_t lead;              // zero bytes before the first non-zero byte
+    uint64_t trail;             // zero bytes after the last non-zero byte
+    uint64_t runs;              // zero runs >= ENTROPY_ZERO_RUN_MIN between non-zero bytes
+    uint64_t run_bytes;
+    uint64_t longest;
+};
+
+struct entropy_summary {
+    uint64_t offset;            // in the slice
+    uint64_t bytes;
+    uint64_t zeros;
+    uint64_t zero_runs;         // including runs at either end
+    uint64_t zero_run_bytes;
+    uint64_t longest_zero_run;
+    float entropy;              // bits per byte
+    uint8_t top_byte;           // most frequent value
+    uint32_t flags;             // ENTROPY_*
+};
+
+struct entropy_page {
+    uint64_t offset;            // in the slice
+    uint32_t bytes;
+    uint32_t segment;
+    float entropy;
+    float zero_share;
+};
+
+struct entropy_report {
+    uint32_t page_size;
+    struct entropy_summary *sects;  // per img->sects; bytes 0 if not file-backed
+    size_t nsects;
+    struct entropy_summary *segs;   // per img->segs (file range)
+    size_t nsegs;
+    struct entropy_page *pages;     // by segment, then offset
+    size_t npages;
+    struct entropy_summary whole;   // every segment's file bytes
+    int has_crypt;
+    uint32_t cryptid;
+    struct entropy_summary crypt;   // [cryptoff, cryptoff + cryptsize)
+    uint32_t flags;                 // union of all flags
+};
+
+// Statistics of img's file-backed segments. page_size 0 picks 16 KB for
+// arm64 and 4 KB otherwise. Returns 0, or -1 with a reason.
+int entropy_analyze(const struct macho_image *img, uint32_t page_size,
+                    struct entropy_report *out, char *errbuf, size_t errlen);
+void entropy_report_free(struct entropy_report *r);
+
+// Adds bytes p[0..n) (which follow whatever acc already holds) to acc.
+void entropy_add(struct entropy_acc *acc, const uint8_t *p, size_t n);
+// Shannon entropy of a histogram, in bits per byte.
+double entropy_bits(const uint64_t hist[256], uint64_t n);
+
+// Names of set flags joined with '|', or "-" for none.
+const char *entropy_flag_names(uint32_t flags, char *buf, size_t len);
+
+// Section table, crypt range, a heat map with one glyph per page, and the
+// verdict.
+void entropy_print(const struct macho_image *img, const struct entropy_report *r);
+
+// Name of the scan kernel in use: "avx2" or "swar".
+const char *entropy_impl(void);
+
+#endif /* MACHO_ENTROPY_H */
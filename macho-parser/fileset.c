@@ -0,0 +1,111 @@
+#include "fileset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+
+#include "macho_common.h"
+#include "parallel.h"
+
+int fileset_entries(const struct macho_image *img, struct fileset_entry **out, size_t *n,
+                    char *errbuf, size_t errlen) {
+    *out = NULL;
+    *n = 0;
+    if (img->filetype != MH_FILESET) {
+        snprintf(errbuf, errlen, "not an MH_FILESET (filetype 0x%x)", img->filetype);
+        return -1;
+    }
+    struct fileset_entry *v = calloc(img->ncmds_valid ? img->ncmds_valid : 1, sizeof(*v));
+    if (!v) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    size_t k = 0;
+    size_t iter = 0;
+    const struct macho_lc_ref *lc;
+    while ((lc = macho_image_next_cmd(img, LC_FILESET_ENTRY, &iter)) != NULL) {
+        const uint8_t *p = img->buf + lc->offset;
+        uint32_t name_off;
+        if (lc->cmdsize < sizeof(struct fileset_entry_command) ||
+            (name_off = load32_u(p + 24, img->swapped)) >= lc->cmdsize ||
+            !memchr(p + name_off, '\0', lc->cmdsize - name_off)) {
+            free(v);
+            snprintf(errbuf, errlen, "malformed LC_FILESET_ENTRY at offset 0x%x", lc->offset);
+            return -1;
+        }
+        v[k].vmaddr = load64_u(p + 8, img->swapped);
+        v[k].fileoff = load64_u(p + 16, img->swapped);
+        v[k].id = (const char *)p + name_off;
+        k++;
+    }
+    *out = v;
+    *n = k;
+    return 0;
+}
+
+long fileset_find(const struct fileset_entry *v, size_t n, const char *name) {
+    size_t nl = strlen(name);
+    long hit = -1;
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(v[i].id, name) == 0) return (long)i;
+        size_t il = strlen(v[i].id);
+        if (il > nl && v[i].id[il - nl - 1] == '.' && strcmp(v[i].id + il - nl, name) == 0) {
+            if (hit >= 0) return -1;
+            hit = (long)i;
+        }
+    }
+    return hit;
+}
+
+struct analyze_ctx {
+    const uint8_t *buf;
+    size_t size;
+    const struct fileset_entry *v;
+    struct fileset_entry_info *out;
+};
+
+static void analyze_range(size_t begin, size_t end, unsigned worker, void *arg) {
+    (void)worker;
+    struct analyze_ctx *c = arg;
+    for (size_t i = begin; i < end; i++) {
+        struct fileset_entry_info *info = &c->out[i];
+        memset(info, 0, sizeof(*info));
+        struct macho_image img;
+        if (macho_image_load_at(&img, c->buf, c->size, c->v[i].fileoff,
+                                info->err, sizeof(info->err)) != 0) {
+            continue;
+        }
+        info->ok = 1;
+        info->cputype = img.cputype;
+        info->filetype = img.filetype;
+        info->nsegs = (uint32_t)img.nsegs;
+        info->nsects = (uint32_t)img.nsects;
+        for (size_t s = 0; s < img.nsegs; s++) info->vmsize += img.segs[s].vmsize;
+        for (size_t s = 0; s < img.nsects; s++) {
+            if (img.sects[s].flags & (S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)) {
+                info->code_size += img.sects[s].size;
+            }
+        }
+        uint64_t *starts = NULL;
+        info->nfuncs = (uint32_t)macho_image_function_starts(&img, &starts);
+        free(starts);
+        struct macho_symbol *syms = NULL;
+        info->nsyms = (uint32_t)macho_image_defined_symbols(&img, &syms);
+        free(syms);
+        size_t iter = 0;
+        const struct macho_lc_ref *lc = macho_image_next_cmd(&img, LC_UUID, &iter);
+        if (lc && lc->cmdsize >= sizeof(struct uuid_command)) {
+            memcpy(info->uuid, img.buf + lc->offset + 8, 16);
+            info->has_uuid = 1;
+        }
+        macho_image_free(&img);
+    }
+}
+
+void fileset_analyze(const uint8_t *buf, size_t size, const struct fileset_entry *v,
+                     size_t n, unsigned jobs, struct fileset_entry_info *out) {
+    struct analyze_ctx ctx = { buf, size, v, out };
+    par_for(n, 4, jobs, analyze_range, &ctx);
+}
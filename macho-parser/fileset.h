@@ -0,0 +1,52 @@
+#ifndef MACHO_FILESET_H
+#define MACHO_FILESET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// MH_FILESET containers (kernelcaches since iOS 15 / macOS 11).
+//
+// The container's own load commands are segments covering everything plus
+// one LC_FILESET_ENTRY per member: the kernel itself and every kext. An
+// entry is a complete Mach-O header at `fileoff`; its segment, section
+// and __LINKEDIT offsets are relative to the container, so entries are
+// loaded with macho_image_load_at over the whole file.
+
+struct fileset_entry {
+    const char *id;          // "com.apple.kernel", "com.apple.driver.AppleARMPlatform", ...
+    uint64_t vmaddr;
+    uint64_t fileoff;
+};
+
+// Entries of a loaded MH_FILESET image, in load command order. Returns 0
+// with a malloc'd array (id strings point into the image), -1 on error.
+int fileset_entries(const struct macho_image *img, struct fileset_entry **out, size_t *n,
+                    char *errbuf, size_t errlen);
+
+// Index by id: exact match, else the unique entry whose id ends in
+// ".<name>" ("kernel" finds "com.apple.kernel"). -1 if none or ambiguous.
+long fileset_find(const struct fileset_entry *v, size_t n, const char *name);
+
+struct fileset_entry_info {
+    int ok;
+    char err[96];
+    uint32_t cputype;
+    uint32_t filetype;
+    uint32_t nsegs;
+    uint32_t nsects;
+    uint64_t vmsize;         // sum of segment sizes
+    uint64_t code_size;      // sections with instructions
+    uint32_t nfuncs;         // LC_FUNCTION_STARTS entries
+    uint32_t nsyms;          // defined symbols
+    int has_uuid;
+    uint8_t uuid[16];
+};
+
+// Load and summarise every entry of the container in `buf` (the whole
+// decompressed kernelcache), in parallel. jobs == 0 means one per CPU.
+void fileset_analyze(const uint8_t *buf, size_t size, const struct fileset_entry *v,
+                     size_t n, unsigned jobs, struct fileset_entry_info *out);
+
+#endif /* MACHO_FILESET_H */
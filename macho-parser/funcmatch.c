@@ -0,0 +1,750 @@
+#include "funcmatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/mach/machine.h"
+#include "../include/macho/loader.h"
+#include "../include/macho/nlist.h"
+
+#include "arm64_decode.h"
+#include "cfg.h"
+#include "macho_common.h"
+#include "parallel.h"
+#include "xref.h"
+
+#define FM_K 32                 // MinHash values per function
+#define FM_KW 8                 // ... over masked words, for scoring only
+#define FM_BANDS 8
+#define FM_ROWS (FM_K / FM_BANDS)
+#define FM_BUCKET_MAX 64        // larger LSH buckets are tiny, common shapes
+#define FM_MIN_SCORE 0.5f
+#define FM_NEIGHBOR_MIN 0.35f
+#define FM_MAX_STRING 256
+#define FM_NONE UINT32_MAX
+
+struct fm_func {
+    uint64_t start;
+    uint64_t end;
+    uint64_t exact;             // masked content hash
+    uint64_t strset;            // hash of the string set, 0 when empty
+    const char *name;
+    uint32_t sig[FM_K];
+    uint32_t sigw[FM_KW];
+    uint32_t ninsns;
+    uint32_t nblocks;
+    uint32_t nedges;
+    uint32_t ncall_sites;
+    uint32_t ncallees;
+    uint32_t ncallers;
+    uint32_t str_start;         // into fm_side.strs
+    uint32_t nstrs;
+    uint32_t match;             // index on the other side, or FM_NONE
+    float conf;
+    uint8_t how;
+};
+
+struct fm_side {
+    const struct macho_image *img;
+    const struct macho_section *text;
+    struct cfg_graph cfg;
+    struct macho_symbol *syms;  // defined, by address
+    size_t nsyms;
+    struct fm_func *f;          // cfg order, i.e. by address
+    size_t n;
+    uint64_t *strs;             // per function: sorted, unique string hashes
+};
+
+static uint64_t fmix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v;
+    h *= 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+static uint64_t hash_str(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (; *s; s++) h = (h ^ (uint8_t)*s) * 0x100000001b3ull;
+    return h;
+}
+
+static const char *symbol_at(const struct fm_side *s, uint64_t vmaddr) {
+    size_t lo = 0;
+    size_t hi = s->nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->syms[mid].addr < vmaddr) lo = mid + 1;
+        else hi = mid;
+    }
+    const char *local = NULL;
+    for (size_t i = lo; i < s->nsyms && s->syms[i].addr == vmaddr; i++) {
+        if (!s->syms[i].name[0]) continue;
+        if (s->syms[i].type & N_EXT) return s->syms[i].name;
+        if (!local) local = s->syms[i].name;
+    }
+    return local;
+}
+
+// Instruction class for the n-grams: the top ten opcode bits, which is what
+// the decoder's table is indexed by, with PC-relative forms reduced to their
+// kind (and condition) so that their immediates do not leak in.
+static uint32_t insn_class(uint32_t w, const struct a64_insn *d) {
+    switch (d->kind) {
+    case A64_ADRP:
+    case A64_ADR:
+    case A64_LDR_LIT:
+    case A64_B:
+    case A64_BL:
+    case A64_CBZ:
+    case A64_TBZ:
+        return 0x400u | d->kind;
+    case A64_B_COND:
+        return 0x400u | (uint32_t)d->kind << 4 | (w & 0xf);
+    default:
+        return w >> 22;
+    }
+}
+
+// The word as it would read after relinking anywhere: PC-relative
+// immediates cleared, and the page offset of an ADD/LDR/STR off an ADRP
+// result cleared. adrp_regs tracks which registers hold ADRP results.
+static uint32_t masked_word(uint32_t w, const struct a64_insn *d, uint32_t *adrp_regs) {
+    switch (d->kind) {
+    case A64_ADRP:
+        *adrp_regs |= 1u << d->rd;
+        return w & ~(3u << 29 | 0x7ffffu << 5);
+    case A64_ADR:
+        return w & ~(3u << 29 | 0x7ffffu << 5);
+    case A64_LDR_LIT:
+    case A64_B_COND:
+    case A64_CBZ:
+        return w & ~(0x7ffffu << 5);
+    case A64_TBZ:
+        return w & ~(0x3fffu << 5);
+    case A64_B:
+    case A64_BL:
+        return w & 0xfc000000u;
+    case A64_ADD_IMM:
+    case A64_LDST_UIMM: {
+        uint32_t v = (*adrp_regs & (1u << d->rn)) ? w & ~(0xfffu << 10) : w;
+        if (d->kind == A64_ADD_IMM || d->is_load) *adrp_regs &= ~(1u << d->rd);
+        return v;
+    }
+    default:
+        return w;
+    }
+}
+
+// k hash functions from two (Kirsch-Mitzenmacher); the loop has no
+// dependence between lanes, so it vectorizes.
+static void minhash_add(uint32_t *sig, uint32_t k_count, uint64_t shingle) {
+    uint64_t h1 = fmix(shingle);
+    uint64_t h2 = fmix(shingle ^ 0x9e3779b97f4a7c15ull) | 1;
+    for (uint32_t k = 0; k < k_count; k++) {
+        uint32_t v = (uint32_t)((h1 + k * h2) >> 32);
+        sig[k] = v < sig[k] ? v : sig[k];
+    }
+}
+
+static void feature_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct fm_side *s = ctx;
+    const struct cfg_graph *g = &s->cfg;
+    const uint8_t *code = s->img->buf + s->text->offset;
+    for (size_t i = begin; i < end; i++) {
+        const struct cfg_function *cf = &g->funcs[i];
+        struct fm_func *f = &s->f[i];
+        uint32_t n = cf->end > cf->start ? (uint32_t)((cf->end - cf->start) / 4) : 0;
+        const uint8_t *p = code + (cf->start - s->text->addr);
+        f->start = cf->start;
+        f->end = cf->end;
+        f->name = symbol_at(s, cf->start);
+        f->ninsns = n;
+        f->nblocks = cf->nblocks;
+        for (uint32_t b = 0; b < cf->nblocks; b++) f->nedges += g->blocks[cf->first_block + b].nsucc;
+        f->ncall_sites = cf->ncall_sites;
+        f->ncallees = cf->ncallees;
+        f->ncallers = cf->ncallers;
+        f->match = FM_NONE;
+        for (uint32_t k = 0; k < FM_K; k++) f->sig[k] = UINT32_MAX;
+        for (uint32_t k = 0; k < FM_KW; k++) f->sigw[k] = UINT32_MAX;
+
+        // Shingles are 3-grams of classes; shorter functions give one,
+        // padded with zeros.
+        uint64_t h = mix(0x6a09e667f3bcc908ull, n);
+        uint32_t adrp_regs = 0;
+        uint32_t t0 = 0;
+        uint32_t t1 = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t w = load32_u(p + (size_t)j * 4, 0);
+            struct a64_insn d;
+            a64_decode(w, &d);
+            uint32_t t = insn_class(w, &d);
+            uint32_t m = masked_word(w, &d, &adrp_regs);
+            h = mix(h, m);
+            minhash_add(f->sigw, FM_KW, m);
+            if (j >= 2 || j + 1 == n) {
+                minhash_add(f->sig, FM_K, (uint64_t)t0 << 22 | (uint64_t)t1 << 11 | t);
+            }
+            t0 = t1;
+            t1 = t;
+        }
+        f->exact = h;
+    }
+}
+
+struct str_ref {
+    uint32_t func;
+    uint64_t hash;
+};
+
+static int cmp_str_ref(const void *a, const void *b) {
+    const struct str_ref *x = a;
+    const struct str_ref *y = b;
+    if (x->func != y->func) return x->func < y->func ? -1 : 1;
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+static int is_string_ref(uint8_t kind) {
+    return kind == XREF_ADRP_ADD || kind == XREF_ADRP_LDST || kind == XREF_ADR ||
+           kind == XREF_LDR_LIT;
+}
+
+// Content hashes of the C strings each function references, from the xref
+// index's targets that fall in a cstring section.
+static int collect_strings(struct fm_side *s, unsigned nthreads, char *errbuf, size_t errlen) {
+    struct xref_index idx;
+    if (xref_build(s->img, nthreads, &idx, errbuf, errlen) != 0) return -1;
+    struct str_ref *v = NULL;
+    size_t n = 0;
+    size_t cap = 0;
+    int rc = -1;
+    for (size_t si = 0; si < s->img->nsects; si++) {
+        const struct macho_section *sec = &s->img->sects[si];
+        if ((sec->flags & SECTION_TYPE) != S_CSTRING_LITERALS) continue;
+        uint64_t send = sec->addr + sec->size;
+        size_t lo = 0;
+        size_t hi = idx.ntargets;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (idx.targets[mid] < sec->addr) lo = mid + 1;
+            else hi = mid;
+        }
+        for (size_t t = lo; t < idx.ntargets && idx.targets[t] < send; t++) {
+            uint64_t avail = send - idx.targets[t];
+            if (avail > FM_MAX_STRING) avail = FM_MAX_STRING;
+            const uint8_t *p = macho_image_vm_ptr(s->img, idx.targets[t], avail);
+            if (!p) continue;
+            uint64_t h = 0xcbf29ce484222325ull;
+            for (uint64_t k = 0; k < avail && p[k]; k++) h = (h ^ p[k]) * 0x100000001b3ull;
+            for (uint32_t r = idx.ref_start[t]; r < idx.ref_start[t + 1]; r++) {
+                if (!is_string_ref(idx.refs[r].kind)) continue;
+                long fi = cfg_function_at(&s->cfg, idx.refs[r].from);
+                if (fi < 0) continue;
+                if (n == cap) {
+                    size_t ncap = cap ? cap * 2 : 256;
+                    struct str_ref *nv = realloc(v, ncap * sizeof(*nv));
+                    if (!nv) goto oom;
+                    v = nv;
+                    cap = ncap;
+                }
+                v[n].func = (uint32_t)fi;
+                v[n++].hash = h;
+            }
+        }
+    }
+    if (n) qsort(v, n, sizeof(*v), cmp_str_ref);
+    s->strs = malloc((n ? n : 1) * sizeof(*s->strs));
+    if (!s->strs) goto oom;
+    size_t u = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct fm_func *f = &s->f[v[i].func];
+        if (f->nstrs && s->strs[u - 1] == v[i].hash) continue;
+        if (!f->nstrs) f->str_start = (uint32_t)u;
+        s->strs[u++] = v[i].hash;
+        f->nstrs++;
+        f->strset = mix(f->strset ? f->strset : 0x3c6ef372fe94f82bull, v[i].hash) | 1;
+    }
+    rc = 0;
+    goto done;
+oom:
+    snprintf(errbuf, errlen, "out of memory");
+done:
+    free(v);
+    xref_free(&idx);
+    return rc;
+}
+
+static int open_side(struct fm_side *s, const struct macho_image *img, unsigned nthreads,
+                     const char *which, char *errbuf, size_t errlen) {
+    char err[200];
+    memset(s, 0, sizeof(*s));
+    s->img = img;
+    if (cfg_build(img, nthreads, &s->cfg, err, sizeof(err)) != 0) {
+        snprintf(errbuf, errlen, "%s build: %s", which, err);
+        return -1;
+    }
+    s->text = macho_image_section(img, "__TEXT", "__text");
+    s->nsyms = macho_image_defined_symbols(img, &s->syms);
+    s->n = s->cfg.nfuncs;
+    s->f = calloc(s->n ? s->n : 1, sizeof(*s->f));
+    if (!s->f || s->n >= FM_NONE) {
+        snprintf(errbuf, errlen, "%s build: out of memory", which);
+        return -1;
+    }
+    par_for(s->n, 16, nthreads, feature_worker, s);
+    if (collect_strings(s, nthreads, err, sizeof(err)) != 0) {
+        snprintf(errbuf, errlen, "%s build: %s", which, err);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_side(struct fm_side *s) {
+    cfg_free(&s->cfg);
+    free(s->syms);
+    free(s->f);
+    free(s->strs);
+}
+
+static float ratio(uint32_t a, uint32_t b) {
+    if (a == b) return 1.0f;
+    return a < b ? (float)a / (float)b : (float)b / (float)a;
+}
+
+static float string_jaccard(const struct fm_side *a, const struct fm_func *x,
+                            const struct fm_side *b, const struct fm_func *y) {
+    const uint64_t *p = a->strs + x->str_start;
+    const uint64_t *q = b->strs + y->str_start;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t common = 0;
+    while (i < x->nstrs && j < y->nstrs) {
+        if (p[i] < q[j]) i++;
+        else if (p[i] > q[j]) j++;
+        else {
+            common++;
+            i++;
+            j++;
+        }
+    }
+    return (float)common / (float)(x->nstrs + y->nstrs - common);
+}
+
+static int contains(const uint32_t *list, uint32_t n, uint32_t v) {
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (list[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < n && list[lo] == v;
+}
+
+// Matched neighbours (callees, callers) of x whose partners are the same
+// kind of neighbour of y; *seen gets the matched neighbours of both.
+static uint32_t neighbours_agree(const struct fm_side *a, uint32_t x, const struct fm_side *b,
+                                 uint32_t y, uint32_t *seen) {
+    const struct cfg_function *fx = &a->cfg.funcs[x];
+    const struct cfg_function *fy = &b->cfg.funcs[y];
+    uint32_t agree = 0;
+    *seen = 0;
+    for (int dir = 0; dir < 2; dir++) {
+        const uint32_t *lx = dir ? a->cfg.callers + fx->caller_start : a->cfg.callees + fx->callee_start;
+        const uint32_t *ly = dir ? b->cfg.callers + fy->caller_start : b->cfg.callees + fy->callee_start;
+        uint32_t nx = dir ? fx->ncallers : fx->ncallees;
+        uint32_t ny = dir ? fy->ncallers : fy->ncallees;
+        for (uint32_t k = 0; k < nx; k++) {
+            uint32_t m = a->f[lx[k]].match;
+            if (m == FM_NONE) continue;
+            ++*seen;
+            agree += contains(ly, ny, m) != 0;
+        }
+        for (uint32_t k = 0; k < ny; k++) *seen += b->f[ly[k]].match != FM_NONE;
+    }
+    return agree;
+}
+
+// Weighted similarity in [0, 1]: the MinHash estimate of n-gram Jaccard
+// similarity dominates; shape, call degree and strings (when either side
+// has any) refine it, and so does agreement among neighbours that are
+// already matched.
+static float score(const struct fm_side *a, uint32_t i, const struct fm_side *b, uint32_t j) {
+    const struct fm_func *x = &a->f[i];
+    const struct fm_func *y = &b->f[j];
+    uint32_t same = 0;
+    uint32_t samew = 0;
+    if (x->ninsns && y->ninsns) {
+        for (uint32_t k = 0; k < FM_K; k++) same += x->sig[k] == y->sig[k];
+        for (uint32_t k = 0; k < FM_KW; k++) samew += x->sigw[k] == y->sigw[k];
+    }
+    float code = 0.75f * (float)same / FM_K + 0.25f * (float)samew / FM_KW;
+    float shape = (ratio(x->ninsns, y->ninsns) + ratio(x->nblocks, y->nblocks) +
+                   ratio(x->nedges, y->nedges)) / 3.0f;
+    float calls = (ratio(x->ncall_sites, y->ncall_sites) + ratio(x->ncallees, y->ncallees) +
+                   ratio(x->ncallers, y->ncallers)) / 3.0f;
+    float total = 0.55f * code + 0.15f * shape + 0.15f * calls;
+    float weight = 0.85f;
+    if (x->nstrs || y->nstrs) {
+        total += 0.15f * string_jaccard(a, x, b, y);
+        weight += 0.15f;
+    }
+    uint32_t seen = 0;
+    uint32_t agree = neighbours_agree(a, i, b, j, &seen);
+    if (seen) {
+        total += 0.3f * (float)agree / (float)(seen - agree);
+        weight += 0.3f;
+    }
+    return total / weight;
+}
+
+static void set_match(struct fm_side *a, uint32_t i, struct fm_side *b, uint32_t j,
+                      uint8_t how, float conf) {
+    a->f[i].match = j;
+    b->f[j].match = i;
+    a->f[i].how = b->f[j].how = how;
+    a->f[i].conf = b->f[j].conf = conf;
+}
+
+struct fm_key {
+    uint64_t key;
+    uint32_t idx;
+};
+
+static int cmp_key(const void *a, const void *b) {
+    const struct fm_key *x = a;
+    const struct fm_key *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+static uint64_t func_key(const struct fm_func *f, uint8_t how) {
+    switch (how) {
+    case FUNCMATCH_NAME: return f->name ? hash_str(f->name) | 1 : 0;
+    case FUNCMATCH_EXACT: return f->ninsns ? f->exact | 1 : 0;
+    default: return f->strset;
+    }
+}
+
+static size_t unmatched_keys(const struct fm_side *s, uint8_t how, struct fm_key *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        if (s->f[i].match != FM_NONE) continue;
+        uint64_t k = func_key(&s->f[i], how);
+        if (!k) continue;
+        out[n].key = k;
+        out[n++].idx = (uint32_t)i;
+    }
+    qsort(out, n, sizeof(*out), cmp_key);
+    return n;
+}
+
+// Pairs the unmatched functions whose key occurs exactly once on each side.
+static int match_unique(struct fm_side *a, struct fm_side *b, uint8_t how) {
+    struct fm_key *ka = malloc((a->n ? a->n : 1) * sizeof(*ka));
+    struct fm_key *kb = malloc((b->n ? b->n : 1) * sizeof(*kb));
+    if (!ka || !kb) {
+        free(ka);
+        free(kb);
+        return -1;
+    }
+    size_t na = unmatched_keys(a, how, ka);
+    size_t nb = unmatched_keys(b, how, kb);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb) {
+        if (ka[i].key < kb[j].key) i++;
+        else if (ka[i].key > kb[j].key) j++;
+        else {
+            uint64_t k = ka[i].key;
+            size_t ri = i;
+            size_t rj = j;
+            while (ri < na && ka[ri].key == k) ri++;
+            while (rj < nb && kb[rj].key == k) rj++;
+            uint32_t x = ka[i].idx;
+            uint32_t y = kb[j].idx;
+            if (ri - i == 1 && rj - j == 1 &&
+                (how != FUNCMATCH_NAME || strcmp(a->f[x].name, b->f[y].name) == 0)) {
+                float conf = how == FUNCMATCH_STRINGS ? (1.0f + score(a, x, b, y)) / 2.0f : 1.0f;
+                set_match(a, x, b, y, how, conf);
+            }
+            i = ri;
+            j = rj;
+        }
+    }
+    free(ka);
+    free(kb);
+    return 0;
+}
+
+static uint64_t band_key(const uint32_t *sig, uint32_t band) {
+    uint64_t k = fmix(band + 1);
+    for (uint32_t r = 0; r < FM_ROWS; r++) k = fmix(k ^ sig[band * FM_ROWS + r]);
+    return k;
+}
+
+// LSH table: (band key, function) for every unmatched function, sorted.
+static struct fm_key *band_table(const struct fm_side *s, size_t *count) {
+    struct fm_key *t = malloc((s->n ? s->n : 1) * FM_BANDS * sizeof(*t));
+    if (!t) return NULL;
+    size_t n = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        if (s->f[i].match != FM_NONE || s->f[i].ninsns == 0) continue;
+        for (uint32_t b = 0; b < FM_BANDS; b++) {
+            t[n].key = band_key(s->f[i].sig, b);
+            t[n++].idx = (uint32_t)i;
+        }
+    }
+    qsort(t, n, sizeof(*t), cmp_key);
+    *count = n;
+    return t;
+}
+
+struct lsh_job {
+    const struct fm_side *from;
+    const struct fm_side *to;
+    const struct fm_key *table;   // over `to`
+    size_t ntable;
+    uint32_t *best;               // per `from` function
+    float *best_score;
+    float *second;
+};
+
+static int same_band(const uint32_t *x, const uint32_t *y, uint32_t band) {
+    return memcmp(x + band * FM_ROWS, y + band * FM_ROWS, FM_ROWS * sizeof(*x)) == 0;
+}
+
+static void lsh_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct lsh_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        const struct fm_func *f = &job->from->f[i];
+        job->best[i] = FM_NONE;
+        job->best_score[i] = 0.0f;
+        job->second[i] = 0.0f;
+        if (f->match != FM_NONE || f->ninsns == 0) continue;
+        for (uint32_t b = 0; b < FM_BANDS; b++) {
+            uint64_t key = band_key(f->sig, b);
+            size_t lo = 0;
+            size_t hi = job->ntable;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (job->table[mid].key < key) lo = mid + 1;
+                else hi = mid;
+            }
+            size_t e = lo;
+            while (e < job->ntable && job->table[e].key == key) e++;
+            if (e - lo > FM_BUCKET_MAX) {
+                // Dozens of functions share these rows: whatever scores
+                // best elsewhere is a guess. Leave it to the call graph.
+                job->best[i] = FM_NONE;
+                break;
+            }
+            for (size_t c = lo; c < e; c++) {
+                uint32_t j = job->table[c].idx;
+                const uint32_t *sig = job->to->f[j].sig;
+                // Score each candidate once: in the first band it shares.
+                uint32_t pb = 0;
+                while (pb < b && !same_band(f->sig, sig, pb)) pb++;
+                if (pb < b) continue;
+                float sc = score(job->from, (uint32_t)i, job->to, j);
+                if (sc > job->best_score[i]) {
+                    job->second[i] = job->best_score[i];
+                    job->best_score[i] = sc;
+                    job->best[i] = j;
+                } else if (sc > job->second[i]) {
+                    job->second[i] = sc;
+                }
+            }
+        }
+    }
+}
+
+// Mutual best LSH candidates; each direction is scored in parallel.
+static int match_lsh(struct fm_side *a, struct fm_side *b, unsigned nthreads) {
+    size_t nta = 0;
+    size_t ntb = 0;
+    struct fm_key *ta = band_table(a, &nta);
+    struct fm_key *tb = band_table(b, &ntb);
+    uint32_t *best_a = malloc((a->n ? a->n : 1) * sizeof(*best_a));
+    uint32_t *best_b = malloc((b->n ? b->n : 1) * sizeof(*best_b));
+    float *sc_a = malloc((a->n ? a->n : 1) * 2 * sizeof(*sc_a));
+    float *sc_b = malloc((b->n ? b->n : 1) * 2 * sizeof(*sc_b));
+    int rc = -1;
+    if (!ta || !tb || !best_a || !best_b || !sc_a || !sc_b) goto done;
+
+    struct lsh_job ja = { a, b, tb, ntb, best_a, sc_a, sc_a + a->n };
+    struct lsh_job jb = { b, a, ta, nta, best_b, sc_b, sc_b + b->n };
+    par_for(a->n, 64, nthreads, lsh_worker, &ja);
+    par_for(b->n, 64, nthreads, lsh_worker, &jb);
+    for (size_t i = 0; i < a->n; i++) {
+        uint32_t j = best_a[i];
+        if (j == FM_NONE || best_b[j] != i || sc_a[i] < FM_MIN_SCORE) continue;
+        float sc = sc_a[i];
+        float runner = ja.second[i] > jb.second[j] ? ja.second[i] : jb.second[j];
+        float gap = sc - runner;
+        float conf = gap >= 0.1f ? sc : sc * (0.5f + 5.0f * gap);
+        set_match(a, (uint32_t)i, b, j, FUNCMATCH_LSH, conf);
+    }
+    rc = 0;
+done:
+    free(ta);
+    free(tb);
+    free(best_a);
+    free(best_b);
+    free(sc_a);
+    free(sc_b);
+    return rc;
+}
+
+// The single unmatched function among list[0..n), or FM_NONE.
+static uint32_t lone_unmatched(const struct fm_side *s, const uint32_t *list, uint32_t n) {
+    uint32_t found = FM_NONE;
+    for (uint32_t k = 0; k < n; k++) {
+        if (s->f[list[k]].match != FM_NONE) continue;
+        if (found != FM_NONE && found != list[k]) return FM_NONE;
+        found = list[k];
+    }
+    return found;
+}
+
+// One pass over matched pairs: where each side has exactly one unmatched
+// callee (or caller), those two are likely the same function. Returns
+// how many pairs were added.
+static size_t match_neighbours(struct fm_side *a, struct fm_side *b) {
+    size_t added = 0;
+    for (size_t i = 0; i < a->n; i++) {
+        uint32_t j = a->f[i].match;
+        if (j == FM_NONE) continue;
+        const struct cfg_function *fa = &a->cfg.funcs[i];
+        const struct cfg_function *fb = &b->cfg.funcs[j];
+        for (int dir = 0; dir < 2; dir++) {
+            uint32_t x = dir ? lone_unmatched(a, a->cfg.callers + fa->caller_start, fa->ncallers)
+                             : lone_unmatched(a, a->cfg.callees + fa->callee_start, fa->ncallees);
+            uint32_t y = dir ? lone_unmatched(b, b->cfg.callers + fb->caller_start, fb->ncallers)
+                             : lone_unmatched(b, b->cfg.callees + fb->callee_start, fb->ncallees);
+            if (x == FM_NONE || y == FM_NONE) continue;
+            float sc = score(a, x, b, y);
+            if (sc < FM_NEIGHBOR_MIN) continue;
+            float parent = a->f[i].conf;
+            set_match(a, x, b, y, FUNCMATCH_CALLGRAPH, sc < parent ? sc : parent);
+            added++;
+        }
+    }
+    return added;
+}
+
+int funcmatch_build(const struct macho_image *old_img, const struct macho_image *new_img,
+                    unsigned nthreads, struct funcmatch_map *out, char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    struct fm_side s[2];
+    memset(s, 0, sizeof(s));
+    int rc = -1;
+    a64_decode_init();
+    if (open_side(&s[0], old_img, nthreads, "old", errbuf, errlen) != 0 ||
+        open_side(&s[1], new_img, nthreads, "new", errbuf, errlen) != 0) {
+        goto done;
+    }
+
+    static const uint8_t unique_rounds[] = { FUNCMATCH_NAME, FUNCMATCH_EXACT, FUNCMATCH_STRINGS };
+    for (size_t r = 0; r < sizeof(unique_rounds); r++) {
+        if (match_unique(&s[0], &s[1], unique_rounds[r]) != 0) goto oom;
+    }
+    if (match_lsh(&s[0], &s[1], nthreads) != 0) goto oom;
+    while (match_neighbours(&s[0], &s[1]) != 0) {
+    }
+
+    out->v = calloc(s[0].n ? s[0].n : 1, sizeof(*out->v));
+    if (!out->v) goto oom;
+    out->n = s[0].n;
+    out->nnew = s[1].n;
+    for (size_t i = 0; i < s[0].n; i++) {
+        const struct fm_func *f = &s[0].f[i];
+        struct funcmatch_entry *e = &out->v[i];
+        e->old_addr = f->start;
+        e->old_size = f->end - f->start;
+        e->name = f->name;
+        if (f->match != FM_NONE) {
+            const struct fm_func *g = &s[1].f[f->match];
+            e->new_addr = g->start;
+            if (!e->name) e->name = g->name;
+            e->confidence = f->conf;
+            e->how = f->how;
+            e->patch_bytes = s[1].cfg.funcs[f->match].patch_bytes;
+        }
+        out->by_how[e->how]++;
+    }
+    rc = 0;
+    goto done;
+oom:
+    snprintf(errbuf, errlen, "out of memory");
+done:
+    close_side(&s[0]);
+    close_side(&s[1]);
+    return rc;
+}
+
+void funcmatch_free(struct funcmatch_map *m) {
+    free(m->v);
+    memset(m, 0, sizeof(*m));
+}
+
+const struct funcmatch_entry *funcmatch_lookup(const struct funcmatch_map *m,
+                                               uint64_t old_addr) {
+    size_t lo = 0;
+    size_t hi = m->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->v[mid].old_addr <= old_addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    const struct funcmatch_entry *e = &m->v[lo - 1];
+    return old_addr - e->old_addr < e->old_size ? e : NULL;
+}
+
+const char *funcmatch_how_name(uint8_t how) {
+    static const char *const names[FUNCMATCH_HOW_COUNT] = {
+        "none", "name", "exact", "strings", "lsh", "callgraph",
+    };
+    return how < FUNCMATCH_HOW_COUNT ? names[how] : "?";
+}
+
+static void print_entry(const struct funcmatch_entry *e) {
+    if (e->how == FUNCMATCH_NONE) {
+        printf("0x%llx -> none%s%s\n", (unsigned long long)e->old_addr, e->name ? " " : "",
+               e->name ? e->name : "");
+        return;
+    }
+    printf("0x%llx -> 0x%llx conf=%.2f via=%s patch_bytes=%u%s%s\n",
+           (unsigned long long)e->old_addr, (unsigned long long)e->new_addr, e->confidence,
+           funcmatch_how_name(e->how), e->patch_bytes, e->name ? " " : "",
+           e->name ? e->name : "");
+}
+
+void funcmatch_print(const struct funcmatch_map *m, int only_addr, uint64_t addr) {
+    printf("== Function matches (old -> new) ==\n");
+    printf("old=%zu new=%zu matched=%zu (name=%zu exact=%zu strings=%zu lsh=%zu callgraph=%zu)\n",
+           m->n, m->nnew, m->n - m->by_how[FUNCMATCH_NONE], m->by_how[FUNCMATCH_NAME],
+           m->by_how[FUNCMATCH_EXACT], m->by_how[FUNCMATCH_STRINGS], m->by_how[FUNCMATCH_LSH],
+           m->by_how[FUNCMATCH_CALLGRAPH]);
+    if (only_addr) {
+        const struct funcmatch_entry *e = funcmatch_lookup(m, addr);
+        if (!e) {
+            printf("0x%llx: not inside a known function\n", (unsigned long long)addr);
+            return;
+        }
+        print_entry(e);
+        return;
+    }
+    for (size_t i = 0; i < m->n; i++) print_entry(&m->v[i]);
+}
@@ -0,0 +1,83 @@
+#ifndef MACHO_FUNCMATCH_H
+#define MACHO_FUNCMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Function matching between two builds of an arm64 binary: where did each
+// function of the old build go in the new one?
+//
+// Every function in __TEXT,__text (cfg_build's boundaries) gets features
+// that survive relinking and small edits:
+//   - a content hash with PC-relative immediates and ADRP page offsets
+//     masked, for exact matches;
+//   - a MinHash signature over 3-grams of instruction classes (the top ten
+//     opcode bits, PC-relative forms reduced to their kind), so registers,
+//     addresses and branch distances do not count;
+//   - CFG shape (instructions, blocks, edges) and call degree (call sites,
+//     callees, callers);
+//   - the C strings it references (xref_build's targets in cstring
+//     sections), hashed by content.
+//
+// Matching runs in rounds, each over what is still unmatched: unique
+// symbol names, unique content hashes, unique non-empty string sets, then
+// LSH over bands of the MinHash signature (a pair is kept if each side is
+// the other's best score), and last the neighbours of matched pairs, where
+// a single unmatched callee or caller on each side pairs up. Feature
+// extraction and LSH scoring run on par_for workers.
+//
+// Name and exact matches have confidence 1. A unique string set averages 1
+// with the pair's score. LSH and neighbour matches use the score, and an
+// LSH match loses up to half of it when a runner-up scores within 0.1.
+//
+// Addresses are unslid vmaddrs. For a match, new_addr + slide is the `src`
+// of arm64_patch_prologue and patch_bytes its insn_bytes: cfg_build's
+// patch window in the new build, 0 when the prologue cannot be relocated.
+
+enum funcmatch_how {
+    FUNCMATCH_NONE = 0,
+    FUNCMATCH_NAME,
+    FUNCMATCH_EXACT,
+    FUNCMATCH_STRINGS,
+    FUNCMATCH_LSH,
+    FUNCMATCH_CALLGRAPH,
+    FUNCMATCH_HOW_COUNT
+};
+
+struct funcmatch_entry {
+    uint64_t old_addr;
+    uint64_t old_size;
+    uint64_t new_addr;         // 0 when unmatched
+    const char *name;          // old build's symbol (else the new one's), or NULL
+    float confidence;          // 0..1
+    uint8_t how;               // enum funcmatch_how
+    uint32_t patch_bytes;
+};
+
+struct funcmatch_map {
+    struct funcmatch_entry *v; // one per old function, by old_addr
+    size_t n;
+    size_t nnew;               // functions in the new build
+    size_t by_how[FUNCMATCH_HOW_COUNT];
+};
+
+// Both images must be arm64 with a __TEXT,__text section. nthreads == 0
+// uses every online CPU. Names alias the images. Returns 0, or -1 with a
+// reason.
+int funcmatch_build(const struct macho_image *old_img, const struct macho_image *new_img,
+                    unsigned nthreads, struct funcmatch_map *out, char *errbuf, size_t errlen);
+void funcmatch_free(struct funcmatch_map *m);
+
+// Entry of the old function containing old_addr, or NULL.
+const struct funcmatch_entry *funcmatch_lookup(const struct funcmatch_map *m,
+                                               uint64_t old_addr);
+
+const char *funcmatch_how_name(uint8_t how);
+
+// One line per old function (or only the one containing addr):
+//   0x100004000 -> 0x100004120 conf=0.97 via=lsh patch_bytes=16 _name
+void funcmatch_print(const struct funcmatch_map *m, int only_addr, uint64_t addr);
+
+#endif /* MACHO_FUNCMATCH_H */
@@ -0,0 +1,222 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+
+// fuzz_macho: in-process fuzz harness for the Mach-O header parsers.
+//
+// Each input goes straight to parse_fat, parse_thin_macho_64 or
+// parse_thin_macho_32 by magic, with no fork, exec or file I/O in between,
+// so one process runs tens of thousands of inputs per second where a
+// fork and exec of `macho_inspect FILE` per input is capped at a few
+// thousand, and far fewer under a sanitizer runtime. The parsers are
+// the static functions in macho_inspect.c, which is compiled into this
+// file with its main renamed. Their stdout goes to /dev/null; their
+// stderr is redirected to /dev/null by macro so the real stderr stays
+// free for libFuzzer, AFL++ and sanitizer reports.
+//
+// Three front ends share LLVMFuzzerTestOneInput:
+//   make fuzz         libFuzzer (clang -fsanitize=fuzzer), with
+//                     macho_fuzz_mutate as LLVMFuzzerCustomMutator
+//   make fuzz-afl     AFL++ persistent mode (afl-clang-fast) plus the
+//                     mutator as an AFL_CUSTOM_MUTATOR_LIBRARY
+//   make fuzz-replay  plain $(CC) with sanitizers: replay files, or run a
+//                     mutation loop without any fuzzing toolchain
+//
+//   fuzz_macho_replay [-n ITER] [-s SEED] [-w FILE] <file>...
+//
+// Seeds: `make fuzz-seeds` copies macho/{true,whoami,yes} and their thin
+// slices into fuzz_seeds/.
+
+static FILE *fuzz_sink;
+
+static FILE *fuzz_stderr(void) {
+    return stderr;
+}
+
+#undef stderr
+#define stderr fuzz_sink
+#define main macho_inspect_main
+#include "macho_inspect.c"
+#undef main
+#undef stderr
+
+#include "fuzz_mutator.h"
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t max_size, unsigned int seed);
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)argc;
+    (void)argv;
+    if (fuzz_sink) return 0;
+    if (!freopen("/dev/null", "w", stdout)) {
+        fprintf(fuzz_stderr(), "error: cannot redirect stdout to /dev/null\n");
+        abort();
+    }
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    fuzz_sink = fopen("/dev/null", "w");
+    if (!fuzz_sink) {
+        fprintf(fuzz_stderr(), "error: cannot open /dev/null\n");
+        abort();
+    }
+    setvbuf(fuzz_sink, NULL, _IOFBF, 1 << 16);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < sizeof(uint32_t)) return 0;
+    uint32_t magic = 0;
+    memcpy(&magic, data, sizeof(magic));
+
+    if (is_fat_magic(magic)) {
+        struct parse_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        parse_fat(data, size, &opts);
+    } else if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        parse_thin_macho_64(data, size);
+    } else if (magic == MH_MAGIC || magic == MH_CIGAM) {
+        parse_thin_macho_32(data, size);
+    }
+    return 0;
+}
+
+size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t max_size, unsigned int seed) {
+    uint64_t rng = ((uint64_t)seed << 32) | seed;
+    return macho_fuzz_mutate(data, size, max_size, &rng);
+}
+
+#if defined(__AFL_FUZZ_TESTCASE_LEN)
+// AFL++ persistent mode: the process is forked once, then fed up to 10000
+// inputs through shared memory before AFL++ restarts it.
+__AFL_FUZZ_INIT();
+
+int main(void) {
+    LLVMFuzzerInitialize(NULL, NULL);
+    __AFL_INIT();
+    const uint8_t *buf = __AFL_FUZZ_TESTCASE_BUF;
+    while (__AFL_LOOP(10000)) {
+        LLVMFuzzerTestOneInput(buf, (size_t)__AFL_FUZZ_TESTCASE_LEN);
+    }
+    return 0;
+}
+
+#elif defined(FUZZ_STANDALONE)
+// Standalone driver: run every file once, then ITER mutated inputs picked
+// round-robin from them. Iteration i always starts from the same seed file
+// with rng state SEED + i, so a run is reproducible.
+
+#define FUZZ_MAX_INPUT (4u << 20)
+
+struct seed_file {
+    const char *path;
+    struct mapped_file mf;
+    size_t size;            // capped at FUZZ_MAX_INPUT
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int save_input(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    size_t w = fwrite(data, 1, size, f);
+    return (fclose(f) != 0 || w != size) ? -1 : 0;
+}
+
+static void fuzz_usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [-n ITER] [-s SEED] [-w FILE] <file>...\n", prog);
+    fprintf(out, "  -n ITER   mutated inputs to run after the replay (default 0)\n");
+    fprintf(out, "  -s SEED   mutator seed (default 1)\n");
+    fprintf(out, "  -w FILE   write each mutated input to FILE before running it,\n");
+    fprintf(out, "            so a crash leaves the input behind\n");
+}
+
+int main(int argc, char **argv) {
+    FILE *err = fuzz_stderr();
+    uint64_t iters = 0, seed = 1;
+    const char *cur = NULL;
+    int first = argc;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            fuzz_usage(argv[0], stdout);
+            return 0;
+        } else if (strcmp(a, "-n") == 0 && i + 1 < argc) {
+            iters = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(a, "-s") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(a, "-w") == 0 && i + 1 < argc) {
+            cur = argv[++i];
+        } else if (a[0] == '-') {
+            fuzz_usage(argv[0], err);
+            return 2;
+        } else {
+            first = i;
+            break;
+        }
+    }
+    int nseeds = argc - first;
+    if (nseeds <= 0) {
+        fuzz_usage(argv[0], err);
+        return 2;
+    }
+
+    struct seed_file *seeds = calloc((size_t)nseeds, sizeof(*seeds));
+    if (!seeds) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < nseeds; i++) {
+        seeds[i].path = argv[first + i];
+        char msg[256];
+        if (map_file(seeds[i].path, &seeds[i].mf, msg, sizeof(msg)) != 0) {
+            fprintf(err, "error: %s\n", msg);
+            return 1;
+        }
+        seeds[i].size = seeds[i].mf.size < FUZZ_MAX_INPUT ? seeds[i].mf.size : FUZZ_MAX_INPUT;
+    }
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    double t0 = now_sec();
+    for (int i = 0; i < nseeds; i++)
+        LLVMFuzzerTestOneInput(seeds[i].mf.data, seeds[i].size);
+    double t1 = now_sec();
+    fprintf(err, "replayed %d input(s) in %.3f s\n", nseeds, t1 - t0);
+
+    if (iters) {
+        uint8_t *buf = malloc(FUZZ_MAX_INPUT);
+        if (!buf) {
+            perror("malloc");
+            return 1;
+        }
+        for (uint64_t it = 0; it < iters; it++) {
+            const struct seed_file *sf = &seeds[it % (uint64_t)nseeds];
+            uint64_t rng = (seed + it) * 0x9E3779B97F4A7C15ULL;
+            size_t size = sf->size;
+            if (size) memcpy(buf, sf->mf.data, size);
+            // Stack one to four mutations, as libFuzzer and AFL++ havoc do.
+            for (uint32_t k = 1 + (uint32_t)(rng >> 62); k > 0 && size; k--)
+                size = macho_fuzz_mutate(buf, size, FUZZ_MAX_INPUT, &rng);
+            if (cur && save_input(cur, buf, size) != 0) {
+                fprintf(err, "error: cannot write %s\n", cur);
+                return 1;
+            }
+            LLVMFuzzerTestOneInput(buf, size);
+        }
+        double t2 = now_sec();
+        double dt = t2 - t1;
+        fprintf(err, "ran %llu mutated input(s) in %.3f s (%.0f exec/s)\n",
+                (unsigned long long)iters, dt, dt > 0 ? (double)iters / dt : 0.0);
+        free(buf);
+    }
+
+    for (int i = 0; i < nseeds; i++) unmap_file(&seeds[i].mf);
+    free(seeds);
+    return 0;
+}
+#endif
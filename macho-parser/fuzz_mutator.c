@@ -0,0 +1,461 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "macho_common.h"
+#include "fuzz_mutator.h"
+
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64 0xcafebabf
+#define FAT_CIGAM_64 0xbfbafeca
+#endif
+
+#define FAT_ARCH_64_SIZE 32     // struct fat_arch_64 is not in every fat.h
+#define MAX_CMDS 1024           // commands indexed per mutation
+
+// xorshift64*: cheap, and the state is one word the caller can seed.
+static uint64_t rnd(uint64_t *s) {
+    if (*s == 0) *s = 0x9E3779B97F4A7C15ULL;
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t below(uint64_t *s, uint32_t n) {
+    return n ? (uint32_t)(rnd(s) % n) : 0;
+}
+
+static const uint32_t interesting32[] = {
+    0, 1, 2, 4, 7, 8, 16, 0x1f, 0x20, 0x48, 0x7f, 0x80, 0xff, 0x100,
+    0x1000, 0x4000, 0x7fff, 0x8000, 0xffff, 0x10000, 0x7fffffff,
+    0x80000000, 0xfffffff8, 0xfffffffe, 0xffffffff,
+};
+
+static const uint64_t interesting64[] = {
+    0x100000000ULL, 0x7fffffffffffffffULL, 0x8000000000000000ULL,
+    0xfffffffffffff000ULL, 0xffffffffffffffffULL,
+};
+
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint32_t new32(uint64_t *s, uint32_t old) {
+    switch (below(s, 4)) {
+    case 0:  return interesting32[below(s, NELEM(interesting32))];
+    case 1:  return old + 1 + below(s, 16);
+    case 2:  return old - 1 - below(s, 16);
+    default: return old ^ (1u << below(s, 32));
+    }
+}
+
+static uint64_t new64(uint64_t *s, uint64_t old) {
+    switch (below(s, 5)) {
+    case 0:  return interesting32[below(s, NELEM(interesting32))];
+    case 1:  return interesting64[below(s, NELEM(interesting64))];
+    case 2:  return old + 1 + below(s, 16);
+    case 3:  return old - 1 - below(s, 16);
+    default: return old ^ (1ULL << below(s, 64));
+    }
+}
+
+static void mutate_field(uint8_t *p, unsigned width, int swapped, uint64_t *s) {
+    if (width == 8) store64_u(p, new64(s, load64_u(p, swapped)), swapped);
+    else store32_u(p, new32(s, load32_u(p, swapped)), swapped);
+}
+
+// Load command fields worth corrupting: every offset, size and count the
+// parsers use to index the file.
+struct lc_field {
+    uint32_t cmd;
+    uint16_t off;
+    uint8_t width;
+};
+
+#define F(cmd, type, member) \
+    { cmd, offsetof(struct type, member), sizeof(((struct type *)0)->member) }
+
+static const struct lc_field lc_fields[] = {
+    F(LC_SEGMENT_64, segment_command_64, vmaddr),
+    F(LC_SEGMENT_64, segment_command_64, vmsize),
+    F(LC_SEGMENT_64, segment_command_64, fileoff),
+    F(LC_SEGMENT_64, segment_command_64, filesize),
+    F(LC_SEGMENT_64, segment_command_64, nsects),
+    F(LC_SEGMENT_64, segment_command_64, initprot),
+    F(LC_SEGMENT, segment_command, vmaddr),
+    F(LC_SEGMENT, segment_command, vmsize),
+    F(LC_SEGMENT, segment_command, fileoff),
+    F(LC_SEGMENT, segment_command, filesize),
+    F(LC_SEGMENT, segment_command, nsects),
+    F(LC_SEGMENT, segment_command, initprot),
+    F(LC_SYMTAB, symtab_command, symoff),
+    F(LC_SYMTAB, symtab_command, nsyms),
+    F(LC_SYMTAB, symtab_command, stroff),
+    F(LC_SYMTAB, symtab_command, strsize),
+    F(LC_DYSYMTAB, dysymtab_command, iextdefsym),
+    F(LC_DYSYMTAB, dysymtab_command, nextdefsym),
+    F(LC_DYSYMTAB, dysymtab_command, iundefsym),
+    F(LC_DYSYMTAB, dysymtab_command, nundefsym),
+    F(LC_DYSYMTAB, dysymtab_command, indirectsymoff),
+    F(LC_DYSYMTAB, dysymtab_command, nindirectsyms),
+    F(LC_DYSYMTAB, dysymtab_command, extreloff),
+    F(LC_DYSYMTAB, dysymtab_command, nextrel),
+    F(LC_DYSYMTAB, dysymtab_command, locreloff),
+    F(LC_DYSYMTAB, dysymtab_command, nlocrel),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, rebase_off),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, rebase_size),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, bind_off),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, bind_size),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, lazy_bind_off),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, lazy_bind_size),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, export_off),
+    F(LC_DYLD_INFO_ONLY, dyld_info_command, export_size),
+    F(LC_DYLD_INFO, dyld_info_command, rebase_off),
+    F(LC_DYLD_INFO, dyld_info_command, bind_off),
+    F(LC_DYLD_INFO, dyld_info_command, export_size),
+    F(LC_CODE_SIGNATURE, linkedit_data_command, dataoff),
+    F(LC_CODE_SIGNATURE, linkedit_data_command, datasize),
+    F(LC_FUNCTION_STARTS, linkedit_data_command, dataoff),
+    F(LC_FUNCTION_STARTS, linkedit_data_command, datasize),
+    F(LC_DATA_IN_CODE, linkedit_data_command, dataoff),
+    F(LC_DATA_IN_CODE, linkedit_data_command, datasize),
+    F(LC_DYLD_CHAINED_FIXUPS, linkedit_data_command, dataoff),
+    F(LC_DYLD_CHAINED_FIXUPS, linkedit_data_command, datasize),
+    F(LC_DYLD_EXPORTS_TRIE, linkedit_data_command, dataoff),
+    F(LC_DYLD_EXPORTS_TRIE, linkedit_data_command, datasize),
+    F(LC_LOAD_DYLIB, dylib_command, dylib.name.offset),
+    F(LC_LOAD_WEAK_DYLIB, dylib_command, dylib.name.offset),
+    F(LC_REEXPORT_DYLIB, dylib_command, dylib.name.offset),
+    F(LC_ID_DYLIB, dylib_command, dylib.name.offset),
+    F(LC_LOAD_DYLINKER, dylinker_command, name.offset),
+    F(LC_RPATH, rpath_command, path.offset),
+    F(LC_MAIN, entry_point_command, entryoff),
+    F(LC_MAIN, entry_point_command, stacksize),
+    F(LC_ENCRYPTION_INFO, encryption_info_command, cryptoff),
+    F(LC_ENCRYPTION_INFO, encryption_info_command, cryptsize),
+    F(LC_ENCRYPTION_INFO_64, encryption_info_command_64, cryptoff),
+    F(LC_ENCRYPTION_INFO_64, encryption_info_command_64, cryptsize),
+    F(LC_BUILD_VERSION, build_version_command, ntools),
+    // thread_command is followed by (flavor, count, state[count]) records
+    { LC_UNIXTHREAD, 8, 4 }, { LC_UNIXTHREAD, 12, 4 },
+    { LC_THREAD, 8, 4 }, { LC_THREAD, 12, 4 },
+};
+
+static const struct lc_field sect64_fields[] = {
+    F(0, section_64, addr), F(0, section_64, size), F(0, section_64, offset),
+    F(0, section_64, align), F(0, section_64, reloff), F(0, section_64, nreloc),
+    F(0, section_64, flags),
+};
+
+static const struct lc_field sect32_fields[] = {
+    F(0, section, addr), F(0, section, size), F(0, section, offset),
+    F(0, section, align), F(0, section, reloff), F(0, section, nreloc),
+    F(0, section, flags),
+};
+
+#undef F
+
+// Command types a cmd rewrite picks from: the ones with parsers behind them.
+static const uint32_t lc_types[] = {
+    LC_SEGMENT, LC_SEGMENT_64, LC_SYMTAB, LC_DYSYMTAB, LC_DYLD_INFO_ONLY,
+    LC_LOAD_DYLIB, LC_ID_DYLIB, LC_LOAD_DYLINKER, LC_RPATH, LC_MAIN,
+    LC_UNIXTHREAD, LC_THREAD, LC_UUID, LC_CODE_SIGNATURE, LC_FUNCTION_STARTS,
+    LC_DYLD_CHAINED_FIXUPS, LC_DYLD_EXPORTS_TRIE, LC_ENCRYPTION_INFO_64,
+    LC_BUILD_VERSION,
+};
+
+// Move the input to another parser: thin 32/64-bit in either byte order,
+// or FAT (always big-endian on disk).
+static void set_magic(uint8_t *p, uint64_t *r) {
+    static const uint32_t thin[] = { MH_MAGIC, MH_CIGAM, MH_MAGIC_64, MH_CIGAM_64 };
+    uint32_t k = below(r, NELEM(thin) + 2);
+    if (k < NELEM(thin)) store32_u(p, thin[k], 0);
+    else store32_be(p, k == NELEM(thin) ? FAT_MAGIC : FAT_MAGIC_64);
+}
+
+// A thin slice as the mutator sees it: the header and the offsets of the
+// load commands that lie inside both sizeofcmds and the buffer.
+struct slice {
+    uint8_t *p;
+    int swapped;
+    size_t hdr;             // sizeof the mach_header
+    size_t cmds_end;        // hdr + sizeofcmds, clamped to len
+    uint32_t ncmds;         // commands indexed in off[]
+    uint32_t off[MAX_CMDS];
+};
+
+static int slice_parse(struct slice *s, uint8_t *p, size_t len) {
+    if (len < sizeof(struct mach_header)) return -1;
+    uint32_t magic = load32_u(p, 0);
+    if (magic == MH_MAGIC || magic == MH_CIGAM) {
+        s->hdr = sizeof(struct mach_header);
+    } else if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        s->hdr = sizeof(struct mach_header_64);
+    } else {
+        return -1;
+    }
+    if (len < s->hdr) return -1;
+    s->p = p;
+    s->swapped = (magic == MH_CIGAM || magic == MH_CIGAM_64);
+
+    uint32_t ncmds = load32_u(p + offsetof(struct mach_header, ncmds), s->swapped);
+    uint32_t sizeofcmds = load32_u(p + offsetof(struct mach_header, sizeofcmds), s->swapped);
+    s->cmds_end = sizeofcmds > len - s->hdr ? len : s->hdr + sizeofcmds;
+    s->ncmds = 0;
+    size_t o = s->hdr;
+    for (uint32_t i = 0; i < ncmds && s->ncmds < MAX_CMDS; i++) {
+        if (o + sizeof(struct load_command) > s->cmds_end) break;
+        uint32_t cmdsize = load32_u(p + o + offsetof(struct load_command, cmdsize), s->swapped);
+        if (cmdsize < sizeof(struct load_command) || cmdsize > s->cmds_end - o) break;
+        s->off[s->ncmds++] = (uint32_t)o;
+        o += cmdsize;
+    }
+    return 0;
+}
+
+static uint32_t lc_cmd(const struct slice *s, uint32_t i) {
+    return load32_u(s->p + s->off[i], s->swapped);
+}
+
+static uint32_t lc_size(const struct slice *s, uint32_t i) {
+    return load32_u(s->p + s->off[i] + offsetof(struct load_command, cmdsize), s->swapped);
+}
+
+static void mutate_header(struct slice *s, uint64_t *r) {
+    uint8_t *p = s->p;
+    switch (below(r, 6)) {
+    case 0:
+        set_magic(p, r);
+        break;
+    case 1:
+        mutate_field(p + offsetof(struct mach_header, cputype), 4, s->swapped, r);
+        break;
+    case 2:
+        store32_u(p + offsetof(struct mach_header, filetype), 1 + below(r, 12), s->swapped);
+        break;
+    case 3:
+    case 4:
+        mutate_field(p + offsetof(struct mach_header, ncmds), 4, s->swapped, r);
+        break;
+    default:
+        mutate_field(p + offsetof(struct mach_header, sizeofcmds), 4, s->swapped, r);
+        break;
+    }
+}
+
+// Rewrite a known field of command i, or a section header when it is a
+// segment, or any word of the body when the command type has no table.
+static void mutate_lc_field(struct slice *s, uint32_t i, uint64_t *r) {
+    uint32_t cmd = lc_cmd(s, i);
+    uint32_t size = lc_size(s, i);
+    uint8_t *lc = s->p + s->off[i];
+
+    if ((cmd == LC_SEGMENT_64 || cmd == LC_SEGMENT) && below(r, 2)) {
+        size_t segsz = cmd == LC_SEGMENT_64 ? sizeof(struct segment_command_64)
+                                            : sizeof(struct segment_command);
+        size_t sectsz = cmd == LC_SEGMENT_64 ? sizeof(struct section_64) : sizeof(struct section);
+        if (size >= segsz + sectsz) {
+            uint32_t n = (uint32_t)((size - segsz) / sectsz);
+            uint8_t *sect = lc + segsz + (size_t)below(r, n) * sectsz;
+            const struct lc_field *f = cmd == LC_SEGMENT_64
+                ? &sect64_fields[below(r, NELEM(sect64_fields))]
+                : &sect32_fields[below(r, NELEM(sect32_fields))];
+            mutate_field(sect + f->off, f->width, s->swapped, r);
+            return;
+        }
+    }
+
+    uint32_t nmatch = 0;
+    for (size_t k = 0; k < NELEM(lc_fields); k++)
+        if (lc_fields[k].cmd == cmd && lc_fields[k].off + lc_fields[k].width <= size) nmatch++;
+    if (nmatch) {
+        uint32_t pick = below(r, nmatch);
+        for (size_t k = 0; k < NELEM(lc_fields); k++) {
+            const struct lc_field *f = &lc_fields[k];
+            if (f->cmd != cmd || f->off + f->width > size) continue;
+            if (pick-- == 0) {
+                mutate_field(lc + f->off, f->width, s->swapped, r);
+                return;
+            }
+        }
+    }
+    if (size >= 12) {
+        uint32_t words = (size - 8) / 4;
+        mutate_field(lc + 8 + (size_t)below(r, words) * 4, 4, s->swapped, r);
+    }
+}
+
+// Copy command i to the end of the command area. Padding between the
+// commands and the first section is used when it is zero, so file offsets
+// stay valid; otherwise the rest of the file moves up.
+static size_t dup_lc(struct slice *s, uint32_t i, size_t size, size_t max_size) {
+    uint32_t cs = lc_size(s, i);
+    size_t end = s->off[s->ncmds - 1] + lc_size(s, s->ncmds - 1);
+    int fits = end + cs <= size;
+    for (size_t k = end; fits && k < end + cs; k++)
+        if (s->p[k]) fits = 0;
+    if (!fits) {
+        if (size + cs > max_size) return size;
+        memmove(s->p + end + cs, s->p + end, size - end);
+        size += cs;
+    }
+    memmove(s->p + end, s->p + s->off[i], cs);
+    uint8_t *h = s->p;
+    store32_u(h + offsetof(struct mach_header, ncmds), s->ncmds + 1, s->swapped);
+    store32_u(h + offsetof(struct mach_header, sizeofcmds),
+              (uint32_t)(end + cs - s->hdr), s->swapped);
+    return size;
+}
+
+// Remove command i and zero the freed tail, leaving file offsets alone.
+static void delete_lc(struct slice *s, uint32_t i) {
+    uint32_t cs = lc_size(s, i);
+    size_t end = s->off[s->ncmds - 1] + lc_size(s, s->ncmds - 1);
+    size_t o = s->off[i];
+    memmove(s->p + o, s->p + o + cs, end - o - cs);
+    memset(s->p + end - cs, 0, cs);
+    store32_u(s->p + offsetof(struct mach_header, ncmds), s->ncmds - 1, s->swapped);
+    store32_u(s->p + offsetof(struct mach_header, sizeofcmds),
+              (uint32_t)(end - cs - s->hdr), s->swapped);
+}
+
+// One mutation of a thin image. `whole` is set when the slice is the whole
+// buffer, so commands may be inserted and the file resized.
+static size_t mutate_slice(struct slice *s, int whole, size_t size, size_t max_size, uint64_t *r) {
+    uint32_t op = below(r, 16);
+    if (s->ncmds == 0 || op < 2) {
+        mutate_header(s, r);
+        return size;
+    }
+    uint32_t i = below(r, s->ncmds);
+    uint8_t *lc = s->p + s->off[i];
+    switch (op) {
+    case 2:
+        mutate_field(lc + offsetof(struct load_command, cmdsize), 4, s->swapped, r);
+        return size;
+    case 3:
+        store32_u(lc, lc_types[below(r, NELEM(lc_types))], s->swapped);
+        return size;
+    case 4:
+        if (whole) return dup_lc(s, i, size, max_size);
+        break;
+    case 5:
+        delete_lc(s, i);
+        return size;
+    case 6:
+        if (whole && size > 1) return 1 + (size_t)(rnd(r) % (size - 1));
+        break;
+    default:
+        break;
+    }
+    mutate_lc_field(s, i, r);
+    return size;
+}
+
+static void flip_bytes(uint8_t *data, size_t size, uint64_t *r) {
+    uint32_t n = 1 + below(r, 4);
+    for (uint32_t k = 0; k < n; k++)
+        data[rnd(r) % size] ^= (uint8_t)(1u << below(r, 8));
+}
+
+// FAT inputs: corrupt the header and arch table a third of the time,
+// otherwise mutate one of the slices in place.
+static size_t mutate_fat(uint8_t *data, size_t size, size_t max_size, uint64_t *r,
+                         struct slice *s) {
+    uint32_t magic = load32_u(data, 0);
+    int swapped = (magic == FAT_CIGAM || magic == FAT_CIGAM_64);
+    int fat64 = (magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64);
+    size_t asz = fat64 ? FAT_ARCH_64_SIZE : sizeof(struct fat_arch);
+    uint32_t nfat = load32_u(data + offsetof(struct fat_header, nfat_arch), swapped);
+    size_t room = (size - sizeof(struct fat_header)) / asz;
+    uint32_t n = nfat < room ? nfat : (uint32_t)(room < 64 ? room : 64);
+
+    if (n == 0 || below(r, 3) == 0) {
+        if (n == 0 || below(r, 4) == 0) {
+            if (below(r, 2)) set_magic(data, r);
+            else mutate_field(data + offsetof(struct fat_header, nfat_arch), 4, swapped, r);
+            return size;
+        }
+        uint8_t *a = data + sizeof(struct fat_header) + (size_t)below(r, n) * asz;
+        switch (below(r, 4)) {
+        case 0:  mutate_field(a, 4, swapped, r); break;                        // cputype
+        case 1:  mutate_field(a + 8, fat64 ? 8 : 4, swapped, r); break;        // offset
+        case 2:  mutate_field(a + (fat64 ? 16 : 12), fat64 ? 8 : 4, swapped, r); break;  // size
+        default: mutate_field(a + (fat64 ? 24 : 16), 4, swapped, r); break;    // align
+        }
+        return size;
+    }
+
+    const uint8_t *a = data + sizeof(struct fat_header) + (size_t)below(r, n) * asz;
+    uint64_t off = fat64 ? load64_u(a + 8, swapped) : load32_u(a + 8, swapped);
+    uint64_t len = fat64 ? load64_u(a + 16, swapped) : load32_u(a + 12, swapped);
+    if (off >= size || len > size - off || slice_parse(s, data + off, (size_t)len) != 0) {
+        flip_bytes(data, size, r);
+        return size;
+    }
+    return mutate_slice(s, 0, size, max_size, r);
+}
+
+size_t macho_fuzz_mutate(uint8_t *data, size_t size, size_t max_size, uint64_t *rng) {
+    if (size == 0) return 0;
+    if (size > max_size) size = max_size;
+
+    struct slice s;
+    if (size >= sizeof(struct fat_header)) {
+        uint32_t magic = load32_u(data, 0);
+        if (magic == FAT_MAGIC || magic == FAT_CIGAM || magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64)
+            return mutate_fat(data, size, max_size, rng, &s);
+    }
+    if (below(rng, 16) == 0 || slice_parse(&s, data, size) != 0) {
+        flip_bytes(data, size, rng);
+        return size;
+    }
+    return mutate_slice(&s, 1, size, max_size, rng);
+}
+
+#ifdef FUZZ_AFL_MUTATOR
+// AFL++ custom mutator entry points (AFL_CUSTOM_MUTATOR_LIBRARY). Built as
+// a shared object by `make fuzz-afl`; AFL++ still runs its own havoc stage
+// unless AFL_CUSTOM_MUTATOR_ONLY is set.
+struct afl_mutator {
+    uint64_t rng;
+    uint8_t *buf;
+    size_t cap;
+};
+
+void *afl_custom_init(void *afl, unsigned int seed) {
+    (void)afl;
+    struct afl_mutator *m = calloc(1, sizeof(*m));
+    if (m) m->rng = seed;
+    return m;
+}
+
+size_t afl_custom_fuzz(void *data, uint8_t *buf, size_t buf_size, uint8_t **out_buf,
+                       uint8_t *add_buf, size_t add_buf_size, size_t max_size) {
+    (void)add_buf;
+    (void)add_buf_size;
+    struct afl_mutator *m = data;
+    if (m->cap < max_size) {
+        uint8_t *nb = realloc(m->buf, max_size);
+        if (!nb) {
+            *out_buf = buf;
+            return buf_size;
+        }
+        m->buf = nb;
+        m->cap = max_size;
+    }
+    size_t n = buf_size < max_size ? buf_size : max_size;
+    memcpy(m->buf, buf, n);
+    *out_buf = m->buf;
+    return macho_fuzz_mutate(m->buf, n, max_size, &m->rng);
+}
+
+void afl_custom_deinit(void *data) {
+    struct afl_mutator *m = data;
+    if (m) free(m->buf);
+    free(m);
+}
+#endif
@@ -0,0 +1,25 @@
+#ifndef MACHO_FUZZ_MUTATOR_H
+#define MACHO_FUZZ_MUTATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Structure-aware mutation for fuzzing the Mach-O parsers.
+//
+// A byte-level mutator spends almost every execution on inputs that fail
+// the magic or the first bounds check. This one parses just enough of the
+// input (FAT header and arch table, mach_header, the load command chain)
+// to rewrite fields the parsers trust: ncmds and sizeofcmds, cmdsize,
+// segment and section offsets and counts, lc_str offsets, thread state
+// counts, FAT slice offsets and sizes. It can also swap the magic between
+// the 32/64-bit and FAT forms, duplicate or delete a whole load command,
+// and truncate the file. Values come from a table of boundary numbers or
+// a small delta from the current value, written in the slice's byte order.
+// When the input does not parse at all it falls back to flipping bytes.
+
+// Mutate data[0, size) in place, growing it up to max_size at most.
+// *rng is the generator state (any value; 0 is replaced). Returns the new
+// size, which is at least 1 when size was.
+size_t macho_fuzz_mutate(uint8_t *data, size_t size, size_t max_size, uint64_t *rng);
+
+#endif /* MACHO_FUZZ_MUTATOR_H */
@@ -0,0 +1,206 @@
+#include "img4.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lzfse.h"
+#include "lzss.h"
+
+#define DER_INTEGER 0x02
+#define DER_OCTET_STRING 0x04
+#define DER_IA5_STRING 0x16
+#define DER_SEQUENCE 0x30
+
+// One DER element: tag (single byte), definite length.
+struct der {
+    const uint8_t *start;
+    uint8_t tag;
+    const uint8_t *body;
+    size_t len;
+    const uint8_t *next;
+};
+
+static int der_read(const uint8_t *p, const uint8_t *end, struct der *d) {
+    if (end - p < 2) return -1;
+    d->start = p;
+    d->tag = p[0];
+    size_t len = p[1];
+    p += 2;
+    if (len & 0x80) {
+        size_t nbytes = len & 0x7f;
+        if (nbytes == 0 || nbytes > sizeof(size_t) || (size_t)(end - p) < nbytes) return -1;
+        len = 0;
+        for (size_t i = 0; i < nbytes; i++) len = (len << 8) | *p++;
+    }
+    if (len > (size_t)(end - p)) return -1;
+    d->body = p;
+    d->len = len;
+    d->next = p + len;
+    return 0;
+}
+
+static int der_is_string(const struct der *d, const char *s) {
+    size_t n = strlen(s);
+    return d->tag == DER_IA5_STRING && d->len == n && memcmp(d->body, s, n) == 0;
+}
+
+static int der_uint(const struct der *d, uint64_t *out) {
+    if (d->tag != DER_INTEGER || d->len == 0 || d->len > 9) return -1;
+    uint64_t v = 0;
+    for (size_t i = 0; i < d->len; i++) v = (v << 8) | d->body[i];
+    *out = v;
+    return 0;
+}
+
+// The first two elements of a top-level SEQUENCE, if its first is `magic`.
+static int open_container(const uint8_t *buf, size_t size, const char *magic,
+                          struct der *seq, struct der *second) {
+    struct der first;
+    if (der_read(buf, buf + size, seq) != 0 || seq->tag != DER_SEQUENCE) return -1;
+    const uint8_t *end = seq->body + seq->len;
+    if (der_read(seq->body, end, &first) != 0 || !der_is_string(&first, magic)) return -1;
+    return der_read(first.next, end, second);
+}
+
+int img4_detect(const uint8_t *buf, size_t size) {
+    struct der seq;
+    struct der second;
+    return open_container(buf, size, "IM4P", &seq, &second) == 0 ||
+           open_container(buf, size, "IMG4", &seq, &second) == 0;
+}
+
+int img4_parse(const uint8_t *buf, size_t size, struct img4_payload *out,
+               char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    struct der seq;
+    struct der el;
+    if (open_container(buf, size, "IMG4", &seq, &el) == 0) {
+        // The IM4P is the second element; the manifest is not needed.
+        if (el.tag != DER_SEQUENCE) {
+            snprintf(errbuf, errlen, "IMG4 without an IM4P");
+            return -1;
+        }
+        buf = el.start;
+        size = (size_t)(el.next - el.start);
+    }
+    if (open_container(buf, size, "IM4P", &seq, &el) != 0) {
+        snprintf(errbuf, errlen, "not an IM4P");
+        return -1;
+    }
+    const uint8_t *end = seq.body + seq.len;
+    if (el.tag != DER_IA5_STRING || el.len != 4) {
+        snprintf(errbuf, errlen, "IM4P: bad type tag");
+        return -1;
+    }
+    memcpy(out->type, el.body, 4);
+    if (der_read(el.next, end, &el) != 0 || el.tag != DER_IA5_STRING) {
+        snprintf(errbuf, errlen, "IM4P: bad description");
+        return -1;
+    }
+    out->description = (const char *)el.body;
+    out->description_len = el.len;
+    if (der_read(el.next, end, &el) != 0 || el.tag != DER_OCTET_STRING) {
+        snprintf(errbuf, errlen, "IM4P: missing payload");
+        return -1;
+    }
+    out->data = el.body;
+    out->size = el.len;
+
+    // Optional trailers: keybags (OCTET STRING), compression info
+    // (SEQUENCE of two INTEGERs), properties (context-specific).
+    const uint8_t *p = el.next;
+    while (p < end && der_read(p, end, &el) == 0) {
+        if (el.tag == DER_OCTET_STRING) {
+            out->encrypted = 1;
+        } else if (el.tag == DER_SEQUENCE) {
+            struct der algo;
+            struct der sz;
+            uint64_t a;
+            uint64_t s;
+            if (der_read(el.body, el.next, &algo) == 0 && der_uint(&algo, &a) == 0 &&
+                der_read(algo.next, el.next, &sz) == 0 && der_uint(&sz, &s) == 0 && a == 1) {
+                out->declared_size = s;
+            }
+        }
+        p = el.next;
+    }
+    return 0;
+}
+
+enum img4_compression img4_compression(const uint8_t *data, size_t size) {
+    if (size >= 8 && memcmp(data, "complzss", 8) == 0) return IMG4_LZSS;
+    if (size >= 4 && memcmp(data, "bvx", 3) == 0 &&
+        (data[3] == '2' || data[3] == '1' || data[3] == 'n' || data[3] == '-')) {
+        return IMG4_LZFSE;
+    }
+    return IMG4_RAW;
+}
+
+const char *img4_compression_name(enum img4_compression c) {
+    switch (c) {
+        case IMG4_LZFSE: return "lzfse";
+        case IMG4_LZSS: return "lzss";
+        default: return "none";
+    }
+}
+
+int img4_decompress(const uint8_t *data, size_t size, uint64_t size_hint,
+                    uint8_t **out, size_t *out_len, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *out_len = 0;
+    enum img4_compression c = img4_compression(data, size);
+    if (c == IMG4_LZSS) {
+        struct lzss_header h;
+        if (lzss_parse_header(data, size, &h) != 0) {
+            snprintf(errbuf, errlen, "bad complzss header");
+            return -1;
+        }
+        uint8_t *buf = malloc(h.uncompressed_size ? h.uncompressed_size : 1);
+        if (!buf) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+        size_t n;
+        lzss_decode(data + LZSS_HEADER_SIZE, h.compressed_size, buf, h.uncompressed_size, &n);
+        if (n != h.uncompressed_size || lzss_adler32(buf, n) != h.adler32) {
+            free(buf);
+            snprintf(errbuf, errlen, "complzss: %s", n != h.uncompressed_size ?
+                     "short output" : "adler32 mismatch");
+            return -1;
+        }
+        *out = buf;
+        *out_len = n;
+        return 0;
+    }
+    if (c == IMG4_LZFSE) {
+        size_t want = lzfse_decoded_size(data, size);
+        if (want == SIZE_MAX) {
+            snprintf(errbuf, errlen, "lzfse: malformed block chain");
+            return -1;
+        }
+        if (size_hint && size_hint != want) {
+            snprintf(errbuf, errlen, "lzfse: blocks hold %zu bytes, header says %llu",
+                     want, (unsigned long long)size_hint);
+            return -1;
+        }
+        uint8_t *buf = malloc(want ? want : 1);
+        if (!buf) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+        size_t n;
+        int rc = lzfse_decode(data, size, buf, want, &n);
+        // The block headers promised `want` bytes; anything else is corrupt.
+        if (rc == LZFSE_ERROR || n != want) {
+            free(buf);
+            snprintf(errbuf, errlen, "lzfse: corrupt stream at output byte %zu", n);
+            return -1;
+        }
+        *out = buf;
+        *out_len = n;
+        return 0;
+    }
+    snprintf(errbuf, errlen, "payload is not compressed");
+    return -1;
+}
@@ -0,0 +1,50 @@
+#ifndef MACHO_IMG4_H
+#define MACHO_IMG4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IMG4 / IM4P containers, as kernelcaches ship in IPSWs and on disk:
+//
+//   IMG4 ::= SEQUENCE { "IMG4", IM4P, [0] IM4M, ... }
+//   IM4P ::= SEQUENCE { "IM4P", type ("krnl"), description, OCTET STRING
+//                       payload, [OCTET STRING keybags],
+//                       [SEQUENCE { INTEGER algorithm, INTEGER size }] }
+//
+// The payload is usually compressed: LZFSE ("bvx2" blocks, with the
+// algorithm/size sequence) since iOS 10, "complzss" before that.
+
+struct img4_payload {
+    char type[5];                  // "krnl", "rkrn", ...
+    const char *description;       // not NUL-terminated
+    size_t description_len;
+    const uint8_t *data;           // points into the input
+    size_t size;
+    int encrypted;                 // keybags present
+    uint64_t declared_size;        // decompressed size from the IM4P, or 0
+};
+
+// Does buf look like DER-encoded IMG4 or IM4P?
+int img4_detect(const uint8_t *buf, size_t size);
+
+// Returns 0 on success, -1 on malformed input.
+int img4_parse(const uint8_t *buf, size_t size, struct img4_payload *out,
+               char *errbuf, size_t errlen);
+
+enum img4_compression {
+    IMG4_RAW = 0,
+    IMG4_LZFSE,
+    IMG4_LZSS,
+};
+
+// Which compressor produced `data` (by its magic).
+enum img4_compression img4_compression(const uint8_t *data, size_t size);
+const char *img4_compression_name(enum img4_compression c);
+
+// Decompress an LZFSE or complzss payload into a malloc'd buffer.
+// size_hint (may be 0) is the expected size when the stream does not say.
+// Returns 0 on success, -1 on error.
+int img4_decompress(const uint8_t *data, size_t size, uint64_t size_hint,
+                    uint8_t **out, size_t *out_len, char *errbuf, size_t errlen);
+
+#endif /* MACHO_IMG4_H */
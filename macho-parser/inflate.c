@@ -0,0 +1,331 @@
+#include "inflate.h"
+
+#include <string.h>
+
+// Huffman codes are decoded through a 10-bit lookup table (one probe for
+// almost every symbol); longer codes fall back to the canonical walk from
+// RFC 1951 / zlib's puff.c.
+
+#define FAST_BITS INFLATE_FAST_BITS
+#define FAST_SIZE (1u << FAST_BITS)
+#define MAX_BITS 15
+
+enum { MODE_HEADER, MODE_STORED, MODE_CODES, MODE_END };
+
+struct bits {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t buf;
+    unsigned n;
+    unsigned pad;                  // zero bytes fed past the end of input
+};
+
+static inline void refill(struct bits *b) {
+    while (b->n <= 56) {
+        if (b->p < b->end) {
+            b->buf |= (uint64_t)*b->p++ << b->n;
+        } else {
+            b->pad++;
+        }
+        b->n += 8;
+    }
+}
+
+static inline uint32_t need(struct bits *b, unsigned k) {
+    if (b->n < k) refill(b);
+    uint32_t v = (uint32_t)(b->buf & ((1ull << k) - 1));
+    b->buf >>= k;
+    b->n -= k;
+    return v;
+}
+
+// Consumed more bits than the input had?
+static inline int overrun(const struct bits *b) {
+    return b->pad * 8 > b->n;
+}
+
+// Build a decoder from code lengths. Incomplete codes are allowed (a
+// single distance code is legal); over-subscribed ones are not.
+static int build(struct inflate_huff *h, const uint8_t *lens, unsigned n) {
+    uint16_t offs[MAX_BITS + 2];
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (unsigned i = 0; i < n; i++) h->count[lens[i]]++;
+    if (h->count[0] == n) return 0;
+
+    int left = 1;
+    for (unsigned len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return -1;
+    }
+
+    offs[1] = 0;
+    for (unsigned len = 1; len < MAX_BITS; len++) offs[len + 1] = offs[len] + h->count[len];
+    for (unsigned i = 0; i < n; i++) {
+        if (lens[i]) h->symbol[offs[lens[i]]++] = (uint16_t)i;
+    }
+
+    // Canonical codes are assigned in (length, symbol) order and sent
+    // MSB-first, so the table index is the bit-reversed code.
+    unsigned code = 0;
+    unsigned k = 0;
+    for (unsigned len = 1; len <= FAST_BITS; len++) {
+        for (unsigned c = 0; c < h->count[len]; c++, k++, code++) {
+            unsigned rev = 0;
+            for (unsigned b = 0; b < len; b++) rev |= ((code >> b) & 1u) << (len - 1 - b);
+            uint16_t e = (uint16_t)((h->symbol[k] << 4) | len);
+            for (unsigned idx = rev; idx < FAST_SIZE; idx += 1u << len) h->fast[idx] = e;
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+static int decode(struct bits *b, const struct inflate_huff *h) {
+    if (b->n < MAX_BITS) refill(b);
+    uint16_t e = h->fast[b->buf & (FAST_SIZE - 1)];
+    if (e) {
+        unsigned len = e & 15u;
+        b->buf >>= len;
+        b->n -= len;
+        return e >> 4;
+    }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned len = 1; len <= MAX_BITS; len++) {
+        code |= (int)((b->buf >> (len - 1)) & 1u);
+        int count = h->count[len];
+        if (code - count < first) {
+            b->buf >>= len;
+            b->n -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+struct out {
+    uint8_t *p;
+    size_t n;
+    size_t cap;
+};
+
+// Copy as much of the pending match as fits.
+static int copy_match(struct out *o, struct inflate_state *s) {
+    size_t len = s->copy_len;
+    if (len > o->cap - o->n) len = o->cap - o->n;
+    uint8_t *dst = o->p + o->n;
+    const uint8_t *src = dst - s->copy_dist;
+    if (s->copy_dist >= len) {
+        memcpy(dst, src, len);
+    } else {
+        for (size_t i = 0; i < len; i++) dst[i] = src[i];   // overlapping run
+    }
+    o->n += len;
+    s->copy_len -= len;
+    return s->copy_len ? INFLATE_FULL : INFLATE_DONE;
+}
+
+// A literal or match that does not fit is kept in the state, so a later
+// call picks up exactly where this one stopped.
+static int codes(struct bits *b, struct out *o, struct inflate_state *s) {
+    const struct inflate_huff *lit = &s->lit;
+    const struct inflate_huff *dist = &s->dist;
+    if (s->lit_pending >= 0) {
+        if (o->n == o->cap) return INFLATE_FULL;
+        o->p[o->n++] = (uint8_t)s->lit_pending;
+        s->lit_pending = -1;
+    }
+    if (s->copy_len && copy_match(o, s) == INFLATE_FULL) return INFLATE_FULL;
+    for (;;) {
+        int sym = decode(b, lit);
+        if (sym < 0 || overrun(b)) return INFLATE_ERROR;
+        if (sym < 256) {
+            if (o->n == o->cap) {
+                s->lit_pending = sym;
+                return INFLATE_FULL;
+            }
+            o->p[o->n++] = (uint8_t)sym;
+            continue;
+        }
+        if (sym == 256) return INFLATE_DONE;
+        sym -= 257;
+        if (sym >= 29) return INFLATE_ERROR;
+        size_t len = len_base[sym] + need(b, len_extra[sym]);
+        int ds = decode(b, dist);
+        if (ds < 0 || ds >= 30 || overrun(b)) return INFLATE_ERROR;
+        size_t d = dist_base[ds] + need(b, dist_extra[ds]);
+        if (d > o->n) return INFLATE_ERROR;
+        s->copy_len = len;
+        s->copy_dist = d;
+        if (copy_match(o, s) == INFLATE_FULL) return INFLATE_FULL;
+    }
+}
+
+static int stored_header(struct bits *b, struct inflate_state *s) {
+    // Drop to a byte boundary, then hand the unread whole bytes back.
+    need(b, b->n & 7u);
+    size_t back = b->n / 8;
+    if (back < b->pad) return -1;
+    b->p -= back - b->pad;
+    b->buf = 0;
+    b->n = 0;
+    b->pad = 0;
+
+    if ((size_t)(b->end - b->p) < 4) return -1;
+    unsigned len = (unsigned)b->p[0] | ((unsigned)b->p[1] << 8);
+    unsigned nlen = (unsigned)b->p[2] | ((unsigned)b->p[3] << 8);
+    b->p += 4;
+    if (len != (~nlen & 0xffffu)) return -1;
+    if ((size_t)(b->end - b->p) < len) return -1;
+    s->stored_left = len;
+    return 0;
+}
+
+static int stored(struct bits *b, struct out *o, struct inflate_state *s) {
+    size_t take = s->stored_left;
+    if (take > o->cap - o->n) take = o->cap - o->n;
+    memcpy(o->p + o->n, b->p, take);
+    o->n += take;
+    b->p += take;
+    s->stored_left -= take;
+    return s->stored_left ? INFLATE_FULL : INFLATE_DONE;
+}
+
+static int dynamic_tables(struct bits *b, struct inflate_huff *lit, struct inflate_huff *dist) {
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    uint8_t lens[320];
+    unsigned nlen = need(b, 5) + 257;
+    unsigned ndist = need(b, 5) + 1;
+    unsigned ncode = need(b, 4) + 4;
+    if (nlen > 286 || ndist > 30) return -1;
+
+    memset(lens, 0, 19);
+    for (unsigned i = 0; i < ncode; i++) lens[order[i]] = (uint8_t)need(b, 3);
+    struct inflate_huff cl;
+    if (build(&cl, lens, 19) != 0) return -1;
+
+    unsigned i = 0;
+    while (i < nlen + ndist) {
+        int sym = decode(b, &cl);
+        if (sym < 0 || overrun(b)) return -1;
+        if (sym < 16) {
+            lens[i++] = (uint8_t)sym;
+            continue;
+        }
+        uint8_t v = 0;
+        unsigned rep;
+        if (sym == 16) {
+            if (i == 0) return -1;
+            v = lens[i - 1];
+            rep = 3 + need(b, 2);
+        } else if (sym == 17) {
+            rep = 3 + need(b, 3);
+        } else {
+            rep = 11 + need(b, 7);
+        }
+        if (i + rep > nlen + ndist) return -1;
+        while (rep--) lens[i++] = v;
+    }
+    if (lens[256] == 0) return -1;   // no end-of-block code
+    if (build(lit, lens, nlen) != 0 || build(dist, lens + nlen, ndist) != 0) return -1;
+    return 0;
+}
+
+void inflate_init(struct inflate_state *s, const uint8_t *src, size_t srclen) {
+    memset(s, 0, sizeof(*s));
+    s->p = src;
+    s->end = src + srclen;
+    s->mode = MODE_HEADER;
+    s->rc = INFLATE_DONE;
+    s->lit_pending = -1;
+}
+
+int inflate_more(struct inflate_state *s, uint8_t *dst, size_t dstcap, size_t *out_len) {
+    *out_len = s->total;
+    if (s->mode == MODE_END) return s->rc;
+    if (dstcap < s->total) dstcap = s->total;
+    struct bits b = { s->p, s->end, s->buf, s->n, s->pad };
+    struct out o = { dst, s->total, dstcap };
+    int rc = INFLATE_DONE;
+
+    for (;;) {
+        if (s->mode == MODE_HEADER) {
+            if (s->last) {
+                s->mode = MODE_END;
+                break;
+            }
+            s->last = (int)need(&b, 1);
+            unsigned type = need(&b, 2);
+            if (overrun(&b)) {
+                rc = INFLATE_ERROR;
+            } else if (type == 0) {
+                rc = stored_header(&b, s) == 0 ? INFLATE_DONE : INFLATE_ERROR;
+                s->mode = MODE_STORED;
+            } else if (type == 1) {
+                uint8_t lens[288 + 30];
+                unsigned i = 0;
+                for (; i < 144; i++) lens[i] = 8;
+                for (; i < 256; i++) lens[i] = 9;
+                for (; i < 280; i++) lens[i] = 7;
+                for (; i < 288; i++) lens[i] = 8;
+                for (; i < 288 + 30; i++) lens[i] = 5;
+                build(&s->lit, lens, 288);
+                build(&s->dist, lens + 288, 30);
+                s->mode = MODE_CODES;
+            } else if (type == 2) {
+                rc = dynamic_tables(&b, &s->lit, &s->dist) == 0 ? INFLATE_DONE : INFLATE_ERROR;
+                s->mode = MODE_CODES;
+            } else {
+                rc = INFLATE_ERROR;
+            }
+            if (rc != INFLATE_DONE) break;
+        }
+        rc = s->mode == MODE_STORED ? stored(&b, &o, s) : codes(&b, &o, s);
+        if (rc != INFLATE_DONE) break;
+        s->mode = MODE_HEADER;
+    }
+    if (rc == INFLATE_ERROR) {
+        s->mode = MODE_END;
+        s->rc = INFLATE_ERROR;
+    }
+    s->p = b.p;
+    s->buf = b.buf;
+    s->n = b.n;
+    s->pad = b.pad;
+    s->total = o.n;
+    *out_len = o.n;
+    return rc;
+}
+
+int inflate_raw(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                size_t *out_len) {
+    struct inflate_state s;
+    inflate_init(&s, src, srclen);
+    return inflate_more(&s, dst, dstcap, out_len);
+}
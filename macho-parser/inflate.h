@@ -0,0 +1,62 @@
+#ifndef MACHO_INFLATE_H
+#define MACHO_INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Raw DEFLATE (RFC 1951) decoder for zip members.
+//
+// Output goes to one flat buffer, which doubles as the LZ77 window, so
+// there is no separate 32 KiB history to manage. Decoding stops as soon as
+// the buffer is full: callers that only need a file's first N bytes (a
+// Mach-O header and its load commands) pay for N bytes, not the member.
+//
+// A stopped decode can be resumed with a larger buffer that still holds
+// the output so far (realloc keeps it), and continues from where it
+// stopped, so reading a member in rounds costs each byte once.
+
+enum {
+    INFLATE_DONE = 0,      // end of the deflate stream reached
+    INFLATE_FULL = 1,      // dst filled before the end; *out_len == dstcap
+    INFLATE_ERROR = -1,    // corrupt or truncated input
+};
+
+#define INFLATE_FAST_BITS 10
+
+struct inflate_huff {
+    uint16_t fast[1u << INFLATE_FAST_BITS];   // (symbol << 4) | length, 0 = slow path
+    uint16_t count[16];
+    uint16_t symbol[288];
+};
+
+// Decoder state between calls. Fields are private to inflate.c.
+struct inflate_state {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t buf;
+    unsigned n;
+    unsigned pad;
+    int mode;              // next block header, stored, codes, or end
+    int last;              // the current block is the final one
+    int rc;                // sticky INFLATE_DONE / INFLATE_ERROR once reached
+    int lit_pending;       // literal decoded when dst was full, or -1
+    size_t stored_left;    // bytes of the current stored block still to copy
+    size_t copy_len;       // bytes of a match still to copy
+    size_t copy_dist;
+    size_t total;          // output so far: dst[0, total)
+    struct inflate_huff lit;
+    struct inflate_huff dist;
+};
+
+void inflate_init(struct inflate_state *s, const uint8_t *src, size_t srclen);
+
+// Continue decoding into dst, whose first s->total bytes must be the
+// output of the earlier calls, until the stream ends or dst holds dstcap
+// bytes. *out_len is the total output so far.
+int inflate_more(struct inflate_state *s, uint8_t *dst, size_t dstcap, size_t *out_len);
+
+// One-shot: inflate_init plus one inflate_more.
+int inflate_raw(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                size_t *out_len);
+
+#endif /* MACHO_INFLATE_H */
@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "codesign.h"
+#include "corpus.h"
+#include "entitlements.h"
+#include "entropy.h"
+#include "macho_common.h"
+#include "macho_image.h"
+#include "parallel.h"
+#include "universal.h"
+#include "zip.h"
+
+// ipa_scan: list the Mach-O files inside .ipa/.zip archives without
+// extracting them.
+//
+//   ipa_scan [-j N] [--deep] [--max-member MB] ARCHIVE...
+//
+// The archive is mapped and only its central directory is parsed. Each
+// member is inflated into a per-worker buffer just far enough to cover the
+// Mach-O header and load commands of every slice; --deep inflates whole
+// Mach-O members, verifies their code signatures and adds each slice's
+// entropy with any packed/compressed/encrypted flags (entropy.h).
+
+struct scan_opts {
+    int deep;
+    uint64_t max_member;
+};
+
+struct strbuf {
+    char *s;
+    size_t n;
+    size_t cap;
+};
+
+static void sb_printf(struct strbuf *sb, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if (sb->n + (size_t)len + 1 > sb->cap) {
+        size_t ncap = sb->cap ? sb->cap : 256;
+        while (ncap < sb->n + (size_t)len + 1) ncap *= 2;
+        char *ns = realloc(sb->s, ncap);
+        if (!ns) return;
+        sb->s = ns;
+        sb->cap = ncap;
+    }
+    va_start(ap, fmt);
+    vsnprintf(sb->s + sb->n, sb->cap - sb->n, fmt, ap);
+    va_end(ap);
+    sb->n += (size_t)len;
+}
+
+struct member_result {
+    struct strbuf text;
+    int is_macho;
+    int error;
+    uint64_t inflated;
+};
+
+struct worker_buf {
+    uint8_t *p;
+    size_t cap;
+};
+
+struct scan_job {
+    const struct zip_archive *za;
+    const struct scan_opts *opts;
+    size_t *members;                 // indices into za->entries
+    struct member_result *results;
+    struct worker_buf *bufs;
+};
+
+static const char *cpu_name(uint32_t cputype) {
+    switch (cputype) {
+        case CPU_TYPE_ARM: return "arm";
+        case CPU_TYPE_ARM64: return "arm64";
+        case CPU_TYPE_X86: return "i386";
+        case CPU_TYPE_X86_64: return "x86_64";
+        default: return "?";
+    }
+}
+
+static const char *filetype_name(uint32_t t) {
+    switch (t) {
+        case MH_OBJECT: return "OBJECT";
+        case MH_EXECUTE: return "EXECUTE";
+        case MH_DYLIB: return "DYLIB";
+        case MH_BUNDLE: return "BUNDLE";
+        case MH_DYLINKER: return "DYLINKER";
+        case MH_DSYM: return "DSYM";
+        case MH_KEXT_BUNDLE: return "KEXT";
+        default: return "OTHER";
+    }
+}
+
+static int is_macho_magic(uint32_t m) {
+    return m == MH_MAGIC || m == MH_CIGAM || m == MH_MAGIC_64 || m == MH_CIGAM_64;
+}
+
+// Bytes needed to see the header and load commands of every slice, given
+// the first `have` bytes of a `size`-byte member. 0: not a Mach-O.
+static uint64_t header_extent(const uint8_t *buf, size_t have, uint64_t size) {
+    if (have < 8) return size < 4096 ? size : 4096;
+    char err[128];
+    struct fat_slice *s = NULL;
+    size_t n = 0;
+    int is_fat, is64;
+    if (universal_read_head(buf, have, size, &s, &n, &is_fat, &is64, err, sizeof(err)) != 0) {
+        uint32_t magic;
+        memcpy(&magic, buf, sizeof(magic));
+        if (magic != FAT_CIGAM && magic != 0xbfbafecau) return 0;
+        // FAT: ask for the whole slice table, unless it cannot exist.
+        uint64_t tab = 8 + (uint64_t)load32_be(buf + 4) * (magic == FAT_CIGAM ? 20 : 32);
+        return tab > have && tab <= size ? tab : 0;
+    }
+    uint64_t need = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t off = s[i].offset;
+        uint64_t hdr = off + sizeof(struct mach_header_64);
+        uint64_t end = hdr;
+        if (hdr <= have) {
+            uint32_t magic;
+            memcpy(&magic, buf + off, sizeof(magic));
+            if (!is_macho_magic(magic)) {
+                free(s);
+                return 0;
+            }
+            int sw = (magic == MH_CIGAM || magic == MH_CIGAM_64);
+            int m64 = (magic == MH_MAGIC_64 || magic == MH_CIGAM_64);
+            end = off + (m64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header)) +
+                  load32_u(buf + off + 20, sw);
+        }
+        if (end > off + s[i].size) end = off + s[i].size;
+        if (end > need) need = end;
+    }
+    free(s);
+    return need;
+}
+
+static int reserve(struct worker_buf *wb, size_t n) {
+    if (n <= wb->cap) return 0;
+    uint8_t *np = realloc(wb->p, n);
+    if (!np) return -1;
+    wb->p = np;
+    wb->cap = n;
+    return 0;
+}
+
+static void describe_slice(const uint8_t *slice, size_t avail, uint32_t cputype, int full,
+                           struct strbuf *sb) {
+    char err[256];
+    struct macho_image img;
+    if (macho_image_load(&img, slice, avail, err, sizeof(err)) != 0) {
+        sb_printf(sb, "  %-8s error: %s\n", cpu_name(cputype), err);
+        return;
+    }
+    size_t dylibs = 0;
+    int cryptid = -1;
+    int sig = 0;
+    const char *install = NULL;
+    for (size_t i = 0; i < img.ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img.cmds[i];
+        const uint8_t *p = img.buf + lc->offset;
+        switch (lc->cmd) {
+            case LC_LOAD_DYLIB: case LC_LOAD_WEAK_DYLIB: case LC_REEXPORT_DYLIB:
+            case LC_LAZY_LOAD_DYLIB: case LC_LOAD_UPWARD_DYLIB:
+                dylibs++;
+                break;
+            case LC_ID_DYLIB:
+                if (lc->cmdsize > 24 && load32_u(p + 8, img.swapped) < lc->cmdsize &&
+                    memchr(p + load32_u(p + 8, img.swapped), 0,
+                           lc->cmdsize - load32_u(p + 8, img.swapped))) {
+                    install = (const char *)p + load32_u(p + 8, img.swapped);
+                }
+                break;
+            case LC_ENCRYPTION_INFO: case LC_ENCRYPTION_INFO_64:
+                if (lc->cmdsize >= 20) cryptid = (int)load32_u(p + 16, img.swapped);
+                break;
+            case LC_CODE_SIGNATURE:
+                sig = 1;
+                break;
+            default:
+                break;
+        }
+    }
+    sb_printf(sb, "  %-8s %-8s ncmds=%u dylibs=%zu", cpu_name(img.cputype),
+              filetype_name(img.filetype), img.ncmds, dylibs);
+    if (cryptid >= 0) sb_printf(sb, " cryptid=%d", cryptid);
+    sb_printf(sb, "%s", sig ? " signed" : " unsigned");
+    if (install) sb_printf(sb, " id=%s", install);
+
+    if (full && sig) {
+        struct cs_signature cs;
+        if (cs_parse(&img, &cs, err, sizeof(err)) != 0) {
+            sb_printf(sb, " sig=malformed");
+        } else {
+            struct cs_verify_result vr;
+            if (cs.ncds == 0 || cs_verify(&img, &cs, &cs.cds[0], 1, &vr) != 0) {
+                sb_printf(sb, " sig=unverifiable");
+            } else {
+                sb_printf(sb, " sig=%s", vr.pages_bad || vr.special_bad ? "INVALID" : "valid");
+            }
+            struct ent_list ents;
+            memset(&ents, 0, sizeof(ents));
+            if (ent_from_signature(&cs, &ents, err, sizeof(err)) == 0) {
+                sb_printf(sb, " entitlements=%zu", ents.n);
+            }
+            ent_list_free(&ents);
+            if (cs.ncds) sb_printf(sb, " ident=%s", cs.cds[0].ident ? cs.cds[0].ident : "?");
+            cs_free(&cs);
+        }
+    }
+    // The whole member is in memory: the byte statistics cost one more pass.
+    if (full) {
+        struct entropy_report er;
+        if (entropy_analyze(&img, 0, &er, err, sizeof(err)) == 0) {
+            char fl[64];
+            sb_printf(sb, " entropy=%.2f", er.whole.entropy);
+            if (er.flags) sb_printf(sb, " %s", entropy_flag_names(er.flags, fl, sizeof(fl)));
+            entropy_report_free(&er);
+        }
+    }
+    sb_printf(sb, "\n");
+    macho_image_free(&img);
+}
+
+static void scan_member(const struct scan_job *job, size_t k, unsigned worker) {
+    const struct zip_entry *e = &job->za->entries[job->members[k]];
+    struct member_result *r = &job->results[k];
+    struct worker_buf *wb = &job->bufs[worker];
+    char err[256];
+
+    // Inflate a little, see how much the headers need, inflate that much.
+    // Each round resumes the inflate where the last one stopped, so the
+    // headers cost the bytes up to the end of the last slice's load
+    // commands, once: for a FAT member that is the whole file up to its
+    // last slice, for a thin one the first few KiB. --deep goes straight
+    // to the whole member once the first round has seen a Mach-O magic.
+    struct zip_reader zr;
+    if (zip_reader_open(&zr, job->za, e, err, sizeof(err)) != 0) {
+        sb_printf(&r->text, "%s\n", err);
+        r->error = 1;
+        return;
+    }
+    uint64_t cap = e->size < 4096 ? e->size : 4096;
+    size_t got = 0;
+    int rc = 1;
+    uint64_t need = 0;
+    int truncated = 0;
+    int deep = job->opts->deep;
+    for (int round = 0; round < 8; round++) {
+        if (cap > job->opts->max_member || reserve(wb, (size_t)cap) != 0) {
+            if (!deep || need == 0 || need > job->opts->max_member) {
+                sb_printf(&r->text, "%s: headers need %llu bytes, over the member limit\n",
+                          e->name, (unsigned long long)cap);
+                r->error = 1;
+                return;
+            }
+            // Only the whole-member read is over the limit: headers only.
+            deep = 0;
+            truncated = 1;
+            if (need <= got) break;
+            cap = need;
+            continue;
+        }
+        size_t before = got;
+        rc = zip_reader_read(&zr, wb->p, (size_t)cap, &got, err, sizeof(err));
+        r->inflated += got - before;
+        if (rc < 0) {
+            sb_printf(&r->text, "%s\n", err);
+            r->error = 1;
+            return;
+        }
+        need = header_extent(wb->p, got, e->size);
+        if (need == 0) return;                 // not a Mach-O: silent
+        if (rc == 0) break;
+        if (deep) {
+            cap = e->size;
+        } else if (need <= got) {
+            break;
+        } else {
+            cap = need;
+        }
+    }
+    if (need > got) {
+        sb_printf(&r->text, "%s: truncated Mach-O headers\n", e->name);
+        r->error = 1;
+        return;
+    }
+
+    int full = rc == 0;
+    r->is_macho = 1;
+    sb_printf(&r->text, "%s (%llu bytes, %s)%s\n", e->name, (unsigned long long)e->size,
+              e->method == 8 ? "deflate" : "stored",
+              truncated ? " over the member limit; headers only" : "");
+    struct fat_slice *s = NULL;
+    size_t n = 0;
+    int is_fat, is64;
+    if (universal_read_head(wb->p, got, e->size, &s, &n, &is_fat, &is64, err, sizeof(err)) != 0) {
+        sb_printf(&r->text, "  error: %s\n", err);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t avail = got - (size_t)s[i].offset;
+        if (avail > s[i].size) avail = (size_t)s[i].size;
+        describe_slice(wb->p + s[i].offset, avail, s[i].cputype, full, &r->text);
+    }
+    free(s);
+}
+
+static void scan_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    const struct scan_job *job = ctx;
+    for (size_t i = begin; i < end; i++) scan_member(job, i, worker);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int scan_archive(const char *path, const struct scan_opts *opts, unsigned jobs) {
+    char err[256];
+    struct mapped_file mf;
+    if (map_file(path, &mf, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    double t0 = now_ms();
+    struct zip_archive za;
+    if (zip_open(&za, mf.data, mf.size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s: %s\n", path, err);
+        unmap_file(&mf);
+        return 1;
+    }
+
+    // Directories and tiny members cannot be Mach-O files.
+    size_t *members = malloc((za.n ? za.n : 1) * sizeof(*members));
+    struct member_result *results = calloc(za.n ? za.n : 1, sizeof(*results));
+    if (jobs == 0) jobs = par_default_threads();
+    struct worker_buf *bufs = calloc(jobs, sizeof(*bufs));
+    if (!members || !results || !bufs) {
+        fprintf(stderr, "error: out of memory\n");
+        free(members);
+        free(results);
+        free(bufs);
+        zip_close(&za);
+        unmap_file(&mf);
+        return 1;
+    }
+    size_t nm = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < za.n; i++) {
+        const struct zip_entry *e = &za.entries[i];
+        total += e->size;
+        size_t len = strlen(e->name);
+        if (e->size < sizeof(struct mach_header) || (len && e->name[len - 1] == '/')) continue;
+        members[nm++] = i;
+    }
+
+    struct scan_job job = { &za, opts, members, results, bufs };
+    par_for(nm, 4, jobs, scan_worker, &job);
+
+    size_t machos = 0;
+    size_t errors = 0;
+    uint64_t inflated = 0;
+    for (size_t i = 0; i < nm; i++) {
+        if (results[i].text.s) fputs(results[i].text.s, stdout);
+        machos += (size_t)results[i].is_macho;
+        errors += (size_t)results[i].error;
+        inflated += results[i].inflated;
+        free(results[i].text.s);
+    }
+    double t1 = now_ms();
+    printf("%s: members=%zu machos=%zu errors=%zu inflated=%llu of %llu bytes (%.1f%%) in %.1fms\n",
+           path, za.n, machos, errors, (unsigned long long)inflated,
+           (unsigned long long)total, total ? 100.0 * (double)inflated / (double)total : 0.0,
+           t1 - t0);
+
+    for (unsigned w = 0; w < jobs; w++) free(bufs[w].p);
+    free(bufs);
+    free(results);
+    free(members);
+    zip_close(&za);
+    unmap_file(&mf);
+    return errors ? 1 : 0;
+}
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [-j N] [--deep] [--max-member MB] <archive.ipa|.zip>...\n", prog);
+}
+
+int main(int argc, char **argv) {
+    struct scan_opts opts = { 0, 256ull << 20 };
+    unsigned jobs = 0;
+    char **paths = calloc((size_t)argc, sizeof(*paths));
+    size_t npaths = 0;
+    if (!paths) { perror("calloc"); return 1; }
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+            jobs = (unsigned)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--deep") == 0) {
+            opts.deep = 1;
+        } else if (strcmp(argv[i], "--max-member") == 0 && i + 1 < argc) {
+            opts.max_member = (uint64_t)(strtod(argv[++i], NULL) * 1048576.0);
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0], stdout);
+            free(paths);
+            return 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            free(paths);
+            return 2;
+        } else {
+            paths[npaths++] = argv[i];
+        }
+    }
+    if (npaths == 0) {
+        usage(argv[0], stderr);
+        free(paths);
+        return 2;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < npaths; i++) rc |= scan_archive(paths[i], &opts, jobs);
+    free(paths);
+    return rc;
+}
@@ -0,0 +1,291 @@
+#include "launch_cost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/mach/machine.h"
+#include "../include/macho/loader.h"
+
+#include "dyld_info.h"
+#include "parallel.h"
+
+// Score weights, in rough microseconds on a current phone: mapping and
+// registering an image (code signature, segments), faulting in and
+// dirtying a fixup page, one rebase or symbol lookup, running an
+// initializer, and the runtime work per ObjC/Swift record (+load and
+// categories are the expensive ones). They rank binaries; they are not a
+// measurement.
+#define W_IMAGE      150.0
+#define W_PAGE         8.0
+#define W_REBASE       0.005
+#define W_BIND         0.05
+#define W_WEAK_BIND    0.1
+#define W_INIT        10.0
+#define W_CLASS        0.3
+#define W_CATEGORY     1.5
+#define W_NONLAZY     15.0
+#define W_SELREF       0.01
+#define W_CONFORMANCE  0.2
+
+static int on_chained(void *ctx, const struct macho_chained_fixup *f) {
+    struct launch_stats *st = ctx;
+    if (f->new_page) st->fixup_pages++;
+    if (f->bind) st->binds++;
+    else st->rebases++;
+    return 0;
+}
+
+// Opcode fixups arrive roughly in address order, so a page is usually the
+// same as the last one; the rest are sorted and counted at the end.
+struct page_set {
+    const struct macho_image *img;
+    struct launch_stats *st;
+    unsigned shift;
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+};
+
+static int add_page(struct page_set *ps, uint32_t seg, uint64_t offset) {
+    uint64_t page = (ps->img->segs[seg].vmaddr + offset) >> ps->shift;
+    if (ps->n && ps->v[ps->n - 1] == page) return 0;
+    if (ps->n == ps->cap) {
+        size_t cap = ps->cap ? ps->cap * 2 : 256;
+        uint64_t *v = realloc(ps->v, cap * sizeof(*v));
+        if (!v) return -1;
+        ps->v = v;
+        ps->cap = cap;
+    }
+    ps->v[ps->n++] = page;
+    return 0;
+}
+
+static int on_rebase(void *ctx, uint32_t seg, uint64_t offset) {
+    struct page_set *ps = ctx;
+    ps->st->rebases++;
+    return add_page(ps, seg, offset);
+}
+
+static int on_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                   int64_t addend, uint32_t seg, uint64_t offset) {
+    (void)name;
+    (void)ordinal;
+    (void)flags;
+    (void)addend;
+    struct page_set *ps = ctx;
+    ps->st->binds++;
+    return seg == MACHO_NO_SEGMENT ? 0 : add_page(ps, seg, offset);
+}
+
+static int on_weak_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                        int64_t addend, uint32_t seg, uint64_t offset) {
+    (void)name;
+    (void)ordinal;
+    (void)flags;
+    (void)addend;
+    struct page_set *ps = ctx;
+    ps->st->weak_binds++;
+    return seg == MACHO_NO_SEGMENT ? 0 : add_page(ps, seg, offset);
+}
+
+static int on_lazy_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                        int64_t addend, uint32_t seg, uint64_t offset) {
+    (void)name;
+    (void)ordinal;
+    (void)flags;
+    (void)addend;
+    (void)seg;
+    (void)offset;
+    ((struct page_set *)ctx)->st->lazy_binds++;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int opcode_stats(const struct macho_image *img, struct launch_stats *st,
+                        char *errbuf, size_t errlen) {
+    struct page_set ps = { img, st, img->cputype == CPU_TYPE_ARM64 ? 14 : 12, NULL, 0, 0 };
+    // The walkers name their own errors; the callbacks only fail to allocate.
+    snprintf(errbuf, errlen, "out of memory");
+    int rc = macho_rebase_walk(img, on_rebase, &ps, errbuf, errlen);
+    if (rc == 0) rc = macho_bind_walk(img, MACHO_BIND, on_bind, &ps, errbuf, errlen);
+    if (rc == 0) rc = macho_bind_walk(img, MACHO_BIND_WEAK, on_weak_bind, &ps, errbuf, errlen);
+    if (rc == 0) rc = macho_bind_walk(img, MACHO_BIND_LAZY, on_lazy_bind, &ps, errbuf, errlen);
+    if (ps.n) qsort(ps.v, ps.n, sizeof(*ps.v), cmp_u64);
+    for (size_t i = 0; i < ps.n; i++) {
+        if (i == 0 || ps.v[i] != ps.v[i - 1]) st->fixup_pages++;
+    }
+    free(ps.v);
+    return rc == 0 ? 0 : -1;
+}
+
+int launch_stats(const struct macho_image *img, struct launch_stats *out,
+                 char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    uint64_t ptr = img->is64 ? 8 : 4;
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *s = &img->sects[i];
+        uint32_t type = s->flags & SECTION_TYPE;
+        if (type == S_MOD_INIT_FUNC_POINTERS) out->initializers += s->size / ptr;
+        else if (type == S_INIT_FUNC_OFFSETS) out->initializers += s->size / 4;
+        else if (strcmp(s->sectname, "__objc_classlist") == 0) out->objc_classes += s->size / ptr;
+        else if (strcmp(s->sectname, "__objc_catlist") == 0) out->objc_categories += s->size / ptr;
+        else if (strcmp(s->sectname, "__objc_nlclslist") == 0 ||
+                 strcmp(s->sectname, "__objc_nlcatlist") == 0) {
+            out->objc_nonlazy += s->size / ptr;
+        } else if (strcmp(s->sectname, "__objc_selrefs") == 0) {
+            out->objc_selrefs += s->size / ptr;
+        } else if (strcmp(s->sectname, "__swift5_proto") == 0) {
+            out->swift_conformances += s->size / 4;
+        }
+    }
+
+    uint32_t size = 0;
+    const uint8_t *chained = macho_image_linkedit(img, LC_DYLD_CHAINED_FIXUPS, &size);
+    if (chained) {
+        out->chained = 1;
+        return macho_chained_walk(img, on_chained, out, errbuf, errlen);
+    }
+    return opcode_stats(img, out, errbuf, errlen);
+}
+
+void launch_stats_add(struct launch_stats *acc, const struct launch_stats *s) {
+    acc->rebases += s->rebases;
+    acc->binds += s->binds;
+    acc->lazy_binds += s->lazy_binds;
+    acc->weak_binds += s->weak_binds;
+    acc->fixup_pages += s->fixup_pages;
+    acc->initializers += s->initializers;
+    acc->objc_classes += s->objc_classes;
+    acc->objc_categories += s->objc_categories;
+    acc->objc_nonlazy += s->objc_nonlazy;
+    acc->objc_selrefs += s->objc_selrefs;
+    acc->swift_conformances += s->swift_conformances;
+}
+
+double launch_score(const struct launch_stats *s, size_t nimages) {
+    return W_IMAGE * (double)nimages +
+           W_PAGE * (double)s->fixup_pages +
+           W_REBASE * (double)s->rebases +
+           W_BIND * (double)s->binds +
+           W_WEAK_BIND * (double)s->weak_binds +
+           W_INIT * (double)s->initializers +
+           W_CLASS * (double)s->objc_classes +
+           W_CATEGORY * (double)s->objc_categories +
+           W_NONLAZY * (double)s->objc_nonlazy +
+           W_SELREF * (double)s->objc_selrefs +
+           W_CONFORMANCE * (double)s->swift_conformances;
+}
+
+struct stats_job {
+    const struct resolver *r;
+    struct launch_stats *stats;
+    uint8_t *bad;
+};
+
+static void stats_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct stats_job *job = ctx;
+    char err[128];
+    for (size_t i = begin; i < end; i++) {
+        const struct resolver_image *im = job->r->images[i];
+        if (!im->ok) continue;
+        if (launch_stats(&im->img, &job->stats[i], err, sizeof(err)) != 0) job->bad[i] = 1;
+    }
+}
+
+int launch_cost_reports(const struct resolver *r, const size_t *roots, size_t nroots,
+                        unsigned jobs, struct launch_report *out) {
+    struct stats_job job;
+    job.r = r;
+    job.stats = calloc(r->nimages ? r->nimages : 1, sizeof(*job.stats));
+    job.bad = calloc(r->nimages ? r->nimages : 1, 1);
+    if (!job.stats || !job.bad) {
+        free(job.stats);
+        free(job.bad);
+        return -1;
+    }
+    par_for(r->nimages, 1, jobs, stats_worker, &job);
+
+    int rc = 0;
+    for (size_t i = 0; i < nroots; i++) {
+        struct launch_report *rep = &out[i];
+        memset(rep, 0, sizeof(*rep));
+        rep->root = roots[i];
+        rep->self = job.stats[roots[i]];
+        size_t *order = NULL;
+        rep->nimages = resolver_closure(r, roots[i], &order);
+        if (!order) {
+            rc = -1;
+            continue;
+        }
+        for (size_t j = 0; j < rep->nimages; j++) {
+            const struct resolver_image *im = r->images[order[j]];
+            if (!im->ok) {
+                rep->missing++;
+                continue;
+            }
+            for (size_t k = 0; k < im->link.ndylibs; k++) {
+                if (im->deps[k] == RESOLVER_NONE && im->link.dylibs[k].kind != DYLIB_WEAK) {
+                    rep->missing++;
+                }
+            }
+            rep->errors += job.bad[order[j]];
+            launch_stats_add(&rep->closure, &job.stats[order[j]]);
+        }
+        rep->closure.chained = rep->self.chained;
+        rep->score = launch_score(&rep->closure, rep->nimages);
+        free(order);
+    }
+    free(job.stats);
+    free(job.bad);
+    return rc;
+}
+
+static int cmp_score(const void *a, const void *b) {
+    double x = ((const struct launch_report *)a)->score;
+    double y = ((const struct launch_report *)b)->score;
+    return (x < y) - (x > y);
+}
+
+static void print_stats(const char *label, const struct launch_stats *s) {
+    printf("    %-8s rebases=%llu binds=%llu lazy=%llu weak=%llu pages=%llu inits=%llu "
+           "classes=%llu categories=%llu +load=%llu selrefs=%llu conformances=%llu\n",
+           label, (unsigned long long)s->rebases, (unsigned long long)s->binds,
+           (unsigned long long)s->lazy_binds, (unsigned long long)s->weak_binds,
+           (unsigned long long)s->fixup_pages, (unsigned long long)s->initializers,
+           (unsigned long long)s->objc_classes, (unsigned long long)s->objc_categories,
+           (unsigned long long)s->objc_nonlazy, (unsigned long long)s->objc_selrefs,
+           (unsigned long long)s->swift_conformances);
+}
+
+void launch_cost_print(const struct resolver *r, struct launch_report *v, size_t n,
+                       int list_only) {
+    if (n > 1) qsort(v, n, sizeof(*v), cmp_score);
+    printf("%10s %6s %10s %9s %7s %6s %7s %5s  %s\n", "score", "images", "rebases",
+           "binds", "pages", "inits", "classes", "cats", "path");
+    for (size_t i = 0; i < n; i++) {
+        const struct launch_report *rep = &v[i];
+        const struct launch_stats *c = &rep->closure;
+        printf("%10.0f %6zu %10llu %9llu %7llu %6llu %7llu %5llu  %s\n", rep->score,
+               rep->nimages, (unsigned long long)c->rebases, (unsigned long long)c->binds,
+               (unsigned long long)c->fixup_pages, (unsigned long long)c->initializers,
+               (unsigned long long)c->objc_classes, (unsigned long long)c->objc_categories,
+               r->images[rep->root]->path);
+    }
+    if (list_only) return;
+    for (size_t i = 0; i < n; i++) {
+        const struct launch_report *rep = &v[i];
+        printf("== %s: %s fixups, %zu images (%zu missing, %zu malformed) ==\n",
+               r->images[rep->root]->path, rep->self.chained ? "chained" : "opcode",
+               rep->nimages, rep->missing, rep->errors);
+        print_stats("self", &rep->self);
+        print_stats("closure", &rep->closure);
+        printf("    score    %.0f (self %.0f)\n", rep->score, launch_score(&rep->self, 1));
+    }
+}
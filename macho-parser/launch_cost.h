@@ -0,0 +1,65 @@
+#ifndef MACHO_LAUNCH_COST_H
+#define MACHO_LAUNCH_COST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+#include "resolve.h"
+
+// What an image costs dyld and the ObjC/Swift runtimes at launch, counted
+// statically: fixups (chained or opcode-based) and the pages they dirty,
+// initializers, and the runtime metadata registered before main.
+//
+// launch_cost_reports computes the counts for every image a resolver has
+// loaded (in parallel), then sums them over each root's closure and turns
+// them into a score. Shared libraries are counted once per image, so a
+// corpus of apps sharing frameworks costs one pass per framework.
+
+struct launch_stats {
+    uint64_t rebases;
+    uint64_t binds;                // bound at launch (every chained bind is)
+    uint64_t lazy_binds;           // opcode images: bound on first call
+    uint64_t weak_binds;           // weak-definition coalescing entries
+    uint64_t fixup_pages;          // distinct pages written by rebases and binds
+    uint64_t initializers;         // __mod_init_func / __init_offsets entries
+    uint64_t objc_classes;
+    uint64_t objc_categories;
+    uint64_t objc_nonlazy;         // classes and categories with +load
+    uint64_t objc_selrefs;
+    uint64_t swift_conformances;
+    int chained;                   // fixups from LC_DYLD_CHAINED_FIXUPS
+};
+
+// Returns 0, or -1 with a reason when the fixup information is malformed
+// (the counts gathered so far are kept).
+int launch_stats(const struct macho_image *img, struct launch_stats *out,
+                 char *errbuf, size_t errlen);
+
+void launch_stats_add(struct launch_stats *acc, const struct launch_stats *s);
+
+// Weighted sum of the counts plus a per-image cost, in rough microseconds.
+// Good for ranking binaries, not for predicting a stopwatch.
+double launch_score(const struct launch_stats *s, size_t nimages);
+
+struct launch_report {
+    size_t root;                   // resolver image index
+    size_t nimages;                // closure size, root included
+    size_t missing;                // dependencies that could not be loaded
+    size_t errors;                 // closure images with malformed fixups
+    struct launch_stats self;
+    struct launch_stats closure;   // root included
+    double score;                  // over the closure
+};
+
+// One report per root, in `roots` order. Returns 0, or -1 on allocation
+// failure.
+int launch_cost_reports(const struct resolver *r, const size_t *roots, size_t nroots,
+                        unsigned jobs, struct launch_report *out);
+
+// A ranked table (highest score first); without list_only each root's
+// own and closure counts follow.
+void launch_cost_print(const struct resolver *r, struct launch_report *v, size_t n,
+                       int list_only);
+
+#endif /* MACHO_LAUNCH_COST_H */
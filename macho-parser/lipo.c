@@ -0,0 +1,392 @@
+#if defined(__linux__)
+#define _GNU_SOURCE        // copy_file_range
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "lipo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include "../include/mach/machine.h"
+
+#include "parallel.h"
+#include "universal.h"
+
+// High byte of cpusubtype holds capability bits (e.g. LIB64), not the
+// subtype proper.
+#define SUBTYPE_CAPS_MASK 0xff000000u
+
+#define COPY_CHUNK (1u << 30)
+
+// Copy [in_off, in_off+len) of `in` to out_off in `out`.
+static int copy_range(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+#if defined(__linux__)
+    // In-kernel copy; on btrfs/XFS this is a reflink and moves no data.
+    while (len > 0) {
+        loff_t io = (loff_t)in_off;
+        loff_t oo = (loff_t)out_off;
+        ssize_t r = copy_file_range(in, &io, out, &oo, len < COPY_CHUNK ? len : COPY_CHUNK, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            // Cross-filesystem on old kernels, or unsupported fs.
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) break;
+            return -1;
+        }
+        if (r == 0) {
+            errno = EIO;       // source shorter than its slice table says
+            return -1;
+        }
+        in_off += (uint64_t)r;
+        out_off += (uint64_t)r;
+        len -= (uint64_t)r;
+    }
+    if (len > 0 && lseek(out, (off_t)out_off, SEEK_SET) >= 0) {
+        while (len > 0) {
+            off_t io = (off_t)in_off;
+            ssize_t r = sendfile(out, in, &io, len < COPY_CHUNK ? len : COPY_CHUNK);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            in_off += (uint64_t)r;
+            out_off += (uint64_t)r;
+            len -= (uint64_t)r;
+        }
+    }
+#endif
+    if (len == 0) return 0;
+
+    static const size_t bufsz = 1u << 20;
+    uint8_t *buf = malloc(bufsz);
+    if (!buf) return -1;
+    while (len > 0) {
+        size_t want = len < bufsz ? (size_t)len : bufsz;
+        ssize_t r = pread(in, buf, want, (off_t)in_off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            if (r == 0) errno = EIO;
+            free(buf);
+            return -1;
+        }
+        size_t done = 0;
+        while (done < (size_t)r) {
+            ssize_t w = pwrite(out, buf + done, (size_t)r - done, (off_t)(out_off + done));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                free(buf);
+                return -1;
+            }
+            done += (size_t)w;
+        }
+        in_off += (uint64_t)r;
+        out_off += (uint64_t)r;
+        len -= (uint64_t)r;
+    }
+    free(buf);
+    return 0;
+}
+
+// Temp file next to `path`, renamed over it by finish_output().
+static int open_output(const char *path, char **tmp_out, char *errbuf, size_t errlen) {
+    size_t plen = strlen(path);
+    char *tmp = malloc(plen + 8);
+    if (!tmp) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    snprintf(tmp, plen + 8, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        snprintf(errbuf, errlen, "%s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+    *tmp_out = tmp;
+    return fd;
+}
+
+static int finish_output(int fd, char *tmp, const char *path, int ok, unsigned mode,
+                         char *errbuf, size_t errlen) {
+    if (ok && fchmod(fd, (mode_t)(mode & 07777)) != 0) ok = 0;
+    if (close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+static int open_input(const char *path, struct stat *st, char *errbuf, size_t errlen) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) {
+        snprintf(errbuf, errlen, "%s: not a regular file", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int pick_slice(const struct fat_slice *s, size_t n, int want_index, uint32_t want_cputype,
+                      char *errbuf, size_t errlen) {
+    if (want_index >= 0) {
+        if ((size_t)want_index >= n) {
+            snprintf(errbuf, errlen, "slice index out of range");
+            return -1;
+        }
+        return want_index;
+    }
+    uint32_t want = want_cputype ? want_cputype : (uint32_t)CPU_TYPE_ARM64;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i].cputype == want) return (int)i;
+    }
+    if (want_cputype) {
+        snprintf(errbuf, errlen, "requested arch not found in fat file");
+        return -1;
+    }
+    return 0;
+}
+
+// Write slice `s` of in_fd to out_path as a thin file.
+static int write_thin(int in_fd, const struct fat_slice *s, const char *out_path, unsigned mode,
+                      char *errbuf, size_t errlen) {
+    char *tmp = NULL;
+    int out = open_output(out_path, &tmp, errbuf, errlen);
+    if (out < 0) return -1;
+    int ok = copy_range(in_fd, s->offset, out, 0, s->size) == 0;
+    return finish_output(out, tmp, out_path, ok, mode, errbuf, errlen);
+}
+
+int lipo_extract(const char *in_path, int want_index, uint32_t want_cputype,
+                 const char *out_path, struct lipo_result *res,
+                 char *errbuf, size_t errlen) {
+    memset(res, 0, sizeof(*res));
+    struct stat st;
+    int fd = open_input(in_path, &st, errbuf, errlen);
+    if (fd < 0) return -1;
+
+    struct fat_slice *s = NULL;
+    size_t n = 0;
+    int is_fat, is64;
+    int rc = universal_read_fd(fd, (uint64_t)st.st_size, &s, &n, &is_fat, &is64,
+                               errbuf, errlen);
+    if (rc == 0) {
+        int pick = pick_slice(s, n, want_index, want_cputype, errbuf, errlen);
+        rc = pick < 0 ? -1 : write_thin(fd, &s[pick], out_path, st.st_mode, errbuf, errlen);
+        if (rc == 0) {
+            res->nslices = 1;
+            res->size = s[pick].size;
+        }
+    }
+    free(s);
+    close(fd);
+    return rc;
+}
+
+struct create_input {
+    struct fat_slice slice;     // offset: in the source file
+    int fd;
+};
+
+int lipo_create(char **in_paths, size_t n, int force64, const char *out_path,
+                struct lipo_result *res, char *errbuf, size_t errlen) {
+    memset(res, 0, sizeof(*res));
+    int *fds = malloc(n * sizeof(*fds));
+    struct create_input *in = NULL;
+    size_t nin = 0;
+    size_t cap = 0;
+    unsigned mode = 0755;
+    int rc = -1;
+    if (!fds) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    size_t nfds = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        struct stat st;
+        int fd = open_input(in_paths[i], &st, errbuf, errlen);
+        if (fd < 0) goto out;
+        fds[nfds++] = fd;
+        if (i == 0) mode = st.st_mode;
+
+        struct fat_slice *s = NULL;
+        size_t ns = 0;
+        int is_fat, is64;
+        if (universal_read_fd(fd, (uint64_t)st.st_size, &s, &ns, &is_fat, &is64,
+                              errbuf, errlen) != 0) {
+            size_t el = strlen(errbuf);
+            snprintf(errbuf + el, errlen > el ? errlen - el : 0, " (%s)", in_paths[i]);
+            goto out;
+        }
+        for (size_t k = 0; k < ns; k++) {
+            for (size_t j = 0; j < nin; j++) {
+                if (in[j].slice.cputype == s[k].cputype &&
+                    ((in[j].slice.cpusubtype ^ s[k].cpusubtype) & ~SUBTYPE_CAPS_MASK) == 0) {
+                    snprintf(errbuf, errlen, "%s: duplicate slice (cputype %u subtype %u)",
+                             in_paths[i], s[k].cputype, s[k].cpusubtype & ~SUBTYPE_CAPS_MASK);
+                    free(s);
+                    goto out;
+                }
+            }
+            if (nin == cap) {
+                size_t ncap = cap ? cap * 2 : 8;
+                struct create_input *ni = realloc(in, ncap * sizeof(*ni));
+                if (!ni) {
+                    snprintf(errbuf, errlen, "out of memory");
+                    free(s);
+                    goto out;
+                }
+                in = ni;
+                cap = ncap;
+            }
+            in[nin].slice = s[k];
+            in[nin].fd = fd;
+            nin++;
+        }
+        free(s);
+    }
+    if (nin == 0) {
+        snprintf(errbuf, errlen, "no input slices");
+        goto out;
+    }
+
+    // Smallest alignment first (stable), so the 16 KiB arm64 slice does not
+    // push 4 KiB ones onto 16 KiB boundaries.
+    for (size_t i = 1; i < nin; i++) {
+        struct create_input t = in[i];
+        size_t j = i;
+        while (j > 0 && in[j - 1].slice.align > t.slice.align) {
+            in[j] = in[j - 1];
+            j--;
+        }
+        in[j] = t;
+    }
+
+    struct fat_slice *layout = malloc(nin * sizeof(*layout));
+    if (!layout) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto out;
+    }
+    for (size_t i = 0; i < nin; i++) layout[i] = in[i].slice;
+    int fat64 = 0;
+    uint64_t total = universal_layout(layout, nin, force64, &fat64);
+
+    size_t hsz = universal_header_size(nin, fat64);
+    uint8_t *hdr = calloc(1, hsz);
+    char *tmp = NULL;
+    int out = hdr ? open_output(out_path, &tmp, errbuf, errlen) : -1;
+    if (!hdr && out < 0) snprintf(errbuf, errlen, "out of memory");
+    if (out >= 0) {
+        universal_write_header(layout, nin, fat64, hdr);
+        // Size first: alignment gaps become holes instead of written zeros.
+        int ok = ftruncate(out, (off_t)total) == 0 &&
+                 pwrite(out, hdr, hsz, 0) == (ssize_t)hsz;
+        for (size_t i = 0; ok && i < nin; i++) {
+            ok = copy_range(in[i].fd, in[i].slice.offset, out, layout[i].offset,
+                            layout[i].size) == 0;
+        }
+        rc = finish_output(out, tmp, out_path, ok, mode, errbuf, errlen);
+        if (rc == 0) {
+            res->nslices = (uint32_t)nin;
+            res->fat64 = fat64;
+            res->size = total;
+        }
+    }
+    free(hdr);
+    free(layout);
+
+out:
+    for (size_t i = 0; i < nfds; i++) close(fds[i]);
+    free(fds);
+    free(in);
+    return rc;
+}
+
+struct thin_job {
+    char **paths;
+    uint32_t cputype;
+    struct lipo_thin_stats *per_worker;
+};
+
+static void thin_one(const char *path, uint32_t cputype, struct lipo_thin_stats *st) {
+    char err[256];
+    struct stat sb;
+    st->files++;
+    int fd = open_input(path, &sb, err, sizeof(err));
+    if (fd < 0) {
+        st->errors++;
+        return;
+    }
+    struct fat_slice *s = NULL;
+    size_t n = 0;
+    int is_fat = 0;
+    int is64 = 0;
+    if (universal_read_fd(fd, (uint64_t)sb.st_size, &s, &n, &is_fat, &is64,
+                          err, sizeof(err)) != 0) {
+        st->not_macho++;
+    } else if (!is_fat) {
+        st->thin++;
+    } else {
+        int pick = -1;
+        for (size_t i = 0; i < n && pick < 0; i++) {
+            if (s[i].cputype == cputype) pick = (int)i;
+        }
+        if (pick < 0) {
+            st->missing_arch++;
+        } else if (write_thin(fd, &s[pick], path, sb.st_mode, err, sizeof(err)) != 0) {
+            st->errors++;
+        } else {
+            st->thinned++;
+            st->bytes_before += (uint64_t)sb.st_size;
+            st->bytes_after += s[pick].size;
+        }
+    }
+    free(s);
+    close(fd);
+}
+
+static void thin_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    struct thin_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        thin_one(job->paths[i], job->cputype, &job->per_worker[worker]);
+    }
+}
+
+void lipo_thin_many(char **paths, size_t n, uint32_t want_cputype, unsigned nthreads,
+                    struct lipo_thin_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (nthreads == 0) nthreads = par_default_threads();
+    struct lipo_thin_stats *pw = calloc(nthreads, sizeof(*pw));
+    if (!pw) {
+        // Degrade to one worker writing straight into the totals.
+        for (size_t i = 0; i < n; i++) thin_one(paths[i], want_cputype, stats);
+        return;
+    }
+    struct thin_job job = { paths, want_cputype, pw };
+    par_for(n, 1, nthreads, thin_worker, &job);
+    for (unsigned w = 0; w < nthreads; w++) {
+        stats->files += pw[w].files;
+        stats->thinned += pw[w].thinned;
+        stats->thin += pw[w].thin;
+        stats->not_macho += pw[w].not_macho;
+        stats->missing_arch += pw[w].missing_arch;
+        stats->errors += pw[w].errors;
+        stats->bytes_before += pw[w].bytes_before;
+        stats->bytes_after += pw[w].bytes_after;
+    }
+    free(pw);
+}
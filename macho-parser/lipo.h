@@ -0,0 +1,49 @@
+#ifndef MACHO_LIPO_H
+#define MACHO_LIPO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// lipo-style slice extraction and universal assembly.
+//
+// Only the FAT header is read into memory. Slice bytes are copied file to
+// file by the kernel (copy_file_range, then sendfile, on Linux; a pread/
+// pwrite loop elsewhere), so thinning a bundle costs I/O, not CPU. Outputs
+// are written to a temporary file and renamed into place.
+
+struct lipo_result {
+    uint32_t nslices;
+    int fat64;
+    uint64_t size;
+};
+
+// Copy one slice of in_path to out_path as a thin Mach-O. Selection works
+// like macho_select_slice: want_index >= 0 wins, else want_cputype (0 means
+// "arm64 if present, else the first slice"). A thin input is copied whole.
+int lipo_extract(const char *in_path, int want_index, uint32_t want_cputype,
+                 const char *out_path, struct lipo_result *res,
+                 char *errbuf, size_t errlen);
+
+// Build a universal file from thin or FAT inputs. Slices keep their
+// alignment (the linker default for thin inputs) and are ordered by it, as
+// lipo does. FAT64 is used when an offset or size needs it, or if force64.
+int lipo_create(char **in_paths, size_t n, int force64, const char *out_path,
+                struct lipo_result *res, char *errbuf, size_t errlen);
+
+struct lipo_thin_stats {
+    size_t files;
+    size_t thinned;
+    size_t thin;           // already thin Mach-O
+    size_t not_macho;
+    size_t missing_arch;   // FAT without the requested CPU: left alone
+    size_t errors;
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+};
+
+// Replace every FAT file in `paths` that contains want_cputype with that
+// slice alone, in parallel. Per-file problems are counted, not fatal.
+void lipo_thin_many(char **paths, size_t n, uint32_t want_cputype, unsigned nthreads,
+                    struct lipo_thin_stats *stats);
+
+#endif /* MACHO_LIPO_H */
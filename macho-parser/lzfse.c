@@ -0,0 +1,598 @@
+#include "lzfse.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Format notes, after Apple's reference implementation (lzfse_internal.h):
+//
+// A bvx2 block header packs the counts and final encoder states into three
+// 64-bit words, followed by the four frequency tables in a small
+// variable-length code. The payload is two FSE bitstreams written forwards
+// and read backwards from their last byte: first the literals, coded as
+// four interleaved streams, then one stream of (L, M, D) triples - L
+// literals to copy, then M bytes from D back. D == 0 repeats the previous
+// distance. Each triple value is an FSE symbol plus extra raw bits.
+
+#define MAGIC_END  0x24787662u     // "bvx$"
+#define MAGIC_RAW  0x2d787662u     // "bvx-"
+#define MAGIC_V1   0x31787662u     // "bvx1"
+#define MAGIC_V2   0x32787662u     // "bvx2"
+#define MAGIC_LZVN 0x6e787662u     // "bvxn"
+
+#define L_SYMBOLS 20
+#define M_SYMBOLS 20
+#define D_SYMBOLS 64
+#define LIT_SYMBOLS 256
+#define L_STATES 64
+#define M_STATES 64
+#define D_STATES 256
+#define LIT_STATES 1024
+#define NFREQ (L_SYMBOLS + M_SYMBOLS + D_SYMBOLS + LIT_SYMBOLS)
+
+#define MATCHES_PER_BLOCK 10000
+#define LITERALS_PER_BLOCK (4 * MATCHES_PER_BLOCK)
+
+#define V1_HEADER_SIZE 772         // sizeof(lzfse_compressed_block_header_v1)
+#define V2_HEADER_MIN 32
+
+static const uint8_t l_extra[L_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 5, 8
+};
+static const int32_t l_base[L_SYMBOLS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 20, 28, 60
+};
+static const uint8_t m_extra[M_SYMBOLS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 5, 8, 11
+};
+static const int32_t m_base[M_SYMBOLS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 24, 56, 312
+};
+static const uint8_t d_extra[D_SYMBOLS] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+    8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+};
+static const int32_t d_base[D_SYMBOLS] = {
+    0, 1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 28, 36, 44, 52,
+    60, 76, 92, 108, 124, 156, 188, 220, 252, 316, 380, 444, 508, 636, 764, 892,
+    1020, 1276, 1532, 1788, 2044, 2556, 3068, 3580, 4092, 5116, 6140, 7164, 8188, 10236, 12284, 14332,
+    16380, 20476, 24572, 28668, 32764, 40956, 49148, 57340, 65532, 81916, 98300, 114684, 131068, 163836, 196604, 229372
+};
+
+static uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static uint64_t le64(const uint8_t *p) {
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+struct out {
+    uint8_t *p;
+    size_t n;
+    size_t cap;
+};
+
+// Copy a literal run; returns nonzero if dst filled up.
+static int put_literals(struct out *o, const uint8_t *src, size_t len) {
+    int full = 0;
+    if (len > o->cap - o->n) {
+        len = o->cap - o->n;
+        full = 1;
+    }
+    memcpy(o->p + o->n, src, len);
+    o->n += len;
+    return full;
+}
+
+// Copy a match from `d` bytes back (d <= o->n checked by the caller).
+static int put_match(struct out *o, size_t d, size_t len) {
+    int full = 0;
+    if (len > o->cap - o->n) {
+        len = o->cap - o->n;
+        full = 1;
+    }
+    uint8_t *dst = o->p + o->n;
+    const uint8_t *src = dst - d;
+    if (d >= len) {
+        memcpy(dst, src, len);
+    } else {
+        for (size_t i = 0; i < len; i++) dst[i] = src[i];   // overlapping run
+    }
+    o->n += len;
+    return full;
+}
+
+// --- FSE ---
+
+// Backward bit reader: bits come off the top of `accum`, bytes are loaded
+// from the end of the stream towards its start.
+struct bwd {
+    uint64_t accum;
+    int nbits;
+    int bad;
+    const uint8_t *p;
+    const uint8_t *start;
+};
+
+// `n` is the header's final bit count, in [-7, 0]: how many bits of the last
+// byte are padding.
+static int bwd_init(struct bwd *b, int n, const uint8_t *start, const uint8_t *end) {
+    b->start = start;
+    b->bad = 0;
+    int bytes = n ? 8 : 7;
+    if (end - start < bytes) return -1;
+    b->p = end - bytes;
+    b->accum = 0;
+    for (int i = bytes - 1; i >= 0; i--) b->accum = (b->accum << 8) | b->p[i];
+    b->nbits = n + bytes * 8;
+    if (b->nbits < 56 || b->nbits >= 64 || (b->accum >> b->nbits) != 0) return -1;
+    return 0;
+}
+
+// Top up to at least 56 bits. Reading may run into the block header in
+// front of the payload (`start` is the block start); those bits are never
+// consumed by a well-formed stream.
+static int bwd_flush(struct bwd *b) {
+    int nbits = (63 - b->nbits) & -8;
+    int nbytes = nbits >> 3;
+    if (b->p - b->start < nbytes) return -1;
+    b->p -= nbytes;
+    uint64_t in = 0;
+    for (int i = nbytes - 1; i >= 0; i--) in = (in << 8) | b->p[i];
+    b->accum = (b->accum << nbits) | in;
+    b->nbits += nbits;
+    return 0;
+}
+
+static inline uint64_t bwd_pull(struct bwd *b, int n) {
+    if (n > b->nbits) {
+        b->bad = 1;
+        return 0;
+    }
+    b->nbits -= n;
+    uint64_t v = b->accum >> b->nbits;
+    b->accum &= (1ull << b->nbits) - 1;
+    return v;
+}
+
+struct lit_entry {
+    uint8_t k;          // bits to read for the next state
+    uint8_t symbol;
+    uint16_t delta;     // next state = delta + bits
+};
+
+struct val_entry {
+    uint8_t total_bits; // state bits + extra value bits
+    uint8_t value_bits;
+    uint16_t delta;
+    int32_t vbase;
+};
+
+static int check_freq(const uint16_t *freq, int nsymbols, int nstates) {
+    int sum = 0;
+    for (int i = 0; i < nsymbols; i++) sum += freq[i];
+    return sum <= nstates ? 0 : -1;
+}
+
+static int clz32(uint32_t x) {
+    int n = 0;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+// Each symbol owns freq[i] consecutive states. A state reads k or k-1 bits,
+// chosen so that the next-state ranges of a symbol tile [0, nstates).
+static void init_lit_table(const uint16_t *freq, struct lit_entry *t) {
+    memset(t, 0, LIT_STATES * sizeof(*t));
+    int n_clz = clz32(LIT_STATES);
+    struct lit_entry *e = t;
+    for (int i = 0; i < LIT_SYMBOLS; i++) {
+        int f = freq[i];
+        if (f == 0) continue;
+        int k = clz32((uint32_t)f) - n_clz;
+        int j0 = ((2 * LIT_STATES) >> k) - f;
+        for (int j = 0; j < f; j++, e++) {
+            e->symbol = (uint8_t)i;
+            if (j < j0) {
+                e->k = (uint8_t)k;
+                e->delta = (uint16_t)(((f + j) << k) - LIT_STATES);
+            } else {
+                e->k = (uint8_t)(k - 1);
+                e->delta = (uint16_t)((j - j0) << (k - 1));
+            }
+        }
+    }
+}
+
+static void init_val_table(int nstates, int nsymbols, const uint16_t *freq,
+                           const uint8_t *extra, const int32_t *base, struct val_entry *t) {
+    memset(t, 0, (size_t)nstates * sizeof(*t));
+    int n_clz = clz32((uint32_t)nstates);
+    struct val_entry *e = t;
+    for (int i = 0; i < nsymbols; i++) {
+        int f = freq[i];
+        if (f == 0) continue;
+        int k = clz32((uint32_t)f) - n_clz;
+        int j0 = ((2 * nstates) >> k) - f;
+        for (int j = 0; j < f; j++, e++) {
+            e->value_bits = extra[i];
+            e->vbase = base[i];
+            if (j < j0) {
+                e->total_bits = (uint8_t)(k + extra[i]);
+                e->delta = (uint16_t)(((f + j) << k) - nstates);
+            } else {
+                e->total_bits = (uint8_t)(k - 1 + extra[i]);
+                e->delta = (uint16_t)((j - j0) << (k - 1));
+            }
+        }
+    }
+}
+
+static inline uint8_t lit_decode(uint16_t *state, const struct lit_entry *t, struct bwd *b) {
+    const struct lit_entry *e = &t[*state];
+    *state = (uint16_t)(e->delta + bwd_pull(b, e->k));
+    return e->symbol;
+}
+
+static inline int32_t val_decode(uint16_t *state, const struct val_entry *t, struct bwd *b) {
+    const struct val_entry *e = &t[*state];
+    uint32_t v = (uint32_t)bwd_pull(b, e->total_bits);
+    *state = (uint16_t)(e->delta + (v >> e->value_bits));
+    return e->vbase + (int32_t)(v & ((1u << e->value_bits) - 1));
+}
+
+// A compressed block, v1 and v2 headers reduced to the same fields.
+struct fse_block {
+    uint32_t n_raw;
+    uint32_t n_literals;
+    uint32_t n_matches;
+    uint32_t n_lit_payload;
+    uint32_t n_lmd_payload;
+    int literal_bits;
+    int lmd_bits;
+    uint16_t lit_state[4];
+    uint16_t l_state;
+    uint16_t m_state;
+    uint16_t d_state;
+    uint16_t freq[NFREQ];        // l, m, d, literal
+};
+
+// Per-decode scratch, allocated once per lzfse_decode call.
+struct scratch {
+    struct lit_entry lit[LIT_STATES];
+    struct val_entry l[L_STATES];
+    struct val_entry m[M_STATES];
+    struct val_entry d[D_STATES];
+    uint8_t literals[LITERALS_PER_BLOCK + 64];
+};
+
+// The v2 frequency code: 2..14-bit codes, least significant bit first.
+static uint32_t freq_value(uint32_t bits, int *nbits) {
+    static const int8_t nbits_table[32] = {
+        2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14,
+        2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14
+    };
+    static const int8_t value_table[32] = {
+        0, 2, 1, 4, 0, 3, 1, -1, 0, 2, 1, 5, 0, 3, 1, -1,
+        0, 2, 1, 6, 0, 3, 1, -1, 0, 2, 1, 7, 0, 3, 1, -1
+    };
+    uint32_t b = bits & 31;
+    int n = nbits_table[b];
+    *nbits = n;
+    if (n == 8) return 8 + ((bits >> 4) & 0xf);
+    if (n == 14) return 24 + ((bits >> 4) & 0x3ff);
+    return (uint32_t)value_table[b];
+}
+
+static int parse_v2(const uint8_t *p, size_t avail, struct fse_block *blk, size_t *hdr_size) {
+    if (avail < V2_HEADER_MIN) return -1;
+    uint64_t v0 = le64(p + 8);
+    uint64_t v1 = le64(p + 16);
+    uint64_t v2 = le64(p + 24);
+    blk->n_raw = le32(p + 4);
+    blk->n_literals = (uint32_t)(v0 & 0xfffff);
+    blk->n_lit_payload = (uint32_t)((v0 >> 20) & 0xfffff);
+    blk->n_matches = (uint32_t)((v0 >> 40) & 0xfffff);
+    blk->literal_bits = (int)((v0 >> 60) & 7) - 7;
+    for (int i = 0; i < 4; i++) blk->lit_state[i] = (uint16_t)((v1 >> (10 * i)) & 0x3ff);
+    blk->n_lmd_payload = (uint32_t)((v1 >> 40) & 0xfffff);
+    blk->lmd_bits = (int)((v1 >> 60) & 7) - 7;
+    uint32_t hs = (uint32_t)(v2 & 0xffffffffu);
+    blk->l_state = (uint16_t)((v2 >> 32) & 0x3ff);
+    blk->m_state = (uint16_t)((v2 >> 42) & 0x3ff);
+    blk->d_state = (uint16_t)((v2 >> 52) & 0x3ff);
+    if (hs < V2_HEADER_MIN || hs > avail) return -1;
+
+    const uint8_t *src = p + V2_HEADER_MIN;
+    const uint8_t *end = p + hs;
+    uint32_t accum = 0;
+    int accum_nbits = 0;
+    for (int i = 0; i < NFREQ; i++) {
+        while (src < end && accum_nbits + 8 <= 32) {
+            accum |= (uint32_t)*src++ << accum_nbits;
+            accum_nbits += 8;
+        }
+        int nbits;
+        blk->freq[i] = (uint16_t)freq_value(accum, &nbits);
+        if (nbits > accum_nbits) return -1;
+        accum >>= nbits;
+        accum_nbits -= nbits;
+    }
+    if (accum_nbits >= 8 || src != end) return -1;
+    *hdr_size = hs;
+    return 0;
+}
+
+static int parse_v1(const uint8_t *p, size_t avail, struct fse_block *blk, size_t *hdr_size) {
+    if (avail < V1_HEADER_SIZE) return -1;
+    blk->n_raw = le32(p + 4);
+    blk->n_literals = le32(p + 12);
+    blk->n_matches = le32(p + 16);
+    blk->n_lit_payload = le32(p + 20);
+    blk->n_lmd_payload = le32(p + 24);
+    blk->literal_bits = (int32_t)le32(p + 28);
+    for (int i = 0; i < 4; i++) blk->lit_state[i] = (uint16_t)(p[32 + 2 * i] | p[33 + 2 * i] << 8);
+    blk->lmd_bits = (int32_t)le32(p + 40);
+    blk->l_state = (uint16_t)(p[44] | p[45] << 8);
+    blk->m_state = (uint16_t)(p[46] | p[47] << 8);
+    blk->d_state = (uint16_t)(p[48] | p[49] << 8);
+    for (int i = 0; i < NFREQ; i++) blk->freq[i] = (uint16_t)(p[50 + 2 * i] | p[51 + 2 * i] << 8);
+    if (blk->literal_bits < -7 || blk->literal_bits > 0 ||
+        blk->lmd_bits < -7 || blk->lmd_bits > 0) {
+        return -1;
+    }
+    *hdr_size = V1_HEADER_SIZE;
+    return 0;
+}
+
+// Decode one FSE block whose header starts at `blk_start`; the payload is
+// [payload, payload + n_lit_payload + n_lmd_payload).
+static int fse_block(const struct fse_block *blk, const uint8_t *blk_start,
+                     const uint8_t *payload, struct scratch *sc, struct out *o) {
+    const uint16_t *l_freq = blk->freq;
+    const uint16_t *m_freq = l_freq + L_SYMBOLS;
+    const uint16_t *d_freq = m_freq + M_SYMBOLS;
+    const uint16_t *lit_freq = d_freq + D_SYMBOLS;
+    if (blk->n_literals > LITERALS_PER_BLOCK || blk->n_matches > LITERALS_PER_BLOCK ||
+        check_freq(l_freq, L_SYMBOLS, L_STATES) || check_freq(m_freq, M_SYMBOLS, M_STATES) ||
+        check_freq(d_freq, D_SYMBOLS, D_STATES) ||
+        check_freq(lit_freq, LIT_SYMBOLS, LIT_STATES) ||
+        blk->l_state >= L_STATES || blk->m_state >= M_STATES || blk->d_state >= D_STATES) {
+        return LZFSE_ERROR;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (blk->lit_state[i] >= LIT_STATES) return LZFSE_ERROR;
+    }
+    init_lit_table(lit_freq, sc->lit);
+    init_val_table(L_STATES, L_SYMBOLS, l_freq, l_extra, l_base, sc->l);
+    init_val_table(M_STATES, M_SYMBOLS, m_freq, m_extra, m_base, sc->m);
+    init_val_table(D_STATES, D_SYMBOLS, d_freq, d_extra, d_base, sc->d);
+
+    // Literals: four interleaved states, one flush per group of four
+    // (4 x 10 bits fits in the 56 guaranteed).
+    struct bwd b;
+    const uint8_t *lit_end = payload + blk->n_lit_payload;
+    if (bwd_init(&b, blk->literal_bits, blk_start, lit_end) != 0) return LZFSE_ERROR;
+    uint16_t s0 = blk->lit_state[0], s1 = blk->lit_state[1];
+    uint16_t s2 = blk->lit_state[2], s3 = blk->lit_state[3];
+    uint8_t *lits = sc->literals;
+    for (uint32_t i = 0; i < blk->n_literals; i += 4) {
+        if (bwd_flush(&b) != 0) return LZFSE_ERROR;
+        lits[i + 0] = lit_decode(&s0, sc->lit, &b);
+        lits[i + 1] = lit_decode(&s1, sc->lit, &b);
+        lits[i + 2] = lit_decode(&s2, sc->lit, &b);
+        lits[i + 3] = lit_decode(&s3, sc->lit, &b);
+    }
+    if (b.bad) return LZFSE_ERROR;
+
+    // L/M/D triples: at most 14 + 17 + 23 bits each, one flush per triple.
+    if (bwd_init(&b, blk->lmd_bits, blk_start, lit_end + blk->n_lmd_payload) != 0) {
+        return LZFSE_ERROR;
+    }
+    uint16_t ls = blk->l_state, ms = blk->m_state, ds = blk->d_state;
+    const uint8_t *lit = lits;
+    const uint8_t *lits_end = lits + blk->n_literals;
+    size_t start = o->n;
+    size_t d = 0;
+    for (uint32_t i = 0; i < blk->n_matches; i++) {
+        if (bwd_flush(&b) != 0) return LZFSE_ERROR;
+        size_t l = (size_t)val_decode(&ls, sc->l, &b);
+        size_t m = (size_t)val_decode(&ms, sc->m, &b);
+        size_t nd = (size_t)val_decode(&ds, sc->d, &b);
+        if (b.bad) return LZFSE_ERROR;
+        if (nd) d = nd;
+        if (l > (size_t)(lits_end - lit) || l + m > blk->n_raw - (o->n - start)) {
+            return LZFSE_ERROR;
+        }
+        if (put_literals(o, lit, l)) return LZFSE_FULL;
+        lit += l;
+        if (m) {
+            if (d == 0 || d > o->n) return LZFSE_ERROR;
+            if (put_match(o, d, m)) return LZFSE_FULL;
+        }
+    }
+    return o->n - start == blk->n_raw ? LZFSE_DONE : LZFSE_ERROR;
+}
+
+// --- LZVN ---
+
+// Opcodes (L = literal count, M = match length, D = distance):
+//   LLMMMDDD DDDDDDDD           sml_d  (low bits 0-5)
+//   LLMMM110                    pre_d  (previous D)
+//   LLMMM111 DDDDDDDD DDDDDDDD  lrg_d
+//   101LLMMM DDDDDDMM DDDDDDDD  med_d
+//   1110LLLL / 11100000 LLLLLLLL  literals only
+//   1111MMMM / 11110000 MMMMMMMM  match only, previous D
+//   00000110 + 7 bytes          end of stream
+//   00001110, 00010110          nop
+// 0x70-0x7f and 0xd0-0xdf are undefined: with L=1 or 3 the MMM field is
+// short, and 0xa0-0xbf (L=2, M>6) is med_d.
+static int lzvn_block(const uint8_t *s, const uint8_t *end, uint32_t n_raw, struct out *o) {
+    size_t start = o->n;
+    size_t d = 0;
+    for (;;) {
+        if (s >= end) return LZFSE_ERROR;
+        uint8_t opc = s[0];
+        size_t avail = (size_t)(end - s);
+        size_t len = 1, l = 0, m = 0;
+        size_t nd = d;
+        if (opc == 0x06) {
+            if (avail < 8) return LZFSE_ERROR;
+            break;
+        } else if (opc == 0x0e || opc == 0x16) {
+            s++;
+            continue;
+        } else if (opc >= 0xf0) {
+            if (opc == 0xf0) {
+                if (avail < 2) return LZFSE_ERROR;
+                m = (size_t)s[1] + 16;
+                len = 2;
+            } else {
+                m = opc & 0xf;
+            }
+        } else if (opc >= 0xe0) {
+            if (opc == 0xe0) {
+                if (avail < 2) return LZFSE_ERROR;
+                l = (size_t)s[1] + 16;
+                len = 2;
+            } else {
+                l = opc & 0xf;
+            }
+        } else if (opc >= 0xa0 && opc < 0xc0) {
+            if (avail < 3) return LZFSE_ERROR;
+            uint32_t w = (uint32_t)s[1] | ((uint32_t)s[2] << 8);
+            l = (opc >> 3) & 3;
+            m = (size_t)((((opc & 7) << 2) | (w & 3)) + 3);
+            nd = w >> 2;
+            len = 3;
+        } else if ((opc >= 0x70 && opc < 0x80) || (opc >= 0xd0 && opc < 0xe0)) {
+            return LZFSE_ERROR;
+        } else {
+            l = opc >> 6;
+            m = (size_t)((opc >> 3) & 7) + 3;
+            switch (opc & 7) {
+                case 7:
+                    if (avail < 3) return LZFSE_ERROR;
+                    nd = (size_t)s[1] | ((size_t)s[2] << 8);
+                    len = 3;
+                    break;
+                case 6:
+                    if (opc < 0x40) return LZFSE_ERROR;
+                    break;
+                default:
+                    if (avail < 2) return LZFSE_ERROR;
+                    nd = ((size_t)(opc & 7) << 8) | s[1];
+                    len = 2;
+                    break;
+            }
+        }
+        if (l > avail - len || l + m > n_raw - (o->n - start)) return LZFSE_ERROR;
+        s += len;
+        if (put_literals(o, s, l)) return LZFSE_FULL;
+        s += l;
+        if (m) {
+            if (nd == 0 || nd > o->n) return LZFSE_ERROR;
+            d = nd;
+            if (put_match(o, d, m)) return LZFSE_FULL;
+        }
+    }
+    return o->n - start == n_raw ? LZFSE_DONE : LZFSE_ERROR;
+}
+
+int lzfse_decode(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                 size_t *out_len) {
+    struct out o = { dst, 0, dstcap };
+    struct scratch *sc = NULL;
+    const uint8_t *p = src;
+    const uint8_t *end = src + srclen;
+    int rc = LZFSE_ERROR;
+
+    for (;;) {
+        size_t avail = (size_t)(end - p);
+        if (avail < 4) break;
+        uint32_t magic = le32(p);
+        if (magic == MAGIC_END) {
+            rc = LZFSE_DONE;
+            break;
+        }
+        if (o.n == o.cap) {
+            rc = LZFSE_FULL;
+            break;
+        }
+        if (magic == MAGIC_RAW) {
+            if (avail < 8 || le32(p + 4) > avail - 8) break;
+            uint32_t n = le32(p + 4);
+            if (put_literals(&o, p + 8, n)) {
+                rc = LZFSE_FULL;
+                break;
+            }
+            p += 8 + (size_t)n;
+        } else if (magic == MAGIC_LZVN) {
+            if (avail < 12 || le32(p + 8) > avail - 12) break;
+            uint32_t n_payload = le32(p + 8);
+            rc = lzvn_block(p + 12, p + 12 + n_payload, le32(p + 4), &o);
+            if (rc != LZFSE_DONE) break;
+            rc = LZFSE_ERROR;
+            p += 12 + (size_t)n_payload;
+        } else if (magic == MAGIC_V1 || magic == MAGIC_V2) {
+            struct fse_block blk;
+            size_t hs;
+            if ((magic == MAGIC_V2 ? parse_v2(p, avail, &blk, &hs)
+                                   : parse_v1(p, avail, &blk, &hs)) != 0) {
+                break;
+            }
+            uint64_t payload = (uint64_t)blk.n_lit_payload + blk.n_lmd_payload;
+            if (payload > avail - hs) break;
+            if (!sc && !(sc = malloc(sizeof(*sc)))) break;
+            rc = fse_block(&blk, p, p + hs, sc, &o);
+            if (rc != LZFSE_DONE) break;
+            rc = LZFSE_ERROR;
+            p += hs + (size_t)payload;
+        } else {
+            break;
+        }
+    }
+    free(sc);
+    *out_len = o.n;
+    return rc;
+}
+
+size_t lzfse_decoded_size(const uint8_t *src, size_t srclen) {
+    const uint8_t *p = src;
+    const uint8_t *end = src + srclen;
+    size_t total = 0;
+    for (;;) {
+        size_t avail = (size_t)(end - p);
+        if (avail < 4) return SIZE_MAX;
+        uint32_t magic = le32(p);
+        uint64_t skip;
+        if (magic == MAGIC_END) return total;
+        if (avail < 8) return SIZE_MAX;
+        uint32_t n_raw = le32(p + 4);
+        if (magic == MAGIC_RAW) {
+            skip = 8 + (uint64_t)n_raw;
+        } else if (magic == MAGIC_LZVN) {
+            if (avail < 12) return SIZE_MAX;
+            skip = 12 + (uint64_t)le32(p + 8);
+        } else if (magic == MAGIC_V2) {
+            if (avail < V2_HEADER_MIN) return SIZE_MAX;
+            uint64_t v0 = le64(p + 8);
+            uint64_t v1 = le64(p + 16);
+            skip = (le64(p + 24) & 0xffffffffu) + ((v0 >> 20) & 0xfffff) + ((v1 >> 40) & 0xfffff);
+        } else if (magic == MAGIC_V1) {
+            if (avail < V1_HEADER_SIZE) return SIZE_MAX;
+            skip = V1_HEADER_SIZE + (uint64_t)le32(p + 20) + le32(p + 24);
+        } else {
+            return SIZE_MAX;
+        }
+        if (skip > avail || total > SIZE_MAX - n_raw) return SIZE_MAX;
+        total += n_raw;
+        p += skip;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MACHO_LZFSE_H
+#define MACHO_LZFSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZFSE decoder (Apple's compression for kernelcaches, iBoot images and
+// .aar archives), including the LZVN blocks it embeds for small inputs.
+//
+// An LZFSE stream is a sequence of blocks, each with a "bvx?" magic:
+// bvx- (stored), bvx1/bvx2 (FSE-coded literals and L/M/D triples), bvxn
+// (LZVN) and bvx$ (end of stream). Blocks are decoded one at a time straight
+// into the caller's buffer, which is also the match window, as in inflate.c.
+// Decoding stops when the buffer is full, so a caller that only wants the
+// first N bytes (the fileset header and its load commands) pays for N bytes.
+
+enum {
+    LZFSE_DONE = 0,        // end-of-stream block reached
+    LZFSE_FULL = 1,        // dst filled before the end; *out_len == dstcap
+    LZFSE_ERROR = -1,      // corrupt or truncated input
+};
+
+int lzfse_decode(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                 size_t *out_len);
+
+// Decoded size from the block headers alone, or SIZE_MAX if the block chain
+// is malformed. Cheap: no block is decoded.
+size_t lzfse_decoded_size(const uint8_t *src, size_t srclen);
+
+#endif /* MACHO_LZFSE_H */
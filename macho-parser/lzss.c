@@ -0,0 +1,82 @@
+#include "lzss.h"
+
+#include <string.h>
+
+#include "macho_common.h"
+
+#define RING 4096
+#define MAX_MATCH 18
+#define THRESHOLD 2
+
+int lzss_decode(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                size_t *out_len) {
+    uint8_t ring[RING];
+    memset(ring, ' ', RING - MAX_MATCH);
+    memset(ring + RING - MAX_MATCH, 0, MAX_MATCH);
+    unsigned r = RING - MAX_MATCH;
+    const uint8_t *end = src + srclen;
+    size_t n = 0;
+    unsigned flags = 0;
+
+    for (;;) {
+        flags >>= 1;
+        if (!(flags & 0x100)) {
+            if (src == end) break;
+            flags = *src++ | 0xff00u;
+        }
+        if (flags & 1) {
+            if (src == end) break;
+            if (n == dstcap) {
+                *out_len = n;
+                return LZSS_FULL;
+            }
+            uint8_t c = *src++;
+            dst[n++] = c;
+            ring[r] = c;
+            r = (r + 1) & (RING - 1);
+        } else {
+            if (end - src < 2) break;
+            unsigned pos = src[0] | ((unsigned)(src[1] & 0xf0) << 4);
+            unsigned len = (src[1] & 0x0f) + THRESHOLD + 1;
+            src += 2;
+            for (unsigned k = 0; k < len; k++) {
+                if (n == dstcap) {
+                    *out_len = n;
+                    return LZSS_FULL;
+                }
+                uint8_t c = ring[(pos + k) & (RING - 1)];
+                dst[n++] = c;
+                ring[r] = c;
+                r = (r + 1) & (RING - 1);
+            }
+        }
+    }
+    *out_len = n;
+    return LZSS_DONE;
+}
+
+int lzss_parse_header(const uint8_t *buf, size_t size, struct lzss_header *out) {
+    if (size < LZSS_HEADER_SIZE || memcmp(buf, "complzss", 8) != 0) return -1;
+    out->adler32 = load32_be(buf + 8);
+    out->uncompressed_size = load32_be(buf + 12);
+    out->compressed_size = load32_be(buf + 16);
+    if (out->compressed_size > size - LZSS_HEADER_SIZE) return -1;
+    return 0;
+}
+
+uint32_t lzss_adler32(const uint8_t *p, size_t n) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (n) {
+        // 5552 is the most bytes that cannot overflow b before the modulo.
+        size_t k = n < 5552 ? n : 5552;
+        n -= k;
+        while (k--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
@@ -0,0 +1,37 @@
+#ifndef MACHO_LZSS_H
+#define MACHO_LZSS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZSS as used for pre-iOS 10 kernelcaches ("complzss"): Okumura's
+// classic coder with a 4 KiB ring, 18-byte maximum match and one flag byte
+// per eight items. The ring starts out filled with spaces, so matches may
+// reach back before the start of the output.
+//
+// The ring is the only state, so input is decoded in a single forward
+// pass with no look-ahead; decoding stops when dst is full.
+
+enum {
+    LZSS_DONE = 0,         // input exhausted
+    LZSS_FULL = 1,         // dst filled first; *out_len == dstcap
+};
+
+int lzss_decode(const uint8_t *src, size_t srclen, uint8_t *dst, size_t dstcap,
+                size_t *out_len);
+
+// The "complzss" container: 0x180-byte header, big-endian fields.
+#define LZSS_HEADER_SIZE 0x180
+
+struct lzss_header {
+    uint32_t adler32;      // of the decompressed data
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+};
+
+// Returns 0 if buf starts with a well-formed complzss header.
+int lzss_parse_header(const uint8_t *buf, size_t size, struct lzss_header *out);
+
+uint32_t lzss_adler32(const uint8_t *p, size_t n);
+
+#endif /* MACHO_LZSS_H */
@@ -0,0 +1,459 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "bench_inspect.h"
+#include "corpus.h"
+#include "dyld_info.h"
+#include "macho_image.h"
+#include "universal.h"
+
+// macho_bench: parser throughput over a corpus.
+//
+//   macho_bench [-r ROUNDS] [-c BASELINE] [-t PCT] <path>... | -
+//
+// Files are mapped and touched once, then parsed ROUNDS times in stages,
+// each timed on its own:
+//   slices   universal_read: the FAT table, or the thin header
+//   load     macho_image_load per slice (budget pre-pass included)
+//   link     macho_link_info + macho_imports
+//   symbols  macho_image_defined_symbols
+//   exports  macho_exports (trie, else the symbol table)
+//   fixups   rebase and bind opcode walks, or the chained fixup walk
+//   inspect  macho_inspect's own parse_fat / parse_thin_macho_* on the
+//            whole file, printing to /dev/null (bench_inspect.h)
+// A slice that fails to load counts as an error and skips the later stages.
+// Only total has a byte rate: corpus bytes per second. Each stage reads a
+// small, stage-specific part of a file (the FAT table, the load commands,
+// the symbol table), so file bytes over its time would be meaningless;
+// stages report ns/file and files/s and print MB/s=-.
+//
+// The report on stdout is line-oriented and stable: a version line, the
+// corpus line, one `stage` line per stage and `total`, then the `count`
+// line. Every field is key=value and the order never changes, so reports
+// can be diffed and grepped. Timings vary between runs; allocations and
+// counts do not, and a change in them means the parser changed.
+//
+// With -c, the stage lines of an earlier report are compared: a stage
+// whose ns/file is more than PCT percent higher (default 10), or with
+// more allocations per file, is a regression and the exit status is 1.
+
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64 0xcafebabf
+#endif
+#ifndef FAT_CIGAM_64
+#define FAT_CIGAM_64 0xbfbafeca
+#endif
+
+#define REPORT_VERSION 3
+
+enum {
+    ST_SLICES, ST_LOAD, ST_LINK, ST_SYMBOLS, ST_EXPORTS, ST_FIXUPS, ST_INSPECT, ST_TOTAL,
+    ST_COUNT
+};
+
+static const char *const stage_names[ST_COUNT] = {
+    "slices", "load", "link", "symbols", "exports", "fixups", "inspect", "total",
+};
+
+// ---- allocation counting ----
+//
+// glibc lets a program replace malloc and reach the real one through
+// __libc_malloc, so every allocation in the process is counted, including
+// the ones libc makes for strdup and friends. Elsewhere allocs are not
+// reported. The counter is not atomic: the benchmark runs on one thread.
+
+#if defined(__GLIBC__)
+#define HAVE_ALLOC_COUNT 1
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t m);
+extern void *__libc_realloc(void *p, size_t n);
+extern void __libc_free(void *p);
+
+static uint64_t g_allocs;
+
+void *malloc(size_t n) {
+    g_allocs++;
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t m) {
+    g_allocs++;
+    return __libc_calloc(n, m);
+}
+
+void *realloc(void *p, size_t n) {
+    g_allocs++;
+    return __libc_realloc(p, n);
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+static uint64_t g_allocs;
+#endif
+
+struct stage_stat {
+    uint64_t ns;
+    uint64_t allocs;
+};
+
+struct counts {
+    uint64_t slices;
+    uint64_t errors;
+    uint64_t symbols;
+    uint64_t imports;
+    uint64_t exports;
+    uint64_t fixups;
+};
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [-r ROUNDS] [-c BASELINE] [-t PCT] <path>... | -\n", prog);
+    fprintf(out, "  -r ROUNDS    parse every file this many times (default 10)\n");
+    fprintf(out, "  -c BASELINE  compare with an earlier report; exit 1 on a regression\n");
+    fprintf(out, "  -t PCT       slowdown tolerated by -c, in percent (default 10)\n");
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int count_rebase(void *ctx, uint32_t seg, uint64_t offset) {
+    (void)seg;
+    (void)offset;
+    (*(uint64_t *)ctx)++;
+    return 0;
+}
+
+static int count_bind(void *ctx, const char *name, int32_t ordinal, unsigned flags,
+                      int64_t addend, uint32_t seg, uint64_t offset) {
+    (void)name;
+    (void)ordinal;
+    (void)flags;
+    (void)addend;
+    (void)seg;
+    (void)offset;
+    (*(uint64_t *)ctx)++;
+    return 0;
+}
+
+static int count_chained(void *ctx, const struct macho_chained_fixup *f) {
+    (void)f;
+    (*(uint64_t *)ctx)++;
+    return 0;
+}
+
+// Run body as one stage, adding its time and allocations to st.
+#define STAGE(st, body)                                  \
+    do {                                                 \
+        uint64_t a0_ = g_allocs, t0_ = now_ns();         \
+        body;                                            \
+        (st)->ns += now_ns() - t0_;                      \
+        (st)->allocs += g_allocs - a0_;                  \
+    } while (0)
+
+static void parse_slice(const uint8_t *buf, size_t size, struct stage_stat *st,
+                        struct counts *c) {
+    struct macho_image img;
+    char err[256];
+    int rc;
+    STAGE(&st[ST_LOAD], rc = macho_image_load(&img, buf, size, err, sizeof(err)));
+    if (rc != 0) {
+        c->errors++;
+        return;
+    }
+
+    struct macho_link_info li;
+    struct macho_import *imports = NULL;
+    size_t nimports = 0;
+    int have_li;
+    STAGE(&st[ST_LINK], {
+        have_li = macho_link_info(&img, &li, err, sizeof(err)) == 0;
+        if (macho_imports(&img, &imports, &nimports, err, sizeof(err)) != 0) nimports = 0;
+    });
+    c->imports += nimports;
+
+    struct macho_symbol *syms = NULL;
+    size_t nsyms;
+    STAGE(&st[ST_SYMBOLS], nsyms = macho_image_defined_symbols(&img, &syms));
+    c->symbols += nsyms;
+
+    struct macho_export_list ex;
+    int have_ex;
+    STAGE(&st[ST_EXPORTS], have_ex = macho_exports(&img, &ex, err, sizeof(err)) == 0);
+    if (have_ex) c->exports += ex.n;
+
+    uint64_t fixups = 0;
+    STAGE(&st[ST_FIXUPS], {
+        macho_rebase_walk(&img, count_rebase, &fixups, err, sizeof(err));
+        macho_bind_walk(&img, MACHO_BIND, count_bind, &fixups, err, sizeof(err));
+        macho_bind_walk(&img, MACHO_BIND_LAZY, count_bind, &fixups, err, sizeof(err));
+        macho_chained_walk(&img, count_chained, &fixups, err, sizeof(err));
+    });
+    c->fixups += fixups;
+
+    if (have_ex) macho_export_list_free(&ex);
+    free(syms);
+    free(imports);
+    if (have_li) macho_link_info_free(&li);
+    macho_image_free(&img);
+}
+
+static void parse_file(const struct mapped_file *mf, struct stage_stat *st, struct counts *c) {
+    struct fat_slice *s = NULL;
+    size_t n = 0;
+    int is_fat, is64, rc;
+    char err[256];
+    STAGE(&st[ST_INSPECT], bench_inspect(mf->data, mf->size));
+    STAGE(&st[ST_SLICES],
+          rc = universal_read(mf->data, mf->size, &s, &n, &is_fat, &is64, err, sizeof(err)));
+    if (rc != 0) {
+        c->errors++;
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        c->slices++;
+        parse_slice(mf->data + s[i].offset, (size_t)s[i].size, st, c);
+    }
+    free(s);
+}
+
+// The inspect stage prints. While the rounds run, stdout goes to
+// /dev/null; returns the saved descriptor for stdout_restore, or -1.
+static int stdout_to_null(void) {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int fd = open("/dev/null", O_WRONLY);
+    if (saved < 0 || fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+        if (saved >= 0) close(saved);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+    return saved;
+}
+
+static void stdout_restore(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static double per(uint64_t v, uint64_t n) {
+    return n ? (double)v / (double)n : 0.0;
+}
+
+// MB/s prints as - when `bytes` is 0.
+static void print_stage(const char *name, const struct stage_stat *st, uint64_t files,
+                        uint64_t bytes) {
+    double sec = (double)st->ns / 1e9;
+    printf("stage name=%s ns/file=%.0f", name, per(st->ns, files));
+    if (bytes) printf(" MB/s=%.1f", sec > 0 ? (double)bytes / 1e6 / sec : 0.0);
+    else printf(" MB/s=-");
+    printf(" files/s=%.0f", sec > 0 ? (double)files / sec : 0.0);
+    if (HAVE_ALLOC_COUNT) printf(" allocs/file=%.2f\n", per(st->allocs, files));
+    else printf(" allocs/file=-\n");
+}
+
+// "key=value" field of a report line, as a double. Returns -1 if absent
+// or not a number.
+static int field(const char *line, const char *key, double *out) {
+    size_t klen = strlen(key);
+    for (const char *p = line; (p = strstr(p, key)) != NULL; p += klen) {
+        if ((p == line || p[-1] == ' ') && p[klen] == '=') {
+            char *end;
+            *out = strtod(p + klen + 1, &end);
+            return end == p + klen + 1 ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+static int compare(const char *path, const struct stage_stat *st, uint64_t files,
+                   size_t corpus_files, uint64_t corpus_bytes, double tolerance) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char line[512];
+    int regressions = 0, matched = 0;
+    while (fgets(line, sizeof(line), f)) {
+        double v;
+        if (strncmp(line, "corpus ", 7) == 0) {
+            if ((field(line, "files", &v) == 0 && (size_t)v != corpus_files) ||
+                (field(line, "bytes", &v) == 0 && (uint64_t)v != corpus_bytes)) {
+                fprintf(stderr, "warning: baseline was measured on a different corpus\n");
+            }
+            continue;
+        }
+        if (strncmp(line, "stage name=", 11) != 0) continue;
+        size_t nlen = strcspn(line + 11, " \n");
+        int k = 0;
+        for (; k < ST_COUNT; k++) {
+            if (strlen(stage_names[k]) == nlen && memcmp(stage_names[k], line + 11, nlen) == 0) {
+                break;
+            }
+        }
+        if (k == ST_COUNT) continue;
+        matched++;
+
+        // ns/file rather than MB/s: every stage reports it, in v1 reports too.
+        double nsf = per(st[k].ns, files);
+        double allocs = per(st[k].allocs, files);
+        double old_nsf, old_allocs;
+        int slow = 0, more = 0;
+        fprintf(stderr, "compare name=%s", stage_names[k]);
+        if (field(line, "ns/file", &old_nsf) == 0 && old_nsf > 0) {
+            double change = (nsf - old_nsf) / old_nsf * 100.0;
+            slow = change > tolerance;
+            fprintf(stderr, " ns/file=%.0f->%.0f (%+.1f%%)", old_nsf, nsf, change);
+        }
+        if (HAVE_ALLOC_COUNT && field(line, "allocs/file", &old_allocs) == 0) {
+            more = allocs > old_allocs + 0.005;
+            fprintf(stderr, " allocs/file=%.2f->%.2f", old_allocs, allocs);
+        }
+        fprintf(stderr, "%s\n", slow || more ? " REGRESSION" : "");
+        regressions += slow || more;
+    }
+    fclose(f);
+    if (!matched) {
+        fprintf(stderr, "error: %s: no stage lines\n", path);
+        return -1;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    // Fully buffered whether stdout is a terminal or not, so the inspect
+    // stage costs the same wherever the report goes.
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+    unsigned rounds = 10;
+    const char *baseline = NULL;
+    double tolerance = 10.0;
+    int first = 1;
+    for (; first < argc; first++) {
+        const char *a = argv[first];
+        if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            usage(argv[0], stdout);
+            return 0;
+        } else if ((strcmp(a, "-r") == 0 || strcmp(a, "-c") == 0 || strcmp(a, "-t") == 0) &&
+                   first + 1 < argc) {
+            const char *v = argv[++first];
+            if (a[1] == 'r') rounds = (unsigned)strtoul(v, NULL, 0);
+            else if (a[1] == 'c') baseline = v;
+            else tolerance = strtod(v, NULL);
+        } else if (a[0] == '-' && a[1] != '\0') {
+            usage(argv[0], stderr);
+            return 2;
+        } else {
+            break;
+        }
+    }
+    if (first >= argc || rounds == 0) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+
+    char **paths;
+    size_t npaths = corpus_collect_paths(argc - first, argv + first, &paths);
+    struct mapped_file *files = calloc(npaths ? npaths : 1, sizeof(*files));
+    if (!files) {
+        perror("calloc");
+        return 1;
+    }
+    size_t nfiles = 0;
+    uint64_t bytes = 0, skipped = 0;
+    for (size_t i = 0; i < npaths; i++) {
+        char err[256];
+        struct mapped_file mf;
+        if (map_file(paths[i], &mf, err, sizeof(err)) != 0) {
+            fprintf(stderr, "warning: %s\n", err);
+            skipped++;
+            continue;
+        }
+        uint32_t magic = 0;
+        if (mf.size >= 4) memcpy(&magic, mf.data, 4);
+        if (magic != MH_MAGIC_64 && magic != MH_CIGAM_64 && magic != MH_MAGIC &&
+            magic != MH_CIGAM && magic != FAT_MAGIC && magic != FAT_CIGAM &&
+            magic != FAT_MAGIC_64 && magic != FAT_CIGAM_64) {
+            unmap_file(&mf);
+            skipped++;
+            continue;
+        }
+        // Fault every page in now, so the first round does not pay for it.
+        volatile uint8_t sink = 0;
+        for (size_t off = 0; off < mf.size; off += 4096) sink ^= mf.data[off];
+        (void)sink;
+        files[nfiles++] = mf;
+        bytes += mf.size;
+    }
+    corpus_free_paths(paths, npaths);
+    if (!nfiles) {
+        fprintf(stderr, "error: no Mach-O files\n");
+        free(files);
+        return 1;
+    }
+
+    int saved = bench_inspect_init() == 0 ? stdout_to_null() : -1;
+    if (saved < 0) {
+        fprintf(stderr, "error: cannot redirect output to /dev/null\n");
+        for (size_t i = 0; i < nfiles; i++) unmap_file(&files[i]);
+        free(files);
+        return 1;
+    }
+
+    struct stage_stat st[ST_COUNT];
+    struct counts c;
+    // Warm-up round, not reported: caches, branch predictors, allocator.
+    memset(st, 0, sizeof(st));
+    memset(&c, 0, sizeof(c));
+    for (size_t i = 0; i < nfiles; i++) parse_file(&files[i], st, &c);
+
+    memset(st, 0, sizeof(st));
+    memset(&c, 0, sizeof(c));
+    for (unsigned r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < nfiles; i++) {
+            STAGE(&st[ST_TOTAL], parse_file(&files[i], st, &c));
+        }
+    }
+    stdout_restore(saved);
+
+    uint64_t runs = (uint64_t)nfiles * rounds;
+    uint64_t run_bytes = bytes * rounds;
+    printf("# macho_bench report v%d\n", REPORT_VERSION);
+    printf("corpus files=%zu skipped=%llu slices=%llu bytes=%llu rounds=%u errors=%llu\n",
+           nfiles, (unsigned long long)skipped, (unsigned long long)(c.slices / rounds),
+           (unsigned long long)bytes, rounds, (unsigned long long)(c.errors / rounds));
+    for (int k = 0; k < ST_COUNT; k++) {
+        print_stage(stage_names[k], &st[k], runs, k == ST_TOTAL ? run_bytes : 0);
+    }
+    printf("count symbols/file=%.2f imports/file=%.2f exports/file=%.2f fixups/file=%.2f\n",
+           per(c.symbols, runs), per(c.imports, runs), per(c.exports, runs),
+           per(c.fixups, runs));
+
+    int rc = 0;
+    if (baseline) {
+        // Compare per file, so the baseline may use a different round count.
+        int reg = compare(baseline, st, runs, nfiles, bytes, tolerance);
+        if (reg != 0) rc = 1;
+        if (reg > 0) fprintf(stderr, "%d stage(s) regressed\n", reg);
+    }
+
+    for (size_t i = 0; i < nfiles; i++) unmap_file(&files[i]);
+    free(files);
+    return rc;
+}
@@ -0,0 +1,122 @@
+#ifndef MACHO_COMMON_H
+#define MACHO_COMMON_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Byte-order helpers shared by macho_inspect and the analysis modules.
+// Mach-O headers are host-endian for the target CPU; FAT headers are always
+// big-endian. `swapped` means "file endianness differs from ours".
+
+static inline uint32_t bswap32_u(uint32_t x) {
+    return ((x & 0x000000FFu) << 24) |
+           ((x & 0x0000FF00u) <<  8) |
+           ((x & 0x00FF0000u) >>  8) |
+           ((x & 0xFF000000u) >> 24);
+}
+
+static inline uint64_t bswap64_u(uint64_t x) {
+    return ((uint64_t)bswap32_u((uint32_t)(x & 0xFFFFFFFFULL)) << 32) |
+            (uint64_t)bswap32_u((uint32_t)(x >> 32));
+}
+
+static inline uint32_t read32_u(uint32_t x, int swapped) {
+    return swapped ? bswap32_u(x) : x;
+}
+
+static inline uint64_t read64_u(uint64_t x, int swapped) {
+    return swapped ? bswap64_u(x) : x;
+}
+
+// Unaligned loads straight from a file buffer. Linkedit payloads are only
+// 4- or 8-byte aligned by convention, never by guarantee.
+static inline uint16_t load16_u(const uint8_t *p, int swapped) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped ? (uint16_t)((v << 8) | (v >> 8)) : v;
+}
+
+static inline uint32_t load32_u(const uint8_t *p, int swapped) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return read32_u(v, swapped);
+}
+
+static inline uint64_t load64_u(const uint8_t *p, int swapped) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return read64_u(v, swapped);
+}
+
+// Stores in the slice's byte order, for tools that rewrite load commands.
+static inline void store32_u(uint8_t *p, uint32_t v, int swapped) {
+    v = read32_u(v, swapped);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void store64_u(uint8_t *p, uint64_t v, int swapped) {
+    v = read64_u(v, swapped);
+    memcpy(p, &v, sizeof(v));
+}
+
+// Big-endian loads for formats that are BE on disk regardless of CPU
+// (FAT headers, code signature blobs, IM4P/DER).
+static inline uint32_t load32_be(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t load64_be(const uint8_t *p) {
+    return ((uint64_t)load32_be(p) << 32) | (uint64_t)load32_be(p + 4);
+}
+
+static inline void store32_be(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void store64_be(uint8_t *p, uint64_t v) {
+    store32_be(p, (uint32_t)(v >> 32));
+    store32_be(p + 4, (uint32_t)v);
+}
+
+// ULEB128 as used by LC_FUNCTION_STARTS, dyld opcodes and the export trie.
+// Returns 0 and leaves *p untouched on truncation or overflow.
+static inline int read_uleb128(const uint8_t **p, const uint8_t *end, uint64_t *out) {
+    const uint8_t *q = *p;
+    uint64_t v = 0;
+    unsigned shift = 0;
+    while (q < end) {
+        uint8_t b = *q++;
+        if (shift >= 64) return 0;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if ((b & 0x80) == 0) {
+            *p = q;
+            *out = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int read_sleb128(const uint8_t **p, const uint8_t *end, int64_t *out) {
+    const uint8_t *q = *p;
+    int64_t v = 0;
+    unsigned shift = 0;
+    uint8_t b = 0;
+    do {
+        if (q >= end || shift >= 64) return 0;
+        b = *q++;
+        v |= (int64_t)((uint64_t)(b & 0x7f) << shift);
+        shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40)) v |= -((int64_t)1 << shift);
+    *p = q;
+    *out = v;
+    return 1;
+}
+
+#endif /* MACHO_COMMON_H */
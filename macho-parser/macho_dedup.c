@@ -0,0 +1,343 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/mach/machine.h"
+
+#include "corpus.h"
+#include "dedup.h"
+#include "digest.h"
+
+// macho_dedup: content-defined chunking across a corpus.
+//
+//   macho_dedup scan [-j N] [-v] PATH... | -     shared bytes per file and section
+//   macho_dedup store [-j N] [-v] STORE PATH... | -
+//                                                add files to a dedup store
+//   macho_dedup restore STORE PATH OUT|-         reassemble a stored file
+//   macho_dedup list STORE                       stored files
+//   macho_dedup stats STORE                      chunk and byte totals
+
+// Without -v, scan lists this many section names.
+#define TOP_SECTIONS 25
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s scan [-j N] [-v] <path>... | -\n", prog);
+    fprintf(out, "       %s store [-j N] [-v] <store dir> <path>... | -\n", prog);
+    fprintf(out, "       %s restore <store dir> <path> <out file | ->\n", prog);
+    fprintf(out, "       %s list <store dir>\n", prog);
+    fprintf(out, "       %s stats <store dir>\n", prog);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static double pct(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static const char *cpu_name(uint32_t cputype) {
+    switch (cputype) {
+        case CPU_TYPE_ARM: return "arm";
+        case CPU_TYPE_ARM64: return "arm64";
+        case CPU_TYPE_X86: return "i386";
+        case CPU_TYPE_X86_64: return "x86_64";
+        default: return "?";
+    }
+}
+
+// "__TEXT,__text", "__LINKEDIT", or what lies outside every slice.
+static const char *region_label(const struct dedup_image *im, const struct dedup_region *r,
+                                char *buf, size_t len) {
+    if (r->segname[0] == '\0') return im->macho ? "(outside slices)" : "(not Mach-O)";
+    if (r->sectname[0] == '\0') return r->segname;
+    snprintf(buf, len, "%s,%s", r->segname, r->sectname);
+    return buf;
+}
+
+struct opts {
+    unsigned jobs;
+    int verbose;
+};
+
+// [-j N] [-v] in any order; returns the index of the first other argument.
+static int parse_opts(int argc, char **argv, struct opts *o) {
+    int i = 0;
+    while (i < argc) {
+        if (i + 1 < argc && (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0)) {
+            o->jobs = (unsigned)strtoul(argv[i + 1], NULL, 0);
+            i += 2;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            o->verbose = 1;
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+static void print_image(const struct dedup_image *im, int verbose, const char *what) {
+    if (im->error) {
+        printf("error: cannot read %s\n", im->path);
+        return;
+    }
+    printf("%5.1f%%  %s %llu of %llu bytes, %u chunks  %s\n", pct(im->shared, im->size), what,
+           (unsigned long long)im->shared, (unsigned long long)im->size, im->nchunks, im->path);
+    if (!verbose) return;
+    for (size_t r = 0; r < im->nregions; r++) {
+        const struct dedup_region *rg = &im->regions[r];
+        char buf[40];
+        printf("        %-6s %-32s 0x%08llx %10llu  %s %10llu (%5.1f%%)\n",
+               rg->cputype ? cpu_name(rg->cputype) : "-", region_label(im, rg, buf, sizeof(buf)),
+               (unsigned long long)rg->offset, (unsigned long long)rg->size, what,
+               (unsigned long long)rg->shared, pct(rg->shared, rg->size));
+    }
+}
+
+struct label_total {
+    char name[40];
+    uint64_t bytes;
+    uint64_t shared;
+    uint64_t count;
+};
+
+static int cmp_label_name(const void *a, const void *b) {
+    return strcmp(((const struct label_total *)a)->name, ((const struct label_total *)b)->name);
+}
+
+static int cmp_label_shared(const void *a, const void *b) {
+    const struct label_total *x = a;
+    const struct label_total *y = b;
+    if (x->shared != y->shared) return x->shared < y->shared ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+// Shared bytes by section name across every file and slice.
+static void print_sections(const struct dedup_report *rep, int verbose) {
+    size_t n = 0;
+    for (size_t i = 0; i < rep->nimages; i++) n += rep->images[i].nregions;
+    struct label_total *t = malloc((n ? n : 1) * sizeof(*t));
+    if (!t) return;
+    size_t k = 0;
+    for (size_t i = 0; i < rep->nimages; i++) {
+        const struct dedup_image *im = &rep->images[i];
+        for (size_t r = 0; r < im->nregions; r++) {
+            char buf[40];
+            snprintf(t[k].name, sizeof(t[k].name), "%s",
+                     region_label(im, &im->regions[r], buf, sizeof(buf)));
+            t[k].bytes = im->regions[r].size;
+            t[k].shared = im->regions[r].shared;
+            t[k].count = 1;
+            k++;
+        }
+    }
+    qsort(t, n, sizeof(*t), cmp_label_name);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m && strcmp(t[m - 1].name, t[i].name) == 0) {
+            t[m - 1].bytes += t[i].bytes;
+            t[m - 1].shared += t[i].shared;
+            t[m - 1].count++;
+        } else {
+            t[m++] = t[i];
+        }
+    }
+    qsort(t, m, sizeof(*t), cmp_label_shared);
+
+    size_t show = verbose || m < TOP_SECTIONS ? m : TOP_SECTIONS;
+    printf("\nby section (%zu names%s):\n", m, show < m ? ", top by shared bytes" : "");
+    printf("  %-32s %8s %14s %14s %7s\n", "section", "regions", "bytes", "shared", "");
+    for (size_t i = 0; i < show; i++) {
+        printf("  %-32s %8llu %14llu %14llu %6.1f%%\n", t[i].name,
+               (unsigned long long)t[i].count, (unsigned long long)t[i].bytes,
+               (unsigned long long)t[i].shared, pct(t[i].shared, t[i].bytes));
+    }
+    free(t);
+}
+
+static void print_totals(const struct dedup_report *rep, double ms, const char *unique_what) {
+    double secs = ms / 1e3;
+    printf("\nfiles=%zu errors=%zu bytes=%llu chunks=%llu (avg %.0f bytes)\n", rep->nimages,
+           rep->errors, (unsigned long long)rep->bytes, (unsigned long long)rep->chunks,
+           rep->chunks ? (double)rep->bytes / (double)rep->chunks : 0.0);
+    // Nothing new (a store run over files already stored) is an infinite
+    // ratio, not 1x; no input at all has no ratio.
+    char ratio[32];
+    if (rep->unique_bytes) {
+        snprintf(ratio, sizeof(ratio), "%.2fx",
+                 (double)rep->bytes / (double)rep->unique_bytes);
+    } else {
+        snprintf(ratio, sizeof(ratio), "%s", rep->bytes ? "inf" : "-");
+    }
+    printf("%s=%llu chunks, %llu bytes (%.1f%% of input, dedup ratio %s)\n", unique_what,
+           (unsigned long long)rep->unique_chunks, (unsigned long long)rep->unique_bytes,
+           pct(rep->unique_bytes, rep->bytes), ratio);
+    printf("time=%.1fms (%.0f files/s, %.0f MB/s, sha256=%s)\n", ms,
+           secs > 0 ? (double)rep->nimages / secs : 0.0,
+           secs > 0 ? (double)rep->bytes / 1e6 / secs : 0.0, digest_sha256_impl());
+}
+
+static int cmd_scan(int argc, char **argv) {
+    struct opts o = { 0, 0 };
+    int i = parse_opts(argc, argv, &o);
+    if (argc - i < 1) {
+        fprintf(stderr, "error: scan needs inputs\n");
+        return 2;
+    }
+    char **paths = NULL;
+    size_t npaths = corpus_collect_paths(argc - i, argv + i, &paths);
+
+    char err[256];
+    struct dedup_report rep;
+    double t0 = now_ms();
+    int rc = dedup_scan(paths, npaths, o.jobs, &rep, err, sizeof(err));
+    double t1 = now_ms();
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        corpus_free_paths(paths, npaths);
+        return 1;
+    }
+    for (size_t k = 0; k < rep.nimages; k++) print_image(&rep.images[k], o.verbose, "shared");
+    print_sections(&rep, o.verbose);
+    print_totals(&rep, t1 - t0, "distinct");
+    dedup_report_free(&rep);
+    corpus_free_paths(paths, npaths);
+    return 0;
+}
+
+static int cmd_store(int argc, char **argv) {
+    struct opts o = { 0, 0 };
+    int i = parse_opts(argc, argv, &o);
+    if (argc - i < 2) {
+        fprintf(stderr, "error: store needs a store directory and inputs\n");
+        return 2;
+    }
+    const char *dir = argv[i++];
+    char **paths = NULL;
+    size_t npaths = corpus_collect_paths(argc - i, argv + i, &paths);
+
+    char err[256];
+    struct dedup_report rep;
+    double t0 = now_ms();
+    int rc = dedup_store_add(dir, paths, npaths, o.jobs, &rep, err, sizeof(err));
+    double t1 = now_ms();
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        corpus_free_paths(paths, npaths);
+        return 1;
+    }
+    for (size_t k = 0; k < rep.nimages; k++) {
+        if (o.verbose || rep.images[k].error) print_image(&rep.images[k], o.verbose, "deduped");
+    }
+    print_totals(&rep, t1 - t0, "written");
+    dedup_report_free(&rep);
+    corpus_free_paths(paths, npaths);
+    return 0;
+}
+
+static int cmd_restore(const struct dedup_store *st, const char *path, const char *out) {
+    long f = dedup_store_find(st, path);
+    if (f < 0) {
+        fprintf(stderr, "error: %s is not in the store\n", path);
+        return 1;
+    }
+    char err[256];
+    uint8_t *buf = NULL;
+    size_t size = 0;
+    if (dedup_store_read(st, (uint32_t)f, &buf, &size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    int rc = 0;
+    if (strcmp(out, "-") == 0) {
+        rc = fwrite(buf, 1, size, stdout) == size && fflush(stdout) == 0 ? 0 : 1;
+        if (rc) fprintf(stderr, "error: write to stdout failed\n");
+    } else if (write_file_atomic(out, buf, size, 0644, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        rc = 1;
+    }
+    free(buf);
+    return rc;
+}
+
+static int cmd_list(const struct dedup_store *st) {
+    for (uint32_t i = 0; i < st->h->nfiles; i++) {
+        printf("%12llu %8u  %s\n", (unsigned long long)st->files[i].size, st->files[i].nchunks,
+               dedup_store_path(st, i));
+    }
+    return 0;
+}
+
+static int cmd_stats(const struct dedup_store *st) {
+    const struct dedup_header *h = st->h;
+    uint64_t logical = 0;
+    for (uint32_t i = 0; i < h->nfiles; i++) logical += st->files[i].size;
+    uint64_t live = 0;
+    uint64_t dead = 0;
+    uint32_t ndead = 0;
+    uint32_t largest = 0;
+    for (uint32_t i = 0; i < h->nchunks; i++) {
+        const struct dedup_chunk *c = &st->chunks[i];
+        if (c->refs) {
+            live += c->size;
+        } else {
+            dead += c->size;
+            ndead++;
+        }
+        if (c->size > largest) largest = c->size;
+    }
+    printf("files=%u logical=%llu bytes refs=%llu\n", h->nfiles, (unsigned long long)logical,
+           (unsigned long long)h->nrefs);
+    printf("chunks=%u (avg %.0f, largest %u bytes) referenced=%llu bytes unreferenced=%u "
+           "chunks, %llu bytes\n",
+           h->nchunks, h->nchunks ? (double)(live + dead) / h->nchunks : 0.0, largest,
+           (unsigned long long)live, ndead, (unsigned long long)dead);
+    printf("pack=%llu bytes (%llu past the catalog) dedup ratio %.2fx\n",
+           (unsigned long long)st->pack_size,
+           (unsigned long long)(st->pack_size - h->pack_size),
+           live ? (double)logical / (double)live : 1.0);
+    printf("chunking: FastCDC min %d, avg %d, max %d bytes, SHA-256 fingerprints\n",
+           DEDUP_MIN_CHUNK, DEDUP_AVG_CHUNK, DEDUP_MAX_CHUNK);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0], argc < 2 ? stderr : stdout);
+        return argc < 2 ? 2 : 0;
+    }
+    const char *cmd = argv[1];
+    if (strcmp(cmd, "scan") == 0) return cmd_scan(argc - 2, argv + 2);
+    if (strcmp(cmd, "store") == 0) return cmd_store(argc - 2, argv + 2);
+
+    if (argc < 3) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    char err[256];
+    struct dedup_store st;
+    if (dedup_store_open(argv[2], &st, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
+    int rc;
+    if (strcmp(cmd, "restore") == 0 && argc == 5) {
+        rc = cmd_restore(&st, argv[3], argv[4]);
+    } else if (strcmp(cmd, "list") == 0) {
+        rc = cmd_list(&st);
+    } else if (strcmp(cmd, "stats") == 0) {
+        rc = cmd_stats(&st);
+    } else {
+        usage(argv[0], stderr);
+        rc = 2;
+    }
+    dedup_store_close(&st);
+    return rc;
+}
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "synth.h"
+
+// macho_gen: write a synthetic Mach-O corpus for macho_bench.
+//
+//   macho_gen [-n FILES] [-k thin|fat|fat64|mix] [-s SEED] [--cmds N]
+//             [--sects N] [--syms N] [--dylibs N] [--fixups N]
+//             [--headerpad N] OUTDIR
+//
+// Files are named synth-NNNN-KIND. File i uses seed SEED + i, so the same
+// arguments always write the same bytes.
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [-n FILES] [-k thin|fat|fat64|mix] [-s SEED] [--cmds N] [--sects N]\n"
+                 "       [--syms N] [--dylibs N] [--fixups N] [--headerpad N] <out dir>\n", prog);
+    fprintf(out, "  -n FILES     files to write (default 100)\n");
+    fprintf(out, "  -k KIND      container; mix cycles thin, fat, fat64 (default mix)\n");
+    fprintf(out, "  -s SEED      first seed (default 1)\n");
+    fprintf(out, "  --cmds N     load commands per slice (default 32)\n");
+    fprintf(out, "  --sects N    sections per slice (default 16)\n");
+    fprintf(out, "  --syms N     defined symbols (default 1000)\n");
+    fprintf(out, "  --dylibs N   LC_LOAD_DYLIBs (default 8)\n");
+    fprintf(out, "  --fixups N   rebases + binds (default 2000)\n");
+    fprintf(out, "  --headerpad N zero bytes after the load commands (default 0)\n");
+}
+
+static int parse_u32(const char *s, uint32_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(s, &end, 0);
+    if (errno || end == s || *end || v > UINT32_MAX) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    struct macho_synth_opts o;
+    macho_synth_defaults(&o);
+    uint32_t nfiles = 100;
+    int mix = 1;
+    const char *dir = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        uint32_t *num = NULL;
+        if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+            usage(argv[0], stdout);
+            return 0;
+        } else if (strcmp(a, "-n") == 0) {
+            num = &nfiles;
+        } else if (strcmp(a, "--cmds") == 0) {
+            num = &o.cmds;
+        } else if (strcmp(a, "--sects") == 0) {
+            num = &o.sects;
+        } else if (strcmp(a, "--syms") == 0) {
+            num = &o.syms;
+        } else if (strcmp(a, "--dylibs") == 0) {
+            num = &o.dylibs;
+        } else if (strcmp(a, "--fixups") == 0) {
+            num = &o.fixups;
+        } else if (strcmp(a, "--headerpad") == 0) {
+            num = &o.headerpad;
+        } else if (strcmp(a, "-s") == 0 && i + 1 < argc) {
+            o.seed = strtoull(argv[++i], NULL, 0);
+            continue;
+        } else if (strcmp(a, "-k") == 0 && i + 1 < argc) {
+            const char *k = argv[++i];
+            mix = 0;
+            if (strcmp(k, "thin") == 0) o.kind = SYNTH_THIN;
+            else if (strcmp(k, "fat") == 0) o.kind = SYNTH_FAT;
+            else if (strcmp(k, "fat64") == 0) o.kind = SYNTH_FAT64;
+            else if (strcmp(k, "mix") == 0) mix = 1;
+            else {
+                fprintf(stderr, "error: unknown kind '%s'\n", k);
+                return 2;
+            }
+            continue;
+        } else if (a[0] == '-' || dir) {
+            usage(argv[0], stderr);
+            return 2;
+        } else {
+            dir = a;
+            continue;
+        }
+        if (i + 1 >= argc || parse_u32(argv[i + 1], num) != 0) {
+            fprintf(stderr, "error: %s requires a number\n", a);
+            return 2;
+        }
+        i++;
+    }
+    if (!dir) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "error: mkdir %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    uint64_t seed0 = o.seed;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < nfiles; i++) {
+        if (mix) o.kind = (enum macho_synth_kind)(i % 3);
+        o.seed = seed0 + i;
+        uint8_t *buf;
+        size_t size;
+        char err[256];
+        if (macho_synth(&o, &buf, &size, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            return 1;
+        }
+        size_t plen = strlen(dir) + 32;
+        char *path = malloc(plen);
+        if (!path) {
+            free(buf);
+            perror("malloc");
+            return 1;
+        }
+        snprintf(path, plen, "%s/synth-%04u-%s", dir, i, macho_synth_kind_name(o.kind));
+        int rc = write_file_atomic(path, buf, size, 0755, err, sizeof(err));
+        free(path);
+        free(buf);
+        if (rc != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            return 1;
+        }
+        total += size;
+    }
+    printf("%u files, %llu bytes in %s\n", nfiles, (unsigned long long)total, dir);
+    return 0;
+}
@@ -0,0 +1,526 @@
+#include "macho_image.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+#include "../include/macho/nlist.h"
+
+#include "budget.h"
+#include "macho_common.h"
+
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64  0xcafebabf
+#endif
+
+#ifndef FAT_CIGAM_64
+#define FAT_CIGAM_64  0xbfbafeca
+#endif
+
+static void set_err(char *errbuf, size_t errlen, const char *fmt, ...) {
+    if (!errbuf || errlen == 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(errbuf, errlen, fmt, ap);
+    va_end(ap);
+}
+
+static void copy_name16(char dst[17], const char src[16]) {
+    memcpy(dst, src, 16);
+    dst[16] = '\0';
+}
+
+int macho_image_load(struct macho_image *img, const uint8_t *buf, size_t sz,
+                     char *errbuf, size_t errlen) {
+    return macho_image_load_at(img, buf, sz, 0, errbuf, errlen);
+}
+
+int macho_image_load_at(struct macho_image *img, const uint8_t *buf, size_t sz,
+                        uint64_t header_offset, char *errbuf, size_t errlen) {
+    memset(img, 0, sizeof(*img));
+    if (header_offset > sz || sz - header_offset < sizeof(struct mach_header)) {
+        set_err(errbuf, errlen, "file too small for mach_header");
+        return -1;
+    }
+    const uint8_t *hp = buf + header_offset;
+
+    uint32_t magic = 0;
+    memcpy(&magic, hp, sizeof(magic));
+    if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        img->is64 = 1;
+        img->swapped = (magic == MH_CIGAM_64);
+        img->header_size = sizeof(struct mach_header_64);
+    } else if (magic == MH_MAGIC || magic == MH_CIGAM) {
+        img->is64 = 0;
+        img->swapped = (magic == MH_CIGAM);
+        img->header_size = sizeof(struct mach_header);
+    } else {
+        set_err(errbuf, errlen, "not a thin Mach-O (magic 0x%08x)", magic);
+        return -1;
+    }
+    if (sz - header_offset < img->header_size) {
+        set_err(errbuf, errlen, "file too small for mach_header_64");
+        return -1;
+    }
+
+    struct mach_header h;
+    memcpy(&h, hp, sizeof(h));
+    int sw = img->swapped;
+    img->buf = buf;
+    img->size = sz;
+    img->header_offset = header_offset;
+    img->cputype = read32_u((uint32_t)h.cputype, sw);
+    img->cpusubtype = read32_u((uint32_t)h.cpusubtype, sw);
+    img->filetype = read32_u(h.filetype, sw);
+    img->ncmds = read32_u(h.ncmds, sw);
+    img->sizeofcmds = read32_u(h.sizeofcmds, sw);
+    img->flags = read32_u(h.flags, sw);
+
+    // The pre-pass validates every load command and counts the segments and
+    // sections, so the tables below are allocated once at their final size
+    // and the walk needs no further bounds checks.
+    struct macho_budget_usage u;
+    if (macho_budget_check_thin(hp, (size_t)(sz - header_offset), NULL, &u,
+                                errbuf, errlen) != 0) {
+        return -1;
+    }
+    img->cmds = calloc(u.ncmds ? u.ncmds : 1, sizeof(*img->cmds));
+    img->segs = calloc(u.nsegs ? u.nsegs : 1, sizeof(*img->segs));
+    img->sects = calloc(u.nsects ? u.nsects : 1, sizeof(*img->sects));
+    if (!img->cmds || !img->segs || !img->sects) {
+        set_err(errbuf, errlen, "out of memory");
+        macho_image_free(img);
+        return -1;
+    }
+
+    const uint8_t *p = hp + img->header_size;
+    for (uint32_t i = 0; i < u.ncmds; i++) {
+        uint32_t cmd = load32_u(p, sw);
+        uint32_t cmdsize = load32_u(p + 4, sw);
+
+        struct macho_lc_ref *ref = &img->cmds[img->ncmds_valid++];
+        ref->cmd = cmd;
+        ref->cmdsize = cmdsize;
+        ref->offset = (uint32_t)(p - buf);
+
+        if (cmd == LC_SEGMENT_64 || cmd == LC_SEGMENT) {
+            int seg64 = (cmd == LC_SEGMENT_64);
+            size_t hdr = seg64 ? sizeof(struct segment_command_64) : sizeof(struct segment_command);
+            size_t secsz = seg64 ? sizeof(struct section_64) : sizeof(struct section);
+            struct segment_map *m = &img->segs[img->nsegs];
+            uint32_t nsects;
+            // Load commands are only 4-byte aligned in a 32-bit image, and a
+            // slice may start anywhere: copy before reading fields.
+            if (seg64) {
+                struct segment_command_64 s;
+                memcpy(&s, p, sizeof(s));
+                copy_name16(m->name, s.segname);
+                m->vmaddr = read64_u(s.vmaddr, sw);
+                m->vmsize = read64_u(s.vmsize, sw);
+                m->fileoff = read64_u(s.fileoff, sw);
+                m->filesize = read64_u(s.filesize, sw);
+                m->maxprot = read32_u((uint32_t)s.maxprot, sw);
+                m->initprot = read32_u((uint32_t)s.initprot, sw);
+                m->flags = read32_u(s.flags, sw);
+                nsects = read32_u(s.nsects, sw);
+            } else {
+                struct segment_command s;
+                memcpy(&s, p, sizeof(s));
+                copy_name16(m->name, s.segname);
+                m->vmaddr = read32_u(s.vmaddr, sw);
+                m->vmsize = read32_u(s.vmsize, sw);
+                m->fileoff = read32_u(s.fileoff, sw);
+                m->filesize = read32_u(s.filesize, sw);
+                m->maxprot = read32_u((uint32_t)s.maxprot, sw);
+                m->initprot = read32_u((uint32_t)s.initprot, sw);
+                m->flags = read32_u(s.flags, sw);
+                nsects = read32_u(s.nsects, sw);
+            }
+            m->first_sect = (uint32_t)img->nsects;
+            m->nsects = nsects;
+
+            const uint8_t *sp = p + hdr;
+            for (uint32_t k = 0; k < nsects; k++, sp += secsz) {
+                struct macho_section *s = &img->sects[img->nsects++];
+                if (seg64) {
+                    struct section_64 sec;
+                    memcpy(&sec, sp, sizeof(sec));
+                    copy_name16(s->sectname, sec.sectname);
+                    copy_name16(s->segname, sec.segname);
+                    s->addr = read64_u(sec.addr, sw);
+                    s->size = read64_u(sec.size, sw);
+                    s->offset = read32_u(sec.offset, sw);
+                    s->align = read32_u(sec.align, sw);
+                    s->reloff = read32_u(sec.reloff, sw);
+                    s->nreloc = read32_u(sec.nreloc, sw);
+                    s->flags = read32_u(sec.flags, sw);
+                } else {
+                    struct section sec;
+                    memcpy(&sec, sp, sizeof(sec));
+                    copy_name16(s->sectname, sec.sectname);
+                    copy_name16(s->segname, sec.segname);
+                    s->addr = read32_u(sec.addr, sw);
+                    s->size = read32_u(sec.size, sw);
+                    s->offset = read32_u(sec.offset, sw);
+                    s->align = read32_u(sec.align, sw);
+                    s->reloff = read32_u(sec.reloff, sw);
+                    s->nreloc = read32_u(sec.nreloc, sw);
+                    s->flags = read32_u(sec.flags, sw);
+                }
+                s->segment = (uint32_t)img->nsegs;
+            }
+            img->nsegs++;
+        } else if (cmd == LC_SYMTAB) {
+            struct symtab_command st;
+            memcpy(&st, p, sizeof(st));
+            img->symoff = read32_u(st.symoff, sw);
+            img->nsyms = read32_u(st.nsyms, sw);
+            img->stroff = read32_u(st.stroff, sw);
+            img->strsize = read32_u(st.strsize, sw);
+        }
+
+        p += cmdsize;
+    }
+
+    return 0;
+}
+
+void macho_image_free(struct macho_image *img) {
+    if (!img) return;
+    free(img->cmds);
+    free(img->segs);
+    free(img->sects);
+    img->cmds = NULL;
+    img->segs = NULL;
+    img->sects = NULL;
+    img->ncmds_valid = img->nsegs = img->nsects = 0;
+}
+
+const struct macho_lc_ref *macho_image_next_cmd(const struct macho_image *img,
+                                                uint32_t cmd, size_t *iter) {
+    for (size_t i = *iter; i < img->ncmds_valid; i++) {
+        if (img->cmds[i].cmd == cmd) {
+            *iter = i + 1;
+            return &img->cmds[i];
+        }
+    }
+    *iter = img->ncmds_valid;
+    return NULL;
+}
+
+const struct macho_section *macho_image_section(const struct macho_image *img,
+                                                const char *segname,
+                                                const char *sectname) {
+    for (size_t i = 0; i < img->nsects; i++) {
+        if ((!segname || strcmp(img->sects[i].segname, segname) == 0) &&
+            strcmp(img->sects[i].sectname, sectname) == 0) {
+            return &img->sects[i];
+        }
+    }
+    return NULL;
+}
+
+const struct segment_map *macho_image_segment(const struct macho_image *img,
+                                              const char *segname) {
+    for (size_t i = 0; i < img->nsegs; i++) {
+        if (strcmp(img->segs[i].name, segname) == 0) return &img->segs[i];
+    }
+    return NULL;
+}
+
+const struct macho_section *macho_image_section_for_vm(const struct macho_image *img,
+                                                       uint64_t vmaddr) {
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *s = &img->sects[i];
+        if (vmaddr >= s->addr && vmaddr - s->addr < s->size) return s;
+    }
+    return NULL;
+}
+
+int macho_image_vm_to_off(const struct macho_image *img, uint64_t vmaddr,
+                          uint64_t *fileoff) {
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *m = &img->segs[i];
+        if (vmaddr >= m->vmaddr && vmaddr - m->vmaddr < m->filesize) {
+            *fileoff = m->fileoff + (vmaddr - m->vmaddr);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int macho_image_off_to_vm(const struct macho_image *img, uint64_t fileoff,
+                          uint64_t *vmaddr) {
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *m = &img->segs[i];
+        if (fileoff >= m->fileoff && fileoff - m->fileoff < m->filesize) {
+            *vmaddr = m->vmaddr + (fileoff - m->fileoff);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const uint8_t *macho_image_vm_ptr(const struct macho_image *img, uint64_t vmaddr,
+                                  uint64_t len) {
+    uint64_t off = 0;
+    if (macho_image_vm_to_off(img, vmaddr, &off) != 0) return NULL;
+    if (off > img->size || len > img->size - off) return NULL;
+    return img->buf + off;
+}
+
+const uint8_t *macho_image_linkedit(const struct macho_image *img, uint32_t cmd,
+                                    uint32_t *size_out) {
+    size_t it = 0;
+    const struct macho_lc_ref *ref = macho_image_next_cmd(img, cmd, &it);
+    if (!ref || ref->cmdsize < sizeof(struct linkedit_data_command)) return NULL;
+    const uint8_t *p = img->buf + ref->offset;
+    uint32_t off = load32_u(p + 8, img->swapped);
+    uint32_t size = load32_u(p + 12, img->swapped);
+    if ((uint64_t)off + size > img->size) return NULL;
+    if (size_out) *size_out = size;
+    return img->buf + off;
+}
+
+uint64_t macho_image_base(const struct macho_image *img) {
+    for (size_t i = 0; i < img->nsegs; i++) {
+        if (img->segs[i].fileoff == img->header_offset && img->segs[i].filesize != 0) {
+            return img->segs[i].vmaddr;
+        }
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+size_t macho_image_function_starts(const struct macho_image *img, uint64_t **out) {
+    *out = NULL;
+    uint32_t size = 0;
+    const uint8_t *p = macho_image_linkedit(img, LC_FUNCTION_STARTS, &size);
+    if (!p || size == 0) return 0;
+    const uint8_t *end = p + size;
+
+    // Each entry is a ULEB128 delta from the previous start (the first from
+    // the __TEXT base); a zero delta terminates the table. Every entry is at
+    // least one byte, so `size` bounds the count.
+    uint64_t *v = malloc((size_t)size * sizeof(*v));
+    if (!v) return 0;
+    size_t n = 0;
+    uint64_t addr = macho_image_base(img);
+    while (p < end) {
+        uint64_t delta = 0;
+        if (!read_uleb128(&p, end, &delta) || delta == 0) break;
+        addr += delta;
+        v[n++] = addr;
+    }
+    if (n == 0) {
+        free(v);
+        return 0;
+    }
+    *out = v;
+    return n;
+}
+
+static int cmp_sym(const void *a, const void *b) {
+    const struct macho_symbol *x = a;
+    const struct macho_symbol *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+size_t macho_image_defined_symbols(const struct macho_image *img,
+                                   struct macho_symbol **out) {
+    *out = NULL;
+    if (img->nsyms == 0) return 0;
+    size_t entsz = img->is64 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    if ((uint64_t)img->symoff + (uint64_t)img->nsyms * entsz > img->size) return 0;
+    if ((uint64_t)img->stroff + img->strsize > img->size) return 0;
+
+    struct macho_symbol *v = malloc((size_t)img->nsyms * sizeof(*v));
+    if (!v) return 0;
+    const char *strtab = (const char *)img->buf + img->stroff;
+    size_t n = 0;
+    const uint8_t *sp = img->buf + img->symoff;
+    for (uint32_t i = 0; i < img->nsyms; i++, sp += entsz) {
+        uint32_t strx = load32_u(sp, img->swapped);
+        uint8_t type = sp[4];
+        uint8_t sect = sp[5];
+        uint16_t desc = load16_u(sp + 6, img->swapped);
+        uint64_t value = img->is64 ? load64_u(sp + 8, img->swapped)
+                                   : load32_u(sp + 8, img->swapped);
+        if ((type & N_STAB) || (type & N_TYPE) != N_SECT) continue;
+        if (strx >= img->strsize) continue;
+        // Names must terminate inside the string table.
+        if (!memchr(strtab + strx, '\0', img->strsize - strx)) continue;
+        v[n].addr = value;
+        v[n].name = strtab + strx;
+        v[n].type = type;
+        v[n].sect = sect;
+        v[n].desc = desc;
+        n++;
+    }
+    if (n == 0) {
+        free(v);
+        return 0;
+    }
+    qsort(v, n, sizeof(*v), cmp_sym);
+    *out = v;
+    return n;
+}
+
+int macho_image_symbol(const struct macho_image *img, uint32_t index,
+                       struct macho_symbol *out) {
+    size_t entsz = img->is64 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    if (index >= img->nsyms) return -1;
+    if ((uint64_t)img->symoff + (uint64_t)img->nsyms * entsz > img->size) return -1;
+    if ((uint64_t)img->stroff + img->strsize > img->size) return -1;
+    const uint8_t *sp = img->buf + img->symoff + (size_t)index * entsz;
+    const char *strtab = (const char *)img->buf + img->stroff;
+    uint32_t strx = load32_u(sp, img->swapped);
+    if (strx >= img->strsize || !memchr(strtab + strx, '\0', img->strsize - strx)) return -1;
+    out->name = strtab + strx;
+    out->type = sp[4];
+    out->sect = sp[5];
+    out->desc = load16_u(sp + 6, img->swapped);
+    out->addr = img->is64 ? load64_u(sp + 8, img->swapped) : load32_u(sp + 8, img->swapped);
+    return 0;
+}
+
+size_t macho_image_functions_in(const struct macho_image *img,
+                                const struct macho_section *sect, uint64_t **out) {
+    *out = NULL;
+    uint64_t *starts = NULL;
+    size_t n = macho_image_function_starts(img, &starts);
+    if (n == 0) {
+        struct macho_symbol *syms = NULL;
+        size_t ns = macho_image_defined_symbols(img, &syms);
+        if (ns) {
+            starts = malloc(ns * sizeof(*starts));
+            if (!starts) {
+                free(syms);
+                return 0;
+            }
+            for (size_t i = 0; i < ns; i++) starts[n++] = syms[i].addr;
+        }
+        free(syms);
+    }
+
+    // Clip to the section and make sure its first byte starts a range, so
+    // code before the first known function is still covered.
+    uint64_t *v = malloc((n + 1) * sizeof(*v));
+    if (!v) {
+        free(starts);
+        return 0;
+    }
+    size_t m = 0;
+    v[m++] = sect->addr;
+    for (size_t i = 0; i < n; i++) {
+        if (starts[i] > sect->addr && starts[i] - sect->addr < sect->size) {
+            v[m++] = starts[i];
+        }
+    }
+    free(starts);
+
+    qsort(v, m, sizeof(*v), cmp_u64);
+    size_t u = 0;
+    for (size_t i = 0; i < m; i++) {
+        if (u == 0 || v[i] != v[u - 1]) v[u++] = v[i];
+    }
+    *out = v;
+    return u;
+}
+
+int macho_select_slice(const uint8_t *buf, size_t sz, int want_index,
+                       uint32_t want_cputype, uint64_t *off, uint64_t *size,
+                       char *errbuf, size_t errlen) {
+    if (sz < sizeof(uint32_t)) {
+        set_err(errbuf, errlen, "file too small");
+        return -1;
+    }
+    uint32_t magic = 0;
+    memcpy(&magic, buf, sizeof(magic));
+    if (magic != FAT_MAGIC && magic != FAT_CIGAM &&
+        magic != FAT_MAGIC_64 && magic != FAT_CIGAM_64) {
+        *off = 0;
+        *size = sz;
+        return 0;
+    }
+    if (sz < sizeof(struct fat_header)) {
+        set_err(errbuf, errlen, "file too small for fat_header");
+        return -1;
+    }
+
+    if (macho_budget_check_fat(buf, sz, NULL, errbuf, errlen) != 0) return -1;
+
+    // FAT headers are big-endian on disk.
+    int fat64 = (magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64);
+    uint32_t nfat = load32_be(buf + 4);
+    size_t entsz = fat64 ? 32 : 20;
+    if ((uint64_t)nfat * entsz > sz - sizeof(struct fat_header)) {
+        set_err(errbuf, errlen, "truncated fat_arch table");
+        return -1;
+    }
+    if (nfat == 0) {
+        set_err(errbuf, errlen, "fat file has no slices");
+        return -1;
+    }
+
+    const uint8_t *tab = buf + sizeof(struct fat_header);
+    int pick = -1;
+    if (want_index >= 0) {
+        if ((uint32_t)want_index >= nfat) {
+            set_err(errbuf, errlen, "slice index out of range");
+            return -1;
+        }
+        pick = want_index;
+    } else {
+        uint32_t want = want_cputype ? want_cputype : (uint32_t)CPU_TYPE_ARM64;
+        for (uint32_t i = 0; i < nfat; i++) {
+            if (load32_be(tab + i * entsz) == want) { pick = (int)i; break; }
+        }
+        if (pick < 0 && want_cputype) {
+            set_err(errbuf, errlen, "requested arch not found in fat file");
+            return -1;
+        }
+        if (pick < 0) pick = 0;
+    }
+
+    const uint8_t *e = tab + (size_t)pick * entsz;
+    uint64_t o = fat64 ? load64_be(e + 8) : load32_be(e + 8);
+    uint64_t s = fat64 ? load64_be(e + 16) : load32_be(e + 12);
+    if (o > sz || s > sz - o) {
+        set_err(errbuf, errlen, "slice out of bounds");
+        return -1;
+    }
+    *off = o;
+    *size = s;
+    return 0;
+}
+
+uint32_t macho_image_segment_cmd(const struct macho_image *img, const char *segname) {
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *lc = &img->cmds[i];
+        if (lc->cmd != LC_SEGMENT && lc->cmd != LC_SEGMENT_64) continue;
+        if (strncmp((const char *)img->buf + lc->offset + 8, segname, 16) == 0) return lc->offset;
+    }
+    return 0;
+}
+
+uint64_t macho_image_header_limit(const struct macho_image *img) {
+    uint64_t lo = img->size;
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *s = &img->sects[i];
+        if (s->offset && s->size && s->offset < lo) lo = s->offset;
+    }
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *s = &img->segs[i];
+        if (s->fileoff && s->filesize && s->fileoff < lo) lo = s->fileoff;
+    }
+    return lo;
+}
@@ -0,0 +1,171 @@
+#ifndef MACHO_IMAGE_H
+#define MACHO_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Non-printing view of one thin Mach-O slice.
+//
+// macho_inspect's parse_thin_macho_* functions print as they walk; the
+// analysis passes (xrefs, CFG, signatures, ...) need the same facts as data.
+// macho_image_load walks the load commands once, bounds-checks them, and
+// records segments, sections and the offsets of every load command so a pass
+// can pull what it needs without re-walking. Nothing is copied: all pointers
+// alias the caller's buffer, which must outlive the image.
+
+struct segment_map {
+    char name[17];
+    uint64_t vmaddr;
+    uint64_t vmsize;
+    uint64_t fileoff;
+    uint64_t filesize;
+    uint32_t maxprot;
+    uint32_t initprot;
+    uint32_t flags;
+    uint32_t first_sect;   // index into macho_image.sects
+    uint32_t nsects;
+};
+
+struct macho_section {
+    char segname[17];
+    char sectname[17];
+    uint64_t addr;
+    uint64_t size;
+    uint32_t offset;
+    uint32_t align;
+    uint32_t reloff;
+    uint32_t nreloc;
+    uint32_t flags;
+    uint32_t segment;      // index into macho_image.segs
+};
+
+struct macho_lc_ref {
+    uint32_t cmd;
+    uint32_t cmdsize;
+    uint32_t offset;       // from the start of the slice
+};
+
+struct macho_image {
+    const uint8_t *buf;
+    size_t size;
+    int swapped;
+    int is64;
+    uint32_t cputype;
+    uint32_t cpusubtype;
+    uint32_t filetype;
+    uint32_t ncmds;
+    uint32_t sizeofcmds;
+    uint32_t flags;
+    uint32_t header_size;
+    uint64_t header_offset;   // of the mach_header within buf (fileset entries)
+
+    struct macho_lc_ref *cmds;
+    size_t ncmds_valid;
+
+    struct segment_map *segs;
+    size_t nsegs;
+
+    struct macho_section *sects;
+    size_t nsects;
+
+    // LC_SYMTAB (0 when absent).
+    uint32_t symoff;
+    uint32_t nsyms;
+    uint32_t stroff;
+    uint32_t strsize;
+};
+
+// A symbol from LC_SYMTAB reduced to what the passes use.
+struct macho_symbol {
+    uint64_t addr;
+    const char *name;      // points into the string table
+    uint8_t type;
+    uint8_t sect;          // 1-based section ordinal, 0 = NO_SECT
+    uint16_t desc;
+};
+
+// Returns 0 on success, -1 on malformed input. errbuf (may be NULL) receives
+// a one-line reason.
+int macho_image_load(struct macho_image *img, const uint8_t *buf, size_t sz,
+                     char *errbuf, size_t errlen);
+void macho_image_free(struct macho_image *img);
+
+// Same, for an image whose mach_header sits at `header_offset` inside a
+// larger file whose offsets it uses: an MH_FILESET entry (a kext in a
+// kernelcache) records segment and __LINKEDIT offsets relative to the
+// container, not to its own header. Load command offsets are then
+// relative to buf as well.
+int macho_image_load_at(struct macho_image *img, const uint8_t *buf, size_t sz,
+                        uint64_t header_offset, char *errbuf, size_t errlen);
+
+// First load command of type `cmd` at or after index *iter (pass a zeroed
+// iterator to start). Returns NULL when there are no more.
+const struct macho_lc_ref *macho_image_next_cmd(const struct macho_image *img,
+                                                uint32_t cmd, size_t *iter);
+
+const struct macho_section *macho_image_section(const struct macho_image *img,
+                                                const char *segname,
+                                                const char *sectname);
+const struct segment_map *macho_image_segment(const struct macho_image *img,
+                                              const char *segname);
+
+// Section containing vmaddr, or NULL.
+const struct macho_section *macho_image_section_for_vm(const struct macho_image *img,
+                                                       uint64_t vmaddr);
+
+// Translate between VM addresses and slice file offsets via the segment map.
+int macho_image_vm_to_off(const struct macho_image *img, uint64_t vmaddr,
+                          uint64_t *fileoff);
+int macho_image_off_to_vm(const struct macho_image *img, uint64_t fileoff,
+                          uint64_t *vmaddr);
+
+// Bytes of [vmaddr, vmaddr + len) if they are file-backed, else NULL.
+const uint8_t *macho_image_vm_ptr(const struct macho_image *img, uint64_t vmaddr,
+                                  uint64_t len);
+
+// Payload of a linkedit_data_command (LC_FUNCTION_STARTS, LC_CODE_SIGNATURE,
+// ...). Returns NULL if the command is absent or out of bounds.
+const uint8_t *macho_image_linkedit(const struct macho_image *img, uint32_t cmd,
+                                    uint32_t *size_out);
+
+// File offset of the segment load command named `segname`, or 0.
+uint32_t macho_image_segment_cmd(const struct macho_image *img, const char *segname);
+
+// Lowest file offset of section or segment content past the header: the
+// load command area may grow up to here.
+uint64_t macho_image_header_limit(const struct macho_image *img);
+
+// Preferred load address: vmaddr of the segment that maps the header
+// (fileoff 0, or header_offset for a fileset entry) with nonzero filesize
+// (normally __TEXT).
+uint64_t macho_image_base(const struct macho_image *img);
+
+// Decoded LC_FUNCTION_STARTS as sorted VM addresses. Returns the count and
+// stores a malloc'd array in *out (NULL when the command is absent).
+size_t macho_image_function_starts(const struct macho_image *img, uint64_t **out);
+
+// Symbols defined in a section (N_SECT, non-stab), sorted by address.
+// Returns the count; *out is malloc'd.
+size_t macho_image_defined_symbols(const struct macho_image *img,
+                                   struct macho_symbol **out);
+
+// Symbol table entry `index`, whatever its type. Returns 0, or -1 when the
+// index is out of range or the name does not terminate in the string table.
+int macho_image_symbol(const struct macho_image *img, uint32_t index,
+                       struct macho_symbol *out);
+
+// Function boundaries for a code pass: LC_FUNCTION_STARTS if present, else
+// defined symbols inside `sect`, else the section start. The result is
+// sorted, de-duplicated and clipped to the section.
+size_t macho_image_functions_in(const struct macho_image *img,
+                                const struct macho_section *sect, uint64_t **out);
+
+// Pick a slice out of a FAT container without printing. want_index >= 0
+// selects by position, else want_cputype != 0 selects by CPU, else ARM64 is
+// preferred and the first slice is the fallback. Thin input yields the
+// whole buffer. Returns 0 on success.
+int macho_select_slice(const uint8_t *buf, size_t sz, int want_index,
+                       uint32_t want_cputype, uint64_t *off, uint64_t *size,
+                       char *errbuf, size_t errlen);
+
+#endif /* MACHO_IMAGE_H */
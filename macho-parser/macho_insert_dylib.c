@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "corpus.h"
+#include "dylib_insert.h"
+
+// macho_insert_dylib: add an LC_LOAD_DYLIB to every slice of a binary.
+//
+//   macho_insert_dylib [--weak] [--no-sign] [-o OUT] DYLIB_PATH FILE
+//
+// DYLIB_PATH is written as-is; use @executable_path/... or an absolute
+// path that exists on the target. The result is re-signed ad hoc unless
+// --no-sign is given.
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [--weak] [--current-version V] [--compat-version V]\n"
+                 "       %*s [--no-sign] [-j N] [-o OUT] <dylib path> <mach-o file>\n",
+            prog, (int)strlen(prog), "");
+}
+
+// "A.B.C" -> xxxx.yy.zz packed as dyld expects.
+static uint32_t parse_version(const char *s) {
+    unsigned long a = 0, b = 0, c = 0;
+    char *end = NULL;
+    a = strtoul(s, &end, 10);
+    if (end && *end == '.') b = strtoul(end + 1, &end, 10);
+    if (end && *end == '.') c = strtoul(end + 1, &end, 10);
+    return (uint32_t)(((a & 0xffff) << 16) | ((b & 0xff) << 8) | (c & 0xff));
+}
+
+int main(int argc, char **argv) {
+    struct insert_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.current_version = 0x10000;
+    opts.compat_version = 0x10000;
+    const char *path = NULL;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--weak") == 0) {
+            opts.weak = 1;
+        } else if (strcmp(argv[i], "--no-sign") == 0) {
+            opts.no_sign = 1;
+        } else if (strcmp(argv[i], "--current-version") == 0 && i + 1 < argc) {
+            opts.current_version = parse_version(argv[++i]);
+        } else if (strcmp(argv[i], "--compat-version") == 0 && i + 1 < argc) {
+            opts.compat_version = parse_version(argv[++i]);
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+            opts.jobs = (unsigned)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0], stdout);
+            return 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            return 2;
+        } else if (!opts.dylib) {
+            opts.dylib = argv[i];
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!opts.dylib || !path) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    if (!out_path) out_path = path;
+
+    char err[256];
+    struct mapped_file mf;
+    if (map_file(path, &mf, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    struct stat st;
+    mode_t mode = (stat(path, &st) == 0) ? st.st_mode : 0755;
+
+    uint8_t *buf = NULL;
+    size_t size = 0;
+    int rc = dylib_insert_buffer(mf.data, mf.size, &opts, &buf, &size, err, sizeof(err));
+    unmap_file(&mf);
+    if (rc == 1) {
+        printf("%s already loads %s; unchanged\n", path, opts.dylib);
+        return 0;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
+    rc = write_file_atomic(out_path, buf, size, mode, err, sizeof(err));
+    free(buf);
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    printf("inserted %s %s -> %s%s\n", opts.weak ? "LC_LOAD_WEAK_DYLIB" : "LC_LOAD_DYLIB",
+           opts.dylib, out_path, opts.no_sign ? " (signature now invalid)" : " (re-signed ad hoc)");
+    return 0;
+}
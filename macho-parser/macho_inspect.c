@@ -1,11 +1,39 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include "../include/macho/loader.h"
 #include "../include/macho/fat.h"
 
+#include "macho_common.h"
+#include "macho_image.h"
+#include "parallel.h"
+#include "archive.h"
+#include "bindiff.h"
+#include "budget.h"
+#include "cfg.h"
+#include "codesign.h"
+#include "core.h"
+#include "corpus.h"
+#include "digest.h"
+#include "dyld_emu.h"
+#include "entitlements.h"
+#include "entropy.h"
+#include "fileset.h"
+#include "funcmatch.h"
+#include "img4.h"
+#include "launch_cost.h"
+#include "lipo.h"
+#include "relocs.h"
+#include "resolve.h"
+#include "size_report.h"
+#include "xref.h"
+
 
 // --- FAT64 compatibility shim ---
 // Some fat.h variants omit FAT64 constants/structs.
@@ -40,26 +68,6 @@ struct fat_arch_64 {
 
 
 
-static uint32_t bswap32_u(uint32_t x) {
-    return ((x & 0x000000FFu) << 24) |
-           ((x & 0x0000FF00u) <<  8) |
-           ((x & 0x00FF0000u) >>  8) |
-           ((x & 0xFF000000u) >> 24);
-}
-
-static uint64_t bswap64_u(uint64_t x) {
-    return ((uint64_t)bswap32_u((uint32_t)(x & 0xFFFFFFFFULL)) << 32) |
-            (uint64_t)bswap32_u((uint32_t)(x >> 32));
-}
-
-static uint32_t read32_u(uint32_t x, int swapped) {
-    return swapped ? bswap32_u(x) : x;
-}
-
-static uint64_t read64_u(uint64_t x, int swapped) {
-    return swapped ? bswap64_u(x) : x;
-}
-
 static const char *cpu_type_name(uint32_t cputype) {
     switch (cputype) {
         case CPU_TYPE_ARM: return "ARM";
@@ -107,24 +115,51 @@ static const char *lc_name(uint32_t c) {
         case LC_UUID: return "LC_UUID";
         case LC_RPATH: return "LC_RPATH";
         case LC_DYLD_ENVIRONMENT: return "LC_DYLD_ENVIRONMENT";
+        case LC_FILESET_ENTRY: return "LC_FILESET_ENTRY";
         default: return "LC_OTHER";
     }
 }
 
+enum inspect_mode {
+    MODE_DUMP = 0,
+    MODE_XREFS,
+    MODE_CFG,
+    MODE_CODESIGN,
+    MODE_VERIFY,
+    MODE_ENTITLEMENTS,
+    MODE_EXTRACT_SLICE,
+    MODE_CREATE_UNIVERSAL,
+    MODE_THIN,
+    MODE_RELOCS,
+    MODE_FILESET,
+    MODE_CORE,
+    MODE_IMPORTS,
+    MODE_LAUNCH_COST,
+    MODE_LOAD,
+    MODE_SIZE,
+    MODE_DIFF,
+    MODE_MATCH,
+    MODE_ENTROPY,
+};
+
 struct parse_opts {
     int list_only;
     int have_slice;
     uint32_t slice_index;
     int have_arch;
     uint32_t arch;
-};
-
-struct segment_map {
-    char name[17];
-    uint64_t vmaddr;
-    uint64_t vmsize;
-    uint64_t fileoff;
-    uint64_t filesize;
+    enum inspect_mode mode;
+    unsigned jobs;
+    int have_target;
+    uint64_t target;
+    const char *out_path;
+    int force_fat64;
+    const char *member;     // archive member to analyse
+    const char *find;       // archive symbol to look up
+    const char *entry;      // fileset entry to analyse
+    const char *decompress_out;
+    const char *sysroot;    // prefix for absolute install names
+    size_t top;             // rows per level in size reports
 };
 
 static size_t lc_strnlen(const char *s, size_t maxlen) {
@@ -179,8 +214,9 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
         return 1;
     }
 
-    const struct mach_header *h = (const struct mach_header*)buf;
-    uint32_t magic = h->magic;
+    struct mach_header h;
+    memcpy(&h, buf, sizeof(h));
+    uint32_t magic = h.magic;
     int swapped = 0;
     if (magic == MH_MAGIC) swapped = 0;
     else if (magic == MH_CIGAM) swapped = 1;
@@ -189,18 +225,25 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
         return 1;
     }
 
-    uint32_t ncmds = read32_u(h->ncmds, swapped);
-    uint32_t sizeofcmds = read32_u(h->sizeofcmds, swapped);
-    uint32_t cputype = read32_u((uint32_t)h->cputype, swapped);
+    uint32_t ncmds = read32_u(h.ncmds, swapped);
+    uint32_t sizeofcmds = read32_u(h.sizeofcmds, swapped);
+    uint32_t cputype = read32_u((uint32_t)h.cputype, swapped);
 
     printf("== Thin Mach-O (32-bit) ==\n");
     printf("CPU type: %u (%s)\n", cputype, cpu_type_name(cputype));
     printf("Load commands: %u  sizeofcmds=%u\n", ncmds, sizeofcmds);
 
     const uint8_t *p = buf + sizeof(struct mach_header);
-    const uint8_t *end = buf + sz;
 
-    struct segment_map *segs = calloc(ncmds, sizeof(*segs));
+    struct macho_budget_usage usage;
+    char err[256];
+    if (macho_budget_check_thin(buf, sz, NULL, &usage, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    const uint8_t *end = p + sizeofcmds;
+
+    struct segment_map *segs = calloc(usage.nsegs ? usage.nsegs : 1, sizeof(*segs));
     if (!segs) { perror("calloc"); return 1; }
     size_t segs_count = 0;
     uint64_t entryoff = 0;
@@ -215,9 +258,8 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
             return 1;
         }
 
-        const struct load_command *lc = (const struct load_command*)p;
-        uint32_t cmd = read32_u(lc->cmd, swapped);
-        uint32_t cmdsize = read32_u(lc->cmdsize, swapped);
+        uint32_t cmd = load32_u(p, swapped);
+        uint32_t cmdsize = load32_u(p + 4, swapped);
         if (cmdsize < sizeof(struct load_command)) {
             fprintf(stderr, "error: invalid cmdsize at %u\n", i);
             free(segs);
@@ -237,25 +279,26 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct segment_command *s = (const struct segment_command*)p;
-            uint32_t nsects = read32_u(s->nsects, swapped);
-            printf("     SEG %-16s vm=0x%08x size=0x%08x fileoff=0x%08x filesize=0x%08x nsects=%u\n",
-                   s->segname,
-                   read32_u(s->vmaddr, swapped),
-                   read32_u(s->vmsize, swapped),
-                   read32_u(s->fileoff, swapped),
-                   read32_u(s->filesize, swapped),
+            struct segment_command seg;
+            memcpy(&seg, p, sizeof(seg));
+            uint32_t nsects = read32_u(seg.nsects, swapped);
+            printf("     SEG %-16.16s vm=0x%08x size=0x%08x fileoff=0x%08x filesize=0x%08x nsects=%u\n",
+                   seg.segname,
+                   read32_u(seg.vmaddr, swapped),
+                   read32_u(seg.vmsize, swapped),
+                   read32_u(seg.fileoff, swapped),
+                   read32_u(seg.filesize, swapped),
                    nsects);
 
-            if (segs_count < ncmds) {
+            if (segs_count < usage.nsegs) {
                 struct segment_map *m = &segs[segs_count++];
                 memset(m, 0, sizeof(*m));
-                memcpy(m->name, s->segname, 16);
+                memcpy(m->name, seg.segname, 16);
                 m->name[16] = '\0';
-                m->vmaddr = read32_u(s->vmaddr, swapped);
-                m->vmsize = read32_u(s->vmsize, swapped);
-                m->fileoff = read32_u(s->fileoff, swapped);
-                m->filesize = read32_u(s->filesize, swapped);
+                m->vmaddr = read32_u(seg.vmaddr, swapped);
+                m->vmsize = read32_u(seg.vmsize, swapped);
+                m->fileoff = read32_u(seg.fileoff, swapped);
+                m->filesize = read32_u(seg.filesize, swapped);
             }
 
             size_t need = sizeof(struct segment_command) +
@@ -265,16 +308,18 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct section *sec = (const struct section*)(p + sizeof(struct segment_command));
-            for (uint32_t sidx = 0; sidx < nsects; sidx++) {
-                printf("         SECT %-16s seg=%-16s addr=0x%08x size=0x%08x off=0x%08x align=%u flags=0x%x\n",
-                       sec[sidx].sectname,
-                       sec[sidx].segname,
-                       read32_u(sec[sidx].addr, swapped),
-                       read32_u(sec[sidx].size, swapped),
-                       read32_u(sec[sidx].offset, swapped),
-                       read32_u(sec[sidx].align, swapped),
-                       read32_u(sec[sidx].flags, swapped));
+            const uint8_t *sp = p + sizeof(struct segment_command);
+            for (uint32_t sidx = 0; sidx < nsects; sidx++, sp += sizeof(struct section)) {
+                struct section sec;
+                memcpy(&sec, sp, sizeof(sec));
+                printf("         SECT %-16.16s seg=%-16.16s addr=0x%08x size=0x%08x off=0x%08x align=%u flags=0x%x\n",
+                       sec.sectname,
+                       sec.segname,
+                       read32_u(sec.addr, swapped),
+                       read32_u(sec.size, swapped),
+                       read32_u(sec.offset, swapped),
+                       read32_u(sec.align, swapped),
+                       read32_u(sec.flags, swapped));
             }
         } else if (cmd == LC_MAIN) {
             if (cmdsize < sizeof(struct entry_point_command)) {
@@ -282,36 +327,31 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct entry_point_command *ep = (const struct entry_point_command*)p;
-            entryoff = read64_u(ep->entryoff, swapped);
+            entryoff = load64_u(p + offsetof(struct entry_point_command, entryoff), swapped);
             have_entryoff = 1;
             printf("     entryoff=0x%llx stacksize=0x%llx\n",
                    (unsigned long long)entryoff,
-                   (unsigned long long)read64_u(ep->stacksize, swapped));
+                   (unsigned long long)load64_u(p + offsetof(struct entry_point_command, stacksize), swapped));
         } else if (cmd == LC_UUID) {
-            const struct uuid_command *uc = (const struct uuid_command*)p;
             printf("     uuid=");
-            print_uuid(uc->uuid);
+            print_uuid(p + offsetof(struct uuid_command, uuid));
         } else if (cmd == LC_LOAD_DYLIB || cmd == LC_LOAD_WEAK_DYLIB ||
                    cmd == LC_REEXPORT_DYLIB || cmd == LC_LOAD_UPWARD_DYLIB ||
                    cmd == LC_ID_DYLIB) {
-            const struct dylib_command *dc = (const struct dylib_command*)p;
-            uint32_t name_off = read32_u(dc->dylib.name.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct dylib_command, dylib.name.offset), swapped);
             printf("     dylib=");
             print_lc_string(p, cmdsize, name_off);
             printf(" current=0x%x compat=0x%x\n",
-                   read32_u(dc->dylib.current_version, swapped),
-                   read32_u(dc->dylib.compatibility_version, swapped));
+                   load32_u(p + offsetof(struct dylib_command, dylib.current_version), swapped),
+                   load32_u(p + offsetof(struct dylib_command, dylib.compatibility_version), swapped));
         } else if (cmd == LC_RPATH) {
-            const struct rpath_command *rc = (const struct rpath_command*)p;
-            uint32_t name_off = read32_u(rc->path.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct rpath_command, path.offset), swapped);
             printf("     rpath=");
             print_lc_string(p, cmdsize, name_off);
             printf("\n");
         } else if (cmd == LC_LOAD_DYLINKER || cmd == LC_ID_DYLINKER ||
                    cmd == LC_DYLD_ENVIRONMENT) {
-            const struct dylinker_command *dc = (const struct dylinker_command*)p;
-            uint32_t name_off = read32_u(dc->name.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct dylinker_command, name.offset), swapped);
             printf("     dyld=");
             print_lc_string(p, cmdsize, name_off);
             printf("\n");
@@ -324,15 +364,13 @@ static int parse_thin_macho_32(const uint8_t *buf, size_t sz) {
             const uint8_t *tp = p + sizeof(struct thread_command);
             const uint8_t *tend = p + cmdsize;
             while (tp + 8 <= tend) {
-                uint32_t flavor = read32_u(*(const uint32_t*)tp, swapped);
-                uint32_t count = read32_u(*(const uint32_t*)(tp + 4), swapped);
+                uint32_t flavor = load32_u(tp, swapped);
+                uint32_t count = load32_u(tp + 4, swapped);
                 tp += 8;
                 size_t bytes = (size_t)count * sizeof(uint32_t);
                 if (tp + bytes > tend) break;
                 if (flavor == ARM_THREAD_STATE64 && count >= ARM_THREAD_STATE64_COUNT) {
-                    const struct arm_thread_state64 *ts =
-                        (const struct arm_thread_state64*)tp;
-                    entry_pc = read64_u(ts->pc, swapped);
+                    entry_pc = load64_u(tp + offsetof(struct arm_thread_state64, pc), swapped);
                     have_entry_pc = 1;
                 }
                 tp += bytes;
@@ -360,8 +398,9 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
         return 1;
     }
 
-    const struct mach_header_64 *h = (const struct mach_header_64*)buf;
-    uint32_t magic = h->magic;
+    struct mach_header_64 h;
+    memcpy(&h, buf, sizeof(h));
+    uint32_t magic = h.magic;
     int swapped = 0;
     if (magic == MH_MAGIC_64) swapped = 0;
     else if (magic == MH_CIGAM_64) swapped = 1;
@@ -370,18 +409,25 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
         return 1;
     }
 
-    uint32_t ncmds = read32_u(h->ncmds, swapped);
-    uint32_t sizeofcmds = read32_u(h->sizeofcmds, swapped);
-    uint32_t cputype = read32_u((uint32_t)h->cputype, swapped);
+    uint32_t ncmds = read32_u(h.ncmds, swapped);
+    uint32_t sizeofcmds = read32_u(h.sizeofcmds, swapped);
+    uint32_t cputype = read32_u((uint32_t)h.cputype, swapped);
 
     printf("== Thin Mach-O (64-bit) ==\n");
     printf("CPU type: %u (%s)\n", cputype, cpu_type_name(cputype));
     printf("Load commands: %u  sizeofcmds=%u\n", ncmds, sizeofcmds);
 
     const uint8_t *p = buf + sizeof(struct mach_header_64);
-    const uint8_t *end = buf + sz;
 
-    struct segment_map *segs = calloc(ncmds, sizeof(*segs));
+    struct macho_budget_usage usage;
+    char err[256];
+    if (macho_budget_check_thin(buf, sz, NULL, &usage, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    const uint8_t *end = p + sizeofcmds;
+
+    struct segment_map *segs = calloc(usage.nsegs ? usage.nsegs : 1, sizeof(*segs));
     if (!segs) { perror("calloc"); return 1; }
     size_t segs_count = 0;
     uint64_t entryoff = 0;
@@ -396,9 +442,8 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
             return 1;
         }
 
-        const struct load_command *lc = (const struct load_command*)p;
-        uint32_t cmd = read32_u(lc->cmd, swapped);
-        uint32_t cmdsize = read32_u(lc->cmdsize, swapped);
+        uint32_t cmd = load32_u(p, swapped);
+        uint32_t cmdsize = load32_u(p + 4, swapped);
         if (cmdsize < sizeof(struct load_command)) {
             fprintf(stderr, "error: invalid cmdsize at %u\n", i);
             free(segs);
@@ -418,25 +463,26 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct segment_command_64 *s = (const struct segment_command_64*)p;
-            uint32_t nsects = read32_u(s->nsects, swapped);
-            printf("     SEG %-16s vm=0x%llx size=0x%llx fileoff=0x%llx filesize=0x%llx nsects=%u\n",
-                   s->segname,
-                   (unsigned long long)read64_u(s->vmaddr, swapped),
-                   (unsigned long long)read64_u(s->vmsize, swapped),
-                   (unsigned long long)read64_u(s->fileoff, swapped),
-                   (unsigned long long)read64_u(s->filesize, swapped),
+            struct segment_command_64 seg;
+            memcpy(&seg, p, sizeof(seg));
+            uint32_t nsects = read32_u(seg.nsects, swapped);
+            printf("     SEG %-16.16s vm=0x%llx size=0x%llx fileoff=0x%llx filesize=0x%llx nsects=%u\n",
+                   seg.segname,
+                   (unsigned long long)read64_u(seg.vmaddr, swapped),
+                   (unsigned long long)read64_u(seg.vmsize, swapped),
+                   (unsigned long long)read64_u(seg.fileoff, swapped),
+                   (unsigned long long)read64_u(seg.filesize, swapped),
                    nsects);
 
-            if (segs_count < ncmds) {
+            if (segs_count < usage.nsegs) {
                 struct segment_map *m = &segs[segs_count++];
                 memset(m, 0, sizeof(*m));
-                memcpy(m->name, s->segname, 16);
+                memcpy(m->name, seg.segname, 16);
                 m->name[16] = '\0';
-                m->vmaddr = read64_u(s->vmaddr, swapped);
-                m->vmsize = read64_u(s->vmsize, swapped);
-                m->fileoff = read64_u(s->fileoff, swapped);
-                m->filesize = read64_u(s->filesize, swapped);
+                m->vmaddr = read64_u(seg.vmaddr, swapped);
+                m->vmsize = read64_u(seg.vmsize, swapped);
+                m->fileoff = read64_u(seg.fileoff, swapped);
+                m->filesize = read64_u(seg.filesize, swapped);
             }
 
             size_t need = sizeof(struct segment_command_64) +
@@ -446,16 +492,18 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct section_64 *sec = (const struct section_64*)(p + sizeof(struct segment_command_64));
-            for (uint32_t sidx = 0; sidx < nsects; sidx++) {
-                printf("         SECT %-16s seg=%-16s addr=0x%llx size=0x%llx off=0x%x align=%u flags=0x%x\n",
-                       sec[sidx].sectname,
-                       sec[sidx].segname,
-                       (unsigned long long)read64_u(sec[sidx].addr, swapped),
-                       (unsigned long long)read64_u(sec[sidx].size, swapped),
-                       read32_u(sec[sidx].offset, swapped),
-                       read32_u(sec[sidx].align, swapped),
-                       read32_u(sec[sidx].flags, swapped));
+            const uint8_t *sp = p + sizeof(struct segment_command_64);
+            for (uint32_t sidx = 0; sidx < nsects; sidx++, sp += sizeof(struct section_64)) {
+                struct section_64 sec;
+                memcpy(&sec, sp, sizeof(sec));
+                printf("         SECT %-16.16s seg=%-16.16s addr=0x%llx size=0x%llx off=0x%x align=%u flags=0x%x\n",
+                       sec.sectname,
+                       sec.segname,
+                       (unsigned long long)read64_u(sec.addr, swapped),
+                       (unsigned long long)read64_u(sec.size, swapped),
+                       read32_u(sec.offset, swapped),
+                       read32_u(sec.align, swapped),
+                       read32_u(sec.flags, swapped));
             }
         } else if (cmd == LC_MAIN) {
             if (cmdsize < sizeof(struct entry_point_command)) {
@@ -463,64 +511,83 @@ static int parse_thin_macho_64(const uint8_t *buf, size_t sz) {
                 free(segs);
                 return 1;
             }
-            const struct entry_point_command *ep = (const struct entry_point_command*)p;
-            entryoff = read64_u(ep->entryoff, swapped);
+            entryoff = load64_u(p + offsetof(struct entry_point_command, entryoff), swapped);
             have_entryoff = 1;
             printf("     entryoff=0x%llx stacksize=0x%llx\n",
                    (unsigned long long)entryoff,
-                   (unsigned long long)read64_u(ep->stacksize, swapped));
+                   (unsigned long long)load64_u(p + offsetof(struct entry_point_command, stacksize), swapped));
         } else if (cmd == LC_UUID) {
-            const struct uuid_command *uc = (const struct uuid_command*)p;
             printf("     uuid=");
-            print_uuid(uc->uuid);
+            print_uuid(p + offsetof(struct uuid_command, uuid));
         } else if (cmd == LC_LOAD_DYLIB || cmd == LC_LOAD_WEAK_DYLIB ||
                    cmd == LC_REEXPORT_DYLIB || cmd == LC_LOAD_UPWARD_DYLIB ||
                    cmd == LC_ID_DYLIB) {
-            const struct dylib_command *dc = (const struct dylib_command*)p;
-            uint32_t name_off = read32_u(dc->dylib.name.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct dylib_command, dylib.name.offset), swapped);
             printf("     dylib=");
             print_lc_string(p, cmdsize, name_off);
             printf(" current=0x%x compat=0x%x\n",
-                   read32_u(dc->dylib.current_version, swapped),
-                   read32_u(dc->dylib.compatibility_version, swapped));
+                   load32_u(p + offsetof(struct dylib_command, dylib.current_version), swapped),
+                   load32_u(p + offsetof(struct dylib_command, dylib.compatibility_version), swapped));
         } else if (cmd == LC_RPATH) {
-            const struct rpath_command *rc = (const struct rpath_command*)p;
-            uint32_t name_off = read32_u(rc->path.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct rpath_command, path.offset), swapped);
             printf("     rpath=");
             print_lc_string(p, cmdsize, name_off);
             printf("\n");
         } else if (cmd == LC_LOAD_DYLINKER || cmd == LC_ID_DYLINKER ||
                    cmd == LC_DYLD_ENVIRONMENT) {
-            const struct dylinker_command *dc = (const struct dylinker_command*)p;
-            uint32_t name_off = read32_u(dc->name.offset, swapped);
+            uint32_t name_off = load32_u(p + offsetof(struct dylinker_command, name.offset), swapped);
             printf("     dyld=");
             print_lc_string(p, cmdsize, name_off);
             printf("\n");
+        } else if (cmd == LC_FILESET_ENTRY) {
+            if (cmdsize < sizeof(struct fileset_entry_command)) {
+                fprintf(stderr, "error: LC_FILESET_ENTRY too small\n");
+                free(segs);
+                return 1;
+            }
+            printf("     entry=");
+            print_lc_string(p, cmdsize,
+                            load32_u(p + offsetof(struct fileset_entry_command, entry_id.offset),
+                                     swapped));
+            printf(" vm=0x%llx fileoff=0x%llx\n",
+                   (unsigned long long)load64_u(p + offsetof(struct fileset_entry_command, vmaddr), swapped),
+                   (unsigned long long)load64_u(p + offsetof(struct fileset_entry_command, fileoff), swapped));
         } else if (cmd == LC_UNIXTHREAD || cmd == LC_THREAD) {
             if (cmdsize < sizeof(struct thread_command)) {
                 fprintf(stderr, "error: LC_THREAD too small\n");
                 free(segs);
                 return 1;
             }
+            // Every flavor is listed; --core decodes them all.
             const uint8_t *tp = p + sizeof(struct thread_command);
             const uint8_t *tend = p + cmdsize;
-            while (tp + 8 <= tend) {
-                uint32_t flavor = read32_u(*(const uint32_t*)tp, swapped);
-                uint32_t count = read32_u(*(const uint32_t*)(tp + 4), swapped);
+            have_entry_pc = 0;
+            while (tend - tp >= 8) {
+                uint32_t flavor = load32_u(tp, swapped);
+                uint32_t count = load32_u(tp + 4, swapped);
                 tp += 8;
                 size_t bytes = (size_t)count * sizeof(uint32_t);
-                if (tp + bytes > tend) break;
-                if (flavor == ARM_THREAD_STATE64 && count >= ARM_THREAD_STATE64_COUNT) {
-                    const struct arm_thread_state64 *ts =
-                        (const struct arm_thread_state64*)tp;
-                    entry_pc = read64_u(ts->pc, swapped);
+                if (bytes > (size_t)(tend - tp)) break;
+                const char *fname = core_flavor_name(cputype, flavor);
+                printf("     state %s (%u) count=%u\n", fname ? fname : "?", flavor, count);
+                // Flavor numbers are per architecture: 4 is x86_THREAD_STATE64
+                // on x86_64 but ARM_DEBUG_STATE on arm64.
+                if (cputype == (uint32_t)CPU_TYPE_ARM64 && flavor == ARM_THREAD_STATE64 &&
+                    count >= ARM_THREAD_STATE64_COUNT) {
+                    entry_pc = load64_u(tp + offsetof(struct arm_thread_state64, pc), swapped);
+                    have_entry_pc = 1;
+                } else if (cputype == (uint32_t)CPU_TYPE_X86_64 && flavor == x86_THREAD_STATE64 &&
+                           count >= x86_THREAD_STATE64_COUNT) {
+                    entry_pc = load64_u(tp + offsetof(struct x86_thread_state64, rip), swapped);
                     have_entry_pc = 1;
                 }
                 tp += bytes;
             }
-            if (have_entry_pc) {
+            if (have_entry_pc && cmd == LC_UNIXTHREAD) {
                 printf("     entry pc=0x%llx (from LC_UNIXTHREAD)\n",
                        (unsigned long long)entry_pc);
+            } else if (have_entry_pc) {
+                printf("     pc=0x%llx\n", (unsigned long long)entry_pc);
             }
         }
 
@@ -554,6 +621,12 @@ static int parse_fat(const uint8_t *buf, size_t sz, const struct parse_opts *opt
     printf("== FAT / Universal Mach-O ==\n");
     printf("fat magic: 0x%08x  nfat_arch=%u  (swapped=%d)\n", magic, nfat, swapped);
 
+    char err[256];
+    if (macho_budget_check_fat(buf, sz, NULL, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
     // Support FAT32 (fat_arch) and FAT64 (fat_arch_64)
     if (magic == FAT_MAGIC || magic == FAT_CIGAM) {
         size_t need = sizeof(struct fat_header) + (size_t)nfat * sizeof(struct fat_arch);
@@ -699,10 +772,761 @@ static int parse_fat(const uint8_t *buf, size_t sz, const struct parse_opts *opt
     return 1;
 }
 
+static int run_codesign(const struct macho_image *img, const struct parse_opts *opts) {
+    char err[256];
+    struct cs_signature sig;
+    int prc = cs_parse(img, &sig, err, sizeof(err));
+    if (prc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    if (opts->mode == MODE_CODESIGN) {
+        cs_print(&sig);
+        cs_free(&sig);
+        return 0;
+    }
+    if (opts->mode == MODE_ENTITLEMENTS) {
+        struct ent_list ents = { 0 };
+        int erc = ent_from_signature(&sig, &ents, err, sizeof(err));
+        printf("== Entitlements (%s) ==\n",
+               sig.der_entitlements ? "DER" : sig.entitlements ? "XML" : "none");
+        for (size_t i = 0; i < ents.n; i++) {
+            printf("%s = %s\n", ents.v[i].key, ents.v[i].value);
+        }
+        if (erc < 0) fprintf(stderr, "error: %s\n", err);
+        ent_list_free(&ents);
+        cs_free(&sig);
+        return erc < 0 ? 1 : 0;
+    }
+
+    int rc = 0;
+    printf("== Verify (sha256: %s) ==\n", digest_sha256_impl());
+    for (size_t i = 0; i < sig.ncds; i++) {
+        const struct cs_code_directory *cd = &sig.cds[i];
+        struct cs_verify_result res;
+        int vrc = cs_verify(img, &sig, cd, opts->jobs, &res);
+        printf("CodeDirectory slot=0x%x %s: pages %u/%u ok, special %u/%u ok",
+               cd->slot, cs_hash_type_name(cd->hash_type),
+               res.pages - res.pages_bad, res.pages,
+               res.special_checked - res.special_bad, res.special_checked);
+        if (res.pages_bad) printf(", first bad page %u", res.first_bad);
+        printf(" => %s\n", vrc == 0 ? "valid" : "INVALID");
+        if (vrc != 0) rc = 1;
+    }
+    cs_free(&sig);
+    return rc;
+}
+
+static void print_relocs(const struct macho_image *img) {
+    char err[256];
+    int any = 0;
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *s = &img->sects[i];
+        struct macho_reloc *v;
+        size_t n;
+        if (macho_relocs(img, i, &v, &n, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            continue;
+        }
+        if (n == 0) continue;
+        any = 1;
+        printf("== Relocations (%s,%s) %zu entries ==\n", s->segname, s->sectname, n);
+        for (size_t k = 0; k < n; k++) {
+            const struct macho_reloc *r = &v[k];
+            printf("  0x%08x %-30s len=%u%s ", r->address,
+                   macho_reloc_type_name(img->cputype, r->type), 1u << r->length,
+                   r->pcrel ? " pcrel" : "      ");
+            struct macho_symbol sym;
+            if (r->scattered) {
+                printf("value=0x%x", r->value);
+            } else if (r->external) {
+                if (macho_image_symbol(img, r->symbolnum, &sym) == 0) printf("%s", sym.name);
+                else printf("sym#%u", r->symbolnum);
+            } else if (r->symbolnum >= 1 && r->symbolnum <= img->nsects) {
+                const struct macho_section *t = &img->sects[r->symbolnum - 1];
+                printf("(%s,%s)", t->segname, t->sectname);
+            } else {
+                printf("sect#%u", r->symbolnum);
+            }
+            if (r->addend) printf(" %+lld", (long long)r->addend);
+            printf("\n");
+        }
+        free(v);
+    }
+    if (!any) printf("no section relocations\n");
+}
+
+// Analysis modes work on a non-printing macho_image: the selected slice,
+// or one fileset entry.
+static int run_image(const struct macho_image *img, const struct parse_opts *opts) {
+    char err[256];
+    int rc = 0;
+    if (opts->mode == MODE_XREFS) {
+        struct xref_index idx;
+        if (xref_build(img, opts->jobs, &idx, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            rc = 1;
+        } else {
+            xref_print(img, &idx, opts->have_target, opts->target);
+            xref_free(&idx);
+        }
+    } else if (opts->mode == MODE_CFG) {
+        struct cfg_graph g;
+        if (cfg_build(img, opts->jobs, &g, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            rc = 1;
+        } else {
+            cfg_print(&g, opts->have_target, opts->target);
+            cfg_free(&g);
+        }
+    } else if (opts->mode == MODE_CODESIGN || opts->mode == MODE_VERIFY ||
+               opts->mode == MODE_ENTITLEMENTS) {
+        rc = run_codesign(img, opts);
+    } else if (opts->mode == MODE_RELOCS) {
+        print_relocs(img);
+    } else if (opts->mode == MODE_ENTROPY) {
+        struct entropy_report r;
+        if (entropy_analyze(img, 0, &r, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            rc = 1;
+        } else {
+            entropy_print(img, &r);
+            entropy_report_free(&r);
+        }
+    }
+    return rc;
+}
+
+static int run_analysis(const uint8_t *buf, size_t sz, const struct parse_opts *opts) {
+    char err[256];
+    uint64_t off = 0;
+    uint64_t size = 0;
+    if (macho_select_slice(buf, sz, opts->have_slice ? (int)opts->slice_index : -1,
+                           opts->have_arch ? opts->arch : 0,
+                           &off, &size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
+    struct macho_image img;
+    if (macho_image_load(&img, buf + off, (size_t)size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    int rc = run_image(&img, opts);
+    macho_image_free(&img);
+    return rc;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int dump_thin(const uint8_t *buf, size_t sz) {
+    uint32_t magic = 0;
+    if (sz >= sizeof(magic)) memcpy(&magic, buf, sizeof(magic));
+    if (magic == MH_MAGIC || magic == MH_CIGAM) return parse_thin_macho_32(buf, sz);
+    return parse_thin_macho_64(buf, sz);
+}
+
+// Static library (or one slice of a universal one). With --member the
+// selected mode runs on that member; otherwise every member is indexed.
+static int run_archive(const uint8_t *buf, size_t sz, const struct parse_opts *opts) {
+    char err[256];
+    struct ar_archive ar;
+    if (ar_open(&ar, buf, sz, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    int rc = 0;
+    if (opts->member) {
+        const struct ar_member *m = ar_find(&ar, opts->member);
+        if (!m) {
+            fprintf(stderr, "error: no member '%s'\n", opts->member);
+            rc = 1;
+        } else if (opts->mode == MODE_DUMP) {
+            rc = dump_thin(m->data, (size_t)m->size);
+        } else {
+            rc = run_analysis(m->data, (size_t)m->size, opts);
+        }
+        ar_close(&ar);
+        return rc;
+    }
+
+    double t0 = now_ms();
+    struct ar_index idx;
+    if (ar_index_build(&ar, opts->jobs, &idx, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        ar_close(&ar);
+        return 1;
+    }
+    double t1 = now_ms();
+
+    if (opts->find) {
+        const struct ar_symbol *s = ar_index_find(&idx, opts->find);
+        if (!s) {
+            printf("%s: not defined\n", opts->find);
+            rc = 1;
+        }
+        for (; s && s < idx.syms + idx.nsyms && strcmp(s->name, opts->find) == 0; s++) {
+            printf("%s: %s\n", s->name, ar.members[s->member].name);
+        }
+        ar_index_free(&idx);
+        ar_close(&ar);
+        return rc;
+    }
+
+    printf("== Archive: %zu members ==\n", ar.n);
+    if (!opts->list_only) {
+        for (size_t i = 0; i < ar.n; i++) {
+            const struct ar_member_info *mi = &idx.info[i];
+            if (!mi->ok) {
+                printf("  [%zu] %s: not a Mach-O (%llu bytes)\n", i, ar.members[i].name,
+                       (unsigned long long)ar.members[i].size);
+                continue;
+            }
+            printf("  [%zu] %s: %s type=0x%x sects=%u relocs=%u defined=%u undefined=%u\n",
+                   i, ar.members[i].name, cpu_type_name(mi->cputype), mi->filetype,
+                   mi->nsects, mi->nreloc, mi->ndefined, mi->nundefined);
+        }
+    }
+    printf("symbols: %zu defined, %zu undefined, %zu defined more than once\n",
+           idx.nsyms, idx.nundefined, idx.duplicates);
+    if (ar.nsymdefs) {
+        printf("table of contents: %s%s, %zu entries: %zu match, %zu elsewhere, %zu dangling\n",
+               ar.symdef_64 ? "__.SYMDEF_64" : "__.SYMDEF",
+               ar.symdef_sorted ? " SORTED" : "", ar.nsymdefs, idx.symdef_matched,
+               idx.symdef_mismatched, idx.symdef_unresolved);
+    } else {
+        printf("table of contents: none\n");
+    }
+    if (idx.bad_members) printf("members not parsed: %zu\n", idx.bad_members);
+    printf("indexed in %.1f ms\n", t1 - t0);
+    ar_index_free(&idx);
+    ar_close(&ar);
+    return rc;
+}
+
+// Kernelcache: an MH_FILESET container. --fileset summarises every entry
+// (in parallel); --entry NAME runs the selected mode on one entry.
+static int run_fileset(const uint8_t *buf, size_t sz, const struct parse_opts *opts) {
+    char err[256];
+    uint64_t off = 0;
+    uint64_t size = 0;
+    if (macho_select_slice(buf, sz, opts->have_slice ? (int)opts->slice_index : -1,
+                           opts->have_arch ? opts->arch : 0,
+                           &off, &size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    const uint8_t *base = buf + off;
+    struct macho_image img;
+    if (macho_image_load(&img, base, (size_t)size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    struct fileset_entry *v;
+    size_t n;
+    if (fileset_entries(&img, &v, &n, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        macho_image_free(&img);
+        return 1;
+    }
+
+    int rc = 0;
+    if (opts->entry) {
+        long k = fileset_find(v, n, opts->entry);
+        struct macho_image e;
+        if (k < 0) {
+            fprintf(stderr, "error: no single fileset entry matches '%s'\n", opts->entry);
+            rc = 1;
+        } else if (opts->mode == MODE_DUMP) {
+            if (v[k].fileoff >= size) {
+                fprintf(stderr, "error: entry %s: fileoff beyond file\n", v[k].id);
+                rc = 1;
+            } else {
+                rc = parse_thin_macho_64(base + v[k].fileoff, (size_t)(size - v[k].fileoff));
+            }
+        } else if (macho_image_load_at(&e, base, (size_t)size, v[k].fileoff,
+                                       err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: entry %s: %s\n", v[k].id, err);
+            rc = 1;
+        } else {
+            rc = run_image(&e, opts);
+            macho_image_free(&e);
+        }
+    } else {
+        struct fileset_entry_info *info = calloc(n ? n : 1, sizeof(*info));
+        if (!info) {
+            perror("calloc");
+            free(v);
+            macho_image_free(&img);
+            return 1;
+        }
+        double t0 = now_ms();
+        fileset_analyze(base, (size_t)size, v, n, opts->jobs, info);
+        double t1 = now_ms();
+
+        uint64_t code = 0;
+        uint64_t funcs = 0;
+        size_t bad = 0;
+        printf("== Fileset: %zu entries ==\n", n);
+        for (size_t i = 0; i < n; i++) {
+            const struct fileset_entry_info *fi = &info[i];
+            if (!fi->ok) {
+                printf("  [%3zu] %s: error: %s\n", i, v[i].id, fi->err);
+                bad++;
+                continue;
+            }
+            code += fi->code_size;
+            funcs += fi->nfuncs;
+            printf("  [%3zu] %-48s vm=0x%llx fileoff=0x%llx segs=%u sects=%u code=0x%llx funcs=%u syms=%u",
+                   i, v[i].id, (unsigned long long)v[i].vmaddr,
+                   (unsigned long long)v[i].fileoff, fi->nsegs, fi->nsects,
+                   (unsigned long long)fi->code_size, fi->nfuncs, fi->nsyms);
+            if (fi->has_uuid) {
+                printf(" uuid=");
+                print_uuid(fi->uuid);
+            } else {
+                printf("\n");
+            }
+        }
+        printf("code: %llu bytes, %llu functions; entries not parsed: %zu\n",
+               (unsigned long long)code, (unsigned long long)funcs, bad);
+        printf("analysed in %.1f ms\n", t1 - t0);
+        if (bad) rc = 1;
+        free(info);
+    }
+    free(v);
+    macho_image_free(&img);
+    return rc;
+}
+
+// Core dump: memory regions, then every thread's registers and a
+// frame-pointer backtrace read through the region index.
+static int run_core(const uint8_t *buf, size_t sz, const struct parse_opts *opts) {
+    char err[256];
+    struct core_file c;
+    double t0 = now_ms();
+    if (core_load(&c, buf, sz, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    double t1 = now_ms();
+    core_print(&c, opts->list_only);
+    printf("indexed in %.1f ms\n", t1 - t0);
+    core_close(&c);
+    return 0;
+}
+
+// Import resolution: every input is an executable whose dylib closure is
+// loaded into one shared resolver, so libraries common to several inputs
+// are read once.
+static int run_imports(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    char err[256];
+    struct resolver r;
+    resolver_init(&r, opts->sysroot, opts->have_arch ? opts->arch : 0, opts->jobs);
+    char **paths = NULL;
+    size_t n = corpus_collect_paths((int)ninputs, inputs, &paths);
+    int rc = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t before = r.nimages;
+        double t0 = now_ms();
+        size_t idx = resolver_load(&r, paths[i], err, sizeof(err));
+        double t1 = now_ms();
+        if (idx == RESOLVER_NONE) {
+            fprintf(stderr, "error: %s\n", err);
+            rc = 1;
+            continue;
+        }
+        if (resolver_print(&r, idx, opts->list_only) != 0) rc = 1;
+        printf("loaded %zu new images in %.1f ms (%zu cached)\n", r.nimages - before,
+               t1 - t0, before);
+    }
+    corpus_free_paths(paths, n);
+    resolver_free(&r);
+    return rc;
+}
+
+// Launch cost: like --imports, every input's closure goes into one
+// resolver; the per-image counts are then computed once per image, in
+// parallel, and summed per input.
+static int run_launch_cost(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    char err[256];
+    struct resolver r;
+    resolver_init(&r, opts->sysroot, opts->have_arch ? opts->arch : 0, opts->jobs);
+    char **paths = NULL;
+    size_t n = corpus_collect_paths((int)ninputs, inputs, &paths);
+    size_t *roots = malloc((n ? n : 1) * sizeof(*roots));
+    struct launch_report *reps = calloc(n ? n : 1, sizeof(*reps));
+    int rc = 0;
+    size_t nroots = 0;
+    if (!roots || !reps) {
+        perror("malloc");
+        rc = 1;
+        goto done;
+    }
+    double t0 = now_ms();
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = resolver_load(&r, paths[i], err, sizeof(err));
+        if (idx == RESOLVER_NONE) {
+            fprintf(stderr, "error: %s\n", err);
+            rc = 1;
+            continue;
+        }
+        roots[nroots++] = idx;
+    }
+    double t1 = now_ms();
+    if (launch_cost_reports(&r, roots, nroots, opts->jobs, reps) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        rc = 1;
+    } else {
+        double t2 = now_ms();
+        launch_cost_print(&r, reps, nroots, opts->list_only);
+        printf("%zu inputs, %zu images: loaded in %.1f ms, counted in %.1f ms\n", nroots,
+               r.nimages, t1 - t0, t2 - t1);
+    }
+done:
+    free(roots);
+    free(reps);
+    corpus_free_paths(paths, n);
+    resolver_free(&r);
+    return rc;
+}
+
+// Loader emulation: every input's closure is found with the resolver, then
+// mapped into this process dependencies first, so each image's binds land
+// in the stub images already mapped. Libraries in a load cycle see the
+// images mapped after them as missing.
+static int run_load(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    char err[256];
+    char **paths = NULL;
+    size_t n = corpus_collect_paths((int)ninputs, inputs, &paths);
+    int rc = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct resolver r;
+        resolver_init(&r, opts->sysroot, opts->have_arch ? opts->arch : 0, opts->jobs);
+        double t0 = now_ms();
+        size_t idx = resolver_load(&r, paths[i], err, sizeof(err));
+        if (idx == RESOLVER_NONE) {
+            fprintf(stderr, "error: %s\n", err);
+            resolver_free(&r);
+            rc = 1;
+            continue;
+        }
+        size_t *order = NULL;
+        size_t norder = resolver_closure(&r, idx, &order);
+        struct dyld_emu_image *ims = calloc(r.nimages ? r.nimages : 1, sizeof(*ims));
+        const struct dyld_emu_image **by_index = calloc(r.nimages ? r.nimages : 1,
+                                                        sizeof(*by_index));
+        const struct dyld_emu_image **all = calloc(norder ? norder : 1, sizeof(*all));
+        const struct dyld_emu_image **deps = NULL;
+        size_t nall = 0;
+        if (!order || !ims || !by_index || !all) {
+            perror("malloc");
+            rc = 1;
+            goto next;
+        }
+        for (size_t j = norder; j-- > 0;) {
+            const struct resolver_image *ri = r.images[order[j]];
+            if (!ri->ok) continue;
+            free(deps);
+            deps = calloc(ri->link.ndylibs ? ri->link.ndylibs : 1, sizeof(*deps));
+            if (!deps) {
+                perror("malloc");
+                rc = 1;
+                goto next;
+            }
+            for (size_t k = 0; k < ri->link.ndylibs; k++) {
+                if (ri->deps[k] != RESOLVER_NONE) deps[k] = by_index[ri->deps[k]];
+            }
+            struct dyld_emu_options o;
+            dyld_emu_options_init(&o);
+            o.cputype = ri->img.cputype;
+            o.deps = deps;
+            o.ndeps = ri->link.ndylibs;
+            if (dyld_emu_load(ri->path, &o, &ims[order[j]], err, sizeof(err)) != 0) {
+                fprintf(stderr, "error: %s: %s\n", ri->path, err);
+                rc = 1;
+                if (j == 0) goto next;
+                continue;
+            }
+            by_index[order[j]] = &ims[order[j]];
+            all[nall++] = &ims[order[j]];
+        }
+        double t1 = now_ms();
+        const struct dyld_emu_image *root = by_index[idx];
+        if (!root) {
+            fprintf(stderr, "error: %s: %s\n", r.images[idx]->path, r.images[idx]->err);
+            rc = 1;
+            goto next;
+        }
+        for (size_t j = 0; j + 1 < nall; j++) {
+            const struct dyld_emu_image *d = all[j];
+            printf("stub %s: 0x%llx, fixups: %s, %llu rebases, %llu binds, %llu unresolved\n",
+                   d->path, (unsigned long long)(uintptr_t)d->base, d->fixups,
+                   (unsigned long long)d->stats.rebases, (unsigned long long)d->stats.binds,
+                   (unsigned long long)d->stats.unresolved);
+        }
+        dyld_emu_print(root, all, nall, opts->list_only);
+        printf("mapped %zu images in %.1f ms\n", nall, t1 - t0);
+        if (root->stats.unresolved) rc = 1;
+    next:
+        for (size_t j = 0; ims && j < r.nimages; j++) {
+            if (by_index && by_index[j]) dyld_emu_unload(&ims[j]);
+        }
+        free(deps);
+        free(all);
+        free(by_index);
+        free(ims);
+        free(order);
+        resolver_free(&r);
+    }
+    corpus_free_paths(paths, n);
+    return rc;
+}
+
+// Maps `path` and loads the slice picked by --slice/--arch (else arm64,
+// else the first). Errors are printed.
+static int load_input_image(const struct parse_opts *opts, const char *path,
+                            struct mapped_file *mf, struct macho_image *img) {
+    char err[256];
+    uint64_t off = 0;
+    uint64_t size = 0;
+    if (map_file(path, mf, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return -1;
+    }
+    if (macho_select_slice(mf->data, mf->size, opts->have_slice ? (int)opts->slice_index : -1,
+                           opts->have_arch ? opts->arch : 0, &off, &size, err, sizeof(err)) != 0 ||
+        macho_image_load(img, mf->data + off, (size_t)size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s: %s\n", path, err);
+        unmap_file(mf);
+        return -1;
+    }
+    return 0;
+}
+
+struct size_input {
+    struct mapped_file mf;
+    struct macho_image img;
+    struct size_report rep;
+};
+
+static int load_size_input(const struct parse_opts *opts, const char *path,
+                           struct size_input *in) {
+    char err[256];
+    if (load_input_image(opts, path, &in->mf, &in->img) != 0) return -1;
+    if (size_report_build(&in->img, &in->rep, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s: %s\n", path, err);
+        macho_image_free(&in->img);
+        unmap_file(&in->mf);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_size_input(struct size_input *in) {
+    size_report_free(&in->rep);
+    macho_image_free(&in->img);
+    unmap_file(&in->mf);
+}
+
+// Size attribution for one binary, or what changed between two.
+static int run_size(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    if (ninputs != 1 && ninputs != 2) {
+        fprintf(stderr, "error: --size takes one file, or two to compare\n");
+        return 2;
+    }
+    struct size_input in[2];
+    double t0 = now_ms();
+    for (size_t i = 0; i < ninputs; i++) {
+        if (load_size_input(opts, inputs[i], &in[i]) != 0) {
+            if (i) free_size_input(&in[0]);
+            return 1;
+        }
+    }
+    double t1 = now_ms();
+    int rc = 0;
+    size_t top = opts->top ? opts->top : 10;
+    if (ninputs == 1) {
+        size_report_print(&in[0].rep, top);
+        printf("%zu symbols attributed in %.1f ms\n", in[0].rep.nsyms, t1 - t0);
+    } else {
+        printf("%s -> %s\n", inputs[0], inputs[1]);
+        if (size_report_diff(&in[0].rep, &in[1].rep, top) != 0) {
+            fprintf(stderr, "error: out of memory\n");
+            rc = 1;
+        }
+        printf("%zu -> %zu symbols attributed in %.1f ms\n", in[0].rep.nsyms, in[1].rep.nsyms,
+               t1 - t0);
+    }
+    for (size_t i = 0; i < ninputs; i++) free_size_input(&in[i]);
+    return rc;
+}
+
+// Structural diff of two builds; both are parsed at once.
+static int run_diff(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    if (ninputs != 2) {
+        fprintf(stderr, "error: --diff takes two files\n");
+        return 2;
+    }
+    struct bindiff_side sides[2];
+    double t0 = now_ms();
+    if (bindiff_open(sides, inputs[0], inputs[1], opts->have_slice ? (int)opts->slice_index : -1,
+                     opts->have_arch ? opts->arch : 0, opts->jobs) != 0) {
+        for (int i = 0; i < 2; i++) {
+            if (sides[i].err[0]) fprintf(stderr, "error: %s\n", sides[i].err);
+        }
+        bindiff_close(sides);
+        return 1;
+    }
+    double t1 = now_ms();
+    struct bindiff_stats st;
+    int rc = 0;
+    if (bindiff_print(sides, opts->top, opts->jobs, &st) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        rc = 1;
+    }
+    double t2 = now_ms();
+    printf("%zu changes; sections: %zu unchanged (%.1f MB skipped by hash), %zu changed\n",
+           st.changes, st.sections_same, (double)st.bytes_skipped / (1024.0 * 1024.0),
+           st.sections_changed);
+    printf("functions: %zu unchanged (%zu moved), %zu changed, %zu added, %zu removed\n",
+           st.funcs_same, st.funcs_moved, st.funcs_changed, st.funcs_added, st.funcs_removed);
+    printf("parsed and hashed in %.1f ms, compared in %.1f ms\n", t1 - t0, t2 - t1);
+    bindiff_close(sides);
+    return rc;
+}
+
+// Where each function of OLD went in NEW, with confidence and the patch
+// window arm64_patch_prologue can use at the new address.
+static int run_match(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    if (ninputs != 2) {
+        fprintf(stderr, "error: --match takes two files (old, new)\n");
+        return 2;
+    }
+    struct mapped_file mf[2];
+    struct macho_image img[2];
+    if (load_input_image(opts, inputs[0], &mf[0], &img[0]) != 0) return 1;
+    if (load_input_image(opts, inputs[1], &mf[1], &img[1]) != 0) {
+        macho_image_free(&img[0]);
+        unmap_file(&mf[0]);
+        return 1;
+    }
+    char err[256];
+    struct funcmatch_map map;
+    int rc = 0;
+    double t0 = now_ms();
+    if (funcmatch_build(&img[0], &img[1], opts->jobs, &map, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        rc = 1;
+    } else {
+        double t1 = now_ms();
+        printf("%s -> %s\n", inputs[0], inputs[1]);
+        funcmatch_print(&map, opts->have_target, opts->target);
+        printf("matched in %.1f ms\n", t1 - t0);
+        funcmatch_free(&map);
+    }
+    for (int i = 0; i < 2; i++) {
+        macho_image_free(&img[i]);
+        unmap_file(&mf[i]);
+    }
+    return rc;
+}
+
+// lipo-style modes: they work on files, not on a parsed slice, and never
+// read slice contents into memory.
+static int run_lipo(const struct parse_opts *opts, char **inputs, size_t ninputs) {
+    char err[256];
+    struct lipo_result res;
+    if (opts->mode == MODE_EXTRACT_SLICE) {
+        if (ninputs != 1) {
+            fprintf(stderr, "error: --extract-slice takes one input file\n");
+            return 2;
+        }
+        if (lipo_extract(inputs[0], opts->have_slice ? (int)opts->slice_index : -1,
+                         opts->have_arch ? opts->arch : 0, opts->out_path, &res,
+                         err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            return 1;
+        }
+        printf("wrote %s (%llu bytes)\n", opts->out_path, (unsigned long long)res.size);
+        return 0;
+    }
+    if (opts->mode == MODE_CREATE_UNIVERSAL) {
+        if (lipo_create(inputs, ninputs, opts->force_fat64, opts->out_path, &res,
+                        err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            return 1;
+        }
+        printf("wrote %s: %s, %u slices, %llu bytes\n", opts->out_path,
+               res.fat64 ? "FAT64" : "FAT", res.nslices, (unsigned long long)res.size);
+        return 0;
+    }
+
+    char **paths = NULL;
+    size_t n = corpus_collect_paths((int)ninputs, inputs, &paths);
+    struct lipo_thin_stats st;
+    lipo_thin_many(paths, n, opts->arch, opts->jobs, &st);
+    corpus_free_paths(paths, n);
+    printf("files=%zu thinned=%zu already_thin=%zu not_macho=%zu missing_arch=%zu errors=%zu\n",
+           st.files, st.thinned, st.thin, st.not_macho, st.missing_arch, st.errors);
+    printf("bytes: %llu -> %llu\n", (unsigned long long)st.bytes_before,
+           (unsigned long long)st.bytes_after);
+    return st.errors ? 1 : 0;
+}
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [--list] [--slice N | --arch NAME|CPU] [--jobs N] [mode] <mach-o file>\n", prog);
+    fprintf(out, "modes:\n");
+    fprintf(out, "  (default)          dump header and load commands\n");
+    fprintf(out, "  --xrefs            arm64 cross-references in __TEXT,__text\n");
+    fprintf(out, "  --xrefs-to ADDR    only references to ADDR\n");
+    fprintf(out, "  --cfg              arm64 basic blocks and call graph\n");
+    fprintf(out, "  --cfg-func ADDR    one function, with hook blast radius\n");
+    fprintf(out, "  --codesign         code signature blobs, CodeDirectories, requirements\n");
+    fprintf(out, "  --verify           recompute page and special-slot hashes\n");
+    fprintf(out, "  --entitlements     entitlements (DER if present, else XML)\n");
+    fprintf(out, "  --extract-slice OUT          write the selected slice as a thin file\n");
+    fprintf(out, "  --create-universal OUT IN... build a FAT file (FAT64 if needed, or --fat64)\n");
+    fprintf(out, "  --thin ARCH PATH...|-        thin FAT files in place, in parallel\n");
+    fprintf(out, "  --relocs           section relocations (MH_OBJECT)\n");
+    fprintf(out, "  --entropy          entropy, zero runs and a page heat map; flags packed,\n");
+    fprintf(out, "                     compressed or encrypted content\n");
+    fprintf(out, "  --fileset          kernelcache (MH_FILESET): summarise every entry\n");
+    fprintf(out, "  --entry ID         run the selected mode on one fileset entry\n");
+    fprintf(out, "  --decompress OUT   write the unwrapped, decompressed IM4P/kernelcache\n");
+    fprintf(out, "  --core             core dump (MH_CORE): regions, thread state, backtraces\n");
+    fprintf(out, "  --imports PATH...|-  bind every import across the dylib closure\n");
+    fprintf(out, "  --launch-cost PATH...|-  rank by estimated dyld launch cost\n");
+    fprintf(out, "  --load PATH...|-   map into this process like dyld: slide, fixups, binds\n");
+    fprintf(out, "                     into the dylib closure; --list: unresolved binds only\n");
+    fprintf(out, "  --sysroot DIR      root for absolute install names (--imports, --launch-cost,\n");
+    fprintf(out, "                     --load)\n");
+    fprintf(out, "  --size A [B]       file/VM size by segment, section, symbol, object; B: diff\n");
+    fprintf(out, "  --diff A B         load commands, segments, sections, dylibs, exports, symbols\n");
+    fprintf(out, "                     and changed functions between two builds\n");
+    fprintf(out, "  --top N            rows per level (--size, default 10; --diff, default all)\n");
+    fprintf(out, "  --match OLD NEW    arm64: map OLD's functions to NEW's, with confidence and\n");
+    fprintf(out, "                     the patch_bytes arm64_patch_prologue can use\n");
+    fprintf(out, "  --match-at ADDR    only the OLD function containing ADDR\n");
+    fprintf(out, "  --budget SPEC      parse limits for untrusted input, e.g. cmds=4096,sects=16K,\n");
+    fprintf(out, "                     arches=16,alloc=16M,work=1M (0 or none: unlimited)\n");
+    fprintf(out, "static libraries (.a): members are indexed unless one is picked:\n");
+    fprintf(out, "  --member NAME      run the selected mode on one member\n");
+    fprintf(out, "  --find SYMBOL      member(s) defining SYMBOL\n");
+}
+
 int main(int argc, char **argv) {
     struct parse_opts opts;
     memset(&opts, 0, sizeof(opts));
     const char *path = NULL;
+    char **inputs = calloc((size_t)argc, sizeof(*inputs));
+    size_t ninputs = 0;
+    if (!inputs) { perror("calloc"); return 1; }
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--list") == 0) {
@@ -725,58 +1549,266 @@ int main(int argc, char **argv) {
             }
             opts.have_arch = 1;
             i++;
+        } else if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: %s requires an argument\n", argv[i]);
+                return 2;
+            }
+            opts.jobs = (unsigned)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--xrefs") == 0) {
+            opts.mode = MODE_XREFS;
+        } else if (strcmp(argv[i], "--xrefs-to") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --xrefs-to requires an address\n");
+                return 2;
+            }
+            opts.mode = MODE_XREFS;
+            opts.have_target = 1;
+            opts.target = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--cfg") == 0) {
+            opts.mode = MODE_CFG;
+        } else if (strcmp(argv[i], "--cfg-func") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --cfg-func requires an address\n");
+                return 2;
+            }
+            opts.mode = MODE_CFG;
+            opts.have_target = 1;
+            opts.target = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--codesign") == 0) {
+            opts.mode = MODE_CODESIGN;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            opts.mode = MODE_VERIFY;
+        } else if (strcmp(argv[i], "--entitlements") == 0) {
+            opts.mode = MODE_ENTITLEMENTS;
+        } else if (strcmp(argv[i], "--extract-slice") == 0 ||
+                   strcmp(argv[i], "--create-universal") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: %s requires an output path\n", argv[i]);
+                return 2;
+            }
+            opts.mode = argv[i][2] == 'e' ? MODE_EXTRACT_SLICE : MODE_CREATE_UNIVERSAL;
+            opts.out_path = argv[++i];
+        } else if (strcmp(argv[i], "--fileset") == 0) {
+            opts.mode = MODE_FILESET;
+        } else if (strcmp(argv[i], "--core") == 0) {
+            opts.mode = MODE_CORE;
+        } else if (strcmp(argv[i], "--imports") == 0) {
+            opts.mode = MODE_IMPORTS;
+        } else if (strcmp(argv[i], "--launch-cost") == 0) {
+            opts.mode = MODE_LAUNCH_COST;
+        } else if (strcmp(argv[i], "--load") == 0) {
+            opts.mode = MODE_LOAD;
+        } else if (strcmp(argv[i], "--size") == 0) {
+            opts.mode = MODE_SIZE;
+        } else if (strcmp(argv[i], "--diff") == 0) {
+            opts.mode = MODE_DIFF;
+        } else if (strcmp(argv[i], "--match") == 0) {
+            opts.mode = MODE_MATCH;
+        } else if (strcmp(argv[i], "--match-at") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --match-at requires an address\n");
+                return 2;
+            }
+            opts.mode = MODE_MATCH;
+            opts.have_target = 1;
+            opts.target = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--top") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --top requires a count\n");
+                return 2;
+            }
+            opts.top = (size_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--sysroot") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --sysroot requires a directory\n");
+                return 2;
+            }
+            opts.sysroot = argv[++i];
+        } else if (strcmp(argv[i], "--entry") == 0 || strcmp(argv[i], "--decompress") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: %s requires an argument\n", argv[i]);
+                return 2;
+            }
+            if (argv[i][2] == 'e') opts.entry = argv[++i];
+            else opts.decompress_out = argv[++i];
+        } else if (strcmp(argv[i], "--relocs") == 0) {
+            opts.mode = MODE_RELOCS;
+        } else if (strcmp(argv[i], "--entropy") == 0) {
+            opts.mode = MODE_ENTROPY;
+        } else if (strcmp(argv[i], "--member") == 0 || strcmp(argv[i], "--find") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: %s requires an argument\n", argv[i]);
+                return 2;
+            }
+            if (argv[i][2] == 'm') opts.member = argv[++i];
+            else opts.find = argv[++i];
+        } else if (strcmp(argv[i], "--budget") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: --budget requires a spec\n");
+                return 2;
+            }
+            // Installed before any worker starts: the loaders read it unlocked.
+            struct macho_budget b = *macho_budget_default();
+            char err[256];
+            if (macho_budget_parse(&b, argv[++i], err, sizeof(err)) != 0) {
+                fprintf(stderr, "error: %s\n", err);
+                return 2;
+            }
+            macho_budget_set_default(&b);
+        } else if (strcmp(argv[i], "--fat64") == 0) {
+            opts.force_fat64 = 1;
+        } else if (strcmp(argv[i], "--thin") == 0) {
+            if (i + 1 >= argc || !parse_cputype(argv[i + 1], &opts.arch)) {
+                fprintf(stderr, "error: --thin requires an arch\n");
+                return 2;
+            }
+            opts.mode = MODE_THIN;
+            i++;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            printf("usage: %s [--list] [--slice N | --arch NAME|CPU] <mach-o file>\n", argv[0]);
+            usage(argv[0], stdout);
             return 0;
-        } else if (argv[i][0] == '-') {
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
             fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
             return 2;
         } else {
             path = argv[i];
+            inputs[ninputs++] = argv[i];
         }
     }
 
     if (!path) {
-        fprintf(stderr, "usage: %s [--list] [--slice N | --arch NAME|CPU] <mach-o file>\n", argv[0]);
+        usage(argv[0], stderr);
+        free(inputs);
         return 2;
     }
+    if (opts.mode == MODE_EXTRACT_SLICE || opts.mode == MODE_CREATE_UNIVERSAL ||
+        opts.mode == MODE_THIN) {
+        int lrc = run_lipo(&opts, inputs, ninputs);
+        free(inputs);
+        return lrc;
+    }
+    if (opts.mode == MODE_IMPORTS || opts.mode == MODE_LAUNCH_COST || opts.mode == MODE_LOAD) {
+        int irc = opts.mode == MODE_IMPORTS ? run_imports(&opts, inputs, ninputs) :
+                  opts.mode == MODE_LOAD    ? run_load(&opts, inputs, ninputs) :
+                                              run_launch_cost(&opts, inputs, ninputs);
+        free(inputs);
+        return irc;
+    }
+    if (opts.mode == MODE_SIZE || opts.mode == MODE_DIFF || opts.mode == MODE_MATCH) {
+        int src = opts.mode == MODE_SIZE ? run_size(&opts, inputs, ninputs) :
+                  opts.mode == MODE_DIFF ? run_diff(&opts, inputs, ninputs) :
+                                           run_match(&opts, inputs, ninputs);
+        free(inputs);
+        return src;
+    }
+    free(inputs);
 
-    FILE *f = fopen(path, "rb");
-    if (!f) { perror("open"); return 1; }
-
-    fseek(f, 0, SEEK_END);
-    long n = ftell(f);
-    rewind(f);
-
-    if (n <= 0) {
-        fprintf(stderr, "error: empty file\n");
-        fclose(f);
+    char err[256];
+    struct mapped_file mf;
+    if (map_file(path, &mf, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
         return 1;
     }
-
-    uint8_t *buf = (uint8_t*)malloc((size_t)n);
-    if (!buf) { perror("malloc"); fclose(f); return 1; }
-
-    if (fread(buf, 1, (size_t)n, f) != (size_t)n) {
-        perror("fread");
-        fclose(f);
-        free(buf);
+    if (mf.size < sizeof(uint32_t)) {
+        fprintf(stderr, "error: %s\n", mf.size ? "file too small" : "empty file");
+        unmap_file(&mf);
+        return 1;
+    }
+    const uint8_t *buf = mf.data;
+    size_t n = mf.size;
+
+    // Kernelcaches come wrapped in IM4P and compressed; analyse the
+    // decompressed image.
+    uint8_t *unpacked = NULL;
+    if (img4_detect(buf, n) || img4_compression(buf, n) != IMG4_RAW) {
+        struct img4_payload pl = { "", NULL, 0, buf, n, 0, 0 };
+        if (img4_detect(buf, n) && img4_parse(buf, n, &pl, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            unmap_file(&mf);
+            return 1;
+        }
+        if (pl.encrypted) {
+            fprintf(stderr, "error: IM4P payload is encrypted\n");
+            unmap_file(&mf);
+            return 1;
+        }
+        enum img4_compression c = img4_compression(pl.data, pl.size);
+        double t0 = now_ms();
+        size_t ulen = pl.size;
+        if (c != IMG4_RAW &&
+            img4_decompress(pl.data, pl.size, pl.declared_size, &unpacked, &ulen,
+                            err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            unmap_file(&mf);
+            return 1;
+        }
+        if (c == IMG4_RAW) {
+            // DER puts the payload at an arbitrary offset; the parsers
+            // want the Mach-O header aligned.
+            unpacked = malloc(pl.size ? pl.size : 1);
+            if (!unpacked) {
+                perror("malloc");
+                unmap_file(&mf);
+                return 1;
+            }
+            memcpy(unpacked, pl.data, pl.size);
+        }
+        printf("== IM4P type=%s desc=%.*s %s %zu -> %zu bytes (%.1f ms) ==\n",
+               pl.type[0] ? pl.type : "-", (int)pl.description_len,
+               pl.description ? pl.description : "", img4_compression_name(c),
+               pl.size, ulen, now_ms() - t0);
+        buf = unpacked;
+        n = ulen;
+    }
+    if (opts.decompress_out) {
+        int wrc = write_file_atomic(opts.decompress_out, buf, n, 0644, err, sizeof(err));
+        if (wrc != 0) fprintf(stderr, "error: %s\n", err);
+        else printf("wrote %s (%zu bytes)\n", opts.decompress_out, n);
+        free(unpacked);
+        unmap_file(&mf);
+        return wrc != 0;
+    }
+    if (n < sizeof(uint32_t)) {
+        fprintf(stderr, "error: file too small\n");
+        free(unpacked);
+        unmap_file(&mf);
         return 1;
     }
-    fclose(f);
 
     uint32_t magic = 0;
     memcpy(&magic, buf, sizeof(magic));
 
+    // A static library, plain or as the selected slice of a universal file.
+    uint64_t ar_off = 0;
+    uint64_t ar_size = n;
+    int archive = ar_is_archive(buf, n);
+    if (!archive && is_fat_magic(magic) && !opts.list_only &&
+        macho_select_slice(buf, n, opts.have_slice ? (int)opts.slice_index : -1,
+                           opts.have_arch ? opts.arch : 0, &ar_off, &ar_size,
+                           err, sizeof(err)) == 0) {
+        archive = ar_is_archive(buf + ar_off, (size_t)ar_size);
+    }
+
     int rc;
-    if (is_fat_magic(magic)) {
-        rc = parse_fat(buf, (size_t)n, &opts);
-    } else if (magic == MH_MAGIC || magic == MH_CIGAM) {
-        rc = parse_thin_macho_32(buf, (size_t)n);
+    if (archive) {
+        rc = run_archive(buf + ar_off, (size_t)ar_size, &opts);
+    } else if (opts.entry || opts.mode == MODE_FILESET) {
+        rc = run_fileset(buf, n, &opts);
+    } else if (opts.mode == MODE_CORE) {
+        rc = run_core(buf, n, &opts);
+    } else if (opts.member || opts.find) {
+        fprintf(stderr, "error: --member/--find need a static library\n");
+        rc = 2;
+    } else if (opts.mode != MODE_DUMP && !opts.list_only) {
+        rc = run_analysis(buf, n, &opts);
+    } else if (is_fat_magic(magic)) {
+        rc = parse_fat(buf, n, &opts);
     } else {
-        rc = parse_thin_macho_64(buf, (size_t)n);
+        rc = dump_thin(buf, n);
     }
 
-    free(buf);
+    free(unpacked);
+    unmap_file(&mf);
     return rc;
 }
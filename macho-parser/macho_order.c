@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/mach/machine.h"
+
+#include "corpus.h"
+#include "macho_image.h"
+#include "order.h"
+
+// macho_order: turn function-entry traces into a linker order file.
+//
+//   macho_order [--arch A] [--slide S] [--page-size N] [-o OUT] BINARY TRACE... | -
+//
+// A trace is text, one PC per line (hex, 0x optional). Runtime PCs are
+// unslid with --slide or with a "# slide 0x..." line in the trace; blank
+// lines and other '#' lines are ignored. The order file goes to OUT (the
+// report to stdout) or to stdout (the report to stderr), ready for
+// ld -order_file.
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s [--arch arm64|x86_64] [--slide S] [--page-size N] [-o OUT]\n"
+                 "       %*s <mach-o file> <trace>... | -\n",
+            prog, (int)strlen(prog), "");
+}
+
+struct pc_vec {
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+};
+
+static int read_trace(const char *path, uint64_t slide, struct pc_vec *pcs) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[512];
+    int rc = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *s = line;
+        while (*s == ' ' || *s == '\t') s++;
+        if (*s == '#') {
+            const char *key = "# slide";
+            if (strncmp(s, key, strlen(key)) == 0) slide = strtoull(s + strlen(key), NULL, 16);
+            continue;
+        }
+        char *end = NULL;
+        uint64_t pc = strtoull(s, &end, 16);
+        if (end == s) continue;
+        if (pcs->n == pcs->cap) {
+            size_t cap = pcs->cap ? pcs->cap * 2 : 4096;
+            uint64_t *v = realloc(pcs->v, cap * sizeof(*v));
+            if (!v) {
+                rc = -1;
+                break;
+            }
+            pcs->v = v;
+            pcs->cap = cap;
+        }
+        pcs->v[pcs->n++] = pc - slide;
+    }
+    if (f != stdin) fclose(f);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    uint32_t cputype = 0;
+    uint64_t slide = 0;
+    uint64_t page_size = 0;
+    const char *out_path = NULL;
+    const char *path = NULL;
+    int first_trace = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--arch") == 0 && i + 1 < argc) {
+            const char *a = argv[++i];
+            cputype = strcmp(a, "arm64") == 0 ? (uint32_t)CPU_TYPE_ARM64 :
+                      strcmp(a, "x86_64") == 0 ? (uint32_t)CPU_TYPE_X86_64 :
+                      (uint32_t)strtoul(a, NULL, 0);
+        } else if (strcmp(argv[i], "--slide") == 0 && i + 1 < argc) {
+            slide = strtoull(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+            page_size = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0], stdout);
+            return 0;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            return 2;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            first_trace = i;
+            break;
+        }
+    }
+    if (!path || !first_trace) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    if (page_size & (page_size - 1)) {
+        fprintf(stderr, "error: page size must be a power of two\n");
+        return 2;
+    }
+
+    struct pc_vec pcs = { NULL, 0, 0 };
+    for (int i = first_trace; i < argc; i++) {
+        if (read_trace(argv[i], slide, &pcs) != 0) {
+            free(pcs.v);
+            return 1;
+        }
+    }
+
+    char err[256];
+    struct mapped_file mf;
+    if (map_file(path, &mf, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        free(pcs.v);
+        return 1;
+    }
+    uint64_t off = 0;
+    uint64_t size = 0;
+    struct macho_image img;
+    struct order_plan plan;
+    int rc = 1;
+    if (macho_select_slice(mf.data, mf.size, -1, cputype, &off, &size, err, sizeof(err)) != 0 ||
+        macho_image_load(&img, mf.data + off, (size_t)size, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        goto out;
+    }
+    if (order_plan_build(&img, pcs.v, pcs.n, page_size, &plan, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        macho_image_free(&img);
+        goto out;
+    }
+
+    if (out_path) {
+        FILE *f = fopen(out_path, "w");
+        if (!f) {
+            perror(out_path);
+        } else {
+            order_plan_write(&plan, f);
+            rc = fclose(f) == 0 ? 0 : 1;
+            if (rc) perror(out_path);
+            else printf("wrote %s (%zu functions)\n", out_path, plan.nhot - plan.unnamed);
+            order_plan_report(&plan, stdout);
+        }
+    } else {
+        order_plan_write(&plan, stdout);
+        order_plan_report(&plan, stderr);
+        rc = 0;
+    }
+    order_plan_free(&plan);
+    macho_image_free(&img);
+out:
+    unmap_file(&mf);
+    free(pcs.v);
+    return rc;
+}
@@ -0,0 +1,189 @@
+#include "order.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/mach/machine.h"
+#include "../include/macho/nlist.h"
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Name for a function starting at `addr`: an external symbol if there is
+// one, else the first local one. syms is sorted by address.
+static const char *name_at(const struct macho_symbol *syms, size_t n, uint64_t addr) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (syms[mid].addr < addr) lo = mid + 1;
+        else hi = mid;
+    }
+    const char *local = NULL;
+    for (size_t i = lo; i < n && syms[i].addr == addr; i++) {
+        if (!syms[i].name[0]) continue;
+        if (syms[i].type & N_EXT) return syms[i].name;
+        if (!local) local = syms[i].name;
+    }
+    return local;
+}
+
+// Function containing pc, or nfuncs. funcs is sorted and contiguous.
+static size_t func_for(const struct order_func *funcs, size_t nfuncs, uint64_t pc) {
+    size_t lo = 0;
+    size_t hi = nfuncs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (funcs[mid].start <= pc) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0 || pc >= funcs[lo - 1].end) return nfuncs;
+    return lo - 1;
+}
+
+// Distinct pages spanned by the hot functions at their current addresses:
+// all of them, or only those without a symbol.
+static uint64_t current_pages(const struct order_plan *p, int unnamed_only, int *oom) {
+    size_t n = 0;
+    size_t cap = 0;
+    uint64_t *pages = NULL;
+    for (size_t i = 0; i < p->nhot; i++) {
+        const struct order_func *f = &p->funcs[p->hot[i]];
+        if (unnamed_only && f->name) continue;
+        for (uint64_t pg = f->start / p->page_size; pg <= (f->end - 1) / p->page_size; pg++) {
+            if (n && pages[n - 1] == pg) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 256;
+                uint64_t *v = realloc(pages, cap * sizeof(*v));
+                if (!v) {
+                    free(pages);
+                    *oom = 1;
+                    return 0;
+                }
+                pages = v;
+            }
+            pages[n++] = pg;
+        }
+    }
+    if (n) qsort(pages, n, sizeof(*pages), cmp_u64);
+    uint64_t distinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || pages[i] != pages[i - 1]) distinct++;
+    }
+    free(pages);
+    return distinct;
+}
+
+int order_plan_build(const struct macho_image *img, const uint64_t *pcs, size_t npcs,
+                     uint64_t page_size, struct order_plan *out,
+                     char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    const struct macho_section *sect = macho_image_section(img, "__TEXT", "__text");
+    if (!sect || sect->size == 0) {
+        snprintf(errbuf, errlen, "no __TEXT,__text section");
+        return -1;
+    }
+    if (page_size == 0) page_size = img->cputype == CPU_TYPE_ARM64 ? 0x4000 : 0x1000;
+    out->page_size = page_size;
+
+    uint64_t *starts = NULL;
+    size_t n = macho_image_functions_in(img, sect, &starts);
+    struct macho_symbol *syms = NULL;
+    size_t nsyms = macho_image_defined_symbols(img, &syms);
+    out->funcs = calloc(n ? n : 1, sizeof(*out->funcs));
+    out->hot = malloc((n ? n : 1) * sizeof(*out->hot));
+    if (!starts || !out->funcs || !out->hot) {
+        free(starts);
+        free(syms);
+        order_plan_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    uint64_t sect_end = sect->addr + sect->size;
+    for (size_t i = 0; i < n; i++) {
+        struct order_func *f = &out->funcs[i];
+        f->start = starts[i];
+        f->end = i + 1 < n ? starts[i + 1] : sect_end;
+        f->name = name_at(syms, nsyms, f->start);
+    }
+    out->nfuncs = n;
+    free(starts);
+    free(syms);
+
+    out->trace_pcs = npcs;
+    for (size_t i = 0; i < npcs; i++) {
+        size_t k = func_for(out->funcs, n, pcs[i]);
+        if (k == n) {
+            out->unmapped++;
+            continue;
+        }
+        struct order_func *f = &out->funcs[k];
+        if (f->hits++ == 0) {
+            f->first_hit = i;
+            out->hot[out->nhot++] = k;
+            out->hot_bytes += f->end - f->start;
+            if (!f->name) out->unnamed++;
+        }
+    }
+
+    int oom = 0;
+    out->pages_before = current_pages(out, 0, &oom);
+
+    // Packed layout: named hot functions back to back from the start of
+    // __text, each aligned as the section is. Functions without a symbol
+    // cannot be moved and keep the pages they span now.
+    uint64_t align = 1ull << (sect->align < 15 ? sect->align : 15);
+    uint64_t cursor = sect->addr;
+    uint64_t last = UINT64_MAX;
+    for (size_t i = 0; i < out->nhot; i++) {
+        const struct order_func *f = &out->funcs[out->hot[i]];
+        if (!f->name) continue;
+        cursor = (cursor + align - 1) & ~(align - 1);
+        uint64_t first = cursor / page_size;
+        cursor += f->end - f->start;
+        uint64_t end = (cursor - 1) / page_size;
+        out->pages_after += end - first + 1 - (first == last);
+        last = end;
+    }
+    out->pages_after += current_pages(out, 1, &oom);
+    if (oom) {
+        order_plan_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    return 0;
+}
+
+void order_plan_free(struct order_plan *p) {
+    free(p->funcs);
+    free(p->hot);
+    memset(p, 0, sizeof(*p));
+}
+
+void order_plan_write(const struct order_plan *p, FILE *out) {
+    for (size_t i = 0; i < p->nhot; i++) {
+        const struct order_func *f = &p->funcs[p->hot[i]];
+        if (f->name) {
+            fprintf(out, "%s\n", f->name);
+        } else {
+            fprintf(out, "# 0x%llx: no symbol, %llu bytes\n", (unsigned long long)f->start,
+                    (unsigned long long)(f->end - f->start));
+        }
+    }
+}
+
+void order_plan_report(const struct order_plan *p, FILE *out) {
+    fprintf(out, "trace: %llu pcs, %zu of %zu functions hit, %llu pcs outside __text\n",
+            (unsigned long long)p->trace_pcs, p->nhot, p->nfuncs,
+            (unsigned long long)p->unmapped);
+    fprintf(out, "hot code: %llu bytes (%zu functions without a symbol stay in place)\n",
+            (unsigned long long)p->hot_bytes, p->unnamed);
+    uint64_t saved = p->pages_before > p->pages_after ? p->pages_before - p->pages_after : 0;
+    fprintf(out, "pages touched (%llu KB): %llu now -> %llu ordered, %llu fewer faults (%.0f%%)\n",
+            (unsigned long long)(p->page_size / 1024), (unsigned long long)p->pages_before,
+            (unsigned long long)p->pages_after, (unsigned long long)saved,
+            p->pages_before ? 100.0 * (double)saved / (double)p->pages_before : 0.0);
+}
@@ -0,0 +1,60 @@
+#ifndef MACHO_ORDER_H
+#define MACHO_ORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "macho_image.h"
+
+// Linker order files from function-entry traces.
+//
+// A trace is a list of PCs (unslid), in the order functions were entered:
+// the log of prologue hooks installed with arm64_patch_prologue, a
+// sampling profiler, anything that yields addresses. Each PC is mapped to
+// the __TEXT,__text function containing it (LC_FUNCTION_STARTS, else the
+// symbol table) and named from the symbol table. The functions hit are
+// ordered by first hit, so code that runs early in startup is packed
+// together, and the order file lists them for ld -order_file.
+//
+// The plan also predicts the effect: the number of distinct pages the hit
+// functions span now, against the number they span once packed from the
+// start of __text with the section's alignment.
+
+struct order_func {
+    uint64_t start;
+    uint64_t end;
+    const char *name;          // NULL when no symbol starts here
+    uint64_t hits;
+    size_t first_hit;          // trace position of the first hit
+};
+
+struct order_plan {
+    struct order_func *funcs;  // every function of __text, by address
+    size_t nfuncs;
+    size_t *hot;               // indices into funcs, in first-hit order
+    size_t nhot;
+    size_t unnamed;            // hot functions without a symbol (cannot be ordered)
+    uint64_t trace_pcs;
+    uint64_t unmapped;         // PCs outside __text
+    uint64_t hot_bytes;
+    uint64_t page_size;
+    uint64_t pages_before;     // pages spanned by hot code in the current layout
+    uint64_t pages_after;      // ... once packed in first-hit order
+};
+
+// page_size 0 picks 16 KB for arm64 and 4 KB otherwise. Returns 0, or -1
+// with a reason (no __TEXT,__text, out of memory).
+int order_plan_build(const struct macho_image *img, const uint64_t *pcs, size_t npcs,
+                     uint64_t page_size, struct order_plan *out,
+                     char *errbuf, size_t errlen);
+void order_plan_free(struct order_plan *p);
+
+// One symbol per line in first-hit order; functions without a symbol are
+// listed as comments.
+void order_plan_write(const struct order_plan *p, FILE *out);
+
+// Counts and the page prediction.
+void order_plan_report(const struct order_plan *p, FILE *out);
+
+#endif /* MACHO_ORDER_H */
@@ -0,0 +1,92 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct par_job {
+    size_t n;
+    size_t grain;
+    atomic_size_t next;
+    par_fn fn;
+    void *ctx;
+};
+
+struct par_worker {
+    struct par_job *job;
+    unsigned index;
+    pthread_t tid;
+};
+
+unsigned par_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    if (n > 256) return 256;
+    return (unsigned)n;
+}
+
+static void par_drain(struct par_job *job, unsigned index) {
+    for (;;) {
+        size_t begin = atomic_fetch_add(&job->next, job->grain);
+        if (begin >= job->n) break;
+        size_t end = begin + job->grain;
+        if (end > job->n || end < begin) end = job->n;
+        job->fn(begin, end, index, job->ctx);
+    }
+}
+
+static void *par_thread_main(void *arg) {
+    struct par_worker *w = (struct par_worker *)arg;
+    par_drain(w->job, w->index);
+    return NULL;
+}
+
+int par_for(size_t n, size_t grain, unsigned nthreads, par_fn fn, void *ctx) {
+    if (n == 0) return 0;
+    if (grain == 0) grain = 1;
+    if (nthreads == 0) nthreads = par_default_threads();
+    size_t chunks = (n + grain - 1) / grain;
+    if ((size_t)nthreads > chunks) nthreads = (unsigned)chunks;
+
+    struct par_job job;
+    job.n = n;
+    job.grain = grain;
+    atomic_init(&job.next, 0);
+    job.fn = fn;
+    job.ctx = ctx;
+
+    if (nthreads <= 1) {
+        par_drain(&job, 0);
+        return 0;
+    }
+
+    struct par_worker *workers = calloc(nthreads, sizeof(*workers));
+    if (!workers) {
+        par_drain(&job, 0);
+        return -1;
+    }
+
+    // Worker 0 is the calling thread; spawn the rest.
+    int rc = 0;
+    unsigned started = 1;
+    for (unsigned i = 1; i < nthreads; i++) {
+        workers[i].job = &job;
+        workers[i].index = i;
+        if (pthread_create(&workers[i].tid, NULL, par_thread_main, &workers[i]) != 0) {
+            rc = -1;
+            break;
+        }
+        started++;
+    }
+
+    par_drain(&job, 0);
+
+    for (unsigned i = 1; i < started; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
+    free(workers);
+    return rc;
+}
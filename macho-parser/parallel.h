@@ -0,0 +1,24 @@
+#ifndef MACHO_PARALLEL_H
+#define MACHO_PARALLEL_H
+
+#include <stddef.h>
+
+// Minimal fork/join helper for the analysis passes.
+//
+// par_for splits [0, n) into chunks of `grain` items and hands them to
+// `nthreads` workers through a shared atomic cursor, so uneven work (one
+// huge function, one huge slice) does not leave cores idle. Each callback
+// gets the worker index so callers can keep per-worker output buffers and
+// merge them afterwards instead of locking.
+
+typedef void (*par_fn)(size_t begin, size_t end, unsigned worker, void *ctx);
+
+// Number of online CPUs (at least 1).
+unsigned par_default_threads(void);
+
+// Runs fn over [0, n). nthreads == 0 means par_default_threads().
+// Returns 0 on success, -1 if threads could not be created (the work is
+// then finished on the calling thread, so results are still complete).
+int par_for(size_t n, size_t grain, unsigned nthreads, par_fn fn, void *ctx);
+
+#endif /* MACHO_PARALLEL_H */
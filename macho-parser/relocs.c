@@ -0,0 +1,158 @@
+#include "relocs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/reloc.h"
+#include "../include/macho/arm64/reloc.h"
+#include "../include/macho/x86_64/reloc.h"
+
+#include "macho_common.h"
+
+static int host_big_endian(void) {
+    const uint16_t one = 1;
+    uint8_t b;
+    memcpy(&b, &one, 1);
+    return b == 0;
+}
+
+// Does the fixed-up location hold the addend (as opposed to an instruction
+// or nothing)? A SUBTRACTOR shares its location with the UNSIGNED that
+// follows it; the addend is reported once, on the UNSIGNED.
+static int addend_in_place(uint32_t cputype, uint8_t type) {
+    if (cputype == (uint32_t)CPU_TYPE_X86_64) return type != X86_64_RELOC_SUBTRACTOR;
+    if (cputype == (uint32_t)CPU_TYPE_ARM64) {
+        return type == ARM64_RELOC_UNSIGNED || type == ARM64_RELOC_POINTER_TO_GOT ||
+               type == ARM64_RELOC_AUTHENTICATED_POINTER;
+    }
+    return type == GENERIC_RELOC_VANILLA;
+}
+
+int macho_relocs(const struct macho_image *img, size_t sect, struct macho_reloc **out,
+                 size_t *n, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *n = 0;
+    if (sect >= img->nsects) {
+        snprintf(errbuf, errlen, "section index out of range");
+        return -1;
+    }
+    const struct macho_section *s = &img->sects[sect];
+    if (s->nreloc == 0) return 0;
+    if ((uint64_t)s->reloff + (uint64_t)s->nreloc * 8 > img->size) {
+        snprintf(errbuf, errlen, "(%s,%s): relocations out of bounds", s->segname, s->sectname);
+        return -1;
+    }
+    struct macho_reloc *v = calloc(s->nreloc, sizeof(*v));
+    if (!v) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    // Bitfields are allocated from the low bit on little-endian targets and
+    // from the high bit on big-endian ones.
+    int file_be = img->swapped ^ host_big_endian();
+    int modern = img->cputype == (uint32_t)CPU_TYPE_X86_64 ||
+                 img->cputype == (uint32_t)CPU_TYPE_ARM64;
+    const uint8_t *content = NULL;
+    if (s->offset && (uint64_t)s->offset + s->size <= img->size) content = img->buf + s->offset;
+
+    int64_t pending_addend = 0;
+    int have_pending = 0;
+    size_t k = 0;
+    const uint8_t *p = img->buf + s->reloff;
+    for (uint32_t i = 0; i < s->nreloc; i++, p += 8) {
+        uint32_t w0 = load32_u(p, img->swapped);
+        uint32_t w1 = load32_u(p + 4, img->swapped);
+        struct macho_reloc *r = &v[k];
+        memset(r, 0, sizeof(*r));
+
+        if ((w0 & R_SCATTERED) && !modern) {
+            // Same numeric layout in both byte orders.
+            r->scattered = 1;
+            r->address = w0 & 0xffffffu;
+            r->type = (uint8_t)((w0 >> 24) & 0xf);
+            r->length = (uint8_t)((w0 >> 28) & 3);
+            r->pcrel = (uint8_t)((w0 >> 30) & 1);
+            r->value = w1;
+        } else {
+            r->address = w0;
+            if (file_be) {
+                r->symbolnum = w1 >> 8;
+                r->pcrel = (uint8_t)((w1 >> 7) & 1);
+                r->length = (uint8_t)((w1 >> 5) & 3);
+                r->external = (uint8_t)((w1 >> 4) & 1);
+                r->type = (uint8_t)(w1 & 0xf);
+            } else {
+                r->symbolnum = w1 & 0xffffffu;
+                r->pcrel = (uint8_t)((w1 >> 24) & 1);
+                r->length = (uint8_t)((w1 >> 25) & 3);
+                r->external = (uint8_t)((w1 >> 27) & 1);
+                r->type = (uint8_t)(w1 >> 28);
+            }
+        }
+
+        if (img->cputype == (uint32_t)CPU_TYPE_ARM64 && !r->scattered &&
+            r->type == ARM64_RELOC_ADDEND) {
+            // 24-bit signed addend for the next PAGE21/PAGEOFF12.
+            pending_addend = (int64_t)(r->symbolnum & 0x7fffffu) -
+                             (int64_t)(r->symbolnum & 0x800000u);
+            have_pending = 1;
+            continue;
+        }
+
+        if (have_pending) {
+            r->addend = pending_addend;
+            have_pending = 0;
+        } else if (content && addend_in_place(img->cputype, r->type) &&
+                   r->address < s->size && (1u << r->length) <= s->size - r->address) {
+            const uint8_t *at = content + r->address;
+            switch (r->length) {
+                case 0: r->addend = (int8_t)at[0]; break;
+                case 1: r->addend = (int16_t)load16_u(at, img->swapped); break;
+                case 2: r->addend = (int32_t)load32_u(at, img->swapped); break;
+                default: r->addend = (int64_t)load64_u(at, img->swapped); break;
+            }
+            if (img->cputype == (uint32_t)CPU_TYPE_ARM64 &&
+                r->type == ARM64_RELOC_AUTHENTICATED_POINTER) {
+                r->addend = (int32_t)(uint32_t)r->addend;   // key/diversity above
+            }
+        }
+        k++;
+    }
+    if (k == 0) {
+        free(v);
+        v = NULL;
+    }
+    *out = v;
+    *n = k;
+    return 0;
+}
+
+const char *macho_reloc_type_name(uint32_t cputype, uint8_t type) {
+    if (cputype == (uint32_t)CPU_TYPE_ARM64) {
+        static const char *const names[] = {
+            "ARM64_RELOC_UNSIGNED", "ARM64_RELOC_SUBTRACTOR", "ARM64_RELOC_BRANCH26",
+            "ARM64_RELOC_PAGE21", "ARM64_RELOC_PAGEOFF12", "ARM64_RELOC_GOT_LOAD_PAGE21",
+            "ARM64_RELOC_GOT_LOAD_PAGEOFF12", "ARM64_RELOC_POINTER_TO_GOT",
+            "ARM64_RELOC_TLVP_LOAD_PAGE21", "ARM64_RELOC_TLVP_LOAD_PAGEOFF12",
+            "ARM64_RELOC_ADDEND", "ARM64_RELOC_AUTHENTICATED_POINTER",
+        };
+        return type < sizeof(names) / sizeof(names[0]) ? names[type] : "ARM64_RELOC_?";
+    }
+    if (cputype == (uint32_t)CPU_TYPE_X86_64) {
+        static const char *const names[] = {
+            "X86_64_RELOC_UNSIGNED", "X86_64_RELOC_SIGNED", "X86_64_RELOC_BRANCH",
+            "X86_64_RELOC_GOT_LOAD", "X86_64_RELOC_GOT", "X86_64_RELOC_SUBTRACTOR",
+            "X86_64_RELOC_SIGNED_1", "X86_64_RELOC_SIGNED_2", "X86_64_RELOC_SIGNED_4",
+            "X86_64_RELOC_TLV",
+        };
+        return type < sizeof(names) / sizeof(names[0]) ? names[type] : "X86_64_RELOC_?";
+    }
+    static const char *const names[] = {
+        "GENERIC_RELOC_VANILLA", "GENERIC_RELOC_PAIR", "GENERIC_RELOC_SECTDIFF",
+        "GENERIC_RELOC_PB_LA_PTR", "GENERIC_RELOC_LOCAL_SECTDIFF", "GENERIC_RELOC_TLV",
+    };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "GENERIC_RELOC_?";
+}
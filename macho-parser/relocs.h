@@ -0,0 +1,38 @@
+#ifndef MACHO_RELOCS_H
+#define MACHO_RELOCS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Section relocations of MH_OBJECT files (relocation_info, reloff/nreloc
+// in each section header).
+//
+// The on-disk entries are bitfields whose layout depends on the file's
+// byte order, so they are decoded by hand rather than through the struct.
+// Mach-O has no RELA: an addend lives either in the bytes being fixed up
+// (pointers, and everything on x86_64) or, for arm64 instruction fixups,
+// in a preceding ARM64_RELOC_ADDEND entry. Both are folded into `addend`.
+
+struct macho_reloc {
+    uint32_t address;      // offset into the section
+    uint32_t symbolnum;    // symbol index if external, else 1-based section ordinal
+    uint8_t type;          // per-CPU r_type
+    uint8_t length;        // log2 of the fixup width
+    uint8_t pcrel;
+    uint8_t external;
+    uint8_t scattered;     // 32-bit CPUs only; `value` is then r_value
+    int64_t addend;
+    uint32_t value;
+};
+
+// Relocations of img->sects[sect]. Returns 0 with a malloc'd array in *out
+// (NULL when there are none), -1 if the table is out of bounds.
+int macho_relocs(const struct macho_image *img, size_t sect, struct macho_reloc **out,
+                 size_t *n, char *errbuf, size_t errlen);
+
+// "ARM64_RELOC_PAGE21", "X86_64_RELOC_BRANCH", ... or "GENERIC_RELOC_*".
+const char *macho_reloc_type_name(uint32_t cputype, uint8_t type);
+
+#endif /* MACHO_RELOCS_H */
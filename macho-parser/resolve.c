@@ -0,0 +1,507 @@
+#define _XOPEN_SOURCE 700        // realpath
+
+#include "resolve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../include/macho/loader.h"
+
+#include "macho_common.h"
+#include "parallel.h"
+
+// Re-export chains deeper than this are treated as cycles.
+#define MAX_REEXPORT_DEPTH 32
+
+#define RESOLVE_PATH_MAX 4096
+
+void resolver_init(struct resolver *r, const char *sysroot, uint32_t cputype, unsigned jobs) {
+    memset(r, 0, sizeof(*r));
+    r->sysroot = sysroot && sysroot[0] ? sysroot : NULL;
+    r->cputype = cputype;
+    r->jobs = jobs;
+}
+
+static void free_image(struct resolver_image *im) {
+    free(im->deps);
+    macho_export_list_free(&im->exports);
+    free(im->imports);
+    macho_link_info_free(&im->link);
+    if (im->ok) macho_image_free(&im->img);
+    unmap_file(&im->mf);
+    free(im->path);
+    free(im);
+}
+
+void resolver_free(struct resolver *r) {
+    for (size_t i = 0; i < r->nimages; i++) free_image(r->images[i]);
+    free(r->images);
+    free(r->index);
+    memset(r, 0, sizeof(*r));
+}
+
+// Position of `path` in the sorted index, or where it would go.
+static size_t index_pos(const struct resolver *r, const char *path, int *found) {
+    size_t lo = 0;
+    size_t hi = r->nindex;
+    *found = 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(r->index[mid].path, path);
+        if (c == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Existing image for `real`, or a new unloaded one. Takes ownership of
+// `real`. Returns RESOLVER_NONE on allocation failure.
+static size_t intern(struct resolver *r, char *real, size_t loader, size_t root,
+                     unsigned depth, int *is_new) {
+    int found;
+    size_t pos = index_pos(r, real, &found);
+    *is_new = 0;
+    if (found) {
+        free(real);
+        return r->index[pos].index;
+    }
+    if (r->nimages == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 32;
+        struct resolver_image **v = realloc(r->images, cap * sizeof(*v));
+        if (!v) goto oom;
+        r->images = v;
+        struct resolver_key *k = realloc(r->index, cap * sizeof(*k));
+        if (!k) goto oom;
+        r->index = k;
+        r->cap = cap;
+    }
+    struct resolver_image *im = calloc(1, sizeof(*im));
+    if (!im) goto oom;
+    im->path = real;
+    im->loader = loader;
+    im->root = root;
+    im->depth = depth;
+    size_t idx = r->nimages++;
+    r->images[idx] = im;
+    memmove(&r->index[pos + 1], &r->index[pos], (r->nindex - pos) * sizeof(*r->index));
+    r->index[pos].path = real;
+    r->index[pos].index = idx;
+    r->nindex++;
+    *is_new = 1;
+    return idx;
+oom:
+    free(real);
+    return RESOLVER_NONE;
+}
+
+static char *existing_file(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+    return realpath(path, NULL);
+}
+
+// Length of the directory part of `path` ("." when there is none).
+static void dir_of(const char *path, const char **dir, int *len) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        *dir = ".";
+        *len = 1;
+    } else {
+        *dir = path;
+        *len = slash == path ? 1 : (int)(slash - path);
+    }
+}
+
+static int has_prefix(const char *s, const char *prefix, const char **rest) {
+    size_t n = strlen(prefix);
+    if (strncmp(s, prefix, n) != 0) return 0;
+    *rest = s + n;
+    return 1;
+}
+
+// Expand @executable_path/@loader_path (not @rpath) in `name`, as seen by
+// image `owner`; absolute paths get the sysroot. Returns 0 if it does not
+// fit in `out`.
+static int expand(const struct resolver *r, const struct resolver_image *owner,
+                  const char *name, char *out, size_t outlen) {
+    const char *rest;
+    const char *dir;
+    int dlen;
+    int n;
+    if (has_prefix(name, "@executable_path", &rest)) {
+        dir_of(r->images[owner->root]->path, &dir, &dlen);
+        n = snprintf(out, outlen, "%.*s%s", dlen, dir, rest);
+    } else if (has_prefix(name, "@loader_path", &rest)) {
+        dir_of(owner->path, &dir, &dlen);
+        n = snprintf(out, outlen, "%.*s%s", dlen, dir, rest);
+    } else if (name[0] == '/' && r->sysroot) {
+        n = snprintf(out, outlen, "%s%s", r->sysroot, name);
+    } else {
+        n = snprintf(out, outlen, "%s", name);
+    }
+    return n >= 0 && (size_t)n < outlen;
+}
+
+// Find the file dyld would load for dependency `name` of image `from`.
+// Returns a malloc'd real path, or NULL.
+static char *locate(const struct resolver *r, size_t from, const char *name) {
+    const struct resolver_image *im = r->images[from];
+    char buf[RESOLVE_PATH_MAX];
+    char rp[RESOLVE_PATH_MAX];
+    const char *rest;
+    if (has_prefix(name, "@rpath/", &rest)) {
+        // LC_RPATHs of the loading image, then of its loader, up to the
+        // executable; each is expanded relative to the image that carries it.
+        for (size_t cur = from; cur != RESOLVER_NONE; cur = r->images[cur]->loader) {
+            const struct resolver_image *owner = r->images[cur];
+            for (size_t i = 0; i < owner->link.nrpaths; i++) {
+                if (!expand(r, owner, owner->link.rpaths[i], rp, sizeof(rp))) continue;
+                int n = snprintf(buf, sizeof(buf), "%s/%s", rp, rest);
+                if (n < 0 || (size_t)n >= sizeof(buf)) continue;
+                char *real = existing_file(buf);
+                if (real) return real;
+            }
+        }
+        return NULL;
+    }
+    if (expand(r, im, name, buf, sizeof(buf))) {
+        char *real = existing_file(buf);
+        if (real) return real;
+    }
+    if (strchr(name, '/') == NULL) {
+        // Leaf name: dyld's fallback library path.
+        static const char *const fallback[] = { "/usr/local/lib", "/usr/lib" };
+        for (size_t i = 0; i < sizeof(fallback) / sizeof(fallback[0]); i++) {
+            int n = snprintf(buf, sizeof(buf), "%s%s/%s", r->sysroot ? r->sysroot : "",
+                             fallback[i], name);
+            if (n < 0 || (size_t)n >= sizeof(buf)) continue;
+            char *real = existing_file(buf);
+            if (real) return real;
+        }
+    }
+    return NULL;
+}
+
+struct load_job {
+    struct resolver *r;
+    size_t first;                  // images [first, first + n) are this level
+};
+
+static void load_one(struct resolver *r, struct resolver_image *im) {
+    char *err = im->err;
+    size_t errlen = sizeof(im->err);
+    if (map_file(im->path, &im->mf, err, errlen) != 0) return;
+    uint64_t off = 0;
+    uint64_t size = 0;
+    if (macho_select_slice(im->mf.data, im->mf.size, -1, r->cputype, &off, &size,
+                           err, errlen) != 0) {
+        return;
+    }
+    if (r->cputype) {
+        // Thin files are returned whole whatever their CPU; a dylib of
+        // another architecture cannot be loaded into the executable.
+        uint32_t cpu = 0;
+        if (size >= 8) memcpy(&cpu, im->mf.data + off + 4, 4);
+        if (cpu != r->cputype && bswap32_u(cpu) != r->cputype) {
+            snprintf(err, errlen, "no slice for the executable's architecture");
+            return;
+        }
+    }
+    if (macho_image_load(&im->img, im->mf.data + off, (size_t)size, err, errlen) != 0) return;
+    im->ok = 1;
+    if (macho_link_info(&im->img, &im->link, err, errlen) != 0 ||
+        macho_imports(&im->img, &im->imports, &im->nimports, err, errlen) != 0 ||
+        macho_exports(&im->img, &im->exports, err, errlen) != 0) {
+        im->ok = 0;
+        macho_image_free(&im->img);
+        return;
+    }
+    im->deps = malloc((im->link.ndylibs ? im->link.ndylibs : 1) * sizeof(*im->deps));
+    if (!im->deps) {
+        snprintf(err, errlen, "out of memory");
+        im->ok = 0;
+        macho_image_free(&im->img);
+        return;
+    }
+    for (size_t i = 0; i < im->link.ndylibs; i++) im->deps[i] = RESOLVER_NONE;
+}
+
+static void load_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct load_job *job = ctx;
+    for (size_t i = begin; i < end; i++) load_one(job->r, job->r->images[job->first + i]);
+}
+
+size_t resolver_load(struct resolver *r, const char *path, char *errbuf, size_t errlen) {
+    char *real = existing_file(path);
+    if (!real) {
+        snprintf(errbuf, errlen, "%s: not found", path);
+        return RESOLVER_NONE;
+    }
+    int is_new;
+    size_t root = intern(r, real, RESOLVER_NONE, r->nimages, 0, &is_new);
+    if (root == RESOLVER_NONE) {
+        snprintf(errbuf, errlen, "out of memory");
+        return RESOLVER_NONE;
+    }
+    if (!is_new) {
+        if (!r->images[root]->ok) {
+            snprintf(errbuf, errlen, "%s: %s", path, r->images[root]->err);
+            return RESOLVER_NONE;
+        }
+        return root;
+    }
+    struct resolver_image *im = r->images[root];
+    load_one(r, im);
+    if (!im->ok) {
+        snprintf(errbuf, errlen, "%s: %s", path, im->err);
+        return RESOLVER_NONE;
+    }
+    if (!r->cputype) r->cputype = im->img.cputype;
+
+    // Breadth-first: locate the next level's files (cheap, serial), then
+    // map and index them (the expensive part) in parallel.
+    size_t level_begin = root;
+    size_t level_end = root + 1;
+    for (unsigned depth = 1; level_begin < level_end; depth++) {
+        size_t next_begin = r->nimages;
+        for (size_t i = level_begin; i < level_end; i++) {
+            struct resolver_image *from = r->images[i];
+            if (!from->ok) continue;
+            for (size_t k = 0; k < from->link.ndylibs; k++) {
+                char *found = locate(r, i, from->link.dylibs[k].name);
+                if (!found) continue;
+                size_t dep = intern(r, found, i, root, depth, &is_new);
+                from = r->images[i];
+                from->deps[k] = dep;
+            }
+        }
+        struct load_job job = { r, next_begin };
+        par_for(r->nimages - next_begin, 1, r->jobs, load_worker, &job);
+        level_begin = next_begin;
+        level_end = r->nimages;
+    }
+    return root;
+}
+
+size_t resolver_closure(const struct resolver *r, size_t root, size_t **out) {
+    size_t *order = malloc(r->nimages * sizeof(*order));
+    uint8_t *seen = calloc(r->nimages, 1);
+    size_t n = 0;
+    if (!order || !seen) {
+        free(order);
+        free(seen);
+        *out = NULL;
+        return 0;
+    }
+    order[n++] = root;
+    seen[root] = 1;
+    for (size_t i = 0; i < n; i++) {
+        const struct resolver_image *im = r->images[order[i]];
+        if (!im->ok) continue;
+        for (size_t k = 0; k < im->link.ndylibs; k++) {
+            size_t d = im->deps[k];
+            if (d == RESOLVER_NONE || seen[d]) continue;
+            seen[d] = 1;
+            order[n++] = d;
+        }
+    }
+    free(seen);
+    *out = order;
+    return n;
+}
+
+// Symbol `name` as exported by image `lib`: its own exports (following
+// re-export entries to the library they name), then the libraries it
+// re-exports with LC_REEXPORT_DYLIB.
+static int lookup(const struct resolver *r, size_t lib, const char *name, unsigned depth,
+                  size_t *provider, const struct macho_export **exp) {
+    if (lib == RESOLVER_NONE || depth > MAX_REEXPORT_DEPTH) return 0;
+    const struct resolver_image *im = r->images[lib];
+    if (!im->ok) return 0;
+    const struct macho_export *e = macho_export_find(&im->exports, name);
+    if (e) {
+        if (!(e->flags & EXPORT_SYMBOL_FLAGS_REEXPORT)) {
+            *provider = lib;
+            *exp = e;
+            return 1;
+        }
+        uint32_t ord = e->reexport_ordinal;
+        if (ord < 1 || ord > im->link.ndylibs) return 0;
+        return lookup(r, im->deps[ord - 1], e->import_name ? e->import_name : name,
+                      depth + 1, provider, exp);
+    }
+    for (size_t k = 0; k < im->link.ndylibs; k++) {
+        if (im->link.dylibs[k].kind != DYLIB_REEXPORT) continue;
+        if (lookup(r, im->deps[k], name, depth + 1, provider, exp)) return 1;
+    }
+    return 0;
+}
+
+size_t resolver_bind(const struct resolver *r, size_t idx, struct resolved_import **out) {
+    const struct resolver_image *im = r->images[idx];
+    struct resolved_import *v = calloc(im->nimports ? im->nimports : 1, sizeof(*v));
+    *out = v;
+    if (!v) return im->nimports;
+    size_t *order = NULL;
+    size_t norder = 0;
+    int two_level = (im->img.flags & MH_TWOLEVEL) != 0;
+    size_t unresolved = 0;
+
+    for (size_t i = 0; i < im->nimports; i++) {
+        const struct macho_import *imp = &im->imports[i];
+        struct resolved_import *ri = &v[i];
+        ri->imp = imp;
+        ri->library = RESOLVER_NONE;
+        ri->provider = RESOLVER_NONE;
+        int32_t ord = two_level ? imp->ordinal : BIND_SPECIAL_DYLIB_FLAT_LOOKUP;
+        int weak = imp->weak_import;
+        int found = 0;
+        if (ord >= 1) {
+            if ((size_t)ord <= im->link.ndylibs) {
+                ri->library = im->deps[ord - 1];
+                if (im->link.dylibs[ord - 1].kind == DYLIB_WEAK) weak = 1;
+            }
+            if (ri->library == RESOLVER_NONE || !r->images[ri->library]->ok) {
+                ri->status = weak ? RESOLVE_WEAK_MISSING : RESOLVE_NO_LIBRARY;
+                unresolved += !weak;
+                continue;
+            }
+            found = lookup(r, ri->library, imp->name, 0, &ri->provider, &ri->exp);
+        } else if (ord == BIND_SPECIAL_DYLIB_SELF) {
+            ri->library = idx;
+            found = lookup(r, idx, imp->name, 0, &ri->provider, &ri->exp);
+        } else if (ord == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE) {
+            ri->library = im->root;
+            found = lookup(r, im->root, imp->name, 0, &ri->provider, &ri->exp);
+        } else {
+            // Flat and weak lookups: every image of the closure in load order.
+            if (!order) norder = resolver_closure(r, im->root, &order);
+            for (size_t j = 0; j < norder && !found; j++) {
+                found = lookup(r, order[j], imp->name, 0, &ri->provider, &ri->exp);
+            }
+            // A weak-def lookup that finds nothing keeps the image's own copy.
+            if (ord == BIND_SPECIAL_DYLIB_WEAK_LOOKUP) weak = 1;
+        }
+        if (found) {
+            ri->status = RESOLVE_BOUND;
+        } else {
+            ri->status = weak ? RESOLVE_WEAK_MISSING : RESOLVE_NO_SYMBOL;
+            unresolved += !weak;
+        }
+    }
+    free(order);
+    return unresolved;
+}
+
+const char *resolve_status_name(enum resolve_status s) {
+    switch (s) {
+        case RESOLVE_BOUND: return "bound";
+        case RESOLVE_WEAK_MISSING: return "weak-missing";
+        case RESOLVE_NO_LIBRARY: return "no-library";
+        case RESOLVE_NO_SYMBOL: return "no-symbol";
+    }
+    return "?";
+}
+
+static const char *dylib_kind_name(enum macho_dylib_kind k) {
+    switch (k) {
+        case DYLIB_LOAD: return "";
+        case DYLIB_WEAK: return " (weak)";
+        case DYLIB_REEXPORT: return " (re-export)";
+        case DYLIB_UPWARD: return " (upward)";
+        case DYLIB_LAZY: return " (lazy)";
+    }
+    return "";
+}
+
+// Where an import's ordinal points, for display.
+static void ordinal_label(const struct resolver_image *im, int32_t ord, char *out, size_t len) {
+    if (ord >= 1 && (size_t)ord <= im->link.ndylibs) {
+        const char *name = im->link.dylibs[ord - 1].name;
+        const char *slash = strrchr(name, '/');
+        snprintf(out, len, "%s", slash ? slash + 1 : name);
+    } else if (ord >= 1) {
+        snprintf(out, len, "ordinal %d?", ord);
+    } else {
+        snprintf(out, len, "%s", ord == BIND_SPECIAL_DYLIB_SELF ? "self" :
+                                 ord == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE ? "main" :
+                                 ord == BIND_SPECIAL_DYLIB_FLAT_LOOKUP ? "flat" :
+                                 ord == BIND_SPECIAL_DYLIB_WEAK_LOOKUP ? "weak" : "?");
+    }
+}
+
+size_t resolver_print(const struct resolver *r, size_t idx, int list_only) {
+    size_t *order = NULL;
+    size_t n = resolver_closure(r, idx, &order);
+    size_t missing_libs = 0;
+    printf("== closure of %s: %zu images ==\n", r->images[idx]->path, n);
+    for (size_t j = 0; j < n; j++) {
+        const struct resolver_image *im = r->images[order[j]];
+        if (!list_only || !im->ok) {
+            printf("  [%zu] %s", order[j], im->path);
+            if (!im->ok) printf("  ERROR: %s", im->err);
+            else if (im->link.install_name) printf("  (%s)", im->link.install_name);
+            printf("\n");
+        }
+        if (!im->ok) {
+            missing_libs++;
+            continue;
+        }
+        for (size_t k = 0; k < im->link.ndylibs; k++) {
+            const struct macho_dylib *d = &im->link.dylibs[k];
+            if (im->deps[k] == RESOLVER_NONE) {
+                missing_libs += d->kind != DYLIB_WEAK;
+                if (list_only) printf("  [%zu] %s needs\n", order[j], im->path);
+                printf("      %u: %s%s  NOT FOUND\n", (unsigned)k + 1, d->name,
+                       dylib_kind_name(d->kind));
+            } else if (!list_only) {
+                printf("      %u: %s%s -> [%zu]\n", (unsigned)k + 1, d->name,
+                       dylib_kind_name(d->kind), im->deps[k]);
+            }
+        }
+    }
+    free(order);
+
+    const struct resolver_image *im = r->images[idx];
+    struct resolved_import *v = NULL;
+    size_t unresolved = resolver_bind(r, idx, &v);
+    size_t counts[4] = { 0, 0, 0, 0 };
+    for (size_t i = 0; v && i < im->nimports; i++) counts[v[i].status]++;
+    printf("== imports: %zu (bound %zu, weak-missing %zu, no-library %zu, no-symbol %zu); "
+           "missing libraries: %zu ==\n", im->nimports, counts[RESOLVE_BOUND],
+           counts[RESOLVE_WEAK_MISSING], counts[RESOLVE_NO_LIBRARY], counts[RESOLVE_NO_SYMBOL],
+           missing_libs);
+    for (size_t i = 0; v && i < im->nimports; i++) {
+        const struct resolved_import *ri = &v[i];
+        if (list_only && ri->status == RESOLVE_BOUND) continue;
+        char label[96];
+        ordinal_label(im, ri->imp->ordinal, label, sizeof(label));
+        printf("  %-40s %-24s %s", ri->imp->name, label, resolve_status_name(ri->status));
+        if (ri->status == RESOLVE_BOUND) {
+            const struct resolver_image *p = r->images[ri->provider];
+            printf("  [%zu]+0x%llx", ri->provider, (unsigned long long)ri->exp->address);
+            if (ri->library != RESOLVER_NONE && ri->provider != ri->library) {
+                const char *slash = strrchr(p->path, '/');
+                printf(" via %s", slash ? slash + 1 : p->path);
+            }
+            if (ri->exp->flags & EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION) printf(" weak-def");
+            if (ri->exp->flags & EXPORT_SYMBOL_FLAGS_STUB_AND_RESOLVER) printf(" resolver");
+            if ((ri->exp->flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) ==
+                EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL) {
+                printf(" tlv");
+            }
+        }
+        if (ri->imp->weak_import) printf(" weak-import");
+        if (ri->imp->lazy) printf(" lazy");
+        printf("\n");
+    }
+    free(v);
+    return unresolved + missing_libs;
+}
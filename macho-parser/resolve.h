@@ -0,0 +1,101 @@
+#ifndef MACHO_RESOLVE_H
+#define MACHO_RESOLVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "corpus.h"
+#include "dyld_info.h"
+#include "macho_image.h"
+
+// Two-level namespace import resolution over an executable's dylib closure.
+//
+// resolver_load maps the executable, then every library it loads, level by
+// level, the way dyld finds them: @executable_path, @loader_path and
+// @rpath (LC_RPATHs of the whole loader chain) are expanded, absolute
+// install names are looked up under the sysroot. Each level's images are
+// mapped and indexed (load commands, imports, export trie) in parallel.
+// Images are memoized by real path, so loading a second executable into
+// the same resolver only reads the libraries it does not share.
+//
+// resolver_bind then binds each import to the image that exports it:
+// library ordinal, export-trie re-exports and LC_REEXPORT_DYLIB umbrellas,
+// flat and main-executable lookups, weak imports and weak libraries.
+
+#define RESOLVER_NONE ((size_t)-1)
+
+struct resolver_image {
+    char *path;                    // real path on disk
+    size_t loader;                 // image that first loaded it (RESOLVER_NONE for roots)
+    size_t root;                   // executable whose closure it was loaded into
+    unsigned depth;
+    int ok;                        // mapped and parsed
+    char err[160];
+    struct mapped_file mf;
+    struct macho_image img;
+    struct macho_link_info link;
+    struct macho_import *imports;
+    size_t nimports;
+    struct macho_export_list exports;
+    size_t *deps;                  // [link.ndylibs]: image index or RESOLVER_NONE
+};
+
+struct resolver_key {
+    const char *path;
+    size_t index;
+};
+
+struct resolver {
+    const char *sysroot;           // prefix for absolute install names, or NULL
+    uint32_t cputype;              // slice to load; 0 = taken from the first root
+    unsigned jobs;
+    struct resolver_image **images;
+    size_t nimages;
+    size_t cap;
+    struct resolver_key *index;    // sorted by path
+    size_t nindex;
+};
+
+enum resolve_status {
+    RESOLVE_BOUND,
+    RESOLVE_WEAK_MISSING,          // weak import or weak library: binds to 0
+    RESOLVE_NO_LIBRARY,            // ordinal names a library that was not found
+    RESOLVE_NO_SYMBOL,             // library found, symbol not exported
+};
+
+struct resolved_import {
+    const struct macho_import *imp;
+    enum resolve_status status;
+    size_t library;                // image the ordinal names (RESOLVER_NONE if flat)
+    size_t provider;               // image that defines the symbol
+    const struct macho_export *exp;
+};
+
+void resolver_init(struct resolver *r, const char *sysroot, uint32_t cputype, unsigned jobs);
+void resolver_free(struct resolver *r);
+
+// Load `path` and its closure. Returns the image index, or RESOLVER_NONE
+// with a reason in errbuf if `path` itself cannot be loaded. Libraries that
+// are missing or malformed do not fail the load; they show up as
+// RESOLVER_NONE deps or as images with ok == 0.
+size_t resolver_load(struct resolver *r, const char *path, char *errbuf, size_t errlen);
+
+// Bind every import of image `idx`. *out is malloc'd, one entry per import
+// in the image's import order. Returns the number of non-weak imports left
+// unresolved.
+size_t resolver_bind(const struct resolver *r, size_t idx, struct resolved_import **out);
+
+// Images reachable from root `idx` in load order (breadth-first over the
+// dependencies), `idx` first. Returns the count; *out is malloc'd.
+size_t resolver_closure(const struct resolver *r, size_t idx, size_t **out);
+
+// "bound", "weak-missing", ...
+const char *resolve_status_name(enum resolve_status s);
+
+// Closure of root `idx` (each image with its dependencies), then its
+// bindings; with list_only only the summary, missing libraries and
+// unresolved imports. Returns the number of problems: non-weak imports left
+// unresolved plus non-weak libraries that could not be loaded.
+size_t resolver_print(const struct resolver *r, size_t idx, int list_only);
+
+#endif /* MACHO_RESOLVE_H */
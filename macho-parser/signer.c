@@ -0,0 +1,299 @@
+#include "signer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/kern/cs_blobs.h"
+#include "../include/macho/loader.h"
+
+#include "codesign.h"
+#include "digest.h"
+#include "macho_common.h"
+#include "macho_image.h"
+#include "parallel.h"
+#include "universal.h"
+
+#define SIGN_PAGE_SHIFT 12
+#define SIGN_PAGE_SIZE  (1u << SIGN_PAGE_SHIFT)
+#define SIGN_HASH_SIZE  CS_SHA256_LEN
+
+// CodeDirectory header through execSegFlags (0x20400) / preEncryptOffset (0x20500).
+#define CD_SIZE_EXECSEG 88
+#define CD_SIZE_RUNTIME 96
+
+// Flags an ad-hoc re-sign carries over from the old CodeDirectory.
+#define CS_KEEP_FLAGS (CS_HARD | CS_KILL | CS_CHECK_EXPIRATION | CS_RESTRICT | \
+                       CS_ENFORCEMENT | CS_REQUIRE_LV | CS_RUNTIME)
+
+static uint64_t align_up(uint64_t x, uint64_t a) {
+    return (x + a - 1) & ~(a - 1);
+}
+
+struct hash_job {
+    const uint8_t *buf;
+    uint64_t limit;
+    uint8_t *slots;
+};
+
+static void hash_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct hash_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        uint64_t off = (uint64_t)i * SIGN_PAGE_SIZE;
+        uint64_t n = job->limit - off;
+        if (n > SIGN_PAGE_SIZE) n = SIGN_PAGE_SIZE;
+        digest_sha256(job->buf + off, (size_t)n, job->slots + i * SIGN_HASH_SIZE);
+    }
+}
+
+struct sb_entry {
+    uint32_t slot;
+    const uint8_t *data;    // NULL for the CodeDirectory (built in place)
+    uint32_t length;
+};
+
+int cs_sign_slice(const uint8_t *in, size_t in_size, const struct sign_opts *opts,
+                  const char *default_ident, uint8_t **out, size_t *out_size,
+                  char *errbuf, size_t errlen) {
+    *out = NULL;
+    *out_size = 0;
+
+    struct macho_image img;
+    if (macho_image_load(&img, in, in_size, errbuf, errlen) != 0) return -1;
+    int sw = img.swapped;
+
+    struct cs_signature old;
+    char oerr[128];
+    int have_old = cs_parse(&img, &old, oerr, sizeof(oerr)) == 0;
+    const struct cs_code_directory *ocd = have_old ? &old.cds[0] : NULL;
+
+    int rc = -1;
+    uint8_t *o = NULL;
+
+    uint32_t linkedit_lc = macho_image_segment_cmd(&img, "__LINKEDIT");
+    const struct segment_map *linkedit = macho_image_segment(&img, "__LINKEDIT");
+    const struct segment_map *text = macho_image_segment(&img, "__TEXT");
+    if (!linkedit_lc || !linkedit || !text) {
+        snprintf(errbuf, errlen, "no __TEXT/__LINKEDIT segment");
+        goto done;
+    }
+
+    // Where the signature goes: the old slot, or 16-aligned after __LINKEDIT
+    // with a new load command in the header padding.
+    size_t iter = 0;
+    const struct macho_lc_ref *cs_lc = macho_image_next_cmd(&img, LC_CODE_SIGNATURE, &iter);
+    uint64_t dataoff;
+    if (cs_lc) {
+        dataoff = load32_u(in + cs_lc->offset + 8, sw);
+    } else {
+        uint64_t cmds_end = (uint64_t)img.header_size + img.sizeofcmds;
+        if (cmds_end + sizeof(struct linkedit_data_command) > macho_image_header_limit(&img)) {
+            snprintf(errbuf, errlen, "no header padding for LC_CODE_SIGNATURE");
+            goto done;
+        }
+        dataoff = align_up(linkedit->fileoff + linkedit->filesize, 16);
+    }
+    if (dataoff < linkedit->fileoff || dataoff > UINT32_MAX) {
+        snprintf(errbuf, errlen, "code signature offset 0x%llx outside __LINKEDIT",
+                 (unsigned long long)dataoff);
+        goto done;
+    }
+
+    // Blobs carried over or synthesized.
+    static const uint8_t empty_requirements[12] = {
+        0xfa, 0xde, 0x0c, 0x01, 0, 0, 0, 12, 0, 0, 0, 0
+    };
+    static const uint8_t empty_cms[8] = { 0xfa, 0xde, 0x0b, 0x01, 0, 0, 0, 8 };
+    const struct cs_blob_ref *ents = NULL;
+    const struct cs_blob_ref *der = NULL;
+    if (have_old && !opts->drop_entitlements) {
+        ents = old.entitlements;
+        der = old.der_entitlements;
+    }
+
+    struct sb_entry blobs[5];
+    size_t nblobs = 0;
+    blobs[nblobs++] = (struct sb_entry){ CSSLOT_CODEDIRECTORY, NULL, 0 };
+    blobs[nblobs++] = (struct sb_entry){ CSSLOT_REQUIREMENTS, empty_requirements,
+                                         sizeof(empty_requirements) };
+    if (ents) blobs[nblobs++] = (struct sb_entry){ CSSLOT_ENTITLEMENTS, ents->data, ents->length };
+    if (der) blobs[nblobs++] = (struct sb_entry){ CSSLOT_DER_ENTITLEMENTS, der->data, der->length };
+    blobs[nblobs++] = (struct sb_entry){ CSSLOT_SIGNATURESLOT, empty_cms, sizeof(empty_cms) };
+
+    const char *ident = opts->ident;
+    if (!ident && ocd && ocd->ident) ident = ocd->ident;
+    if (!ident) ident = default_ident ? default_ident : "a.out";
+
+    uint32_t flags = CS_ADHOC | (ocd ? (ocd->flags & CS_KEEP_FLAGS) : 0);
+    int with_runtime = (flags & CS_RUNTIME) != 0;
+    uint32_t cd_hdr = with_runtime ? CD_SIZE_RUNTIME : CD_SIZE_EXECSEG;
+    uint32_t n_special = der ? CSSLOT_DER_ENTITLEMENTS
+                             : ents ? CSSLOT_ENTITLEMENTS : CSSLOT_REQUIREMENTS;
+    uint64_t n_code = (dataoff + SIGN_PAGE_SIZE - 1) / SIGN_PAGE_SIZE;
+    size_t ident_len = strlen(ident) + 1;
+    uint32_t hash_offset = (uint32_t)(cd_hdr + ident_len + (size_t)n_special * SIGN_HASH_SIZE);
+    uint64_t cd_len = hash_offset + n_code * SIGN_HASH_SIZE;
+
+    uint64_t sb_len = 12 + 8 * (uint64_t)nblobs + cd_len;
+    for (size_t i = 1; i < nblobs; i++) sb_len += blobs[i].length;
+    uint64_t datasize = align_up(sb_len, 16);
+    uint64_t new_size = dataoff + datasize;
+    if (sb_len > UINT32_MAX || new_size > SIZE_MAX) {
+        snprintf(errbuf, errlen, "signature too large");
+        goto done;
+    }
+
+    o = calloc(1, (size_t)new_size);
+    if (!o) {
+        snprintf(errbuf, errlen, "out of memory");
+        goto done;
+    }
+    memcpy(o, in, (size_t)(dataoff < in_size ? dataoff : in_size));
+
+    // Header and load commands first: they are inside the hashed range.
+    if (cs_lc) {
+        store32_u(o + cs_lc->offset + 12, (uint32_t)datasize, sw);
+    } else {
+        uint8_t *lc = o + img.header_size + img.sizeofcmds;
+        store32_u(lc, LC_CODE_SIGNATURE, sw);
+        store32_u(lc + 4, sizeof(struct linkedit_data_command), sw);
+        store32_u(lc + 8, (uint32_t)dataoff, sw);
+        store32_u(lc + 12, (uint32_t)datasize, sw);
+        store32_u(o + 16, img.ncmds + 1, sw);
+        store32_u(o + 20, img.sizeofcmds + (uint32_t)sizeof(struct linkedit_data_command), sw);
+    }
+    uint64_t le_filesize = new_size - linkedit->fileoff;
+    uint64_t page = img.cputype == (uint32_t)CPU_TYPE_ARM64 ? 0x4000 : 0x1000;
+    uint64_t le_vmsize = align_up(le_filesize, page);
+    if (le_vmsize < linkedit->vmsize) le_vmsize = linkedit->vmsize;
+    if (img.is64) {
+        store64_u(o + linkedit_lc + 32, le_vmsize, sw);
+        store64_u(o + linkedit_lc + 48, le_filesize, sw);
+    } else {
+        store32_u(o + linkedit_lc + 28, (uint32_t)le_vmsize, sw);
+        store32_u(o + linkedit_lc + 36, (uint32_t)le_filesize, sw);
+    }
+
+    // SuperBlob: index, then blobs in index order.
+    uint8_t *sb = o + dataoff;
+    store32_be(sb, CSMAGIC_EMBEDDED_SIGNATURE);
+    store32_be(sb + 4, (uint32_t)sb_len);
+    store32_be(sb + 8, (uint32_t)nblobs);
+    uint64_t pos = 12 + 8 * (uint64_t)nblobs;
+    uint8_t *cd = NULL;
+    for (size_t i = 0; i < nblobs; i++) {
+        store32_be(sb + 12 + i * 8, blobs[i].slot);
+        store32_be(sb + 16 + i * 8, (uint32_t)pos);
+        if (blobs[i].data) {
+            memcpy(sb + pos, blobs[i].data, blobs[i].length);
+            pos += blobs[i].length;
+        } else {
+            cd = sb + pos;
+            pos += cd_len;
+        }
+    }
+
+    store32_be(cd, CSMAGIC_CODEDIRECTORY);
+    store32_be(cd + 4, (uint32_t)cd_len);
+    store32_be(cd + 8, with_runtime ? CS_SUPPORTSRUNTIME : CS_SUPPORTSEXECSEG);
+    store32_be(cd + 12, flags);
+    store32_be(cd + 16, hash_offset);
+    store32_be(cd + 20, cd_hdr);
+    store32_be(cd + 24, n_special);
+    store32_be(cd + 28, (uint32_t)n_code);
+    store32_be(cd + 32, (uint32_t)dataoff);
+    cd[36] = SIGN_HASH_SIZE;
+    cd[37] = CS_HASHTYPE_SHA256;
+    cd[38] = 0;
+    cd[39] = SIGN_PAGE_SHIFT;
+    // spare2, scatterOffset, teamOffset, spare3, codeLimit64 stay zero.
+    store64_be(cd + 64, text->fileoff);
+    store64_be(cd + 72, text->filesize);
+    uint64_t exec_flags = ocd ? ocd->exec_seg_flags
+                              : (img.filetype == MH_EXECUTE ? CS_EXECSEG_MAIN_BINARY : 0);
+    store64_be(cd + 80, exec_flags);
+    if (with_runtime) {
+        store32_be(cd + 88, ocd->runtime);
+        store32_be(cd + 92, 0);
+    }
+    memcpy(cd + cd_hdr, ident, ident_len);
+
+    // Special slots count down from hashOffset; unused ones stay zero.
+    uint8_t *slots = cd + hash_offset;
+    for (size_t i = 1; i < nblobs; i++) {
+        uint32_t slot = blobs[i].slot;
+        if (slot > n_special) continue;
+        const uint8_t *b = sb + load32_be(sb + 16 + i * 8);
+        digest_sha256(b, load32_be(b + 4), slots - (size_t)slot * SIGN_HASH_SIZE);
+    }
+
+    struct hash_job job = { o, dataoff, slots };
+    par_for((size_t)n_code, 64, opts->jobs, hash_worker, &job);
+
+    *out = o;
+    *out_size = (size_t)new_size;
+    o = NULL;
+    rc = 0;
+
+done:
+    free(o);
+    if (have_old) cs_free(&old);
+    macho_image_free(&img);
+    return rc;
+}
+
+int cs_sign_buffer(const uint8_t *in, size_t in_size, const struct sign_opts *opts,
+                   const char *default_ident, uint8_t **out, size_t *out_size,
+                   char *errbuf, size_t errlen) {
+    *out = NULL;
+    *out_size = 0;
+
+    struct fat_slice *slices = NULL;
+    size_t n = 0;
+    int is_fat = 0;
+    int is64 = 0;
+    if (universal_read(in, in_size, &slices, &n, &is_fat, &is64, errbuf, errlen) != 0) {
+        return -1;
+    }
+    if (!is_fat) {
+        free(slices);
+        return cs_sign_slice(in, in_size, opts, default_ident, out, out_size, errbuf, errlen);
+    }
+
+    uint8_t **signed_slices = calloc(n, sizeof(*signed_slices));
+    if (!signed_slices) {
+        free(slices);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < n && rc == 0; i++) {
+        size_t sz = 0;
+        rc = cs_sign_slice(in + slices[i].offset, (size_t)slices[i].size, opts,
+                           default_ident, &signed_slices[i], &sz, errbuf, errlen);
+        slices[i].size = sz;
+    }
+
+    if (rc == 0) {
+        int fat64 = 0;
+        uint64_t total = universal_layout(slices, n, is64, &fat64);
+        uint8_t *o = (total <= SIZE_MAX) ? calloc(1, (size_t)total) : NULL;
+        if (!o) {
+            snprintf(errbuf, errlen, "out of memory");
+            rc = -1;
+        } else {
+            universal_write_header(slices, n, fat64, o);
+            for (size_t i = 0; i < n; i++) {
+                memcpy(o + slices[i].offset, signed_slices[i], (size_t)slices[i].size);
+            }
+            *out = o;
+            *out_size = (size_t)total;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) free(signed_slices[i]);
+    free(signed_slices);
+    free(slices);
+    return rc;
+}
@@ -0,0 +1,33 @@
+#ifndef MACHO_SIGNER_H
+#define MACHO_SIGNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ad-hoc re-signing (the equivalent of `codesign -f -s -`).
+//
+// Any offline edit (patched bytes, an extra load command) breaks the page
+// hashes, and on arm64 macOS/iOS the kernel refuses to map the result. The
+// signer replaces LC_CODE_SIGNATURE with a fresh SuperBlob: a SHA-256
+// CodeDirectory over 4 KiB pages, an empty requirements set, the old
+// entitlements (XML and DER, copied verbatim) and an empty CMS wrapper.
+// The identifier and execSeg/runtime settings of the old signature are kept.
+
+struct sign_opts {
+    const char *ident;          // NULL: old identifier, else default_ident
+    int drop_entitlements;
+    unsigned jobs;              // 0 = all CPUs
+};
+
+// Re-sign one thin slice. On success *out is a new malloc'd slice (its size
+// usually differs from in_size).
+int cs_sign_slice(const uint8_t *in, size_t in_size, const struct sign_opts *opts,
+                  const char *default_ident, uint8_t **out, size_t *out_size,
+                  char *errbuf, size_t errlen);
+
+// Re-sign every slice of a thin or FAT file image and reassemble it.
+int cs_sign_buffer(const uint8_t *in, size_t in_size, const struct sign_opts *opts,
+                   const char *default_ident, uint8_t **out, size_t *out_size,
+                   char *errbuf, size_t errlen);
+
+#endif /* MACHO_SIGNER_H */
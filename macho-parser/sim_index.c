@@ -0,0 +1,792 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sim_index.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "corpus.h"
+#include "dyld_info.h"
+#include "macho_image.h"
+#include "parallel.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIDX_HAVE_AVX2 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define SIDX_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define EMPTY UINT32_MAX
+
+// Content bins take the top 6 bits of a window hash, symbol bins the top 5.
+#define CONTENT_SHIFT 26
+#define SYMBOL_SHIFT 27
+
+// Window hashes are computed a chunk at a time, then folded into the bins.
+#define WINDOW_CHUNK 1024
+
+// ---- window hashing ----
+
+// Hash of the 8-byte window (lo, hi): the two words are mixed with odd
+// multipliers and a rotation, then finalised like murmur3's fmix32. Only
+// 32-bit multiplies, shifts and xors, so every lane of a vector register
+// computes the same value as this function.
+static inline uint32_t window_hash(uint32_t lo, uint32_t hi) {
+    uint32_t x = lo * 0x9e3779b1u;
+    uint32_t y = hi * 0x85ebca77u;
+    x ^= (y << 13) | (y >> 19);
+    x ^= x >> 15;
+    x *= 0x2c1b3c6du;
+    x ^= x >> 12;
+    x *= 0x297a2d39u;
+    return x ^ (x >> 15);
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Hashes of the n windows starting at p, p + 4, ..., p + 4 * (n - 1). The
+// caller guarantees 4 * n + 4 readable bytes.
+static void hash_windows_portable(const uint8_t *p, size_t n, uint32_t *out) {
+    for (size_t i = 0; i < n; i++) out[i] = window_hash(load32(p + i * 4), load32(p + i * 4 + 4));
+}
+
+#ifdef SIDX_HAVE_AVX2
+__attribute__((target("avx2")))
+static void hash_windows_avx2(const uint8_t *p, size_t n, uint32_t *out) {
+    const __m256i m1 = _mm256_set1_epi32((int)0x9e3779b1u);
+    const __m256i m2 = _mm256_set1_epi32((int)0x85ebca77u);
+    const __m256i m3 = _mm256_set1_epi32((int)0x2c1b3c6du);
+    const __m256i m4 = _mm256_set1_epi32((int)0x297a2d39u);
+    size_t i = 0;
+    // Eight windows read 36 bytes: lo is p[4i..4i+32), hi the same shifted by 4.
+    for (; i + 8 <= n; i += 8) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(p + i * 4));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(p + i * 4 + 4));
+        __m256i x = _mm256_mullo_epi32(lo, m1);
+        __m256i y = _mm256_mullo_epi32(hi, m2);
+        y = _mm256_or_si256(_mm256_slli_epi32(y, 13), _mm256_srli_epi32(y, 19));
+        x = _mm256_xor_si256(x, y);
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+        x = _mm256_mullo_epi32(x, m3);
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 12));
+        x = _mm256_mullo_epi32(x, m4);
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+        _mm256_storeu_si256((__m256i *)(out + i), x);
+    }
+    hash_windows_portable(p + i * 4, n - i, out + i);
+}
+
+static int cpu_has_avx2(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+    // AVX needs OS support for the YMM state (OSXSAVE + XCR0 bits 1-2).
+    if (!((c >> 27) & 1) || !((c >> 28) & 1)) return 0;
+    unsigned xlo, xhi;
+    __asm__ volatile("xgetbv" : "=a"(xlo), "=d"(xhi) : "c"(0));
+    if ((xlo & 6) != 6) return 0;
+    if (__get_cpuid_max(0, NULL) < 7) return 0;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b >> 5) & 1;
+}
+#endif
+
+#ifdef SIDX_HAVE_NEON
+static void hash_windows_neon(const uint8_t *p, size_t n, uint32_t *out) {
+    const uint32x4_t m1 = vdupq_n_u32(0x9e3779b1u);
+    const uint32x4_t m2 = vdupq_n_u32(0x85ebca77u);
+    const uint32x4_t m3 = vdupq_n_u32(0x2c1b3c6du);
+    const uint32x4_t m4 = vdupq_n_u32(0x297a2d39u);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t lo = vreinterpretq_u32_u8(vld1q_u8(p + i * 4));
+        uint32x4_t hi = vreinterpretq_u32_u8(vld1q_u8(p + i * 4 + 4));
+        uint32x4_t x = vmulq_u32(lo, m1);
+        uint32x4_t y = vmulq_u32(hi, m2);
+        y = vorrq_u32(vshlq_n_u32(y, 13), vshrq_n_u32(y, 19));
+        x = veorq_u32(x, y);
+        x = veorq_u32(x, vshrq_n_u32(x, 15));
+        x = vmulq_u32(x, m3);
+        x = veorq_u32(x, vshrq_n_u32(x, 12));
+        x = vmulq_u32(x, m4);
+        x = veorq_u32(x, vshrq_n_u32(x, 15));
+        vst1q_u32(out + i, x);
+    }
+    hash_windows_portable(p + i * 4, n - i, out + i);
+}
+#endif
+
+typedef void (*hash_windows_fn)(const uint8_t *p, size_t n, uint32_t *out);
+
+static hash_windows_fn g_hash_windows = hash_windows_portable;
+static const char *g_hash_name = "portable";
+static pthread_once_t g_hash_once = PTHREAD_ONCE_INIT;
+
+static void hash_pick(void) {
+#ifdef SIDX_HAVE_NEON
+    g_hash_windows = hash_windows_neon;
+    g_hash_name = "neon";
+#endif
+#ifdef SIDX_HAVE_AVX2
+    if (cpu_has_avx2()) {
+        g_hash_windows = hash_windows_avx2;
+        g_hash_name = "avx2";
+    }
+#endif
+}
+
+const char *sidx_hash_impl(void) {
+    pthread_once(&g_hash_once, hash_pick);
+    return g_hash_name;
+}
+
+// ---- signatures ----
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// One-permutation update: the top bits of h pick the bin, the rest is the
+// value it competes with.
+static void oph_add(uint32_t *bins, unsigned shift, const uint32_t *h, size_t n) {
+    uint32_t mask = ((uint32_t)1 << shift) - 1;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t b = h[i] >> shift;
+        uint32_t v = h[i] & mask;
+        if (v < bins[b]) bins[b] = v;
+    }
+}
+
+// Rotation densification: an empty bin takes the value of the next
+// non-empty bin to its right, offset by the distance so that borrowed
+// values only collide with values borrowed over the same distance. Leaves
+// an all-empty signature alone.
+static void densify(uint32_t *bins, unsigned k, unsigned shift) {
+    uint32_t orig[SIDX_CONTENT_K];
+    memcpy(orig, bins, k * sizeof(*bins));
+    for (unsigned i = 0; i < k; i++) {
+        if (orig[i] != EMPTY) continue;
+        for (unsigned t = 1; t < k; t++) {
+            uint32_t v = orig[(i + t) % k];
+            if (v == EMPTY) continue;
+            v += (uint32_t)t << shift;
+            bins[i] = v == EMPTY ? EMPTY - 1 : v;
+            break;
+        }
+    }
+}
+
+static int is_zerofill(uint32_t flags) {
+    uint32_t type = flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+static void sign_content(const struct macho_image *img, struct sidx_sig *out) {
+    uint32_t h[WINDOW_CHUNK];
+    pthread_once(&g_hash_once, hash_pick);
+    for (size_t s = 0; s < img->nsects; s++) {
+        const struct macho_section *sec = &img->sects[s];
+        if (is_zerofill(sec->flags) || sec->size < 8) continue;
+        if (sec->offset > img->size || sec->size > img->size - sec->offset) continue;
+        const uint8_t *p = img->buf + sec->offset;
+        size_t nwin = (size_t)(sec->size - 8) / 4 + 1;
+        for (size_t i = 0; i < nwin; i += WINDOW_CHUNK) {
+            size_t m = nwin - i < WINDOW_CHUNK ? nwin - i : WINDOW_CHUNK;
+            g_hash_windows(p + i * 4, m, h);
+            oph_add(out->content, CONTENT_SHIFT, h, m);
+        }
+        out->content_bytes += sec->size;
+    }
+    if (out->content_bytes) densify(out->content, SIDX_CONTENT_K, CONTENT_SHIFT);
+}
+
+// Imports and exports are tagged so that a library exporting a name and a
+// client importing it do not share the shingle.
+static uint32_t name_hash(char tag, const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    h = (h ^ (uint8_t)tag) * 1099511628211ull;
+    for (; *s; s++) h = (h ^ (uint8_t)*s) * 1099511628211ull;
+    return (uint32_t)fmix64(h);
+}
+
+// Names whose dyld info cannot be read contribute nothing; the content
+// signature still stands.
+static void sign_symbols(const struct macho_image *img, struct sidx_sig *out) {
+    char err[200];
+    uint32_t h[WINDOW_CHUNK];
+    size_t nh = 0;
+
+    struct macho_import *imps = NULL;
+    size_t nimps = 0;
+    if (macho_imports(img, &imps, &nimps, err, sizeof(err)) == 0) {
+        for (size_t i = 0; i < nimps; i++) {
+            if (!imps[i].name) continue;
+            h[nh++] = name_hash('I', imps[i].name);
+            if (nh == WINDOW_CHUNK) {
+                oph_add(out->symbols, SYMBOL_SHIFT, h, nh);
+                out->nsymbols += (uint32_t)nh;
+                nh = 0;
+            }
+        }
+        free(imps);
+    }
+
+    struct macho_export_list exps = { 0 };
+    if (macho_exports(img, &exps, err, sizeof(err)) == 0) {
+        for (size_t i = 0; i < exps.n; i++) {
+            if (!exps.v[i].name) continue;
+            h[nh++] = name_hash('E', exps.v[i].name);
+            if (nh == WINDOW_CHUNK) {
+                oph_add(out->symbols, SYMBOL_SHIFT, h, nh);
+                out->nsymbols += (uint32_t)nh;
+                nh = 0;
+            }
+        }
+    }
+    macho_export_list_free(&exps);
+
+    oph_add(out->symbols, SYMBOL_SHIFT, h, nh);
+    out->nsymbols += (uint32_t)nh;
+    if (out->nsymbols) densify(out->symbols, SIDX_SYMBOL_K, SYMBOL_SHIFT);
+}
+
+static int looks_like_macho(const uint8_t *p, size_t n) {
+    if (n < 4) return 0;
+    uint32_t m;
+    memcpy(&m, p, sizeof(m));
+    return m == MH_MAGIC || m == MH_CIGAM || m == MH_MAGIC_64 || m == MH_CIGAM_64 ||
+           m == FAT_MAGIC || m == FAT_CIGAM || m == 0xcafebabfu || m == 0xbfbafecau;
+}
+
+int sidx_sign(const uint8_t *buf, size_t size, struct sidx_sig *out,
+              char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    memset(out->content, 0xff, sizeof(out->content));
+    memset(out->symbols, 0xff, sizeof(out->symbols));
+    if (!looks_like_macho(buf, size)) return 1;
+
+    uint64_t off = 0;
+    uint64_t sz = 0;
+    // 0xcafebabe is shared with Java class files: a FAT header that does
+    // not select is not a broken Mach-O.
+    if (macho_select_slice(buf, size, -1, 0, &off, &sz, errbuf, errlen) != 0) return 1;
+
+    struct macho_image img;
+    if (macho_image_load(&img, buf + off, (size_t)sz, errbuf, errlen) != 0) return -1;
+    sign_content(&img, out);
+    sign_symbols(&img, out);
+    macho_image_free(&img);
+    return 0;
+}
+
+static float agreement(const uint32_t *a, const uint32_t *b, unsigned k) {
+    unsigned same = 0;
+    for (unsigned i = 0; i < k; i++) same += a[i] == b[i];
+    return (float)same / (float)k;
+}
+
+float sidx_similarity(const struct sidx_sig *a, const struct sidx_sig *b,
+                      float *content, float *symbols) {
+    int has_c = a->content_bytes && b->content_bytes;
+    int has_s = a->nsymbols && b->nsymbols;
+    float c = has_c ? agreement(a->content, b->content, SIDX_CONTENT_K) : 0.0f;
+    float s = has_s ? agreement(a->symbols, b->symbols, SIDX_SYMBOL_K) : 0.0f;
+    if (content) *content = c;
+    if (symbols) *symbols = s;
+    float w = (has_c ? 2.0f : 0.0f) + (has_s ? 1.0f : 0.0f);
+    return w > 0 ? ((has_c ? 2.0f * c : 0.0f) + s) / w : 0.0f;
+}
+
+static uint64_t band_key(const uint32_t *v, uint32_t band) {
+    uint64_t h = 0x9e3779b97f4a7c15ull * (band + 1);
+    for (unsigned r = 0; r < SIDX_ROWS; r++) h = fmix64(h ^ v[r]) + r;
+    return h;
+}
+
+// Band keys of sig into bands[] (room for every band); returns the count.
+static size_t sig_bands(const struct sidx_sig *sig, uint32_t binary, struct sidx_band *bands) {
+    size_t n = 0;
+    if (sig->content_bytes) {
+        for (uint32_t b = 0; b < SIDX_CONTENT_BANDS; b++) {
+            bands[n].key = band_key(&sig->content[b * SIDX_ROWS], b);
+            bands[n].binary = binary;
+            bands[n].band = b;
+            n++;
+        }
+    }
+    if (sig->nsymbols) {
+        for (uint32_t b = 0; b < SIDX_SYMBOL_BANDS; b++) {
+            uint32_t band = SIDX_CONTENT_BANDS + b;
+            bands[n].key = band_key(&sig->symbols[b * SIDX_ROWS], band);
+            bands[n].binary = binary;
+            bands[n].band = band;
+            n++;
+        }
+    }
+    return n;
+}
+
+// ---- build ----
+
+enum { SCAN_NONE, SCAN_MACHO, SCAN_ERROR };
+
+struct scan_job {
+    char **paths;
+    struct sidx_sig *sigs;
+    uint8_t *state;                // SCAN_*
+};
+
+static void scan_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct scan_job *job = ctx;
+    for (size_t i = begin; i < end; i++) {
+        char err[256];
+        struct mapped_file mf;
+        if (map_file(job->paths[i], &mf, err, sizeof(err)) != 0) {
+            job->state[i] = SCAN_ERROR;
+            continue;
+        }
+        int rc = sidx_sign(mf.data, mf.size, &job->sigs[i], err, sizeof(err));
+        job->state[i] = rc == 0 ? SCAN_MACHO : rc < 0 ? SCAN_ERROR : SCAN_NONE;
+        unmap_file(&mf);
+    }
+}
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int cmp_band(const void *a, const void *b) {
+    const struct sidx_band *x = a;
+    const struct sidx_band *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->binary > y->binary) - (x->binary < y->binary);
+}
+
+static uint64_t align8(uint64_t x) {
+    return (x + 7) & ~(uint64_t)7;
+}
+
+// Write `len` bytes at file offset `at` (>= *pos), zero-filling the gap.
+static int emit(FILE *f, uint64_t *pos, const void *p, size_t len, uint64_t at) {
+    static const uint8_t zeros[8];
+    while (*pos < at) {
+        size_t n = (at - *pos) < sizeof(zeros) ? (size_t)(at - *pos) : sizeof(zeros);
+        if (fwrite(zeros, 1, n, f) != n) return 0;
+        *pos += n;
+    }
+    if (len && fwrite(p, 1, len, f) != len) return 0;
+    *pos += len;
+    return 1;
+}
+
+static int write_index(const char *out_path, const struct sidx_header *h,
+                       const uint32_t *bins, const struct sidx_sig *sigs,
+                       const struct sidx_band *bands, const char *strtab,
+                       char *errbuf, size_t errlen) {
+    size_t plen = strlen(out_path);
+    char *tmp = malloc(plen + 5);
+    if (!tmp) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    memcpy(tmp, out_path, plen);
+    memcpy(tmp + plen, ".tmp", 5);
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        snprintf(errbuf, errlen, "%s: %s", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+
+    uint64_t pos = 0;
+    int ok = emit(f, &pos, h, sizeof(*h), 0) &&
+             emit(f, &pos, bins, (size_t)h->nbinaries * sizeof(*bins), h->binaries_off) &&
+             emit(f, &pos, sigs, (size_t)h->nbinaries * sizeof(*sigs), h->sigs_off) &&
+             emit(f, &pos, bands, (size_t)h->nbands * sizeof(*bands), h->bands_off) &&
+             emit(f, &pos, strtab, (size_t)h->strtab_size, h->strtab_off);
+
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, out_path) != 0) {
+        snprintf(errbuf, errlen, "%s: %s", out_path, strerror(errno));
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+int sidx_build(char **paths, size_t npaths, unsigned nthreads, const char *out_path,
+               struct sidx_build_stats *stats, char *errbuf, size_t errlen) {
+    memset(stats, 0, sizeof(*stats));
+    if (npaths > UINT32_MAX / (SIDX_CONTENT_BANDS + SIDX_SYMBOL_BANDS)) {
+        snprintf(errbuf, errlen, "too many input files");
+        return -1;
+    }
+
+    // Stable binary ids regardless of input order or thread timing.
+    qsort(paths, npaths, sizeof(*paths), cmp_path);
+    size_t uniq = 0;
+    for (size_t i = 0; i < npaths; i++) {
+        if (uniq && strcmp(paths[uniq - 1], paths[i]) == 0) continue;
+        // Swap rather than overwrite: the caller still owns all npaths strings.
+        char *t = paths[uniq];
+        paths[uniq++] = paths[i];
+        paths[i] = t;
+    }
+    npaths = uniq;
+    stats->files = npaths;
+
+    struct sidx_sig *sigs = malloc((npaths ? npaths : 1) * sizeof(*sigs));
+    uint8_t *state = calloc(npaths ? npaths : 1, 1);
+    if (!sigs || !state) {
+        free(sigs);
+        free(state);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    struct scan_job job = { paths, sigs, state };
+    par_for(npaths, 16, nthreads, scan_worker, &job);
+
+    // Keep the Mach-O files, in path order.
+    size_t nb = 0;
+    size_t strsize = 1;
+    for (size_t i = 0; i < npaths; i++) {
+        if (state[i] == SCAN_ERROR) stats->errors++;
+        if (state[i] != SCAN_MACHO) continue;
+        stats->bytes += sigs[i].content_bytes;
+        strsize += strlen(paths[i]) + 1;
+        nb++;
+    }
+    stats->machos = nb;
+
+    uint32_t *bins = malloc((nb ? nb : 1) * sizeof(*bins));
+    char *strtab = malloc(strsize);
+    struct sidx_band *bands =
+        malloc((nb ? nb : 1) * (SIDX_CONTENT_BANDS + SIDX_SYMBOL_BANDS) * sizeof(*bands));
+    int rc = -1;
+    if (!bins || !strtab || !bands || strsize > UINT32_MAX) {
+        snprintf(errbuf, errlen, "out of memory");
+    } else {
+        size_t pos = 1;
+        size_t nbands = 0;
+        size_t k = 0;
+        strtab[0] = '\0';
+        for (size_t i = 0; i < npaths; i++) {
+            if (state[i] != SCAN_MACHO) continue;
+            size_t len = strlen(paths[i]) + 1;
+            memcpy(strtab + pos, paths[i], len);
+            bins[k] = (uint32_t)pos;
+            pos += len;
+            sigs[k] = sigs[i];
+            nbands += sig_bands(&sigs[k], (uint32_t)k, bands + nbands);
+            k++;
+        }
+        qsort(bands, nbands, sizeof(*bands), cmp_band);
+
+        struct sidx_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, SIDX_MAGIC, sizeof(h.magic));
+        h.version = SIDX_VERSION;
+        h.byte_order = SIDX_BYTE_ORDER;
+        h.nbinaries = (uint32_t)nb;
+        h.nbands = (uint32_t)nbands;
+        h.binaries_off = align8(sizeof(h));
+        h.sigs_off = align8(h.binaries_off + (uint64_t)nb * sizeof(*bins));
+        h.bands_off = align8(h.sigs_off + (uint64_t)nb * sizeof(*sigs));
+        h.strtab_off = align8(h.bands_off + (uint64_t)nbands * sizeof(*bands));
+        h.strtab_size = strsize;
+        rc = write_index(out_path, &h, bins, sigs, bands, strtab, errbuf, errlen);
+        stats->bands = nbands;
+    }
+
+    free(bins);
+    free(strtab);
+    free(bands);
+    free(sigs);
+    free(state);
+    return rc;
+}
+
+// ---- query ----
+
+int sidx_open(const char *path, struct sidx *idx, char *errbuf, size_t errlen) {
+    memset(idx, 0, sizeof(*idx));
+    struct mapped_file mf;
+    if (map_file(path, &mf, errbuf, errlen) != 0) return -1;
+    idx->map = mf.data;
+    idx->size = mf.size;
+
+    const struct sidx_header *h = (const struct sidx_header *)mf.data;
+    if (mf.size < sizeof(*h) || memcmp(h->magic, SIDX_MAGIC, sizeof(h->magic)) != 0) {
+        snprintf(errbuf, errlen, "%s: not a similarity index", path);
+        sidx_close(idx);
+        return -1;
+    }
+    if (h->version != SIDX_VERSION || h->byte_order != SIDX_BYTE_ORDER) {
+        snprintf(errbuf, errlen, "%s: index version %u / byte order mismatch",
+                 path, h->version);
+        sidx_close(idx);
+        return -1;
+    }
+
+    uint64_t sz = mf.size;
+    int ok = h->binaries_off <= sz && (uint64_t)h->nbinaries * 4 <= sz - h->binaries_off &&
+             h->sigs_off <= sz &&
+             (uint64_t)h->nbinaries * sizeof(struct sidx_sig) <= sz - h->sigs_off &&
+             h->bands_off <= sz &&
+             (uint64_t)h->nbands * sizeof(struct sidx_band) <= sz - h->bands_off &&
+             h->strtab_off <= sz && h->strtab_size <= sz - h->strtab_off &&
+             h->strtab_size > 0 && mf.data[h->strtab_off + h->strtab_size - 1] == '\0' &&
+             (h->binaries_off | h->sigs_off | h->bands_off) % 8 == 0;
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt index", path);
+        sidx_close(idx);
+        return -1;
+    }
+    // Band entries are validated once so queries can index without checks.
+    const struct sidx_band *bands = (const struct sidx_band *)(mf.data + h->bands_off);
+    for (uint32_t i = 0; i < h->nbands && ok; i++) {
+        ok = bands[i].binary < h->nbinaries &&
+             bands[i].band < SIDX_CONTENT_BANDS + SIDX_SYMBOL_BANDS &&
+             (i == 0 || bands[i - 1].key <= bands[i].key);
+    }
+    if (!ok) {
+        snprintf(errbuf, errlen, "%s: corrupt band table", path);
+        sidx_close(idx);
+        return -1;
+    }
+
+    idx->h = h;
+    idx->binaries = (const uint32_t *)(mf.data + h->binaries_off);
+    idx->sigs = (const struct sidx_sig *)(mf.data + h->sigs_off);
+    idx->bands = bands;
+    idx->strtab = (const char *)(mf.data + h->strtab_off);
+    return 0;
+}
+
+void sidx_close(struct sidx *idx) {
+    struct mapped_file mf = { idx->map, idx->size };
+    unmap_file(&mf);
+    memset(idx, 0, sizeof(*idx));
+}
+
+const char *sidx_path(const struct sidx *idx, uint32_t binary) {
+    if (binary >= idx->h->nbinaries || idx->binaries[binary] >= idx->h->strtab_size) return "";
+    return idx->strtab + idx->binaries[binary];
+}
+
+long sidx_find_binary(const struct sidx *idx, const char *path) {
+    size_t lo = 0;
+    size_t hi = idx->h->nbinaries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(sidx_path(idx, (uint32_t)mid), path);
+        if (c == 0) return (long)mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+// First band entry with key >= key.
+static size_t band_lower_bound(const struct sidx *idx, uint64_t key) {
+    size_t lo = 0;
+    size_t hi = idx->h->nbands;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->bands[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+size_t sidx_candidates(const struct sidx *idx, const struct sidx_sig *sig, uint32_t **out) {
+    struct sidx_band mine[SIDX_CONTENT_BANDS + SIDX_SYMBOL_BANDS];
+    size_t nmine = sig_bands(sig, 0, mine);
+    uint32_t *v = NULL;
+    size_t n = 0;
+    size_t cap = 0;
+    *out = NULL;
+    for (size_t m = 0; m < nmine; m++) {
+        for (size_t i = band_lower_bound(idx, mine[m].key);
+             i < idx->h->nbands && idx->bands[i].key == mine[m].key; i++) {
+            if (idx->bands[i].band != mine[m].band) continue;
+            if (n == cap) {
+                size_t ncap = cap ? cap * 2 : 64;
+                uint32_t *nv = realloc(v, ncap * sizeof(*nv));
+                if (!nv) {
+                    free(v);
+                    return 0;
+                }
+                v = nv;
+                cap = ncap;
+            }
+            v[n++] = idx->bands[i].binary;
+        }
+    }
+    if (n == 0) return 0;
+    qsort(v, n, sizeof(*v), cmp_u32);
+    size_t u = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (u == 0 || v[u - 1] != v[i]) v[u++] = v[i];
+    }
+    *out = v;
+    return u;
+}
+
+// ---- clustering ----
+
+struct edge {
+    uint32_t a;
+    uint32_t b;
+};
+
+struct edge_vec {
+    struct edge *v;
+    size_t n;
+    size_t cap;
+    int oom;
+};
+
+// A bucket with more than one member: band entries [first, last).
+struct run {
+    size_t first;
+    size_t last;
+};
+
+struct cluster_job {
+    const struct sidx *idx;
+    const struct run *runs;
+    float min;
+    struct edge_vec *edges;        // per worker
+};
+
+static void edge_push(struct edge_vec *ev, uint32_t a, uint32_t b) {
+    if (ev->n == ev->cap) {
+        size_t ncap = ev->cap ? ev->cap * 2 : 256;
+        struct edge *nv = realloc(ev->v, ncap * sizeof(*nv));
+        if (!nv) {
+            ev->oom = 1;
+            return;
+        }
+        ev->v = nv;
+        ev->cap = ncap;
+    }
+    ev->v[ev->n].a = a;
+    ev->v[ev->n].b = b;
+    ev->n++;
+}
+
+static void cluster_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    struct cluster_job *job = ctx;
+    const struct sidx_band *bands = job->idx->bands;
+    const struct sidx_sig *sigs = job->idx->sigs;
+    struct edge_vec *ev = &job->edges[worker];
+    for (size_t r = begin; r < end; r++) {
+        size_t first = job->runs[r].first;
+        size_t last = job->runs[r].last;
+        for (size_t i = first + 1; i < last; i++) {
+            uint32_t b = bands[i].binary;
+            uint32_t f = bands[first].binary;
+            uint32_t p = bands[i - 1].binary;
+            if (sidx_similarity(&sigs[f], &sigs[b], NULL, NULL) >= job->min) {
+                edge_push(ev, f, b);
+            } else if (p != f && sidx_similarity(&sigs[p], &sigs[b], NULL, NULL) >= job->min) {
+                edge_push(ev, p, b);
+            }
+        }
+    }
+}
+
+static uint32_t uf_find(uint32_t *parent, uint32_t x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+int sidx_cluster(const struct sidx *idx, float min, unsigned nthreads, uint32_t **cluster_of) {
+    size_t nb = idx->h->nbinaries;
+    size_t nbands = idx->h->nbands;
+    *cluster_of = NULL;
+    if (nthreads == 0) nthreads = par_default_threads();
+
+    // A band's key and number together name a bucket.
+    size_t nruns = 0;
+    struct run *runs = malloc((nbands / 2 + 1) * sizeof(*runs));
+    uint32_t *parent = malloc((nb ? nb : 1) * sizeof(*parent));
+    struct edge_vec *edges = calloc(nthreads, sizeof(*edges));
+    int rc = -1;
+    if (!runs || !parent || !edges) goto out;
+    for (size_t i = 0; i < nbands;) {
+        size_t j = i + 1;
+        while (j < nbands && idx->bands[j].key == idx->bands[i].key &&
+               idx->bands[j].band == idx->bands[i].band) {
+            j++;
+        }
+        if (j - i > 1) {
+            runs[nruns].first = i;
+            runs[nruns].last = j;
+            nruns++;
+        }
+        i = j;
+    }
+
+    struct cluster_job job = { idx, runs, min, edges };
+    par_for(nruns, 64, nthreads, cluster_worker, &job);
+
+    for (size_t i = 0; i < nb; i++) parent[i] = (uint32_t)i;
+    int oom = 0;
+    for (unsigned w = 0; w < nthreads; w++) {
+        oom |= edges[w].oom;
+        for (size_t e = 0; e < edges[w].n; e++) {
+            uint32_t a = uf_find(parent, edges[w].v[e].a);
+            uint32_t b = uf_find(parent, edges[w].v[e].b);
+            // The smaller index is the root, so labels do not depend on
+            // thread timing.
+            if (a < b) parent[b] = a;
+            else if (b < a) parent[a] = b;
+        }
+    }
+    if (oom) goto out;
+    for (size_t i = 0; i < nb; i++) parent[i] = uf_find(parent, (uint32_t)i);
+    *cluster_of = parent;
+    parent = NULL;
+    rc = 0;
+
+out:
+    for (unsigned w = 0; edges && w < nthreads; w++) free(edges[w].v);
+    free(edges);
+    free(runs);
+    free(parent);
+    return rc;
+}
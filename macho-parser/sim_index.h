@@ -0,0 +1,130 @@
+#ifndef MACHO_SIM_INDEX_H
+#define MACHO_SIM_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MinHash signatures and an LSH index for finding near-duplicate or
+// derived binaries in a corpus without comparing every pair.
+//
+// Each Mach-O file (the slice macho_select_slice prefers) gets two
+// signatures:
+//   content  64 values over its file-backed sections, shingled as the
+//            8-byte window at every 4-byte offset;
+//   symbols  32 values over its import and export names.
+// Both use one-permutation hashing: every shingle is hashed once, the top
+// bits pick a bin and the bin keeps its minimum; empty bins borrow from the
+// next non-empty one (rotation densification). The share of equal values
+// estimates the Jaccard similarity of the shingle sets. Hashing the windows
+// is the hot loop and runs 8 lanes at a time with AVX2 (detected with CPUID
+// at runtime) or 4 with NEON, else in portable C.
+//
+// Bands of 4 values (16 for content, 8 for symbols) are hashed into one
+// table sorted by key, so a binary's candidates are one binary search per
+// band. The on-disk file is the in-memory layout, as for ent_index: opening
+// it is one mmap. All integers are host byte order.
+//
+//   header
+//   u32 binaries[nbinaries]          path (string offset), sorted by path
+//   struct sidx_sig sigs[nbinaries]
+//   struct sidx_band bands[nbands]   sorted by key, then binary
+//   strtab                           NUL-terminated paths
+
+#define SIDX_MAGIC "MACHOSIM"
+#define SIDX_VERSION 1
+#define SIDX_BYTE_ORDER 0x01020304u
+
+#define SIDX_CONTENT_K 64
+#define SIDX_SYMBOL_K 32
+#define SIDX_ROWS 4
+#define SIDX_CONTENT_BANDS (SIDX_CONTENT_K / SIDX_ROWS)
+#define SIDX_SYMBOL_BANDS (SIDX_SYMBOL_K / SIDX_ROWS)
+
+struct sidx_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t nbinaries;
+    uint32_t nbands;
+    uint64_t binaries_off;
+    uint64_t sigs_off;
+    uint64_t bands_off;
+    uint64_t strtab_off;
+    uint64_t strtab_size;
+};
+
+// A signature with no shingles (no section bytes, no symbols) is all
+// UINT32_MAX and takes no part in LSH.
+struct sidx_sig {
+    uint32_t content[SIDX_CONTENT_K];
+    uint32_t symbols[SIDX_SYMBOL_K];
+    uint64_t content_bytes;     // section bytes shingled
+    uint32_t nsymbols;          // imports + exports
+    uint32_t reserved;
+};
+
+struct sidx_band {
+    uint64_t key;
+    uint32_t binary;
+    uint32_t band;              // content bands first, then symbol bands
+};
+
+struct sidx_build_stats {
+    size_t files;
+    size_t machos;
+    size_t errors;
+    uint64_t bytes;             // section bytes shingled
+    size_t bands;
+};
+
+// Signature of one file. Returns 0, 1 if it is not Mach-O, or -1 with a
+// reason.
+int sidx_sign(const uint8_t *buf, size_t size, struct sidx_sig *out,
+              char *errbuf, size_t errlen);
+
+// Sign `paths` in parallel and write the index to out_path (atomically via
+// a temporary file). Files that are not Mach-O are counted and skipped.
+int sidx_build(char **paths, size_t npaths, unsigned nthreads, const char *out_path,
+               struct sidx_build_stats *stats, char *errbuf, size_t errlen);
+
+struct sidx {
+    const uint8_t *map;
+    size_t size;
+    const struct sidx_header *h;
+    const uint32_t *binaries;
+    const struct sidx_sig *sigs;
+    const struct sidx_band *bands;
+    const char *strtab;
+};
+
+int sidx_open(const char *path, struct sidx *idx, char *errbuf, size_t errlen);
+void sidx_close(struct sidx *idx);
+
+const char *sidx_path(const struct sidx *idx, uint32_t binary);
+
+// Binary index for a path, or -1.
+long sidx_find_binary(const struct sidx *idx, const char *path);
+
+// Estimated similarity in [0, 1]: the content and symbol Jaccard estimates
+// (stored through the pointers when not NULL) weighted 2:1. A part counts
+// only when both sides have shingles for it.
+float sidx_similarity(const struct sidx_sig *a, const struct sidx_sig *b,
+                      float *content, float *symbols);
+
+// Binaries sharing at least one band with sig, each once, sorted. Returns
+// the count; *out is malloc'd (NULL when there are none or on failure).
+size_t sidx_candidates(const struct sidx *idx, const struct sidx_sig *sig, uint32_t **out);
+
+// Single-linkage clusters of binaries at least `min` similar. Candidate
+// pairs come from LSH buckets: each member of a bucket is compared with
+// the bucket's first member and with its predecessor, so a bucket of
+// thousands of copies costs a linear number of comparisons. Buckets are
+// scored in parallel. On success *cluster_of (malloc'd) maps every binary
+// to the smallest binary index in its cluster. Returns 0, or -1 on
+// allocation failure.
+int sidx_cluster(const struct sidx *idx, float min, unsigned nthreads, uint32_t **cluster_of);
+
+// Name of the window hashing kernel in use: "avx2", "neon" or "portable".
+const char *sidx_hash_impl(void);
+
+#endif /* MACHO_SIM_INDEX_H */
@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "corpus.h"
+#include "sim_index.h"
+
+// simindex: MinHash/LSH index for near-duplicate binaries in a corpus.
+//
+//   simindex build [-j N] OUT PATH... | -
+//   simindex similar IDX PATH [MIN]     binaries like PATH (indexed or not)
+//   simindex cluster IDX [MIN]          groups of near-duplicates
+//   simindex stats IDX                  totals and bucket sizes
+
+#define DEFAULT_MIN 0.5f
+
+static void usage(const char *prog, FILE *out) {
+    fprintf(out, "usage: %s build [-j N] <index> <path>... | -\n", prog);
+    fprintf(out, "       %s similar <index> <path> [min similarity, default 0.5]\n", prog);
+    fprintf(out, "       %s cluster <index> [min similarity, default 0.5]\n", prog);
+    fprintf(out, "       %s stats <index>\n", prog);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int parse_min(const char *s, float *out) {
+    char *end = NULL;
+    double v = strtod(s, &end);
+    if (!end || *end || v < 0.0 || v > 1.0) {
+        fprintf(stderr, "error: similarity must be between 0 and 1: %s\n", s);
+        return -1;
+    }
+    *out = (float)v;
+    return 0;
+}
+
+static int cmd_build(int argc, char **argv) {
+    unsigned jobs = 0;
+    int i = 0;
+    if (i + 1 < argc && (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0)) {
+        jobs = (unsigned)strtoul(argv[i + 1], NULL, 0);
+        i += 2;
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "error: build needs an output file and inputs\n");
+        return 2;
+    }
+    const char *out = argv[i++];
+
+    char **paths = NULL;
+    size_t npaths = corpus_collect_paths(argc - i, argv + i, &paths);
+
+    char err[256];
+    struct sidx_build_stats st;
+    double t0 = now_ms();
+    int rc = sidx_build(paths, npaths, jobs, out, &st, err, sizeof(err));
+    double t1 = now_ms();
+    corpus_free_paths(paths, npaths);
+    if (rc != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+    double secs = (t1 - t0) / 1e3;
+    printf("files=%zu macho=%zu errors=%zu hashed=%.1fMB bands=%zu\n",
+           st.files, st.machos, st.errors, (double)st.bytes / 1e6, st.bands);
+    printf("time=%.1fms (%.0f files/s, %.0f MB/s, %s) -> %s\n", t1 - t0,
+           secs > 0 ? (double)st.files / secs : 0.0,
+           secs > 0 ? (double)st.bytes / 1e6 / secs : 0.0, sidx_hash_impl(), out);
+    return 0;
+}
+
+struct hit {
+    uint32_t binary;
+    float sim;
+    float content;
+    float symbols;
+};
+
+static int cmp_hit(const void *a, const void *b) {
+    const struct hit *x = a;
+    const struct hit *y = b;
+    if (x->sim != y->sim) return x->sim < y->sim ? 1 : -1;
+    return (x->binary > y->binary) - (x->binary < y->binary);
+}
+
+static int cmd_similar(const struct sidx *idx, const char *path, float min) {
+    // An indexed path uses its stored signature; anything else is signed now.
+    struct sidx_sig own;
+    const struct sidx_sig *sig;
+    long self = sidx_find_binary(idx, path);
+    if (self >= 0) {
+        sig = &idx->sigs[self];
+    } else {
+        char err[256];
+        struct mapped_file mf;
+        if (map_file(path, &mf, err, sizeof(err)) != 0) {
+            fprintf(stderr, "error: %s\n", err);
+            return 1;
+        }
+        int rc = sidx_sign(mf.data, mf.size, &own, err, sizeof(err));
+        unmap_file(&mf);
+        if (rc != 0) {
+            fprintf(stderr, "error: %s: %s\n", path, rc > 0 ? "not a Mach-O file" : err);
+            return 1;
+        }
+        sig = &own;
+    }
+
+    uint32_t *cand = NULL;
+    size_t ncand = sidx_candidates(idx, sig, &cand);
+    struct hit *hits = malloc((ncand ? ncand : 1) * sizeof(*hits));
+    if (!hits) {
+        free(cand);
+        return 1;
+    }
+    size_t nhits = 0;
+    for (size_t i = 0; i < ncand; i++) {
+        if ((long)cand[i] == self) continue;
+        struct hit *h = &hits[nhits];
+        h->binary = cand[i];
+        h->sim = sidx_similarity(sig, &idx->sigs[cand[i]], &h->content, &h->symbols);
+        if (h->sim >= min) nhits++;
+    }
+    qsort(hits, nhits, sizeof(*hits), cmp_hit);
+    for (size_t i = 0; i < nhits; i++) {
+        printf("%.2f  (content %.2f, symbols %.2f)  %s\n", hits[i].sim, hits[i].content,
+               hits[i].symbols, sidx_path(idx, hits[i].binary));
+    }
+    fprintf(stderr, "%zu candidates, %zu at or above %.2f\n", ncand - (self >= 0), nhits, min);
+    free(hits);
+    free(cand);
+    return nhits ? 0 : 1;
+}
+
+static const uint32_t *g_label;
+static const uint32_t *g_size;
+
+// Largest cluster first, then by label; members by index (path order).
+static int cmp_member(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    uint32_t lx = g_label[x];
+    uint32_t ly = g_label[y];
+    if (g_size[lx] != g_size[ly]) return g_size[lx] < g_size[ly] ? 1 : -1;
+    if (lx != ly) return lx < ly ? -1 : 1;
+    return (x > y) - (x < y);
+}
+
+static int cmd_cluster(const struct sidx *idx, float min) {
+    uint32_t nb = idx->h->nbinaries;
+    uint32_t *label = NULL;
+    double t0 = now_ms();
+    if (sidx_cluster(idx, min, 0, &label) != 0) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    double t1 = now_ms();
+
+    uint32_t *size = calloc(nb ? nb : 1, sizeof(*size));
+    uint32_t *order = malloc((nb ? nb : 1) * sizeof(*order));
+    if (!size || !order) {
+        free(size);
+        free(order);
+        free(label);
+        return 1;
+    }
+    size_t nclustered = 0;
+    for (uint32_t i = 0; i < nb; i++) size[label[i]]++;
+    for (uint32_t i = 0; i < nb; i++) {
+        if (size[label[i]] > 1) order[nclustered++] = i;
+    }
+    g_label = label;
+    g_size = size;
+    qsort(order, nclustered, sizeof(*order), cmp_member);
+
+    size_t nclusters = 0;
+    for (size_t i = 0; i < nclustered; i++) {
+        uint32_t b = order[i];
+        if (i == 0 || label[order[i - 1]] != label[b]) {
+            printf("%scluster %zu: %u binaries\n", nclusters ? "\n" : "", nclusters + 1,
+                   size[label[b]]);
+            nclusters++;
+        }
+        printf("  %s\n", sidx_path(idx, b));
+    }
+    fprintf(stderr, "clusters=%zu clustered=%zu singletons=%zu min=%.2f time=%.1fms\n",
+            nclusters, nclustered, (size_t)nb - nclustered, min, t1 - t0);
+    free(order);
+    free(size);
+    free(label);
+    return 0;
+}
+
+static int cmd_stats(const struct sidx *idx) {
+    const struct sidx_header *h = idx->h;
+    uint64_t bytes = 0;
+    size_t no_content = 0;
+    size_t no_symbols = 0;
+    for (uint32_t i = 0; i < h->nbinaries; i++) {
+        bytes += idx->sigs[i].content_bytes;
+        no_content += idx->sigs[i].content_bytes == 0;
+        no_symbols += idx->sigs[i].nsymbols == 0;
+    }
+    size_t buckets = 0;
+    size_t shared = 0;
+    size_t largest = 0;
+    for (uint32_t i = 0; i < h->nbands;) {
+        uint32_t j = i + 1;
+        while (j < h->nbands && idx->bands[j].key == idx->bands[i].key &&
+               idx->bands[j].band == idx->bands[i].band) {
+            j++;
+        }
+        buckets++;
+        if (j - i > 1) shared++;
+        if (j - i > largest) largest = j - i;
+        i = j;
+    }
+    printf("binaries=%u hashed=%.1fMB no_content=%zu no_symbols=%zu\n", h->nbinaries,
+           (double)bytes / 1e6, no_content, no_symbols);
+    printf("bands=%u buckets=%zu shared_buckets=%zu largest_bucket=%zu strtab=%llu bytes\n",
+           h->nbands, buckets, shared, largest, (unsigned long long)h->strtab_size);
+    printf("signature: content k=%d, symbols k=%d, %d rows per band, hashing=%s\n",
+           SIDX_CONTENT_K, SIDX_SYMBOL_K, SIDX_ROWS, sidx_hash_impl());
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0], argc < 2 ? stderr : stdout);
+        return argc < 2 ? 2 : 0;
+    }
+    const char *cmd = argv[1];
+    if (strcmp(cmd, "build") == 0) return cmd_build(argc - 2, argv + 2);
+
+    if (argc < 3) {
+        usage(argv[0], stderr);
+        return 2;
+    }
+    char err[256];
+    struct sidx idx;
+    if (sidx_open(argv[2], &idx, err, sizeof(err)) != 0) {
+        fprintf(stderr, "error: %s\n", err);
+        return 1;
+    }
+
+    int rc;
+    float min = DEFAULT_MIN;
+    if (strcmp(cmd, "similar") == 0 && argc >= 4) {
+        rc = argc >= 5 && parse_min(argv[4], &min) != 0 ? 2 : cmd_similar(&idx, argv[3], min);
+    } else if (strcmp(cmd, "cluster") == 0) {
+        rc = argc >= 4 && parse_min(argv[3], &min) != 0 ? 2 : cmd_cluster(&idx, min);
+    } else if (strcmp(cmd, "stats") == 0) {
+        rc = cmd_stats(&idx);
+    } else {
+        usage(argv[0], stderr);
+        rc = 2;
+    }
+    sidx_close(&idx);
+    return rc;
+}
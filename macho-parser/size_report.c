@@ -0,0 +1,745 @@
+#include "size_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/nlist.h"
+#include "../include/macho/stab.h"
+
+#include "macho_common.h"
+
+// Debug map entry: an address (N_FUN, N_STSYM) or, for N_GSYM, a name.
+struct obj_ref {
+    uint64_t addr;
+    const char *name;
+    uint32_t object;
+};
+
+struct debug_map {
+    const char **objs;             // N_OSO names, de-duplicated
+    size_t nobjs;
+    struct obj_ref *by_addr;       // sorted by address
+    size_t naddr;
+    struct obj_ref *by_name;       // sorted by name
+    size_t nname;
+};
+
+static int cmp_ref_addr(const void *a, const void *b) {
+    const struct obj_ref *x = a;
+    const struct obj_ref *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int cmp_ref_name(const void *a, const void *b) {
+    return strcmp(((const struct obj_ref *)a)->name, ((const struct obj_ref *)b)->name);
+}
+
+static int cmp_str_ptr(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static size_t find_name(const char **v, size_t n, const char *name) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(v[mid], name);
+        if (c == 0) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return n;
+}
+
+static void debug_map_free(struct debug_map *m) {
+    free(m->objs);
+    free(m->by_addr);
+    free(m->by_name);
+    memset(m, 0, sizeof(*m));
+}
+
+// Two passes over the stabs: count, then fill. Object indices are first
+// assigned in N_OSO order and then renumbered by name so an object listed
+// twice (one per architecture of a universal .o, say) is one entry.
+static int debug_map_build(const struct macho_image *img, struct debug_map *m) {
+    memset(m, 0, sizeof(*m));
+    uint64_t entsz = img->is64 ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    if ((uint64_t)img->symoff + img->nsyms * entsz > img->size) return 0;
+
+    size_t noso = 0;
+    size_t nrefs = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            if (noso == 0) return 0;
+            m->objs = malloc(noso * sizeof(*m->objs));
+            m->by_addr = malloc((nrefs ? nrefs : 1) * sizeof(*m->by_addr));
+            m->by_name = malloc((nrefs ? nrefs : 1) * sizeof(*m->by_name));
+            if (!m->objs || !m->by_addr || !m->by_name) {
+                debug_map_free(m);
+                return -1;
+            }
+        }
+        uint32_t cur = SIZE_NO_OBJECT;
+        for (uint32_t i = 0; i < img->nsyms; i++) {
+            struct macho_symbol s;
+            if (macho_image_symbol(img, i, &s) != 0 || !(s.type & N_STAB)) continue;
+            if (s.type == N_OSO) {
+                if (pass == 0) noso++;
+                else m->objs[m->nobjs] = s.name;
+                cur = (uint32_t)m->nobjs;
+                if (pass == 1) m->nobjs++;
+            } else if (s.type == N_SO && !s.name[0]) {
+                cur = SIZE_NO_OBJECT;
+            } else if (cur != SIZE_NO_OBJECT && s.name[0] &&
+                       (s.type == N_FUN || s.type == N_STSYM || s.type == N_GSYM)) {
+                if (pass == 0) {
+                    nrefs++;
+                    continue;
+                }
+                struct obj_ref r = { s.addr, s.name, cur };
+                if (s.type == N_GSYM) m->by_name[m->nname++] = r;
+                else m->by_addr[m->naddr++] = r;
+            }
+        }
+    }
+
+    // Renumber objects by name, merging duplicates.
+    const char **sorted = malloc(m->nobjs * sizeof(*sorted));
+    uint32_t *remap = malloc(m->nobjs * sizeof(*remap));
+    if (!sorted || !remap) {
+        free(sorted);
+        free(remap);
+        debug_map_free(m);
+        return -1;
+    }
+    memcpy(sorted, m->objs, m->nobjs * sizeof(*sorted));
+    qsort(sorted, m->nobjs, sizeof(*sorted), cmp_str_ptr);
+    size_t nuniq = 0;
+    for (size_t i = 0; i < m->nobjs; i++) {
+        if (nuniq == 0 || strcmp(sorted[nuniq - 1], sorted[i]) != 0) sorted[nuniq++] = sorted[i];
+    }
+    for (size_t i = 0; i < m->nobjs; i++) remap[i] = (uint32_t)find_name(sorted, nuniq, m->objs[i]);
+    for (size_t i = 0; i < m->naddr; i++) m->by_addr[i].object = remap[m->by_addr[i].object];
+    for (size_t i = 0; i < m->nname; i++) m->by_name[i].object = remap[m->by_name[i].object];
+    free(remap);
+    free(m->objs);
+    m->objs = sorted;
+    m->nobjs = nuniq;
+
+    qsort(m->by_addr, m->naddr, sizeof(*m->by_addr), cmp_ref_addr);
+    qsort(m->by_name, m->nname, sizeof(*m->by_name), cmp_ref_name);
+    return 0;
+}
+
+static uint32_t object_by_name(const struct debug_map *m, const char *name) {
+    size_t lo = 0;
+    size_t hi = m->nname;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(m->by_name[mid].name, name);
+        if (c == 0) return m->by_name[mid].object;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return SIZE_NO_OBJECT;
+}
+
+static int is_zerofill(uint32_t flags) {
+    uint32_t type = flags & SECTION_TYPE;
+    return type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL;
+}
+
+// Segment whose file range holds [off, off + size), or nsegs.
+static size_t segment_for_off(const struct macho_image *img, uint64_t off, uint64_t size) {
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *s = &img->segs[i];
+        if (s->filesize && off >= s->fileoff && off - s->fileoff < s->filesize &&
+            size <= s->filesize - (off - s->fileoff)) {
+            return i;
+        }
+    }
+    return img->nsegs;
+}
+
+static void add_piece(const struct macho_image *img, struct size_item *sects, size_t *n,
+                      size_t cap, const char *name, uint64_t off, uint64_t size) {
+    if (size == 0 || *n == cap) return;
+    size_t seg = segment_for_off(img, off, size);
+    if (seg == img->nsegs) return;
+    struct size_item it = { name, (uint32_t)seg, SIZE_NO_OBJECT, size, size };
+    sects[(*n)++] = it;
+}
+
+// The parts of __LINKEDIT, from the load commands that point into it.
+static void add_linkedit(const struct macho_image *img, struct size_item *sects, size_t *n,
+                         size_t cap) {
+    int sw = img->swapped;
+    for (size_t i = 0; i < img->ncmds_valid; i++) {
+        const struct macho_lc_ref *ref = &img->cmds[i];
+        const uint8_t *p = img->buf + ref->offset;
+        switch (ref->cmd) {
+        case LC_SYMTAB:
+            if (ref->cmdsize < sizeof(struct symtab_command)) break;
+            add_piece(img, sects, n, cap, "[symbol table]", load32_u(p + 8, sw),
+                      (uint64_t)load32_u(p + 12, sw) *
+                          (img->is64 ? sizeof(struct nlist_64) : sizeof(struct nlist)));
+            add_piece(img, sects, n, cap, "[string table]", load32_u(p + 16, sw),
+                      load32_u(p + 20, sw));
+            break;
+        case LC_DYSYMTAB:
+            if (ref->cmdsize < sizeof(struct dysymtab_command)) break;
+            add_piece(img, sects, n, cap, "[indirect symbols]", load32_u(p + 56, sw),
+                      (uint64_t)load32_u(p + 60, sw) * 4);
+            add_piece(img, sects, n, cap, "[external relocations]", load32_u(p + 64, sw),
+                      (uint64_t)load32_u(p + 68, sw) * 8);
+            add_piece(img, sects, n, cap, "[local relocations]", load32_u(p + 72, sw),
+                      (uint64_t)load32_u(p + 76, sw) * 8);
+            break;
+        case LC_DYLD_INFO:
+        case LC_DYLD_INFO_ONLY:
+            if (ref->cmdsize < sizeof(struct dyld_info_command)) break;
+            add_piece(img, sects, n, cap, "[rebase opcodes]", load32_u(p + 8, sw),
+                      load32_u(p + 12, sw));
+            add_piece(img, sects, n, cap, "[bind opcodes]", load32_u(p + 16, sw),
+                      load32_u(p + 20, sw));
+            add_piece(img, sects, n, cap, "[weak bind opcodes]", load32_u(p + 24, sw),
+                      load32_u(p + 28, sw));
+            add_piece(img, sects, n, cap, "[lazy bind opcodes]", load32_u(p + 32, sw),
+                      load32_u(p + 36, sw));
+            add_piece(img, sects, n, cap, "[exports trie]", load32_u(p + 40, sw),
+                      load32_u(p + 44, sw));
+            break;
+        default: {
+            const char *name =
+                ref->cmd == LC_CODE_SIGNATURE ? "[code signature]" :
+                ref->cmd == LC_FUNCTION_STARTS ? "[function starts]" :
+                ref->cmd == LC_DATA_IN_CODE ? "[data in code]" :
+                ref->cmd == LC_SEGMENT_SPLIT_INFO ? "[split info]" :
+                ref->cmd == LC_DYLIB_CODE_SIGN_DRS ? "[dylib code sign DRs]" :
+                ref->cmd == LC_LINKER_OPTIMIZATION_HINT ? "[optimization hints]" :
+                ref->cmd == LC_DYLD_EXPORTS_TRIE ? "[exports trie]" :
+                ref->cmd == LC_DYLD_CHAINED_FIXUPS ? "[chained fixups]" : NULL;
+            if (!name || ref->cmdsize < sizeof(struct linkedit_data_command)) break;
+            add_piece(img, sects, n, cap, name, load32_u(p + 8, sw), load32_u(p + 12, sw));
+            break;
+        }
+        }
+    }
+}
+
+struct ordered_item {
+    struct size_item it;
+    size_t orig;
+};
+
+// parent ascending, then largest first (file, then VM), then name.
+static int cmp_ordered(const void *a, const void *b) {
+    const struct size_item *x = &((const struct ordered_item *)a)->it;
+    const struct size_item *y = &((const struct ordered_item *)b)->it;
+    if (x->parent != y->parent) return x->parent < y->parent ? -1 : 1;
+    if (x->file != y->file) return x->file > y->file ? -1 : 1;
+    if (x->vm != y->vm) return x->vm > y->vm ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+// Sorts v with cmp_ordered; remap (may be NULL) receives new index by old.
+static int sort_items(struct size_item *v, size_t n, uint32_t *remap) {
+    struct ordered_item *o = malloc((n ? n : 1) * sizeof(*o));
+    if (!o) return -1;
+    for (size_t i = 0; i < n; i++) {
+        o[i].it = v[i];
+        o[i].orig = i;
+    }
+    qsort(o, n, sizeof(*o), cmp_ordered);
+    for (size_t i = 0; i < n; i++) {
+        v[i] = o[i].it;
+        if (remap) remap[o[i].orig] = (uint32_t)i;
+    }
+    free(o);
+    return 0;
+}
+
+// Index of the section holding a symbol: its n_sect when that agrees with
+// the address, else a lookup by address.
+static size_t symbol_section(const struct macho_image *img, const struct macho_symbol *s) {
+    if (s->sect >= 1 && s->sect <= img->nsects) {
+        const struct macho_section *sec = &img->sects[s->sect - 1];
+        if (s->addr >= sec->addr && s->addr - sec->addr < sec->size) return s->sect - 1u;
+    }
+    const struct macho_section *sec = macho_image_section_for_vm(img, s->addr);
+    return sec ? (size_t)(sec - img->sects) : img->nsects;
+}
+
+static int attribute_symbols(const struct macho_image *img, const struct debug_map *dm,
+                             struct size_report *r) {
+    struct macho_symbol *syms = NULL;
+    size_t n = macho_image_defined_symbols(img, &syms);
+    if (n == 0) {
+        free(syms);
+        return 0;
+    }
+    r->syms = malloc(n * sizeof(*r->syms));
+    if (!r->syms) {
+        free(syms);
+        return -1;
+    }
+    size_t k = 0;   // cursor into dm->by_addr, which is sorted like syms
+    for (size_t i = 0, j; i < n; i = j) {
+        // Aliases: every symbol at this address; an external one (the
+        // first by name) takes the bytes.
+        const struct macho_symbol *rep = NULL;
+        for (j = i; j < n && syms[j].addr == syms[i].addr; j++) {
+            if (!syms[j].name[0]) continue;
+            int ext = (syms[j].type & N_EXT) != 0;
+            int rep_ext = rep && (rep->type & N_EXT) != 0;
+            if (!rep || ext > rep_ext || (ext == rep_ext && strcmp(syms[j].name, rep->name) < 0)) {
+                rep = &syms[j];
+            }
+        }
+        if (!rep) continue;
+        size_t si = symbol_section(img, rep);
+        if (si == img->nsects) continue;
+        const struct macho_section *sec = &img->sects[si];
+        uint64_t end = sec->addr + sec->size;
+        if (j < n && syms[j].addr < end) end = syms[j].addr;
+        uint64_t size = end - rep->addr;
+
+        struct size_item *it = &r->syms[r->nsyms++];
+        it->name = rep->name;
+        it->parent = (uint32_t)si;
+        it->vm = size;
+        it->file = is_zerofill(sec->flags) ? 0 : size;
+        it->object = SIZE_NO_OBJECT;
+        while (k < dm->naddr && dm->by_addr[k].addr < rep->addr) k++;
+        if (k < dm->naddr && dm->by_addr[k].addr == rep->addr) it->object = dm->by_addr[k].object;
+        else if (rep->type & N_EXT) it->object = object_by_name(dm, rep->name);
+    }
+    free(syms);
+    return 0;
+}
+
+int size_report_build(const struct macho_image *img, struct size_report *out,
+                      char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    struct debug_map dm;
+    if (debug_map_build(img, &dm) != 0) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    // Real sections first, at their image indices (symbols refer to them
+    // by that index until the sort), then the synthetic entries: header,
+    // __LINKEDIT parts (at most 13), one padding entry per segment.
+    size_t cap = img->nsects + 2 * img->nsegs + 16;
+    out->segs = calloc(img->nsegs + 1, sizeof(*out->segs));
+    out->sects = calloc(cap, sizeof(*out->sects));
+    uint32_t *remap = malloc(cap * sizeof(*remap));
+    uint64_t *seg_file = calloc(img->nsegs + 1, sizeof(*seg_file));
+    uint64_t *seg_vm = calloc(img->nsegs + 1, sizeof(*seg_vm));
+    if (!out->segs || !out->sects || !remap || !seg_file || !seg_vm) goto oom;
+
+    out->file_size = img->size;
+    uint64_t mapped = 0;
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct segment_map *s = &img->segs[i];
+        struct size_item *it = &out->segs[out->nsegs++];
+        it->name = s->name;
+        it->object = SIZE_NO_OBJECT;
+        it->file = s->fileoff >= img->size ? 0 :
+                   s->filesize < img->size - s->fileoff ? s->filesize : img->size - s->fileoff;
+        it->vm = s->vmsize;
+        // Reservations (__PAGEZERO) are listed but left out of the total.
+        if (s->initprot || s->maxprot || s->filesize) out->vm_size += s->vmsize;
+        mapped += it->file;
+    }
+    if (mapped < out->file_size) {
+        struct size_item it = { "[unmapped]", 0, SIZE_NO_OBJECT, out->file_size - mapped, 0 };
+        out->segs[out->nsegs++] = it;
+    }
+
+    for (size_t i = 0; i < img->nsects; i++) {
+        const struct macho_section *sec = &img->sects[i];
+        struct size_item *it = &out->sects[out->nsects++];
+        it->name = sec->sectname;
+        it->parent = sec->segment < img->nsegs ? sec->segment : (uint32_t)img->nsegs;
+        it->object = SIZE_NO_OBJECT;
+        it->vm = sec->size;
+        it->file = is_zerofill(sec->flags) ? 0 : sec->size;
+    }
+    uint64_t hdr = img->header_size + (uint64_t)img->sizeofcmds;
+    size_t hseg = segment_for_off(img, img->header_offset, hdr);
+    if (hseg < img->nsegs) {
+        struct size_item it = { "[mach-o header]", (uint32_t)hseg, SIZE_NO_OBJECT, hdr, hdr };
+        out->sects[out->nsects++] = it;
+    }
+    add_linkedit(img, out->sects, &out->nsects, cap - img->nsegs);
+
+    for (size_t i = 0; i < out->nsects; i++) {
+        seg_file[out->sects[i].parent] += out->sects[i].file;
+        seg_vm[out->sects[i].parent] += out->sects[i].vm;
+    }
+    for (size_t i = 0; i < img->nsegs; i++) {
+        const struct size_item *seg = &out->segs[i];
+        if (seg_file[i] == 0 && seg_vm[i] == 0) continue;   // no sections: the segment says it all
+        uint64_t f = seg->file > seg_file[i] ? seg->file - seg_file[i] : 0;
+        uint64_t v = seg->vm > seg_vm[i] ? seg->vm - seg_vm[i] : 0;
+        if (f == 0 && v == 0) continue;
+        struct size_item it = { "[padding]", (uint32_t)i, SIZE_NO_OBJECT, f, v };
+        out->sects[out->nsects++] = it;
+    }
+    // Sections whose segment is unknown are dropped rather than guessed.
+    size_t kept = 0;
+    for (size_t i = 0; i < out->nsects; i++) {
+        if (out->sects[i].parent < img->nsegs) out->sects[kept++] = out->sects[i];
+    }
+    size_t real = img->nsects;
+    for (size_t i = 0; i < img->nsects; i++) {
+        if (img->sects[i].segment >= img->nsegs) real--;
+    }
+
+    if (attribute_symbols(img, &dm, out) != 0) goto oom;
+    if (real != img->nsects) {
+        // Symbol parents are image section indices: drop the symbols of
+        // dropped sections and renumber the rest.
+        size_t w = 0;
+        for (size_t i = 0, idx = 0; i < img->nsects; i++) {
+            remap[i] = img->sects[i].segment < img->nsegs ? (uint32_t)idx++ : UINT32_MAX;
+        }
+        for (size_t i = 0; i < out->nsyms; i++) {
+            uint32_t p = remap[out->syms[i].parent];
+            if (p == UINT32_MAX) continue;
+            out->syms[w] = out->syms[i];
+            out->syms[w++].parent = p;
+        }
+        out->nsyms = w;
+    }
+    out->nsects = kept;
+    if (sort_items(out->sects, out->nsects, remap) != 0) goto oom;
+    for (size_t i = 0; i < out->nsyms; i++) out->syms[i].parent = remap[out->syms[i].parent];
+    if (sort_items(out->syms, out->nsyms, NULL) != 0) goto oom;
+
+    if (dm.nobjs) {
+        out->objs = calloc(dm.nobjs, sizeof(*out->objs));
+        if (!out->objs) goto oom;
+        out->nobjs = dm.nobjs;
+        for (size_t i = 0; i < dm.nobjs; i++) {
+            out->objs[i].name = dm.objs[i];
+            out->objs[i].object = SIZE_NO_OBJECT;
+        }
+        for (size_t i = 0; i < out->nsyms; i++) {
+            const struct size_item *s = &out->syms[i];
+            if (s->object == SIZE_NO_OBJECT) continue;
+            out->objs[s->object].file += s->file;
+            out->objs[s->object].vm += s->vm;
+        }
+        uint32_t *objmap = malloc(dm.nobjs * sizeof(*objmap));
+        if (!objmap || sort_items(out->objs, out->nobjs, objmap) != 0) {
+            free(objmap);
+            goto oom;
+        }
+        for (size_t i = 0; i < out->nsyms; i++) {
+            if (out->syms[i].object != SIZE_NO_OBJECT) {
+                out->syms[i].object = objmap[out->syms[i].object];
+            }
+        }
+        free(objmap);
+    }
+
+    free(remap);
+    free(seg_file);
+    free(seg_vm);
+    debug_map_free(&dm);
+    return 0;
+
+oom:
+    free(remap);
+    free(seg_file);
+    free(seg_vm);
+    debug_map_free(&dm);
+    size_report_free(out);
+    snprintf(errbuf, errlen, "out of memory");
+    return -1;
+}
+
+void size_report_free(struct size_report *r) {
+    free(r->segs);
+    free(r->sects);
+    free(r->syms);
+    free(r->objs);
+    memset(r, 0, sizeof(*r));
+}
+
+static const char *fmt_size(char *buf, size_t len, uint64_t v) {
+    if (v < 1024) snprintf(buf, len, "%llu", (unsigned long long)v);
+    else if (v < (1ull << 20)) snprintf(buf, len, "%.1fKi", (double)v / 1024);
+    else if (v < (1ull << 30)) snprintf(buf, len, "%.1fMi", (double)v / (1 << 20));
+    else snprintf(buf, len, "%.1fGi", (double)v / (1 << 30));
+    return buf;
+}
+
+static double pct(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static const char *fmt_pct(char *buf, size_t len, uint64_t part, uint64_t whole) {
+    if (part > whole) snprintf(buf, len, "-");
+    else snprintf(buf, len, "%.1f%%", pct(part, whole));
+    return buf;
+}
+
+static void print_row(const struct size_report *r, int indent, const char *name,
+                      uint64_t file, uint64_t vm) {
+    char fp[16];
+    char fb[16];
+    char vp[16];
+    char vb[16];
+    printf(" %7s %8s  %7s %8s   %*s%s\n", fmt_pct(fp, sizeof(fp), file, r->file_size),
+           fmt_size(fb, sizeof(fb), file), fmt_pct(vp, sizeof(vp), vm, r->vm_size),
+           fmt_size(vb, sizeof(vb), vm), indent, "", name);
+}
+
+void size_report_print(const struct size_report *r, size_t top) {
+    printf("      FILE SIZE          VM SIZE\n");
+    printf(" ----------------  ----------------\n");
+    size_t sc = 0;   // sections and symbols are sorted by parent
+    size_t yc = 0;
+    uint64_t sym_file = 0;
+    uint64_t obj_file = 0;
+    for (size_t i = 0; i < r->nsegs; i++) {
+        const struct size_item *seg = &r->segs[i];
+        print_row(r, 0, seg->name, seg->file, seg->vm);
+        for (; sc < r->nsects && r->sects[sc].parent == i; sc++) {
+            const struct size_item *sec = &r->sects[sc];
+            if (sec->file == 0 && sec->vm == 0) continue;
+            print_row(r, 2, sec->name, sec->file, sec->vm);
+            size_t shown = 0;
+            size_t more = 0;
+            uint64_t more_file = 0;
+            uint64_t more_vm = 0;
+            uint64_t in_file = 0;
+            uint64_t in_vm = 0;
+            for (; yc < r->nsyms && r->syms[yc].parent == sc; yc++) {
+                const struct size_item *s = &r->syms[yc];
+                in_file += s->file;
+                in_vm += s->vm;
+                if (s->object != SIZE_NO_OBJECT) obj_file += s->file;
+                if (shown < top) {
+                    print_row(r, 4, s->name, s->file, s->vm);
+                    shown++;
+                } else {
+                    more++;
+                    more_file += s->file;
+                    more_vm += s->vm;
+                }
+            }
+            sym_file += in_file;
+            if (more) {
+                char label[48];
+                snprintf(label, sizeof(label), "[%zu more symbols]", more);
+                print_row(r, 4, label, more_file, more_vm);
+            }
+            if (shown && (sec->file > in_file || sec->vm > in_vm)) {
+                print_row(r, 4, "[no symbol]", sec->file - in_file, sec->vm - in_vm);
+            }
+        }
+    }
+    print_row(r, 0, "TOTAL", r->file_size, r->vm_size);
+
+    if (r->nobjs == 0) {
+        printf("\nno debug map (N_OSO stabs): object files unknown\n");
+        return;
+    }
+    printf("\nobject files (%zu, from the debug map; %.1f%% of symbol bytes attributed):\n",
+           r->nobjs, pct(obj_file, sym_file));
+    uint64_t more_file = 0;
+    uint64_t more_vm = 0;
+    for (size_t i = 0; i < r->nobjs; i++) {
+        if (i < top) print_row(r, 2, r->objs[i].name, r->objs[i].file, r->objs[i].vm);
+        else {
+            more_file += r->objs[i].file;
+            more_vm += r->objs[i].vm;
+        }
+    }
+    if (r->nobjs > top) {
+        char label[48];
+        snprintf(label, sizeof(label), "[%zu more objects]", r->nobjs - top);
+        print_row(r, 2, label, more_file, more_vm);
+    }
+}
+
+// Diff: every level becomes (scope, name, file, vm) keys sorted by name,
+// merged in one pass.
+struct size_key {
+    const char *scope;
+    const char *name;
+    uint64_t file;
+    uint64_t vm;
+};
+
+struct size_delta {
+    const char *scope;
+    const char *name;
+    uint64_t old_file;
+    uint64_t new_file;
+    uint64_t old_vm;
+    uint64_t new_vm;
+};
+
+static int cmp_key(const void *a, const void *b) {
+    const struct size_key *x = a;
+    const struct size_key *y = b;
+    int c = strcmp(x->scope, y->scope);
+    return c ? c : strcmp(x->name, y->name);
+}
+
+static int64_t dfile(const struct size_delta *d) {
+    return (int64_t)(d->new_file - d->old_file);
+}
+
+static int64_t dvm(const struct size_delta *d) {
+    return (int64_t)(d->new_vm - d->old_vm);
+}
+
+static uint64_t mag(int64_t v) {
+    return v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+}
+
+// Largest change first: file bytes, then VM bytes, then name.
+static int cmp_delta(const void *a, const void *b) {
+    const struct size_delta *x = a;
+    const struct size_delta *y = b;
+    uint64_t fx = mag(dfile(x));
+    uint64_t fy = mag(dfile(y));
+    if (fx != fy) return fx > fy ? -1 : 1;
+    uint64_t vx = mag(dvm(x));
+    uint64_t vy = mag(dvm(y));
+    if (vx != vy) return vx > vy ? -1 : 1;
+    int c = strcmp(x->scope, y->scope);
+    return c ? c : strcmp(x->name, y->name);
+}
+
+// Keys for one level of a report: 0 segments, 1 sections, 2 symbols,
+// 3 objects. Sections are scoped by their segment.
+static struct size_key *level_keys(const struct size_report *r, int level, size_t *n) {
+    const struct size_item *v = level == 0 ? r->segs : level == 1 ? r->sects :
+                                level == 2 ? r->syms : r->objs;
+    *n = level == 0 ? r->nsegs : level == 1 ? r->nsects : level == 2 ? r->nsyms : r->nobjs;
+    struct size_key *k = malloc((*n ? *n : 1) * sizeof(*k));
+    if (!k) return NULL;
+    for (size_t i = 0; i < *n; i++) {
+        k[i].scope = level == 1 ? r->segs[v[i].parent].name : "";
+        k[i].name = v[i].name;
+        k[i].file = v[i].file;
+        k[i].vm = v[i].vm;
+    }
+    qsort(k, *n, sizeof(*k), cmp_key);
+    return k;
+}
+
+// Changed entries of one level, largest change first. Same-named entries
+// (local symbols from different files) are summed.
+static struct size_delta *level_diff(const struct size_report *a, const struct size_report *b,
+                                     int level, size_t *nout) {
+    size_t na = 0;
+    size_t nb = 0;
+    struct size_key *ka = level_keys(a, level, &na);
+    struct size_key *kb = level_keys(b, level, &nb);
+    struct size_delta *d = malloc((na + nb ? na + nb : 1) * sizeof(*d));
+    if (!ka || !kb || !d) {
+        free(ka);
+        free(kb);
+        free(d);
+        return NULL;
+    }
+    size_t n = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na || j < nb) {
+        const struct size_key *key = i == na ? &kb[j] : j == nb ? &ka[i] :
+                                     cmp_key(&ka[i], &kb[j]) <= 0 ? &ka[i] : &kb[j];
+        struct size_delta cur = { key->scope, key->name, 0, 0, 0, 0 };
+        for (; i < na && cmp_key(&ka[i], key) == 0; i++) {
+            cur.old_file += ka[i].file;
+            cur.old_vm += ka[i].vm;
+        }
+        for (; j < nb && cmp_key(&kb[j], key) == 0; j++) {
+            cur.new_file += kb[j].file;
+            cur.new_vm += kb[j].vm;
+        }
+        if (cur.old_file != cur.new_file || cur.old_vm != cur.new_vm) d[n++] = cur;
+    }
+    free(ka);
+    free(kb);
+    qsort(d, n, sizeof(*d), cmp_delta);
+    *nout = n;
+    return d;
+}
+
+static const char *fmt_delta(char *buf, size_t len, int64_t v) {
+    char s[16];
+    if (v == 0) snprintf(buf, len, "0");
+    else snprintf(buf, len, "%c%s", v < 0 ? '-' : '+', fmt_size(s, sizeof(s), mag(v)));
+    return buf;
+}
+
+static const char *fmt_change(char *buf, size_t len, uint64_t before, uint64_t after) {
+    if (before == after) snprintf(buf, len, " ");
+    else if (before == 0) snprintf(buf, len, "[NEW]");
+    else if (after == 0) snprintf(buf, len, "[DEL]");
+    else snprintf(buf, len, "%+.1f%%", 100.0 * ((double)after - (double)before) / (double)before);
+    return buf;
+}
+
+static void print_delta_row(int indent, const char *scope, const char *name, uint64_t old_file,
+                            uint64_t new_file, uint64_t old_vm, uint64_t new_vm) {
+    char fd[20];
+    char fc[20];
+    char vd[20];
+    char vc[20];
+    printf(" %9s %8s  %9s %8s   %*s%s%s%s\n",
+           fmt_delta(fd, sizeof(fd), (int64_t)(new_file - old_file)),
+           fmt_change(fc, sizeof(fc), old_file, new_file),
+           fmt_delta(vd, sizeof(vd), (int64_t)(new_vm - old_vm)),
+           fmt_change(vc, sizeof(vc), old_vm, new_vm), indent, "", scope,
+           scope[0] ? "," : "", name);
+}
+
+int size_report_diff(const struct size_report *a, const struct size_report *b, size_t top) {
+    static const char *const titles[] = { "segments", "sections", "symbols", "object files" };
+    printf("        FILE SIZE              VM SIZE\n");
+    printf(" --------------------  --------------------\n");
+    for (int level = 0; level < 4; level++) {
+        size_t n = 0;
+        struct size_delta *d = level_diff(a, b, level, &n);
+        if (!d) return -1;
+        if (n == 0) {
+            free(d);
+            continue;
+        }
+        printf("%s:\n", titles[level]);
+        // Segments and sections are few: all of them. Symbols and objects:
+        // the top ones and a summary line.
+        size_t show = level < 2 || n < top ? n : top;
+        for (size_t i = 0; i < show; i++) {
+            print_delta_row(2, d[i].scope, d[i].name, d[i].old_file, d[i].new_file,
+                            d[i].old_vm, d[i].new_vm);
+        }
+        if (show < n) {
+            uint64_t of = 0, nf = 0, ov = 0, nv = 0;
+            for (size_t i = show; i < n; i++) {
+                of += d[i].old_file;
+                nf += d[i].new_file;
+                ov += d[i].old_vm;
+                nv += d[i].new_vm;
+            }
+            char label[48];
+            snprintf(label, sizeof(label), "[%zu more changed]", n - show);
+            print_delta_row(2, "", label, of, nf, ov, nv);
+        }
+        free(d);
+    }
+    print_delta_row(0, "", "TOTAL", a->file_size, b->file_size, a->vm_size, b->vm_size);
+    return 0;
+}
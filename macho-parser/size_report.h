@@ -0,0 +1,62 @@
+#ifndef MACHO_SIZE_REPORT_H
+#define MACHO_SIZE_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Where the bytes of a binary go, in file and in VM: segment -> section ->
+// symbol, plus the object file each symbol came from when the symbol table
+// still carries the linker's debug map (N_OSO stabs).
+//
+// Every byte is attributed once. A section's bytes go to the symbols it
+// contains, each owning up to the next symbol (aliases at one address
+// count once, under the external name); what precedes the first symbol is
+// left to the section. __LINKEDIT is split by the load commands that point
+// into it (symbol and string tables, fixups, exports, signature, ...), the
+// header and load commands get their own entry, and what remains of a
+// segment is padding. The symbol array from macho_image_defined_symbols is
+// already sorted, so attribution is one linear pass over it.
+//
+// Names alias the image (and its buffer) or are string literals; the
+// image must outlive the report.
+
+#define SIZE_NO_OBJECT UINT32_MAX
+
+struct size_item {
+    const char *name;
+    uint32_t parent;       // sections: index into segs; symbols: into sects
+    uint32_t object;       // symbols: index into objs, or SIZE_NO_OBJECT
+    uint64_t file;
+    uint64_t vm;
+};
+
+struct size_report {
+    uint64_t file_size;            // the slice
+    uint64_t vm_size;              // sum of segment vmsize, reservations excepted
+    struct size_item *segs;        // load order; "[unmapped]" last if needed
+    size_t nsegs;
+    struct size_item *sects;       // by segment, then largest first
+    size_t nsects;
+    struct size_item *syms;        // by section, then largest first
+    size_t nsyms;
+    struct size_item *objs;        // largest first
+    size_t nobjs;
+};
+
+// Returns 0, or -1 with a reason (out of memory).
+int size_report_build(const struct macho_image *img, struct size_report *out,
+                      char *errbuf, size_t errlen);
+void size_report_free(struct size_report *r);
+
+// The segment/section/symbol tree, then objects; `top` symbols per section
+// and `top` objects are listed, the rest summed.
+void size_report_print(const struct size_report *r, size_t top);
+
+// What changed from a to b: segments and sections matched by name, then
+// the `top` symbols and objects with the largest change. Returns 0, or -1
+// on allocation failure.
+int size_report_diff(const struct size_report *a, const struct size_report *b, size_t top);
+
+#endif /* MACHO_SIZE_REPORT_H */
@@ -0,0 +1,460 @@
+#include "synth.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/nlist.h"
+#include "../include/mach/machine.h"
+
+#include "macho_common.h"
+#include "universal.h"
+
+#ifndef CPU_SUBTYPE_ARM64_ALL
+#define CPU_SUBTYPE_ARM64_ALL 0
+#endif
+#ifndef CPU_SUBTYPE_X86_64_ALL
+#define CPU_SUBTYPE_X86_64_ALL 3
+#endif
+#ifndef VM_PROT_NONE
+#define VM_PROT_NONE 0
+#endif
+
+#define SYNTH_BASE 0x100000000ull
+#define SYNTH_MAX_COUNT (1u << 24)
+
+static void set_err(char *errbuf, size_t errlen, const char *fmt, ...) {
+    if (!errbuf || errlen == 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(errbuf, errlen, fmt, ap);
+    va_end(ap);
+}
+
+void macho_synth_defaults(struct macho_synth_opts *o) {
+    memset(o, 0, sizeof(*o));
+    o->kind = SYNTH_THIN;
+    o->cmds = 32;
+    o->sects = 16;
+    o->syms = 1000;
+    o->dylibs = 8;
+    o->fixups = 2000;
+    o->seed = 1;
+}
+
+const char *macho_synth_kind_name(enum macho_synth_kind k) {
+    switch (k) {
+        case SYNTH_THIN: return "thin";
+        case SYNTH_FAT: return "fat";
+        case SYNTH_FAT64: return "fat64";
+    }
+    return "?";
+}
+
+static uint64_t splitmix64(uint64_t *s) {
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) & ~(a - 1);
+}
+
+// ---- growable byte buffer for the __LINKEDIT streams ----
+
+struct obuf {
+    uint8_t *p;
+    size_t n;
+    size_t cap;
+    int oom;
+};
+
+static void ob_put(struct obuf *b, const void *src, size_t len) {
+    if (b->oom) return;
+    if (b->n + len > b->cap) {
+        size_t ncap = b->cap ? b->cap : 256;
+        while (ncap < b->n + len) ncap *= 2;
+        uint8_t *np = realloc(b->p, ncap);
+        if (!np) {
+            b->oom = 1;
+            return;
+        }
+        b->p = np;
+        b->cap = ncap;
+    }
+    memcpy(b->p + b->n, src, len);
+    b->n += len;
+}
+
+static void ob_byte(struct obuf *b, uint8_t v) {
+    ob_put(b, &v, 1);
+}
+
+static void ob_uleb(struct obuf *b, uint64_t v) {
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        if (v) byte |= 0x80;
+        ob_byte(b, byte);
+    } while (v);
+}
+
+static void ob_align(struct obuf *b, size_t a) {
+    while (b->n % a) ob_byte(b, 0);
+}
+
+// ---- load command writers: the slice buffer is zeroed, so names and
+// padding need no explicit fill ----
+
+static void w32(uint8_t **c, uint32_t v) {
+    store32_u(*c, v, 0);
+    *c += 4;
+}
+
+static void w64(uint8_t **c, uint64_t v) {
+    store64_u(*c, v, 0);
+    *c += 8;
+}
+
+static void wname(uint8_t **c, const char *name) {
+    memcpy(*c, name, strlen(name));
+    *c += 16;
+}
+
+static void w_segment(uint8_t **c, const char *name, uint32_t nsects, uint64_t vmaddr,
+                      uint64_t vmsize, uint64_t fileoff, uint64_t filesize, uint32_t prot) {
+    w32(c, LC_SEGMENT_64);
+    w32(c, (uint32_t)(sizeof(struct segment_command_64) + nsects * sizeof(struct section_64)));
+    wname(c, name);
+    w64(c, vmaddr);
+    w64(c, vmsize);
+    w64(c, fileoff);
+    w64(c, filesize);
+    w32(c, prot);
+    w32(c, prot);
+    w32(c, nsects);
+    w32(c, 0);
+}
+
+static void w_section(uint8_t **c, const char *sect, const char *seg, uint64_t addr,
+                      uint64_t size, uint32_t offset, uint32_t align, uint32_t flags) {
+    wname(c, sect);
+    wname(c, seg);
+    w64(c, addr);
+    w64(c, size);
+    w32(c, offset);
+    w32(c, align);
+    w32(c, 0);
+    w32(c, 0);
+    w32(c, flags);
+    *c += 12;   // reserved1..3
+}
+
+static uint32_t lc_str_size(size_t fixed, const char *s) {
+    return (uint32_t)align_up(fixed + strlen(s) + 1, 8);
+}
+
+static void w_lc_str(uint8_t **c, uint32_t cmd, size_t fixed, const char *s) {
+    uint8_t *start = *c;
+    uint32_t size = lc_str_size(fixed, s);
+    w32(c, cmd);
+    w32(c, size);
+    w32(c, (uint32_t)fixed);
+    memcpy(start + fixed, s, strlen(s));
+    *c = start + size;
+}
+
+static void dylib_name(char *out, size_t len, uint32_t i) {
+    if (i == 0) snprintf(out, len, "/usr/lib/libSystem.B.dylib");
+    else snprintf(out, len, "@rpath/libsynth%u.dylib", i);
+}
+
+static int build_slice(const struct macho_synth_opts *o, uint32_t cputype, uint64_t seed,
+                       uint8_t **out, size_t *out_size, char *errbuf, size_t errlen) {
+    int arm64 = (cputype == (uint32_t)CPU_TYPE_ARM64);
+    uint64_t page = arm64 ? 0x4000 : 0x1000;
+    uint32_t nd = o->dylibs ? o->dylibs : 1;
+    uint32_t nsects = o->sects < 2 ? 2 : o->sects;
+    uint32_t ntext = nsects - 1;
+    uint32_t fixed_cmds = 10 + nd;
+    uint32_t ncmds = o->cmds < fixed_cmds ? fixed_cmds : o->cmds;
+    uint32_t nrpath = ncmds - fixed_cmds;
+    uint32_t nreb = o->fixups / 2;
+    uint32_t nbind = o->fixups - nreb;
+    char name[64];
+
+    // Load command area.
+    uint64_t cmds_size = 4 * sizeof(struct segment_command_64) +
+                         (uint64_t)nsects * sizeof(struct section_64) +
+                         sizeof(struct dyld_info_command) + sizeof(struct symtab_command) +
+                         sizeof(struct dysymtab_command) + sizeof(struct uuid_command) +
+                         sizeof(struct entry_point_command) +
+                         lc_str_size(sizeof(struct dylinker_command), "/usr/lib/dyld");
+    for (uint32_t i = 0; i < nd; i++) {
+        dylib_name(name, sizeof(name), i);
+        cmds_size += lc_str_size(sizeof(struct dylib_command), name);
+    }
+    for (uint32_t i = 0; i < nrpath; i++) {
+        snprintf(name, sizeof(name), "@loader_path/../lib%u", i);
+        cmds_size += lc_str_size(sizeof(struct rpath_command), name);
+    }
+    if (cmds_size > UINT32_MAX / 2) {
+        set_err(errbuf, errlen, "load commands too large (%llu bytes)",
+                (unsigned long long)cmds_size);
+        return -1;
+    }
+
+    // __TEXT: header, load commands, padding, then __text and the filler
+    // sections.
+    uint64_t text_start = align_up(sizeof(struct mach_header_64) + cmds_size + o->headerpad, 16);
+    uint64_t code_size = o->syms * 16ull < 64 ? 64 : o->syms * 16ull;
+    uint64_t text_end = text_start + code_size + 64ull * (ntext - 1);
+    uint64_t text_filesize = align_up(text_end, page);
+    uint64_t data_off = text_filesize;
+    uint64_t data_size = o->fixups ? o->fixups * 8ull : 8;
+    uint64_t data_filesize = align_up(data_size, page);
+    uint64_t data_vm = SYNTH_BASE + data_off;
+
+    // __LINKEDIT streams.
+    struct obuf rebase = { 0 }, bind = { 0 }, syms = { 0 }, strs = { 0 };
+    if (nreb) {
+        ob_byte(&rebase, REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+        ob_byte(&rebase, REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 2);
+        ob_uleb(&rebase, 0);
+        ob_byte(&rebase, REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+        ob_uleb(&rebase, nreb);
+    }
+    ob_byte(&rebase, REBASE_OPCODE_DONE);
+    ob_align(&rebase, 8);
+
+    ob_put(&strs, " ", 2);
+    for (uint32_t i = 0; i < o->syms; i++) {
+        uint8_t nl[16] = { 0 };
+        store32_u(nl, (uint32_t)strs.n, 0);
+        nl[4] = N_SECT | N_EXT;
+        nl[5] = 1;
+        store64_u(nl + 8, SYNTH_BASE + text_start + 16ull * i, 0);
+        ob_put(&syms, nl, sizeof(nl));
+        int n = snprintf(name, sizeof(name), "_synth_fn_%u", i);
+        ob_put(&strs, name, (size_t)n + 1);
+    }
+    if (nbind) {
+        ob_byte(&bind, BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+        ob_byte(&bind, BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 2);
+        ob_uleb(&bind, 8ull * nreb);
+    }
+    for (uint32_t i = 0; i < nbind; i++) {
+        uint32_t ord = 1 + i % nd;
+        if (ord <= BIND_IMMEDIATE_MASK) {
+            ob_byte(&bind, BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | (uint8_t)ord);
+        } else {
+            ob_byte(&bind, BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB);
+            ob_uleb(&bind, ord);
+        }
+        int n = snprintf(name, sizeof(name), "_synth_import_%u", i);
+        ob_byte(&bind, BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+        ob_put(&bind, name, (size_t)n + 1);
+        ob_byte(&bind, BIND_OPCODE_DO_BIND);
+
+        uint8_t nl[16] = { 0 };
+        store32_u(nl, (uint32_t)strs.n, 0);
+        nl[4] = N_UNDF | N_EXT;
+        nl[7] = (uint8_t)(ord > 255 ? 255 : ord);     // n_desc: library ordinal
+        ob_put(&syms, nl, sizeof(nl));
+        ob_put(&strs, name, (size_t)n + 1);
+    }
+    ob_byte(&bind, BIND_OPCODE_DONE);
+    ob_align(&bind, 8);
+    ob_align(&strs, 8);
+
+    if (rebase.oom || bind.oom || syms.oom || strs.oom) {
+        free(rebase.p);
+        free(bind.p);
+        free(syms.p);
+        free(strs.p);
+        set_err(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    uint64_t le_off = data_off + data_filesize;
+    uint64_t rebase_off = le_off;
+    uint64_t bind_off = rebase_off + rebase.n;
+    uint64_t sym_off = bind_off + bind.n;
+    uint64_t str_off = sym_off + syms.n;
+    uint64_t le_size = str_off + strs.n - le_off;
+    uint64_t file_size = le_off + le_size;
+
+    uint8_t *f = file_size <= SIZE_MAX ? calloc(1, (size_t)file_size) : NULL;
+    if (!f || str_off + strs.n > UINT32_MAX) {
+        free(f);
+        free(rebase.p);
+        free(bind.p);
+        free(syms.p);
+        free(strs.p);
+        set_err(errbuf, errlen, f ? "file too large for 32-bit offsets" : "out of memory");
+        return -1;
+    }
+    memcpy(f + rebase_off, rebase.p, rebase.n);
+    memcpy(f + bind_off, bind.p, bind.n);
+    memcpy(f + sym_off, syms.p, syms.n);
+    memcpy(f + str_off, strs.p, strs.n);
+    free(rebase.p);
+    free(bind.p);
+    free(syms.p);
+    free(strs.p);
+
+    uint8_t *c = f;
+    w32(&c, MH_MAGIC_64);
+    w32(&c, cputype);
+    w32(&c, arm64 ? CPU_SUBTYPE_ARM64_ALL : CPU_SUBTYPE_X86_64_ALL);
+    w32(&c, MH_EXECUTE);
+    w32(&c, ncmds);
+    w32(&c, (uint32_t)cmds_size);
+    w32(&c, MH_NOUNDEFS | MH_DYLDLINK | MH_TWOLEVEL | MH_PIE);
+    w32(&c, 0);
+
+    w_segment(&c, SEG_PAGEZERO, 0, 0, SYNTH_BASE, 0, 0, VM_PROT_NONE);
+    w_segment(&c, SEG_TEXT, ntext, SYNTH_BASE, text_filesize, 0, text_filesize,
+              VM_PROT_READ | VM_PROT_EXECUTE);
+    w_section(&c, SECT_TEXT, SEG_TEXT, SYNTH_BASE + text_start, code_size,
+              (uint32_t)text_start, 4, S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS);
+    for (uint32_t i = 1; i < ntext; i++) {
+        uint64_t off = text_start + code_size + 64ull * (i - 1);
+        snprintf(name, sizeof(name), "__synth%u", i);
+        w_section(&c, name, SEG_TEXT, SYNTH_BASE + off, 64, (uint32_t)off, 4, S_REGULAR);
+    }
+    w_segment(&c, SEG_DATA, 1, data_vm, data_filesize, data_off, data_filesize,
+              VM_PROT_READ | VM_PROT_WRITE);
+    w_section(&c, SECT_DATA, SEG_DATA, data_vm, data_size, (uint32_t)data_off, 3, S_REGULAR);
+    w_segment(&c, SEG_LINKEDIT, 0, data_vm + data_filesize, align_up(le_size, page), le_off,
+              le_size, VM_PROT_READ);
+
+    w32(&c, LC_DYLD_INFO_ONLY);
+    w32(&c, sizeof(struct dyld_info_command));
+    w32(&c, (uint32_t)rebase_off);
+    w32(&c, (uint32_t)rebase.n);
+    w32(&c, (uint32_t)bind_off);
+    w32(&c, (uint32_t)bind.n);
+    c += 6 * 4;     // no weak, lazy or export data
+
+    w32(&c, LC_SYMTAB);
+    w32(&c, sizeof(struct symtab_command));
+    w32(&c, (uint32_t)sym_off);
+    w32(&c, o->syms + nbind);
+    w32(&c, (uint32_t)str_off);
+    w32(&c, (uint32_t)strs.n);
+
+    uint8_t *dy = c;
+    w32(&c, LC_DYSYMTAB);
+    w32(&c, sizeof(struct dysymtab_command));
+    store32_u(dy + offsetof(struct dysymtab_command, nextdefsym), o->syms, 0);
+    store32_u(dy + offsetof(struct dysymtab_command, iundefsym), o->syms, 0);
+    store32_u(dy + offsetof(struct dysymtab_command, nundefsym), nbind, 0);
+    c = dy + sizeof(struct dysymtab_command);
+
+    w_lc_str(&c, LC_LOAD_DYLINKER, sizeof(struct dylinker_command), "/usr/lib/dyld");
+
+    w32(&c, LC_UUID);
+    w32(&c, sizeof(struct uuid_command));
+    uint64_t s = seed;
+    w64(&c, splitmix64(&s));
+    w64(&c, splitmix64(&s));
+
+    w32(&c, LC_MAIN);
+    w32(&c, sizeof(struct entry_point_command));
+    w64(&c, text_start);
+    w64(&c, 0);
+
+    for (uint32_t i = 0; i < nd; i++) {
+        dylib_name(name, sizeof(name), i);
+        uint8_t *dl = c;
+        w_lc_str(&c, LC_LOAD_DYLIB, sizeof(struct dylib_command), name);
+        store32_u(dl + offsetof(struct dylib_command, dylib.timestamp), 2, 0);
+        store32_u(dl + offsetof(struct dylib_command, dylib.current_version), 0x10000, 0);
+        store32_u(dl + offsetof(struct dylib_command, dylib.compatibility_version), 0x10000, 0);
+    }
+    for (uint32_t i = 0; i < nrpath; i++) {
+        snprintf(name, sizeof(name), "@loader_path/../lib%u", i);
+        w_lc_str(&c, LC_RPATH, sizeof(struct rpath_command), name);
+    }
+
+    // Code: 16-byte functions ending in a return. Filler sections and
+    // rebased pointers (to the functions) fill the rest.
+    for (uint64_t off = 0; off + 16 <= code_size; off += 16) {
+        uint8_t *fn = f + text_start + off;
+        if (arm64) {
+            for (int k = 0; k < 3; k++) store32_u(fn + 4 * k, 0xd503201f, 0);   // nop
+            store32_u(fn + 12, 0xd65f03c0, 0);                                  // ret
+        } else {
+            memset(fn, 0x90, 15);
+            fn[15] = 0xc3;
+        }
+    }
+    for (uint64_t off = text_start + code_size; off < text_end; off += 8) {
+        store64_u(f + off, splitmix64(&s), 0);
+    }
+    uint32_t nfn = o->syms ? o->syms : 1;
+    for (uint32_t i = 0; i < nreb; i++) {
+        store64_u(f + data_off + 8ull * i, SYNTH_BASE + text_start + 16ull * (i % nfn), 0);
+    }
+
+    *out = f;
+    *out_size = (size_t)file_size;
+    return 0;
+}
+
+int macho_synth(const struct macho_synth_opts *o, uint8_t **out, size_t *size,
+                char *errbuf, size_t errlen) {
+    *out = NULL;
+    *size = 0;
+    if (o->cmds > SYNTH_MAX_COUNT || o->sects > SYNTH_MAX_COUNT || o->syms > SYNTH_MAX_COUNT ||
+        o->dylibs > SYNTH_MAX_COUNT || o->fixups > SYNTH_MAX_COUNT ||
+        o->headerpad > SYNTH_MAX_COUNT) {
+        set_err(errbuf, errlen, "counts are limited to %u", SYNTH_MAX_COUNT);
+        return -1;
+    }
+    if (o->kind == SYNTH_THIN) {
+        return build_slice(o, (uint32_t)CPU_TYPE_ARM64, o->seed, out, size, errbuf, errlen);
+    }
+
+    uint8_t *slices[2] = { NULL, NULL };
+    size_t sizes[2];
+    uint32_t cpus[2] = { (uint32_t)CPU_TYPE_ARM64, (uint32_t)CPU_TYPE_X86_64 };
+    for (int i = 0; i < 2; i++) {
+        if (build_slice(o, cpus[i], o->seed + (uint64_t)i, &slices[i], &sizes[i],
+                        errbuf, errlen) != 0) {
+            free(slices[0]);
+            return -1;
+        }
+    }
+    struct fat_slice fs[2];
+    memset(fs, 0, sizeof(fs));
+    for (int i = 0; i < 2; i++) {
+        fs[i].cputype = cpus[i];
+        fs[i].cpusubtype = load32_u(slices[i] + 8, 0);
+        fs[i].size = sizes[i];
+        fs[i].align = universal_default_align(cpus[i]);
+    }
+    int need64 = 0;
+    uint64_t total = universal_layout(fs, 2, o->kind == SYNTH_FAT64, &need64);
+    int fat64 = (o->kind == SYNTH_FAT64 || need64);
+    uint8_t *f = total <= SIZE_MAX ? calloc(1, (size_t)total) : NULL;
+    if (!f) {
+        free(slices[0]);
+        free(slices[1]);
+        set_err(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    universal_write_header(fs, 2, fat64, f);
+    for (int i = 0; i < 2; i++) {
+        memcpy(f + fs[i].offset, slices[i], sizes[i]);
+        free(slices[i]);
+    }
+    *out = f;
+    *size = (size_t)total;
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef MACHO_SYNTH_H
+#define MACHO_SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic Mach-O files for benchmarks and fuzz seeds: well-formed
+// MH_EXECUTE images whose size along each axis the parsers care about is
+// set by the caller.
+//
+// A slice is 64-bit (arm64, or x86_64 as the second slice of a FAT file)
+// and laid out like ld64 output:
+//   __PAGEZERO, __TEXT (the header, load commands and the code sections),
+//   __DATA (one __data section of pointers), __LINKEDIT (rebase and bind
+//   opcodes, symbol table, string table);
+//   LC_DYLD_INFO_ONLY, LC_SYMTAB, LC_DYSYMTAB, LC_LOAD_DYLINKER, LC_UUID,
+//   LC_MAIN and one LC_LOAD_DYLIB per library, then LC_RPATHs up to `cmds`.
+// Half of the fixups are rebases, the other half binds to distinct
+// imports spread over the libraries. Each defined symbol is a 16-byte
+// function in __text. Content depends only on the options, so a seed
+// names a corpus.
+
+enum macho_synth_kind {
+    SYNTH_THIN,
+    SYNTH_FAT,      // arm64 + x86_64
+    SYNTH_FAT64,    // the same with fat_arch_64 entries
+};
+
+struct macho_synth_opts {
+    enum macho_synth_kind kind;
+    uint32_t cmds;      // load commands per slice (at least 10 + dylibs)
+    uint32_t sects;     // sections per slice (at least 2)
+    uint32_t syms;      // defined symbols
+    uint32_t dylibs;    // LC_LOAD_DYLIB, libSystem first (at least 1)
+    uint32_t fixups;    // pointers in __data
+    uint32_t headerpad; // zero bytes after the load commands (ld -headerpad)
+    uint64_t seed;      // UUIDs and filler bytes
+};
+
+void macho_synth_defaults(struct macho_synth_opts *o);
+
+// Build one file. Returns 0 and a malloc'd buffer in *out, or -1 with a
+// reason in errbuf.
+int macho_synth(const struct macho_synth_opts *o, uint8_t **out, size_t *size,
+                char *errbuf, size_t errlen);
+
+const char *macho_synth_kind_name(enum macho_synth_kind k);
+
+#endif /* MACHO_SYNTH_H */
@@ -0,0 +1,44 @@
+# ABOUTME: Checks that --cfg and --match stay inside __text when a function start
+# ABOUTME: lands in the last partial word of the section (end would precede start).
+# ABOUTME: Run from the repository root after building macho-parser.
+#!/usr/bin/env sh
+set -eu
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+./macho-parser/macho_gen -n 1 -k thin --sects 2 --syms 2 "$TMP" >/dev/null
+BIN="$TMP/synth-0000-thin"
+
+# Write an N-byte little-endian value at a file offset: putle OFF VALUE N.
+putle() {
+    v=$2
+    esc=""
+    i=0
+    while [ $i -lt "$3" ]; do
+        esc="$esc$(printf '\\%03o' $((v & 255)))"
+        v=$((v >> 8))
+        i=$((i + 1))
+    done
+    printf "$esc" | dd of="$BIN" bs=1 seek="$1" conv=notrunc 2>/dev/null
+}
+get64() {
+    od -An -t u8 -j "$1" -N 8 "$BIN" | tr -d ' '
+}
+
+# section_64 for __text: sectname[16] segname[16] addr size offset.
+SECT=$(grep -obUa "__text" "$BIN" | head -n 1 | cut -d: -f1)
+ADDR=$(get64 $((SECT + 32)))
+OFF=$(od -An -t u4 -j $((SECT + 48)) -N 4 "$BIN" | tr -d ' ')
+
+# Move __text to addr+2 and shrink it to 15 bytes. The second symbol, at
+# addr+16, is then 14 bytes in: inside the section, but past the last
+# whole word at addr+2+12.
+putle $((SECT + 32)) $((ADDR + 2)) 8
+putle $((SECT + 40)) 15 8
+putle $((SECT + 48)) $((OFF + 2)) 4
+
+CFG=$(./macho-parser/macho_inspect --cfg "$BIN" 2>&1)
+echo "$CFG" | grep -q "func 0x$(printf '%x' $((ADDR + 16))) size=0x0 "
+
+./macho-parser/macho_inspect --match "$BIN" "$BIN" >/dev/null
@@ -0,0 +1,29 @@
+# ABOUTME: Checks that ipa_scan's default headers-only mode inflates less of a FAT
+# ABOUTME: member than the member's size, i.e. header rounds resume instead of restarting.
+# ABOUTME: Run from the repository root after building macho-parser; needs zip(1).
+#!/usr/bin/env sh
+set -eu
+
+if ! command -v zip >/dev/null 2>&1; then
+    echo "skip: zip not installed"
+    exit 0
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+mkdir -p "$TMP/Payload/Yes.app"
+cp ./macho-parser/macho/yes "$TMP/Payload/Yes.app/yes"
+(cd "$TMP" && zip -q -r app.ipa Payload)
+
+OUTPUT=$(./macho-parser/ipa_scan "$TMP/app.ipa")
+echo "$OUTPUT" | grep -q "x86_64   EXECUTE"
+echo "$OUTPUT" | grep -q "arm64    EXECUTE"
+
+# "...: members=3 machos=1 errors=0 inflated=N of M bytes (...)"
+INFLATED=$(echo "$OUTPUT" | sed -n 's/.* inflated=\([0-9]*\) of \([0-9]*\) bytes.*/\1/p')
+TOTAL=$(echo "$OUTPUT" | sed -n 's/.* inflated=\([0-9]*\) of \([0-9]*\) bytes.*/\2/p')
+if [ "$INFLATED" -ge "$TOTAL" ]; then
+    echo "fail: headers-only scan inflated $INFLATED of $TOTAL bytes" >&2
+    exit 1
+fi
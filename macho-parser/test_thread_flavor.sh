@@ -0,0 +1,35 @@
+# ABOUTME: Checks that macho_inspect decodes a thread pc only from the slice's own
+# ABOUTME: architecture's flavors: flavor 4 on arm64 is ARM_DEBUG_STATE, not x86 rip.
+# ABOUTME: Run from the repository root after building macho-parser.
+#!/usr/bin/env sh
+set -eu
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Little-endian 32-bit word as printf octal escapes.
+le32() {
+    printf '\\%03o\\%03o\\%03o\\%03o' $(($1 & 255)) $((($1 >> 8) & 255)) \
+        $((($1 >> 16) & 255)) $((($1 >> 24) & 255))
+}
+
+# Thin arm64 MH_EXECUTE with one LC_THREAD (cmd 4) carrying flavor 4, count 64.
+# Every state word is 0x41414141, which would print as an x86 rip.
+{
+    printf "$(le32 0xfeedfacf)$(le32 0x0100000c)$(le32 0)$(le32 2)"
+    printf "$(le32 1)$(le32 272)$(le32 0)$(le32 0)"
+    printf "$(le32 4)$(le32 272)$(le32 4)$(le32 64)"
+    i=0
+    while [ $i -lt 64 ]; do
+        printf "$(le32 0x41414141)"
+        i=$((i + 1))
+    done
+} >"$TMP/debug_state"
+
+OUTPUT=$(./macho-parser/macho_inspect "$TMP/debug_state" 2>&1)
+
+echo "$OUTPUT" | grep -q "state ARM_DEBUG_STATE (4) count=64"
+if echo "$OUTPUT" | grep -q "pc=0x"; then
+    echo "fail: arm64 ARM_DEBUG_STATE decoded as a thread pc" >&2
+    exit 1
+fi
@@ -0,0 +1,199 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "universal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/macho/loader.h"
+#include "../include/macho/fat.h"
+
+#include "budget.h"
+#include "macho_common.h"
+
+#ifndef FAT_MAGIC_64
+#define FAT_MAGIC_64 0xcafebabf
+#endif
+#ifndef FAT_CIGAM_64
+#define FAT_CIGAM_64 0xbfbafeca
+#endif
+
+int universal_read_head(const uint8_t *buf, size_t avail, uint64_t sz, struct fat_slice **out,
+                        size_t *n, int *is_fat, int *is64, char *errbuf, size_t errlen) {
+    *out = NULL;
+    *n = 0;
+    *is_fat = 0;
+    *is64 = 0;
+    if (sz < 8 || avail < 8) {
+        snprintf(errbuf, errlen, "file too small");
+        return -1;
+    }
+    uint32_t magic;
+    memcpy(&magic, buf, sizeof(magic));
+
+    if (magic != FAT_MAGIC && magic != FAT_CIGAM &&
+        magic != FAT_MAGIC_64 && magic != FAT_CIGAM_64) {
+        if (magic != MH_MAGIC && magic != MH_CIGAM &&
+            magic != MH_MAGIC_64 && magic != MH_CIGAM_64) {
+            snprintf(errbuf, errlen, "not a Mach-O (magic 0x%08x)", magic);
+            return -1;
+        }
+        if (avail < 12) {
+            snprintf(errbuf, errlen, "file too small");
+            return -1;
+        }
+        int swapped = (magic == MH_CIGAM || magic == MH_CIGAM_64);
+        struct fat_slice *s = calloc(1, sizeof(*s));
+        if (!s) {
+            snprintf(errbuf, errlen, "out of memory");
+            return -1;
+        }
+        s->cputype = load32_u(buf + 4, swapped);
+        s->cpusubtype = load32_u(buf + 8, swapped);
+        s->offset = 0;
+        s->size = sz;
+        s->align = universal_default_align(s->cputype);
+        *out = s;
+        *n = 1;
+        return 0;
+    }
+
+    if (macho_budget_check_fat(buf, avail, NULL, errbuf, errlen) != 0) return -1;
+    int fat64 = (magic == FAT_MAGIC_64 || magic == FAT_CIGAM_64);
+    uint32_t nfat = load32_be(buf + 4);
+    size_t entsz = fat64 ? 32 : 20;
+    if (nfat == 0 || (uint64_t)nfat * entsz > avail - 8) {
+        snprintf(errbuf, errlen, "bad fat_arch table (nfat_arch=%u)", nfat);
+        return -1;
+    }
+    struct fat_slice *s = calloc(nfat, sizeof(*s));
+    if (!s) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    for (uint32_t i = 0; i < nfat; i++) {
+        const uint8_t *e = buf + 8 + (size_t)i * entsz;
+        s[i].cputype = load32_be(e);
+        s[i].cpusubtype = load32_be(e + 4);
+        s[i].offset = fat64 ? load64_be(e + 8) : load32_be(e + 8);
+        s[i].size = fat64 ? load64_be(e + 16) : load32_be(e + 12);
+        s[i].align = fat64 ? load32_be(e + 24) : load32_be(e + 16);
+        if (s[i].offset > sz || s[i].size > sz - s[i].offset) {
+            snprintf(errbuf, errlen, "slice %u out of bounds", i);
+            free(s);
+            return -1;
+        }
+        if (s[i].align > 30) s[i].align = universal_default_align(s[i].cputype);
+    }
+    *out = s;
+    *n = nfat;
+    *is_fat = 1;
+    *is64 = fat64;
+    return 0;
+}
+
+int universal_read(const uint8_t *buf, size_t sz, struct fat_slice **out, size_t *n,
+                   int *is_fat, int *is64, char *errbuf, size_t errlen) {
+    return universal_read_head(buf, sz, sz, out, n, is_fat, is64, errbuf, errlen);
+}
+
+static int pread_full(int fd, uint8_t *buf, size_t len, uint64_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, buf + done, len - done, (off_t)(off + done));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+int universal_read_fd(int fd, uint64_t file_size, struct fat_slice **out, size_t *n,
+                      int *is_fat, int *is64, char *errbuf, size_t errlen) {
+    uint8_t head[8];
+    *out = NULL;
+    *n = 0;
+    if (file_size < sizeof(head) || pread_full(fd, head, sizeof(head), 0) != 0) {
+        snprintf(errbuf, errlen, "file too small");
+        return -1;
+    }
+    uint32_t magic;
+    memcpy(&magic, head, sizeof(magic));
+    size_t want = 12;
+    if (magic == FAT_MAGIC || magic == FAT_CIGAM || magic == FAT_MAGIC_64 ||
+        magic == FAT_CIGAM_64) {
+        uint64_t tab = 8 + (uint64_t)load32_be(head + 4) *
+                           ((magic == FAT_MAGIC || magic == FAT_CIGAM) ? 20 : 32);
+        if (tab > file_size) {
+            snprintf(errbuf, errlen, "bad fat_arch table (nfat_arch=%u)", load32_be(head + 4));
+            return -1;
+        }
+        want = (size_t)tab;
+    }
+    if (want > file_size) want = (size_t)file_size;
+    uint8_t *buf = malloc(want);
+    if (!buf) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    int rc = -1;
+    if (pread_full(fd, buf, want, 0) != 0) {
+        snprintf(errbuf, errlen, "read: %s", strerror(errno));
+    } else {
+        rc = universal_read_head(buf, want, file_size, out, n, is_fat, is64, errbuf, errlen);
+    }
+    free(buf);
+    return rc;
+}
+
+uint32_t universal_default_align(uint32_t cputype) {
+    return cputype == (uint32_t)CPU_TYPE_ARM64 ? 14 : 12;
+}
+
+size_t universal_header_size(size_t n, int fat64) {
+    return 8 + n * (fat64 ? 32 : 20);
+}
+
+uint64_t universal_layout(struct fat_slice *s, size_t n, int force64, int *need64) {
+    // Lay out for the 32-bit header first; if anything overflows, redo it
+    // with the (larger) FAT64 header.
+    for (int fat64 = force64 ? 1 : 0; fat64 < 2; fat64++) {
+        uint64_t pos = universal_header_size(n, fat64);
+        int overflow = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t a = 1ull << s[i].align;
+            pos = (pos + a - 1) & ~(a - 1);
+            s[i].offset = pos;
+            if (pos > UINT32_MAX || s[i].size > UINT32_MAX) overflow = 1;
+            pos += s[i].size;
+        }
+        if (!overflow || fat64) {
+            *need64 = fat64 || overflow;
+            return pos;
+        }
+    }
+    return 0;
+}
+
+void universal_write_header(const struct fat_slice *s, size_t n, int fat64, uint8_t *out) {
+    store32_be(out, fat64 ? FAT_MAGIC_64 : FAT_MAGIC);
+    store32_be(out + 4, (uint32_t)n);
+    for (size_t i = 0; i < n; i++) {
+        uint8_t *e = out + 8 + i * (fat64 ? 32 : 20);
+        store32_be(e, s[i].cputype);
+        store32_be(e + 4, s[i].cpusubtype);
+        if (fat64) {
+            store64_be(e + 8, s[i].offset);
+            store64_be(e + 16, s[i].size);
+            store32_be(e + 24, s[i].align);
+            store32_be(e + 28, 0);
+        } else {
+            store32_be(e + 8, (uint32_t)s[i].offset);
+            store32_be(e + 12, (uint32_t)s[i].size);
+            store32_be(e + 16, s[i].align);
+        }
+    }
+}
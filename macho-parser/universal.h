@@ -0,0 +1,49 @@
+#ifndef MACHO_UNIVERSAL_H
+#define MACHO_UNIVERSAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reading and laying out FAT (universal) containers for the tools that
+// rewrite binaries. A thin file is treated as a container with one slice.
+
+struct fat_slice {
+    uint32_t cputype;
+    uint32_t cpusubtype;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t align;        // log2
+};
+
+// Slices of `buf`. *is_fat is 0 for a thin Mach-O (one slice covering the
+// whole buffer), *is64 is set for FAT64 input. Returns 0 on success and a
+// malloc'd array in *out.
+int universal_read(const uint8_t *buf, size_t sz, struct fat_slice **out, size_t *n,
+                   int *is_fat, int *is64, char *errbuf, size_t errlen);
+
+// Same, when only the first `avail` bytes of a `file_size`-byte file are at
+// hand (they must cover the slice table).
+int universal_read_head(const uint8_t *buf, size_t avail, uint64_t file_size,
+                        struct fat_slice **out, size_t *n, int *is_fat, int *is64,
+                        char *errbuf, size_t errlen);
+
+// Same, but reads only the slice table from an open file of file_size
+// bytes; slice contents are never touched.
+int universal_read_fd(int fd, uint64_t file_size, struct fat_slice **out, size_t *n,
+                      int *is_fat, int *is64, char *errbuf, size_t errlen);
+
+// log2 alignment the linker uses for a CPU: 16 KiB for arm64, 4 KiB else.
+uint32_t universal_default_align(uint32_t cputype);
+
+// Assign offsets to slices (size and align must be set), in order, after
+// the header. Sets *need64 when an offset or size does not fit in 32 bits
+// (FAT64 is then required; pass force64 to use it regardless). Returns the
+// total file size.
+uint64_t universal_layout(struct fat_slice *s, size_t n, int force64, int *need64);
+
+// Serialize the big-endian FAT header for a laid-out slice table into out
+// (at least universal_header_size bytes).
+size_t universal_header_size(size_t n, int fat64);
+void universal_write_header(const struct fat_slice *s, size_t n, int fat64, uint8_t *out);
+
+#endif /* MACHO_UNIVERSAL_H */
@@ -0,0 +1,407 @@
+#include "xref.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/macho/loader.h"
+
+#include "arm64_decode.h"
+#include "macho_common.h"
+#include "parallel.h"
+
+struct raw_xref {
+    uint64_t target;
+    uint64_t from;
+    uint8_t kind;
+};
+
+struct xvec {
+    struct raw_xref *v;
+    size_t n;
+    size_t cap;
+    int oom;
+};
+
+static void xvec_push(struct xvec *x, uint64_t target, uint64_t from, uint8_t kind) {
+    if (x->n == x->cap) {
+        size_t ncap = x->cap ? x->cap * 2 : 1024;
+        struct raw_xref *nv = realloc(x->v, ncap * sizeof(*nv));
+        if (!nv) {
+            x->oom = 1;
+            return;
+        }
+        x->v = nv;
+        x->cap = ncap;
+    }
+    x->v[x->n].target = target;
+    x->v[x->n].from = from;
+    x->v[x->n].kind = kind;
+    x->n++;
+}
+
+// Register tracking state for one window. Bit 31 is never set: as a base
+// it means SP, as a destination XZR.
+struct regs {
+    uint64_t val[32];
+    uint64_t adrp_pc[32];
+    uint32_t known;
+    uint32_t pending;   // holds an ADRP page nobody has consumed yet
+};
+
+#define CALLER_SAVED 0x0007FFFFu  // x0-x18
+
+// Forget registers in `mask`; an ADRP page dropped without an add/ldr
+// consuming it is still a reference, so it is emitted as XREF_ADRP.
+static void kill_regs(struct regs *r, uint32_t mask, struct xvec *out) {
+    uint32_t drop = r->pending & mask;
+    while (drop) {
+        unsigned i = (unsigned)__builtin_ctz(drop);
+        drop &= drop - 1;
+        xvec_push(out, r->val[i], r->adrp_pc[i], XREF_ADRP);
+    }
+    r->known &= ~mask;
+    r->pending &= ~mask;
+}
+
+static void set_reg(struct regs *r, unsigned rd, uint64_t v, struct xvec *out) {
+    if (rd == 31) return;
+    kill_regs(r, 1u << rd, out);
+    r->val[rd] = v;
+    r->known |= 1u << rd;
+}
+
+static void scan_range(const uint8_t *code, uint64_t code_addr,
+                       uint64_t start, uint64_t end, struct xvec *out) {
+    struct regs r;
+    r.known = 0;
+    r.pending = 0;
+    struct a64_insn d;
+
+    for (uint64_t pc = start; pc + 4 <= end; pc += 4) {
+        // Apple arm64 code is always little-endian.
+        uint32_t w = load32_u(code + (pc - code_addr), 0);
+        a64_decode(w, &d);
+        uint32_t rd_bit = (d.rd == 31) ? 0 : (1u << d.rd);
+        uint32_t rn_bit = (d.rn == 31) ? 0 : (1u << d.rn);
+
+        switch (d.kind) {
+        case A64_ADRP:
+            set_reg(&r, d.rd, a64_pcrel_target(&d, pc), out);
+            if (rd_bit) {
+                r.pending |= rd_bit;
+                r.adrp_pc[d.rd] = pc;
+            }
+            break;
+        case A64_ADR: {
+            uint64_t t = a64_pcrel_target(&d, pc);
+            xvec_push(out, t, pc, XREF_ADR);
+            set_reg(&r, d.rd, t, out);
+            break;
+        }
+        case A64_ADD_IMM:
+            if (r.known & rn_bit) {
+                uint64_t t = r.val[d.rn] + (uint64_t)d.imm;
+                xvec_push(out, t, pc, XREF_ADRP_ADD);
+                r.pending &= ~rn_bit;
+                set_reg(&r, d.rd, t, out);
+            } else {
+                kill_regs(&r, rd_bit, out);
+            }
+            break;
+        case A64_LDST_UIMM:
+            if (r.known & rn_bit) {
+                xvec_push(out, r.val[d.rn] + (uint64_t)d.imm, pc, XREF_ADRP_LDST);
+                r.pending &= ~rn_bit;
+            }
+            if (d.is_load && !d.is_vec) kill_regs(&r, rd_bit, out);
+            break;
+        case A64_LDST_REG:
+        case A64_LDST_PAIR: {
+            // SIMD/FP loads leave the X registers alone; writeback forms
+            // replace the base, and pair loads also write rt2.
+            uint32_t w = d.wback ? rn_bit : 0;
+            if (d.is_load && !d.is_vec) {
+                w |= rd_bit;
+                if (d.kind == A64_LDST_PAIR && d.rt2 != 31) w |= 1u << d.rt2;
+            }
+            kill_regs(&r, w, out);
+            break;
+        }
+        case A64_LDR_LIT:
+            xvec_push(out, a64_pcrel_target(&d, pc), pc, XREF_LDR_LIT);
+            if (!d.is_vec) kill_regs(&r, rd_bit, out);
+            break;
+        case A64_BL:
+            xvec_push(out, a64_pcrel_target(&d, pc), pc, XREF_CALL);
+            kill_regs(&r, CALLER_SAVED | (1u << 30), out);
+            break;
+        case A64_BLR:
+            kill_regs(&r, CALLER_SAVED | (1u << 30), out);
+            break;
+        case A64_B:
+            xvec_push(out, a64_pcrel_target(&d, pc), pc, XREF_JUMP);
+            kill_regs(&r, 0xFFFFFFFFu, out);
+            break;
+        case A64_B_COND:
+        case A64_CBZ:
+        case A64_TBZ:
+            xvec_push(out, a64_pcrel_target(&d, pc), pc, XREF_COND);
+            break;
+        case A64_BR:
+        case A64_RET:
+            kill_regs(&r, 0xFFFFFFFFu, out);
+            break;
+        default:
+            // Unknown data processing: assume it writes rd.
+            kill_regs(&r, rd_bit, out);
+            break;
+        }
+    }
+    kill_regs(&r, 0xFFFFFFFFu, out);
+}
+
+struct xref_job {
+    const uint8_t *code;
+    uint64_t code_addr;
+    uint64_t code_end;
+    const uint64_t *funcs;
+    size_t nfuncs;
+    struct xvec *per_worker;
+};
+
+static void xref_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    struct xref_job *job = ctx;
+    struct xvec *out = &job->per_worker[worker];
+    for (size_t i = begin; i < end; i++) {
+        uint64_t fs = job->funcs[i];
+        uint64_t fe = (i + 1 < job->nfuncs) ? job->funcs[i + 1] : job->code_end;
+        scan_range(job->code, job->code_addr, fs, fe, out);
+    }
+}
+
+static int cmp_raw(const void *a, const void *b) {
+    const struct raw_xref *x = a;
+    const struct raw_xref *y = b;
+    if (x->target != y->target) return (x->target > y->target) - (x->target < y->target);
+    return (x->from > y->from) - (x->from < y->from);
+}
+
+// Min-heap of worker ids keyed by each worker's next unmerged ref, so the
+// merge costs O(log nthreads) per ref instead of a scan of every run.
+struct merge_heap {
+    const struct xvec *vecs;
+    const size_t *head;
+    unsigned *w;
+    unsigned n;
+};
+
+static int heap_less(const struct merge_heap *h, unsigned a, unsigned b) {
+    return cmp_raw(&h->vecs[a].v[h->head[a]], &h->vecs[b].v[h->head[b]]) < 0;
+}
+
+static void heap_down(struct merge_heap *h, unsigned i) {
+    for (;;) {
+        unsigned l = 2 * i + 1;
+        unsigned m = i;
+        if (l < h->n && heap_less(h, h->w[l], h->w[m])) m = l;
+        if (l + 1 < h->n && heap_less(h, h->w[l + 1], h->w[m])) m = l + 1;
+        if (m == i) return;
+        unsigned t = h->w[i];
+        h->w[i] = h->w[m];
+        h->w[m] = t;
+        i = m;
+    }
+}
+
+static void sort_worker(size_t begin, size_t end, unsigned worker, void *ctx) {
+    (void)worker;
+    struct xvec *vecs = ctx;
+    for (size_t i = begin; i < end; i++) {
+        if (vecs[i].n > 1) qsort(vecs[i].v, vecs[i].n, sizeof(struct raw_xref), cmp_raw);
+    }
+}
+
+int xref_build(const struct macho_image *img, unsigned nthreads,
+               struct xref_index *out, char *errbuf, size_t errlen) {
+    memset(out, 0, sizeof(*out));
+    if (img->cputype != (uint32_t)CPU_TYPE_ARM64) {
+        snprintf(errbuf, errlen, "xrefs need an arm64 slice");
+        return -1;
+    }
+    const struct macho_section *text = macho_image_section(img, "__TEXT", "__text");
+    if (!text || text->size == 0) {
+        snprintf(errbuf, errlen, "no __TEXT,__text section");
+        return -1;
+    }
+    if ((uint64_t)text->offset + text->size > img->size) {
+        snprintf(errbuf, errlen, "__text out of bounds");
+        return -1;
+    }
+
+    uint64_t *funcs = NULL;
+    size_t nfuncs = macho_image_functions_in(img, text, &funcs);
+    if (nfuncs == 0) {
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    a64_decode_init();
+
+    if (nthreads == 0) nthreads = par_default_threads();
+    struct xvec *vecs = calloc(nthreads, sizeof(*vecs));
+    if (!vecs) {
+        free(funcs);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    struct xref_job job;
+    job.code = img->buf + text->offset;
+    job.code_addr = text->addr;
+    job.code_end = text->addr + (text->size & ~(uint64_t)3);
+    job.funcs = funcs;
+    job.nfuncs = nfuncs;
+    job.per_worker = vecs;
+    // Small grains keep the cursor moving past one giant function.
+    par_for(nfuncs, 16, nthreads, xref_worker, &job);
+    par_for(nthreads, 1, nthreads, sort_worker, vecs);
+
+    size_t total = 0;
+    int oom = 0;
+    for (unsigned w = 0; w < nthreads; w++) {
+        total += vecs[w].n;
+        oom |= vecs[w].oom;
+    }
+
+    out->nfunctions = nfuncs;
+    out->refs = malloc((total ? total : 1) * sizeof(*out->refs));
+    out->targets = malloc((total ? total : 1) * sizeof(*out->targets));
+    out->ref_start = malloc((total + 1) * sizeof(*out->ref_start));
+    if (oom || !out->refs || !out->targets || !out->ref_start) {
+        for (unsigned w = 0; w < nthreads; w++) free(vecs[w].v);
+        free(vecs);
+        free(funcs);
+        xref_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    // k-way merge of the per-worker sorted runs straight into CSR form.
+    size_t *head = calloc(nthreads, sizeof(*head));
+    unsigned *heap_w = malloc(nthreads * sizeof(*heap_w));
+    if (!head || !heap_w) {
+        free(head);
+        free(heap_w);
+        for (unsigned w = 0; w < nthreads; w++) free(vecs[w].v);
+        free(vecs);
+        free(funcs);
+        xref_free(out);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+    struct merge_heap heap = { vecs, head, heap_w, 0 };
+    for (unsigned w = 0; w < nthreads; w++) {
+        if (vecs[w].n) heap_w[heap.n++] = w;
+    }
+    for (unsigned i = heap.n / 2; i-- > 0;) heap_down(&heap, i);
+
+    size_t nt = 0;
+    for (size_t k = 0; k < total; k++) {
+        unsigned best = heap_w[0];
+        const struct raw_xref *r = &vecs[best].v[head[best]++];
+        if (head[best] == vecs[best].n) heap_w[0] = heap_w[--heap.n];
+        heap_down(&heap, 0);
+        if (nt == 0 || out->targets[nt - 1] != r->target) {
+            out->targets[nt] = r->target;
+            out->ref_start[nt] = (uint32_t)k;
+            nt++;
+        }
+        out->refs[k].from = r->from;
+        out->refs[k].kind = r->kind;
+    }
+    out->ref_start[nt] = (uint32_t)total;
+    out->ntargets = nt;
+    out->nrefs = total;
+
+    free(head);
+    free(heap_w);
+    for (unsigned w = 0; w < nthreads; w++) free(vecs[w].v);
+    free(vecs);
+    free(funcs);
+    return 0;
+}
+
+void xref_free(struct xref_index *idx) {
+    free(idx->targets);
+    free(idx->ref_start);
+    free(idx->refs);
+    memset(idx, 0, sizeof(*idx));
+}
+
+static size_t find_target(const struct xref_index *idx, uint64_t target) {
+    size_t lo = 0;
+    size_t hi = idx->ntargets;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->targets[mid] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < idx->ntargets && idx->targets[lo] == target) ? lo : idx->ntargets;
+}
+
+const struct xref_ref *xref_lookup(const struct xref_index *idx, uint64_t target,
+                                   size_t *count) {
+    size_t i = find_target(idx, target);
+    if (i == idx->ntargets) {
+        *count = 0;
+        return NULL;
+    }
+    *count = idx->ref_start[i + 1] - idx->ref_start[i];
+    return &idx->refs[idx->ref_start[i]];
+}
+
+const char *xref_kind_name(uint8_t kind) {
+    switch (kind) {
+        case XREF_ADRP_ADD: return "adrp+add";
+        case XREF_ADRP_LDST: return "adrp+ldst";
+        case XREF_ADR: return "adr";
+        case XREF_LDR_LIT: return "ldr-literal";
+        case XREF_CALL: return "call";
+        case XREF_JUMP: return "jump";
+        case XREF_COND: return "cond";
+        case XREF_ADRP: return "adrp";
+        default: return "?";
+    }
+}
+
+static void print_target(const struct macho_image *img, const struct xref_index *idx,
+                         size_t i) {
+    uint64_t t = idx->targets[i];
+    const struct macho_section *s = macho_image_section_for_vm(img, t);
+    uint32_t n = idx->ref_start[i + 1] - idx->ref_start[i];
+    if (s) {
+        printf("0x%llx %s,%s refs=%u\n", (unsigned long long)t, s->segname, s->sectname, n);
+    } else {
+        printf("0x%llx <unmapped> refs=%u\n", (unsigned long long)t, n);
+    }
+    for (uint32_t k = idx->ref_start[i]; k < idx->ref_start[i + 1]; k++) {
+        printf("     <- 0x%llx %s\n", (unsigned long long)idx->refs[k].from,
+               xref_kind_name(idx->refs[k].kind));
+    }
+}
+
+void xref_print(const struct macho_image *img, const struct xref_index *idx,
+                int only_target, uint64_t target) {
+    printf("== Cross-references (__TEXT,__text) ==\n");
+    printf("functions=%zu targets=%zu refs=%zu\n", idx->nfunctions, idx->ntargets, idx->nrefs);
+    if (only_target) {
+        size_t i = find_target(idx, target);
+        if (i == idx->ntargets) {
+            printf("0x%llx: no references\n", (unsigned long long)target);
+        } else {
+            print_target(img, idx, i);
+        }
+        return;
+    }
+    for (size_t i = 0; i < idx->ntargets; i++) print_target(img, idx, i);
+}
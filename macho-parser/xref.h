@@ -0,0 +1,66 @@
+#ifndef MACHO_XREF_H
+#define MACHO_XREF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macho_image.h"
+
+// Cross-reference pass over __TEXT,__text (arm64 only).
+//
+// Every function (from LC_FUNCTION_STARTS, else the symbol table) is scanned
+// with the table-driven decoder while tracking which registers hold a known
+// address: ADRP seeds a page, ADD/LDR/STR off a known base materialize a full
+// address. Tracking is reset at function entry and after any instruction
+// with no fallthrough, and BL/BLR clobber x0-x18, so a window never leaks
+// state across a call or an unconditional jump. BL/B/B.cond/CBZ/TBZ targets
+// are recorded as well.
+//
+// The result is a CSR index keyed by target address: targets[] is sorted and
+// unique, and refs[ref_start[i] .. ref_start[i+1]) are the instructions that
+// reference targets[i], sorted by address.
+
+enum xref_kind {
+    XREF_ADRP_ADD = 0,  // adrp + add
+    XREF_ADRP_LDST,     // adrp (+ add) + ldr/str [xN, #off]
+    XREF_ADR,
+    XREF_LDR_LIT,
+    XREF_CALL,          // bl
+    XREF_JUMP,          // b
+    XREF_COND,          // b.cond / cbz / cbnz / tbz / tbnz
+    XREF_ADRP,          // bare page reference with no resolving add/ldr seen
+    XREF_KIND_COUNT
+};
+
+struct xref_ref {
+    uint64_t from;      // address of the referencing instruction
+    uint8_t kind;
+};
+
+struct xref_index {
+    uint64_t *targets;
+    uint32_t *ref_start;    // ntargets + 1 entries
+    struct xref_ref *refs;
+    size_t ntargets;
+    size_t nrefs;
+    size_t nfunctions;
+};
+
+// Builds the index. nthreads == 0 uses every online CPU. Returns 0 on
+// success, -1 if the image has no arm64 __text or on allocation failure.
+int xref_build(const struct macho_image *img, unsigned nthreads,
+               struct xref_index *out, char *errbuf, size_t errlen);
+void xref_free(struct xref_index *idx);
+
+// References to exactly `target` (NULL/0 if none).
+const struct xref_ref *xref_lookup(const struct xref_index *idx, uint64_t target,
+                                   size_t *count);
+
+const char *xref_kind_name(uint8_t kind);
+
+// Print the index (or only `target` when only_target is set) in
+// macho_inspect's text style.
+void xref_print(const struct macho_image *img, const struct xref_index *idx,
+                int only_target, uint64_t target);
+
+#endif /* MACHO_XREF_H */
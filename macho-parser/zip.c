@@ -0,0 +1,257 @@
+#include "zip.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inflate.h"
+
+#define SIG_LOCAL   0x04034b50u
+#define SIG_CENTRAL 0x02014b50u
+#define SIG_EOCD    0x06054b50u
+#define SIG_EOCD64  0x06064b50u
+#define SIG_LOC64   0x07064b50u
+
+// Zip fields are little-endian regardless of host.
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static uint64_t le64(const uint8_t *p) {
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+// The EOCD record sits in the last 22 + 65535 (max comment) bytes.
+static const uint8_t *find_eocd(const uint8_t *d, size_t size) {
+    if (size < 22) return NULL;
+    size_t lo = size > 22 + 65535 ? size - 22 - 65535 : 0;
+    for (size_t i = size - 22 + 1; i-- > lo;) {
+        if (le32(d + i) == SIG_EOCD && i + 22 + le16(d + i + 20) == size) return d + i;
+    }
+    // Tolerate trailing junk after the comment.
+    for (size_t i = size - 22 + 1; i-- > lo;) {
+        if (le32(d + i) == SIG_EOCD) return d + i;
+    }
+    return NULL;
+}
+
+// Apply a ZIP64 extended-information extra field: only the fields whose
+// 32-bit central-directory value is 0xffffffff are present, in this order.
+static void apply_zip64(const uint8_t *extra, size_t len, struct zip_entry *e,
+                        int need_size, int need_comp, int need_off) {
+    size_t p = 0;
+    while (p + 4 <= len) {
+        uint16_t id = le16(extra + p);
+        uint16_t sz = le16(extra + p + 2);
+        if (p + 4 + sz > len) return;
+        if (id == 0x0001) {
+            const uint8_t *f = extra + p + 4;
+            size_t k = 0;
+            if (need_size && k + 8 <= sz) { e->size = le64(f + k); k += 8; }
+            if (need_comp && k + 8 <= sz) { e->comp_size = le64(f + k); k += 8; }
+            if (need_off && k + 8 <= sz) { e->local_offset = le64(f + k); }
+            return;
+        }
+        p += 4 + (size_t)sz;
+    }
+}
+
+int zip_open(struct zip_archive *za, const uint8_t *data, size_t size,
+             char *errbuf, size_t errlen) {
+    memset(za, 0, sizeof(*za));
+    const uint8_t *eocd = find_eocd(data, size);
+    if (!eocd) {
+        snprintf(errbuf, errlen, "not a zip archive (no end of central directory)");
+        return -1;
+    }
+    uint64_t count = le16(eocd + 10);
+    uint64_t cd_size = le32(eocd + 12);
+    uint64_t cd_off = le32(eocd + 16);
+
+    size_t eocd_pos = (size_t)(eocd - data);
+    if (eocd_pos >= 20 && le32(eocd - 20) == SIG_LOC64) {
+        uint64_t rec = le64(eocd - 20 + 8);
+        if (rec > size || size - rec < 56 || le32(data + rec) != SIG_EOCD64) {
+            snprintf(errbuf, errlen, "bad ZIP64 end of central directory");
+            return -1;
+        }
+        count = le64(data + rec + 32);
+        cd_size = le64(data + rec + 40);
+        cd_off = le64(data + rec + 48);
+    }
+    if (cd_off > size || cd_size > size - cd_off || count > cd_size / 46) {
+        snprintf(errbuf, errlen, "central directory out of bounds");
+        return -1;
+    }
+
+    za->entries = calloc(count ? (size_t)count : 1, sizeof(*za->entries));
+    za->names = malloc((size_t)cd_size + 1);
+    if (!za->entries || !za->names) {
+        zip_close(za);
+        snprintf(errbuf, errlen, "out of memory");
+        return -1;
+    }
+
+    const uint8_t *p = data + cd_off;
+    const uint8_t *end = p + cd_size;
+    char *names = za->names;
+    for (uint64_t i = 0; i < count; i++) {
+        if ((size_t)(end - p) < 46 || le32(p) != SIG_CENTRAL) {
+            zip_close(za);
+            snprintf(errbuf, errlen, "bad central directory entry %llu", (unsigned long long)i);
+            return -1;
+        }
+        size_t nlen = le16(p + 28);
+        size_t xlen = le16(p + 30);
+        size_t clen = le16(p + 32);
+        if ((size_t)(end - p) - 46 < nlen + xlen + clen) {
+            zip_close(za);
+            snprintf(errbuf, errlen, "truncated central directory entry %llu",
+                     (unsigned long long)i);
+            return -1;
+        }
+        struct zip_entry *e = &za->entries[za->n++];
+        e->flags = le16(p + 8);
+        e->method = le16(p + 10);
+        e->crc32 = le32(p + 16);
+        e->comp_size = le32(p + 20);
+        e->size = le32(p + 24);
+        e->local_offset = le32(p + 42);
+        apply_zip64(p + 46 + nlen, xlen, e, e->size == 0xffffffffu,
+                    e->comp_size == 0xffffffffu, e->local_offset == 0xffffffffu);
+        // Names are shorter than their entries, so they fit in cd_size.
+        memcpy(names, p + 46, nlen);
+        names[nlen] = '\0';
+        e->name = names;
+        names += nlen + 1;
+        p += 46 + nlen + xlen + clen;
+    }
+    za->data = data;
+    za->size = size;
+    return 0;
+}
+
+void zip_close(struct zip_archive *za) {
+    free(za->entries);
+    free(za->names);
+    memset(za, 0, sizeof(*za));
+}
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+    }
+}
+
+// Slicing-by-8: eight table lookups per 8 input bytes.
+uint32_t zip_crc32(uint32_t crc, const uint8_t *p, size_t n) {
+    pthread_once(&crc_once, crc_init);
+    crc = ~crc;
+    while (n >= 8) {
+        uint32_t a = crc ^ le32(p);
+        uint32_t b = le32(p + 4);
+        crc = crc_table[7][a & 0xff] ^ crc_table[6][(a >> 8) & 0xff] ^
+              crc_table[5][(a >> 16) & 0xff] ^ crc_table[4][a >> 24] ^
+              crc_table[3][b & 0xff] ^ crc_table[2][(b >> 8) & 0xff] ^
+              crc_table[1][(b >> 16) & 0xff] ^ crc_table[0][b >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+int zip_reader_open(struct zip_reader *zr, const struct zip_archive *za,
+                    const struct zip_entry *e, char *errbuf, size_t errlen) {
+    memset(zr, 0, sizeof(*zr));
+    zr->e = e;
+    if (e->flags & 1) {
+        snprintf(errbuf, errlen, "%s: encrypted member", e->name);
+        return -1;
+    }
+    uint64_t lo = e->local_offset;
+    if (lo > za->size || za->size - lo < 30 || le32(za->data + lo) != SIG_LOCAL) {
+        snprintf(errbuf, errlen, "%s: bad local header", e->name);
+        return -1;
+    }
+    // The local name/extra lengths may differ from the central ones.
+    uint64_t start = lo + 30 + le16(za->data + lo + 26) + le16(za->data + lo + 28);
+    if (start > za->size || e->comp_size > za->size - start) {
+        snprintf(errbuf, errlen, "%s: member data out of bounds", e->name);
+        return -1;
+    }
+    zr->src = za->data + start;
+    if (e->method == 0) {
+        if (e->comp_size != e->size) {
+            snprintf(errbuf, errlen, "%s: stored member size mismatch", e->name);
+            return -1;
+        }
+    } else if (e->method == 8) {
+        inflate_init(&zr->inf, zr->src, (size_t)e->comp_size);
+    } else {
+        snprintf(errbuf, errlen, "%s: unsupported compression method %u", e->name, e->method);
+        return -1;
+    }
+    return 0;
+}
+
+int zip_reader_read(struct zip_reader *zr, uint8_t *dst, size_t cap, size_t *got,
+                    char *errbuf, size_t errlen) {
+    const struct zip_entry *e = zr->e;
+    *got = zr->got;
+    if (zr->done) return 0;
+
+    int rc;
+    size_t n = zr->got;
+    if (e->method == 0) {
+        n = e->size < cap ? (size_t)e->size : cap;
+        if (n < zr->got) n = zr->got;
+        memcpy(dst + zr->got, zr->src + zr->got, n - zr->got);
+        rc = n == e->size ? 0 : 1;
+    } else {
+        int irc = inflate_more(&zr->inf, dst, cap, &n);
+        if (irc == INFLATE_ERROR) {
+            snprintf(errbuf, errlen, "%s: corrupt deflate data", e->name);
+            return -1;
+        }
+        rc = irc == INFLATE_DONE ? 0 : 1;
+        if (rc == 0 && n != e->size) {
+            snprintf(errbuf, errlen, "%s: inflated to %zu bytes, expected %llu", e->name, n,
+                     (unsigned long long)e->size);
+            return -1;
+        }
+    }
+    zr->crc = zip_crc32(zr->crc, dst + zr->got, n - zr->got);
+    zr->got = n;
+    if (rc == 0 && zr->crc != e->crc32) {
+        snprintf(errbuf, errlen, "%s: CRC mismatch", e->name);
+        return -1;
+    }
+    zr->done = rc == 0;
+    *got = n;
+    return rc;
+}
+
+int zip_read(const struct zip_archive *za, const struct zip_entry *e, uint8_t *dst,
+             size_t cap, size_t *got, char *errbuf, size_t errlen) {
+    struct zip_reader zr;
+    *got = 0;
+    if (zip_reader_open(&zr, za, e, errbuf, errlen) != 0) return -1;
+    return zip_reader_read(&zr, dst, cap, got, errbuf, errlen);
+}
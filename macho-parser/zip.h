@@ -0,0 +1,67 @@
+#ifndef MACHO_ZIP_H
+#define MACHO_ZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inflate.h"
+
+// Read-only zip (.ipa) access on a mapped file.
+//
+// Only the central directory is parsed up front; member data is located
+// through its local header when asked for. Stored (0) and deflated (8)
+// members are supported, including ZIP64 sizes and offsets. Encrypted
+// members are listed but cannot be read.
+
+struct zip_entry {
+    const char *name;          // NUL-terminated (copied out of the archive)
+    uint64_t comp_size;
+    uint64_t size;
+    uint64_t local_offset;
+    uint32_t crc32;
+    uint16_t method;
+    uint16_t flags;            // bit 0: encrypted
+};
+
+struct zip_archive {
+    const uint8_t *data;
+    size_t size;
+    struct zip_entry *entries;
+    size_t n;
+    char *names;
+};
+
+// Returns 0 on success, -1 if the buffer is not a readable zip.
+int zip_open(struct zip_archive *za, const uint8_t *data, size_t size,
+             char *errbuf, size_t errlen);
+void zip_close(struct zip_archive *za);
+
+// Up to `cap` leading bytes of the member into dst, inflating only as far
+// as needed. Returns 0 when the whole member was read (and its CRC-32
+// checked), 1 when it stopped at cap, -1 on error.
+int zip_read(const struct zip_archive *za, const struct zip_entry *e, uint8_t *dst,
+             size_t cap, size_t *got, char *errbuf, size_t errlen);
+
+// A member read in rounds: each zip_reader_read continues where the last
+// one stopped, so growing the buffer round by round inflates every byte
+// once. dst must hold the bytes of the earlier rounds (realloc keeps them).
+struct zip_reader {
+    const struct zip_entry *e;
+    const uint8_t *src;
+    size_t got;                // bytes delivered so far
+    uint32_t crc;              // of those bytes
+    int done;
+    struct inflate_state inf;
+};
+
+int zip_reader_open(struct zip_reader *zr, const struct zip_archive *za,
+                    const struct zip_entry *e, char *errbuf, size_t errlen);
+
+// Extends dst to `cap` bytes of the member. Same returns as zip_read;
+// *got is the total so far.
+int zip_reader_read(struct zip_reader *zr, uint8_t *dst, size_t cap, size_t *got,
+                    char *errbuf, size_t errlen);
+
+uint32_t zip_crc32(uint32_t crc, const uint8_t *p, size_t n);
+
+#endif /* MACHO_ZIP_H */